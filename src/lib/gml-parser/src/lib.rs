@@ -31,9 +31,12 @@ graph [
 
 pub mod gml;
 mod parser;
+mod reader;
 
 use nom::Finish;
 
+pub use reader::parse_reader;
+
 /// Parse the graph string into a [`gml::Gml`] object. If the graph contains syntax errors, a
 /// human-readable error message will be returned.
 /// ```
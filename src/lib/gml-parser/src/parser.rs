@@ -64,13 +64,19 @@ pub fn item<'a, E: GmlParseError<'a>>(input: &'a str) -> IResult<&str, GmlItem,
     }
 }
 
-/// Parse a GML graph.
-pub fn gml<'a, E: GmlParseError<'a>>(input: &'a str) -> IResult<&str, Gml, E> {
+/// Parse the start of a GML graph, up to the graph's first item.
+pub fn header<'a, E: GmlParseError<'a>>(input: &'a str) -> IResult<&str, (), E> {
     let (input, _) = multispace0(input)?;
     let (input, _) = tag("graph")(input)?;
     let (input, _) = space0(input)?;
     let (input, _) = tag("[")(input)?;
     let (input, _) = newline(input)?;
+    Ok((input, ()))
+}
+
+/// Parse a GML graph.
+pub fn gml<'a, E: GmlParseError<'a>>(input: &'a str) -> IResult<&str, Gml, E> {
+    let (input, _) = header(input)?;
 
     let (input, (items, _)) = nom::multi::many_till(item, tag("]"))(input)?;
 
@@ -0,0 +1,195 @@
+/*!
+Incremental parsing of a GML graph from a reader.
+*/
+
+use std::collections::HashMap;
+use std::io::BufRead;
+
+use nom::character::complete::multispace0;
+use nom::error::VerboseError;
+use nom::IResult;
+
+use crate::gml::{Gml, GmlItem};
+use crate::parser;
+
+type ParseResult<'a, T> = IResult<&'a str, T, VerboseError<&'a str>>;
+
+/// Lines of the graph that have been read but not yet parsed.
+struct LineBuffer<R> {
+    reader: R,
+    buf: String,
+    /// The line number of the start of `buf`, starting at 0.
+    line: usize,
+    eof: bool,
+}
+
+impl<R: BufRead> LineBuffer<R> {
+    fn new(reader: R) -> Self {
+        Self {
+            reader,
+            buf: String::new(),
+            line: 0,
+            eof: false,
+        }
+    }
+
+    fn read_lines(&mut self, count: usize) -> Result<(), String> {
+        for _ in 0..count {
+            let len = self
+                .reader
+                .read_line(&mut self.buf)
+                .map_err(|e| format!("Failed to read the graph: {e}"))?;
+            if len == 0 {
+                self.eof = true;
+                break;
+            }
+        }
+        Ok(())
+    }
+
+    /// Run `parser` on the buffered lines, and remove the lines that were parsed from the buffer.
+    /// If the parser fails, more lines are read and the parser is retried until either it
+    /// succeeds, it fails with an unrecoverable error, or there's nothing more to read. Since the
+    /// input is always a whole number of lines and no GML item ends part-way through a line, a
+    /// parser will never succeed on a partial item.
+    fn parse<T>(&mut self, parser: impl Fn(&str) -> ParseResult<T>) -> Result<T, String> {
+        // read more lines each time so that large items aren't re-parsed too many times
+        let mut lines_to_read = 1;
+
+        loop {
+            let err = match parser(&self.buf) {
+                Ok((remaining, x)) => {
+                    let parsed_len = self.buf.len() - remaining.len();
+                    self.line += self.buf[..parsed_len].matches('\n').count();
+                    self.buf.drain(..parsed_len);
+                    return Ok(x);
+                }
+                Err(nom::Err::Error(_)) if !self.eof => None,
+                Err(nom::Err::Error(e) | nom::Err::Failure(e)) => Some(e),
+                Err(nom::Err::Incomplete(_)) => unreachable!("We only use complete parsers"),
+            };
+
+            if let Some(e) = err {
+                return Err(format!(
+                    "Error in the graph after line {}:\n{}",
+                    self.line,
+                    nom::error::convert_error(self.buf.as_str(), e),
+                ));
+            }
+
+            self.read_lines(lines_to_read)?;
+            lines_to_read *= 2;
+        }
+    }
+}
+
+/// Parse a GML graph from a reader, keeping only the unparsed part of the current item in memory.
+/// If the graph contains syntax errors, a human-readable error message will be returned.
+pub fn parse_reader(reader: impl BufRead) -> Result<Gml<'static>, String> {
+    let mut lines = LineBuffer::new(reader);
+
+    #[allow(clippy::redundant_closure)]
+    lines.parse(|input| parser::header(input))?;
+
+    let mut nodes = Vec::new();
+    let mut edges = Vec::new();
+    let mut directed = None;
+    let mut others = HashMap::new();
+
+    loop {
+        let item = lines.parse(|input| {
+            let (input, _) = multispace0::<_, VerboseError<&str>>(input)?;
+            if let Some(input) = input.strip_prefix(']') {
+                return Ok((input, None));
+            }
+            let (input, item) = parser::item::<VerboseError<&str>>(input)?;
+            Ok((input, Some(item.upgrade_to_owned())))
+        })?;
+
+        match item {
+            Some(GmlItem::Node(node)) => nodes.push(node),
+            Some(GmlItem::Edge(edge)) => edges.push(edge),
+            Some(GmlItem::Directed(x)) => {
+                if directed.replace(x).is_some() {
+                    return Err("The 'directed' key must only be specified once".into());
+                }
+            }
+            Some(GmlItem::KeyValue((key, value))) => {
+                if others.insert(key, value).is_some() {
+                    return Err("Duplicate keys are not supported".into());
+                }
+            }
+            None => break,
+        }
+    }
+
+    Ok(Gml {
+        // GML graphs are undirected by default
+        directed: directed.unwrap_or(false),
+        nodes,
+        edges,
+        other: others,
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::gml::Value;
+
+    const GRAPH: &str = r#"graph [
+  directed 1
+  label "a
+multi-line string"
+  node [
+    id 0
+    label "Node 0"
+  ]
+  node [
+    id 1
+  ]
+  edge [
+    source 0
+    target 1
+    latency "5 ms"
+    packet_loss 0.5
+  ]
+]
+"#;
+
+    #[test]
+    fn test_matches_parse() {
+        let graph = parse_reader(GRAPH.as_bytes()).unwrap();
+        assert_eq!(graph, crate::parse(GRAPH).unwrap());
+        assert!(graph.directed);
+        assert_eq!(graph.nodes.len(), 2);
+        assert_eq!(graph.edges.len(), 1);
+        assert_eq!(
+            graph.other["label"],
+            Value::Str("a\nmulti-line string".into())
+        );
+    }
+
+    #[test]
+    fn test_small_reads() {
+        // a reader that returns at most one byte at a time
+        let reader = std::io::BufReader::with_capacity(1, GRAPH.as_bytes());
+        assert_eq!(parse_reader(reader).unwrap(), crate::parse(GRAPH).unwrap());
+    }
+
+    #[test]
+    fn test_errors() {
+        // missing closing bracket
+        let graph = GRAPH.trim_end().strip_suffix(']').unwrap();
+        assert!(parse_reader(graph.as_bytes()).is_err());
+
+        // edge without a target
+        let graph = GRAPH.replace("    target 1\n", "");
+        let err = parse_reader(graph.as_bytes()).unwrap_err();
+        assert!(err.contains("after line 11"), "{err}");
+
+        // duplicate key
+        let graph = GRAPH.replace("  directed 1\n", "  directed 1\n  directed 0\n");
+        assert!(parse_reader(graph.as_bytes()).is_err());
+    }
+}
@@ -6,36 +6,89 @@
 
 #include <dlfcn.h>
 #include <execinfo.h>
-#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "lib/shim/shim_api.h"
+
 #ifdef DEBUG
 #define debuglog(...) fprintf(stderr, __VA_ARGS__)
 #else
 #define debuglog(...)
 #endif
 
-// Caches whether or not a memory address is from libssl.so
-typedef struct {
-    void* addr;
-    bool is_libssl;
-} bt_cache_entry_t;
-
-// Lock for safely accessing this lib's global state from multiple threads.
-// TODO: We currently do no error checking when operating on this lock.
-static pthread_mutex_t global_state_lock = PTHREAD_MUTEX_INITIALIZER;
-
+// The environment variable that Shadow sets to enable the cost model. When the
+// cost model is enabled, we charge the calling thread simulated CPU time for
+// the crypto operations that we intercept, whether or not we skip them.
+#define COST_MODEL_ENV_VAR "SHADOW_OPENSSL_CRYPTO_COST_MODEL"
+
+// Rough costs of crypto operations on a ~3 GHz x86-64 CPU with AES-NI, from
+// published `openssl speed -evp` results. Per-byte costs are in picoseconds so
+// that sub-nanosecond costs can be summed without rounding each call to zero.
+#define COST_PER_CALL_NS 100
+#define COST_AES_CTR_PS_PER_BYTE 200
+#define COST_AES_GCM_PS_PER_BYTE 250
+#define COST_CHACHA20_POLY1305_PS_PER_BYTE 600
+// Ciphers that we don't have a cost for, such as AES-CBC.
+#define COST_OTHER_CIPHER_PS_PER_BYTE 1000
+#define COST_X25519_NS 40000
+#define COST_ECDH_P256_NS 60000
+#define COST_RSA_2048_SIGN_NS 700000
+#define COST_ECDSA_P256_SIGN_NS 20000
+#define COST_ED25519_SIGN_NS 20000
+
+// Charged time is applied once a thread has accumulated at least this much.
+#define COST_APPLY_THRESHOLD_PS (1000 * 1000)
+
+// Object identifiers from OpenSSL's `obj_mac.h`, which are stable across
+// versions. We don't include the OpenSSL headers so that this lib is built the
+// same way regardless of which OpenSSL version the application uses.
+#define NID_rsaEncryption 6
+#define NID_X9_62_id_ecPublicKey 408
+#define NID_aes_128_gcm 895
+#define NID_aes_256_gcm 901
+#define NID_aes_128_ctr 904
+#define NID_aes_256_ctr 906
+#define NID_chacha20_poly1305 1018
+#define NID_X25519 1034
+#define NID_ED25519 1087
+
+// Caches whether or not a memory address is from libssl.so. Each entry is the
+// caller address shifted left by one, with the low bit set if the caller is in
+// libssl.so (user-space addresses fit in 47 bits), or 0 if the entry is empty.
+// Entries are claimed with a compare-and-swap and never change afterwards, so
+// no lock is needed to read or append to the cache.
+//
 // We use a small cache size: in ad-hoc experiments with tor-0.4.6.9, we observed
 // at most three callers of EVP_EncryptUpdate.
-#define EVP_BACKTRACE_CACHE_LEN 10
-static bt_cache_entry_t evp_backtrace_cache[EVP_BACKTRACE_CACHE_LEN];
-
-// For storing a pointer to the original EVP_EncryptUpdate function.
-typedef int EVP_EncryptUpdate_func(void*, unsigned char*, int*, const unsigned char*, int);
+#define BACKTRACE_CACHE_LEN 10
+static uintptr_t backtrace_cache[BACKTRACE_CACHE_LEN];
+
+// Whether the cost model is enabled. Only written by the constructor.
+static bool cost_model_enabled = false;
+
+// Picoseconds of CPU time charged to this thread that haven't been applied yet.
+// Applying time takes the host's shared memory lock, so we batch small charges
+// such as single AES blocks.
+static __thread uint64_t unapplied_cost_ps = 0;
+
+// For storing pointers to the original OpenSSL functions.
+typedef int EVP_Update_func(void*, unsigned char*, int*, const unsigned char*, int);
+typedef int EVP_PKEY_derive_func(void*, unsigned char*, size_t*);
+typedef int EVP_DigestSign_func(void*, unsigned char*, size_t*, const unsigned char*, size_t);
+typedef int ctx_getter_func(const void*);
+typedef void* ptr_getter_func(const void*);
 static void* evp_eu_funcptr = NULL;
+static void* evp_du_funcptr = NULL;
+static void* evp_pkey_derive_funcptr = NULL;
+static void* evp_digest_sign_funcptr = NULL;
+static void* evp_cipher_ctx_nid_funcptr = NULL;
+static void* evp_pkey_ctx_get0_pkey_funcptr = NULL;
+static void* evp_pkey_id_funcptr = NULL;
+static void* evp_md_ctx_pkey_ctx_funcptr = NULL;
 
 // Counters for verifying that interception is happening correctly.
 static unsigned long aes_e_cnt = 0;
@@ -45,122 +98,149 @@ static unsigned long crypto_ce_cnt = 0;
 static unsigned long crypto_cec_cnt = 0;
 static unsigned long evp_c_cnt = 0;
 static unsigned long evp_eu_cnt = 0;
+static unsigned long evp_du_cnt = 0;
+static unsigned long evp_pkey_derive_cnt = 0;
+static unsigned long evp_digest_sign_cnt = 0;
+
+static unsigned long _load(const unsigned long* cnt_ptr) {
+    return __atomic_load_n(cnt_ptr, __ATOMIC_RELAXED);
+}
 
 static void _print_counters() {
     debuglog("Counters: {'AES_encrypt':%lu, 'AES_decrypt':%lu, 'AES_ctr128_encrypt':%lu, "
              "'CRYPTO_ctr128_encrypt':%lu, 'CRYPTO_ctr128_encrypt_ctr32':%lu, "
-             "'EVP_Cipher':%lu, 'EVP_EncryptUpdate':%lu}\n",
-             aes_e_cnt, aes_d_cnt, aes_ce_cnt, crypto_ce_cnt, crypto_cec_cnt, evp_c_cnt,
-             evp_eu_cnt);
+             "'EVP_Cipher':%lu, 'EVP_EncryptUpdate':%lu, 'EVP_DecryptUpdate':%lu, "
+             "'EVP_PKEY_derive':%lu, 'EVP_DigestSign':%lu}\n",
+             _load(&aes_e_cnt), _load(&aes_d_cnt), _load(&aes_ce_cnt), _load(&crypto_ce_cnt),
+             _load(&crypto_cec_cnt), _load(&evp_c_cnt), _load(&evp_eu_cnt), _load(&evp_du_cnt),
+             _load(&evp_pkey_derive_cnt), _load(&evp_digest_sign_cnt));
 }
 
-static void _lock_global_state() {
-    int result = pthread_mutex_lock(&global_state_lock);
-    if (result != 0) {
-        abort();
-    }
-}
-
-static void _unlock_global_state() {
-    int result = pthread_mutex_unlock(&global_state_lock);
-    if (result != 0) {
-        abort();
+// Returns the first non-NULL symbol, for functions that were renamed in OpenSSL 3.
+static void* _dlsym_either(const char* name, const char* alt_name) {
+    void* ptr = dlsym(RTLD_NEXT, name);
+    if (ptr == NULL) {
+        ptr = dlsym(RTLD_NEXT, alt_name);
     }
+    return ptr;
 }
 
 __attribute__((constructor)) void _crypto_load() {
     debuglog("Loading the preloaded crypto interception lib\n");
 
-    _lock_global_state();
+    const char* cost_model = getenv(COST_MODEL_ENV_VAR);
+    cost_model_enabled = cost_model != NULL && strcmp(cost_model, "1") == 0;
 
-    // Initialize backtrace address cache pointers to NULL.
-    memset(evp_backtrace_cache, 0, sizeof(bt_cache_entry_t) * EVP_BACKTRACE_CACHE_LEN);
-
-    // Get a ref to the EVP_EncryptUpdate that would be called if we didn't preload.
+    // Get refs to the functions that would be called if we didn't preload.
     evp_eu_funcptr = dlsym(RTLD_NEXT, "EVP_EncryptUpdate");
+    evp_du_funcptr = dlsym(RTLD_NEXT, "EVP_DecryptUpdate");
+    evp_pkey_derive_funcptr = dlsym(RTLD_NEXT, "EVP_PKEY_derive");
+    evp_digest_sign_funcptr = dlsym(RTLD_NEXT, "EVP_DigestSign");
 
-    debuglog("dlsym for EVP_EncryptUpdate returned %p\n", evp_eu_funcptr);
+    // Accessors for choosing a cost. In OpenSSL 3 the old names are macros.
+    evp_cipher_ctx_nid_funcptr = _dlsym_either("EVP_CIPHER_CTX_nid", "EVP_CIPHER_CTX_get_nid");
+    evp_pkey_ctx_get0_pkey_funcptr = dlsym(RTLD_NEXT, "EVP_PKEY_CTX_get0_pkey");
+    evp_pkey_id_funcptr = _dlsym_either("EVP_PKEY_id", "EVP_PKEY_get_id");
+    evp_md_ctx_pkey_ctx_funcptr = _dlsym_either("EVP_MD_CTX_pkey_ctx", "EVP_MD_CTX_get_pkey_ctx");
 
-    _unlock_global_state();
+    debuglog("dlsym for EVP_EncryptUpdate returned %p\n", evp_eu_funcptr);
+    debuglog("dlsym for EVP_DecryptUpdate returned %p\n", evp_du_funcptr);
+    debuglog("Crypto cost model is %s\n", cost_model_enabled ? "enabled" : "disabled");
 }
 
 __attribute__((destructor)) void _crypto_unload() {
     debuglog("Unloading the preloaded crypto interception lib\n");
-
-    _lock_global_state();
     _print_counters();
-    _unlock_global_state();
 }
 
-static void _increment_unlocked(unsigned long* cnt_ptr) {
-    if ((++(*cnt_ptr) % 1000) == 0) {
+static void _increment(unsigned long* cnt_ptr) {
+    if ((__atomic_add_fetch(cnt_ptr, 1, __ATOMIC_RELAXED) % 1000) == 0) {
         _print_counters();
     }
 }
 
-static void _increment(unsigned long* cnt_ptr) {
-    _lock_global_state();
-    _increment_unlocked(cnt_ptr);
-    _unlock_global_state();
+// Charge the calling thread for `ps` picoseconds of CPU time, if the cost model
+// is enabled.
+static void _charge(uint64_t ps) {
+    if (!cost_model_enabled) {
+        return;
+    }
+
+    unapplied_cost_ps += ps;
+    if (unapplied_cost_ps >= COST_APPLY_THRESHOLD_PS) {
+        shim_api_add_cpu_latency(unapplied_cost_ps / 1000);
+        unapplied_cost_ps %= 1000;
+    }
+}
+
+// Charge for an EVP cipher operation on `len` bytes.
+static void _charge_cipher(uint64_t ps_per_byte, size_t len) {
+    _charge(COST_PER_CALL_NS * 1000 + ps_per_byte * (uint64_t)len);
+}
+
+static uint64_t _cipher_cost_ps_per_byte(void* cipher_ctx) {
+    if (cipher_ctx == NULL || evp_cipher_ctx_nid_funcptr == NULL) {
+        return COST_OTHER_CIPHER_PS_PER_BYTE;
+    }
+
+    switch (((ctx_getter_func*)evp_cipher_ctx_nid_funcptr)(cipher_ctx)) {
+        case NID_aes_128_ctr:
+        case NID_aes_256_ctr: return COST_AES_CTR_PS_PER_BYTE;
+        case NID_aes_128_gcm:
+        case NID_aes_256_gcm: return COST_AES_GCM_PS_PER_BYTE;
+        case NID_chacha20_poly1305: return COST_CHACHA20_POLY1305_PS_PER_BYTE;
+        default: return COST_OTHER_CIPHER_PS_PER_BYTE;
+    }
+}
+
+// Returns the key type of an `EVP_PKEY_CTX`, or 0 if unknown.
+static int _pkey_ctx_type(void* pkey_ctx) {
+    if (pkey_ctx == NULL || evp_pkey_ctx_get0_pkey_funcptr == NULL || evp_pkey_id_funcptr == NULL) {
+        return 0;
+    }
+
+    void* pkey = ((ptr_getter_func*)evp_pkey_ctx_get0_pkey_funcptr)(pkey_ctx);
+    if (pkey == NULL) {
+        return 0;
+    }
+
+    return ((ctx_getter_func*)evp_pkey_id_funcptr)(pkey);
 }
 
 void AES_encrypt(const unsigned char* in, unsigned char* out, const void* key) {
     _increment(&aes_e_cnt);
+    _charge(COST_AES_CTR_PS_PER_BYTE * 16);
 }
 
 void AES_decrypt(const unsigned char* in, unsigned char* out, const void* key) {
     _increment(&aes_d_cnt);
+    _charge(COST_AES_CTR_PS_PER_BYTE * 16);
 }
 
 void AES_ctr128_encrypt(const unsigned char* in, unsigned char* out, const void* key) {
     _increment(&aes_ce_cnt);
+    _charge(COST_AES_CTR_PS_PER_BYTE * 16);
 }
 
 void CRYPTO_ctr128_encrypt(const unsigned char* in, unsigned char* out, size_t len, ...) {
     _increment(&crypto_ce_cnt);
+    _charge(COST_AES_CTR_PS_PER_BYTE * (uint64_t)len);
     memmove(out, in, len);
 }
 
 void CRYPTO_ctr128_encrypt_ctr32(const unsigned char* in, unsigned char* out, size_t len, ...) {
     _increment(&crypto_cec_cnt);
+    _charge(COST_AES_CTR_PS_PER_BYTE * (uint64_t)len);
     memmove(out, in, len);
 }
 
 int EVP_Cipher(void* ctx, unsigned char* out, const unsigned char* in, unsigned int inl) {
     _increment(&evp_c_cnt);
+    _charge_cipher(_cipher_cost_ps_per_byte(ctx), inl);
     memmove(out, in, (size_t)inl);
     return 1;
 }
 
-static const bt_cache_entry_t* _get_cache_entry(void* addr) {
-    // An in-order traversal is fine since the cache is small.
-    // We can skip out early when we get to the first NULL pointer.
-    for (int i = 0; i < EVP_BACKTRACE_CACHE_LEN && evp_backtrace_cache[i].addr != NULL; i++) {
-        if (addr == evp_backtrace_cache[i].addr) {
-            return &evp_backtrace_cache[i];
-        }
-    }
-    return NULL;
-}
-
-static bool _cache_has_space() {
-    return (evp_backtrace_cache[EVP_BACKTRACE_CACHE_LEN - 1].addr == NULL);
-}
-
-static void _append_to_cache(void* addr, bool is_libssl) {
-    // Store at the first empty cache slot.
-    for (int i = 0; i < EVP_BACKTRACE_CACHE_LEN; i++) {
-        if (evp_backtrace_cache[i].addr == NULL) {
-            evp_backtrace_cache[i].addr = addr;
-            evp_backtrace_cache[i].is_libssl = is_libssl;
-
-            debuglog("Cached EVP_EncryptUpdate caller=%p, is_libssl=%s\n", addr,
-                     is_libssl ? "true" : "false");
-            break;
-        }
-    }
-}
-
 static bool _is_addr_in_libssl(void* addr) {
     bool found = false;
 
@@ -176,66 +256,148 @@ static bool _is_addr_in_libssl(void* addr) {
     return found;
 }
 
-int EVP_EncryptUpdate(void* cipher, unsigned char* out, int* outl, const unsigned char* in,
-                      int inl) {
-    // In the case of tor:
-    //   - calls from libssl are used for TLS and skipping will break TLS
-    //   - calls from tor are used for AES and can be skipped
-    // So we can skip the crypto op as long as the call is not made from libssl.
-    void* caller_addr = NULL;
-    bool caller_is_libssl = false;
-
-    {
-        // Get the backtrace addresses; we only need 2: our stack is in [0]
-        // and the caller's stack is in [1].
-        void* bt_addr_buf[2];
-
-        // We want to make sure we get the backtrace here and not in a helper
-        // function so that our stack offset math is correct.
-        int bt_len = backtrace(bt_addr_buf, 2);
-        if (bt_len == 2) {
-            caller_addr = bt_addr_buf[1];
+static bool _is_caller_libssl(void* addr) {
+    uintptr_t key = (uintptr_t)addr << 1;
+
+    // We use a cache first because checking the name of the library is expensive.
+    // An in-order traversal is fine since the cache is small.
+    // We can skip out early when we get to the first empty entry.
+    for (int i = 0; i < BACKTRACE_CACHE_LEN; i++) {
+        uintptr_t entry = __atomic_load_n(&backtrace_cache[i], __ATOMIC_ACQUIRE);
+        if (entry == 0) {
+            break;
+        }
+        if ((entry & ~(uintptr_t)1) == key) {
+            return (entry & 1) != 0;
         }
     }
 
-    if (caller_addr != NULL) {
-        _lock_global_state();
-
-        // We use a cache first because checking the name of the library is expensive.
-        const bt_cache_entry_t* entry = _get_cache_entry(caller_addr);
-
-        if (entry != NULL) {
-            // The answer we want is cached.
-            caller_is_libssl = entry->is_libssl;
-        } else {
-            // Fall back to check the caller backtrace symbols.
-            // This might be more expensive than just performing the crypto op, and we might have to
-            // perform the crypto op anyway depending on the result, but we do it anyway to maintain
-            // consistency in behavior.
-            caller_is_libssl = _is_addr_in_libssl(caller_addr);
-            // Cache it if there is space.
-            if (_cache_has_space()) {
-                _append_to_cache(caller_addr, caller_is_libssl);
-            }
+    // Fall back to check the caller backtrace symbols.
+    // This might be more expensive than just performing the crypto op, and we might have to
+    // perform the crypto op anyway depending on the result, but we do it anyway to maintain
+    // consistency in behavior.
+    bool is_libssl = _is_addr_in_libssl(addr);
+    uintptr_t new_entry = key | (is_libssl ? 1 : 0);
+
+    // Store at the first empty cache slot if there is space. If another thread
+    // stored the same caller first, there's nothing left to do.
+    for (int i = 0; i < BACKTRACE_CACHE_LEN; i++) {
+        uintptr_t expected = 0;
+        if (__atomic_compare_exchange_n(&backtrace_cache[i], &expected, new_entry, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+            debuglog("Cached EVP caller=%p, is_libssl=%s\n", addr, is_libssl ? "true" : "false");
+            break;
         }
-
-        if (!caller_is_libssl) {
-            // We will skip the crypto, increment the counter while we still hold the lock.
-            _increment_unlocked(&evp_eu_cnt);
+        if ((expected & ~(uintptr_t)1) == key) {
+            break;
         }
+    }
+
+    return is_libssl;
+}
 
-        _unlock_global_state();
+// In the case of tor:
+//   - calls from libssl are used for TLS and skipping will break TLS
+//   - calls from tor are used for AES and can be skipped
+// So we can skip the crypto op as long as the call is not made from libssl.
+// Decryption is never skipped, since the ciphertext may have been encrypted
+// outside of the simulation (or by libcrypto itself, e.g. for PEM and PKCS#12
+// files). Calls that aren't skipped are still charged if the cost model is
+// enabled, since the real crypto doesn't take any simulated time.
+static int _evp_update(void* funcptr, unsigned long* cnt_ptr, bool may_skip, void* caller_addr,
+                       void* cipher, unsigned char* out, int* outl, const unsigned char* in,
+                       int inl) {
+    if (inl > 0) {
+        _charge_cipher(_cipher_cost_ps_per_byte(cipher), (size_t)inl);
     }
 
-    if (caller_addr != NULL && !caller_is_libssl) {
+    if (may_skip && caller_addr != NULL && !_is_caller_libssl(caller_addr)) {
         // Skip the crypto in calls made from the application, e.g. tor.
-        // We already incremented the counter above.
+        _increment(cnt_ptr);
+        // For AEAD ciphers, a NULL `out` means that `in` is additional data.
+        if (out != NULL && inl > 0) {
+            memmove(out, in, (size_t)inl);
+        }
+        if (outl != NULL) {
+            *outl = inl;
+        }
         return 1; // success
-    } else if (evp_eu_funcptr != NULL) {
+    } else if (funcptr != NULL) {
         // Let openssl handle it.
-        return ((EVP_EncryptUpdate_func*)evp_eu_funcptr)(cipher, out, outl, in, inl);
+        return ((EVP_Update_func*)funcptr)(cipher, out, outl, in, inl);
     } else {
-        // We counldn't find openssl's EVP_EncryptUpdate function pointer.
+        // We counldn't find openssl's function pointer.
+        return 0; // failure
+    }
+}
+
+// Gets the caller's address. Must be inlined into the intercepted function so
+// that our stack offset math is correct.
+#define GET_CALLER_ADDR(caller_addr)                                                               \
+    do {                                                                                           \
+        /* Get the backtrace addresses; we only need 2: our stack is in [0]                        \
+         * and the caller's stack is in [1]. */                                                    \
+        void* bt_addr_buf[2];                                                                      \
+        int bt_len = backtrace(bt_addr_buf, 2);                                                    \
+        caller_addr = (bt_len == 2) ? bt_addr_buf[1] : NULL;                                       \
+    } while (0)
+
+int EVP_EncryptUpdate(void* cipher, unsigned char* out, int* outl, const unsigned char* in,
+                      int inl) {
+    void* caller_addr = NULL;
+    GET_CALLER_ADDR(caller_addr);
+    return _evp_update(
+        evp_eu_funcptr, &evp_eu_cnt, true, caller_addr, cipher, out, outl, in, inl);
+}
+
+int EVP_DecryptUpdate(void* cipher, unsigned char* out, int* outl, const unsigned char* in,
+                      int inl) {
+    _increment(&evp_du_cnt);
+    return _evp_update(evp_du_funcptr, &evp_du_cnt, false, NULL, cipher, out, outl, in, inl);
+}
+
+// Key exchange (e.g. X25519 in a TLS handshake). The result is needed to derive
+// the session keys, so this always runs the real operation.
+int EVP_PKEY_derive(void* ctx, unsigned char* key, size_t* keylen) {
+    if (evp_pkey_derive_funcptr == NULL) {
         return 0; // failure
     }
+
+    // A NULL `key` only queries the key length.
+    if (key != NULL) {
+        _increment(&evp_pkey_derive_cnt);
+        switch (_pkey_ctx_type(ctx)) {
+            case NID_X25519: _charge(COST_X25519_NS * 1000); break;
+            case NID_X9_62_id_ecPublicKey: _charge(COST_ECDH_P256_NS * 1000); break;
+            default: break;
+        }
+    }
+
+    return ((EVP_PKEY_derive_func*)evp_pkey_derive_funcptr)(ctx, key, keylen);
+}
+
+// Signing (e.g. the server's certificate verify message in a TLS handshake). The
+// peer verifies the signature, so this always runs the real operation.
+int EVP_DigestSign(void* ctx, unsigned char* sigret, size_t* siglen, const unsigned char* tbs,
+                   size_t tbslen) {
+    if (evp_digest_sign_funcptr == NULL) {
+        return 0; // failure
+    }
+
+    // A NULL `sigret` only queries the signature length.
+    if (sigret != NULL) {
+        _increment(&evp_digest_sign_cnt);
+        void* pkey_ctx = NULL;
+        if (evp_md_ctx_pkey_ctx_funcptr != NULL) {
+            pkey_ctx = ((ptr_getter_func*)evp_md_ctx_pkey_ctx_funcptr)(ctx);
+        }
+        switch (_pkey_ctx_type(pkey_ctx)) {
+            case NID_rsaEncryption: _charge(COST_RSA_2048_SIGN_NS * 1000); break;
+            case NID_X9_62_id_ecPublicKey: _charge(COST_ECDSA_P256_SIGN_NS * 1000); break;
+            case NID_ED25519: _charge(COST_ED25519_SIGN_NS * 1000); break;
+            default: break;
+        }
+    }
+
+    return ((EVP_DigestSign_func*)evp_digest_sign_funcptr)(ctx, sigret, siglen, tbs, tbslen);
 }
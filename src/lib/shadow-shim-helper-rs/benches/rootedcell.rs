@@ -0,0 +1,67 @@
+//! Compare the cost of accessing rooted cells to their std equivalents. Run with and without the
+//! `unchecked_root_tags` feature to see the cost of checking the roots.
+
+use std::cell::RefCell;
+use std::hint::black_box;
+
+use criterion::{criterion_group, criterion_main, Criterion};
+use shadow_shim_helper_rs::explicit_drop::ExplicitDrop;
+use shadow_shim_helper_rs::rootedcell::cell::RootedCell;
+use shadow_shim_helper_rs::rootedcell::rc::RootedRc;
+use shadow_shim_helper_rs::rootedcell::refcell::RootedRefCell;
+use shadow_shim_helper_rs::rootedcell::Root;
+
+const ITERATIONS: u64 = 10_000;
+
+pub fn criterion_benchmark(c: &mut Criterion) {
+    let root = Root::new();
+
+    {
+        let cell = RootedRefCell::new(&root, 0u64);
+        c.bench_function("rootedrefcell_borrow_mut", |b| {
+            b.iter(|| {
+                for _ in 0..ITERATIONS {
+                    *black_box(&cell).borrow_mut(&root) += 1;
+                }
+            })
+        });
+    }
+
+    {
+        let cell = RefCell::new(0u64);
+        c.bench_function("refcell_borrow_mut", |b| {
+            b.iter(|| {
+                for _ in 0..ITERATIONS {
+                    *black_box(&cell).borrow_mut() += 1;
+                }
+            })
+        });
+    }
+
+    {
+        let cell = RootedCell::new(&root, 0u64);
+        c.bench_function("rootedcell_get_set", |b| {
+            b.iter(|| {
+                for _ in 0..ITERATIONS {
+                    let cell = black_box(&cell);
+                    cell.set(&root, cell.get(&root) + 1);
+                }
+            })
+        });
+    }
+
+    {
+        let rc = RootedRc::new(&root, 0u64);
+        c.bench_function("rootedrc_clone_drop", |b| {
+            b.iter(|| {
+                for _ in 0..ITERATIONS {
+                    black_box(rc.clone(&root)).explicit_drop(&root);
+                }
+            })
+        });
+        rc.explicit_drop(&root);
+    }
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
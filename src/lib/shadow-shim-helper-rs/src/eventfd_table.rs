@@ -0,0 +1,277 @@
+//! The counters of a host's eventfds, placed in shared memory so that the shim can read and write
+//! an eventfd without a round trip to Shadow when that can't block or change what any blocked
+//! thread, poll, or epoll would see.
+//!
+//! Shadow allocates a slot for an eventfd when it's created, and maps it to the fd number in the
+//! process that created it. While it's mapped and Shadow has no listeners on the eventfd, the shim
+//! handles reads of a non-zero counter and writes that fit in the counter itself. Everything else
+//! goes to Shadow, which uses the same counter.
+//!
+//! Only one side (Shadow or the managed thread that it's running) accesses a host's table at a
+//! time, since control is passed back and forth between them, so the fields don't need to be
+//! updated together atomically.
+
+use std::sync::atomic::{AtomicBool, AtomicI32, AtomicU64, Ordering};
+
+use vasi::VirtualAddressSpaceIndependent;
+
+/// The number of eventfds per host that can have their counters in shared memory.
+const SLOTS: usize = 64;
+
+/// Only fds below this can be handled by the shim.
+const MAX_FD: usize = 256;
+
+/// The largest value that an eventfd counter can hold.
+const MAX_COUNTER: u64 = u64::MAX - 1;
+
+#[derive(Debug, VirtualAddressSpaceIndependent)]
+#[repr(C)]
+struct Slot {
+    in_use: AtomicBool,
+    semaphore: AtomicBool,
+    /// Set while Shadow has listeners on the eventfd (such as a blocked thread or an epoll), which
+    /// must be notified of every change to the counter.
+    shadow_listening: AtomicBool,
+    /// The process and fd through which the shim may access the eventfd. The pid is 0 if the shim
+    /// may not access it.
+    pid: AtomicI32,
+    fd: AtomicI32,
+    counter: AtomicU64,
+}
+
+#[derive(Debug, VirtualAddressSpaceIndependent)]
+#[repr(C)]
+pub struct EventFdTable {
+    slots: [Slot; SLOTS],
+    /// The fds that are mapped in any process, so that the shim can skip the slots for reads and
+    /// writes of other fds.
+    mapped_fds: [AtomicU64; MAX_FD / 64],
+}
+
+impl EventFdTable {
+    pub fn new() -> Self {
+        Self {
+            slots: std::array::from_fn(|_| Slot {
+                in_use: AtomicBool::new(false),
+                semaphore: AtomicBool::new(false),
+                shadow_listening: AtomicBool::new(false),
+                pid: AtomicI32::new(0),
+                fd: AtomicI32::new(-1),
+                counter: AtomicU64::new(0),
+            }),
+            mapped_fds: std::array::from_fn(|_| AtomicU64::new(0)),
+        }
+    }
+
+    /// Allocate a slot for an eventfd created by process `pid` as `fd`, and return its index.
+    /// Returns `None` if the fd is too large or there are no free slots, in which case Shadow
+    /// should keep the counter itself.
+    pub fn alloc(&self, pid: libc::pid_t, fd: i32, counter: u64, semaphore: bool) -> Option<usize> {
+        let fd_idx = usize::try_from(fd).ok().filter(|x| *x < MAX_FD)?;
+        let (idx, slot) = self
+            .slots
+            .iter()
+            .enumerate()
+            .find(|(_, x)| !x.in_use.load(Ordering::Relaxed))?;
+
+        slot.in_use.store(true, Ordering::Relaxed);
+        slot.semaphore.store(semaphore, Ordering::Relaxed);
+        slot.shadow_listening.store(false, Ordering::Relaxed);
+        slot.counter.store(counter, Ordering::Relaxed);
+        slot.fd.store(fd, Ordering::Relaxed);
+        slot.pid.store(pid, Ordering::Relaxed);
+        self.mapped_fds[fd_idx / 64].fetch_or(1 << (fd_idx % 64), Ordering::Relaxed);
+
+        Some(idx)
+    }
+
+    /// Free the slot and return the eventfd's counter. The slot must not be used afterwards.
+    pub fn free(&self, idx: usize) -> u64 {
+        self.unmap(idx);
+        let slot = &self.slots[idx];
+        slot.in_use.store(false, Ordering::Relaxed);
+        slot.counter.load(Ordering::Relaxed)
+    }
+
+    /// Stop the shim from accessing the eventfd in the slot.
+    fn unmap(&self, idx: usize) {
+        let slot = &self.slots[idx];
+        let fd = slot.fd.swap(-1, Ordering::Relaxed);
+        slot.pid.store(0, Ordering::Relaxed);
+
+        let Ok(fd_idx) = usize::try_from(fd) else {
+            return;
+        };
+        // other processes may have the same fd mapped
+        if !self
+            .slots
+            .iter()
+            .any(|x| x.fd.load(Ordering::Relaxed) == fd)
+        {
+            self.mapped_fds[fd_idx / 64].fetch_and(!(1 << (fd_idx % 64)), Ordering::Relaxed);
+        }
+    }
+
+    pub fn counter(&self, idx: usize) -> u64 {
+        self.slots[idx].counter.load(Ordering::Relaxed)
+    }
+
+    pub fn set_counter(&self, idx: usize, counter: u64) {
+        self.slots[idx].counter.store(counter, Ordering::Relaxed)
+    }
+
+    /// Set whether Shadow has listeners on the eventfd. If it does, the shim won't change the
+    /// counter.
+    pub fn set_shadow_listening(&self, idx: usize, listening: bool) {
+        self.slots[idx]
+            .shadow_listening
+            .store(listening, Ordering::Relaxed)
+    }
+
+    /// The slot of the eventfd that the shim may access as `fd` in process `pid`.
+    fn find(&self, pid: libc::pid_t, fd: i32) -> Option<&Slot> {
+        let fd_idx = usize::try_from(fd).ok().filter(|x| *x < MAX_FD)?;
+        if self.mapped_fds[fd_idx / 64].load(Ordering::Relaxed) & (1 << (fd_idx % 64)) == 0 {
+            return None;
+        }
+
+        self.slots.iter().find(|x| {
+            x.fd.load(Ordering::Relaxed) == fd
+                && x.pid.load(Ordering::Relaxed) == pid
+                && !x.shadow_listening.load(Ordering::Relaxed)
+        })
+    }
+
+    /// The value that a read of the eventfd in the slot would return, or `None` if it would block.
+    fn read_value(slot: &Slot) -> Option<u64> {
+        let counter = slot.counter.load(Ordering::Relaxed);
+        if counter == 0 {
+            return None;
+        }
+
+        // behavior defined in `man 2 eventfd`
+        if slot.semaphore.load(Ordering::Relaxed) {
+            Some(1)
+        } else {
+            Some(counter)
+        }
+    }
+
+    /// Like [`shim_read`](Self::shim_read), but doesn't change the counter. This lets the shim
+    /// copy the value to the reader's buffer (which may be invalid) before consuming it.
+    pub fn shim_peek_read(&self, pid: libc::pid_t, fd: i32) -> Option<u64> {
+        Self::read_value(self.find(pid, fd)?)
+    }
+
+    /// Read the eventfd that process `pid` has as `fd`, if the shim can do so without Shadow.
+    /// Returns `None` if Shadow must handle the read, such as if it would block.
+    pub fn shim_read(&self, pid: libc::pid_t, fd: i32) -> Option<u64> {
+        let slot = self.find(pid, fd)?;
+        let value = Self::read_value(slot)?;
+
+        let counter = slot.counter.load(Ordering::Relaxed);
+        slot.counter.store(counter - value, Ordering::Relaxed);
+        Some(value)
+    }
+
+    /// Add `value` to the eventfd that process `pid` has as `fd`, if the shim can do so without
+    /// Shadow. Returns false if Shadow must handle the write, such as if it would block or is
+    /// invalid.
+    pub fn shim_write(&self, pid: libc::pid_t, fd: i32, value: u64) -> bool {
+        let Some(slot) = self.find(pid, fd) else {
+            return false;
+        };
+
+        let counter = slot.counter.load(Ordering::Relaxed);
+        if value > MAX_COUNTER - counter {
+            return false;
+        }
+
+        slot.counter.store(counter + value, Ordering::Relaxed);
+        true
+    }
+}
+
+impl Default for EventFdTable {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_read_write() {
+        let table = EventFdTable::new();
+        let idx = table.alloc(100, 3, 0, false).unwrap();
+
+        assert_eq!(table.shim_read(100, 3), None);
+        assert!(table.shim_write(100, 3, 5));
+        assert!(table.shim_write(100, 3, 2));
+        assert_eq!(table.counter(idx), 7);
+
+        // other processes and fds go to Shadow
+        assert!(!table.shim_write(101, 3, 1));
+        assert!(!table.shim_write(100, 4, 1));
+
+        assert_eq!(table.shim_peek_read(100, 3), Some(7));
+        assert_eq!(table.shim_peek_read(101, 3), None);
+        assert_eq!(table.shim_read(100, 3), Some(7));
+        assert_eq!(table.shim_peek_read(100, 3), None);
+        assert_eq!(table.shim_read(100, 3), None);
+
+        // writes that would block go to Shadow
+        assert!(!table.shim_write(100, 3, u64::MAX));
+        assert!(table.shim_write(100, 3, MAX_COUNTER));
+        assert!(!table.shim_write(100, 3, 1));
+        assert!(table.shim_write(100, 3, 0));
+
+        assert_eq!(table.free(idx), MAX_COUNTER);
+        assert_eq!(table.shim_read(100, 3), None);
+    }
+
+    #[test]
+    fn test_semaphore() {
+        let table = EventFdTable::new();
+        table.alloc(100, 3, 2, true).unwrap();
+
+        assert_eq!(table.shim_peek_read(100, 3), Some(1));
+        assert_eq!(table.shim_read(100, 3), Some(1));
+        assert_eq!(table.shim_read(100, 3), Some(1));
+        assert_eq!(table.shim_read(100, 3), None);
+    }
+
+    #[test]
+    fn test_shadow_listening() {
+        let table = EventFdTable::new();
+        let idx = table.alloc(100, 3, 1, false).unwrap();
+
+        table.set_shadow_listening(idx, true);
+        assert_eq!(table.shim_read(100, 3), None);
+        assert!(!table.shim_write(100, 3, 1));
+
+        table.set_shadow_listening(idx, false);
+        assert_eq!(table.shim_read(100, 3), Some(1));
+    }
+
+    #[test]
+    fn test_same_fd_in_two_processes() {
+        let table = EventFdTable::new();
+        let idx_a = table.alloc(100, 3, 0, false).unwrap();
+        let idx_b = table.alloc(101, 3, 0, false).unwrap();
+
+        table.free(idx_a);
+        assert!(!table.shim_write(100, 3, 1));
+        assert!(table.shim_write(101, 3, 1));
+        assert_eq!(table.free(idx_b), 1);
+    }
+
+    #[test]
+    fn test_large_fd() {
+        let table = EventFdTable::new();
+        assert_eq!(table.alloc(100, MAX_FD as i32, 0, false), None);
+        assert_eq!(table.alloc(100, -1, 0, false), None);
+    }
+}
@@ -0,0 +1,149 @@
+//! A read-only hash table from host names to IPv4 addresses. Shadow builds the table once at
+//! startup and places it in shared memory, so that the shim can resolve host names without making
+//! a syscall.
+//!
+//! The table is a byte slice so that it can be stored in a single shared memory block. All
+//! integers are native-endian `u32`s:
+//!
+//! - a header of a magic number and the number of slots (a power of two)
+//! - the slots, each a `(name_offset + 1, ipv4_addr)` pair, where `name_offset` is the offset of
+//!   the name from the start of the table and `ipv4_addr` is in network byte order; a
+//!   `name_offset + 1` of 0 marks an empty slot
+//! - the names, each a `u32` length followed by that many bytes
+//!
+//! Names are placed in slots by their FNV-1a hash, with linear probing.
+
+const MAGIC: u32 = 0x5348_5453;
+const HEADER_LEN: usize = 2;
+const SLOT_LEN: usize = 2;
+
+fn hash(name: &[u8]) -> u32 {
+    let mut hash: u32 = 0x811c_9dc5;
+    for byte in name {
+        hash ^= u32::from(*byte);
+        hash = hash.wrapping_mul(0x0100_0193);
+    }
+    hash
+}
+
+fn read_u32(table: &[u8], word: usize) -> Option<u32> {
+    let bytes = table.get(word * 4..word * 4 + 4)?;
+    Some(u32::from_ne_bytes(bytes.try_into().unwrap()))
+}
+
+/// Build a table of `hosts`, given as pairs of a name and an IPv4 address in network byte order.
+/// If a name appears more than once, the first address is used.
+pub fn build<'a>(hosts: impl ExactSizeIterator<Item = (&'a str, u32)>) -> Vec<u8> {
+    // keep the table at most half full
+    let num_slots = std::cmp::max(hosts.len() * 2, 1).next_power_of_two();
+    let names_start = (HEADER_LEN + num_slots * SLOT_LEN) * 4;
+
+    let mut slots = vec![(0u32, 0u32); num_slots];
+    let mut names = Vec::new();
+
+    for (name, addr) in hosts {
+        let name = name.as_bytes();
+        let mut idx = hash(name) as usize & (num_slots - 1);
+
+        let is_duplicate = loop {
+            let (offset, _) = slots[idx];
+            if offset == 0 {
+                break false;
+            }
+            if lookup_name_at(&names, offset as usize - 1 - names_start) == Some(name) {
+                break true;
+            }
+            idx = (idx + 1) & (num_slots - 1);
+        };
+        if is_duplicate {
+            continue;
+        }
+
+        let offset = names_start + names.len();
+        slots[idx] = (u32::try_from(offset + 1).unwrap(), addr);
+        names.extend_from_slice(&u32::try_from(name.len()).unwrap().to_ne_bytes());
+        names.extend_from_slice(name);
+    }
+
+    let mut table = Vec::with_capacity(names_start + names.len());
+    table.extend_from_slice(&MAGIC.to_ne_bytes());
+    table.extend_from_slice(&u32::try_from(num_slots).unwrap().to_ne_bytes());
+    for (offset, addr) in slots {
+        table.extend_from_slice(&offset.to_ne_bytes());
+        table.extend_from_slice(&addr.to_ne_bytes());
+    }
+    table.extend_from_slice(&names);
+    table
+}
+
+/// Get the name stored at `offset` of `bytes`.
+fn lookup_name_at(bytes: &[u8], offset: usize) -> Option<&[u8]> {
+    let len = u32::from_ne_bytes(bytes.get(offset..offset + 4)?.try_into().unwrap()) as usize;
+    bytes.get(offset + 4..offset + 4 + len)
+}
+
+/// Look up the IPv4 address (in network byte order) of `name` in a table built by [`build`].
+/// Returns `None` if the name isn't in the table or the table is malformed.
+pub fn lookup(table: &[u8], name: &[u8]) -> Option<u32> {
+    if read_u32(table, 0)? != MAGIC {
+        return None;
+    }
+    let num_slots = read_u32(table, 1)? as usize;
+    if !num_slots.is_power_of_two() {
+        return None;
+    }
+
+    let mut idx = hash(name) as usize & (num_slots - 1);
+    for _ in 0..num_slots {
+        let slot = HEADER_LEN + idx * SLOT_LEN;
+        let offset = read_u32(table, slot)? as usize;
+        if offset == 0 {
+            return None;
+        }
+        if lookup_name_at(table, offset - 1)? == name {
+            return read_u32(table, slot + 1);
+        }
+        idx = (idx + 1) & (num_slots - 1);
+    }
+
+    None
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_lookup() {
+        let hosts: Vec<(String, u32)> = (0..1000)
+            .map(|i| (format!("host{i}"), u32::to_be(0x0b00_0000 + i)))
+            .collect();
+        let table = build(hosts.iter().map(|(name, addr)| (name.as_str(), *addr)));
+
+        for (name, addr) in &hosts {
+            assert_eq!(lookup(&table, name.as_bytes()), Some(*addr));
+        }
+        assert_eq!(lookup(&table, b"host1000"), None);
+        assert_eq!(lookup(&table, b"host"), None);
+        assert_eq!(lookup(&table, b""), None);
+    }
+
+    #[test]
+    fn test_duplicates_and_empty() {
+        let table = build([("a", 1), ("a", 2)].into_iter());
+        assert_eq!(lookup(&table, b"a"), Some(1));
+
+        let table = build(std::iter::empty::<(&str, u32)>());
+        assert_eq!(lookup(&table, b"a"), None);
+    }
+
+    #[test]
+    fn test_malformed() {
+        assert_eq!(lookup(&[], b"a"), None);
+        assert_eq!(lookup(&[0; 16], b"a"), None);
+
+        let mut table = build([("abc", 1)].into_iter());
+        table.truncate(table.len() - 1);
+        assert_eq!(lookup(&table, b"abc"), None);
+    }
+}
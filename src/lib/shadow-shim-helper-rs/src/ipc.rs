@@ -24,6 +24,14 @@ impl IPCData {
         }
     }
 
+    /// Let both ends spin for up to `max_spins` iterations while waiting for a
+    /// message (see [`SelfContainedChannel::set_max_spins`]). This only helps
+    /// when Shadow and the plugin run on different CPUs.
+    pub fn set_max_spins(&self, max_spins: u32) {
+        self.shadow_to_plugin.set_max_spins(max_spins);
+        self.plugin_to_shadow.set_max_spins(max_spins);
+    }
+
     /// Returns a reference to the "Shadow to Plugin" channel.
     pub fn to_plugin(&self) -> &SelfContainedChannel<ShimEventToShim> {
         &self.shadow_to_plugin
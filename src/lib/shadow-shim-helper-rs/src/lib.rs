@@ -6,14 +6,18 @@
 use vasi::VirtualAddressSpaceIndependent;
 
 pub mod emulated_time;
+pub mod eventfd_table;
 pub mod explicit_drop;
+pub mod hosts_table;
 pub mod ipc;
+pub mod log_ring;
 pub mod notnull;
 pub mod option;
 pub mod rootedcell;
 pub mod shim_event;
 pub mod shim_shmem;
 pub mod simulation_time;
+pub mod syscall_set;
 pub mod syscall_types;
 pub mod util;
 
@@ -0,0 +1,334 @@
+//! A bounded lock-free queue of log records in a process's shared memory. The shim pushes its log
+//! records into the ring instead of writing them to stdout itself, and Shadow drains the ring into
+//! its own logger whenever the shim makes a syscall to Shadow, before handling the syscall. This
+//! avoids a write syscall per record, and keeps the shim's records in order with the records that
+//! Shadow logs while handling the shim's syscalls.
+//!
+//! The ring is a fixed array of slots, each with a sequence number that says whether the slot is
+//! ready to be written or read in the current lap (as in Dmitry Vyukov's bounded MPMC queue).
+//! Records that don't fit in a slot, or that arrive while the ring is full, are rejected so that
+//! the caller can write them some other way.
+
+use std::cell::UnsafeCell;
+use std::sync::atomic::{AtomicU64, Ordering};
+
+use vasi::VirtualAddressSpaceIndependent;
+
+use crate::simulation_time::SimulationTime;
+
+/// The number of records that the ring can hold. The ring is drained at every syscall, so this only
+/// needs to hold the records that the shim logs between two syscalls.
+pub const LOG_RING_SLOTS: usize = 128;
+
+const FILE_LEN: usize = 64;
+const MODULE_PATH_LEN: usize = 64;
+/// The longest message, in bytes, that a record can hold.
+pub const LOG_RING_MESSAGE_LEN: usize = 448;
+
+/// A log record copied into shared memory. Strings are stored inline, so they can be read from
+/// any address space.
+#[derive(Copy, Clone, VirtualAddressSpaceIndependent)]
+#[repr(C)]
+pub struct LogRingRecord {
+    level: u8,
+    line: u32,
+    /// Nanoseconds since the start of the simulation, or `u64::MAX` if unknown.
+    sim_time_nanos: u64,
+    file_len: u16,
+    module_path_len: u16,
+    message_len: u16,
+    file: [u8; FILE_LEN],
+    module_path: [u8; MODULE_PATH_LEN],
+    message: [u8; LOG_RING_MESSAGE_LEN],
+}
+
+/// Copy `src` into the start of `dst`, and return its length.
+fn copy_str(dst: &mut [u8], src: &str) -> u16 {
+    dst[..src.len()].copy_from_slice(src.as_bytes());
+    src.len().try_into().unwrap()
+}
+
+/// The strings were copied from `&str`s in their entirety, so are valid UTF-8 unless the managed
+/// process overwrote the shared memory. The length is also untrusted, so is clamped to the buffer.
+fn as_str(bytes: &[u8], len: u16) -> &str {
+    let len = std::cmp::min(usize::from(len), bytes.len());
+    std::str::from_utf8(&bytes[..len]).unwrap_or("?")
+}
+
+impl LogRingRecord {
+    pub fn level(&self) -> log::Level {
+        match self.level {
+            1 => log::Level::Error,
+            2 => log::Level::Warn,
+            3 => log::Level::Info,
+            4 => log::Level::Debug,
+            _ => log::Level::Trace,
+        }
+    }
+
+    pub fn line(&self) -> u32 {
+        self.line
+    }
+
+    pub fn sim_time(&self) -> Option<SimulationTime> {
+        (self.sim_time_nanos != u64::MAX).then(|| SimulationTime::from_nanos(self.sim_time_nanos))
+    }
+
+    pub fn file(&self) -> &str {
+        as_str(&self.file, self.file_len)
+    }
+
+    pub fn module_path(&self) -> &str {
+        as_str(&self.module_path, self.module_path_len)
+    }
+
+    pub fn message(&self) -> &str {
+        as_str(&self.message, self.message_len)
+    }
+}
+
+#[derive(VirtualAddressSpaceIndependent)]
+#[repr(C)]
+struct LogRingSlot {
+    /// Equal to the slot's position when it's empty and ready to be written, and to its position
+    /// plus one when it holds a record that's ready to be read.
+    seq: AtomicU64,
+    record: UnsafeCell<LogRingRecord>,
+}
+
+/// Why a record couldn't be pushed into a [`LogRing`].
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum LogRingPushError {
+    /// The ring has no empty slots.
+    Full,
+    /// A string in the record is longer than a slot can hold.
+    TooLong,
+}
+
+#[derive(VirtualAddressSpaceIndependent)]
+#[repr(C)]
+pub struct LogRing {
+    /// The position of the next slot to be written.
+    write_pos: AtomicU64,
+    /// The position of the next slot to be read.
+    read_pos: AtomicU64,
+    slots: [LogRingSlot; LOG_RING_SLOTS],
+}
+
+// SAFETY: A slot's record is only accessed by the writer or reader that claimed the slot's
+// position, and the slot's sequence number orders those accesses.
+unsafe impl Sync for LogRing {}
+
+impl LogRing {
+    pub fn new() -> Self {
+        Self {
+            write_pos: AtomicU64::new(0),
+            read_pos: AtomicU64::new(0),
+            slots: std::array::from_fn(|i| LogRingSlot {
+                seq: AtomicU64::new(i.try_into().unwrap()),
+                record: UnsafeCell::new(LogRingRecord {
+                    level: 0,
+                    line: 0,
+                    sim_time_nanos: u64::MAX,
+                    file_len: 0,
+                    module_path_len: 0,
+                    message_len: 0,
+                    file: [0; FILE_LEN],
+                    module_path: [0; MODULE_PATH_LEN],
+                    message: [0; LOG_RING_MESSAGE_LEN],
+                }),
+            }),
+        }
+    }
+
+    fn slot(&self, pos: u64) -> &LogRingSlot {
+        &self.slots[(pos % LOG_RING_SLOTS as u64) as usize]
+    }
+
+    /// Push a record into the ring.
+    pub fn push(
+        &self,
+        level: log::Level,
+        file: &str,
+        line: u32,
+        module_path: &str,
+        sim_time: Option<SimulationTime>,
+        message: &str,
+    ) -> Result<(), LogRingPushError> {
+        if file.len() > FILE_LEN
+            || module_path.len() > MODULE_PATH_LEN
+            || message.len() > LOG_RING_MESSAGE_LEN
+        {
+            return Err(LogRingPushError::TooLong);
+        }
+
+        let mut pos = self.write_pos.load(Ordering::Relaxed);
+        let slot = loop {
+            let slot = self.slot(pos);
+            let seq = slot.seq.load(Ordering::Acquire);
+            if seq == pos {
+                // the slot is empty, so try to claim it
+                match self.write_pos.compare_exchange_weak(
+                    pos,
+                    pos + 1,
+                    Ordering::Relaxed,
+                    Ordering::Relaxed,
+                ) {
+                    Ok(_) => break slot,
+                    Err(x) => pos = x,
+                }
+            } else if seq < pos {
+                // the slot still holds a record from the previous lap
+                return Err(LogRingPushError::Full);
+            } else {
+                // another writer claimed this position
+                pos = self.write_pos.load(Ordering::Relaxed);
+            }
+        };
+
+        // SAFETY: We claimed this position, and the reader won't access the record until we
+        // update the sequence number.
+        let record = unsafe { &mut *slot.record.get() };
+        record.level = level as u8;
+        record.line = line;
+        record.sim_time_nanos = sim_time
+            .map(|t| u64::try_from(t.as_nanos()).unwrap())
+            .unwrap_or(u64::MAX);
+        record.file_len = copy_str(&mut record.file, file);
+        record.module_path_len = copy_str(&mut record.module_path, module_path);
+        record.message_len = copy_str(&mut record.message, message);
+
+        slot.seq.store(pos + 1, Ordering::Release);
+        Ok(())
+    }
+
+    /// Pop the oldest record from the ring, if any.
+    pub fn pop(&self) -> Option<LogRingRecord> {
+        let mut pos = self.read_pos.load(Ordering::Relaxed);
+        let slot = loop {
+            let slot = self.slot(pos);
+            let seq = slot.seq.load(Ordering::Acquire);
+            if seq == pos + 1 {
+                // the slot holds a record, so try to claim it
+                match self.read_pos.compare_exchange_weak(
+                    pos,
+                    pos + 1,
+                    Ordering::Relaxed,
+                    Ordering::Relaxed,
+                ) {
+                    Ok(_) => break slot,
+                    Err(x) => pos = x,
+                }
+            } else if seq < pos + 1 {
+                // the slot hasn't been written yet
+                return None;
+            } else {
+                // another reader claimed this position
+                pos = self.read_pos.load(Ordering::Relaxed);
+            }
+        };
+
+        // SAFETY: We claimed this position, and writers won't access the record until we update
+        // the sequence number.
+        let record = unsafe { *slot.record.get() };
+
+        // the slot can be written again in the next lap
+        slot.seq
+            .store(pos + LOG_RING_SLOTS as u64, Ordering::Release);
+        Some(record)
+    }
+}
+
+impl Default for LogRing {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn push(ring: &LogRing, message: &str) -> Result<(), LogRingPushError> {
+        ring.push(
+            log::Level::Debug,
+            "src/foo.rs",
+            10,
+            "shadow_shim::foo",
+            Some(SimulationTime::from_nanos(5)),
+            message,
+        )
+    }
+
+    #[test]
+    fn test_push_pop() {
+        let ring = LogRing::new();
+        assert!(ring.pop().is_none());
+
+        push(&ring, "hello").unwrap();
+        ring.push(log::Level::Warn, "", 0, "", None, "world")
+            .unwrap();
+
+        let record = ring.pop().unwrap();
+        assert_eq!(record.level(), log::Level::Debug);
+        assert_eq!(record.file(), "src/foo.rs");
+        assert_eq!(record.line(), 10);
+        assert_eq!(record.module_path(), "shadow_shim::foo");
+        assert_eq!(record.sim_time(), Some(SimulationTime::from_nanos(5)));
+        assert_eq!(record.message(), "hello");
+
+        let record = ring.pop().unwrap();
+        assert_eq!(record.level(), log::Level::Warn);
+        assert_eq!(record.sim_time(), None);
+        assert_eq!(record.message(), "world");
+
+        assert!(ring.pop().is_none());
+    }
+
+    #[test]
+    fn test_full() {
+        let ring = LogRing::new();
+
+        // wrap around a few times
+        for lap in 0..3 {
+            for i in 0..LOG_RING_SLOTS {
+                push(&ring, &format!("{lap} {i}")).unwrap();
+            }
+            assert_eq!(push(&ring, "extra"), Err(LogRingPushError::Full));
+
+            for i in 0..LOG_RING_SLOTS {
+                assert_eq!(ring.pop().unwrap().message(), format!("{lap} {i}"));
+            }
+            assert!(ring.pop().is_none());
+        }
+    }
+
+    #[test]
+    fn test_too_long() {
+        let ring = LogRing::new();
+        let message = "x".repeat(LOG_RING_MESSAGE_LEN + 1);
+        assert_eq!(push(&ring, &message), Err(LogRingPushError::TooLong));
+        assert!(ring.pop().is_none());
+
+        let message = "x".repeat(LOG_RING_MESSAGE_LEN);
+        push(&ring, &message).unwrap();
+        assert_eq!(ring.pop().unwrap().message(), message);
+    }
+
+    #[test]
+    fn test_corrupt_lengths() {
+        let ring = LogRing::new();
+        push(&ring, "hello").unwrap();
+
+        // the managed process could have overwritten the lengths in shared memory
+        let mut record = ring.pop().unwrap();
+        record.file_len = u16::MAX;
+        record.module_path_len = u16::MAX;
+        record.message_len = u16::MAX;
+
+        assert_eq!(record.file().len(), FILE_LEN);
+        assert_eq!(record.module_path().len(), MODULE_PATH_LEN);
+        assert_eq!(record.message().len(), LOG_RING_MESSAGE_LEN);
+        assert!(record.message().starts_with("hello"));
+    }
+}
@@ -97,6 +97,20 @@ impl Root {
     fn tag(&self) -> Tag {
         self.tag
     }
+
+    /// Prove that this is the root for `tag`, panicking otherwise.
+    ///
+    /// With the `unchecked_root_tags` feature this is only checked in debug builds, which removes
+    /// a tag comparison from every access of a rooted object in release builds. This is only
+    /// sound if the code has been tested with the check enabled, since accessing a rooted object
+    /// with the wrong root is a data race.
+    #[inline]
+    #[track_caller]
+    fn assert_tag(&self, tag: Tag) {
+        if cfg!(any(debug_assertions, not(feature = "unchecked_root_tags"))) {
+            assert_eq!(self.tag, tag, "Expected {:?} Got {:?}", tag, self.tag);
+        }
+    }
 }
 
 impl Default for Root {
@@ -39,11 +39,7 @@ impl<T> RootedRefCell<T> {
     #[inline]
     pub fn borrow<'a>(&'a self, root: &'a Root) -> RootedRefCellRef<'a, T> {
         // Prove that the root is held for this tag.
-        assert_eq!(
-            root.tag, self.tag,
-            "Expected {:?} Got {:?}",
-            self.tag, root.tag
-        );
+        root.assert_tag(self.tag);
 
         assert!(!self.writer.get());
 
@@ -57,11 +53,7 @@ impl<T> RootedRefCell<T> {
     #[inline]
     pub fn borrow_mut<'a>(&'a self, root: &'a Root) -> RootedRefCellRefMut<'a, T> {
         // Prove that the root is held for this tag.
-        assert_eq!(
-            root.tag, self.tag,
-            "Expected {:?} Got {:?}",
-            self.tag, root.tag
-        );
+        root.assert_tag(self.tag);
 
         assert!(!self.writer.get());
         assert!(self.reader_count.get() == 0);
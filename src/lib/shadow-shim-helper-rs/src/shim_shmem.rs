@@ -1,9 +1,14 @@
+use std::sync::atomic::{AtomicBool, AtomicI32, AtomicU32, Ordering};
+
 use linux_api::signal::{sigaction, siginfo_t, sigset_t, stack_t, Signal};
 use shadow_shmem::allocator::{ShMemBlock, ShMemBlockSerialized};
 use vasi::VirtualAddressSpaceIndependent;
 use vasi_sync::scmutex::SelfContainedMutex;
 
+use crate::eventfd_table::EventFdTable;
+use crate::log_ring::LogRing;
 use crate::option::FfiOption;
+use crate::syscall_set::SyscallSet;
 use crate::HostId;
 use crate::{
     emulated_time::{AtomicEmulatedTime, EmulatedTime},
@@ -50,6 +55,12 @@ macro_rules! assert_shmem_safe {
 #[repr(C)]
 pub struct ManagerShmem {
     pub log_start_time_micros: i64,
+    /// A [`crate::hosts_table`] of the simulated hosts' names and addresses, which the shim uses
+    /// to resolve host names without making a syscall.
+    pub hosts_table: FfiOption<ShMemBlockSerialized>,
+    /// Syscalls that the shim's seccomp filter lets managed processes execute natively, without
+    /// trapping into the shim or Shadow.
+    pub native_passthrough_syscalls: SyscallSet,
 }
 
 #[derive(VirtualAddressSpaceIndependent)]
@@ -87,12 +98,16 @@ pub struct HostShmem {
     // Emulated CPU TSC clock rate, for rdtsc emulation.
     pub tsc_hz: u64,
 
-    // Current simulation time.
-    pub sim_time: AtomicEmulatedTime,
+    // Current simulation time, and how far it may be moved forward.
+    pub time: HostShmemTime,
 
     pub shim_log_level: logger::LogLevel,
 
     pub manager_shmem: ShMemBlockSerialized,
+
+    // The counters of the host's eventfds, which the shim can read and write without Shadow in
+    // some cases.
+    pub eventfds: EventFdTable,
 }
 assert_shmem_safe!(HostShmem, _hostshmem_test_fn);
 
@@ -115,7 +130,6 @@ impl HostShmem {
                 host_id,
                 root: Root::new(),
                 unapplied_cpu_latency: SimulationTime::ZERO,
-                max_runahead_time: EmulatedTime::MIN,
             }),
             model_unblocked_syscall_latency,
             max_unapplied_cpu_latency,
@@ -123,9 +137,10 @@ impl HostShmem {
             unblocked_vdso_latency,
             shadow_pid,
             tsc_hz,
-            sim_time: AtomicEmulatedTime::new(EmulatedTime::MIN),
+            time: HostShmemTime::new(),
             shim_log_level,
             manager_shmem: manager_shmem.serialize(),
+            eventfds: EventFdTable::new(),
         }
     }
 
@@ -143,10 +158,84 @@ pub struct HostShmemProtected {
 
     // Modeled CPU latency that hasn't been applied to the clock yet.
     pub unapplied_cpu_latency: SimulationTime,
+}
 
+/// The host's simulation time, and the max simulation time to which it may be
+/// incremented. These are read on every emulated time syscall, so they're
+/// protected by a sequence lock instead of the host's mutex: readers never
+/// block or write to shared memory, and retry if they race with a writer.
+///
+/// Only one side (Shadow or the managed thread that it's running) writes at a
+/// time, since control is passed back and forth between them, so writers don't
+/// need to be synchronized with each other.
+#[derive(VirtualAddressSpaceIndependent)]
+#[repr(C)]
+pub struct HostShmemTime {
+    // Odd while a write is in progress.
+    seq: AtomicU32,
+    sim_time: AtomicEmulatedTime,
     // Max simulation time to which sim_time may be incremented.  Moving time
     // beyond this value requires the current thread to be rescheduled.
-    pub max_runahead_time: EmulatedTime,
+    max_runahead_time: AtomicEmulatedTime,
+}
+
+impl HostShmemTime {
+    fn new() -> Self {
+        Self {
+            seq: AtomicU32::new(0),
+            sim_time: AtomicEmulatedTime::new(EmulatedTime::MIN),
+            max_runahead_time: AtomicEmulatedTime::new(EmulatedTime::MIN),
+        }
+    }
+
+    /// The current simulation time.
+    pub fn sim_time(&self) -> EmulatedTime {
+        // a single field is always consistent, so there's no need to check the
+        // sequence number
+        self.sim_time.load(Ordering::Relaxed)
+    }
+
+    /// The current simulation time and max runahead time, read consistently.
+    pub fn load(&self) -> (EmulatedTime, EmulatedTime) {
+        loop {
+            let seq = self.seq.load(Ordering::Acquire);
+            if seq % 2 != 0 {
+                std::hint::spin_loop();
+                continue;
+            }
+            let sim_time = self.sim_time.load(Ordering::Relaxed);
+            let max_runahead_time = self.max_runahead_time.load(Ordering::Relaxed);
+            // don't let the reads above be reordered after the check below
+            std::sync::atomic::fence(Ordering::Acquire);
+            if self.seq.load(Ordering::Relaxed) == seq {
+                return (sim_time, max_runahead_time);
+            }
+        }
+    }
+
+    /// Update the simulation time and max runahead time.
+    pub fn store(&self, sim_time: EmulatedTime, max_runahead_time: EmulatedTime) {
+        self.write(|| {
+            self.sim_time.store(sim_time, Ordering::Relaxed);
+            self.max_runahead_time
+                .store(max_runahead_time, Ordering::Relaxed);
+        })
+    }
+
+    /// Update the simulation time, keeping the current max runahead time.
+    pub fn set_sim_time(&self, sim_time: EmulatedTime) {
+        self.write(|| self.sim_time.store(sim_time, Ordering::Relaxed))
+    }
+
+    fn write(&self, f: impl FnOnce()) {
+        let seq = self.seq.load(Ordering::Relaxed);
+        debug_assert!(seq % 2 == 0, "Concurrent writers");
+        self.seq.store(seq.wrapping_add(1), Ordering::Relaxed);
+        // don't let the writes in `f` be reordered before the store above
+        std::sync::atomic::fence(Ordering::Release);
+        f();
+        self.seq.store(seq.wrapping_add(2), Ordering::Release);
+    }
 }
 
 #[derive(VirtualAddressSpaceIndependent)]
@@ -158,21 +247,52 @@ pub struct ProcessShmem {
     pub host_shmem: ShMemBlockSerialized,
     pub strace_fd: FfiOption<libc::c_int>,
 
+    // The emulated process id, so that the shim can handle `getpid`.
+    pub pid: libc::pid_t,
+
+    // The emulated parent process id, so that the shim can handle `getppid`.
+    // Updated by Shadow if the process is reparented.
+    pub ppid: AtomicI32,
+
+    // The number of threads of this process that Shadow has blocked in a futex wait, for each
+    // bucket of the virtual addresses that they waited on (see `futex_bucket`). Only updated by
+    // Shadow, so that the shim can answer wakes on private futexes with no blocked threads itself.
+    // Waiters on a shared futex may be in other processes, so this says nothing about those.
+    futex_waiters: [AtomicU32; FUTEX_BUCKETS],
+
+    // Log records from the shim, which Shadow drains into its own logger.
+    pub log_ring: LogRing,
+
     pub protected: RootedRefCell<ProcessShmemProtected>,
 }
 assert_shmem_safe!(ProcessShmem, _test_processshmem_fn);
 
+/// The number of buckets of futex addresses in [`ProcessShmem`].
+const FUTEX_BUCKETS: usize = 256;
+
+fn futex_bucket(addr: usize) -> usize {
+    // futex words are 4-byte aligned, so ignore the low bits
+    let hash = ((addr >> 2) as u64).wrapping_mul(0x9e37_79b9_7f4a_7c15);
+    (hash >> (64 - FUTEX_BUCKETS.trailing_zeros())) as usize
+}
+
 impl ProcessShmem {
     pub fn new(
         host_root: &Root,
         host_shmem: ShMemBlockSerialized,
         host_id: HostId,
         strace_fd: Option<libc::c_int>,
+        pid: libc::pid_t,
+        ppid: libc::pid_t,
     ) -> Self {
         Self {
             host_id,
             host_shmem,
             strace_fd: strace_fd.into(),
+            pid,
+            ppid: AtomicI32::new(ppid),
+            futex_waiters: std::array::from_fn(|_| AtomicU32::new(0)),
+            log_ring: LogRing::new(),
             protected: RootedRefCell::new(
                 host_root,
                 ProcessShmemProtected {
@@ -185,6 +305,24 @@ impl ProcessShmem {
             ),
         }
     }
+
+    /// Record that Shadow has blocked a thread of this process in a wait on the futex at `addr`.
+    pub fn add_futex_waiter(&self, addr: usize) {
+        self.futex_waiters[futex_bucket(addr)].fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Undo a previous [`add_futex_waiter`](Self::add_futex_waiter) once the thread is no longer
+    /// blocked.
+    pub fn remove_futex_waiter(&self, addr: usize) {
+        let prev = self.futex_waiters[futex_bucket(addr)].fetch_sub(1, Ordering::Relaxed);
+        debug_assert!(prev > 0);
+    }
+
+    /// Whether Shadow may have threads of this process blocked on the futex at `addr`. If
+    /// `false`, a private futex wake on `addr` won't wake any threads.
+    pub fn may_have_futex_waiters(&self, addr: usize) -> bool {
+        self.futex_waiters[futex_bucket(addr)].load(Ordering::Relaxed) != 0
+    }
 }
 
 #[derive(VirtualAddressSpaceIndependent)]
@@ -270,6 +408,12 @@ pub struct ThreadShmem {
     pub host_id: HostId,
     pub tid: libc::pid_t,
 
+    // Set by Shadow whenever a signal is made pending for this thread or its process, and only
+    // cleared by the shim once no signals are pending for either, so that the shim can skip
+    // signal processing without taking the host lock. Shadow and the thread never run at the
+    // same time, so relaxed accesses are sufficient.
+    pub maybe_pending_signals: AtomicBool,
+
     pub protected: RootedRefCell<ThreadShmemProtected>,
 }
 assert_shmem_safe!(ThreadShmem, _test_threadshmem_fn);
@@ -279,6 +423,8 @@ impl ThreadShmem {
         Self {
             host_id: host.host_id,
             tid,
+            // the process may already have pending signals
+            maybe_pending_signals: AtomicBool::new(true),
             protected: RootedRefCell::new(
                 &host.root,
                 ThreadShmemProtected {
@@ -478,7 +624,7 @@ pub mod export {
         host_mem: *const ShimShmemHost,
     ) -> CEmulatedTime {
         let host_mem = unsafe { host_mem.as_ref().unwrap() };
-        EmulatedTime::to_c_emutime(Some(host_mem.sim_time.load(Ordering::Relaxed)))
+        EmulatedTime::to_c_emutime(Some(host_mem.time.sim_time()))
     }
 
     /// # Safety
@@ -491,42 +637,156 @@ pub mod export {
     ) {
         let host_mem = unsafe { host_mem.as_ref().unwrap() };
         host_mem
-            .sim_time
-            .store(EmulatedTime::from_c_emutime(t).unwrap(), Ordering::Relaxed);
+            .time
+            .set_sim_time(EmulatedTime::from_c_emutime(t).unwrap());
     }
 
     /// # Safety
     ///
     /// Pointer args must be safely dereferenceable.
     #[no_mangle]
-    pub unsafe extern "C" fn shimshmem_getMaxRunaheadTime(
-        host_mem: *const ShimShmemHostLock,
+    pub unsafe extern "C" fn shimshmem_getEmulatedTimeAndMaxRunahead(
+        host_mem: *const ShimShmemHost,
+        max_runahead_time: *mut CEmulatedTime,
     ) -> CEmulatedTime {
         let host_mem = unsafe { host_mem.as_ref().unwrap() };
-        EmulatedTime::to_c_emutime(Some(host_mem.max_runahead_time))
+        let max_runahead_time = unsafe { max_runahead_time.as_mut().unwrap() };
+        let (sim_time, max) = host_mem.time.load();
+        *max_runahead_time = EmulatedTime::to_c_emutime(Some(max));
+        EmulatedTime::to_c_emutime(Some(sim_time))
     }
 
     /// # Safety
     ///
     /// Pointer args must be safely dereferenceable.
     #[no_mangle]
-    pub unsafe extern "C" fn shimshmem_setMaxRunaheadTime(
-        host_mem: *mut ShimShmemHostLock,
-        t: CEmulatedTime,
+    pub unsafe extern "C" fn shimshmem_getProcessStraceFd(
+        process: *const ShimShmemProcess,
+    ) -> libc::c_int {
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        process_mem.strace_fd.unwrap_or(-1)
+    }
+
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C" fn shimshmem_getProcessId(
+        process: *const ShimShmemProcess,
+    ) -> libc::pid_t {
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        process_mem.pid
+    }
+
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C" fn shimshmem_getParentProcessId(
+        process: *const ShimShmemProcess,
+    ) -> libc::pid_t {
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        process_mem.ppid.load(Ordering::Relaxed)
+    }
+
+    /// Read the eventfd that process `pid` has open as `fd` and store its value in `value`, if
+    /// that can be done without Shadow. Returns false if Shadow needs to handle the read.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C" fn shimshmem_eventfdRead(
+        host: *const ShimShmemHost,
+        pid: libc::pid_t,
+        fd: libc::c_int,
+        value: *mut u64,
+    ) -> bool {
+        let host_mem = unsafe { host.as_ref().unwrap() };
+        match host_mem.eventfds.shim_read(pid, fd) {
+            Some(x) => {
+                unsafe { value.write(x) };
+                true
+            }
+            None => false,
+        }
+    }
+
+    /// Store the value that reading the eventfd that process `pid` has open as `fd` would return
+    /// in `value`, without changing the eventfd's counter, if the read can be done without Shadow.
+    /// Returns false if Shadow needs to handle the read.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C" fn shimshmem_eventfdPeekRead(
+        host: *const ShimShmemHost,
+        pid: libc::pid_t,
+        fd: libc::c_int,
+        value: *mut u64,
+    ) -> bool {
+        let host_mem = unsafe { host.as_ref().unwrap() };
+        match host_mem.eventfds.shim_peek_read(pid, fd) {
+            Some(x) => {
+                unsafe { value.write(x) };
+                true
+            }
+            None => false,
+        }
+    }
+
+    /// Add `value` to the eventfd that process `pid` has open as `fd`, if that can be done
+    /// without Shadow. Returns false if Shadow needs to handle the write.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C" fn shimshmem_eventfdWrite(
+        host: *const ShimShmemHost,
+        pid: libc::pid_t,
+        fd: libc::c_int,
+        value: u64,
+    ) -> bool {
+        let host_mem = unsafe { host.as_ref().unwrap() };
+        host_mem.eventfds.shim_write(pid, fd, value)
+    }
+
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C" fn shimshmem_addFutexWaiter(
+        process: *const ShimShmemProcess,
+        addr: libc::uintptr_t,
     ) {
-        let host_mem = unsafe { host_mem.as_mut().unwrap() };
-        host_mem.max_runahead_time = EmulatedTime::from_c_emutime(t).unwrap();
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        process_mem.add_futex_waiter(addr)
     }
 
     /// # Safety
     ///
     /// Pointer args must be safely dereferenceable.
     #[no_mangle]
-    pub unsafe extern "C" fn shimshmem_getProcessStraceFd(
+    pub unsafe extern "C" fn shimshmem_removeFutexWaiter(
         process: *const ShimShmemProcess,
-    ) -> libc::c_int {
+        addr: libc::uintptr_t,
+    ) {
         let process_mem = unsafe { process.as_ref().unwrap() };
-        process_mem.strace_fd.unwrap_or(-1)
+        process_mem.remove_futex_waiter(addr)
+    }
+
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C" fn shimshmem_mayHaveFutexWaiters(
+        process: *const ShimShmemProcess,
+        addr: libc::uintptr_t,
+    ) -> bool {
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        process_mem.may_have_futex_waiters(addr)
     }
 
     /// # Safety
@@ -604,6 +864,11 @@ pub mod export {
         let lock = unsafe { lock.as_ref().unwrap() };
         let mut protected = thread_mem.protected.borrow_mut(&lock.root);
         protected.pending_signals = sigset_t::wrap(s);
+        if !protected.pending_signals.is_empty() {
+            thread_mem
+                .maybe_pending_signals
+                .store(true, Ordering::Relaxed);
+        }
     }
 
     /// Set the siginfo for the given signal number.
@@ -786,4 +1051,18 @@ pub mod export {
         let manager = unsafe { manager.as_ref().unwrap() };
         manager.log_start_time_micros
     }
+
+    /// Whether the seccomp filter should let syscall `num` execute natively.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[no_mangle]
+    pub unsafe extern "C" fn shimshmem_isNativePassthroughSyscall(
+        manager: *const ShimShmemManager,
+        num: i64,
+    ) -> bool {
+        let manager = unsafe { manager.as_ref().unwrap() };
+        manager.native_passthrough_syscalls.contains(num)
+    }
 }
@@ -0,0 +1,75 @@
+//! A fixed-size set of syscall numbers that can be placed in shared memory, such as the syscalls
+//! that the shim's seccomp filter lets a managed process execute natively.
+
+use vasi::VirtualAddressSpaceIndependent;
+
+const WORDS: usize = 8;
+
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq, VirtualAddressSpaceIndependent)]
+#[repr(C)]
+pub struct SyscallSet {
+    bits: [u64; WORDS],
+}
+
+impl SyscallSet {
+    /// One more than the largest syscall number that the set can hold.
+    pub const MAX: i64 = (WORDS * 64) as i64;
+
+    pub const fn new() -> Self {
+        Self { bits: [0; WORDS] }
+    }
+
+    /// Add `num` to the set. Returns false if `num` is out of range.
+    pub fn insert(&mut self, num: i64) -> bool {
+        if !(0..Self::MAX).contains(&num) {
+            return false;
+        }
+        let num = num as usize;
+        self.bits[num / 64] |= 1 << (num % 64);
+        true
+    }
+
+    pub fn contains(&self, num: i64) -> bool {
+        if !(0..Self::MAX).contains(&num) {
+            return false;
+        }
+        let num = num as usize;
+        self.bits[num / 64] & (1 << (num % 64)) != 0
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.bits.iter().all(|x| *x == 0)
+    }
+
+    /// The syscall numbers in the set, in increasing order.
+    pub fn iter(&self) -> impl Iterator<Item = i64> + '_ {
+        (0..Self::MAX).filter(|x| self.contains(*x))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_insert() {
+        let mut set = SyscallSet::new();
+        assert!(set.is_empty());
+
+        assert!(set.insert(0));
+        assert!(set.insert(63));
+        assert!(set.insert(64));
+        assert!(set.insert(SyscallSet::MAX - 1));
+        assert!(!set.insert(SyscallSet::MAX));
+        assert!(!set.insert(-1));
+
+        assert!(!set.is_empty());
+        assert!(set.contains(63));
+        assert!(!set.contains(62));
+        assert!(!set.contains(-1));
+        assert_eq!(
+            set.iter().collect::<Vec<_>>(),
+            [0, 63, 64, SyscallSet::MAX - 1]
+        );
+    }
+}
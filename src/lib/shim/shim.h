@@ -2,6 +2,8 @@
 #define SHD_SHIM_SHIM_H_
 
 #include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/ucontext.h>
 
@@ -23,6 +25,11 @@ const ShimShmemProcess* shim_processSharedMem();
 const ShimShmemHost* shim_hostSharedMem();
 const ShimShmemManager* shim_managerSharedMem();
 
+// Looks up the IPv4 address of simulated host `name` in the hosts table that
+// Shadow shares with managed processes. On success, writes the address in
+// network byte order to `addr` and returns true.
+bool shim_lookupHostsTableIpv4(const char* name, uint32_t* addr);
+
 // Exposed for Rust
 void _shim_parent_init_preload();
 void _shim_child_thread_init_preload();
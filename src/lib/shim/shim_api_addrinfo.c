@@ -234,6 +234,12 @@ static bool _shim_api_hostname_to_addr_ipv4(const char* node, uint32_t* addr) {
         return true;
     }
 
+    // Try the hosts table in shared memory first, which doesn't need a syscall.
+    if (shim_lookupHostsTableIpv4(node, addr)) {
+        trace("resolved name %s from the shared hosts table", node);
+        return true;
+    }
+
     // Resolve the hostname (find the ipv4 `addr` associated with hostname `name`) using a custom
     // syscall that Shadow handles internally. We want to execute natively in ptrace mode so ptrace
     // can intercept it, but we want to send to Shadow through shmem in preload mode. Let
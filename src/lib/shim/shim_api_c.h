@@ -9,6 +9,7 @@
 #include <ifaddrs.h>
 #include <netdb.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 /// This module defines functions that can be called by external (preloaded)
 /// libraries that are linked to the shim. Those libraries should only call
@@ -33,4 +34,9 @@ int shimc_api_getifaddrs(struct ifaddrs** ifap);
 // Shim implementation of `man 3 freeifaddrs`.
 void shimc_api_freeifaddrs(struct ifaddrs* ifa);
 
+// Charge the calling thread for `nanos` nanoseconds of CPU time that it spent
+// outside of a syscall, e.g. for work that a preloaded library skipped. Time
+// is moved forward before returning, yielding to Shadow if needed.
+void shimc_api_addCpuLatency(uint64_t nanos);
+
 #endif // SRC_LIB_SHIM_SHIM_API_H_
\ No newline at end of file
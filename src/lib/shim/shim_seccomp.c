@@ -19,6 +19,7 @@
 #include <unistd.h>
 
 #include "lib/logger/logger.h"
+#include "lib/shim/shim.h"
 #include "lib/shim/shim_syscall.h"
 #include "lib/shim/shim_tls.h"
 
@@ -31,6 +32,9 @@ static void* TEXT_START = NULL;
 // one thread.
 static void* TEXT_END = NULL;
 #define SIZEOF_SYSCALL_INSN 2
+// One more than the largest syscall number that can be a native passthrough
+// syscall (`SyscallSet::MAX`).
+#define MAX_PASSTHROUGH_SYSCALL 512
 
 // Handler function that receives syscalls that are stopped by the seccomp filter.
 static void _shim_seccomp_handle_sigsys(int sig, siginfo_t* info, void* voidUcontext) {
@@ -184,13 +188,18 @@ void shim_seccomp_init() {
      * version 5.11, though.
      * https://www.kernel.org/doc./html/latest/admin-guide/syscall-user-dispatch.html
      */
-    struct sock_filter filter[] = {
+    struct sock_filter prefix[] = {
         /* accumulator := syscall number */
         BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr)),
 
         /* Always allow sigreturn; otherwise we'd crash returning from our signal handler. */
         BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, SYS_rt_sigreturn, /*true-skip=*/0, /*false-skip=*/1),
         BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
+    };
+
+    /* The passthrough syscalls go here, between the prefix and the suffix. */
+
+    struct sock_filter suffix[] = {
 
     /* This block was intended to whitelist reads and writes to a socket
      * used to communicate with Shadow. It turns out to be unnecessary though,
@@ -267,8 +276,36 @@ void shim_seccomp_init() {
         /* Allow  */
         BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
     };
+
+    const size_t prefix_len = sizeof(prefix) / sizeof(prefix[0]);
+    const size_t suffix_len = sizeof(suffix) / sizeof(suffix[0]);
+    struct sock_filter filter[prefix_len + 2 * MAX_PASSTHROUGH_SYSCALL + suffix_len];
+    size_t len = 0;
+
+    memcpy(&filter[len], prefix, sizeof(prefix));
+    len += prefix_len;
+
+    /* Allow the syscalls that Shadow would only tell us to execute natively
+     * anyway, wherever they're made from, so that they don't pay for a trap and
+     * a round trip to Shadow. The accumulator still holds the syscall number.
+     */
+    const ShimShmemManager* manager = shim_managerSharedMem();
+    int num_passthrough = 0;
+    for (long nr = 0; nr < MAX_PASSTHROUGH_SYSCALL; nr++) {
+        if (shimshmem_isNativePassthroughSyscall(manager, nr)) {
+            filter[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, nr,
+                                                         /*true-skip=*/0, /*false-skip=*/1);
+            filter[len++] = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW);
+            num_passthrough++;
+        }
+    }
+    trace("seccomp filter allows %d passthrough syscalls", num_passthrough);
+
+    memcpy(&filter[len], suffix, sizeof(suffix));
+    len += suffix_len;
+
     struct sock_fprog prog = {
-        .len = (unsigned short)(sizeof(filter) / sizeof(filter[0])),
+        .len = (unsigned short)len,
         .filter = filter,
     };
 
@@ -5,6 +5,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <linux/futex.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -12,6 +13,7 @@
 #include <sys/param.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -19,7 +21,9 @@
 #include "lib/shadow-shim-helper-rs/shim_helper.h"
 #include "lib/shim/shim.h"
 #include "lib/shim/shim_api.h"
+#include "lib/shim/shim_api_c.h"
 #include "lib/shim/shim_sys.h"
+#include "lib/shim/shim_syscall.h"
 #include "main/host/syscall_numbers.h"
 
 static CEmulatedTime _shim_sys_get_time() {
@@ -58,6 +62,186 @@ static CSimulationTime _shim_sys_latency_for_syscall(long n) {
     return shimshmem_unblockedSyscallLatency(shim_hostSharedMem());
 }
 
+// Copies `n` bytes from `src` to `dst` within this process with a native syscall, so that an
+// invalid pointer results in an error rather than a segfault. Returns false if either buffer isn't
+// entirely accessible. This costs two native syscalls, which is still much cheaper than asking
+// Shadow to handle the syscall.
+static bool _shim_sys_copy_checked(void* dst, const void* src, size_t n) {
+    // the native pid, which differs from the pid that Shadow emulates
+    pid_t pid = shim_native_syscall(NULL, SYS_getpid);
+    struct iovec local = {.iov_base = dst, .iov_len = n};
+    struct iovec remote = {.iov_base = (void*)src, .iov_len = n};
+    long rv = shim_native_syscall(NULL, SYS_process_vm_readv, pid, &local, 1, &remote, 1, 0);
+    return rv == (long)n;
+}
+
+// Shadow answers futex wakes on private futexes with no blocked threads, and waits whose futex
+// word doesn't have the expected value, without blocking or any other side effects. Answers those here
+// and returns true, or returns false if Shadow needs to handle the operation.
+static bool _shim_sys_handle_futex(va_list args, long* rv) {
+    va_list futexArgs;
+    va_copy(futexArgs, args);
+    uint32_t* uaddr = va_arg(futexArgs, uint32_t*);
+    int futexOp = va_arg(futexArgs, long);
+    int val = va_arg(futexArgs, long);
+    const struct timespec* timeout = va_arg(futexArgs, const struct timespec*);
+    (void)va_arg(futexArgs, uint32_t*);
+    int val3 = va_arg(futexArgs, long);
+    va_end(futexArgs);
+
+    int operation = futexOp & ~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME);
+    bool isWake = operation == FUTEX_WAKE ||
+                  (operation == FUTEX_WAKE_BITSET && val3 == FUTEX_BITSET_MATCH_ANY);
+    bool isWait = operation == FUTEX_WAIT ||
+                  (operation == FUTEX_WAIT_BITSET && val3 == FUTEX_BITSET_MATCH_ANY);
+
+    if (isWake) {
+        // The shared memory only counts the waiters of this process, while a futex that isn't
+        // private may have waiters in other processes.
+        if (!(futexOp & FUTEX_PRIVATE_FLAG)) {
+            return false;
+        }
+        if (shimshmem_mayHaveFutexWaiters(shim_processSharedMem(), (uintptr_t)uaddr)) {
+            return false;
+        }
+        *rv = 0;
+        return true;
+    }
+
+    if (isWait) {
+        // Shadow reads the timeout before the futex word, and it reports bad pointers as errors
+        // rather than faulting, so leave those cases to Shadow. The futex word may also be
+        // unmapped, so it's read with `_shim_sys_copy_checked`.
+        if (timeout != NULL || uaddr == NULL || (uintptr_t)uaddr % sizeof(*uaddr) != 0) {
+            return false;
+        }
+        uint32_t word = 0;
+        if (!_shim_sys_copy_checked(&word, uaddr, sizeof(word))) {
+            return false;
+        }
+        if (word == (uint32_t)val) {
+            // We'd need to block.
+            return false;
+        }
+        *rv = -EAGAIN;
+        return true;
+    }
+
+    return false;
+}
+
+// Add `latency` to the unapplied CPU latency, and apply all of the unapplied
+// latency once it exceeds `threshold`. The latency is applied by moving time
+// forward locally if that doesn't pass the max runahead time, and otherwise by
+// yielding to Shadow.
+static void _shim_sys_add_cpu_latency(CSimulationTime latency, CSimulationTime threshold) {
+    // The time and max runahead time are readable without the host lock,
+    // so we only need it (once) for the unapplied CPU latency.
+    ShimShmemHostLock* host_lock = shimshmemhost_lock(shim_hostSharedMem());
+    shimshmem_incrementUnappliedCpuLatency(host_lock, latency);
+    CSimulationTime unappliedCpuLatency = shimshmem_getUnappliedCpuLatency(host_lock);
+
+    // Check whether we ought to yield.
+    bool reachedMax = unappliedCpuLatency > threshold;
+    bool shouldYield = false;
+    CEmulatedTime newTime = 0;
+    CEmulatedTime maxTime = 0;
+    if (reachedMax) {
+        newTime = shimshmem_getEmulatedTimeAndMaxRunahead(shim_hostSharedMem(), &maxTime) +
+                  unappliedCpuLatency;
+        if (newTime <= maxTime) {
+            shimshmem_setEmulatedTime(shim_hostSharedMem(), newTime);
+            shimshmem_resetUnappliedCpuLatency(host_lock);
+        } else {
+            shouldYield = true;
+        }
+    }
+    // TODO: Once ptrace mode is deprecated, we can hold this lock longer to
+    // avoid having to reacquire it for each syscall. We currently can't
+    // hold the lock over when any syscalls would be made though (including
+    // from logging), since those result in a ptrace-stop returning control
+    // to shadow without giving us a chance to release the lock.
+    shimshmemhost_unlock(shim_hostSharedMem(), &host_lock);
+    // Should have been released and NULLed.
+    assert(!host_lock);
+
+    trace("unappliedCpuLatency=%ld threshold=%ld", unappliedCpuLatency, threshold);
+    if (reachedMax && !shouldYield) {
+        trace("Reached unapplied CPU latency threshold. Updated time locally. (%ld ns until max)",
+              maxTime - newTime);
+    } else if (shouldYield) {
+        // We still want to eventually return to the caller, but first we
+        // yield control to Shadow so that it can move time forward and
+        // reschedule this thread. This syscall itself is a no-op, but the
+        // Shadow side will itself check and see that there is unapplied
+        // latency to apply, as it does after executing any syscall.
+        //
+        // Since this is a Shadow syscall, it will always be passed through
+        // to Shadow instead of being executed natively.
+        trace("Reached unapplied CPU latency threshold. Yielding. (%ld ns past max)",
+              newTime - maxTime);
+        syscall(SYS_shadow_yield);
+    }
+}
+
+void shimc_api_addCpuLatency(uint64_t nanos) {
+    const ShimShmemHost* mem = shim_hostSharedMem();
+
+    // A preloaded library may call this before the shim has been initialized.
+    if (mem == NULL) {
+        return;
+    }
+
+    // Apply the latency right away, so that it isn't discarded if the thread
+    // blocks before reaching the max unapplied latency.
+    _shim_sys_add_cpu_latency(nanos * SIMTIME_ONE_NANOSECOND, 0);
+}
+
+// Shadow keeps the counters of most eventfds in shared memory, and lets the shim read a non-zero
+// counter or add to it while no thread is blocked on the eventfd and it isn't being polled. Handles
+// such reads and writes here and returns true, or returns false if Shadow needs to handle the
+// syscall (which is always the case for fds that aren't eventfds).
+static bool _shim_sys_handle_eventfd_rw(long syscall_num, va_list args, long* rv) {
+    va_list rwArgs;
+    va_copy(rwArgs, args);
+    int fd = va_arg(rwArgs, long);
+    void* buf = va_arg(rwArgs, void*);
+    size_t count = va_arg(rwArgs, size_t);
+    va_end(rwArgs);
+
+    // Shadow reports short and bad buffers as errors rather than faulting, so leave those cases to
+    // Shadow. Buffers are copied with `_shim_sys_copy_checked` since they may also be invalid.
+    if (buf == NULL || count < sizeof(uint64_t)) {
+        return false;
+    }
+
+    const ShimShmemHost* host = shim_hostSharedMem();
+    pid_t pid = shimshmem_getProcessId(shim_processSharedMem());
+
+    if (syscall_num == SYS_read) {
+        // Copy the value out before consuming it, so that the counter is left unchanged for
+        // Shadow if the buffer is invalid.
+        uint64_t value = 0;
+        if (!shimshmem_eventfdPeekRead(host, pid, fd, &value) ||
+            !_shim_sys_copy_checked(buf, &value, sizeof(value))) {
+            return false;
+        }
+        uint64_t consumed = 0;
+        bool was_read = shimshmem_eventfdRead(host, pid, fd, &consumed);
+        assert(was_read && consumed == value);
+        (void)was_read;
+    } else {
+        uint64_t value = 0;
+        if (!_shim_sys_copy_checked(&value, buf, sizeof(value)) ||
+            !shimshmem_eventfdWrite(host, pid, fd, value)) {
+            return false;
+        }
+    }
+
+    *rv = sizeof(uint64_t);
+    return true;
+}
+
 bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
     // This function is called on every syscall operation so be careful not to doing
     // anything too expensive outside of the switch cases.
@@ -132,6 +316,54 @@ bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
             break;
         }
 
+        case SYS_getpid: {
+            syscallName = "getpid";
+
+            // Fixed for the lifetime of the process.
+            *rv = shimshmem_getProcessId(shim_processSharedMem());
+
+            break;
+        }
+
+        case SYS_getppid: {
+            syscallName = "getppid";
+
+            // Shadow updates this if the process is reparented.
+            *rv = shimshmem_getParentProcessId(shim_processSharedMem());
+
+            break;
+        }
+
+        case SYS_gettid: {
+            syscallName = "gettid";
+
+            // Fixed for the lifetime of the thread.
+            *rv = shimshmem_getThreadId(shim_threadSharedMem());
+
+            break;
+        }
+
+        case SYS_futex: {
+            syscallName = "futex";
+
+            if (!_shim_sys_handle_futex(args, rv)) {
+                return false;
+            }
+
+            break;
+        }
+
+        case SYS_read:
+        case SYS_write: {
+            syscallName = syscall_num == SYS_read ? "read" : "write";
+
+            if (!_shim_sys_handle_eventfd_rw(syscall_num, args, rv)) {
+                return false;
+            }
+
+            break;
+        }
+
         case SYS_sched_yield: {
             syscallName = "sched_yield";
 
@@ -182,51 +414,10 @@ bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
     }
 
     if (shimshmem_getModelUnblockedSyscallLatency(shim_hostSharedMem())) {
-        ShimShmemHostLock* host_lock = shimshmemhost_lock(shim_hostSharedMem());
-        shimshmem_incrementUnappliedCpuLatency(
-            host_lock, _shim_sys_latency_for_syscall(syscall_num));
-        CSimulationTime unappliedCpuLatency = shimshmem_getUnappliedCpuLatency(host_lock);
-        // TODO: Once ptrace mode is deprecated, we can hold this lock longer to
-        // avoid having to reacquire it below. We currently can't hold the lock
-        // over when any syscalls would be made though, since those result in a
-        // ptrace-stop returning control to shadow without giving us a chance to
-        // release the lock.
-        shimshmemhost_unlock(shim_hostSharedMem(), &host_lock);
-
-        // Count the syscall and check whether we ought to yield.
         CSimulationTime maxUnappliedCpuLatency =
             shimshmem_maxUnappliedCpuLatency(shim_hostSharedMem());
-        trace("unappliedCpuLatency=%ld maxUnappliedCpuLatency=%ld", unappliedCpuLatency,
-              maxUnappliedCpuLatency);
-        if (unappliedCpuLatency > maxUnappliedCpuLatency) {
-            // We still want to eventually return the syscall result we just
-            // got, but first we yield control to Shadow so that it can move
-            // time forward and reschedule this thread. This syscall itself is
-            // a no-op, but the Shadow side will itself check and see that
-            // unblockedCount > unblockedLimit, as it does before executing any
-            // syscall.
-            //
-            // Since this is a Shadow syscall, it will always be passed through
-            // to Shadow instead of being executed natively.
-
-            CEmulatedTime newTime = _shim_sys_get_time() + unappliedCpuLatency;
-            host_lock = shimshmemhost_lock(shim_hostSharedMem());
-            CEmulatedTime maxTime = shimshmem_getMaxRunaheadTime(host_lock);
-            if (newTime <= maxTime) {
-                shimshmem_setEmulatedTime(shim_hostSharedMem(), newTime);
-                shimshmem_resetUnappliedCpuLatency(host_lock);
-                shimshmemhost_unlock(shim_hostSharedMem(), &host_lock);
-                trace("Reached maxUnappliedCpuLatency. Updated time locally. (%ld ns until max)",
-                      maxTime - newTime);
-            } else {
-                shimshmemhost_unlock(shim_hostSharedMem(), &host_lock);
-                trace("Reached maxUnappliedCpuLatency. Yielding. (%ld ns past max)",
-                      newTime - maxTime);
-                syscall(SYS_shadow_yield);
-            }
-        }
-        // Should have been released and NULLed.
-        assert(!host_lock);
+        _shim_sys_add_cpu_latency(_shim_sys_latency_for_syscall(syscall_num),
+                                  maxUnappliedCpuLatency);
     }
 
     // the syscall was handled
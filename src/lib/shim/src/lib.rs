@@ -10,7 +10,9 @@ use core::mem::MaybeUninit;
 use crate::tls::ShimTlsVar;
 
 use linux_api::signal::{rt_sigprocmask, SigProcMaskAction};
+use shadow_shim_helper_rs::hosts_table;
 use shadow_shim_helper_rs::ipc::IPCData;
+use shadow_shim_helper_rs::option::FfiOption;
 use shadow_shim_helper_rs::shim_event::{ShimEventStartReq, ShimEventToShadow, ShimEventToShim};
 use shadow_shim_helper_rs::shim_shmem::{HostShmem, ManagerShmem, ProcessShmem, ThreadShmem};
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
@@ -268,6 +270,29 @@ mod global_manager_shmem {
     }
 }
 
+mod global_hosts_table {
+    use super::*;
+
+    // Initialized from the manager's shared memory, so that the table is only deserialized once.
+    static TABLE: LazyLock<Option<ShMemBlockAlias<u8>>> = LazyLock::const_new(|| {
+        let manager = global_manager_shmem::try_get()?;
+        match manager.hosts_table {
+            FfiOption::Some(serialized) => Some(unsafe { shdeserialize(&serialized) }),
+            FfiOption::None => None,
+        }
+    });
+
+    /// Look up `name` in the hosts table that Shadow shares with managed processes. Returns the
+    /// IPv4 address in network byte order, or `None` if `name` isn't a simulated host or there's
+    /// no table.
+    pub fn lookup_ipv4(name: &[u8]) -> Option<u32> {
+        // don't initialize `TABLE` before the manager's shared memory is available
+        global_manager_shmem::try_get()?;
+        let table = (*TABLE).as_ref()?;
+        hosts_table::lookup(table.as_slice(), name)
+    }
+}
+
 mod global_host_shmem {
     use super::*;
 
@@ -323,6 +348,11 @@ mod tls_process_shmem {
         f(SHMEM.get().borrow().as_ref().unwrap())
     }
 
+    /// Returns `None` if `set` hasn't been called yet, or if it's being called.
+    pub fn try_with<O>(f: impl FnOnce(&ProcessShmem) -> O) -> Option<O> {
+        Some(f(SHMEM.get().try_borrow().ok()?.as_ref()?))
+    }
+
     /// The previous value, if any, is dropped.
     ///
     /// # Safety
@@ -501,6 +531,12 @@ pub mod export {
         unsafe { bindings::shimc_api_freeifaddrs(ifa) }
     }
 
+    /// Charge the calling thread for `nanos` nanoseconds of CPU time.
+    #[no_mangle]
+    pub extern "C" fn shim_api_add_cpu_latency(nanos: u64) {
+        unsafe { bindings::shimc_api_addCpuLatency(nanos) }
+    }
+
     /// Sets the flag determining whether syscalls are passed through natively, and
     /// returns the old value. Typical usage is to set this to the desired value at
     /// the beginning of an operation, and restore the old value afterwards.
@@ -601,6 +637,27 @@ pub mod export {
         unsafe { release_and_exit_current_thread(status) }
     }
 
+    /// Look up the IPv4 address of simulated host `name` without making a syscall. On success,
+    /// writes the address in network byte order to `addr` and returns true.
+    ///
+    /// # Safety
+    ///
+    /// `name` must be a valid nul-terminated string, and `addr` must be valid for writes.
+    #[no_mangle]
+    pub unsafe extern "C" fn shim_lookupHostsTableIpv4(
+        name: *const core::ffi::c_char,
+        addr: *mut u32,
+    ) -> bool {
+        let name = unsafe { CStr::from_ptr(name) };
+        match global_hosts_table::lookup_ipv4(name.to_bytes()) {
+            Some(x) => {
+                unsafe { addr.write(x) };
+                true
+            }
+            None => false,
+        }
+    }
+
     #[no_mangle]
     pub extern "C" fn shim_managerSharedMem(
     ) -> *const shadow_shim_helper_rs::shim_shmem::export::ShimShmemManager {
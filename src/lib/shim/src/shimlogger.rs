@@ -3,6 +3,7 @@ use core::time::Duration;
 
 use formatting_nostd::{BorrowedFdWriter, FormatBuffer};
 use rustix::fd::BorrowedFd;
+use shadow_shim_helper_rs::log_ring::LOG_RING_MESSAGE_LEN;
 use shadow_shim_helper_rs::util::time::TimeParts;
 
 /// For internal use; writes to an internal buffer, flushing to stdout
@@ -50,9 +51,11 @@ impl Drop for ShimLoggerWriter {
     }
 }
 
-/// Implementation of `log::Log` for use in the shim. Includes some shim related
-/// metadata (such as simulation time), is no_std, and is careful to only make
-/// inlined syscalls to avoid getting intercepted by the shim's seccomp filter.
+/// Implementation of `log::Log` for use in the shim. Records are pushed into the
+/// process's shared-memory log ring for Shadow to log, which falls back to
+/// writing to stdout with some shim related metadata (such as simulation time).
+/// Is no_std, and is careful to only make inlined syscalls to avoid getting
+/// intercepted by the shim's seccomp filter.
 pub struct ShimLogger {}
 
 impl ShimLogger {
@@ -67,6 +70,34 @@ impl ShimLogger {
     }
 }
 
+impl ShimLogger {
+    /// Push the record into the process's log ring, which Shadow drains into its own log. Unlike
+    /// writing to stdout, this doesn't make any syscalls. Returns `false` if the ring isn't
+    /// available yet or is full, or if the message is too long for the ring.
+    fn try_log_to_ring(record: &log::Record) -> bool {
+        let mut message = FormatBuffer::<{ LOG_RING_MESSAGE_LEN + 1 }>::new();
+        core::fmt::write(&mut message, *record.args()).unwrap();
+        if message.truncated() > 0 {
+            return false;
+        }
+
+        crate::tls_process_shmem::try_with(|shmem| {
+            shmem
+                .log_ring
+                .push(
+                    record.level(),
+                    record.file().unwrap_or("?"),
+                    record.line().unwrap_or(0),
+                    record.module_path().unwrap_or("?"),
+                    crate::simtime(),
+                    message.as_str(),
+                )
+                .is_ok()
+        })
+        .unwrap_or(false)
+    }
+}
+
 impl log::Log for ShimLogger {
     fn enabled(&self, metadata: &log::Metadata) -> bool {
         metadata.level() <= log::max_level()
@@ -77,6 +108,12 @@ impl log::Log for ShimLogger {
             return;
         }
 
+        // Errors are written directly, since the process is likely about to abort before Shadow
+        // drains the ring.
+        if record.level() != log::Level::Error && Self::try_log_to_ring(record) {
+            return;
+        }
+
         let mut writer = ShimLoggerWriter::new();
 
         match crate::global_manager_shmem::try_get() {
@@ -315,9 +315,42 @@ pub unsafe fn process_signals(mut ucontext: Option<&mut ucontext>) -> bool {
             }
         });
     }
+
+    // if nothing is left pending (including blocked signals), stop checking for signals when
+    // returning from syscalls until shadow sets the flag again
+    tls_process_shmem::with(|process| {
+        tls_thread_shmem::with(|thread| {
+            if process
+                .protected
+                .borrow(&host_lock.root)
+                .pending_signals
+                .is_empty()
+                && thread
+                    .protected
+                    .borrow(&host_lock.root)
+                    .pending_signals
+                    .is_empty()
+            {
+                thread
+                    .maybe_pending_signals
+                    .store(false, core::sync::atomic::Ordering::Relaxed);
+            }
+        })
+    });
+
     restartable
 }
 
+/// Returns `false` if the current thread definitely has no pending signals, in which case
+/// [`process_signals`] doesn't need to be called. This doesn't take the host lock.
+pub fn maybe_pending_signals() -> bool {
+    tls_thread_shmem::with(|thread| {
+        thread
+            .maybe_pending_signals
+            .load(core::sync::atomic::Ordering::Relaxed)
+    })
+}
+
 extern "C" fn handle_hardware_error_signal(
     signo: i32,
     info: *mut siginfo_t,
@@ -1,5 +1,4 @@
 use core::fmt::Write;
-use core::sync::atomic;
 
 use formatting_nostd::{BorrowedFdWriter, FormatBuffer};
 use linux_api::errno::Errno;
@@ -94,9 +93,14 @@ unsafe fn emulated_syscall_event(
                     ctx.uc_mcontext.rax = syscall_complete.retval.into();
                 }
 
-                // SAFETY: `ctx` should be valid if present.
-                let all_sigactions_had_sa_restart =
-                    unsafe { crate::signals::process_signals(ctx.as_deref_mut()) };
+                // Signals are rarely pending, so avoid taking the host lock to process them
+                // unless shadow has told us that there may be some.
+                let all_sigactions_had_sa_restart = if crate::signals::maybe_pending_signals() {
+                    // SAFETY: `ctx` should be valid if present.
+                    unsafe { crate::signals::process_signals(ctx.as_deref_mut()) }
+                } else {
+                    true
+                };
 
                 if i64::from(syscall_complete.retval) == Errno::EINTR.to_negated_i64()
                     && all_sigactions_had_sa_restart
@@ -121,10 +125,8 @@ unsafe fn emulated_syscall_event(
                 if let FfiOption::Some(strace_fd) =
                     crate::tls_process_shmem::with(|process| process.strace_fd)
                 {
-                    let emulated_time = global_host_shmem::get()
-                        .sim_time
-                        .load(atomic::Ordering::Relaxed)
-                        - EmulatedTime::SIMULATION_START;
+                    let emulated_time =
+                        global_host_shmem::get().time.sim_time() - EmulatedTime::SIMULATION_START;
                     let tid = tls_thread_shmem::with(|thread| thread.tid);
                     let parts = TimeParts::from_nanos(emulated_time.as_nanos());
                     let mut buffer = FormatBuffer::<200>::new();
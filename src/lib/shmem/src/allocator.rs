@@ -38,6 +38,17 @@ where
     SHMALLOC.lock().alloc(val)
 }
 
+/// Like `shmalloc()`, but copies all of `vals` into a newly-allocated shared memory block. The
+/// values are accessible with `as_slice()` on the block or its aliases, and dereferencing the
+/// block gives the first value. Panics if `vals` is empty.
+pub fn shmalloc_slice<T>(vals: &[T]) -> ShMemBlock<'static, T>
+where
+    T: Copy + Sync + VirtualAddressSpaceIndependent,
+{
+    register_teardown();
+    SHMALLOC.lock().alloc_slice(vals)
+}
+
 /// This function frees a previously allocated block.
 pub fn shfree<T>(block: ShMemBlock<'static, T>)
 where
@@ -145,6 +156,13 @@ where
             internal: serialized,
         }
     }
+
+    /// All values in the block. Has a single value unless the block was allocated with
+    /// `shmalloc_slice()`.
+    pub fn as_slice(&self) -> &[T] {
+        let block = unsafe { &*self.block };
+        block.get_ref::<T>()
+    }
 }
 
 // SAFETY: T is already required to be Sync, and ShMemBlock only exposes
@@ -208,6 +226,18 @@ unsafe impl<'deserializer, T> Send for ShMemBlockAlias<'deserializer, T> where
 {
 }
 
+impl<'deserializer, T> ShMemBlockAlias<'deserializer, T>
+where
+    T: Sync + VirtualAddressSpaceIndependent,
+{
+    /// All values in the block. Has a single value unless the block was allocated with
+    /// `shmalloc_slice()`.
+    pub fn as_slice(&self) -> &[T] {
+        let block = unsafe { &*self.block };
+        block.get_ref::<T>()
+    }
+}
+
 impl<'deserializer, T> core::ops::Deref for ShMemBlockAlias<'deserializer, T>
 where
     T: Sync + VirtualAddressSpaceIndependent,
@@ -309,6 +339,26 @@ impl<'alloc> SharedMemAllocator<'alloc> {
         }
     }
 
+    fn alloc_slice<T: Copy + Sync + VirtualAddressSpaceIndependent>(
+        &mut self,
+        vals: &[T],
+    ) -> ShMemBlock<'alloc, T> {
+        assert!(!vals.is_empty());
+        let t_nbytes: usize = core::mem::size_of_val(vals);
+        let t_alignment: usize = core::mem::align_of::<T>();
+
+        let block = self.internal.alloc(t_nbytes, t_alignment);
+        unsafe {
+            (*block).get_mut_ref::<T>().copy_from_slice(vals);
+        }
+
+        self.nallocs += 1;
+        ShMemBlock::<'alloc, T> {
+            block,
+            phantom: Default::default(),
+        }
+    }
+
     fn free<T: Sync + VirtualAddressSpaceIndependent>(&mut self, mut block: ShMemBlock<'alloc, T>) {
         self.nallocs -= 1;
         block.block = core::ptr::null_mut();
@@ -442,6 +492,34 @@ mod tests {
         }
     }
 
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn allocator_reuses_freed_blocks_of_each_size() {
+        let a = shmalloc(1u8);
+        let b = shmalloc(2u64);
+        let c = shmalloc([3u32; 7]);
+        let a_addr = &*a as *const u8;
+        let b_addr = &*b as *const u64;
+        let c_addr = &*c as *const [u32; 7];
+
+        // Free in an order that interleaves the block sizes on any single freelist.
+        shfree(b);
+        shfree(a);
+        shfree(c);
+
+        let c = shmalloc([4u32; 7]);
+        let a = shmalloc(5u8);
+        let b = shmalloc(6u64);
+        assert_eq!(&*c as *const [u32; 7], c_addr);
+        assert_eq!(&*a as *const u8, a_addr);
+        assert_eq!(&*b as *const u64, b_addr);
+        assert_eq!((*a, *b, *c), (5, 6, [4; 7]));
+
+        shfree(a);
+        shfree(b);
+        shfree(c);
+    }
+
     #[test]
     #[cfg_attr(miri, ignore)]
     fn round_trip_through_serializer() {
@@ -460,6 +538,23 @@ mod tests {
         shfree(original_block);
     }
 
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn slice_round_trip_through_serializer() {
+        let vals: [u8; 5] = [1, 2, 3, 4, 5];
+
+        let original_block = shmalloc_slice(&vals);
+        assert_eq!(original_block.as_slice(), &vals);
+        assert_eq!(*original_block, 1);
+        {
+            let serialized_block = original_block.serialize();
+            let block = unsafe { shdeserialize::<u8>(&serialized_block) };
+            assert_eq!(block.as_slice(), &vals);
+        }
+
+        shfree(original_block);
+    }
+
     #[test]
     // Uses FFI
     #[cfg_attr(miri, ignore)]
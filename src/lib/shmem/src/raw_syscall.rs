@@ -21,6 +21,8 @@ pub const S_IRUSR: u32 = 0o400;
 pub const S_IWUSR: u32 = 0o200;
 pub const S_IRGRP: u32 = S_IRUSR >> 3;
 pub const S_IWGRP: u32 = S_IWUSR >> 3;
+pub const S_IXUSR: u32 = 0o100;
+pub const S_IXGRP: u32 = S_IXUSR >> 3;
 
 fn null_terminated(string: &[u8]) -> bool {
     string.iter().any(|x| *x == 0)
@@ -68,6 +70,28 @@ pub unsafe fn unlink(filename: &[u8]) -> Result<(), Errno> {
         .map_err(Errno::from)
 }
 
+/// # Safety
+///
+/// Assumes pathname is a null-terminated ASCII string.
+pub unsafe fn mkdir(pathname: &[u8], mode: u32) -> Result<(), Errno> {
+    assert!(null_terminated(pathname));
+
+    unsafe { syscall!(linux_syscall::SYS_mkdir, pathname.as_ptr(), mode) }
+        .check()
+        .map_err(Errno::from)
+}
+
+/// # Safety
+///
+/// Assumes pathname is a null-terminated ASCII string.
+pub unsafe fn rmdir(pathname: &[u8]) -> Result<(), Errno> {
+    assert!(null_terminated(pathname));
+
+    unsafe { syscall!(linux_syscall::SYS_rmdir, pathname.as_ptr()) }
+        .check()
+        .map_err(Errno::from)
+}
+
 /// # Safety
 ///
 /// `addr` should be a pointer hinting at a mapping location, or null. The other arguments should
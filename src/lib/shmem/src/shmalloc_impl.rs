@@ -3,9 +3,9 @@
 //! Shadow's shim library, which must async-signal-safe.
 //!
 //! The allocator chains together chunks of shared memory and divvies out portions of each chunk
-//! using a first-fit strategy. The allocator also implements a freelist so that allocated blocks
-//! can be reused efficiently after free. The allocator design isn't good for general-purpose
-//! allocation, but should be OK when used for just a few types.
+//! using a first-fit strategy. The allocator also implements a freelist for each allocation size so
+//! that allocated blocks can be reused efficiently after free. The allocator design isn't good for
+//! general-purpose allocation, but should be OK when used for just a few types.
 //!
 //! This code is intended to be private; the `allocator` module is the public, safer-to-use
 //! front end.
@@ -54,6 +54,8 @@ pub(crate) enum AllocError {
     MMap,
     MUnmap,
     Unlink,
+    MkDir,
+    RmDir,
     WrongAllocator,
     // Leak,
     GetPID,
@@ -67,6 +69,8 @@ const fn alloc_error_to_str(e: AllocError) -> Option<&'static str> {
         AllocError::MMap => Some("Error calling mmap()"),
         AllocError::MUnmap => Some("Error calling munmap()"),
         AllocError::Unlink => Some("Error calling unlink()"),
+        AllocError::MkDir => Some("Error calling mkdir()"),
+        AllocError::RmDir => Some("Error calling rmdir()"),
         AllocError::WrongAllocator => Some("Block was passed to incorrect allocator"),
         // AllocError::Leak => Some("Allocator destroyed but not all blocks are deallocated first"),
         AllocError::GetPID => Some("Error calling getpid()"),
@@ -113,6 +117,12 @@ pub(crate) fn log_err_and_exit(error: AllocError, errno: Option<Errno>) -> ! {
     unreachable!()
 }
 
+fn format_shmem_dir(fb: &mut FormatBuffer<{ crate::util::PATH_MAX_NBYTES }>, pid: i32) {
+    write!(fb, "/dev/shm/{}{}", crate::util::SHM_DIR_PREFIX, pid).unwrap();
+}
+
+/// Writes a new shared memory file name to `buf`, creating the current process's shared memory
+/// directory if it doesn't exist yet.
 fn format_shmem_name(buf: &mut PathBuf) {
     let pid = match getpid() {
         Ok(pid) => pid,
@@ -125,9 +135,18 @@ fn format_shmem_name(buf: &mut PathBuf) {
     };
 
     let mut fb = FormatBuffer::<{ crate::util::PATH_MAX_NBYTES }>::new();
+    format_shmem_dir(&mut fb, pid);
+
+    let dir_buf: PathBuf = crate::util::buf_from_utf8_str(fb.as_str()).unwrap();
+    const MODE: u32 = S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IWGRP | S_IXGRP;
+    match unsafe { mkdir(&dir_buf, MODE) } {
+        Ok(()) | Err(Errno::EEXIST) => {}
+        Err(errno) => log_err_and_exit(AllocError::MkDir, Some(errno)),
+    }
+
     write!(
         &mut fb,
-        "/dev/shm/shadow_shmemfile_{}.{}-{}",
+        "/shadow_shmemfile_{}.{}-{}",
         ts.tv_sec, ts.tv_nsec, pid
     )
     .unwrap();
@@ -135,6 +154,24 @@ fn format_shmem_name(buf: &mut PathBuf) {
     *buf = crate::util::buf_from_utf8_str(fb.as_str()).unwrap();
 }
 
+/// Removes the current process's shared memory directory if it's empty.
+fn remove_shmem_dir() {
+    let pid = match getpid() {
+        Ok(pid) => pid,
+        Err(err) => log_err_and_exit(AllocError::GetPID, Some(err)),
+    };
+
+    let mut fb = FormatBuffer::<{ crate::util::PATH_MAX_NBYTES }>::new();
+    format_shmem_dir(&mut fb, pid);
+
+    let dir_buf: PathBuf = crate::util::buf_from_utf8_str(fb.as_str()).unwrap();
+    match unsafe { rmdir(&dir_buf) } {
+        // another allocator in this process may still have files in the directory
+        Ok(()) | Err(Errno::ENOTEMPTY) => {}
+        Err(errno) => log_err(AllocError::RmDir, Some(errno)),
+    }
+}
+
 const CHUNK_NBYTES_DEFAULT: usize = 8 * 1024 * 1024; // 8 MiB
 
 fn create_map_shared_memory<'a>(path_buf: &PathBuf, nbytes: usize) -> (&'a mut [u8], i32) {
@@ -388,10 +425,33 @@ pub(crate) fn rewind(p: *mut u8) -> *mut Block {
 
 */
 
+/// The number of allocation sizes that get their own freelist. Only a few types are allocated with
+/// this allocator, so in practice every size gets its own list. Blocks of any other size share the
+/// allocator's overflow list.
+const SIZED_FREE_LIST_CAPACITY: usize = 8;
+
+/// A list of free blocks that all have the same size.
+#[derive(Debug, Copy, Clone)]
+struct SizedFreeList {
+    // The size of the blocks in this list, or `None` if the list hasn't been assigned a size yet.
+    // Zero is a valid size, so it can't mark an unused list.
+    alloc_nbytes: Option<usize>,
+    next_free_block: *mut Block,
+}
+
+impl SizedFreeList {
+    const UNUSED: Self = SizedFreeList {
+        alloc_nbytes: None,
+        next_free_block: core::ptr::null_mut(),
+    };
+}
+
 #[derive(Debug)]
 pub(crate) struct FreelistAllocator {
     first_chunk: *mut Chunk,
+    // Free blocks whose sizes don't have a list in `sized_free_lists`.
     next_free_block: *mut Block,
+    sized_free_lists: [SizedFreeList; SIZED_FREE_LIST_CAPACITY],
     chunk_nbytes: usize,
 }
 
@@ -400,6 +460,7 @@ impl FreelistAllocator {
         FreelistAllocator {
             first_chunk: core::ptr::null_mut(),
             next_free_block: core::ptr::null_mut(),
+            sized_free_lists: [SizedFreeList::UNUSED; SIZED_FREE_LIST_CAPACITY],
             chunk_nbytes: CHUNK_NBYTES_DEFAULT,
         }
     }
@@ -423,14 +484,41 @@ impl FreelistAllocator {
         Ok(())
     }
 
+    /// Returns the head of the freelist that holds free blocks of size `alloc_nbytes`. If `assign`
+    /// is true and no list has this size yet, an unused list is assigned to this size (if there is
+    /// one). Once a list is assigned a size it keeps that size, so all free blocks of a given size
+    /// are always in the same list.
+    fn free_list_for_size(&mut self, alloc_nbytes: usize, assign: bool) -> &mut *mut Block {
+        let idx = self
+            .sized_free_lists
+            .iter()
+            .position(|list| list.alloc_nbytes == Some(alloc_nbytes))
+            .or_else(|| {
+                if !assign {
+                    return None;
+                }
+                let idx = self
+                    .sized_free_lists
+                    .iter()
+                    .position(|list| list.alloc_nbytes.is_none())?;
+                self.sized_free_lists[idx].alloc_nbytes = Some(alloc_nbytes);
+                Some(idx)
+            });
+
+        match idx {
+            Some(idx) => &mut self.sized_free_lists[idx].next_free_block,
+            None => &mut self.next_free_block,
+        }
+    }
+
     /// Returns the block and its predecessor (if it exists)
     fn check_free_list_for_acceptable_block(
-        &mut self,
+        free_list: *mut Block,
         alloc_nbytes: usize,
         alloc_alignment: usize,
     ) -> (*mut Block, *mut Block) // (pred, block)
     {
-        let mut block = self.next_free_block;
+        let mut block = free_list;
         let mut pred: *mut Block = core::ptr::null_mut();
 
         while !block.is_null() {
@@ -503,16 +591,18 @@ impl FreelistAllocator {
     }
 
     pub fn alloc(&mut self, alloc_nbytes: usize, alloc_alignment: usize) -> *mut Block {
-        // First, check the free list
+        // First, check the free list. Since all blocks in a sized free list have the same size,
+        // its first block is usually acceptable.
+        let free_list = self.free_list_for_size(alloc_nbytes, false);
         let (pred, mut block) =
-            self.check_free_list_for_acceptable_block(alloc_nbytes, alloc_alignment);
+            Self::check_free_list_for_acceptable_block(*free_list, alloc_nbytes, alloc_alignment);
 
         if !block.is_null() {
             // We found a hit off the free list, we can just return that.
             // But first we update the free list.
             if pred.is_null() {
                 // The block was the first element on the list.
-                self.next_free_block = unsafe { (*block).next_free_block };
+                *free_list = unsafe { (*block).next_free_block };
             } else {
                 // We can just update the predecessor
                 unsafe {
@@ -573,11 +663,13 @@ impl FreelistAllocator {
         unsafe {
             (*block).canary_assert();
         }
-        let old_block = self.next_free_block;
+        let alloc_nbytes = unsafe { (*block).alloc_nbytes } as usize;
+        let free_list = self.free_list_for_size(alloc_nbytes, true);
+        let old_block = *free_list;
         unsafe {
             (*block).next_free_block = old_block;
         }
-        self.next_free_block = block;
+        *free_list = block;
     }
 
     // PRE: Block was allocated with this allocator
@@ -646,6 +738,7 @@ impl FreelistAllocator {
             }
 
             self.first_chunk = core::ptr::null_mut();
+            remove_shmem_dir();
         }
     }
 }
@@ -1,6 +1,11 @@
 // The standard path length limit on Linux.
 pub const PATH_MAX_NBYTES: usize = 255;
 
+/// The shared memory files created by a process are kept in the directory
+/// `/dev/shm/<SHM_DIR_PREFIX><pid>`, so that the files of a process that has exited can be found
+/// and removed together without looking at each file.
+pub const SHM_DIR_PREFIX: &str = "shadow_shmemdir-";
+
 // One extra byte for the null terminator.
 pub(crate) type PathBuf = [u8; PATH_MAX_NBYTES + 1];
 
@@ -1,4 +1,4 @@
-use std::collections::LinkedList;
+use std::collections::VecDeque;
 use std::io::Read;
 
 use bytes::{Buf, Bytes, BytesMut};
@@ -8,7 +8,8 @@ use crate::util::time::Instant;
 
 #[derive(Debug)]
 pub(crate) struct SendQueue<T: Instant> {
-    segments: LinkedList<Segment>,
+    /// The segments and their starting sequence numbers.
+    segments: VecDeque<(Seq, Segment)>,
     time_last_segment_sent: Option<T>,
     // exclusive
     transmitted_up_to: Seq,
@@ -23,7 +24,7 @@ pub(crate) struct SendQueue<T: Instant> {
 impl<T: Instant> SendQueue<T> {
     pub fn new(initial_seq: Seq) -> Self {
         let mut queue = Self {
-            segments: LinkedList::new(),
+            segments: VecDeque::new(),
             time_last_segment_sent: None,
             transmitted_up_to: initial_seq,
             start_seq: initial_seq,
@@ -107,8 +108,9 @@ impl<T: Instant> SendQueue<T> {
             return;
         }
 
+        let seq = self.end_seq;
         self.end_seq += seg.len();
-        self.segments.push_back(seg);
+        self.segments.push_back((seq, seg));
     }
 
     pub fn start_seq(&self) -> Seq {
@@ -134,7 +136,8 @@ impl<T: Instant> SendQueue<T> {
             let advance_by = new_start - self.start_seq;
 
             // this shouldn't panic due to the assertion above
-            let front = self.segments.front_mut().unwrap();
+            let (front_seq, front) = self.segments.front_mut().unwrap();
+            debug_assert!(*front_seq == self.start_seq);
 
             // if the chunk would be completely removed
             if front.len() <= advance_by {
@@ -155,12 +158,12 @@ impl<T: Instant> SendQueue<T> {
             assert!(!data.is_empty());
 
             self.start_seq += advance_by;
+            *front_seq = self.start_seq;
         }
     }
 
     /// Get the next segment that has not yet been transmitted. The `offset` argument can be used to
     /// return the next segment starting at `offset` bytes from the next non-transmitted segment.
-    // TODO: this is slow and is called often
     pub fn next_not_transmitted(&self, offset: u32) -> Option<(Seq, Segment)> {
         // the sequence number of the segment we want to return
         let target_seq = self.transmitted_up_to + offset;
@@ -170,33 +173,30 @@ impl<T: Instant> SendQueue<T> {
             return None;
         }
 
-        let mut seq_cursor = self.start_seq;
-        for seg in &self.segments {
-            let len = seg.len();
-
-            // if the target sequence number is within this segment
-            if SeqRange::new(seq_cursor, seq_cursor + len).contains(target_seq) {
-                let new_segment = match seg {
-                    Segment::Syn => Segment::Syn,
-                    Segment::Fin => Segment::Fin,
-                    Segment::Data(chunk) => {
-                        // the target sequence number might be somewhere within this chunk, so we
-                        // need to trim any bytes with a lower sequence number
-                        let chunk_offset = target_seq - seq_cursor;
-                        let chunk_offset: usize = chunk_offset.try_into().unwrap();
-                        Segment::Data(chunk.slice(chunk_offset..))
-                    }
-                };
-
-                return Some((target_seq, new_segment));
+        // Sequence numbers wrap, so compare the segments' offsets from the start of the buffer
+        // instead. The segments are sorted by offset, so we can binary search for the segment
+        // containing the target sequence number rather than walking the whole send buffer.
+        let target_offset = target_seq - self.start_seq;
+        let index = self
+            .segments
+            .partition_point(|(seq, seg)| (*seq - self.start_seq) + seg.len() <= target_offset);
+
+        // we confirmed above that the target sequence number is contained within the buffer
+        let (seq, seg) = &self.segments[index];
+        debug_assert!(SeqRange::new(*seq, *seq + seg.len()).contains(target_seq));
+
+        let new_segment = match seg {
+            Segment::Syn => Segment::Syn,
+            Segment::Fin => Segment::Fin,
+            Segment::Data(chunk) => {
+                // the target sequence number might be somewhere within this chunk, so we need to
+                // trim any bytes with a lower sequence number
+                let chunk_offset: usize = (target_seq - *seq).try_into().unwrap();
+                Segment::Data(chunk.slice(chunk_offset..))
             }
+        };
 
-            seq_cursor += len;
-        }
-
-        // we confirmed above that the target sequence number is contained within the buffer, but we
-        // looped over all segments in the buffer and didn't find it
-        unreachable!();
+        Some((target_seq, new_segment))
     }
 
     pub fn mark_as_transmitted(&mut self, up_to: Seq, time: T) {
@@ -212,7 +212,7 @@ impl<T: Instant> SendQueue<T> {
 
 #[derive(Debug)]
 pub(crate) struct RecvQueue {
-    segments: LinkedList<Bytes>,
+    segments: VecDeque<Bytes>,
     // inclusive
     start_seq: Seq,
     // exclusive
@@ -224,7 +224,7 @@ pub(crate) struct RecvQueue {
 impl RecvQueue {
     pub fn new(initial_seq: Seq) -> Self {
         Self {
-            segments: LinkedList::new(),
+            segments: VecDeque::new(),
             start_seq: initial_seq,
             end_seq: initial_seq,
             syn_added: false,
@@ -321,3 +321,44 @@ impl Segment {
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_next_not_transmitted() {
+        // start close to the wrap-around point to make sure we handle it
+        let mut queue = SendQueue::<std::time::Instant>::new(Seq::new(u32::MAX - 1));
+        for data in [&b"hello"[..], b" ", b"world"] {
+            queue.add_data(data, data.len()).unwrap();
+        }
+        queue.add_fin();
+
+        let data_seq = Seq::new(u32::MAX - 1) + 1;
+        let next = |queue: &SendQueue<_>, offset| {
+            queue
+                .next_not_transmitted(offset)
+                .map(|(seq, seg)| match seg {
+                    Segment::Syn => (seq, b"SYN".to_vec()),
+                    Segment::Fin => (seq, b"FIN".to_vec()),
+                    Segment::Data(data) => (seq, data.to_vec()),
+                })
+        };
+
+        assert_eq!(next(&queue, 0), Some((data_seq - 1, b"SYN".to_vec())));
+        assert_eq!(next(&queue, 1), Some((data_seq, b"hello".to_vec())));
+        assert_eq!(next(&queue, 3), Some((data_seq + 2, b"llo".to_vec())));
+        assert_eq!(next(&queue, 6), Some((data_seq + 5, b" ".to_vec())));
+        assert_eq!(next(&queue, 9), Some((data_seq + 8, b"rld".to_vec())));
+        assert_eq!(next(&queue, 12), Some((data_seq + 11, b"FIN".to_vec())));
+        assert_eq!(next(&queue, 13), None);
+
+        // acknowledge part of the first data segment
+        queue.mark_as_transmitted(data_seq + 4, std::time::Instant::now());
+        queue.advance_start(data_seq + 3);
+        assert_eq!(next(&queue, 0), Some((data_seq + 4, b"o".to_vec())));
+        assert_eq!(next(&queue, 1), Some((data_seq + 5, b" ".to_vec())));
+        assert_eq!(next(&queue, 4), Some((data_seq + 8, b"rld".to_vec())));
+    }
+}
@@ -4,7 +4,7 @@ use std::net::SocketAddrV4;
 
 use crate::buffer::Segment;
 use crate::seq::{Seq, SeqRange};
-use crate::util::time::Instant;
+use crate::util::time::{Duration, Instant};
 use crate::window_scaling::WindowScaling;
 use crate::{
     Ipv4Header, Payload, PopPacketError, PushPacketError, RecvError, SendError, TcpConfig,
@@ -20,6 +20,7 @@ pub(crate) struct Connection<I: Instant> {
     pub(crate) send: ConnectionSend<I>,
     pub(crate) recv: Option<ConnectionRecv>,
     pub(crate) need_to_ack: bool,
+    pub(crate) delayed_ack: DelayedAck<I>,
     pub(crate) last_advertised_window: Option<u32>,
     pub(crate) window_scaling: WindowScaling,
 }
@@ -43,6 +44,7 @@ impl<I: Instant> Connection<I> {
             send: ConnectionSend::new(send_initial_seq),
             recv: None,
             need_to_ack: true,
+            delayed_ack: DelayedAck::new(),
             last_advertised_window: None,
             window_scaling: WindowScaling::new(),
         };
@@ -163,6 +165,10 @@ impl<I: Instant> Connection<I> {
         // acknowledge or not
         let initial_seq = recv.buffer.next_seq();
 
+        // set if we must acknowledge this packet immediately rather than using a delayed
+        // acknowledgement
+        let mut ack_immediately = false;
+
         if !recv.is_closed {
             if header.flags.contains(TcpFlags::SYN) {
                 if recv.buffer.syn_added() {
@@ -175,6 +181,7 @@ impl<I: Instant> Connection<I> {
                 }
 
                 recv.buffer.add_syn();
+                ack_immediately = true;
             }
 
             let syn_len = if header.flags.contains(TcpFlags::SYN) {
@@ -197,6 +204,9 @@ impl<I: Instant> Connection<I> {
                     }
                 } else {
                     // TODO: store (truncated?) out-of-order packet
+
+                    // send a duplicate acknowledgement so that the peer learns of the gap quickly
+                    ack_immediately = true;
                 }
             }
 
@@ -204,15 +214,20 @@ impl<I: Instant> Connection<I> {
                 if fin_seq == recv.buffer.next_seq() {
                     recv.buffer.add_fin();
                     recv.is_closed = true;
+                    ack_immediately = true;
                 } else {
                     // TODO: store (truncated?) out of order packet
+                    ack_immediately = true;
                 }
             }
         }
 
         // we've added to the receive buffer (payload, syn, or fin), so we need to send an
+        // acknowledgement; in-order payload data may be acknowledged later with a delayed
         // acknowledgement
-        if recv.buffer.next_seq() != initial_seq {
+        if ack_immediately {
+            self.need_to_ack = true;
+        } else if recv.buffer.next_seq() != initial_seq && self.delayed_ack.segment_received() {
             self.need_to_ack = true;
         }
 
@@ -325,6 +340,7 @@ impl<I: Instant> Connection<I> {
 
         // we're sending the most up-to-date acknowledgement
         self.need_to_ack = false;
+        self.delayed_ack.acked();
 
         // inform the buffer that we transmitted this segment
         self.send.buffer.mark_as_transmitted(seq_range.end, now);
@@ -341,6 +357,36 @@ impl<I: Instant> Connection<I> {
         self._next_segment()
     }
 
+    /// Returns the time at which a delayed acknowledgement should be sent, if the connection has
+    /// received data that it hasn't acknowledged and no delayed acknowledgement has been scheduled
+    /// yet. The caller must register a timer for the returned time that calls
+    /// [`delayed_ack_timer_fired()`](Self::delayed_ack_timer_fired).
+    pub fn schedule_delayed_ack(&mut self, now: I) -> Option<I> {
+        if self.need_to_ack || !self.delayed_ack.is_pending() || self.delayed_ack.deadline.is_some()
+        {
+            return None;
+        }
+
+        let deadline = now + I::Duration::from_millis(DelayedAck::<I>::TIMEOUT_MS);
+        self.delayed_ack.deadline = Some(deadline);
+        Some(deadline)
+    }
+
+    /// Should be called when a timer registered for a delayed acknowledgement has fired.
+    pub fn delayed_ack_timer_fired(&mut self, now: I) {
+        // the acknowledgement may have already been sent, or this may be an old timer and a newer
+        // delayed acknowledgement has been scheduled with its own timer
+        if !matches!(self.delayed_ack.deadline, Some(deadline) if deadline <= now) {
+            return;
+        }
+
+        self.delayed_ack.deadline = None;
+
+        if self.delayed_ack.is_pending() {
+            self.need_to_ack = true;
+        }
+    }
+
     /// Returns true if ready to send a packet.
     pub fn wants_to_send(&self) -> bool {
         // should be inlined
@@ -376,7 +422,14 @@ impl<I: Instant> Connection<I> {
 
                 let apparent_window = window >> window_scale << window_scale;
 
-                if self.last_advertised_window != Some(apparent_window) {
+                // The window shrinks as we receive data, but the peer already knows this from the
+                // acknowledgement number, so we only need to send an update when the window opens.
+                // Otherwise every received segment would cause a window update and we could never
+                // delay an acknowledgement.
+                if self
+                    .last_advertised_window
+                    .map_or(true, |last| apparent_window > last)
+                {
                     send_empty_packet = true;
                 }
             }
@@ -589,6 +642,63 @@ impl ConnectionRecv {
     }
 }
 
+/// Decides when to acknowledge received data. Like Linux, we acknowledge at least every second
+/// segment and otherwise delay the acknowledgement for a short time so that it can be combined with
+/// a later acknowledgement or a data segment (RFC 1122 4.2.3.2, RFC 9293 3.8.6.3). The first few
+/// segments of a connection are acknowledged immediately ("quickack" mode) so that the peer's
+/// congestion window can grow quickly during slow start.
+#[derive(Debug)]
+pub(crate) struct DelayedAck<I: Instant> {
+    /// The number of in-order data segments received since we last sent an acknowledgement.
+    unacked_segments: u32,
+    /// The number of remaining data segments that should be acknowledged immediately.
+    quick_acks: u32,
+    /// The time at which the pending delayed acknowledgement should be sent, if a timer has been
+    /// registered for it.
+    deadline: Option<I>,
+}
+
+impl<I: Instant> DelayedAck<I> {
+    /// How long an acknowledgement may be delayed. This is Linux's minimum delayed ack timeout
+    /// (`TCP_DELACK_MIN`).
+    const TIMEOUT_MS: u64 = 40;
+    /// The number of segments to acknowledge immediately at the start of a connection
+    /// (`TCP_MAX_QUICKACKS` in Linux).
+    const MAX_QUICK_ACKS: u32 = 16;
+
+    pub fn new() -> Self {
+        Self {
+            unacked_segments: 0,
+            quick_acks: Self::MAX_QUICK_ACKS,
+            deadline: None,
+        }
+    }
+
+    /// Record that an in-order data segment was received. Returns `true` if the segment should be
+    /// acknowledged immediately.
+    pub fn segment_received(&mut self) -> bool {
+        self.unacked_segments += 1;
+
+        if self.quick_acks > 0 {
+            self.quick_acks -= 1;
+            return true;
+        }
+
+        self.unacked_segments >= 2
+    }
+
+    /// Returns `true` if there is received data that we haven't acknowledged.
+    pub fn is_pending(&self) -> bool {
+        self.unacked_segments > 0
+    }
+
+    /// Record that we sent an acknowledgement for all received data.
+    pub fn acked(&mut self) {
+        self.unacked_segments = 0;
+        self.deadline = None;
+    }
+}
+
 /// Trims the segment `header` and `payload` such that only bytes in the sequence `range` remain.
 /// This may modify the segment sequence number, SYN/FIN flags, or payload.
 fn trim_segment(
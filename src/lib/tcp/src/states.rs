@@ -187,6 +187,32 @@ impl<X: Dependencies> Common<X> {
     pub fn current_time(&self) -> X::Instant {
         self.deps.current_time()
     }
+
+    /// Register a timer for the connection's delayed acknowledgement, if it has received data that
+    /// it's waiting to acknowledge.
+    pub fn schedule_delayed_ack(&self, connection: &mut Connection<X::Instant>) {
+        let Some(deadline) = connection.schedule_delayed_ack(self.current_time()) else {
+            return;
+        };
+
+        self.register_timer(deadline, |mut state| {
+            // the state may have changed since the timer was registered
+            let (now, connection) = match &mut state {
+                TcpStateEnum::SynReceived(x) => (x.common.current_time(), &mut x.connection),
+                TcpStateEnum::Established(x) => (x.common.current_time(), &mut x.connection),
+                TcpStateEnum::FinWaitOne(x) => (x.common.current_time(), &mut x.connection),
+                TcpStateEnum::FinWaitTwo(x) => (x.common.current_time(), &mut x.connection),
+                TcpStateEnum::Closing(x) => (x.common.current_time(), &mut x.connection),
+                TcpStateEnum::TimeWait(x) => (x.common.current_time(), &mut x.connection),
+                TcpStateEnum::CloseWait(x) => (x.common.current_time(), &mut x.connection),
+                TcpStateEnum::LastAck(x) => (x.common.current_time(), &mut x.connection),
+                _ => return state,
+            };
+
+            connection.delayed_ack_timer_fired(now);
+            state
+        });
+    }
 }
 
 /// A pair of remote and local addresses, typically used to represent a connection (the 4-tuple).
@@ -897,6 +923,8 @@ impl<X: Dependencies> TcpStateTrait<X> for SynReceivedState<X> {
             return (self.into(), Err(e));
         }
 
+        self.common.schedule_delayed_ack(&mut self.connection);
+
         // if received ACK, move to the "established" state
         if self.connection.syn_was_acked() {
             let new_state = EstablishedState::new(self.common, self.connection);
@@ -1024,6 +1052,8 @@ impl<X: Dependencies> TcpStateTrait<X> for EstablishedState<X> {
             return (self.into(), Err(e));
         }
 
+        self.common.schedule_delayed_ack(&mut self.connection);
+
         // if received FIN, move to the "close-wait" state
         if self.connection.received_fin() {
             let new_state = CloseWaitState::new(self.common, self.connection);
@@ -1128,6 +1158,8 @@ impl<X: Dependencies> TcpStateTrait<X> for FinWaitOneState<X> {
             return (self.into(), Err(e));
         }
 
+        self.common.schedule_delayed_ack(&mut self.connection);
+
         // if received FIN and ACK, move to the "time-wait" state
         if self.connection.received_fin() && self.connection.fin_was_acked() {
             let new_state = TimeWaitState::new(self.common, self.connection);
@@ -1244,6 +1276,8 @@ impl<X: Dependencies> TcpStateTrait<X> for FinWaitTwoState<X> {
             return (self.into(), Err(e));
         }
 
+        self.common.schedule_delayed_ack(&mut self.connection);
+
         // if received FIN, move to the "time-wait" state
         if self.connection.received_fin() {
             let new_state = TimeWaitState::new(self.common, self.connection);
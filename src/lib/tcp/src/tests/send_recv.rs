@@ -5,6 +5,7 @@ use std::rc::Rc;
 
 use bytes::Bytes;
 
+use crate::tests::util::time::Duration;
 use crate::tests::{establish_helper, Host, Scheduler, TcpSocket, TestEnvState};
 use crate::{Ipv4Header, TcpFlags, TcpHeader, TcpState};
 
@@ -230,3 +231,63 @@ fn test_coalesce_recv() {
     TcpSocket::recvmsg(&tcp, &mut recv_buf[..], 10).unwrap();
     assert_eq!(recv_buf, b"helloworld");
 }
+
+#[test]
+fn test_delayed_ack() {
+    let scheduler = Scheduler::new();
+    let mut host = Host::new();
+
+    // get an established tcp socket
+    let tcp = establish_helper(&scheduler, &mut host);
+
+    /// Helper to send a 5-byte segment to the socket.
+    fn push_segment(tcp: &Rc<RefCell<TcpSocket>>, host: &Host, seq: u32) {
+        let header = TcpHeader {
+            ip: Ipv4Header {
+                src: "5.6.7.8".parse().unwrap(),
+                dst: host.ip_addr,
+            },
+            flags: TcpFlags::empty(),
+            src_port: 20,
+            dst_port: 10,
+            seq,
+            ack: 1,
+            window_size: 10000,
+            selective_acks: None,
+            window_scale: None,
+            timestamp: None,
+            timestamp_echo: None,
+        };
+        tcp.borrow_mut()
+            .push_in_packet(&header, Bytes::from(&b"hello"[..]).into());
+    }
+
+    let mut seq = 1;
+
+    // the first segments of a connection are acknowledged immediately
+    for _ in 0..16 {
+        push_segment(&tcp, &host, seq);
+        seq += 5;
+        let (header, _) = scheduler.pop_packet().unwrap();
+        assert_eq!(header.ack, seq);
+    }
+
+    // after that, only every second segment is acknowledged immediately
+    push_segment(&tcp, &host, seq);
+    seq += 5;
+    assert!(scheduler.pop_packet().is_none());
+    push_segment(&tcp, &host, seq);
+    seq += 5;
+    let (header, _) = scheduler.pop_packet().unwrap();
+    assert_eq!(header.ack, seq);
+
+    // a single segment is acknowledged when the delayed ack timer fires
+    push_segment(&tcp, &host, seq);
+    seq += 5;
+    scheduler.advance(Duration::from_millis(39));
+    assert!(scheduler.pop_packet().is_none());
+    scheduler.advance(Duration::from_millis(1));
+    let (header, _) = scheduler.pop_packet().unwrap();
+    assert_eq!(header.ack, seq);
+    assert!(scheduler.pop_packet().is_none());
+}
@@ -1,6 +1,8 @@
 // https://github.com/rust-lang/rfcs/blob/master/text/2585-unsafe-block-in-unsafe-fn.md
 #![deny(unsafe_op_in_unsafe_fn)]
 
+use std::sync::OnceLock;
+
 // Force cargo to link against crates that aren't (yet) referenced from Rust
 // code (but are referenced from this crate's C code).
 // https://github.com/rust-lang/cargo/issues/9391
@@ -32,8 +34,14 @@ impl Tsc {
     /// (particularly AMD), and can return the wrong value for others. i.e. this
     /// needs more work if we need to dependably get the host's TSC rate.
     /// e.g. see <https://github.com/shadow/shadow/issues/1519>.
+    ///
+    /// The rate is found using cpuid rather than by calibrating against a clock, so this is cheap,
+    /// but cpuid traps to the hypervisor in a VM and the result never changes, so it's only looked
+    /// up once per process.
     pub fn native_cycles_per_second() -> Option<u64> {
-        let res = unsafe { c_internal::TscC_nativeCyclesPerSecond() };
+        static CYCLES_PER_SECOND: OnceLock<u64> = OnceLock::new();
+        let res =
+            *CYCLES_PER_SECOND.get_or_init(|| unsafe { c_internal::TscC_nativeCyclesPerSecond() });
         if res == 0 {
             None
         } else {
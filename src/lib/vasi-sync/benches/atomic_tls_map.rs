@@ -0,0 +1,53 @@
+use std::num::NonZeroUsize;
+
+use criterion::{black_box, criterion_group, criterion_main, Criterion};
+use vasi_sync::atomic_tls_map::AtomicTlsMap;
+
+/// The same capacity as the shim's TLS fallback table.
+const N: usize = 100;
+
+const ITERATIONS: usize = 10_000;
+
+fn table_with_keys(num_keys: usize) -> (Box<AtomicTlsMap<N, u32>>, Vec<NonZeroUsize>) {
+    let table = Box::new(AtomicTlsMap::<N, u32>::new());
+    // Keys resembling ELF thread pointers: far apart and page-aligned-ish.
+    let keys: Vec<_> = (1..=num_keys)
+        .map(|i| NonZeroUsize::new(0x7f00_0000_0000 + i * 0x80_1000).unwrap())
+        .collect();
+    for (i, key) in keys.iter().enumerate() {
+        unsafe { table.get_or_insert_with(*key, || i as u32) };
+    }
+    (table, keys)
+}
+
+/// Repeated lookups of the same key, as when one thread runs for a while.
+fn same_key(table: &AtomicTlsMap<N, u32>, key: NonZeroUsize) -> u32 {
+    let mut sum = 0;
+    for _ in 0..ITERATIONS {
+        sum += *unsafe { table.get(black_box(key)) }.unwrap();
+    }
+    sum
+}
+
+/// Lookups alternating between keys, so that the last-found hint never hits.
+fn alternating_keys(table: &AtomicTlsMap<N, u32>, keys: &[NonZeroUsize]) -> u32 {
+    let mut sum = 0;
+    for i in 0..ITERATIONS {
+        let key = keys[i % keys.len()];
+        sum += *unsafe { table.get(black_box(key)) }.unwrap();
+    }
+    sum
+}
+
+pub fn criterion_benchmark(c: &mut Criterion) {
+    let (table, keys) = table_with_keys(50);
+    c.bench_function("atomic_tls_map_same_key", |b| {
+        b.iter(|| same_key(&table, keys[0]))
+    });
+    c.bench_function("atomic_tls_map_alternating_keys", |b| {
+        b.iter(|| alternating_keys(&table, &keys))
+    });
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
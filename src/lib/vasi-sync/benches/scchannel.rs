@@ -14,7 +14,9 @@ struct Ipc(SelfContainedChannel<()>, SelfContainedChannel<()>);
 
 const PID_ZERO: Option<Pid> = Pid::from_raw(0);
 
-fn ping_pong(bencher: &mut Bencher, do_pinning: bool) {
+/// If `max_spins` is non-zero, both channels spin for up to that many
+/// iterations before sleeping (see `SelfContainedChannel::set_max_spins`).
+fn ping_pong(bencher: &mut Bencher, do_pinning: bool, max_spins: u32) {
     let initial_cpu_set = rustix::process::sched_getaffinity(PID_ZERO).unwrap();
     let pinned_cpu_id = (0..).find(|i| initial_cpu_set.is_set(*i)).unwrap();
     let pinned_cpu_set = {
@@ -30,6 +32,8 @@ fn ping_pong(bencher: &mut Bencher, do_pinning: bool) {
         SelfContainedChannel::new(),
         SelfContainedChannel::new(),
     ));
+    ipc.0.set_max_spins(max_spins);
+    ipc.1.set_max_spins(max_spins);
 
     let receiver_thread = {
         let ipc = ipc.clone();
@@ -59,8 +63,10 @@ fn ping_pong(bencher: &mut Bencher, do_pinning: bool) {
 }
 
 pub fn criterion_benchmark(c: &mut Criterion) {
-    c.bench_function("ping pong", |b| ping_pong(b, false));
-    c.bench_function("ping pong pinned", |b| ping_pong(b, true));
+    c.bench_function("ping pong", |b| ping_pong(b, false, 0));
+    c.bench_function("ping pong pinned", |b| ping_pong(b, true, 0));
+    c.bench_function("ping pong spin", |b| ping_pong(b, false, 10_000));
+    c.bench_function("ping pong pinned spin", |b| ping_pong(b, true, 10_000));
 }
 
 criterion_group!(benches, criterion_benchmark);
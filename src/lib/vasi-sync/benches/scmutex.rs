@@ -0,0 +1,79 @@
+use std::sync::atomic::{AtomicBool, Ordering};
+
+use criterion::{black_box, criterion_group, criterion_main, Bencher, Criterion};
+use vasi_sync::scmutex::SelfContainedMutex;
+
+/// State shared with a forked child process, like `HostShmem` is shared with
+/// the managed processes.
+#[repr(C)]
+struct Shared {
+    mutex: SelfContainedMutex<[u64; 8]>,
+    stop: AtomicBool,
+}
+
+/// A short critical section, similar to the shim's accesses of the host's
+/// protected shared memory.
+fn critical_section(data: &mut [u64; 8]) {
+    for _ in 0..16 {
+        for x in data.iter_mut() {
+            *x = black_box(*x).wrapping_add(1);
+        }
+    }
+}
+
+fn uncontended(bencher: &mut Bencher) {
+    let mutex = SelfContainedMutex::new([0; 8]);
+    bencher.iter(|| critical_section(&mut mutex.lock()));
+    assert_eq!(mutex.contention_stats().contended, 0);
+}
+
+/// The lock is also taken in a loop by a forked child process.
+fn contended_cross_process(bencher: &mut Bencher) {
+    let size = std::mem::size_of::<Shared>();
+    let ptr = unsafe {
+        libc::mmap(
+            std::ptr::null_mut(),
+            size,
+            libc::PROT_READ | libc::PROT_WRITE,
+            libc::MAP_SHARED | libc::MAP_ANONYMOUS,
+            -1,
+            0,
+        )
+    };
+    assert_ne!(ptr, libc::MAP_FAILED);
+    let ptr = ptr as *mut Shared;
+    unsafe {
+        ptr.write(Shared {
+            mutex: SelfContainedMutex::new([0; 8]),
+            stop: AtomicBool::new(false),
+        })
+    };
+    let shared = unsafe { &*ptr };
+
+    let child = unsafe { libc::fork() };
+    assert!(child >= 0);
+    if child == 0 {
+        while !shared.stop.load(Ordering::Relaxed) {
+            critical_section(&mut shared.mutex.lock());
+        }
+        unsafe { libc::_exit(0) };
+    }
+
+    bencher.iter(|| critical_section(&mut shared.mutex.lock()));
+
+    shared.stop.store(true, Ordering::Relaxed);
+    let mut status = 0;
+    assert_eq!(unsafe { libc::waitpid(child, &mut status, 0) }, child);
+    assert!(libc::WIFEXITED(status));
+
+    unsafe { std::ptr::drop_in_place(ptr) };
+    assert_eq!(unsafe { libc::munmap(ptr as *mut libc::c_void, size) }, 0);
+}
+
+pub fn criterion_benchmark(c: &mut Criterion) {
+    c.bench_function("scmutex uncontended", uncontended);
+    c.bench_function("scmutex contended cross-process", contended_cross_process);
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
@@ -16,6 +16,11 @@ use core::ops::Deref;
 /// from its "home" location, but is `O(N)` worst case. Lookup of a non-present
 /// key is always `O(N)`; we need to scan the whole table.
 ///
+/// The index of the most recently found key is kept as a hint, and checked
+/// before hashing and probing. In Shadow only one thread of a managed process
+/// runs at a time, and it typically accesses its thread-local storage many
+/// times in a row, so the hint almost always hits.
+///
 /// This is designed mostly for use by `shadow_shim::tls` to help implement
 /// thread-local storage.
 pub struct AtomicTlsMap<const N: usize, V, H = core::hash::BuildHasherDefault<rustc_hash::FxHasher>>
@@ -28,6 +33,9 @@ where
     // TODO: Consider storing `RefCell<V>` in `values` instead. That'd be a bit
     // more idiomatic, and is probably a better layout for cache performance.
     refcounts: [Cell<usize>; N],
+    // Index of the most recently inserted or found key. It's only a hint, so
+    // may be stale; the key at this index is always checked first.
+    idx_hint: AtomicUsize,
     build_hasher: H,
 }
 /// Override default of `UnsafeCell`, `Cell`, and `V` not being `Sync`.  We
@@ -100,6 +108,7 @@ where
             keys: core::array::from_fn(|_| AtomicOptionNonZeroUsize::new(None)),
             values: core::array::from_fn(|_| UnsafeCell::new(MaybeUninit::uninit())),
             refcounts: core::array::from_fn(|_| Cell::new(0)),
+            idx_hint: AtomicUsize::new(0),
             build_hasher,
         }
     }
@@ -119,11 +128,24 @@ where
     /// way in linear search, and moving the value if its refcount is currently
     /// 0.
     fn idx(&self, key: NonZeroUsize) -> Option<usize> {
-        self.indexes_from(key).find(|idx| {
-            // Relaxed because of requirement that only one thread ever accesses
-            // a given key at once.
+        // Relaxed because of requirement that only one thread ever accesses
+        // a given key at once. The hint itself doesn't synchronize anything;
+        // if another thread changed it, we just miss.
+        let hint = self.idx_hint.load(atomic::Ordering::Relaxed);
+        if self
+            .keys
+            .get(hint)
+            .is_some_and(|k| k.load(atomic::Ordering::Relaxed) == Some(key))
+        {
+            return Some(hint);
+        }
+
+        let idx = self.indexes_from(key).find(|idx| {
+            // Relaxed for the same reason as above.
             self.keys[*idx].load(atomic::Ordering::Relaxed) == Some(key)
-        })
+        })?;
+        self.idx_hint.store(idx, atomic::Ordering::Relaxed);
+        Some(idx)
     }
 
     /// # Safety
@@ -166,6 +188,7 @@ where
                     .is_ok()
             })
             .unwrap();
+        self.idx_hint.store(idx, atomic::Ordering::Relaxed);
         self.values[idx].get_mut().with(|table_value| {
             let table_value = unsafe { &mut *table_value };
             table_value.write(value)
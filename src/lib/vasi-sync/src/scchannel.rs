@@ -160,21 +160,92 @@ impl Display for SelfContainedChannelError {
 /// simulation machine, but only a 3.5% benefit in the "ping pong pinned"
 /// microbenchmark; the latter is expected to be more representative of real
 /// large simulation runs (i.e. pinning should be enabled).
+///
+/// By default `receive` sleeps on a futex as soon as no message is ready. When
+/// the sender runs on a different CPU, it can be faster to spin for a while
+/// first; see [`SelfContainedChannel::set_max_spins`]. Spinning is wasted work
+/// when both ends are pinned to the same CPU, so it's disabled by default.
 #[cfg_attr(not(loom), derive(VirtualAddressSpaceIndependent))]
 #[repr(C)]
 pub struct SelfContainedChannel<T> {
     message: UnsafeCell<MaybeUninit<T>>,
     state: AtomicChannelState,
+    // Upper bound on the number of spin iterations in `receive`. 0 disables spinning.
+    max_spins: AtomicU32,
+    // Number of spin iterations to try in the next `receive`, adapted to how
+    // long recent messages took to arrive.
+    spin_budget: AtomicU32,
 }
 
 impl<T> SelfContainedChannel<T> {
+    /// The smallest spin budget when spinning is enabled, so that the budget
+    /// can grow again after messages were slow to arrive.
+    const MIN_SPINS: u32 = 16;
+
     pub fn new() -> Self {
         Self {
             message: UnsafeCell::new(MaybeUninit::uninit()),
             state: AtomicChannelState::new(),
+            max_spins: AtomicU32::new(0),
+            spin_budget: AtomicU32::new(0),
         }
     }
 
+    /// Allow `receive` to spin up to `max_spins` iterations waiting for a
+    /// message before yielding the CPU once and then sleeping on a futex. The
+    /// number of iterations actually used adapts to how quickly recent messages
+    /// arrived. Setting this to 0 (the default) disables spinning.
+    ///
+    /// This is a setting of the receiving end, so each direction of a
+    /// bidirectional pair of channels can be configured independently.
+    pub fn set_max_spins(&self, max_spins: u32) {
+        self.max_spins
+            .store(max_spins, sync::atomic::Ordering::Relaxed);
+        self.spin_budget
+            .store(max_spins, sync::atomic::Ordering::Relaxed);
+    }
+
+    /// Spin until a message is ready, the writer is closed, or the spin budget
+    /// is used up. Returns the most recently observed state.
+    fn spin_wait(&self, mut state: ChannelState) -> ChannelState {
+        let max_spins = self.max_spins.load(sync::atomic::Ordering::Relaxed);
+        if max_spins == 0 {
+            return state;
+        }
+
+        let min_spins = core::cmp::min(Self::MIN_SPINS, max_spins);
+        let budget = self
+            .spin_budget
+            .load(sync::atomic::Ordering::Relaxed)
+            .clamp(min_spins, max_spins);
+
+        // Move the budget an eighth of the way towards `target`, similar to
+        // glibc's adaptive mutexes.
+        let update_budget = |target: u32| {
+            let budget = i64::from(budget);
+            let new = budget + (i64::from(target) - budget) / 8;
+            let new = new.clamp(i64::from(min_spins), i64::from(max_spins));
+            self.spin_budget
+                .store(new as u32, sync::atomic::Ordering::Relaxed);
+        };
+
+        for i in 0..budget {
+            if state.contents_state == ChannelContentsState::Ready || state.writer_closed {
+                // Aim for twice the number of spins that this message needed.
+                update_budget(i.saturating_mul(2));
+                return state;
+            }
+            sync::spin_loop();
+            state = self.state.load(sync::atomic::Ordering::Relaxed);
+        }
+
+        // Spinning didn't help this time; spin less next time, and give the
+        // sender a chance to run before going to sleep.
+        update_budget(0);
+        sync::sched_yield();
+        self.state.load(sync::atomic::Ordering::Relaxed)
+    }
+
     /// Sends `message` through the channel.
     ///
     /// Panics if the channel already has an unreceived message.
@@ -217,6 +288,9 @@ impl<T> SelfContainedChannel<T> {
     /// Panics if another thread is already trying to receive on this channel.
     pub fn receive(&self) -> Result<T, SelfContainedChannelError> {
         let mut state = self.state.load(sync::atomic::Ordering::Relaxed);
+        if state.contents_state != ChannelContentsState::Ready {
+            state = self.spin_wait(state);
+        }
         loop {
             if state.contents_state == ChannelContentsState::Ready {
                 break;
@@ -140,10 +140,24 @@ impl From<FutexWord> for u32 {
 /// * Works across processes (e.g. doesn't use FUTEX_PRIVATE_FLAG)
 ///
 /// Performance is optimized primarily for low-contention scenarios.
+///
+/// When the lock is held by another thread, `lock` spins for a while before
+/// sleeping on the futex, since critical sections are typically much shorter
+/// than a futex wait and wake. The number of spins adapts to how long recent
+/// waits for the lock took, similar to glibc's adaptive mutexes. The mutex
+/// also counts how often it was contended; see
+/// [`SelfContainedMutex::contention_stats`].
 #[cfg_attr(not(loom), derive(VirtualAddressSpaceIndependent))]
 #[repr(C)]
 pub struct SelfContainedMutex<T> {
     futex: AtomicFutexWord,
+    // Moving average of the number of spins that recent contended `lock` calls
+    // needed (or used up), which sets the spin budget of the next one.
+    spin_estimate: sync::atomic::AtomicU32,
+    // Number of `lock` calls that found the lock held.
+    contended: sync::atomic::AtomicU32,
+    // Number of times that `lock` slept on the futex.
+    sleeps: sync::atomic::AtomicU32,
     val: sync::UnsafeCell<T>,
 }
 
@@ -154,6 +168,31 @@ const UNLOCKED: u16 = 0;
 const LOCKED: u16 = 1;
 const LOCKED_DISCONNECTED: u16 = 2;
 
+/// Upper bound on the number of spin iterations in a contended `lock`.
+#[cfg(not(loom))]
+const MAX_SPINS: u32 = 100;
+// Keep loom's state space small.
+#[cfg(loom)]
+const MAX_SPINS: u32 = 2;
+
+/// The number of spin iterations in a contended `lock` beyond twice the
+/// estimate, so that the estimate can grow.
+#[cfg(not(loom))]
+const MIN_SPINS: u32 = 10;
+#[cfg(loom)]
+const MIN_SPINS: u32 = 1;
+
+/// Contention counters of a [`SelfContainedMutex`]. The counters wrap around on
+/// overflow.
+#[derive(Copy, Clone, Debug, Default, Eq, PartialEq)]
+pub struct SelfContainedMutexStats {
+    /// The number of `lock` calls that found the lock held by another thread.
+    pub contended: u32,
+    /// The number of times that `lock` had to sleep on the futex, after
+    /// spinning didn't acquire the lock.
+    pub sleeps: u32,
+}
+
 impl<T> SelfContainedMutex<T> {
     // TODO: merge with `new` when `AtomicFutexWord` supports a const `new`.
     #[cfg(not(loom))]
@@ -163,6 +202,9 @@ impl<T> SelfContainedMutex<T> {
                 lock_state: UNLOCKED,
                 num_sleepers: 0,
             }),
+            spin_estimate: sync::atomic::AtomicU32::new(0),
+            contended: sync::atomic::AtomicU32::new(0),
+            sleeps: sync::atomic::AtomicU32::new(0),
             val: sync::UnsafeCell::new(val),
         }
     }
@@ -173,16 +215,60 @@ impl<T> SelfContainedMutex<T> {
                 lock_state: UNLOCKED,
                 num_sleepers: 0,
             }),
+            spin_estimate: sync::atomic::AtomicU32::new(0),
+            contended: sync::atomic::AtomicU32::new(0),
+            sleeps: sync::atomic::AtomicU32::new(0),
             val: sync::UnsafeCell::new(val),
         }
     }
 
+    /// The contention counters of this mutex.
+    pub fn contention_stats(&self) -> SelfContainedMutexStats {
+        SelfContainedMutexStats {
+            contended: self.contended.load(sync::Ordering::Relaxed),
+            sleeps: self.sleeps.load(sync::Ordering::Relaxed),
+        }
+    }
+
+    /// Spin until the lock is released or the spin budget is used up. Returns
+    /// the most recently observed state.
+    fn spin_wait(&self, mut current: FutexWord) -> FutexWord {
+        // A disconnected lock is typically held for a long time.
+        if current.lock_state != LOCKED {
+            return current;
+        }
+
+        let estimate = self.spin_estimate.load(sync::Ordering::Relaxed);
+        let budget = core::cmp::min(MAX_SPINS, estimate.saturating_mul(2) + MIN_SPINS);
+
+        // Move the estimate an eighth of the way towards `spins`.
+        let update_estimate = |spins: u32| {
+            let estimate = i64::from(estimate);
+            let new = estimate + (i64::from(spins) - estimate) / 8;
+            self.spin_estimate
+                .store(new.try_into().unwrap(), sync::Ordering::Relaxed);
+        };
+
+        for i in 0..budget {
+            sync::spin_loop();
+            current = self.futex.load(sync::Ordering::Relaxed);
+            if current.lock_state != LOCKED {
+                update_estimate(i + 1);
+                return current;
+            }
+        }
+
+        update_estimate(budget);
+        current
+    }
+
     pub fn lock(&self) -> SelfContainedMutexGuard<T> {
         // On first attempt, optimistically assume the lock is uncontended.
         let mut current = FutexWord {
             lock_state: UNLOCKED,
             num_sleepers: 0,
         };
+        let mut spun = false;
         loop {
             if current.lock_state == UNLOCKED {
                 // Try to take the lock.
@@ -211,6 +297,17 @@ impl<T> SelfContainedMutex<T> {
                 continue;
             }
 
+            // Only spin once per call; after being woken from the futex, the
+            // lock was just released and is typically taken right away.
+            if !spun {
+                spun = true;
+                self.contended.fetch_add(1, sync::Ordering::Relaxed);
+                current = self.spin_wait(current);
+                if current.lock_state == UNLOCKED {
+                    continue;
+                }
+            }
+
             // Try to sleep on the futex.
 
             // Since incrementing is a read-modify-write operation, this does
@@ -223,7 +320,12 @@ impl<T> SelfContainedMutex<T> {
                     break;
                 }
                 match sync::futex_wait(&self.futex.0, current.into()) {
-                    Ok(_) | Err(rustix::io::Errno::INTR) => break,
+                    Ok(_) | Err(rustix::io::Errno::INTR) => {
+                        // Only count waits that actually slept, not attempts
+                        // that found the futex word had changed.
+                        self.sleeps.fetch_add(1, sync::Ordering::Relaxed);
+                        break;
+                    }
                     Err(rustix::io::Errno::AGAIN) => {
                         // We may have gotten this because another thread is
                         // also trying to sleep on the futex, and just
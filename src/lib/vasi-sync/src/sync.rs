@@ -44,6 +44,11 @@ pub fn sched_yield() {
     loom::thread::yield_now();
 }
 
+#[cfg(not(loom))]
+pub use core::hint::spin_loop;
+#[cfg(loom)]
+pub use loom::hint::spin_loop;
+
 // Rustix doesn't define its `FutexOperation` type under miri, so we can't use it in
 // our interfaces. Use our own type and translate in our futex "backends".
 enum FutexOperation {
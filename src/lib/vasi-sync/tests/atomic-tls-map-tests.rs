@@ -100,6 +100,25 @@ mod atomic_tls_map_tests {
         })
     }
 
+    #[test]
+    fn test_removed_key_at_hint() {
+        sync::model(|| {
+            // With a single slot, every key uses the same index as the last one found.
+            let table = AtomicTlsMap::<1, u32>::new();
+            let key1 = NonZeroUsize::try_from(1).unwrap();
+            let key2 = NonZeroUsize::try_from(2).unwrap();
+            unsafe {
+                assert_eq!(*table.get_or_insert_with(key1, || 11), 11);
+                assert_eq!(table.get(key1).as_deref().copied(), Some(11));
+                assert_eq!(table.remove(key1), Some(11));
+
+                assert_eq!(*table.get_or_insert_with(key2, || 12), 12);
+                assert_eq!(table.get(key1).as_deref().copied(), None);
+                assert_eq!(table.get(key2).as_deref().copied(), Some(12));
+            }
+        })
+    }
+
     #[test]
     fn test_forget_all_and_reuse_key() {
         sync::model(|| {
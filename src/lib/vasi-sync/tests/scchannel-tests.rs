@@ -37,6 +37,23 @@ mod scchannel_tests {
         })
     }
 
+    #[test]
+    fn test_two_threads_spinning() {
+        sync::model(|| {
+            let channel = sync::Arc::new(SelfContainedChannel::new());
+            channel.set_max_spins(2);
+            let writer = {
+                let channel = channel.clone();
+                sync::thread::spawn(move || {
+                    channel.send(42);
+                })
+            };
+            let reader = sync::thread::spawn(move || channel.receive());
+            writer.join().unwrap();
+            assert_eq!(reader.join().unwrap(), Ok(42));
+        })
+    }
+
     #[test]
     fn test_drop_cross_thread() {
         sync::model(|| {
@@ -3,7 +3,7 @@
 //! loom.
 //!
 //! [loom]: <https://docs.rs/loom/latest/loom/>
-use vasi_sync::scmutex::{SelfContainedMutex, SelfContainedMutexGuard};
+use vasi_sync::scmutex::{SelfContainedMutex, SelfContainedMutexGuard, SelfContainedMutexStats};
 
 mod sync;
 
@@ -95,6 +95,49 @@ mod scmutex_tests {
 
             let guard = mutex.lock();
             assert_eq!(*guard, nthreads);
+
+            let stats = mutex.contention_stats();
+            assert!(stats.contended <= nthreads);
+            assert!(stats.sleeps == 0 || stats.contended > 0);
+        })
+    }
+
+    #[test]
+    fn test_uncontended_stats() {
+        sync::model(|| {
+            let mutex = SelfContainedMutex::new(0);
+            for _ in 0..3 {
+                *mutex.lock() += 1;
+            }
+            assert_eq!(mutex.contention_stats(), SelfContainedMutexStats::default());
+        })
+    }
+
+    #[test]
+    fn test_contended_stats() {
+        sync::model(|| {
+            let mutex = sync::Arc::new(SelfContainedMutex::new(0));
+            let mut guard = mutex.lock();
+
+            let thread = {
+                let mutex = mutex.clone();
+                sync::thread::spawn(move || {
+                    *mutex.lock() += 1;
+                })
+            };
+
+            sync::rand_sleep();
+            *guard += 1;
+            drop(guard);
+
+            thread.join().unwrap();
+            assert_eq!(*mutex.lock(), 2);
+
+            // The other thread may or may not have found the lock held, and
+            // only sleeps if it did.
+            let stats = mutex.contention_stats();
+            assert!(stats.contended <= 1);
+            assert!(stats.sleeps == 0 || stats.contended == 1);
         })
     }
 }
@@ -0,0 +1,50 @@
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use shadow_rs::utility::byte_queue::ByteQueue;
+
+/// The number of bytes written and read per iteration.
+const TOTAL: usize = 1024 * 1024;
+
+/// Write `TOTAL` bytes to the queue in `chunk`-sized writes and read them back in `chunk`-sized
+/// reads, like a socket buffer that's kept partly full.
+fn stream(queue: &mut ByteQueue, data: &[u8], buf: &mut [u8]) {
+    for _ in 0..(TOTAL / data.len()) {
+        queue.push_stream(data).unwrap();
+        queue.pop(&mut *buf).unwrap();
+    }
+}
+
+/// The same as [`stream`], but each write is a separate packet.
+fn packets(queue: &mut ByteQueue, data: &[u8], buf: &mut [u8]) {
+    for _ in 0..(TOTAL / data.len()) {
+        queue.push_packet(data, data.len()).unwrap();
+        queue.pop(&mut *buf).unwrap();
+    }
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("byte_queue");
+    group.throughput(Throughput::Bytes(TOTAL as u64));
+
+    for chunk in [64, 1460, 65536] {
+        let data = vec![0xAB; chunk];
+        let mut buf = vec![0; chunk];
+
+        group.bench_with_input(BenchmarkId::new("stream", chunk), &data, |b, data| {
+            // the same chunk capacity as socket buffers
+            let mut queue = ByteQueue::new(4096);
+            // keep some bytes queued so that reads don't always empty the queue
+            queue.push_stream(&data[..]).unwrap();
+            b.iter(|| stream(&mut queue, data, &mut buf))
+        });
+        group.bench_with_input(BenchmarkId::new("packets", chunk), &data, |b, data| {
+            let mut queue = ByteQueue::new(4096);
+            queue.push_packet(&data[..], data.len()).unwrap();
+            b.iter(|| packets(&mut queue, data, &mut buf))
+        });
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
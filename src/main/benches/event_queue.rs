@@ -0,0 +1,120 @@
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use rand::{Rng, SeedableRng};
+use rand_xoshiro::Xoshiro256PlusPlus;
+use shadow_rs::core::work::event_queue::{
+    Timed, TimingWheel, TIMING_WHEEL_NUM_SLOTS, TIMING_WHEEL_SLOT_WIDTH,
+};
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+/// The number of events popped and pushed per iteration.
+const OPS: u64 = 1000;
+
+/// A stand-in for an `Event`, which can't be created without a host.
+#[derive(Debug, PartialEq, Eq, PartialOrd, Ord)]
+struct Item {
+    time: EmulatedTime,
+    id: u64,
+}
+
+impl Timed for Item {
+    fn time(&self) -> EmulatedTime {
+        self.time
+    }
+}
+
+trait Queue: Default {
+    fn push(&mut self, item: Item);
+    fn pop(&mut self) -> Option<Item>;
+}
+
+#[derive(Default)]
+struct Heap(BinaryHeap<Reverse<Item>>);
+
+impl Queue for Heap {
+    fn push(&mut self, item: Item) {
+        self.0.push(Reverse(item))
+    }
+
+    fn pop(&mut self) -> Option<Item> {
+        self.0.pop().map(|x| x.0)
+    }
+}
+
+struct Wheel(TimingWheel<Item>);
+
+impl Default for Wheel {
+    fn default() -> Self {
+        Self(TimingWheel::new(
+            TIMING_WHEEL_SLOT_WIDTH,
+            TIMING_WHEEL_NUM_SLOTS,
+        ))
+    }
+}
+
+impl Queue for Wheel {
+    fn push(&mut self, item: Item) {
+        self.0.push(item)
+    }
+
+    fn pop(&mut self) -> Option<Item> {
+        self.0.pop()
+    }
+}
+
+/// The delay of a new event: mostly packet latencies and short timers, with some long timers.
+fn delay(rng: &mut impl Rng) -> SimulationTime {
+    if rng.gen_bool(0.9) {
+        SimulationTime::from_micros(rng.gen_range(100..50_000))
+    } else {
+        SimulationTime::from_secs(rng.gen_range(1..60))
+    }
+}
+
+/// A queue holding `len` events, and the rng to continue scheduling events with.
+fn filled<Q: Queue>(len: u64) -> (Q, Xoshiro256PlusPlus) {
+    let mut rng = Xoshiro256PlusPlus::seed_from_u64(1);
+    let mut queue = Q::default();
+    for id in 0..len {
+        queue.push(Item {
+            time: EmulatedTime::SIMULATION_START + delay(&mut rng),
+            id,
+        });
+    }
+    (queue, rng)
+}
+
+/// The "hold" model: pop the earliest event, and push a new event some time after it.
+fn hold<Q: Queue>(queue: &mut Q, rng: &mut impl Rng) {
+    for _ in 0..OPS {
+        let item = queue.pop().unwrap();
+        queue.push(Item {
+            time: item.time + delay(rng),
+            id: item.id,
+        });
+    }
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("event_queue_hold");
+    group.throughput(Throughput::Elements(OPS));
+
+    for len in [16, 1024, 65536] {
+        group.bench_function(BenchmarkId::new("heap", len), |b| {
+            let (mut queue, mut rng) = filled::<Heap>(len);
+            b.iter(|| hold(&mut queue, &mut rng))
+        });
+        group.bench_function(BenchmarkId::new("timing_wheel", len), |b| {
+            let (mut queue, mut rng) = filled::<Wheel>(len);
+            b.iter(|| hold(&mut queue, &mut rng))
+        });
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
@@ -0,0 +1,60 @@
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use rand::{Rng, SeedableRng};
+use rand_xoshiro::Xoshiro256PlusPlus;
+use shadow_rs::utility::interval_map::IntervalMap;
+
+/// The size of each region, like a single page mapped by a small `mmap`.
+const REGION_LEN: usize = 4096;
+
+/// The number of operations per iteration.
+const OPS: u64 = 1000;
+
+/// A map of `num_regions` adjacent regions, like a process that made many small mappings.
+fn build_map(num_regions: usize) -> IntervalMap<u64> {
+    let mut map = IntervalMap::new();
+    for i in 0..num_regions {
+        let start = i * REGION_LEN;
+        map.insert(start..(start + REGION_LEN), i as u64);
+    }
+    map
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("interval_map");
+    group.throughput(Throughput::Elements(OPS));
+
+    for num_regions in [1_000, 100_000] {
+        let mut rng = Xoshiro256PlusPlus::seed_from_u64(0);
+        let addresses: Vec<usize> = (0..OPS)
+            .map(|_| rng.gen_range(0..(num_regions * REGION_LEN)))
+            .collect();
+
+        // a lookup of a pointer, as in `MemoryMapper::get_mapped_ptr`
+        let map = build_map(num_regions);
+        group.bench_with_input(BenchmarkId::new("get", num_regions), &addresses, |b, x| {
+            b.iter(|| x.iter().filter_map(|x| map.get(*x)).count())
+        });
+
+        // an `mprotect` of part of a region, which splits it, followed by one that restores it
+        let mut map = build_map(num_regions);
+        group.bench_with_input(
+            BenchmarkId::new("split_and_merge", num_regions),
+            &addresses,
+            |b, x| {
+                b.iter(|| {
+                    for addr in x {
+                        let start = addr - addr % REGION_LEN;
+                        let val = *map.get(start).unwrap().1;
+                        map.insert((start + 1024)..(start + 2048), val + 1);
+                        map.insert(start..(start + REGION_LEN), val);
+                    }
+                })
+            },
+        );
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
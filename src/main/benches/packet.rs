@@ -0,0 +1,63 @@
+use std::net::{Ipv4Addr, SocketAddrV4};
+
+use bytes::{Bytes, BytesMut};
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use shadow_rs::cshadow as c;
+use shadow_rs::network::packet::PacketRc;
+
+const SRC: SocketAddrV4 = SocketAddrV4::new(Ipv4Addr::new(11, 0, 0, 1), 5000);
+const DST: SocketAddrV4 = SocketAddrV4::new(Ipv4Addr::new(11, 0, 0, 2), 80);
+
+/// A packet that isn't associated with a host. `PacketRc::new` requires a running worker.
+fn new_packet() -> PacketRc {
+    PacketRc::from_raw(unsafe { c::packet_new_inner(1, 1) })
+}
+
+/// The packet's journey from a socket's send buffer on one host, through the copy made when it's
+/// sent to another host, to the socket's receive buffer on the other host. The payload is shared
+/// with the socket buffers.
+fn send_route_receive(payload: &Bytes) -> Bytes {
+    let mut packet = new_packet();
+    packet.set_udp(SRC, DST);
+    packet.set_payload_bytes(payload.clone(), 0);
+
+    // `Worker::send_packet` copies the packet for the destination host, and the sending host drops
+    // its reference
+    let packet = PacketRc::from_raw(unsafe { c::packet_copy(packet.borrow_inner()) });
+
+    packet.payload_bytes()
+}
+
+/// The same as [`send_route_receive`], but the payload is copied into and out of the packet.
+fn send_route_receive_copied(payload: &Bytes) -> Bytes {
+    let mut packet = new_packet();
+    packet.set_udp(SRC, DST);
+    packet.set_payload(payload, 0);
+
+    let packet = PacketRc::from_raw(unsafe { c::packet_copy(packet.borrow_inner()) });
+
+    let mut received = BytesMut::zeroed(packet.payload_size());
+    packet.get_payload(&mut received);
+    received.freeze()
+}
+
+fn criterion_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("send_route_receive");
+
+    for len in [64, 1460] {
+        let payload = Bytes::from(vec![0xAB; len]);
+        group.throughput(Throughput::Bytes(len as u64));
+
+        group.bench_with_input(BenchmarkId::new("shared", len), &payload, |b, payload| {
+            b.iter(|| send_route_receive(payload))
+        });
+        group.bench_with_input(BenchmarkId::new("copied", len), &payload, |b, payload| {
+            b.iter(|| send_route_receive_copied(payload))
+        });
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
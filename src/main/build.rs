@@ -142,6 +142,7 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .header("host/descriptor/descriptor.h")
         .header("host/descriptor/regular_file.h")
         .header("host/descriptor/tcp_cong.h")
+        .header("host/descriptor/tcp_cong_cubic.h")
         .header("host/descriptor/tcp_cong_reno.h")
         .header("host/futex.h")
         .header("host/process.h")
@@ -163,8 +164,6 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         // Haven't decided how to handle glib struct types yet. Avoid using them
         // until we do.
         .blocklist_type("_?GQueue")
-        .allowlist_function("g_list_append")
-        .allowlist_function("g_list_free")
         .allowlist_type("GList")
         // Needs GQueue
         .opaque_type("_?LegacySocket.*")
@@ -232,10 +231,12 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .allowlist_var("CONFIG_HEADER_SIZE_TCP")
         .allowlist_var("CONFIG_PIPE_BUFFER_SIZE")
         .allowlist_var("CONFIG_MTU")
+        .allowlist_var("PACKET_TCP_INLINE_SACKS")
         .allowlist_var("SYSCALL_IO_BUFSIZE")
         .allowlist_var("SHADOW_SOMAXCONN")
         .allowlist_var("SUID_DUMP_USER")
         .allowlist_var("SUID_DUMP_DISABLE")
+        .allowlist_var("TCP_CONG_CUBIC_NAME")
         .allowlist_var("TCP_CONG_RENO_NAME")
         .opaque_type("SysCallCondition")
         .opaque_type("LegacyFile")
@@ -252,9 +253,12 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .blocklist_type("Timer")
         .blocklist_type("Controller")
         .blocklist_type("Counter")
+        .blocklist_type("IndexedCounter")
         .blocklist_type("Descriptor")
         .blocklist_type("Process")
         .blocklist_type("HostId")
+        .blocklist_type("PayloadBytes")
+        .blocklist_type("PcapFilter")
         .blocklist_type("TaskRef")
         .allowlist_type("WorkerC")
         .opaque_type("WorkerC")
@@ -285,7 +289,9 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .raw_line("use crate::host::syscall::handler::SyscallHandler;")
         .raw_line("use crate::host::syscall_types::SyscallReturn;")
         .raw_line("use crate::host::thread::Thread;")
-        .raw_line("use crate::utility::counter::Counter;")
+        .raw_line("use crate::network::packet::PayloadBytes;")
+        .raw_line("use crate::utility::pcap_writer::PcapFilter;")
+        .raw_line("use crate::utility::counter::{Counter, IndexedCounter};")
         .raw_line("use crate::utility::legacy_callback_queue::RootedRefCell_StateEventSource;")
         .raw_line("")
         .raw_line("use shadow_shim_helper_rs::HostId;")
@@ -342,6 +348,7 @@ fn build_shadow_c(build_common: &ShadowBuildCommon) {
         "host/descriptor/socket.c",
         "host/descriptor/tcp.c",
         "host/descriptor/tcp_cong.c",
+        "host/descriptor/tcp_cong_cubic.c",
         "host/descriptor/tcp_cong_reno.c",
         "host/process.c",
         "host/futex.c",
@@ -44,6 +44,9 @@ typedef struct _PlatformCPUInfo {
     // Keep track of how many workers are assigned to each core, socket, and
     // node.
     GHashTable *cpu_loads, *core_loads, *socket_loads, *node_loads;
+    // Indexed by logical CPU number, the SMT sibling reserved for the plugins
+    // of the worker on that CPU, or AFFINITY_UNINIT.
+    int* plugin_cpus;
 } PlatformCPUInfo;
 
 static PlatformCPUInfo _global_platform_info = {0};
@@ -194,6 +197,29 @@ static void _update_loads(const CPUInfo* cpu_info) {
     _increment_hash_table_value(_global_platform_info.node_loads, _node_key(cpu_info));
 }
 
+/*
+ * Returns the least loaded eligible CPU on the same core as the input CPU, or
+ * NULL if there isn't one.
+ */
+static const CPUInfo* _get_best_sibling(const CPUInfo* cpu_info) {
+    const CPUInfo* p_sibling = NULL;
+
+    for (size_t idx = 0; idx < _global_platform_info.n_cpus; ++idx) {
+        const CPUInfo* rhs = &_global_platform_info.p_cpus[idx];
+        if (rhs->core != cpu_info->core || rhs->logical_cpu_num == cpu_info->logical_cpu_num ||
+            !_cpuIdxIsEligible(idx)) {
+            continue;
+        }
+        if (p_sibling == NULL || _cpuinfo_compare(p_sibling, rhs) == 1) {
+            p_sibling = rhs;
+        }
+    }
+
+    return p_sibling;
+}
+
+static pthread_mutex_t _loads_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 int affinity_getGoodWorkerAffinity() {
 
     if (!_affinity_enabled) {
@@ -203,16 +229,89 @@ int affinity_getGoodWorkerAffinity() {
     // FIXME (rwails): This assumes that the returned affinity was actually
     // used.
 
-    static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
-    pthread_mutex_lock(&mtx);
+    pthread_mutex_lock(&_loads_mtx);
 
     const CPUInfo* p_best_cpu = _get_best_cpu();
     _update_loads(p_best_cpu);
 
-    pthread_mutex_unlock(&mtx);
+    pthread_mutex_unlock(&_loads_mtx);
+    return p_best_cpu->logical_cpu_num;
+}
+
+int affinity_getGoodWorkerAffinityWithSibling() {
+
+    if (!_affinity_enabled) {
+        return AFFINITY_UNINIT;
+    }
+
+    pthread_mutex_lock(&_loads_mtx);
+
+    const CPUInfo* p_best_cpu = _get_best_cpu();
+    _update_loads(p_best_cpu);
+
+    // the sibling counts as loaded, so later workers are placed on other cores
+    // while there are any
+    const CPUInfo* p_sibling = _get_best_sibling(p_best_cpu);
+    if (p_sibling != NULL) {
+        _update_loads(p_sibling);
+        _global_platform_info.plugin_cpus[p_best_cpu->logical_cpu_num] =
+            p_sibling->logical_cpu_num;
+    } else {
+        warning("CPU %d has no SMT sibling, so its plugins will share its CPU",
+                p_best_cpu->logical_cpu_num);
+    }
+
+    pthread_mutex_unlock(&_loads_mtx);
     return p_best_cpu->logical_cpu_num;
 }
 
+int affinity_getPluginAffinity(int cpu_num) {
+    if (!_affinity_enabled || cpu_num < 0 || cpu_num > _global_platform_info.max_cpu_num) {
+        return cpu_num;
+    }
+
+    // workers may still be choosing their CPUs and siblings
+    pthread_mutex_lock(&_loads_mtx);
+    int plugin_cpu = _global_platform_info.plugin_cpus[cpu_num];
+    pthread_mutex_unlock(&_loads_mtx);
+
+    return plugin_cpu != AFFINITY_UNINIT ? plugin_cpu : cpu_num;
+}
+
+static const CPUInfo* _get_cpu_info(int logical_cpu_num) {
+    for (size_t idx = 0; idx < _global_platform_info.n_cpus; ++idx) {
+        if (_global_platform_info.p_cpus[idx].logical_cpu_num == logical_cpu_num) {
+            return &_global_platform_info.p_cpus[idx];
+        }
+    }
+    return NULL;
+}
+
+int affinity_getCPUDistance(int cpu_num_a, int cpu_num_b) {
+    if (!_affinity_enabled) {
+        return -1;
+    }
+
+    const CPUInfo* a = _get_cpu_info(cpu_num_a);
+    const CPUInfo* b = _get_cpu_info(cpu_num_b);
+
+    if (a == NULL || b == NULL) {
+        return -1;
+    }
+
+    if (a->logical_cpu_num == b->logical_cpu_num) {
+        return 0;
+    } else if (a->core == b->core) {
+        return 1;
+    } else if (a->socket == b->socket) {
+        return 2;
+    } else if (a->node == b->node) {
+        return 3;
+    }
+
+    return 4;
+}
+
 /*
  * Read the output of the lscpu command, allocates a buffer, and sets contents
  * to point to the buffer.
@@ -413,6 +512,13 @@ int affinity_initPlatformInfo() {
             MAX(_global_platform_info.max_cpu_num, p_info->logical_cpu_num);
     }
 
+    _global_platform_info.plugin_cpus =
+        malloc(sizeof(int) * (_global_platform_info.max_cpu_num + 1));
+    assert(_global_platform_info.plugin_cpus);
+    for (int cpu_num = 0; cpu_num <= _global_platform_info.max_cpu_num; ++cpu_num) {
+        _global_platform_info.plugin_cpus[cpu_num] = AFFINITY_UNINIT;
+    }
+
     if (lscpu_contents) {
         free(lscpu_contents);
     }
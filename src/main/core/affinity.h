@@ -20,6 +20,38 @@ enum { AFFINITY_UNINIT = -1 };
  */
 int affinity_getGoodWorkerAffinity();
 
+/*
+ * Like affinity_getGoodWorkerAffinity(), but also reserves another logical CPU
+ * on the same core (an SMT sibling) for the plugin threads run by the worker, so
+ * that the worker and its plugins share the core's L1 and L2 caches without
+ * competing for the same logical CPU. The reserved CPU can be looked up with
+ * affinity_getPluginAffinity(). If the core has no other eligible logical CPU,
+ * no CPU is reserved.
+ *
+ * THREAD SAFETY: Thread-safe.
+ */
+int affinity_getGoodWorkerAffinityWithSibling();
+
+/*
+ * Returns the logical CPU that plugin threads run by the worker on cpu_num
+ * should be pinned to: the SMT sibling reserved by
+ * affinity_getGoodWorkerAffinityWithSibling() if there is one, otherwise
+ * cpu_num itself.
+ *
+ * THREAD SAFETY: Thread-safe once all worker CPUs have been chosen.
+ */
+int affinity_getPluginAffinity(int cpu_num);
+
+/*
+ * Returns a measure of how far apart two logical CPUs are in the platform
+ * topology: 0 if they are the same CPU, 1 if they share a core, 2 if they share
+ * a socket, 3 if they share a NUMA node, and 4 otherwise. Returns -1 if the
+ * platform info has not been initialized or either CPU is unknown.
+ *
+ * THREAD SAFETY: Thread-safe after affinity_initPlatformInfo() has returned.
+ */
+int affinity_getCPUDistance(int cpu_num_a, int cpu_num_b);
+
 /*
  * Try to parse platform CPU orientation information from the host machine.
  *
@@ -0,0 +1,370 @@
+//! Choosing the options that only affect how fast a simulation runs, enabled with `--autotune`.
+//!
+//! Shadow runs the start of the simulation several times as child processes ("pilot runs"), each
+//! with the same configuration except for the options being tuned, and measures the real time that
+//! each pilot's scheduling loop took. The options are tuned one at a time, keeping the fastest
+//! value of each option before trying the next.
+//!
+//! The parallelism, scheduler, and CPU pinning don't change the simulation's results, so the
+//! fastest values are used for the rest of the run. The minimum runahead and the maximum unapplied
+//! CPU latency do change the results, so the fastest values are only logged as a recommendation.
+
+use std::ffi::{OsStr, OsString};
+use std::fs::File;
+use std::path::{Path, PathBuf};
+use std::process::Command;
+use std::time::Duration;
+
+use anyhow::Context;
+
+use crate::core::cpu;
+use crate::core::support::configuration::{ConfigOptions, Scheduler};
+use crate::core::support::units;
+
+/// The options that the pilot runs set on the command line, which are removed from Shadow's own
+/// command line. None of these have a value that's optional.
+const PILOT_LONG_OPTIONS: &[&str] = &[
+    "autotune",
+    "data-directory",
+    "max-unapplied-cpu-latency",
+    "parallelism",
+    "progress",
+    "runahead",
+    "scheduler",
+    "stop-time",
+    "use-cpu-pinning",
+];
+const PILOT_SHORT_OPTIONS: &[char] = &['d', 'p'];
+
+#[derive(Debug, Clone, Copy)]
+struct Knobs {
+    parallelism: u32,
+    scheduler: Scheduler,
+    use_cpu_pinning: bool,
+    runahead: Option<Duration>,
+    max_unapplied_cpu_latency: Duration,
+}
+
+impl Knobs {
+    fn from_config(config: &ConfigOptions, cores: u32) -> Self {
+        Self {
+            parallelism: match config.general.parallelism.unwrap() {
+                0 => cores,
+                x => x,
+            },
+            scheduler: config.experimental.scheduler.unwrap(),
+            use_cpu_pinning: config.experimental.use_cpu_pinning.unwrap(),
+            runahead: config.experimental.runahead.flatten().map(Duration::from),
+            max_unapplied_cpu_latency: config
+                .experimental
+                .max_unapplied_cpu_latency
+                .unwrap()
+                .into(),
+        }
+    }
+
+    fn scheduler_name(&self) -> String {
+        serde_json::to_value(self.scheduler)
+            .unwrap()
+            .as_str()
+            .unwrap()
+            .to_string()
+    }
+
+    /// The command line options for a pilot run.
+    fn args(&self) -> Vec<String> {
+        let mut args = vec![
+            format!("--parallelism={}", self.parallelism),
+            format!("--scheduler={}", self.scheduler_name()),
+            format!("--use-cpu-pinning={}", self.use_cpu_pinning),
+            format!(
+                "--max-unapplied-cpu-latency={} ns",
+                self.max_unapplied_cpu_latency.as_nanos()
+            ),
+        ];
+        if let Some(runahead) = self.runahead {
+            args.push(format!("--runahead={} ns", runahead.as_nanos()));
+        }
+        args
+    }
+
+    /// Set the options that don't change the simulation's results.
+    fn apply_deterministic(&self, config: &mut ConfigOptions) {
+        config.general.parallelism = Some(self.parallelism);
+        config.experimental.scheduler = Some(self.scheduler);
+        config.experimental.use_cpu_pinning = Some(self.use_cpu_pinning);
+    }
+}
+
+impl std::fmt::Display for Knobs {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(
+            f,
+            "parallelism={}, scheduler={}, use_cpu_pinning={}, runahead={:?}, \
+             max_unapplied_cpu_latency={:?}",
+            self.parallelism,
+            self.scheduler_name(),
+            self.use_cpu_pinning,
+            self.runahead,
+            self.max_unapplied_cpu_latency,
+        )
+    }
+}
+
+/// Remove the options with the given names, and their values, from `args`.
+fn strip_options(args: &[&OsStr], long: &[&str], short: &[char]) -> Vec<OsString> {
+    let mut stripped = Vec::new();
+    let mut args = args.iter();
+    while let Some(arg) = args.next() {
+        let Some(s) = arg.to_str() else {
+            stripped.push(arg.to_os_string());
+            continue;
+        };
+
+        if s == "--" {
+            // everything after this is positional
+            stripped.push(arg.to_os_string());
+            stripped.extend(args.map(|x| x.to_os_string()));
+            break;
+        }
+
+        let (matches, has_value) = if let Some(name) = s.strip_prefix("--") {
+            match name.split_once('=') {
+                Some((name, _)) => (long.contains(&name), true),
+                None => (long.contains(&name), false),
+            }
+        } else if let Some(name) = s.strip_prefix('-') {
+            match name.chars().next() {
+                Some(c) => (short.contains(&c), name.len() > 1),
+                None => (false, false),
+            }
+        } else {
+            (false, false)
+        };
+
+        if !matches {
+            stripped.push(arg.to_os_string());
+        } else if !has_value {
+            // the value is the next argument
+            args.next();
+        }
+    }
+    stripped
+}
+
+struct Pilots {
+    exe: PathBuf,
+    base_args: Vec<OsString>,
+    stop_time: Duration,
+    dir: PathBuf,
+    count: usize,
+}
+
+impl Pilots {
+    /// Run a pilot and return the real time per simulated second of its scheduling loop, or
+    /// `None` if it didn't complete.
+    fn run(&mut self, knobs: &Knobs) -> anyhow::Result<Option<Duration>> {
+        let name = format!("pilot-{}", self.count);
+        self.count += 1;
+        let data_dir = self.dir.join(&name);
+        let log_path = self.dir.join(format!("{name}.log"));
+        let log = File::create(&log_path)
+            .with_context(|| format!("Failed to create '{}'", log_path.display()))?;
+
+        log::info!("Autotune {name}: {knobs}");
+        let status = Command::new(&self.exe)
+            .args(&self.base_args)
+            .args(knobs.args())
+            .arg(format!("--stop-time={} ns", self.stop_time.as_nanos()))
+            .arg("--data-directory")
+            .arg(&data_dir)
+            .arg("--progress=false")
+            .stdout(log.try_clone()?)
+            .stderr(log)
+            .status()
+            .context("Failed to start a pilot run")?;
+
+        // processes that are still running when the pilot stops are in an unexpected final state,
+        // so a pilot can fail and still have run the whole time
+        let real_time = read_loop_real_time(&data_dir.join("sim-stats.json"));
+        let Some(real_time) = real_time else {
+            log::warn!(
+                "Autotune {name} didn't complete ({status}); see '{}'",
+                log_path.display()
+            );
+            return Ok(None);
+        };
+
+        let per_sim_second = real_time.div_f64(self.stop_time.as_secs_f64());
+        log::info!("Autotune {name}: {per_sim_second:?} per simulated second");
+        Ok(Some(per_sim_second))
+    }
+}
+
+fn read_loop_real_time(path: &Path) -> Option<Duration> {
+    let stats: serde_json::Value = serde_json::from_reader(File::open(path).ok()?).ok()?;
+    stats["rounds"]["real_time_ns"]
+        .as_u64()
+        .map(Duration::from_nanos)
+}
+
+/// Run pilots for the first `pilot_time` of the simulation, apply the fastest deterministic
+/// options to `config`, and log the rest. `args` are Shadow's command line arguments.
+pub fn autotune(
+    config: &mut ConfigOptions,
+    args: &[&OsStr],
+    pilot_time: units::Time<units::TimePrefix>,
+) -> anyhow::Result<()> {
+    let pilot_time = Duration::from(pilot_time);
+    anyhow::ensure!(
+        pilot_time > Duration::ZERO,
+        "The autotune pilot time must be positive"
+    );
+    anyhow::ensure!(
+        config.general.stop_time.map(Duration::from) > Some(pilot_time),
+        "The autotune pilot time must be less than the stop time"
+    );
+    let dir = PathBuf::from(format!(
+        "{}-autotune",
+        config.general.data_directory.as_ref().unwrap()
+    ));
+    if dir.exists() {
+        anyhow::bail!(
+            "The autotune directory '{}' already exists; remove it first",
+            dir.display()
+        );
+    }
+    std::fs::create_dir_all(&dir)
+        .with_context(|| format!("Failed to create '{}'", dir.display()))?;
+
+    let mut pilots = Pilots {
+        exe: std::env::current_exe().context("Failed to find Shadow's executable")?,
+        base_args: strip_options(&args[1..], PILOT_LONG_OPTIONS, PILOT_SHORT_OPTIONS),
+        stop_time: pilot_time,
+        dir,
+        count: 0,
+    };
+
+    let cores = cpu::count_physical_cores();
+    let configured = Knobs::from_config(config, cores);
+    let mut best = configured;
+    let mut best_time = pilots
+        .run(&best)?
+        .context("The pilot run with the configured options didn't complete")?;
+
+    // each stage returns the candidates for one option, given the best options so far
+    type Stage = fn(&Knobs, u32) -> Vec<Knobs>;
+    let stages: [Stage; 5] = [
+        |best, cores| {
+            let mut values: Vec<u32> = [cores / 4, cores / 2, cores]
+                .into_iter()
+                .filter(|x| *x > 0 && *x != best.parallelism)
+                .collect();
+            values.dedup();
+            values
+                .into_iter()
+                .map(|parallelism| Knobs {
+                    parallelism,
+                    ..*best
+                })
+                .collect()
+        },
+        |best, _| {
+            let scheduler = match best.scheduler {
+                Scheduler::ThreadPerHost => Scheduler::ThreadPerCore,
+                _ => Scheduler::ThreadPerHost,
+            };
+            vec![Knobs { scheduler, ..*best }]
+        },
+        |best, _| {
+            vec![Knobs {
+                use_cpu_pinning: !best.use_cpu_pinning,
+                ..*best
+            }]
+        },
+        |best, _| {
+            let Some(runahead) = best.runahead else {
+                return Vec::new();
+            };
+            [2, 4]
+                .into_iter()
+                .map(|x| Knobs {
+                    runahead: Some(runahead * x),
+                    ..*best
+                })
+                .collect()
+        },
+        |best, _| {
+            [10, 100]
+                .into_iter()
+                .map(|x| Knobs {
+                    max_unapplied_cpu_latency: best.max_unapplied_cpu_latency * x,
+                    ..*best
+                })
+                .collect()
+        },
+    ];
+
+    for stage in stages {
+        for candidate in stage(&best, cores) {
+            if let Some(time) = pilots.run(&candidate)? {
+                if time < best_time {
+                    best = candidate;
+                    best_time = time;
+                }
+            }
+        }
+    }
+
+    log::info!("Autotune: using {best}, which took {best_time:?} per simulated second");
+    best.apply_deterministic(config);
+
+    if best.runahead != configured.runahead {
+        log::info!(
+            "Autotune: 'experimental.runahead: {} ns' was faster, but changes the simulation's \
+             results",
+            best.runahead.unwrap().as_nanos()
+        );
+    }
+    if best.max_unapplied_cpu_latency != configured.max_unapplied_cpu_latency {
+        log::info!(
+            "Autotune: 'experimental.max_unapplied_cpu_latency: {} ns' was faster, but changes the \
+             simulation's results",
+            best.max_unapplied_cpu_latency.as_nanos()
+        );
+    }
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_strip_options() {
+        let args: Vec<&OsStr> = [
+            "--parallelism",
+            "4",
+            "-p2",
+            "-d",
+            "data",
+            "--stop-time=10s",
+            "--seed",
+            "3",
+            "-g",
+            "config.yaml",
+            "--",
+            "--runahead",
+        ]
+        .into_iter()
+        .map(OsStr::new)
+        .collect();
+
+        let stripped = strip_options(&args, PILOT_LONG_OPTIONS, PILOT_SHORT_OPTIONS);
+        assert_eq!(
+            stripped,
+            ["--seed", "3", "-g", "config.yaml", "--", "--runahead"]
+        );
+    }
+}
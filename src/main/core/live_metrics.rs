@@ -0,0 +1,241 @@
+//! Live metrics of a running simulation, published in a shared-memory file so that an external
+//! monitor (`src/tools/shadow-top.py`) can read them without interrupting the simulation.
+//!
+//! The file is `/dev/shm/shadow-live-metrics-<pid>`, and is removed at the end of the simulation
+//! (or by a later simulation's shared memory cleanup if this one crashes).
+//! It contains a single [`LiveMetrics`] struct with a fixed layout. The manager updates its fields
+//! after each scheduling round inside a seqlock: the sequence number is odd while the fields are
+//! being written, so a reader copies the fields and retries if the sequence number was odd or
+//! changed during the copy. Each worker thread also counts the syscalls it handles in its own
+//! cache line of the file, outside the seqlock, since those counters only ever increase.
+//!
+//! Any change to the layout must increment [`LIVE_METRICS_VERSION`] and be reflected in
+//! `shadow-top.py`.
+
+use std::cell::Cell;
+use std::fs::OpenOptions;
+use std::num::NonZeroUsize;
+use std::path::{Path, PathBuf};
+use std::ptr::NonNull;
+use std::sync::atomic::{AtomicU32, AtomicU64, Ordering};
+
+use nix::sys::mman::{MapFlags, ProtFlags};
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+/// Identifies a live metrics file. Written last, so a reader that sees it also sees the rest of the
+/// header.
+const LIVE_METRICS_MAGIC: u32 = u32::from_le_bytes(*b"SHTP");
+pub const LIVE_METRICS_VERSION: u32 = 1;
+
+/// The name of the live metrics file in `/dev/shm`, which is followed by the pid of the Shadow
+/// process.
+pub const LIVE_METRICS_FILE_PREFIX: &str = "shadow-live-metrics-";
+
+/// The most worker threads whose metrics are published.
+pub const LIVE_METRICS_MAX_THREADS: usize = 256;
+
+/// The metrics of one worker thread, in its own cache line.
+#[repr(C, align(64))]
+pub struct ThreadMetrics {
+    /// The total time that the thread spent running hosts, in nanoseconds. Written by the manager
+    /// inside the seqlock.
+    busy_ns: AtomicU64,
+    /// The total number of syscalls that the thread has handled. Written by the thread itself.
+    syscalls: AtomicU64,
+}
+
+#[repr(C)]
+pub struct LiveMetrics {
+    magic: AtomicU32,
+    version: u32,
+    num_threads: u32,
+    _pad: u32,
+    /// The seqlock's sequence number, which is odd while the manager is updating the fields below.
+    seq: AtomicU64,
+    /// Simulated time at the end of the last round.
+    sim_time_ns: AtomicU64,
+    /// The simulation's end time.
+    end_time_ns: AtomicU64,
+    /// Real time since the first round.
+    real_time_ns: AtomicU64,
+    /// The number of rounds that have been run.
+    rounds: AtomicU64,
+    /// The number of hosts that ran in the last round.
+    hosts_active: AtomicU64,
+    /// The total number of hosts.
+    hosts: AtomicU64,
+    /// Shadow's resident set size, updated about once a second.
+    rss_bytes: AtomicU64,
+    _reserved: [u64; 6],
+    threads: [ThreadMetrics; LIVE_METRICS_MAX_THREADS],
+}
+
+static_assertions::const_assert_eq!(std::mem::size_of::<ThreadMetrics>(), 64);
+// the header is 128 bytes, followed by the threads
+static_assertions::const_assert_eq!(
+    std::mem::size_of::<LiveMetrics>(),
+    128 + 64 * LIVE_METRICS_MAX_THREADS
+);
+
+/// The values that the manager publishes after a round.
+#[derive(Debug, Copy, Clone, Default)]
+pub struct RoundMetrics {
+    pub sim_time: SimulationTime,
+    pub real_time: std::time::Duration,
+    pub rounds: u64,
+    pub hosts_active: u64,
+    pub rss_bytes: Option<u64>,
+}
+
+/// A mapping of the live metrics file, which is removed when this is dropped.
+pub struct LiveMetricsFile {
+    metrics: NonNull<LiveMetrics>,
+    path: PathBuf,
+}
+
+// SAFETY: The mapping is only accessed through atomics.
+unsafe impl Send for LiveMetricsFile {}
+unsafe impl Sync for LiveMetricsFile {}
+
+thread_local! {
+    /// The current worker thread's metrics, or null if the thread isn't publishing metrics.
+    static THREAD_METRICS: Cell<*const ThreadMetrics> = const { Cell::new(std::ptr::null()) };
+}
+
+impl LiveMetricsFile {
+    /// Create and map the live metrics file for this process.
+    pub fn create(
+        num_threads: usize,
+        num_hosts: usize,
+        end_time: SimulationTime,
+    ) -> std::io::Result<Self> {
+        let path = Path::new("/dev/shm").join(format!(
+            "{LIVE_METRICS_FILE_PREFIX}{}",
+            nix::unistd::getpid().as_raw()
+        ));
+
+        let file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create(true)
+            .truncate(true)
+            .open(&path)?;
+        let len = std::mem::size_of::<LiveMetrics>();
+        file.set_len(len.try_into().unwrap())?;
+
+        // a zeroed file is a valid `LiveMetrics` (all of its fields are integers)
+        let ptr = unsafe {
+            nix::sys::mman::mmap(
+                None,
+                NonZeroUsize::new(len).unwrap(),
+                ProtFlags::PROT_READ | ProtFlags::PROT_WRITE,
+                MapFlags::MAP_SHARED,
+                Some(&file),
+                0,
+            )
+        }
+        .map_err(std::io::Error::from)?;
+
+        let mut metrics = NonNull::new(ptr as *mut LiveMetrics).unwrap();
+        {
+            // SAFETY: Nothing else has access to the mapping yet.
+            let metrics = unsafe { metrics.as_mut() };
+            metrics.version = LIVE_METRICS_VERSION;
+            metrics.num_threads = std::cmp::min(num_threads, LIVE_METRICS_MAX_THREADS)
+                .try_into()
+                .unwrap();
+            metrics
+                .hosts
+                .store(num_hosts.try_into().unwrap(), Ordering::Relaxed);
+            metrics
+                .end_time_ns
+                .store(end_time.as_nanos().try_into().unwrap(), Ordering::Relaxed);
+            metrics.magic.store(LIVE_METRICS_MAGIC, Ordering::Release);
+        }
+
+        Ok(Self { metrics, path })
+    }
+
+    pub fn path(&self) -> &Path {
+        &self.path
+    }
+
+    fn metrics(&self) -> &LiveMetrics {
+        // SAFETY: The mapping is valid until we're dropped, and is only modified through atomics.
+        unsafe { self.metrics.as_ref() }
+    }
+
+    /// Publish the syscall count of the current worker thread as `thread` until [`stop_thread`] is
+    /// called.
+    pub fn start_thread(&self, thread: usize) {
+        let ptr = match self.metrics().threads.get(thread) {
+            Some(x) => x as *const _,
+            None => std::ptr::null(),
+        };
+        THREAD_METRICS.with(|x| x.set(ptr));
+    }
+
+    /// Publish the metrics of a round. `thread_busy` is the time that each thread spent running
+    /// hosts in the round.
+    pub fn update(&self, round: &RoundMetrics, thread_busy: impl Iterator<Item = u64>) {
+        let metrics = self.metrics();
+        let nanos = |x: u128| u64::try_from(x).unwrap();
+
+        // only the manager writes these fields, so it doesn't need to synchronize with itself
+        let seq = metrics.seq.load(Ordering::Relaxed);
+        metrics.seq.store(seq + 1, Ordering::Relaxed);
+        std::sync::atomic::fence(Ordering::Release);
+
+        metrics
+            .sim_time_ns
+            .store(nanos(round.sim_time.as_nanos()), Ordering::Relaxed);
+        metrics
+            .real_time_ns
+            .store(nanos(round.real_time.as_nanos()), Ordering::Relaxed);
+        metrics.rounds.store(round.rounds, Ordering::Relaxed);
+        metrics
+            .hosts_active
+            .store(round.hosts_active, Ordering::Relaxed);
+        if let Some(rss) = round.rss_bytes {
+            metrics.rss_bytes.store(rss, Ordering::Relaxed);
+        }
+        for (thread, busy) in metrics.threads.iter().zip(thread_busy) {
+            let total = thread.busy_ns.load(Ordering::Relaxed) + busy;
+            thread.busy_ns.store(total, Ordering::Relaxed);
+        }
+
+        metrics.seq.store(seq + 2, Ordering::Release);
+    }
+}
+
+impl Drop for LiveMetricsFile {
+    fn drop(&mut self) {
+        let len = std::mem::size_of::<LiveMetrics>();
+        if let Err(e) = unsafe { nix::sys::mman::munmap(self.metrics.as_ptr() as *mut _, len) } {
+            log::warn!("Could not unmap the live metrics file: {e}");
+        }
+        if let Err(e) = std::fs::remove_file(&self.path) {
+            log::warn!(
+                "Could not remove the live metrics file '{}': {e}",
+                self.path.display()
+            );
+        }
+    }
+}
+
+/// Stop publishing the syscall count of the current worker thread. Must be called on each thread
+/// that called [`LiveMetricsFile::start_thread`] before the file is dropped.
+pub fn stop_thread() {
+    THREAD_METRICS.with(|x| x.set(std::ptr::null()));
+}
+
+/// Count a syscall handled by the current worker thread.
+pub fn count_syscall() {
+    let ptr = THREAD_METRICS.with(|x| x.get());
+    // SAFETY: The pointer is cleared before the file is unmapped.
+    if let Some(thread) = unsafe { ptr.as_ref() } {
+        // only this thread writes its counter, so this doesn't need to be an atomic increment
+        let count = thread.syscalls.load(Ordering::Relaxed);
+        thread.syscalls.store(count + 1, Ordering::Relaxed);
+    }
+}
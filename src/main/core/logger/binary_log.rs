@@ -0,0 +1,205 @@
+//! A compact binary encoding of Shadow's log records, which is cheaper for the logger thread to
+//! write than the text format. Use `src/tools/parse-shadow.py --decode` to convert a binary log
+//! back to the text format.
+//!
+//! A binary log starts with [`MAGIC`], followed by a sequence of entries. Each entry starts with a
+//! one-byte [`EntryKind`]. The fields of each kind of entry are listed on [`EntryKind`]. Integers
+//! are little-endian, and strings are a `u32` length followed by that many UTF-8 bytes. An
+//! optional string or integer uses `u32::MAX` (or `u64::MAX`) to mean "none".
+//!
+//! The file, line, module, and level of a log statement, the name and IP address of a host, and
+//! the name of a thread are only written the first time that they're used, and records refer to
+//! them by id.
+
+use std::collections::{HashMap, HashSet};
+use std::io::Write;
+use std::sync::Arc;
+
+use log::Level;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::HostId;
+
+use super::shadow_logger::ShadowLogRecord;
+
+/// The first bytes of a binary log. The last byte is the version of the format.
+pub const MAGIC: &[u8; 8] = b"SHDWLOG\x01";
+
+const NONE_U32: u32 = u32::MAX;
+const NONE_U64: u64 = u64::MAX;
+
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+#[repr(u8)]
+enum EntryKind {
+    /// `u8 level, u32 callsite_id, opt_str file, opt_u32 line, opt_str module_path`, where `level`
+    /// is 1 for error through 5 for trace.
+    Callsite = 1,
+    /// `u32 host_id, str name, str ip`
+    Host = 2,
+    /// `u32 thread_id, str name`
+    Thread = 3,
+    /// `u32 callsite_id, u64 wall_time_micros, opt_u64 sim_time_nanos, u32 thread_id,
+    /// opt_u32 host_id, str message`
+    Record = 4,
+}
+
+/// Identifies a log statement. The strings are static, so comparing their addresses is enough in
+/// the common case, but we compare the contents so that duplicated strings still share an id.
+#[derive(Copy, Clone, Debug, PartialEq, Eq, Hash)]
+struct Callsite {
+    level: Level,
+    file: Option<&'static str>,
+    line: Option<u32>,
+    module_path: Option<&'static str>,
+}
+
+/// Encodes [`ShadowLogRecord`]s in the binary log format. Remembers which callsites, hosts, and
+/// threads have already been written, so all records must be written to the same stream.
+#[derive(Debug, Default)]
+pub struct BinaryLogEncoder {
+    wrote_magic: bool,
+    callsites: HashMap<Callsite, u32>,
+    hosts: HashSet<HostId>,
+    thread_names: HashMap<i32, Arc<str>>,
+}
+
+impl BinaryLogEncoder {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub(super) fn write_record(
+        &mut self,
+        w: &mut impl Write,
+        record: &ShadowLogRecord,
+    ) -> std::io::Result<()> {
+        if !self.wrote_magic {
+            w.write_all(MAGIC)?;
+            self.wrote_magic = true;
+        }
+
+        let callsite = Callsite {
+            level: record.level,
+            file: record.file,
+            line: record.line,
+            module_path: record.module_path,
+        };
+        let callsite_id = match self.callsites.get(&callsite) {
+            Some(id) => *id,
+            None => {
+                let id = u32::try_from(self.callsites.len()).unwrap();
+                w.write_all(&[EntryKind::Callsite as u8, record.level as u8])?;
+                write_u32(w, id)?;
+                write_opt_str(w, record.file)?;
+                write_u32(w, record.line.unwrap_or(NONE_U32))?;
+                write_opt_str(w, record.module_path)?;
+                self.callsites.insert(callsite, id);
+                id
+            }
+        };
+
+        if let Some(host) = &record.host_info {
+            if self.hosts.insert(host.id) {
+                w.write_all(&[EntryKind::Host as u8])?;
+                write_u32(w, host.id.into())?;
+                write_str(w, &host.name)?;
+                write_str(w, &host.default_ip.to_string())?;
+            }
+        }
+
+        let thread_id = record.thread_id.as_raw();
+        if self.thread_names.get(&thread_id) != Some(&record.thread_name) {
+            w.write_all(&[EntryKind::Thread as u8])?;
+            write_u32(w, thread_id as u32)?;
+            write_str(w, &record.thread_name)?;
+            self.thread_names
+                .insert(thread_id, Arc::clone(&record.thread_name));
+        }
+
+        let sim_time_nanos = record.emu_time.map(|t| {
+            let nanos = t.duration_since(&EmulatedTime::SIMULATION_START).as_nanos();
+            u64::try_from(nanos).unwrap()
+        });
+
+        w.write_all(&[EntryKind::Record as u8])?;
+        write_u32(w, callsite_id)?;
+        write_u64(w, u64::try_from(record.wall_time.as_micros()).unwrap())?;
+        write_u64(w, sim_time_nanos.unwrap_or(NONE_U64))?;
+        write_u32(w, thread_id as u32)?;
+        write_u32(
+            w,
+            record
+                .host_info
+                .as_ref()
+                .map(|x| x.id.into())
+                .unwrap_or(NONE_U32),
+        )?;
+        write_str(w, &record.message)
+    }
+}
+
+fn write_u32(w: &mut impl Write, val: u32) -> std::io::Result<()> {
+    w.write_all(&val.to_le_bytes())
+}
+
+fn write_u64(w: &mut impl Write, val: u64) -> std::io::Result<()> {
+    w.write_all(&val.to_le_bytes())
+}
+
+fn write_str(w: &mut impl Write, val: &str) -> std::io::Result<()> {
+    let len = u32::try_from(val.len()).unwrap();
+    assert_ne!(len, NONE_U32);
+    write_u32(w, len)?;
+    w.write_all(val.as_bytes())
+}
+
+fn write_opt_str(w: &mut impl Write, val: Option<&str>) -> std::io::Result<()> {
+    match val {
+        Some(val) => write_str(w, val),
+        None => write_u32(w, NONE_U32),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::time::Duration;
+
+    use super::*;
+
+    fn record(message: &str, line: u32) -> ShadowLogRecord {
+        ShadowLogRecord {
+            level: Level::Info,
+            file: Some("src/foo.rs"),
+            module_path: Some("foo"),
+            line: Some(line),
+            message: message.to_string(),
+            wall_time: Duration::from_micros(7),
+            emu_time: None,
+            thread_name: Arc::from("main"),
+            thread_id: nix::unistd::Pid::from_raw(10),
+            host_info: None,
+        }
+    }
+
+    #[test]
+    fn test_callsites_are_written_once() {
+        let mut encoder = BinaryLogEncoder::new();
+        let mut buf = Vec::new();
+
+        encoder.write_record(&mut buf, &record("a", 1)).unwrap();
+        let first_len = buf.len();
+        encoder.write_record(&mut buf, &record("b", 1)).unwrap();
+        let second_len = buf.len() - first_len;
+        encoder.write_record(&mut buf, &record("c", 2)).unwrap();
+        let third_len = buf.len() - first_len - second_len;
+
+        assert_eq!(&buf[..MAGIC.len()], MAGIC);
+
+        // a record with a one-byte message
+        let record_len = 1 + 4 + 8 + 8 + 4 + 4 + 4 + 1;
+        assert_eq!(second_len, record_len);
+        // a new callsite, but the thread was already written
+        let callsite_len = 1 + 1 + 4 + (4 + 10) + 4 + (4 + 3);
+        assert_eq!(third_len, callsite_len + record_len);
+        assert_eq!(buf[first_len + second_len], EntryKind::Callsite as u8);
+    }
+}
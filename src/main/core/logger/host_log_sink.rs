@@ -0,0 +1,445 @@
+//! Per-host log files, used instead of stdout when `experimental.use_per_host_log_files` is
+//! enabled.
+//!
+//! Records logged while a host is active are formatted by the worker thread that's running the host
+//! into that host's [`HostLogSink`], rather than being queued for the single logger thread. When a
+//! sink's buffer is full, it's handed to one of a small pool of writer threads, which compresses it
+//! into the host's `shadow.log.zst`. A host always uses the same writer thread, so its records are
+//! written in order.
+//!
+//! Each buffer is compressed into a separate zstd frame by its writer thread's compressor, so the
+//! compression state is per writer thread rather than per host, and a sink only holds its file. A
+//! file of concatenated frames decompresses like any other zstd file.
+
+use std::fs::File;
+use std::io::Write;
+use std::path::Path;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::mpsc::{Receiver, SyncSender};
+use std::sync::{Arc, Mutex, Weak};
+
+use once_cell::sync::Lazy;
+
+use crate::core::logger::binary_log::BinaryLogEncoder;
+use crate::core::logger::shadow_logger::ShadowLogRecord;
+
+/// The name of the log file in each host's data directory.
+pub const HOST_LOG_FILE_NAME: &str = "shadow.log.zst";
+
+/// Hand a sink's buffer to its writer thread when it's at least this large. Buffers start empty
+/// and grow as records are written, so hosts that log little don't hold this much memory.
+const FLUSH_BUFFER_BYTES: usize = 256 << 10;
+
+/// The number of full buffers that can be queued for each writer thread. When a writer thread falls
+/// this far behind, workers block until it catches up rather than buffering without limit.
+const WRITER_QUEUE_LEN: usize = 16;
+
+/// Favour speed over ratio; log text compresses well even at the fastest level.
+const ZSTD_LEVEL: i32 = 1;
+
+/// The pool of writer threads, started when the first sink is created.
+static WRITERS: Lazy<Vec<SyncSender<WriterCommand>>> = Lazy::new(|| {
+    let num_threads = std::thread::available_parallelism()
+        .map(|x| x.get() / 8)
+        .unwrap_or(1)
+        .max(1);
+
+    (0..num_threads)
+        .map(|i| {
+            let (sender, receiver) = std::sync::mpsc::sync_channel(WRITER_QUEUE_LEN);
+            std::thread::Builder::new()
+                .name(format!("shadow-hostlog-{i}"))
+                .spawn(move || writer_thread_fn(receiver))
+                .unwrap();
+            sender
+        })
+        .collect()
+});
+
+/// Every sink that has been created, so that they can be flushed if we panic.
+static SINKS: Lazy<Mutex<Vec<Weak<HostLogSink>>>> = Lazy::new(Default::default);
+
+static NEXT_WRITER: AtomicUsize = AtomicUsize::new(0);
+
+enum WriterCommand {
+    /// Compress and write the buffer, and notify the channel afterwards if one is given.
+    Write(Arc<HostLogSink>, Vec<u8>, Option<SyncSender<()>>),
+    /// Write the buffer, close the file, and notify the channel afterwards.
+    Finish(Arc<HostLogSink>, Vec<u8>, SyncSender<()>),
+}
+
+fn writer_thread_fn(receiver: Receiver<WriterCommand>) {
+    // We can't log from this thread without risking deadlock, so errors are printed directly.
+    let mut compressor = match zstd::bulk::Compressor::new(ZSTD_LEVEL) {
+        Ok(x) => x,
+        Err(e) => {
+            eprintln!("WARNING: Could not create the host log compressor: {e}");
+            return;
+        }
+    };
+    while let Ok(cmd) = receiver.recv() {
+        match cmd {
+            WriterCommand::Write(sink, bytes, done) => {
+                if let Err(e) = sink.write_to_file(&mut compressor, &bytes) {
+                    eprintln!("WARNING: Could not write to a host's log file: {e}");
+                }
+                if let Some(done) = done {
+                    done.send(()).ok();
+                }
+            }
+            WriterCommand::Finish(sink, bytes, done) => {
+                if let Err(e) = sink.finish_file(&mut compressor, &bytes) {
+                    eprintln!("WARNING: Could not write to a host's log file: {e}");
+                }
+                done.send(()).ok();
+            }
+        }
+    }
+}
+
+/// The records of a host that haven't been handed to a writer thread yet.
+struct SinkBuffer {
+    bytes: Vec<u8>,
+    /// Set when the records are written in the binary log format. Each host's file is a separate
+    /// binary log, so each sink has its own encoder.
+    binary_encoder: Option<BinaryLogEncoder>,
+    /// Set once the sink has been closed, after which records are no longer accepted.
+    closed: bool,
+}
+
+/// The log file of a single host.
+pub struct HostLogSink {
+    /// Only locked by the worker that's running the host, so it's uncontended.
+    buffer: Mutex<SinkBuffer>,
+    /// Only locked by the sink's writer thread (or while panicking). `None` after the file has been
+    /// closed.
+    file: Mutex<Option<File>>,
+    writer: usize,
+}
+
+impl std::fmt::Debug for HostLogSink {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("HostLogSink")
+            .field("writer", &self.writer)
+            .finish_non_exhaustive()
+    }
+}
+
+impl HostLogSink {
+    /// Create the log file `HOST_LOG_FILE_NAME` in `dir`.
+    pub fn new(dir: &Path, binary: bool) -> std::io::Result<Arc<Self>> {
+        let file = File::create(dir.join(HOST_LOG_FILE_NAME))?;
+
+        let sink = Arc::new(Self {
+            buffer: Mutex::new(SinkBuffer {
+                bytes: Vec::new(),
+                binary_encoder: binary.then(BinaryLogEncoder::new),
+                closed: false,
+            }),
+            file: Mutex::new(Some(file)),
+            writer: NEXT_WRITER.fetch_add(1, Ordering::Relaxed) % WRITERS.len(),
+        });
+
+        let mut sinks = SINKS.lock().unwrap();
+        // forget the sinks of hosts that have been dropped whenever the list would grow, which is
+        // amortized constant time
+        if sinks.len() == sinks.capacity() {
+            sinks.retain(|x| x.strong_count() > 0);
+        }
+        sinks.push(Arc::downgrade(&sink));
+        drop(sinks);
+
+        Ok(sink)
+    }
+
+    /// Format the record into the sink's buffer, and hand the buffer to the writer thread if it's
+    /// full. Returns false if the sink has been closed, in which case the caller should log the
+    /// record elsewhere.
+    pub(super) fn write_record(self: &Arc<Self>, record: &ShadowLogRecord) -> bool {
+        let mut buffer = self.buffer.lock().unwrap();
+        if buffer.closed {
+            return false;
+        }
+
+        let SinkBuffer {
+            bytes,
+            binary_encoder,
+            ..
+        } = &mut *buffer;
+        // writing to a `Vec` can't fail
+        match binary_encoder {
+            Some(encoder) => encoder.write_record(bytes, record).unwrap(),
+            None => write!(bytes, "{record}").unwrap(),
+        }
+
+        if bytes.len() >= FLUSH_BUFFER_BYTES {
+            let bytes = std::mem::take(bytes);
+            // don't hold the lock while possibly blocking on a full queue
+            drop(buffer);
+            self.send(WriterCommand::Write(Arc::clone(self), bytes, None));
+        }
+
+        true
+    }
+
+    /// Write the buffered records to the file, and block until they've been written.
+    pub fn flush_sync(self: &Arc<Self>) {
+        let bytes = std::mem::take(&mut self.buffer.lock().unwrap().bytes);
+        let (done_sender, done_receiver) = std::sync::mpsc::sync_channel(1);
+        self.send(WriterCommand::Write(
+            Arc::clone(self),
+            bytes,
+            Some(done_sender),
+        ));
+        done_receiver.recv().ok();
+    }
+
+    /// Write the buffered records, close the file, and block until it's been closed. Records
+    /// logged after this are rejected by [`Self::write_record`].
+    pub fn close(self: &Arc<Self>) {
+        let bytes = {
+            let mut buffer = self.buffer.lock().unwrap();
+            if buffer.closed {
+                return;
+            }
+            buffer.closed = true;
+            std::mem::take(&mut buffer.bytes)
+        };
+        let (done_sender, done_receiver) = std::sync::mpsc::sync_channel(1);
+        self.send(WriterCommand::Finish(Arc::clone(self), bytes, done_sender));
+        done_receiver.recv().ok();
+    }
+
+    fn send(&self, cmd: WriterCommand) {
+        WRITERS[self.writer].send(cmd).unwrap_or_else(|e| {
+            eprintln!("WARNING: Couldn't send a command to the host log writer thread: {e:?}")
+        });
+    }
+
+    /// Compress `bytes` into a frame and write it to the file.
+    fn write_to_file(
+        &self,
+        compressor: &mut zstd::bulk::Compressor,
+        bytes: &[u8],
+    ) -> std::io::Result<()> {
+        let mut file = self.file.lock().unwrap();
+        let Some(file) = file.as_mut() else {
+            return Ok(());
+        };
+        write_frame(file, compressor, bytes)
+    }
+
+    fn finish_file(
+        &self,
+        compressor: &mut zstd::bulk::Compressor,
+        bytes: &[u8],
+    ) -> std::io::Result<()> {
+        let mut file = self.file.lock().unwrap();
+        let Some(mut file) = file.take() else {
+            return Ok(());
+        };
+        write_frame(&mut file, compressor, bytes)
+    }
+}
+
+fn write_frame(
+    file: &mut File,
+    compressor: &mut zstd::bulk::Compressor,
+    bytes: &[u8],
+) -> std::io::Result<()> {
+    // an empty frame would be valid, but there's no reason to write one
+    if bytes.is_empty() {
+        return Ok(());
+    }
+    file.write_all(&compressor.compress(bytes)?)
+}
+
+/// Write the buffered records of every sink from the current thread. Records in buffers that are
+/// still queued for a writer thread may end up after these ones. Intended for the panic handler, so
+/// skips any sink whose locks are held rather than risking deadlock, and ignores errors.
+pub fn flush_all_on_panic() {
+    let Ok(sinks) = SINKS.try_lock() else {
+        return;
+    };
+    let Ok(mut compressor) = zstd::bulk::Compressor::new(ZSTD_LEVEL) else {
+        return;
+    };
+    for sink in sinks.iter().filter_map(Weak::upgrade) {
+        let Ok(mut buffer) = sink.buffer.try_lock() else {
+            continue;
+        };
+        let Ok(mut file) = sink.file.try_lock() else {
+            continue;
+        };
+        if let Some(file) = file.as_mut() {
+            write_frame(file, &mut compressor, &buffer.bytes).ok();
+        }
+        buffer.bytes.clear();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::time::Duration;
+
+    use log::Level;
+
+    use super::*;
+    use crate::core::logger::binary_log::MAGIC;
+
+    fn record(message: &str) -> ShadowLogRecord {
+        ShadowLogRecord {
+            level: Level::Info,
+            file: Some("src/foo.rs"),
+            module_path: Some("foo"),
+            line: Some(1),
+            message: message.to_string(),
+            wall_time: Duration::from_micros(7),
+            emu_time: None,
+            thread_name: Arc::from("main"),
+            thread_id: nix::unistd::Pid::from_raw(10),
+            host_info: None,
+        }
+    }
+
+    fn read_log(dir: &Path) -> String {
+        let compressed = std::fs::read(dir.join(HOST_LOG_FILE_NAME)).unwrap();
+        String::from_utf8(zstd::stream::decode_all(&compressed[..]).unwrap()).unwrap()
+    }
+
+    #[test]
+    fn test_write_and_flush() {
+        let dir = tempfile::tempdir().unwrap();
+        let sink = HostLogSink::new(dir.path(), false).unwrap();
+
+        assert!(sink.write_record(&record("first")));
+        // nothing is written until the buffer is flushed
+        let file_len = std::fs::metadata(dir.path().join(HOST_LOG_FILE_NAME))
+            .unwrap()
+            .len();
+        assert_eq!(file_len, 0);
+
+        sink.flush_sync();
+        assert_eq!(read_log(dir.path()), record("first").to_string());
+
+        assert!(sink.write_record(&record("second")));
+        sink.flush_sync();
+        assert_eq!(
+            read_log(dir.path()),
+            record("first").to_string() + &record("second").to_string()
+        );
+
+        sink.close();
+    }
+
+    #[test]
+    fn test_full_buffers_are_written_in_order() {
+        let dir = tempfile::tempdir().unwrap();
+        let sink = HostLogSink::new(dir.path(), false).unwrap();
+
+        let mut expected = String::new();
+        let mut i = 0;
+        while expected.len() < 3 * FLUSH_BUFFER_BYTES {
+            let record = record(&format!("message {i}"));
+            assert!(sink.write_record(&record));
+            expected += &record.to_string();
+            i += 1;
+        }
+        sink.close();
+
+        assert_eq!(read_log(dir.path()), expected);
+    }
+
+    #[test]
+    fn test_close_rejects_later_records() {
+        let dir = tempfile::tempdir().unwrap();
+        let sink = HostLogSink::new(dir.path(), false).unwrap();
+
+        assert!(sink.write_record(&record("before")));
+        sink.close();
+        assert!(!sink.write_record(&record("after")));
+
+        // closing again and flushing a closed sink do nothing
+        sink.close();
+        sink.flush_sync();
+
+        assert_eq!(read_log(dir.path()), record("before").to_string());
+    }
+
+    #[test]
+    fn test_per_host_files() {
+        let dir = tempfile::tempdir().unwrap();
+        let host_dirs = ["a", "b"].map(|x| dir.path().join("hosts").join(x));
+        let sinks = host_dirs.clone().map(|x| {
+            std::fs::create_dir_all(&x).unwrap();
+            HostLogSink::new(&x, false).unwrap()
+        });
+
+        // interleave the hosts' records
+        for i in 0..3 {
+            for (sink, name) in sinks.iter().zip(["a", "b"]) {
+                assert!(sink.write_record(&record(&format!("{name} {i}"))));
+            }
+        }
+        for sink in &sinks {
+            sink.close();
+        }
+
+        for (host_dir, name) in host_dirs.iter().zip(["a", "b"]) {
+            // each host has a single file with the expected name
+            let files: Vec<_> = std::fs::read_dir(host_dir)
+                .unwrap()
+                .map(|x| x.unwrap().file_name())
+                .collect();
+            assert_eq!(files, [HOST_LOG_FILE_NAME]);
+
+            let expected: String = (0..3)
+                .map(|i| record(&format!("{name} {i}")).to_string())
+                .collect();
+            assert_eq!(read_log(host_dir), expected);
+        }
+    }
+
+    #[test]
+    fn test_binary_format() {
+        let dir = tempfile::tempdir().unwrap();
+        let sink = HostLogSink::new(dir.path(), true).unwrap();
+
+        let records = [record("first"), record("second")];
+        for record in &records {
+            assert!(sink.write_record(record));
+        }
+        sink.close();
+
+        // the file is a complete binary log of its own
+        let mut encoder = BinaryLogEncoder::new();
+        let mut expected = Vec::new();
+        for record in &records {
+            encoder.write_record(&mut expected, record).unwrap();
+        }
+        let compressed = std::fs::read(dir.path().join(HOST_LOG_FILE_NAME)).unwrap();
+        let decompressed = zstd::stream::decode_all(&compressed[..]).unwrap();
+        assert_eq!(&decompressed[..MAGIC.len()], MAGIC);
+        assert_eq!(decompressed, expected);
+    }
+
+    #[test]
+    fn test_dropped_sinks_are_forgotten() {
+        let dir = tempfile::tempdir().unwrap();
+        for _ in 0..100 {
+            let sink = HostLogSink::new(dir.path(), false).unwrap();
+            sink.close();
+        }
+        let kept = HostLogSink::new(dir.path(), false).unwrap();
+
+        let sinks = SINKS.lock().unwrap();
+        // other tests may have live sinks, but not this many
+        assert!(sinks.len() < 100);
+        assert!(sinks
+            .iter()
+            .any(|x| std::ptr::eq(x.as_ptr(), Arc::as_ptr(&kept))));
+        drop(sinks);
+
+        kept.close();
+    }
+}
@@ -1 +1,3 @@
+pub mod binary_log;
+pub mod host_log_sink;
 pub mod shadow_logger;
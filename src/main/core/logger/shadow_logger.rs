@@ -1,4 +1,5 @@
 use std::cell::RefCell;
+use std::collections::HashSet;
 use std::sync::mpsc::{Receiver, Sender};
 use std::sync::Arc;
 use std::sync::{Mutex, RwLock};
@@ -9,8 +10,12 @@ use log::{Level, LevelFilter, Log, Metadata, Record, SetLoggerError};
 use logger as c_log;
 use once_cell::sync::{Lazy, OnceCell};
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::log_ring::{LogRing, LogRingRecord};
 use shadow_shim_helper_rs::util::time::TimeParts;
 
+use crate::core::logger::binary_log::BinaryLogEncoder;
+use crate::core::logger::host_log_sink;
+use crate::core::support::configuration::LogFormat;
 use crate::core::worker::Worker;
 use crate::host::host::HostInfo;
 
@@ -30,9 +35,14 @@ const MIN_FLUSH_FREQUENCY: Duration = Duration::from_secs(10);
 static SHADOW_LOGGER: Lazy<ShadowLogger> = Lazy::new(ShadowLogger::new);
 
 /// Initialize the Shadow logger.
-pub fn init(max_log_level: LevelFilter, log_errors_to_stderr: bool) -> Result<(), SetLoggerError> {
+pub fn init(
+    max_log_level: LevelFilter,
+    log_errors_to_stderr: bool,
+    log_format: LogFormat,
+) -> Result<(), SetLoggerError> {
     SHADOW_LOGGER.set_max_level(max_log_level);
     SHADOW_LOGGER.set_log_errors_to_stderr(log_errors_to_stderr);
+    SHADOW_LOGGER.set_log_format(log_format);
 
     log::set_logger(&*SHADOW_LOGGER)?;
 
@@ -55,6 +65,7 @@ pub fn init(max_log_level: LevelFilter, log_errors_to_stderr: bool) -> Result<()
         // may have already been destructed, and because the logger thread
         // itself may be in a bad state), and ignore errors.
         SHADOW_LOGGER.flush_records(None).ok();
+        host_log_sink::flush_all_on_panic();
         default_panic_handler(panic_info);
     }));
 
@@ -97,10 +108,14 @@ pub struct ShadowLogger {
 
     // Whether to log errors to stderr in addition to stdout.
     log_errors_to_stderr: OnceCell<bool>,
+
+    // When set, records are written to stdout in the binary log format instead of as text. Only
+    // locked while flushing.
+    binary_encoder: OnceCell<Mutex<BinaryLogEncoder>>,
 }
 
 thread_local!(static SENDER: RefCell<Option<Sender<LoggerCommand>>> = RefCell::new(None));
-thread_local!(static THREAD_NAME: Lazy<String> = Lazy::new(|| { get_thread_name() }));
+thread_local!(static THREAD_NAME: Lazy<Arc<str>> = Lazy::new(|| { get_thread_name().into() }));
 thread_local!(static THREAD_ID: Lazy<nix::unistd::Pid> = Lazy::new(|| { nix::unistd::gettid() }));
 
 fn get_thread_name() -> String {
@@ -142,6 +157,7 @@ impl ShadowLogger {
             buffering_enabled: RwLock::new(false),
             max_log_level: OnceCell::new(),
             log_errors_to_stderr: OnceCell::new(),
+            binary_encoder: OnceCell::new(),
         }
     }
 
@@ -180,6 +196,8 @@ impl ShadowLogger {
         let stdout_locked = stdout_unlocked.lock();
         let mut stdout = std::io::BufWriter::new(stdout_locked);
 
+        let mut binary_encoder = self.binary_encoder.get().map(|x| x.lock().unwrap());
+
         while toflush > 0 {
             let record = match self.records.pop() {
                 Some(r) => r,
@@ -199,10 +217,16 @@ impl ShadowLogger {
                 let mut stderr = std::io::BufWriter::new(stderr_locked);
 
                 let line = format!("{record}");
-                write!(stdout, "{line}")?;
+                match &mut binary_encoder {
+                    Some(encoder) => encoder.write_record(&mut stdout, &record)?,
+                    None => write!(stdout, "{line}")?,
+                }
                 write!(stderr, "{line}")?;
             } else {
-                write!(stdout, "{record}")?;
+                match &mut binary_encoder {
+                    Some(encoder) => encoder.write_record(&mut stdout, &record)?,
+                    None => write!(stdout, "{record}")?,
+                }
             }
         }
         if let Some(done_sender) = done_sender {
@@ -250,6 +274,22 @@ impl ShadowLogger {
         self.log_errors_to_stderr.set(val).unwrap()
     }
 
+    /// Whether records are written in the binary log format.
+    pub fn is_binary_format(&self) -> bool {
+        self.binary_encoder.get().is_some()
+    }
+
+    /// Set the format of the records written to stdout.
+    ///
+    /// Is only intended to be called from `init()`.
+    fn set_log_format(&self, format: LogFormat) {
+        if format == LogFormat::Binary {
+            self.binary_encoder
+                .set(Mutex::new(BinaryLogEncoder::new()))
+                .unwrap()
+        }
+    }
+
     // Send a flush command to the logger thread.
     fn flush_impl(&self, notify_done: Option<Sender<()>>) {
         self.send_command(LoggerCommand::Flush(notify_done))
@@ -309,28 +349,68 @@ impl Log for ShadowLogger {
 
         let message = std::fmt::format(*record.args());
 
+        self.push_record(
+            record.level(),
+            record.file_static(),
+            record.module_path_static(),
+            record.line(),
+            message,
+            Worker::current_time(),
+        );
+    }
+
+    fn flush(&self) {
+        self.flush_sync();
+    }
+}
+
+impl ShadowLogger {
+    fn push_record(
+        &self,
+        level: Level,
+        file: Option<&'static str>,
+        module_path: Option<&'static str>,
+        line: Option<u32>,
+        message: String,
+        emu_time: Option<EmulatedTime>,
+    ) {
         let host_info = Worker::with_active_host(|host| host.info().clone());
 
         let mut shadowrecord = ShadowLogRecord {
-            level: record.level(),
-            file: record.file_static(),
-            module_path: record.module_path_static(),
-            line: record.line(),
+            level,
+            file,
+            module_path,
+            line,
             message,
             wall_time: Duration::from_micros(unsafe {
                 u64::try_from(c_log::logger_elapsed_micros()).unwrap()
             }),
 
-            emu_time: Worker::current_time(),
+            emu_time,
             thread_name: THREAD_NAME
-                .try_with(|name| (*name).clone())
-                .unwrap_or_else(|_| get_thread_name()),
+                .try_with(|name| Arc::clone(&**name))
+                .unwrap_or_else(|_| get_thread_name().into()),
             thread_id: THREAD_ID
                 .try_with(|id| **id)
                 .unwrap_or_else(|_| nix::unistd::gettid()),
             host_info,
         };
 
+        // Records of a host with its own log file are written there instead, except for errors,
+        // which are also written to stdout (and stderr) since we're likely about to crash.
+        if let Some(sink) = shadowrecord
+            .host_info
+            .as_ref()
+            .and_then(|info| info.log_sink.as_ref())
+        {
+            if sink.write_record(&shadowrecord) {
+                if level != Level::Error {
+                    return;
+                }
+                sink.flush_sync();
+            }
+        }
+
         loop {
             match self.records.push(shadowrecord) {
                 Ok(()) => break,
@@ -342,7 +422,7 @@ impl Log for ShadowLogger {
             }
         }
 
-        if record.level() == Level::Error {
+        if level == Level::Error {
             // Unlike in Shadow's C code, we don't abort the program on Error
             // logs. In Rust the same purpose is filled with `panic` and
             // `unwrap`. C callers will still exit or abort via the lib/logger wrapper.
@@ -356,23 +436,60 @@ impl Log for ShadowLogger {
         }
     }
 
-    fn flush(&self) {
-        self.flush_sync();
+    /// Log a record that the shim pushed into a managed process's log ring. The record keeps the
+    /// simulation time at which the shim logged it, and is attributed to the active host.
+    pub fn log_shim_record(&self, record: &LogRingRecord) {
+        let metadata = Metadata::builder()
+            .level(record.level())
+            .target(record.module_path())
+            .build();
+        if !self.enabled(&metadata) {
+            return;
+        }
+
+        self.push_record(
+            record.level(),
+            Some(intern(record.file())),
+            Some(intern(record.module_path())),
+            Some(record.line()),
+            record.message().to_string(),
+            record
+                .sim_time()
+                .map(|t| EmulatedTime::SIMULATION_START + t),
+        );
     }
 }
 
-struct ShadowLogRecord {
-    level: Level,
-    file: Option<&'static str>,
-    module_path: Option<&'static str>,
-    line: Option<u32>,
-    message: String,
-    wall_time: Duration,
-
-    emu_time: Option<EmulatedTime>,
-    thread_name: String,
-    thread_id: nix::unistd::Pid,
-    host_info: Option<Arc<HostInfo>>,
+/// Returns a static copy of `s`. The file names and module paths of shim records come from the
+/// shim's memory, but there are only as many of them as there are log statements in the shim, so
+/// we leak one copy of each rather than keeping the records' strings alive. Each thread keeps its
+/// own copies so that worker threads don't contend on a lock for every shim record.
+fn intern(s: &str) -> &'static str {
+    thread_local!(static INTERNED: RefCell<HashSet<&'static str>> = RefCell::new(HashSet::new()));
+
+    INTERNED.with(|interned| {
+        let mut interned = interned.borrow_mut();
+        if let Some(x) = interned.get(s) {
+            return *x;
+        }
+        let x: &'static str = Box::leak(s.into());
+        interned.insert(x);
+        x
+    })
+}
+
+pub(super) struct ShadowLogRecord {
+    pub(super) level: Level,
+    pub(super) file: Option<&'static str>,
+    pub(super) module_path: Option<&'static str>,
+    pub(super) line: Option<u32>,
+    pub(super) message: String,
+    pub(super) wall_time: Duration,
+
+    pub(super) emu_time: Option<EmulatedTime>,
+    pub(super) thread_name: Arc<str>,
+    pub(super) thread_id: nix::unistd::Pid,
+    pub(super) host_info: Option<Arc<HostInfo>>,
 }
 
 impl std::fmt::Display for ShadowLogRecord {
@@ -443,6 +560,19 @@ enum LoggerCommand {
     Flush(Option<Sender<()>>),
 }
 
+/// Log the records that the shim pushed into a managed process's log ring.
+pub fn drain_shim_log_ring(ring: &LogRing) {
+    while let Some(record) = ring.pop() {
+        SHADOW_LOGGER.log_shim_record(&record);
+    }
+}
+
+/// Whether records are written in the binary log format, which also applies to the hosts' own log
+/// files.
+pub fn is_binary_format() -> bool {
+    SHADOW_LOGGER.is_binary_format()
+}
+
 pub fn set_buffering_enabled(buffering_enabled: bool) {
     SHADOW_LOGGER.set_buffering_enabled(buffering_enabled);
 }
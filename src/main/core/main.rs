@@ -9,12 +9,16 @@ use clap::Parser;
 use nix::sys::{personality, resource, signal};
 use signal_hook::{consts, iterator::Signals};
 
+use crate::core::autotune;
 use crate::core::controller::Controller;
 use crate::core::logger::shadow_logger;
 use crate::core::sim_config::SimConfig;
-use crate::core::support::configuration::{CliOptions, ConfigFileOptions, ConfigOptions};
+use crate::core::support::configuration::{
+    CliOptions, ConfigFileOptions, ConfigOptions, LogFormat,
+};
 use crate::core::worker;
 use crate::cshadow as c;
+use crate::network::graph::routing_cache;
 use crate::utility::shm_cleanup;
 
 fn verify_supported_system() -> anyhow::Result<()> {
@@ -114,6 +118,16 @@ pub fn run_shadow(build_info: &ShadowBuildInfo, args: Vec<&OsStr>) -> anyhow::Re
         std::process::exit(0);
     }
 
+    if let Some(graph_path) = &options.precompute_routing {
+        // there is no configuration file, so log to stdout at the default level
+        shadow_logger::init(log::LevelFilter::Info, false, LogFormat::Text).unwrap();
+        shadow_logger::set_buffering_enabled(false);
+
+        routing_cache::precompute_routing(graph_path, options.output.as_ref().unwrap())?;
+        log::logger().flush();
+        std::process::exit(0);
+    }
+
     // read from stdin if the config filename is given as '-'
     let config_filename: String = match options.config.as_ref().unwrap().as_str() {
         "-" => "/dev/stdin",
@@ -126,7 +140,7 @@ pub fn run_shadow(build_info: &ShadowBuildInfo, args: Vec<&OsStr>) -> anyhow::Re
         .with_context(|| format!("Failed to load configuration file {}", config_filename))?;
 
     // generate the final shadow configuration from the config file and cli options
-    let shadow_config = ConfigOptions::new(config_file, options.clone());
+    let mut shadow_config = ConfigOptions::new(config_file, options.clone());
 
     if options.show_config {
         eprintln!("{:#?}", shadow_config);
@@ -149,7 +163,12 @@ pub fn run_shadow(build_info: &ShadowBuildInfo, args: Vec<&OsStr>) -> anyhow::Re
     let log_errors_to_stderr = shadow_config.experimental.log_errors_to_tty.unwrap()
         && !std::io::stdout().lock().is_terminal()
         && std::io::stderr().lock().is_terminal();
-    shadow_logger::init(log_level.to_level_filter(), log_errors_to_stderr).unwrap();
+    shadow_logger::init(
+        log_level.to_level_filter(),
+        log_errors_to_stderr,
+        shadow_config.experimental.log_format.unwrap(),
+    )
+    .unwrap();
 
     // disable log buffering during startup so that we see every message immediately in the terminal
     shadow_logger::set_buffering_enabled(false);
@@ -181,9 +200,18 @@ pub fn run_shadow(build_info: &ShadowBuildInfo, args: Vec<&OsStr>) -> anyhow::Re
         );
     }
 
-    // before we run the simulation, clean up any orphaned shared memory
-    if let Err(e) = shm_cleanup::shm_cleanup(shm_cleanup::SHM_DIR_PATH) {
-        log::warn!("Unable to clean up shared memory files: {:?}", e);
+    // clean up any orphaned shared memory while the simulation starts; our own shared memory is
+    // in a directory for our pid, so it won't be removed
+    let shm_cleanup_thread = shm_cleanup::shm_cleanup_in_background(shm_cleanup::SHM_DIR_PATH)
+        .map_err(|e| log::warn!("Unable to start cleaning up shared memory files: {:?}", e))
+        .ok();
+
+    if let Some(pilot_time) = options.autotune {
+        if config_filename == "/dev/stdin" {
+            anyhow::bail!("Can't autotune a configuration read from stdin");
+        }
+        autotune::autotune(&mut shadow_config, &args, pilot_time)
+            .context("Failed to autotune the simulation")?;
     }
 
     // save the platform data required for CPU pinning
@@ -252,6 +280,12 @@ pub fn run_shadow(build_info: &ShadowBuildInfo, args: Vec<&OsStr>) -> anyhow::Re
     // run the simulation
     controller.run().context("Failed to run the simulation")?;
 
+    if let Some(thread) = shm_cleanup_thread {
+        if thread.join().is_err() {
+            log::warn!("The shared memory cleanup thread panicked");
+        }
+    }
+
     // disable log buffering
     shadow_logger::set_buffering_enabled(false);
     if buffer_log {
@@ -1,9 +1,11 @@
-use std::collections::{BTreeMap, HashMap};
+use std::collections::{BTreeMap, HashMap, HashSet};
 use std::ffi::{CStr, CString, OsStr, OsString};
+use std::io::Write;
+use std::num::NonZeroU32;
 use std::os::unix::ffi::OsStrExt;
-use std::path::PathBuf;
+use std::path::{Path, PathBuf};
 use std::sync::atomic::AtomicU32;
-use std::sync::Arc;
+use std::sync::{Arc, Mutex};
 use std::time::Duration;
 
 use anyhow::{self, Context};
@@ -11,29 +13,53 @@ use atomic_refcell::AtomicRefCell;
 use log::warn;
 use rand::seq::SliceRandom;
 use rand_xoshiro::Xoshiro256PlusPlus;
+use rayon::prelude::*;
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::hosts_table;
+use shadow_shim_helper_rs::option::FfiOption;
 use shadow_shim_helper_rs::shim_shmem::ManagerShmem;
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
+use shadow_shim_helper_rs::syscall_set::SyscallSet;
 use shadow_shim_helper_rs::util::SyncSendPointer;
 use shadow_shim_helper_rs::HostId;
 use shadow_shmem::allocator::ShMemBlock;
 
 use crate::core::controller::{Controller, ShadowStatusBarState, SimController};
 use crate::core::cpu;
-use crate::core::resource_usage;
-use crate::core::scheduler::runahead::Runahead;
-use crate::core::scheduler::{HostIter, Scheduler, ThreadPerCoreSched, ThreadPerHostSched};
-use crate::core::sim_config::{Bandwidth, HostInfo};
+use crate::core::live_metrics;
+use crate::core::profiler;
+use crate::core::resource_usage::{self, HostMemoryUsage};
+use crate::core::round_hook::{HookEvents, RoundHook};
+use crate::core::scheduler::partition;
+use crate::core::scheduler::runahead::{self, Runahead};
+use crate::core::scheduler::thread_clocks::ThreadClocks;
+use crate::core::scheduler::{
+    HostClasses, HostIter, Scheduler, ThreadPerCoreSched, ThreadPerHostSched,
+};
+use crate::core::sim_config::{Bandwidth, HostInfo, ProcessInfo};
 use crate::core::sim_stats;
 use crate::core::support::configuration::{self, ConfigOptions, EnvName, Flatten};
+use crate::core::support::units::{self, Unit};
+use crate::core::timeline;
 use crate::core::worker;
 use crate::cshadow as c;
-use crate::host::host::{Host, HostParameters};
+use crate::host::host::{ApplicationInfo, Host, HostParameters};
+use crate::host::replay;
+use crate::host::syscall::NATIVE_SYSCALLS;
+use crate::host::traffic;
 use crate::network::graph::{IpAssignment, RoutingInfo};
+use crate::network::multicast::MulticastGroups;
+use crate::network::schedule::{self, PathSchedule};
 use crate::utility;
 use crate::utility::childpid_watcher::ChildPidWatcher;
+use crate::utility::file_cache::FileCache;
 use crate::utility::status_bar::Status;
 
+/// How many iterations Shadow and the shim spin while waiting for each other's IPC messages when
+/// they're pinned to SMT siblings. This is the spin limit of the "ping pong pinned spin" benchmark
+/// of `SelfContainedChannel`.
+const SMT_SIBLING_IPC_MAX_SPINS: u32 = 10_000;
+
 pub struct Manager<'a> {
     manager_config: Option<ManagerConfig>,
     controller: &'a Controller<'a>,
@@ -60,6 +86,8 @@ pub struct Manager<'a> {
 
     meminfo_file: std::fs::File,
     shmem: ShMemBlock<'static, ManagerShmem>,
+    // the hosts table referenced by `shmem`, which must outlive the managed processes
+    _hosts_table: Option<ShMemBlock<'static, u8>>,
 }
 
 impl<'a> Manager<'a> {
@@ -135,6 +163,15 @@ impl<'a> Manager<'a> {
             None
         };
 
+        if config.experimental.use_openssl_crypto_cost_model.unwrap()
+            && preload_openssl_crypto_path.is_none()
+        {
+            log::warn!(
+                "The openssl crypto cost model has no effect unless the openssl crypto library \
+                 is preloaded"
+            );
+        }
+
         // use the working dir to generate absolute paths
         let cwd = std::env::current_dir()?;
         let template_path = config
@@ -153,13 +190,15 @@ impl<'a> Manager<'a> {
             );
 
             // copy the template directory to the data directory path
-            utility::copy_dir_all(&template_path, &data_path).with_context(|| {
-                format!(
-                    "Failed to copy template directory '{}' to '{}'",
-                    template_path.display(),
-                    data_path.display()
-                )
-            })?;
+            let allow_hard_links = config.experimental.use_template_hard_links.unwrap();
+            utility::template_copy::copy_dir_all(&template_path, &data_path, allow_hard_links)
+                .with_context(|| {
+                    format!(
+                        "Failed to copy template directory '{}' to '{}'",
+                        template_path.display(),
+                        data_path.display()
+                    )
+                })?;
 
             // create the hosts directory if it doesn't exist
             let result = std::fs::create_dir(&hosts_path);
@@ -200,8 +239,27 @@ impl<'a> Manager<'a> {
         let meminfo_file =
             std::fs::File::open("/proc/meminfo").context("Failed to open '/proc/meminfo'")?;
 
+        let hosts_table = build_hosts_table(&manager_config.hosts);
+
+        let native_passthrough_syscalls = native_passthrough_syscalls(config)?;
+        if !native_passthrough_syscalls.is_empty() && config.strace_logging_mode().is_some() {
+            log::warn!(
+                "Native passthrough syscalls don't trap into Shadow, so they won't appear in the \
+                 strace logs"
+            );
+        }
+        worker::with_global_sim_stats(|stats| {
+            stats.native_syscalls.lock().unwrap().passthrough =
+                native_passthrough_syscalls.iter().collect();
+        });
+
         let shmem = shadow_shmem::allocator::shmalloc(ManagerShmem {
             log_start_time_micros: unsafe { c::logger_get_global_start_time_micros() },
+            hosts_table: match &hosts_table {
+                Some(table) => FfiOption::Some(table.serialize()),
+                None => FfiOption::None,
+            },
+            native_passthrough_syscalls,
         });
 
         Ok(Self {
@@ -221,6 +279,7 @@ impl<'a> Manager<'a> {
             check_mem_usage: true,
             meminfo_file,
             shmem,
+            _hosts_table: hosts_table,
         })
     }
 
@@ -230,6 +289,40 @@ impl<'a> Manager<'a> {
     ) -> anyhow::Result<u32> {
         let mut manager_config = self.manager_config.take().unwrap();
 
+        // the ids of the hosts to build, which are their positions in the full list of hosts
+        let mut host_ids: Vec<HostId> = (0..manager_config.hosts.len())
+            .map(|i| HostId::from(u32::try_from(i).unwrap()))
+            .collect();
+
+        // when replaying a recorded host, it's the only host that's built; its seed and addresses
+        // were assigned along with all of the other hosts', and it keeps its id, so they're the
+        // same as when it was recorded
+        let replay_path = self
+            .config
+            .experimental
+            .replay_host
+            .flatten_ref()
+            .map(PathBuf::from);
+        // the configured hosts that aren't built, and their ids
+        let mut unbuilt_hosts: Vec<(HostInfo, HostId)> = Vec::new();
+        if let Some(path) = &replay_path {
+            let name = replay::recorded_host_name(path)?;
+            let Some(index) = manager_config.hosts.iter().position(|x| x.name == name) else {
+                anyhow::bail!(
+                    "The host '{name}' in the recording '{}' isn't in the configuration",
+                    path.display()
+                );
+            };
+            unbuilt_hosts = std::mem::take(&mut manager_config.hosts)
+                .into_iter()
+                .zip(std::mem::take(&mut host_ids))
+                .collect();
+            let (host, id) = unbuilt_hosts.swap_remove(index);
+            manager_config.hosts = vec![host];
+            host_ids = vec![id];
+            log::info!("Replaying host '{name}' from '{}'", path.display());
+        }
+
         let min_runahead_config: Option<Duration> = self
             .config
             .experimental
@@ -266,34 +359,107 @@ impl<'a> Manager<'a> {
         // would leak memory if we return before then, but not worrying about that since the issues
         // will go away when we move the hosts to rust, and if we don't add them to the scheduler
         // then it means there was an error and we're going to exit anyways
-        let mut hosts: Vec<_> = manager_config
+        //
+        // hosts from the same host entry share their processes, so we only prepare each entry's
+        // applications once
+        let mut apps_by_entry = HashMap::new();
+        let preload = self.shadow_preload();
+        let host_apps: Vec<Arc<[Arc<ApplicationInfo>]>> = manager_config
             .hosts
             .iter()
-            .enumerate()
-            .map(|(i, x)| {
-                self.build_host(HostId::from(u32::try_from(i).unwrap()), x, dns)
+            .map(|x| {
+                let key = Arc::as_ptr(&x.processes).cast::<ProcessInfo>() as usize;
+                let apps = apps_by_entry
+                    .entry(key)
+                    .or_insert_with(|| self.build_applications(&x.processes, &preload));
+                Arc::clone(apps)
+            })
+            .collect();
+        drop(apps_by_entry);
+
+        // hosts are independent of each other, so we build them in parallel (the DNS has its own
+        // lock); the host ids, seeds, and addresses were already assigned
+        let dns_ptr = unsafe { SyncSendPointer::new(dns) };
+        let mut hosts: Vec<_> = manager_config
+            .hosts
+            .par_iter()
+            .zip(host_apps.par_iter())
+            .zip(host_ids.par_iter())
+            .map(|((x, apps), id)| {
+                self.build_host(*id, x, apps, dns_ptr.ptr())
                     .with_context(|| format!("Failed to build host '{}'", x.name))
             })
             .collect::<anyhow::Result<_>>()?;
+        drop(host_apps);
+
+        // the hosts that aren't built still have their names and addresses in the DNS and the hosts
+        // file, so that the built hosts resolve them as they did in the recorded run
+        for (host_info, id) in &unbuilt_hosts {
+            let name = CString::new(&*host_info.name).unwrap();
+            let ip = match host_info.ip_addr.unwrap() {
+                std::net::IpAddr::V4(ip) => u32::to_be(ip.into()),
+                // the config only allows ipv4 addresses, so this shouldn't happen
+                std::net::IpAddr::V6(_) => unreachable!("IPv6 not supported"),
+            };
+            let addr = unsafe { c::dns_register(dns, *id, name.as_ptr(), ip) };
+            assert!(!addr.is_null());
+            // the DNS keeps its own references
+            unsafe { c::address_unref(addr) };
+        }
+
+        // all hosts are registered, so the worker threads can do lock-free lookups from now on
+        unsafe { c::dns_freeze(dns) };
+
+        if let Some(name) = self.config.experimental.record_host.flatten_ref() {
+            let host = hosts
+                .iter()
+                .find(|x| x.name() == name.as_str())
+                .with_context(|| format!("The host '{name}' to record doesn't exist"))?;
+            host.start_recording()
+                .with_context(|| format!("Failed to start recording host '{name}'"))?;
+        }
+        if let Some(path) = &replay_path {
+            replay::PacketReplayer::new(path)
+                .with_context(|| format!("Failed to read the recording '{}'", path.display()))?
+                .start(&hosts[0]);
+        }
 
         // shuffle the list of hosts to make sure that they are randomly assigned by the scheduler
         hosts.shuffle(&mut manager_config.random);
 
         let use_cpu_pinning = self.config.experimental.use_cpu_pinning.unwrap();
+        let use_smt_sibling_pinning =
+            use_cpu_pinning && self.config.experimental.use_smt_sibling_pinning.unwrap();
 
         // an infinite iterator that always returns `<Option<Option<u32>>>::Some`
-        let cpu_iter =
-            std::iter::from_fn(|| {
-                // if cpu pinning is enabled, return Some(Some(cpu_id)), otherwise return Some(None)
-                Some(use_cpu_pinning.then(|| {
-                    u32::try_from(unsafe { c::affinity_getGoodWorkerAffinity() }).unwrap()
-                }))
-            });
+        let cpu_iter = std::iter::from_fn(|| {
+            // if cpu pinning is enabled, return Some(Some(cpu_id)), otherwise return Some(None)
+            Some(use_cpu_pinning.then(|| {
+                let cpu_id = if use_smt_sibling_pinning {
+                    unsafe { c::affinity_getGoodWorkerAffinityWithSibling() }
+                } else {
+                    unsafe { c::affinity_getGoodWorkerAffinity() }
+                };
+                u32::try_from(cpu_id).unwrap()
+            }))
+        });
 
         // shadow is parallelized at the host level, so we don't need more parallelism than the
         // number of hosts
         let parallelism = std::cmp::min(parallelism, hosts.len());
 
+        let use_host_partitioning = self.config.experimental.use_host_partitioning.unwrap();
+        if use_host_partitioning
+            && matches!(
+                self.config.experimental.scheduler.unwrap(),
+                configuration::Scheduler::ThreadPerHost
+            )
+        {
+            log::warn!("Ignoring 'use_host_partitioning' since the scheduler is thread-per-host");
+        } else if use_host_partitioning {
+            partition_hosts(&mut hosts, parallelism, &manager_config.routing_info);
+        }
+
         // should have either all `Some` values, or all `None` values
         let cpus: Vec<Option<u32>> = cpu_iter.take(parallelism).collect();
         if cpus[0].is_some() {
@@ -305,14 +471,162 @@ impl<'a> Manager<'a> {
         }
         assert_eq!(cpus.len(), parallelism);
 
+        let use_async_rounds = self.config.experimental.use_async_rounds.unwrap();
+        if use_async_rounds
+            && matches!(
+                self.config.experimental.scheduler.unwrap(),
+                configuration::Scheduler::ThreadPerHost
+            )
+        {
+            anyhow::bail!("Asynchronous rounds are not supported by the thread-per-host scheduler");
+        }
+        if use_async_rounds && replay_path.is_some() {
+            anyhow::bail!("Replaying a host is not supported with asynchronous rounds");
+        }
+        if use_async_rounds
+            && self
+                .config
+                .experimental
+                .round_hook_socket
+                .flatten_ref()
+                .is_some()
+        {
+            anyhow::bail!("The round hook is not supported with asynchronous rounds");
+        }
+        // snapshots are written between rounds
+        if use_async_rounds
+            && self
+                .config
+                .experimental
+                .sim_stats_snapshot_interval
+                .flatten()
+                .is_some()
+        {
+            anyhow::bail!("Sim stats snapshots are not supported with asynchronous rounds");
+        }
+        // host memory is sampled between rounds
+        if use_async_rounds
+            && (self
+                .config
+                .experimental
+                .host_memory_interval
+                .flatten()
+                .is_some()
+                || self
+                    .config
+                    .experimental
+                    .host_memory_metrics_port
+                    .flatten()
+                    .is_some())
+        {
+            anyhow::bail!("Sampling host memory usage is not supported with asynchronous rounds");
+        }
+        // the timeline records rounds
+        if use_async_rounds
+            && self
+                .config
+                .experimental
+                .timeline_round_interval
+                .flatten()
+                .is_some()
+        {
+            anyhow::bail!("The timeline is not supported with asynchronous rounds");
+        }
+        // live metrics are published after each round
+        if use_async_rounds && self.config.experimental.live_metrics.unwrap() {
+            anyhow::bail!("Live metrics are not supported with asynchronous rounds");
+        }
+        // without a round barrier there's no point at which no hosts are using the paths
+        if use_async_rounds && !manager_config.path_schedule.is_empty() {
+            anyhow::bail!(
+                "Scheduled changes to network edges are not supported with asynchronous rounds"
+            );
+        }
+        let mut path_schedule = std::mem::take(&mut manager_config.path_schedule);
+
+        // hosts never move between threads when running without a round barrier, and the
+        // lookahead is based on the smallest possible latencies between threads (the runahead
+        // options are ignored)
+        let thread_clocks =
+            use_async_rounds.then(|| ThreadClocks::new(parallelism, hosts.len(), smallest_latency));
+        let host_nodes: Vec<(HostId, u32)> =
+            hosts.iter().map(|x| (x.id(), x.params.node_id)).collect();
+
+        // the vectors that are indexed by host id must fit every id, including the ids of the hosts
+        // that aren't built when replaying a host
+        let num_host_ids = host_ids
+            .iter()
+            .chain(unbuilt_hosts.iter().map(|(_, id)| id))
+            .map(|x| usize::try_from(u32::from(*x)).unwrap() + 1)
+            .max()
+            .unwrap_or(0);
+        drop(host_ids);
+
+        let mut host_route_indices = vec![usize::MAX; num_host_ids];
+        let mut built_hosts = vec![false; num_host_ids];
+        for host in &hosts {
+            let host_id = usize::try_from(u32::from(host.id())).unwrap();
+            host_route_indices[host_id] = manager_config
+                .routing_info
+                .node_index(host.params.node_id)
+                .unwrap();
+            built_hosts[host_id] = true;
+        }
+        // the hosts that aren't built are in the DNS, so packets to them take the paths to their
+        // network nodes
+        for (host_info, id) in &unbuilt_hosts {
+            let host_id = usize::try_from(u32::from(*id)).unwrap();
+            host_route_indices[host_id] = manager_config
+                .routing_info
+                .node_index(host_info.network_node_id)
+                .unwrap();
+        }
+        drop(unbuilt_hosts);
+
+        // without a round barrier there's no point at which membership changes could be applied
+        // for all hosts at once
+        let multicast = MulticastGroups::new(&host_route_indices, thread_clocks.is_some());
+
+        let profiler_interval = self
+            .config
+            .experimental
+            .host_profiler_interval
+            .flatten()
+            .map(Duration::from);
+
+        // the profiler's report and the host memory usage are indexed by host id
+        let mut host_names = vec![String::new(); num_host_ids];
+        for host in &hosts {
+            let host_id = usize::try_from(u32::from(host.id())).unwrap();
+            host_names[host_id] = host.name().to_string();
+        }
+        if profiler_interval.is_some() {
+            profiler::install().context("Failed to install the host profiler")?;
+        }
+
+        // skip freeing memory at the end of the simulation, which would make the object counters
+        // report leaks
+        let fast_teardown = self.config.experimental.use_fast_teardown.unwrap();
+        if fast_teardown && self.config.experimental.use_object_counters.unwrap() {
+            log::warn!(
+                "'use_fast_teardown' doesn't free all objects, so 'use_object_counters' will \
+                 report a memory leak"
+            );
+        }
+
+        // record one of every this many rounds in the timeline trace
+        let timeline_interval = self.config.experimental.timeline_round_interval.flatten();
+
         // set the simulation's global state
         worker::WORKER_SHARED
             .borrow_mut()
             .replace(worker::WorkerShared {
                 ip_assignment: manager_config.ip_assignment,
                 routing_info: manager_config.routing_info,
+                host_route_indices,
+                built_hosts,
                 host_bandwidths: manager_config.host_bandwidths,
-                // safe since the DNS type has an internal mutex
+                // safe since the DNS type has an internal mutex and is read-only once frozen
                 dns: unsafe { SyncSendPointer::new(dns) },
                 num_plugin_errors: AtomicU32::new(0),
                 // allow the status logger's state to be updated from anywhere
@@ -323,12 +637,24 @@ impl<'a> Manager<'a> {
                     min_runahead_config,
                 ),
                 child_pid_watcher: ChildPidWatcher::new(),
-                event_queues: hosts
+                file_cache: FileCache::new(
+                    self.config
+                        .experimental
+                        .file_cache_size
+                        .unwrap()
+                        .convert(units::SiPrefixUpper::Base)
+                        .unwrap()
+                        .value(),
+                ),
+                packet_inboxes: hosts
                     .iter()
-                    .map(|x| (x.id(), x.event_queue().clone()))
+                    .map(|x| (x.id(), x.packet_inbox().clone()))
                     .collect(),
+                thread_clocks,
                 bootstrap_end_time,
                 sim_end_time: self.end_time,
+                is_replaying: replay_path.is_some(),
+                multicast,
             });
 
         // scope used so that the scheduler is dropped before we log the global counters below
@@ -337,45 +663,159 @@ impl<'a> Manager<'a> {
                 configuration::Scheduler::ThreadPerHost => {
                     Scheduler::ThreadPerHost(ThreadPerHostSched::new(&cpus, hosts))
                 }
-                configuration::Scheduler::ThreadPerCore => {
+                configuration::Scheduler::ThreadPerCore
+                | configuration::Scheduler::ThreadPerCoreHybrid => {
                     Scheduler::ThreadPerCore(ThreadPerCoreSched::new(
                         &cpus,
                         hosts,
                         self.config.experimental.use_worker_spinning.unwrap(),
                     ))
                 }
+                configuration::Scheduler::ThreadPerCoreLocality => {
+                    Scheduler::ThreadPerCore(ThreadPerCoreSched::new_with_locality(
+                        &cpus,
+                        hosts,
+                        self.config.experimental.use_worker_spinning.unwrap(),
+                        |a, b| {
+                            let dist = unsafe {
+                                c::affinity_getCPUDistance(
+                                    a.try_into().unwrap(),
+                                    b.try_into().unwrap(),
+                                )
+                            };
+                            // returns -1 if the distance is unknown
+                            dist.try_into().ok()
+                        },
+                    ))
+                }
             };
 
+            if let Scheduler::ThreadPerCore(sched) = &mut scheduler {
+                let rebalance_interval = self
+                    .config
+                    .experimental
+                    .scheduler_rebalance_interval
+                    .flatten();
+
+                if matches!(
+                    self.config.experimental.scheduler.unwrap(),
+                    configuration::Scheduler::ThreadPerCoreHybrid
+                ) {
+                    // hosts are only classified when they're rebalanced
+                    sched.set_rebalance_interval(
+                        rebalance_interval.or(Some(NonZeroU32::new(100).unwrap())),
+                    );
+                    sched.set_host_classes(Some(HostClasses {
+                        min_heavy_threads: self
+                            .config
+                            .experimental
+                            .scheduler_heavy_host_threads
+                            .unwrap()
+                            .get()
+                            .try_into()
+                            .unwrap(),
+                        min_heavy_cost_factor: 8,
+                        num_threads: |host| host.num_threads(),
+                    }));
+                } else {
+                    sched.set_rebalance_interval(rebalance_interval);
+                }
+            }
+
+            if let Scheduler::ThreadPerHost(sched) = &mut scheduler {
+                sched.set_elastic_parallelism(
+                    self.config.experimental.use_elastic_parallelism.unwrap(),
+                );
+                sched.set_rebalance_interval(
+                    self.config
+                        .experimental
+                        .scheduler_rebalance_interval
+                        .flatten(),
+                );
+            }
+
+            let live_metrics = if self.config.experimental.live_metrics.unwrap() {
+                let file = live_metrics::LiveMetricsFile::create(
+                    scheduler.parallelism(),
+                    host_names.len(),
+                    self.end_time - EmulatedTime::SIMULATION_START,
+                )
+                .context("Failed to create the live metrics file")?;
+                log::info!("Publishing live metrics at '{}'", file.path().display());
+                Some(file)
+            } else {
+                None
+            };
+            let live_metrics_ref = live_metrics.as_ref();
+
+            if let Some(interval) = timeline_interval {
+                timeline::set_packet_interval(u64::from(interval.get()));
+            }
+
             // initialize the thread-local Worker
             scheduler.scope(|s| {
                 s.run(|thread_id| {
-                    worker::Worker::new_for_this_thread(worker::WorkerThreadID(thread_id as u32))
+                    worker::Worker::new_for_this_thread(worker::WorkerThreadID(thread_id as u32));
+                    if let Some(interval) = profiler_interval {
+                        if let Err(e) = profiler::start_thread(interval, host_names.len()) {
+                            warn!("Could not start the host profiler on thread {thread_id}: {e}");
+                        }
+                    }
+                    if timeline_interval.is_some() {
+                        timeline::start_thread(thread_id as u32);
+                    }
+                    if let Some(live_metrics) = live_metrics_ref {
+                        live_metrics.start_thread(thread_id);
+                    }
                 });
             });
 
+            // the threads are only pinned to a NUMA node if they're pinned to a CPU
+            let use_numa_placement =
+                self.config.experimental.use_numa_host_placement.unwrap() && use_cpu_pinning;
+            if self.config.experimental.use_numa_host_placement.unwrap() && !use_cpu_pinning {
+                log::warn!("Ignoring 'use_numa_host_placement' since CPU pinning is disabled");
+            }
+            let host_placement = Mutex::new(sim_stats::HostPlacementStats::default());
+            let host_placement_ref = &host_placement;
+
             // boot each host
             scheduler.scope(|s| {
                 s.run_with_hosts(move |_, hosts| {
+                    let numa_node = use_numa_placement
+                        .then(utility::numa::current_node)
+                        .flatten();
                     for_each_host(hosts, |host| {
                         worker::Worker::set_current_time(EmulatedTime::SIMULATION_START);
                         host.lock_shmem();
                         host.boot();
                         host.unlock_shmem();
                         worker::Worker::clear_current_time();
+
+                        if let Some(node) = numa_node {
+                            let pages = host.move_to_numa_node(node);
+                            host_placement_ref.lock().unwrap().add_host(node, &pages);
+                        }
                     });
                 });
             });
 
-            // the current simulation interval
-            let mut window = Some((
-                EmulatedTime::SIMULATION_START,
-                EmulatedTime::SIMULATION_START + SimulationTime::NANOSECOND,
-            ));
+            let host_placement = host_placement.into_inner().unwrap();
+            if use_numa_placement {
+                log::info!(
+                    "Placed hosts on NUMA nodes {:?} (moved {} pages, {} already local, {} failed)",
+                    host_placement.hosts_per_node,
+                    host_placement.pages_moved,
+                    host_placement.pages_local,
+                    host_placement.pages_failed,
+                );
+            }
+            worker::with_global_sim_stats(|stats| {
+                *stats.host_placement.lock().unwrap() = host_placement;
+            });
 
-            // the next event times for each thread; allocated here to avoid re-allocating each
-            // scheduling loop
-            let thread_next_event_times: Vec<AtomicRefCell<Option<EmulatedTime>>> =
-                vec![AtomicRefCell::new(None); scheduler.parallelism()];
+            // counts of executed and skipped scheduling rounds
+            let mut round_stats = sim_stats::RoundStats::default();
 
             // how often to log heartbeat messages
             let heartbeat_interval = self
@@ -388,8 +828,174 @@ impl<'a> Manager<'a> {
             let mut last_heartbeat = EmulatedTime::SIMULATION_START;
             let mut time_of_last_usage_check = std::time::Instant::now();
 
+            // start timing before the simulation may be run without a round barrier below, so that
+            // the rounds' real time includes it
+            let loop_start = std::time::Instant::now();
+
+            if use_async_rounds {
+                let Scheduler::ThreadPerCore(sched) = &mut scheduler else {
+                    anyhow::bail!(
+                        "Asynchronous rounds are not supported by the thread-per-host scheduler"
+                    );
+                };
+                let end_time = self.end_time;
+                let totals = run_without_round_barrier(sched, &host_nodes, end_time, |now| {
+                    worker::WORKER_SHARED
+                        .borrow()
+                        .as_ref()
+                        .unwrap()
+                        .update_status_logger(|state| {
+                            state.current = now;
+                        });
+
+                    if let Some(heartbeat_interval) = heartbeat_interval {
+                        if now > last_heartbeat + heartbeat_interval {
+                            last_heartbeat = now;
+                            self.log_heartbeat(now);
+                        }
+                    }
+
+                    let current_time = std::time::Instant::now();
+                    if current_time.duration_since(time_of_last_usage_check)
+                        > Duration::from_secs(30)
+                    {
+                        time_of_last_usage_check = current_time;
+                        self.check_resource_usage();
+                    }
+                });
+
+                log::info!(
+                    "Ran {} scheduling windows over {} threads without a round barrier",
+                    totals.windows,
+                    scheduler.parallelism(),
+                );
+                round_stats.executed = totals.windows;
+                round_stats.thread_busy_ns = totals.busy_ns;
+            }
+
+            // the current simulation interval (if the simulation wasn't already run without a
+            // round barrier)
+            let mut window = (!use_async_rounds).then_some((
+                EmulatedTime::SIMULATION_START,
+                EmulatedTime::SIMULATION_START + SimulationTime::NANOSECOND,
+            ));
+
+            // the next event times and round timings for each thread; allocated here to avoid
+            // re-allocating each scheduling loop
+            let thread_round_states: Vec<AtomicRefCell<ThreadRoundState>> =
+                vec![AtomicRefCell::new(ThreadRoundState::default()); scheduler.parallelism()];
+
+            let mut round_timeline = if self.config.experimental.round_timeline.unwrap() {
+                let path = self.data_path.join("round-timeline.csv");
+                let file = std::fs::File::create(&path).with_context(|| {
+                    format!("Failed to create round timeline file '{}'", path.display())
+                })?;
+                let mut writer = std::io::BufWriter::new(file);
+                writeln!(
+                    writer,
+                    "round,window_start_ns,window_end_ns,thread,hosts,busy_ns,lock_shmem_ns,\
+                     barrier_wait_ns"
+                )?;
+                Some(writer)
+            } else {
+                None
+            };
+
+            // how often to sample the memory usage of each host
+            let host_memory_interval: Option<SimulationTime> = self
+                .config
+                .experimental
+                .host_memory_interval
+                .flatten()
+                .map(|x| Duration::from(x).try_into().unwrap());
+
+            let mut host_memory_writer = match host_memory_interval {
+                Some(_) => {
+                    let path = self.data_path.join("host-memory.csv");
+                    let file = std::fs::File::create(&path).with_context(|| {
+                        format!("Failed to create host memory file '{}'", path.display())
+                    })?;
+                    let mut writer = std::io::BufWriter::new(file);
+                    writeln!(writer, "time_ns,host,{}", HostMemoryUsage::CSV_HEADER)?;
+                    Some(writer)
+                }
+                None => None,
+            };
+
+            let metrics_server = match self.config.experimental.host_memory_metrics_port.flatten() {
+                Some(_) if host_memory_interval.is_none() => {
+                    log::warn!(
+                        "Not serving host memory metrics since 'host_memory_interval' isn't set"
+                    );
+                    None
+                }
+                Some(port) => {
+                    let server = resource_usage::MetricsServer::start(port).with_context(|| {
+                        format!("Failed to serve host memory metrics on port {port}")
+                    })?;
+                    log::info!("Serving host memory metrics at http://127.0.0.1:{port}/metrics");
+                    Some(server)
+                }
+                None => None,
+            };
+
+            let mut next_host_memory_sample = EmulatedTime::SIMULATION_START;
+            let host_memory_samples = Mutex::new(Vec::new());
+            let host_memory_samples_ref = &host_memory_samples;
+
+            // how often to append a snapshot of the sim stats
+            let stats_snapshot_interval: Option<SimulationTime> = self
+                .config
+                .experimental
+                .sim_stats_snapshot_interval
+                .flatten()
+                .map(|x| Duration::from(x).try_into().unwrap());
+
+            let mut stats_snapshot_writer = match stats_snapshot_interval {
+                Some(_) => {
+                    let path = self.data_path.join("sim-stats-snapshots.jsonl");
+                    let file = std::fs::File::create(&path).with_context(|| {
+                        format!(
+                            "Failed to create sim stats snapshot file '{}'",
+                            path.display()
+                        )
+                    })?;
+                    Some(std::io::BufWriter::new(file))
+                }
+                None => None,
+            };
+            let mut next_stats_snapshot = EmulatedTime::SIMULATION_START;
+
+            // each thread's busy time in the current round, for the live metrics
+            let mut round_thread_busy = Vec::with_capacity(thread_round_states.len());
+            let mut last_live_metrics_rss: Option<std::time::Instant> = None;
+
+            let mut round_hook = match self.config.experimental.round_hook_socket.flatten_ref() {
+                Some(path) => {
+                    log::info!("Connecting to the round hook at '{path}'");
+                    Some(RoundHook::connect(Path::new(path), self.end_time)?)
+                }
+                None => None,
+            };
+
+            // the first sync is before the first round; injected events can't be earlier than
+            // the start of the first window. If the hook doesn't allow the first window to run,
+            // sync again, so that the window doesn't end before it starts.
+            if let (Some(hook), Some((window_start, window_end))) = (&mut round_hook, &mut window) {
+                while hook.needs_sync(*window_start) {
+                    let events = hook.sync(&round_stats, loop_start.elapsed())?;
+                    schedule_hook_events(&mut scheduler, &events)?;
+                }
+                *window_end = hook.clamp_window_end(*window_end);
+            }
+
             // the scheduling loop
-            while let Some((window_start, window_end)) = window {
+            while let Some((window_start, mut window_end)) = window {
+                // no hosts are running, so the paths can be changed
+                if !path_schedule.is_empty() {
+                    window_end = apply_path_changes(&mut path_schedule, window_start, window_end);
+                }
+
                 // update the status logger
                 let display_time = std::cmp::min(window_start, window_end);
                 worker::WORKER_SHARED
@@ -400,24 +1006,61 @@ impl<'a> Manager<'a> {
                         state.current = display_time;
                     });
 
+                let sample_host_memory =
+                    host_memory_interval.is_some() && window_end >= next_host_memory_sample;
+
+                let record_timeline = timeline_interval
+                    .is_some_and(|x| round_stats.executed % u64::from(x.get()) == 0);
+                timeline::set_recording(record_timeline);
+
+                let round_start = std::time::Instant::now();
+
                 // run the events
                 scheduler.scope(|s| {
                     // run the closure on each of the scheduler's threads
                     s.run_with_data(
-                        &thread_next_event_times,
+                        &thread_round_states,
                         // each call of the closure is given an abstract thread-specific host
-                        // iterator, and an element of 'thread_next_event_times'
-                        move |_, hosts, next_event_time| {
-                            let mut next_event_time = next_event_time.borrow_mut();
+                        // iterator, and an element of 'thread_round_states'
+                        move |_, hosts, state| {
+                            let mut state = state.borrow_mut();
+                            let state = &mut *state;
+                            let next_event_time = &mut state.next_event_time;
+                            let timing = &mut state.timing;
+                            timeline::end_barrier_wait();
+                            let round_span = timeline::span("round", None);
+                            let busy_start = std::time::Instant::now();
 
                             worker::Worker::reset_next_event_time();
                             worker::Worker::set_round_end_time(window_end);
 
                             for_each_host(hosts, |host| {
+                                // most hosts in large simulations have no events in a given
+                                // window, and can be skipped without locking them
+                                let cached_next_event_time = host.cached_next_event_time();
+                                if !sample_host_memory
+                                    && cached_next_event_time.map_or(true, |t| t >= window_end)
+                                {
+                                    *next_event_time = [*next_event_time, cached_next_event_time]
+                                        .into_iter()
+                                        .flatten() // filter out None
+                                        .reduce(std::cmp::min);
+                                    return;
+                                }
+
                                 let host_next_event_time = {
+                                    let lock_start = std::time::Instant::now();
                                     host.lock_shmem();
+                                    timing.lock_shmem += lock_start.elapsed();
                                     host.execute(window_end);
                                     let host_next_event_time = host.next_event_time();
+                                    if sample_host_memory {
+                                        let usage = host.memory_usage();
+                                        host_memory_samples_ref
+                                            .lock()
+                                            .unwrap()
+                                            .push((host.id(), usage));
+                                    }
                                     host.unlock_shmem();
                                     host_next_event_time
                                 };
@@ -425,6 +1068,7 @@ impl<'a> Manager<'a> {
                                     .into_iter()
                                     .flatten() // filter out None
                                     .reduce(std::cmp::min);
+                                timing.hosts += 1;
                             });
 
                             let packet_next_event_time = worker::Worker::get_next_event_time();
@@ -433,6 +1077,12 @@ impl<'a> Manager<'a> {
                                 .into_iter()
                                 .flatten() // filter out None
                                 .reduce(std::cmp::min);
+
+                            // the thread-per-host scheduler calls this once for each host on the
+                            // same logical processor
+                            timing.busy += busy_start.elapsed();
+                            drop(round_span);
+                            timeline::start_barrier_wait();
                         },
                     );
 
@@ -454,12 +1104,107 @@ impl<'a> Manager<'a> {
                     }
                 });
 
+                // the scope waits for every thread, so this is the time of the slowest thread plus
+                // the scheduler's overhead
+                let round_duration = round_start.elapsed();
+
+                if sample_host_memory {
+                    let mut samples = std::mem::take(&mut *host_memory_samples.lock().unwrap());
+                    samples.sort_by_key(|(host_id, _)| *host_id);
+
+                    let time_ns = (window_end - EmulatedTime::SIMULATION_START).as_nanos();
+                    if let Some(writer) = &mut host_memory_writer {
+                        for (host_id, usage) in &samples {
+                            let name = &host_names[usize::try_from(u32::from(*host_id)).unwrap()];
+                            write!(writer, "{time_ns},{name},")?;
+                            usage.write_csv(&mut *writer)?;
+                            writeln!(writer)?;
+                        }
+                    }
+
+                    if let Some(server) = &metrics_server {
+                        let hosts = samples.iter().map(|(host_id, usage)| {
+                            let name = &host_names[usize::try_from(u32::from(*host_id)).unwrap()];
+                            (name.as_str(), usage)
+                        });
+                        let mut text = Vec::new();
+                        resource_usage::write_host_memory_prometheus(&mut text, hosts)?;
+                        server.update(String::from_utf8(text).unwrap());
+                    }
+
+                    next_host_memory_sample = window_end + host_memory_interval.unwrap();
+                }
+
+                // add up the threads' timings (also resets them while we have them borrowed)
+                let mut max_busy = Duration::ZERO;
+                let mut total_busy = Duration::ZERO;
+                let mut round_hosts_active = 0;
+                round_thread_busy.clear();
+                for (thread, state) in thread_round_states.iter().enumerate() {
+                    let timing = std::mem::take(&mut state.borrow_mut().timing);
+                    let barrier_wait = round_duration.saturating_sub(timing.busy);
+                    round_hosts_active += timing.hosts;
+                    round_thread_busy.push(duration_as_nanos(timing.busy));
+
+                    max_busy = std::cmp::max(max_busy, timing.busy);
+                    total_busy += timing.busy;
+                    round_stats.thread_busy_ns += duration_as_nanos(timing.busy);
+                    round_stats.thread_lock_shmem_ns += duration_as_nanos(timing.lock_shmem);
+                    round_stats.thread_barrier_wait_ns += duration_as_nanos(barrier_wait);
+
+                    if let Some(writer) = &mut round_timeline {
+                        writeln!(
+                            writer,
+                            "{},{},{},{},{},{},{},{}",
+                            round_stats.executed,
+                            (window_start - EmulatedTime::SIMULATION_START).as_nanos(),
+                            (window_end - EmulatedTime::SIMULATION_START).as_nanos(),
+                            thread,
+                            timing.hosts,
+                            timing.busy.as_nanos(),
+                            timing.lock_shmem.as_nanos(),
+                            barrier_wait.as_nanos(),
+                        )?;
+                    }
+                }
+                let mean_busy = total_busy / u32::try_from(thread_round_states.len()).unwrap();
+                round_stats.straggler_ns += duration_as_nanos(max_busy - mean_busy);
+
+                if let Some(live_metrics) = &live_metrics {
+                    // reading the RSS is a file read, so only do it about once a second
+                    let rss_bytes = if last_live_metrics_rss
+                        .map_or(true, |x| x.elapsed() > Duration::from_secs(1))
+                    {
+                        last_live_metrics_rss = Some(std::time::Instant::now());
+                        resource_usage::statm_resident_bytes(nix::unistd::getpid()).ok()
+                    } else {
+                        None
+                    };
+                    let round = live_metrics::RoundMetrics {
+                        sim_time: std::cmp::min(window_end, self.end_time)
+                            - EmulatedTime::SIMULATION_START,
+                        real_time: loop_start.elapsed(),
+                        rounds: round_stats.executed + 1,
+                        hosts_active: round_hosts_active,
+                        rss_bytes,
+                    };
+                    live_metrics.update(&round, round_thread_busy.iter().copied());
+                }
+
+                // the hosts' multicast group changes in this round are visible from the next round
+                worker::WORKER_SHARED
+                    .borrow()
+                    .as_ref()
+                    .unwrap()
+                    .multicast
+                    .apply_pending();
+
                 // get the minimum next event time for all threads (also resets the next event times
                 // to None while we have them borrowed)
-                let min_next_event_time = thread_next_event_times
+                let min_next_event_time = thread_round_states
                     .iter()
                     // the take() resets it to None for the next scheduling loop
-                    .filter_map(|x| x.borrow_mut().take())
+                    .filter_map(|x| x.borrow_mut().next_event_time.take())
                     .reduce(std::cmp::min)
                     .unwrap_or(EmulatedTime::MAX);
 
@@ -470,24 +1215,217 @@ impl<'a> Manager<'a> {
                     (min_next_event_time - EmulatedTime::SIMULATION_START).as_nanos(),
                 );
 
+                round_stats.executed += 1;
+
+                // the controller will start the next window at the next event time, so any
+                // runahead-sized rounds between the end of this window and the next event are
+                // skipped entirely
+                let next_window_start = std::cmp::min(min_next_event_time, self.end_time);
+                if next_window_start > window_end {
+                    let runahead = worker::WORKER_SHARED
+                        .borrow()
+                        .as_ref()
+                        .unwrap()
+                        .get_runahead();
+                    let skipped = (next_window_start - window_end).as_nanos() / runahead.as_nanos();
+                    round_stats.skipped += u64::try_from(skipped).unwrap();
+                }
+
+                if let Some(writer) = &mut stats_snapshot_writer {
+                    if window_end >= next_stats_snapshot {
+                        // the snapshot has the totals so far, so the live plugin threads' syscall
+                        // counts and the worker threads' local stats are merged into the global
+                        // stats now instead of only at the end
+                        scheduler.scope(|s| {
+                            s.run_with_hosts(|_, hosts| {
+                                for_each_host(hosts, |host| host.flush_syscall_counts());
+                                worker::Worker::add_to_global_sim_stats();
+                            })
+                        });
+
+                        let runahead = worker::WORKER_SHARED
+                            .borrow()
+                            .as_ref()
+                            .unwrap()
+                            .get_runahead();
+                        worker::with_global_sim_stats(|stats| {
+                            sim_stats::write_stats_snapshot(
+                                &mut *writer,
+                                stats,
+                                &round_stats,
+                                window_end - EmulatedTime::SIMULATION_START,
+                                loop_start.elapsed(),
+                                runahead,
+                            )
+                        })?;
+
+                        next_stats_snapshot = window_end + stats_snapshot_interval.unwrap();
+                    }
+                }
+
+                // sync with the round hook once the next window would run past what it allowed,
+                // which may inject events before the next event time; if it doesn't, there's
+                // nothing to run before the next sync, so sync again
+                let mut min_next_event_time = min_next_event_time;
+                if let Some(hook) = &mut round_hook {
+                    while hook.needs_sync(min_next_event_time) {
+                        let events = hook.sync(&round_stats, loop_start.elapsed())?;
+                        schedule_hook_events(&mut scheduler, &events)?;
+                        if let Some(earliest) = events.earliest() {
+                            min_next_event_time = std::cmp::min(min_next_event_time, earliest);
+                        }
+                    }
+                }
+
                 // notify controller that we finished this round, and the time of our next event in
                 // order to fast-forward our execute window if possible
                 window = self
                     .controller
                     .manager_finished_current_round(min_next_event_time);
+
+                if let (Some(hook), Some((_, window_end))) = (&round_hook, &mut window) {
+                    *window_end = hook.clamp_window_end(*window_end);
+                }
+            }
+
+            if let Some(hook) = &mut round_hook {
+                if let Err(e) = hook.finish(&round_stats, loop_start.elapsed()) {
+                    warn!("{e:#}");
+                }
+            }
+
+            if let Some(mut writer) = round_timeline {
+                writer.flush()?;
+            }
+
+            if let Some(live_metrics) = live_metrics {
+                // the threads must stop writing to the file before it's unmapped
+                scheduler.scope(|s| s.run(|_| live_metrics::stop_thread()));
+                drop(live_metrics);
+            }
+
+            timeline::set_recording(false);
+            if let Some(interval) = timeline_interval {
+                scheduler.scope(|s| s.run(|_| timeline::stop_thread()));
+
+                let path = self.data_path.join("timeline.json");
+                let file = std::fs::File::create(&path).with_context(|| {
+                    format!("Failed to create timeline file '{}'", path.display())
+                })?;
+                let mut writer = std::io::BufWriter::new(file);
+                timeline::write_trace(&mut writer, &host_names)?;
+                writer.flush()?;
+                log::info!(
+                    "Wrote a timeline of one of every {interval} rounds to '{}'",
+                    path.display()
+                );
+            }
+
+            if let Some(mut writer) = host_memory_writer {
+                writer.flush()?;
+            }
+
+            if !use_async_rounds {
+                log::info!(
+                    "Ran {} scheduling rounds and skipped {} idle rounds",
+                    round_stats.executed,
+                    round_stats.skipped,
+                );
+            }
+
+            if !use_async_rounds && self.config.experimental.runahead_advisor.unwrap() {
+                let worker_shared = worker::WORKER_SHARED.borrow();
+                let worker_shared = worker_shared.as_ref().unwrap();
+                let runahead = worker_shared.get_runahead();
+                let real_time = loop_start.elapsed();
+                let busy_time = Duration::from_nanos(
+                    round_stats.thread_busy_ns / u64::try_from(thread_round_states.len()).unwrap(),
+                );
+                let latency_counts = worker_shared.routing_info.packet_latency_counts();
+                let total_packets: u64 = latency_counts.values().sum();
+
+                let estimates = runahead::estimate_runahead_lower_bounds(
+                    runahead,
+                    round_stats.executed,
+                    real_time,
+                    busy_time,
+                    &latency_counts,
+                );
+
+                log::info!(
+                    "Runahead advisor: ran {} rounds in {:?} with a runahead of {:?}; estimates \
+                     with a larger 'experimental.runahead':",
+                    round_stats.executed,
+                    real_time,
+                    Duration::from(runahead),
+                );
+                for estimate in estimates.iter().take(8) {
+                    let delayed_percent = match total_packets {
+                        0 => 0.0,
+                        _ => 100.0 * estimate.delayed_packets as f64 / total_packets as f64,
+                    };
+                    log::info!(
+                        "Runahead advisor: runahead {:?}: ~{} rounds in ~{:?}, {} of {} packets \
+                         ({:.2}%) may be delivered late by less than the runahead",
+                        Duration::from(estimate.runahead),
+                        estimate.rounds,
+                        estimate.real_time,
+                        estimate.delayed_packets,
+                        total_packets,
+                        delayed_percent,
+                    );
+                }
+            }
+            round_stats.real_time_ns = loop_start.elapsed().as_nanos().try_into().unwrap();
+            worker::with_global_sim_stats(|stats| {
+                *stats.rounds.lock().unwrap() = round_stats;
+            });
+
+            if fast_teardown {
+                // kill every plugin process before reaping any of them, so that the OS tears them
+                // down concurrently instead of one at a time
+                scheduler.scope(|s| {
+                    s.run_with_hosts(move |_, hosts| {
+                        for_each_host(hosts, |host| host.kill_all_applications());
+                    });
+                });
             }
 
             scheduler.scope(|s| {
                 s.run_with_hosts(move |_, hosts| {
                     for_each_host(hosts, |host| {
                         worker::Worker::set_current_time(self.end_time);
-                        host.free_all_applications();
+                        if fast_teardown {
+                            host.stop_all_applications_without_free();
+                        } else {
+                            host.free_all_applications();
+                        }
                         host.shutdown();
                         worker::Worker::clear_current_time();
                     });
                 });
             });
 
+            if let Some(interval) = profiler_interval {
+                scheduler.scope(|s| s.run(|_| profiler::stop_thread()));
+
+                let path = self.data_path.join("host-profile.csv");
+                let file = std::fs::File::create(&path).with_context(|| {
+                    format!("Failed to create host profile file '{}'", path.display())
+                })?;
+                let mut writer = std::io::BufWriter::new(file);
+                profiler::write_report(&mut writer, &host_names)?;
+                writer.flush()?;
+                log::info!(
+                    "Wrote a host profile sampled every {interval:?} of CPU time to '{}'",
+                    path.display()
+                );
+            }
+
+            if let Some(migrations) = scheduler.host_migrations() {
+                log::info!("Hosts were moved between worker threads {migrations} times");
+            }
+
             // add each thread's local sim statistics to the global sim statistics.
             scheduler.scope(|s| {
                 s.run(|_| {
@@ -498,6 +1436,12 @@ impl<'a> Manager<'a> {
             scheduler.join();
         }
 
+        // the hosts have been dropped, so finish writing their packet captures
+        utility::pcap_writer::wait_for_background_writes();
+
+        // the worker threads' packet pools are freed when they exit, but this thread's isn't
+        unsafe { c::packet_freeThreadPool() };
+
         // simulation is finished, so update the status logger
         worker::WORKER_SHARED
             .borrow()
@@ -513,9 +1457,22 @@ impl<'a> Manager<'a> {
             .unwrap()
             .plugin_error_count();
 
+        worker::WORKER_SHARED
+            .borrow()
+            .as_ref()
+            .unwrap()
+            .routing_info
+            .log_path_cache_stats();
+
         // drop the simulation's global state
         // must drop before the allocation counters have been checked
-        worker::WORKER_SHARED.borrow_mut().take();
+        let worker_shared = worker::WORKER_SHARED.borrow_mut().take();
+        if fast_teardown {
+            // the OS will reclaim it when we exit
+            std::mem::forget(worker_shared);
+        } else {
+            drop(worker_shared);
+        }
 
         // since the scheduler was dropped, all workers should have completed and the global object
         // and syscall counters should have been updated
@@ -552,6 +1509,7 @@ impl<'a> Manager<'a> {
         &self,
         host_id: HostId,
         host_info: &HostInfo,
+        apps: &[Arc<ApplicationInfo>],
         dns: *mut c::DNS,
     ) -> anyhow::Result<Box<Host>> {
         let hostname = CString::new(&*host_info.name).unwrap();
@@ -576,6 +1534,7 @@ impl<'a> Manager<'a> {
                 requested_bw_up_bits: host_info.bandwidth_up_bits.unwrap(),
                 cpu_threshold: host_info.cpu_threshold,
                 cpu_precision: host_info.cpu_precision,
+                cpu_instruction_rate: self.config.experimental.cpu_instruction_rate.flatten(),
                 heartbeat_interval: host_info.heartbeat_interval,
                 heartbeat_log_level: host_info
                     .heartbeat_log_level
@@ -593,6 +1552,7 @@ impl<'a> Manager<'a> {
                     .unwrap_or(c::_LogLevel_LOGLEVEL_UNSET),
                 pcap_config: host_info.pcap_config,
                 qdisc: host_info.qdisc,
+                event_queue: self.config.experimental.event_queue.unwrap(),
                 init_sock_recv_buf_size: host_info.recv_buf_size,
                 autotune_recv_buf: host_info.autotune_recv_buf,
                 init_sock_send_buf_size: host_info.send_buf_size,
@@ -602,12 +1562,49 @@ impl<'a> Manager<'a> {
                 max_unapplied_cpu_latency: self.config.max_unapplied_cpu_latency(),
                 unblocked_syscall_latency: self.config.unblocked_syscall_latency(),
                 unblocked_vdso_latency: self.config.unblocked_vdso_latency(),
-                strace_logging_options: self.config.strace_logging_mode(),
+                strace_logging: self.config.strace_logging_mode(),
                 shim_log_level: host_info
                     .log_level
                     .unwrap_or_else(|| self.config.general.log_level.unwrap())
                     .to_c_loglevel(),
                 use_new_tcp: self.config.experimental.use_new_tcp.unwrap(),
+                use_memory_manager_huge_pages: self
+                    .config
+                    .experimental
+                    .use_memory_manager_huge_pages
+                    .unwrap(),
+                use_memory_merging: self.config.experimental.use_memory_merging.unwrap(),
+                tcp_congestion_control: host_info.tcp_congestion_control,
+                use_async_file_io: self.config.experimental.use_async_file_io.unwrap(),
+                disk: host_info.disk.clone(),
+                use_native_file_io: self.config.experimental.use_native_file_io.unwrap(),
+                flow_metrics_interval: self
+                    .config
+                    .experimental
+                    .flow_metrics_interval
+                    .flatten()
+                    .map(|x| Duration::from(x).try_into().unwrap()),
+                compaction_idle_time: self
+                    .config
+                    .experimental
+                    .host_compaction_idle_time
+                    .flatten()
+                    .map(|x| Duration::from(x).try_into().unwrap()),
+                // the worker and the plugins run on different CPUs of the same core, so waiting for
+                // a message is faster as a spin than a futex sleep and wakeup
+                ipc_max_spins: if self.config.experimental.use_cpu_pinning.unwrap()
+                    && self.config.experimental.use_smt_sibling_pinning.unwrap()
+                {
+                    SMT_SIBLING_IPC_MAX_SPINS
+                } else {
+                    0
+                },
+                use_continuous_token_refill: self
+                    .config
+                    .experimental
+                    .use_continuous_token_refill
+                    .unwrap(),
+                use_per_host_log_files: self.config.experimental.use_per_host_log_files.unwrap(),
             };
 
             Box::new(unsafe {
@@ -623,53 +1620,111 @@ impl<'a> Manager<'a> {
 
         host.lock_shmem();
 
-        for proc in &host_info.processes {
-            let plugin_path =
-                CString::new(proc.plugin.clone().into_os_string().as_bytes()).unwrap();
-            let plugin_name = CString::new(proc.plugin.file_name().unwrap().as_bytes()).unwrap();
-            let pause_for_debugging = host_info.pause_for_debugging;
-
-            let argv: Vec<CString> = proc
-                .args
-                .iter()
-                .map(|x| CString::new(x.as_bytes()).unwrap())
-                .collect();
-
-            let envv = self.generate_env_vars(proc.env.clone());
-            let envv: Vec<CString> = envv
-                .iter()
-                .map(|x| CString::new(x.as_bytes()).unwrap())
-                .collect();
-
+        for app in apps {
             host.continue_execution_timer();
-
-            host.add_application(
-                proc.start_time,
-                proc.shutdown_time,
-                proc.shutdown_signal,
-                plugin_name,
-                plugin_path,
-                envv,
-                argv,
-                pause_for_debugging,
-                proc.expected_final_state,
-            );
-
+            host.add_application(Arc::clone(app), host_info.pause_for_debugging);
             host.stop_execution_timer();
         }
 
+        for traffic in host_info.traffic.iter() {
+            traffic::schedule(&host, traffic);
+        }
+
+        schedule::schedule_bandwidth_changes(&host, &host_info.bandwidth_changes);
+
         host.unlock_shmem();
 
         Ok(host)
     }
 
+    /// Prepare the arguments and environment of the processes in a host entry. `preload` is
+    /// Shadow's part of `LD_PRELOAD` (see [`Self::shadow_preload`]).
+    fn build_applications(
+        &self,
+        processes: &[ProcessInfo],
+        preload: &OsStr,
+    ) -> Arc<[Arc<ApplicationInfo>]> {
+        processes
+            .iter()
+            .map(|proc| {
+                let plugin_path =
+                    CString::new(proc.plugin.clone().into_os_string().as_bytes()).unwrap();
+                let plugin_name =
+                    CString::new(proc.plugin.file_name().unwrap().as_bytes()).unwrap();
+
+                let argv: Vec<CString> = proc
+                    .args
+                    .iter()
+                    .map(|x| CString::new(x.as_bytes()).unwrap())
+                    .collect();
+
+                let envv = self.generate_env_vars(proc.env.clone(), preload);
+                let envv: Vec<CString> = envv
+                    .iter()
+                    .map(|x| CString::new(x.as_bytes()).unwrap())
+                    .collect();
+
+                Arc::new(ApplicationInfo {
+                    start_time: proc.start_time,
+                    shutdown_time: proc.shutdown_time,
+                    shutdown_signal: proc.shutdown_signal,
+                    plugin_name,
+                    plugin_path,
+                    envv,
+                    argv,
+                    expected_final_state: proc.expected_final_state,
+                })
+            })
+            .collect()
+    }
+
     // assume that the provided env variables are UTF-8, since working with str instead of OsStr is
     // much less painful
-    fn generate_env_vars(&self, env: BTreeMap<EnvName, String>) -> Vec<OsString> {
+    fn generate_env_vars(&self, env: BTreeMap<EnvName, String>, preload: &OsStr) -> Vec<OsString> {
         let mut env: BTreeMap<EnvName, OsString> =
             env.into_iter().map(|(k, v)| (k, v.into())).collect();
 
-        // also insert the plugin preload entries
+        // tell the openssl crypto lib to charge cpu time for the crypto that it intercepts
+        if self.preload_openssl_crypto_path.is_some()
+            && self
+                .config
+                .experimental
+                .use_openssl_crypto_cost_model
+                .unwrap()
+        {
+            env.insert(
+                EnvName::new("SHADOW_OPENSSL_CRYPTO_COST_MODEL").unwrap(),
+                "1".into(),
+            );
+        }
+
+        // merge our LD_PRELOAD entries with the config entries
+        let preload_env = env.entry(EnvName::new("LD_PRELOAD").unwrap()).or_default();
+        *preload_env = {
+            let mut s = OsString::new();
+            s.push(preload);
+            // user-provided paths are added to the list after shadow's paths
+            if !preload_env.is_empty() {
+                // we could alternatively have used " " here instead
+                s.push(":");
+                s.push(&preload_env);
+            }
+            s
+        };
+
+        env.into_iter()
+            .map(|(x, y)| {
+                let mut x: OsString = String::from(x).into();
+                x.push("=");
+                x.push(y);
+                x
+            })
+            .collect()
+    }
+
+    /// Shadow's `LD_PRELOAD` paths, which are the same for every process.
+    fn shadow_preload(&self) -> OsString {
+        // the plugin preload entries
         // precendence here is:
         //   - preload path of the injector
         //   - preload path of the libc lib
@@ -701,39 +1756,14 @@ impl<'a> Manager<'a> {
         }
 
         // combine the LD_PRELOAD paths into a string
-        let preload = {
-            let mut preload_string = OsString::new();
-            for (x, path) in preload.iter().enumerate() {
-                if x > 0 {
-                    preload_string.push(":");
-                }
-                preload_string.push(path);
+        let mut preload_string = OsString::new();
+        for (x, path) in preload.iter().enumerate() {
+            if x > 0 {
+                preload_string.push(":");
             }
-            preload_string
-        };
-
-        // merge our LD_PRELOAD entries with the config entries
-        let preload_env = env.entry(EnvName::new("LD_PRELOAD").unwrap()).or_default();
-        *preload_env = {
-            let mut s = OsString::new();
-            s.push(preload);
-            // user-provided paths are added to the list after shadow's paths
-            if !preload_env.is_empty() {
-                // we could alternatively have used " " here instead
-                s.push(":");
-                s.push(&preload_env);
-            }
-            s
-        };
-
-        env.into_iter()
-            .map(|(x, y)| {
-                let mut x: OsString = String::from(x).into();
-                x.push("=");
-                x.push(y);
-                x
-            })
-            .collect()
+            preload_string.push(path);
+        }
+        preload_string
     }
 
     fn log_heartbeat(&mut self, now: EmulatedTime) {
@@ -872,6 +1902,32 @@ pub struct ManagerConfig {
 
     // a list of hosts and their processes
     pub hosts: Vec<HostInfo>,
+
+    // changes to the paths between graph nodes at given times
+    pub path_schedule: PathSchedule,
+}
+
+/// The state of a worker thread in a scheduling round.
+#[derive(Clone, Default)]
+struct ThreadRoundState {
+    /// The earliest next event time of the thread's hosts.
+    next_event_time: Option<EmulatedTime>,
+    timing: ThreadRoundTiming,
+}
+
+/// How a worker thread spent its time in a scheduling round.
+#[derive(Clone, Default)]
+struct ThreadRoundTiming {
+    /// The number of hosts that the thread ran (not including idle hosts that were skipped).
+    hosts: u64,
+    /// The time spent running hosts.
+    busy: Duration,
+    /// The part of `busy` that was spent in `Host::lock_shmem`.
+    lock_shmem: Duration,
+}
+
+fn duration_as_nanos(duration: Duration) -> u64 {
+    u64::try_from(duration.as_nanos()).unwrap_or(u64::MAX)
 }
 
 /// Helper function to initialize the global [`Host`] before running the closure.
@@ -886,6 +1942,321 @@ fn for_each_host(host_iter: &mut HostIter, mut f: impl FnMut(&Host)) {
     });
 }
 
+/// Apply the path changes at or before the start of a scheduling window, and return the end of the
+/// window limited to the time of the next change and to the runahead (which may have been lowered).
+fn apply_path_changes(
+    path_schedule: &mut PathSchedule,
+    window_start: EmulatedTime,
+    window_end: EmulatedTime,
+) -> EmulatedTime {
+    let shared = worker::WORKER_SHARED.borrow();
+    let shared = shared.as_ref().unwrap();
+
+    let mut window_end = window_end;
+    if let Some(min_latency_ns) = path_schedule.apply_until(window_start, &shared.routing_info) {
+        shared
+            .runahead
+            .lower_min_possible_latency(SimulationTime::from_nanos(min_latency_ns));
+        let runahead_end = window_start
+            .checked_add(shared.runahead.get())
+            .unwrap_or(EmulatedTime::MAX);
+        window_end = std::cmp::min(window_end, runahead_end);
+    }
+
+    path_schedule.clamp_window_end(window_end)
+}
+
+/// Schedule the events from a round hook sync on their hosts.
+fn schedule_hook_events(scheduler: &mut Scheduler, events: &HookEvents) -> anyhow::Result<()> {
+    if events.num_hosts() == 0 {
+        return Ok(());
+    }
+
+    let found_names = Mutex::new(HashSet::new());
+    scheduler.scope(|s| {
+        s.run_with_hosts(|_, hosts| {
+            for_each_host(hosts, |host| {
+                if events.schedule_on_host(host) {
+                    found_names.lock().unwrap().insert(host.name().to_string());
+                }
+            });
+        });
+    });
+
+    let found_names = found_names.into_inner().unwrap();
+    if found_names.len() != events.num_hosts() {
+        let unknown: Vec<&str> = events
+            .host_names()
+            .filter(|x| !found_names.contains(*x))
+            .collect();
+        anyhow::bail!("The round hook sent events for unknown hosts: {unknown:?}");
+    }
+
+    Ok(())
+}
+
+/// How often the manager thread reports the progress of a simulation that runs without a round
+/// barrier.
+const ASYNC_PROGRESS_INTERVAL: Duration = Duration::from_millis(100);
+
+/// The totals over all threads of a simulation that ran without a round barrier.
+#[derive(Debug, Default)]
+struct AsyncRunTotals {
+    /// The scheduling windows that the threads ran.
+    windows: u64,
+    busy_ns: u64,
+    threads_finished: usize,
+}
+
+/// Counts a thread as finished when dropped.
+struct FinishedGuard<'a> {
+    totals: &'a Mutex<AsyncRunTotals>,
+    finished: &'a std::sync::Condvar,
+}
+
+impl Drop for FinishedGuard<'_> {
+    fn drop(&mut self) {
+        // the lock is poisoned if another thread panicked while holding it
+        let mut totals = self.totals.lock().unwrap_or_else(|e| e.into_inner());
+        totals.threads_finished += 1;
+        drop(totals);
+        self.finished.notify_all();
+    }
+}
+
+/// Run all host events until `end_time` without a global barrier between scheduling rounds. Each
+/// thread runs only its own hosts, and advances its own scheduling window whenever the other
+/// threads' clocks allow it (see [`ThreadClocks`]). Meanwhile `progress` is called on this thread
+/// every [`ASYNC_PROGRESS_INTERVAL`] with the time that all threads have reached.
+fn run_without_round_barrier(
+    scheduler: &mut ThreadPerCoreSched<Box<Host>>,
+    host_nodes: &[(HostId, u32)],
+    end_time: EmulatedTime,
+    mut progress: impl FnMut(EmulatedTime),
+) -> AsyncRunTotals {
+    let parallelism = scheduler.parallelism();
+
+    // all threads must have registered their hosts before any thread sends packets
+    let registration_barrier = std::sync::Barrier::new(parallelism);
+
+    let totals = Mutex::new(AsyncRunTotals::default());
+    let finished = std::sync::Condvar::new();
+
+    scheduler.scope(|s| {
+        s.run_with_hosts(|thread_idx, hosts| {
+            // counted even if the thread panics, so that the progress loop below ends
+            let _finished = FinishedGuard {
+                totals: &totals,
+                finished: &finished,
+            };
+
+            hosts.with_own_hosts(|hosts| {
+                let shared = worker::WORKER_SHARED.borrow();
+                let shared = shared.as_ref().unwrap();
+                let clocks = shared.thread_clocks.as_ref().unwrap();
+
+                for host in hosts.iter() {
+                    clocks.set_host_owner(host.id(), thread_idx);
+                }
+
+                registration_barrier.wait();
+
+                // the lookaheads depend on which threads own which hosts
+                if thread_idx == 0 {
+                    clocks.set_pair_lookaheads(host_nodes.iter().copied(), |src, dst| {
+                        let path = shared.routing_info.path(src, dst)?;
+                        Some(SimulationTime::from_nanos(path.latency_ns))
+                    });
+                }
+                registration_barrier.wait();
+
+                let mut windows = 0;
+                let mut busy = Duration::ZERO;
+
+                loop {
+                    let next_event_time = clocks.update_lower_bound(thread_idx, || {
+                        hosts.iter().filter_map(|host| host.next_event_time()).min()
+                    });
+
+                    // stop once no thread can run any more events before the end time
+                    let snapshot = clocks.snapshot(thread_idx);
+                    let Some(global_lower_bound) = snapshot.global_lower_bound else {
+                        break;
+                    };
+                    if global_lower_bound >= end_time {
+                        break;
+                    }
+
+                    let window_end = std::cmp::min(snapshot.safe_window_end.unwrap(), end_time);
+
+                    // wait for other threads to advance their clocks or send us events
+                    if !next_event_time.is_some_and(|t| t < window_end) {
+                        clocks.wait_for_change(thread_idx, snapshot.epoch);
+                        continue;
+                    }
+
+                    let busy_start = std::time::Instant::now();
+                    worker::Worker::set_round_end_time(window_end);
+
+                    for _ in 0..hosts.len() {
+                        let host = hosts.pop_front().unwrap();
+
+                        // the cached time was refreshed when updating the lower bound above
+                        if host
+                            .cached_next_event_time()
+                            .map_or(true, |t| t >= window_end)
+                        {
+                            hosts.push_back(host);
+                            continue;
+                        }
+
+                        worker::Worker::set_active_host(host);
+                        worker::Worker::with_active_host(|host| {
+                            host.lock_shmem();
+                            host.execute(window_end);
+                            host.unlock_shmem();
+                        })
+                        .unwrap();
+                        hosts.push_back(worker::Worker::take_active_host());
+                    }
+
+                    windows += 1;
+                    busy += busy_start.elapsed();
+                }
+
+                let mut totals = totals.lock().unwrap();
+                totals.windows += windows;
+                totals.busy_ns += duration_as_nanos(busy);
+            });
+        });
+
+        // report the progress while the threads run
+        loop {
+            let guard = totals.lock().unwrap();
+            let (guard, _) = finished
+                .wait_timeout_while(guard, ASYNC_PROGRESS_INTERVAL, |x| {
+                    x.threads_finished < parallelism
+                })
+                .unwrap();
+            if guard.threads_finished == parallelism {
+                break;
+            }
+            drop(guard);
+
+            let shared = worker::WORKER_SHARED.borrow();
+            let clocks = shared.as_ref().unwrap().thread_clocks.as_ref().unwrap();
+            if let Some(time) = clocks.global_lower_bound() {
+                progress(std::cmp::min(time, end_time));
+            }
+        }
+    });
+
+    totals.into_inner().unwrap()
+}
+
+/// Reorder `hosts` so that when they're assigned to `num_threads` threads in a round-robin order
+/// (as the schedulers do), hosts behind low-latency paths are assigned to the same thread. The
+/// order of hosts within each thread is unchanged.
+fn partition_hosts(
+    hosts: &mut Vec<Box<Host>>,
+    num_threads: usize,
+    routing_info: &RoutingInfo<u32>,
+) {
+    let nodes: Vec<usize> = hosts
+        .iter()
+        .map(|x| routing_info.node_index(x.params.node_id).unwrap())
+        .collect();
+    let latency = |src, dst| routing_info.path_by_index(src, dst).map(|x| x.latency_ns);
+
+    let Some(assignment) = partition::partition_by_latency(&nodes, num_threads, latency) else {
+        log::warn!(
+            "Not partitioning hosts since they use more than {} network nodes",
+            partition::MAX_PARTITION_NODES
+        );
+        return;
+    };
+
+    log::info!("Partitioned hosts between {num_threads} threads");
+    // these look up the paths between every pair of nodes, so only do it when they're logged
+    if log::log_enabled!(log::Level::Debug) {
+        let round_robin: Vec<usize> = (0..hosts.len()).map(|x| x % num_threads).collect();
+        log::debug!(
+            "The smallest latency between threads is {:?} ns (was {:?} ns)",
+            partition::min_cross_latency(&nodes, &assignment, latency),
+            partition::min_cross_latency(&nodes, &round_robin, latency),
+        );
+    }
+
+    let mut thread_hosts: Vec<std::collections::VecDeque<Box<Host>>> =
+        (0..num_threads).map(|_| Default::default()).collect();
+    for (host, thread) in hosts.drain(..).zip(assignment) {
+        thread_hosts[thread].push_back(host);
+    }
+
+    // each thread has exactly as many hosts as it would be given in a round-robin order
+    for thread in (0..num_threads).cycle() {
+        let Some(host) = thread_hosts[thread].pop_front() else {
+            break;
+        };
+        hosts.push(host);
+    }
+    assert!(thread_hosts.iter().all(|x| x.is_empty()));
+}
+
+/// Build a [`hosts_table`] of the hosts' names and addresses in shared memory. Returns `None` if
+/// the table is too large to put in a single shared memory chunk, in which case the shim falls
+/// back to resolving names with a syscall.
+fn build_hosts_table(hosts: &[HostInfo]) -> Option<ShMemBlock<'static, u8>> {
+    // well below the shared memory allocator's chunk size
+    const MAX_TABLE_NBYTES: usize = 4 * 1024 * 1024;
+
+    let table = hosts_table::build(hosts.iter().map(|host| {
+        let ip = match host.ip_addr.unwrap() {
+            std::net::IpAddr::V4(ip) => u32::to_be(ip.into()),
+            // the config only allows ipv4 addresses, so this shouldn't happen
+            std::net::IpAddr::V6(_) => unreachable!("IPv6 not supported"),
+        };
+        (host.name.as_str(), ip)
+    }));
+
+    if table.len() > MAX_TABLE_NBYTES {
+        log::debug!(
+            "Not sharing the hosts table with managed processes since it's {} bytes",
+            table.len()
+        );
+        return None;
+    }
+
+    Some(shadow_shmem::allocator::shmalloc_slice(&table))
+}
+
+/// The syscalls that the shim's seccomp filter should let managed processes execute natively.
+fn native_passthrough_syscalls(config: &ConfigOptions) -> anyhow::Result<SyscallSet> {
+    let mut set = SyscallSet::new();
+
+    if config.experimental.use_native_syscall_passthrough.unwrap() {
+        for num in NATIVE_SYSCALLS {
+            assert!(set.insert(*num));
+        }
+    }
+
+    for num in config
+        .experimental
+        .native_passthrough_syscalls
+        .as_ref()
+        .unwrap()
+    {
+        if !set.insert((*num).into()) {
+            anyhow::bail!(
+                "Native passthrough syscall {num} isn't less than {}",
+                SyscallSet::MAX
+            );
+        }
+    }
+
+    Ok(set)
+}
+
 /// Get the raw speed of the experiment machine.
 fn get_raw_cpu_frequency_hz() -> anyhow::Result<u64> {
     const CONFIG_CPU_MAX_FREQ_FILE: &str = "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq";
@@ -1,12 +1,17 @@
+pub mod autotune;
 pub mod controller;
 pub mod cpu;
+pub mod live_metrics;
 pub mod logger;
 pub mod main;
 pub mod manager;
+pub mod profiler;
 pub mod resource_usage;
+pub mod round_hook;
 pub mod scheduler;
 pub mod sim_config;
 pub mod sim_stats;
 pub mod support;
+pub mod timeline;
 pub mod work;
 pub mod worker;
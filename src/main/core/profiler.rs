@@ -0,0 +1,250 @@
+//! A sampling profiler that attributes the CPU time of Shadow's worker threads to the simulated
+//! host and the kind of work ("phase") that each thread was running.
+//!
+//! Each worker thread keeps its current host and phase in a thread-local tag. When the profiler is
+//! enabled, each worker thread also has a timer on its own CPU-time clock that sends it `SIGPROF`
+//! at a fixed interval, and the signal handler counts a sample for the thread's current tag in a
+//! table that's shared by all threads. A host only runs on one thread at a time, so threads rarely
+//! count samples for the same host at once.
+//! Updating the tag is a thread-local store, so the tags are kept up to date even if the profiler
+//! isn't enabled.
+
+use std::cell::Cell;
+use std::io::Write;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::OnceLock;
+use std::time::Duration;
+
+use nix::sys::signal::{self, SaFlags, SigAction, SigHandler, SigSet, Signal};
+use shadow_shim_helper_rs::HostId;
+
+/// The kind of work that a worker thread is doing.
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+#[repr(u8)]
+pub enum Phase {
+    /// Not running a host, for example scheduling or waiting at the round barrier.
+    Scheduler = 0,
+    /// Running a host's local events, such as timers and socket callbacks.
+    Event = 1,
+    /// Routing a packet that arrived at a host.
+    Packet = 2,
+    /// Handling a managed thread's syscall.
+    Syscall = 3,
+    /// Waiting for a managed thread to return control to Shadow.
+    Plugin = 4,
+}
+
+const NUM_PHASES: usize = 5;
+
+impl Phase {
+    const ALL: [Phase; NUM_PHASES] = [
+        Phase::Scheduler,
+        Phase::Event,
+        Phase::Packet,
+        Phase::Syscall,
+        Phase::Plugin,
+    ];
+
+    fn name(self) -> &'static str {
+        match self {
+            Phase::Scheduler => "scheduler",
+            Phase::Event => "event",
+            Phase::Packet => "packet",
+            Phase::Syscall => "syscall",
+            Phase::Plugin => "plugin",
+        }
+    }
+}
+
+/// A thread's current host and phase. The host is stored as its id plus one, so that 0 means that
+/// no host is running.
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+struct Tag {
+    host: u32,
+    phase: Phase,
+}
+
+impl Tag {
+    const NONE: Self = Tag {
+        host: 0,
+        phase: Phase::Scheduler,
+    };
+}
+
+thread_local! {
+    static TAG: Cell<Tag> = const { Cell::new(Tag::NONE) };
+    static TIMER: Cell<Option<libc::timer_t>> = const { Cell::new(None) };
+}
+
+/// The sample counts of all worker threads, indexed by `host * NUM_PHASES + phase` where `host` is
+/// as in [`Tag`]. Allocated when the first thread starts sampling. Atomic so that the threads can
+/// share it, and so that the report can read it while threads may still be sampled.
+static SAMPLES: OnceLock<Box<[AtomicU64]>> = OnceLock::new();
+
+/// Restores the thread's previous tag when dropped.
+#[must_use]
+pub struct TagGuard {
+    prev: Tag,
+}
+
+impl Drop for TagGuard {
+    fn drop(&mut self) {
+        TAG.with(|tag| tag.set(self.prev));
+    }
+}
+
+/// Attribute this thread's work to `host` (in the [`Phase::Event`] phase) until the returned guard
+/// is dropped.
+pub fn enter_host(host: HostId) -> TagGuard {
+    let host = u32::from(host) + 1;
+    let prev = TAG.with(|tag| {
+        tag.replace(Tag {
+            host,
+            phase: Phase::Event,
+        })
+    });
+    TagGuard { prev }
+}
+
+/// Attribute this thread's work to `phase` (of the current host) until the returned guard is
+/// dropped.
+pub fn enter_phase(phase: Phase) -> TagGuard {
+    let prev = TAG.with(|tag| {
+        let prev = tag.get();
+        tag.set(Tag { phase, ..prev });
+        prev
+    });
+    TagGuard { prev }
+}
+
+extern "C" fn handle_sigprof(_signo: libc::c_int) {
+    // Only async-signal-safe operations here: a thread-local load, an atomic load, and a relaxed
+    // atomic increment.
+    let tag = TAG.with(|tag| tag.get());
+    let Some(samples) = SAMPLES.get() else {
+        return;
+    };
+
+    let idx = tag.host as usize * NUM_PHASES + tag.phase as usize;
+    if let Some(count) = samples.get(idx) {
+        count.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+/// Install the profiler's signal handler. Must be called before [`start_thread`].
+pub fn install() -> nix::Result<()> {
+    let action = SigAction::new(
+        SigHandler::Handler(handle_sigprof),
+        SaFlags::SA_RESTART,
+        SigSet::empty(),
+    );
+    unsafe { signal::sigaction(Signal::SIGPROF, &action) }?;
+    Ok(())
+}
+
+/// Start sampling the current thread every `interval` of the thread's CPU time. `num_hosts` is
+/// the number of hosts in the simulation, and must be the same for every thread.
+pub fn start_thread(interval: Duration, num_hosts: usize) -> nix::Result<()> {
+    let samples = SAMPLES.get_or_init(|| {
+        (0..(num_hosts + 1) * NUM_PHASES)
+            .map(|_| AtomicU64::new(0))
+            .collect()
+    });
+    assert_eq!(samples.len(), (num_hosts + 1) * NUM_PHASES);
+
+    let mut event: libc::sigevent = unsafe { std::mem::zeroed() };
+    event.sigev_notify = libc::SIGEV_THREAD_ID;
+    event.sigev_signo = libc::SIGPROF;
+    event.sigev_notify_thread_id = nix::unistd::gettid().as_raw();
+
+    let mut timer: libc::timer_t = std::ptr::null_mut();
+    nix::errno::Errno::result(unsafe {
+        libc::timer_create(libc::CLOCK_THREAD_CPUTIME_ID, &mut event, &mut timer)
+    })?;
+    TIMER.with(|x| x.set(Some(timer)));
+
+    let interval = libc::timespec {
+        tv_sec: interval.as_secs().try_into().unwrap(),
+        tv_nsec: interval.subsec_nanos().into(),
+    };
+    let spec = libc::itimerspec {
+        it_interval: interval,
+        it_value: interval,
+    };
+    nix::errno::Errno::result(unsafe {
+        libc::timer_settime(timer, 0, &spec, std::ptr::null_mut())
+    })?;
+
+    Ok(())
+}
+
+/// Stop sampling the current thread.
+pub fn stop_thread() {
+    if let Some(timer) = TIMER.with(|x| x.take()) {
+        unsafe { libc::timer_delete(timer) };
+    }
+}
+
+/// Write the sample counts of all threads to `writer` as CSV, with the busiest host and phase
+/// first. `host_names` is indexed by host id.
+pub fn write_report(mut writer: impl Write, host_names: &[String]) -> std::io::Result<()> {
+    let mut totals = vec![0u64; (host_names.len() + 1) * NUM_PHASES];
+    if let Some(samples) = SAMPLES.get() {
+        for (total, count) in totals.iter_mut().zip(samples.iter()) {
+            *total = count.load(Ordering::Relaxed);
+        }
+    }
+
+    let mut rows: Vec<(&str, Phase, u64)> = totals
+        .iter()
+        .enumerate()
+        .filter(|(_, count)| **count != 0)
+        .map(|(idx, count)| {
+            let host = match idx / NUM_PHASES {
+                0 => "-",
+                x => host_names[x - 1].as_str(),
+            };
+            (host, Phase::ALL[idx % NUM_PHASES], *count)
+        })
+        .collect();
+    rows.sort_by(|a, b| b.2.cmp(&a.2).then(a.0.cmp(b.0)));
+
+    writeln!(writer, "host,phase,samples")?;
+    for (host, phase, count) in rows {
+        writeln!(writer, "{host},{},{count}", phase.name())?;
+    }
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_tag_guards() {
+        assert_eq!(TAG.with(|x| x.get()), Tag::NONE);
+        {
+            let _host = enter_host(HostId::from(3));
+            assert_eq!(
+                TAG.with(|x| x.get()),
+                Tag {
+                    host: 4,
+                    phase: Phase::Event
+                }
+            );
+            {
+                let _syscall = enter_phase(Phase::Syscall);
+                assert_eq!(
+                    TAG.with(|x| x.get()),
+                    Tag {
+                        host: 4,
+                        phase: Phase::Syscall
+                    }
+                );
+            }
+            assert_eq!(TAG.with(|x| x.get()).phase, Phase::Event);
+        }
+        assert_eq!(TAG.with(|x| x.get()), Tag::NONE);
+    }
+}
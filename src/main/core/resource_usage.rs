@@ -1,5 +1,7 @@
 use std::fs::File;
-use std::io::{Read, Seek};
+use std::io::{Read, Seek, Write};
+use std::net::{Ipv4Addr, TcpListener, TcpStream};
+use std::sync::{Arc, Mutex};
 
 use serde::Serialize;
 
@@ -75,3 +77,199 @@ fn as_base_unit(val: u64, unit: Option<&str>) -> Option<u64> {
 
     val.checked_mul(mul)
 }
+
+/// Memory used by a host and its managed processes, as sampled by
+/// [`Host::memory_usage`](crate::host::host::Host::memory_usage).
+#[derive(Copy, Clone, Debug, Default, PartialEq, Eq)]
+pub struct HostMemoryUsage {
+    /// The sum of the resident set sizes of the host's running processes, in bytes. Memory shared
+    /// between processes (such as shared libraries) is counted once for each process.
+    pub plugin_rss: u64,
+    /// The part of the running processes' memory that the kernel's same-page merging has merged
+    /// with identical pages, in bytes. Only sampled if `experimental.use_memory_merging` is
+    /// enabled.
+    pub plugin_merged: u64,
+    /// The number of running processes.
+    pub processes: u64,
+    /// The number of events in the host's event queue.
+    pub pending_events: u64,
+    /// The number of open legacy TCP sockets.
+    pub tcp_sockets: u64,
+    /// The bytes buffered in the input buffers of the TCP sockets, including out-of-order data.
+    pub tcp_input_bytes: u64,
+    /// The bytes buffered in the output buffers of the TCP sockets, including data waiting in the
+    /// retransmission queue.
+    pub tcp_output_bytes: u64,
+}
+
+impl HostMemoryUsage {
+    /// The names of the fields in the order that [`write_csv`](Self::write_csv) writes them.
+    pub const CSV_HEADER: &'static str =
+        "plugin_rss_bytes,plugin_merged_bytes,processes,pending_events,tcp_sockets,tcp_input_bytes,\
+         tcp_output_bytes";
+
+    pub fn write_csv(&self, mut writer: impl Write) -> std::io::Result<()> {
+        write!(
+            writer,
+            "{},{},{},{},{},{},{}",
+            self.plugin_rss,
+            self.plugin_merged,
+            self.processes,
+            self.pending_events,
+            self.tcp_sockets,
+            self.tcp_input_bytes,
+            self.tcp_output_bytes,
+        )
+    }
+}
+
+/// Write the memory usage of each host in the Prometheus text exposition format.
+pub fn write_host_memory_prometheus<'a>(
+    mut writer: impl Write,
+    hosts: impl Iterator<Item = (&'a str, &'a HostMemoryUsage)> + Clone,
+) -> std::io::Result<()> {
+    let metrics: [(&str, &str, fn(&HostMemoryUsage) -> u64); 7] = [
+        (
+            "shadow_host_plugin_rss_bytes",
+            "Resident set size of the host's processes.",
+            |x| x.plugin_rss,
+        ),
+        (
+            "shadow_host_plugin_merged_bytes",
+            "Memory of the host's processes that was merged by the kernel's same-page merging.",
+            |x| x.plugin_merged,
+        ),
+        (
+            "shadow_host_processes",
+            "Running processes on the host.",
+            |x| x.processes,
+        ),
+        (
+            "shadow_host_pending_events",
+            "Events in the host's event queue.",
+            |x| x.pending_events,
+        ),
+        (
+            "shadow_host_tcp_sockets",
+            "Open TCP sockets on the host.",
+            |x| x.tcp_sockets,
+        ),
+        (
+            "shadow_host_tcp_input_bytes",
+            "Bytes buffered in the host's TCP input buffers.",
+            |x| x.tcp_input_bytes,
+        ),
+        (
+            "shadow_host_tcp_output_bytes",
+            "Bytes buffered in the host's TCP output and retransmission buffers.",
+            |x| x.tcp_output_bytes,
+        ),
+    ];
+
+    for (name, help, value) in metrics {
+        writeln!(writer, "# HELP {name} {help}")?;
+        writeln!(writer, "# TYPE {name} gauge")?;
+        for (host, usage) in hosts.clone() {
+            writeln!(writer, "{name}{{host=\"{host}\"}} {}", value(usage))?;
+        }
+    }
+
+    Ok(())
+}
+
+/// Serves the latest host memory usage metrics over HTTP on a localhost port, for scraping by
+/// Prometheus. The server runs on a background thread for the rest of the simulation.
+pub struct MetricsServer {
+    metrics: Arc<Mutex<String>>,
+}
+
+impl MetricsServer {
+    pub fn start(port: u16) -> std::io::Result<Self> {
+        let listener = TcpListener::bind((Ipv4Addr::LOCALHOST, port))?;
+        let metrics = Arc::new(Mutex::new(String::new()));
+
+        let metrics_clone = Arc::clone(&metrics);
+        std::thread::Builder::new()
+            .name("metrics-server".to_string())
+            .spawn(move || {
+                for stream in listener.incoming() {
+                    let result = stream.and_then(|stream| serve_metrics(stream, &metrics_clone));
+                    if let Err(e) = result {
+                        log::debug!("Unable to serve metrics: {e}");
+                    }
+                }
+            })?;
+
+        Ok(Self { metrics })
+    }
+
+    /// Replace the metrics that are served.
+    pub fn update(&self, metrics: String) {
+        *self.metrics.lock().unwrap() = metrics;
+    }
+}
+
+fn serve_metrics(mut stream: TcpStream, metrics: &Mutex<String>) -> std::io::Result<()> {
+    stream.set_read_timeout(Some(std::time::Duration::from_secs(1)))?;
+
+    // we serve the same response for any request, but read the request so that the client doesn't
+    // see a reset connection
+    let mut request = [0u8; 4096];
+    let _ = stream.read(&mut request)?;
+
+    let body = metrics.lock().unwrap().clone();
+    write!(
+        stream,
+        "HTTP/1.0 200 OK\r\n\
+         Content-Type: text/plain; version=0.0.4\r\n\
+         Content-Length: {}\r\n\r\n{body}",
+        body.len(),
+    )
+}
+
+/// Returns the resident set size of the process, in bytes, from '/proc/\<pid\>/statm'.
+pub fn statm_resident_bytes(pid: nix::unistd::Pid) -> std::io::Result<u64> {
+    let statm = std::fs::read_to_string(format!("/proc/{pid}/statm"))?;
+
+    // the second field is the number of resident pages
+    let resident_pages: u64 = statm
+        .split_whitespace()
+        .nth(1)
+        .and_then(|x| x.parse().ok())
+        .ok_or_else(|| std::io::Error::new(std::io::ErrorKind::InvalidData, "Unexpected statm"))?;
+
+    let page_size = nix::unistd::sysconf(nix::unistd::SysconfVar::PAGE_SIZE)
+        .ok()
+        .flatten()
+        .unwrap_or(4096);
+
+    Ok(resident_pages * u64::try_from(page_size).unwrap())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_statm_self() {
+        let rss = statm_resident_bytes(nix::unistd::getpid()).unwrap();
+        assert!(rss > 0);
+    }
+
+    #[test]
+    fn test_prometheus() {
+        let usage = HostMemoryUsage {
+            plugin_rss: 4096,
+            tcp_sockets: 2,
+            ..Default::default()
+        };
+
+        let mut buf = Vec::new();
+        write_host_memory_prometheus(&mut buf, [("client", &usage)].into_iter()).unwrap();
+        let text = String::from_utf8(buf).unwrap();
+
+        assert!(text.contains("# TYPE shadow_host_plugin_rss_bytes gauge\n"));
+        assert!(text.contains("shadow_host_plugin_rss_bytes{host=\"client\"} 4096\n"));
+        assert!(text.contains("shadow_host_tcp_sockets{host=\"client\"} 2\n"));
+    }
+}
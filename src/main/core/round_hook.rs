@@ -0,0 +1,369 @@
+//! A hook that lets an external program, such as a power, mobility, or traffic-control model,
+//! co-simulate with Shadow. Enabled with `experimental.round_hook_socket`.
+//!
+//! Shadow connects to the program's Unix stream socket, and they exchange newline-delimited JSON
+//! messages at round boundaries. Shadow sends a [`SyncReport`] with the simulated time that it has
+//! run up to and some statistics, and then blocks until the program replies with a [`SyncReply`].
+//! The reply has a batch of events to inject, and the simulated time that Shadow may run to before
+//! the next sync. Shadow runs every round in between without contacting the program, so the cost of
+//! a sync is paid once per batch of rounds rather than once per round or per event.
+//!
+//! When the simulation ends, Shadow sends a last report with `finished` set, and doesn't wait for a
+//! reply.
+//!
+//! For example, a program that halves a host's upstream bandwidth at 10 seconds and then lets
+//! Shadow run to the end would reply to the first report with:
+//!
+//! ```json
+//! {"run_until_ns": null, "events": [{"time_ns": 10000000000, "host": "server",
+//!  "action": {"set_bandwidth": {"up_bits": 50000000}}}]}
+//! ```
+
+use std::collections::HashMap;
+use std::io::{BufRead, BufReader, Write};
+use std::os::unix::net::UnixStream;
+use std::path::Path;
+use std::time::Duration;
+
+use anyhow::Context;
+use serde::{Deserialize, Serialize};
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+use crate::core::sim_stats::RoundStats;
+use crate::core::support::configuration::Signal;
+use crate::core::work::task::TaskRef;
+use crate::host::host::Host;
+
+/// Sent by Shadow at each sync.
+#[derive(Debug, Serialize)]
+struct SyncReport {
+    /// Every event before this simulated time has run, and no event at or after it has. Injected
+    /// events must not be earlier than this.
+    sim_time_ns: u64,
+    /// The simulation's end time.
+    end_time_ns: u64,
+    /// The number of scheduling rounds that have been run.
+    rounds_executed: u64,
+    /// The number of idle rounds that have been skipped.
+    rounds_skipped: u64,
+    /// Real time since the first round.
+    real_time_ns: u64,
+    /// Set in the last report, which isn't replied to.
+    finished: bool,
+}
+
+/// The program's reply to a [`SyncReport`].
+#[derive(Debug, Deserialize)]
+#[serde(deny_unknown_fields)]
+struct SyncReply {
+    /// Shadow may run the events before this simulated time before syncing again. If null, Shadow
+    /// runs to the end of the simulation without syncing again.
+    run_until_ns: Option<u64>,
+    #[serde(default)]
+    events: Vec<HookEvent>,
+}
+
+#[derive(Debug, Deserialize)]
+#[serde(deny_unknown_fields)]
+struct HookEvent {
+    /// The simulated time at which to run the action.
+    time_ns: u64,
+    /// The name of the host to run the action on.
+    host: String,
+    action: HookAction,
+}
+
+/// An action that the program can run on a host.
+#[derive(Debug, Clone, Deserialize)]
+#[serde(rename_all = "snake_case", deny_unknown_fields)]
+pub enum HookAction {
+    /// Change the bandwidth of the host's internet interface, in bits per second. Omitted directions
+    /// aren't changed. Like the configured bandwidths, the rate is never lower than 1 byte per
+    /// millisecond, so this can't bring a link fully down.
+    SetBandwidth {
+        up_bits: Option<u64>,
+        down_bits: Option<u64>,
+    },
+    /// Send a signal to each of the host's processes, such as to stop the host.
+    Signal { signal: Signal },
+}
+
+impl HookAction {
+    fn run(&self, host: &Host) {
+        log::debug!("Running round hook action {self:?}");
+        match self {
+            Self::SetBandwidth { up_bits, down_bits } => host.set_bandwidth(*up_bits, *down_bits),
+            Self::Signal { signal } => host.signal_all_processes(
+                linux_api::signal::Signal::try_from(**signal as i32).unwrap(),
+            ),
+        }
+    }
+}
+
+/// The events of one sync, by host name.
+#[derive(Debug, Default)]
+pub struct HookEvents {
+    by_host: HashMap<String, Vec<(EmulatedTime, HookAction)>>,
+    earliest: Option<EmulatedTime>,
+}
+
+impl HookEvents {
+    /// The time of the earliest event, if there are any.
+    pub fn earliest(&self) -> Option<EmulatedTime> {
+        self.earliest
+    }
+
+    /// The number of hosts that have events.
+    pub fn num_hosts(&self) -> usize {
+        self.by_host.len()
+    }
+
+    /// The names of the hosts that have events.
+    pub fn host_names(&self) -> impl Iterator<Item = &str> {
+        self.by_host.keys().map(String::as_str)
+    }
+
+    /// Schedule the events of `host`, and return whether it had any.
+    pub fn schedule_on_host(&self, host: &Host) -> bool {
+        let Some(events) = self.by_host.get(host.name()) else {
+            return false;
+        };
+        for (time, action) in events {
+            let action = action.clone();
+            let task = TaskRef::new(move |host| action.run(host));
+            host.schedule_task_at_emulated_time(task, *time);
+        }
+        true
+    }
+}
+
+pub struct RoundHook {
+    reader: BufReader<UnixStream>,
+    writer: UnixStream,
+    /// The events before this time may be run without syncing. `None` once the program has let
+    /// Shadow run to the end.
+    run_until: Option<EmulatedTime>,
+    end_time: EmulatedTime,
+}
+
+impl RoundHook {
+    pub fn connect(path: &Path, end_time: EmulatedTime) -> anyhow::Result<Self> {
+        let stream = UnixStream::connect(path).with_context(|| {
+            format!(
+                "Failed to connect to the round hook socket '{}'",
+                path.display()
+            )
+        })?;
+        Ok(Self {
+            reader: BufReader::new(stream.try_clone()?),
+            writer: stream,
+            // sync before the first round
+            run_until: Some(EmulatedTime::SIMULATION_START),
+            end_time,
+        })
+    }
+
+    /// Whether Shadow must sync before running the events at `time`, or before ending the
+    /// simulation if `time` is after the end.
+    pub fn needs_sync(&self, time: EmulatedTime) -> bool {
+        self.run_until
+            .is_some_and(|t| t < self.end_time && time >= t)
+    }
+
+    /// Limit the end of a scheduling window so that Shadow doesn't run past the next sync.
+    pub fn clamp_window_end(&self, window_end: EmulatedTime) -> EmulatedTime {
+        std::cmp::min(window_end, self.run_until.unwrap_or(EmulatedTime::MAX))
+    }
+
+    fn send_report(
+        &mut self,
+        sim_time: EmulatedTime,
+        round_stats: &RoundStats,
+        real_time: Duration,
+        finished: bool,
+    ) -> anyhow::Result<()> {
+        let report = SyncReport {
+            sim_time_ns: (sim_time - EmulatedTime::SIMULATION_START)
+                .as_nanos()
+                .try_into()
+                .unwrap(),
+            end_time_ns: (self.end_time - EmulatedTime::SIMULATION_START)
+                .as_nanos()
+                .try_into()
+                .unwrap(),
+            rounds_executed: round_stats.executed,
+            rounds_skipped: round_stats.skipped,
+            real_time_ns: real_time.as_nanos().try_into().unwrap_or(u64::MAX),
+            finished,
+        };
+        let mut line = serde_json::to_vec(&report)?;
+        line.push(b'\n');
+        self.writer
+            .write_all(&line)
+            .context("Failed to send a report to the round hook")
+    }
+
+    /// Send a report to the program and wait for its reply. Must only be called when
+    /// [`Self::needs_sync`] is true. Returns the events to inject.
+    pub fn sync(
+        &mut self,
+        round_stats: &RoundStats,
+        real_time: Duration,
+    ) -> anyhow::Result<HookEvents> {
+        let sim_time = self.run_until.unwrap();
+        self.send_report(sim_time, round_stats, real_time, false)?;
+
+        let mut line = String::new();
+        let len = self
+            .reader
+            .read_line(&mut line)
+            .context("Failed to read a reply from the round hook")?;
+        if len == 0 {
+            anyhow::bail!("The round hook closed the connection");
+        }
+        let reply: SyncReply = serde_json::from_str(&line)
+            .with_context(|| format!("Invalid reply from the round hook: {}", line.trim_end()))?;
+
+        let from_nanos = |ns: u64| EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(ns);
+
+        self.run_until = reply.run_until_ns.map(from_nanos);
+        if let Some(run_until) = self.run_until {
+            anyhow::ensure!(
+                run_until > sim_time,
+                "The round hook's run_until_ns must be after the reported sim_time_ns"
+            );
+        }
+
+        let mut events = HookEvents::default();
+        for event in reply.events {
+            let time = from_nanos(event.time_ns);
+            anyhow::ensure!(
+                time >= sim_time,
+                "The round hook's event for host '{}' at {} ns is before the reported sim_time_ns",
+                event.host,
+                event.time_ns,
+            );
+            events.earliest = std::cmp::min(events.earliest.or(Some(time)), Some(time));
+            events
+                .by_host
+                .entry(event.host)
+                .or_default()
+                .push((time, event.action));
+        }
+
+        Ok(events)
+    }
+
+    /// Tell the program that the simulation has ended.
+    pub fn finish(&mut self, round_stats: &RoundStats, real_time: Duration) -> anyhow::Result<()> {
+        self.send_report(self.end_time, round_stats, real_time, true)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse_reply() {
+        let reply: SyncReply = serde_json::from_str(
+            r#"{"run_until_ns": 5, "events": [
+                {"time_ns": 1, "host": "a", "action": {"set_bandwidth": {"up_bits": 10}}},
+                {"time_ns": 2, "host": "b", "action": {"signal": {"signal": "SIGTERM"}}}
+            ]}"#,
+        )
+        .unwrap();
+        assert_eq!(reply.run_until_ns, Some(5));
+        assert!(matches!(
+            reply.events[0].action,
+            HookAction::SetBandwidth {
+                up_bits: Some(10),
+                down_bits: None
+            }
+        ));
+        assert!(matches!(
+            &reply.events[1].action,
+            HookAction::Signal { signal } if **signal == nix::sys::signal::Signal::SIGTERM
+        ));
+
+        let reply: SyncReply = serde_json::from_str(r#"{"run_until_ns": null}"#).unwrap();
+        assert_eq!(reply.run_until_ns, None);
+        assert!(reply.events.is_empty());
+
+        assert!(serde_json::from_str::<SyncReply>(r#"{"run_until_ns": 1, "foo": 2}"#).is_err());
+    }
+
+    #[test]
+    fn test_sync() {
+        let (stream, peer) = UnixStream::pair().unwrap();
+        let end_time = EmulatedTime::SIMULATION_START + SimulationTime::from_secs(10);
+        let mut hook = RoundHook {
+            reader: BufReader::new(stream.try_clone().unwrap()),
+            writer: stream,
+            run_until: Some(EmulatedTime::SIMULATION_START),
+            end_time,
+        };
+        let mut peer_reader = BufReader::new(peer.try_clone().unwrap());
+        let mut peer_writer = peer;
+        // sync, with the peer replying with `reply`; returns the report and the sync's result
+        let mut exchange = |hook: &mut RoundHook, reply: &str| {
+            std::thread::scope(|s| {
+                let peer = s.spawn(|| {
+                    let mut line = String::new();
+                    peer_reader.read_line(&mut line).unwrap();
+                    writeln!(peer_writer, "{reply}").unwrap();
+                    serde_json::from_str::<serde_json::Value>(&line).unwrap()
+                });
+                let events = hook.sync(&RoundStats::default(), Duration::ZERO);
+                (peer.join().unwrap(), events)
+            })
+        };
+        let at_secs = |x| EmulatedTime::SIMULATION_START + SimulationTime::from_secs(x);
+
+        // must sync before the first round
+        assert!(hook.needs_sync(EmulatedTime::SIMULATION_START));
+
+        let (report, events) = exchange(
+            &mut hook,
+            r#"{"run_until_ns": 2000000000, "events": [
+                {"time_ns": 1000000000, "host": "a", "action": {"signal": {"signal": "SIGTERM"}}}
+            ]}"#,
+        );
+        assert_eq!(report["sim_time_ns"], 0);
+        assert_eq!(report["end_time_ns"], 10_000_000_000u64);
+        assert_eq!(report["finished"], false);
+        let events = events.unwrap();
+        assert_eq!(events.earliest(), Some(at_secs(1)));
+        assert_eq!(events.host_names().collect::<Vec<_>>(), ["a"]);
+
+        // runs up to, but not including, the time of the next sync
+        assert!(!hook.needs_sync(at_secs(1)));
+        assert!(hook.needs_sync(at_secs(2)));
+        assert_eq!(hook.clamp_window_end(at_secs(1)), at_secs(1));
+        assert_eq!(hook.clamp_window_end(at_secs(3)), at_secs(2));
+
+        // events can't be before the reported time
+        let (report, events) = exchange(
+            &mut hook,
+            r#"{"run_until_ns": 3000000000, "events": [
+                {"time_ns": 1000000000, "host": "a", "action": {"signal": {"signal": "SIGTERM"}}}
+            ]}"#,
+        );
+        assert_eq!(report["sim_time_ns"], 2_000_000_000u64);
+        assert!(events.is_err());
+
+        // run to the end without syncing again
+        let (_, events) = exchange(&mut hook, r#"{"run_until_ns": null}"#);
+        assert!(events.unwrap().earliest().is_none());
+        assert!(!hook.needs_sync(EmulatedTime::MAX));
+        assert_eq!(hook.clamp_window_end(at_secs(20)), at_secs(20));
+
+        hook.finish(&RoundStats::default(), Duration::ZERO).unwrap();
+        let mut line = String::new();
+        peer_reader.read_line(&mut line).unwrap();
+        let report: serde_json::Value = serde_json::from_str(&line).unwrap();
+        assert_eq!(report["sim_time_ns"], 10_000_000_000u64);
+        assert_eq!(report["finished"], true);
+    }
+}
@@ -5,9 +5,11 @@
 */
 use crossbeam::queue::ArrayQueue;
 
-/// A set of `n` logical processors.
+/// A set of `n` logical processors, of which only the first `num_active` are started. Workers
+/// assigned to inactive processors are stolen by the active processors.
 pub struct LogicalProcessors {
     lps: Vec<LogicalProcessor>,
+    num_active: usize,
 }
 
 impl LogicalProcessors {
@@ -23,7 +25,8 @@ impl LogicalProcessors {
             });
         }
 
-        Self { lps }
+        let num_active = lps.len();
+        Self { lps, num_active }
     }
 
     /// Add a worker id to be run on processor `lpi`.
@@ -63,6 +66,15 @@ impl LogicalProcessors {
         }
     }
 
+    /// Remove every worker from the processors, so that they can be added again with
+    /// [`Self::add_worker`]. Must only be called between tasks, after [`Self::reset`].
+    pub fn clear_workers(&mut self) {
+        for lp in &mut self.lps {
+            assert!(lp.done_workers.is_empty(), "Workers are still running");
+            while lp.ready_workers.pop().is_some() {}
+        }
+    }
+
     /// Returns the cpu id that should be used with [`libc::sched_setaffinity`] to run a thread on
     /// `lpi`. Returns `None` if no cpu id was assigned to `lpi`.
     pub fn cpu_id(&self, lpi: usize) -> Option<u32> {
@@ -75,6 +87,20 @@ impl LogicalProcessors {
     ) -> impl std::iter::Iterator<Item = usize> + Clone + std::iter::ExactSizeIterator {
         0..self.lps.len()
     }
+
+    /// Returns an iterator of the indexes of the active logical processors.
+    pub fn active_iter(
+        &self,
+    ) -> impl std::iter::Iterator<Item = usize> + Clone + std::iter::ExactSizeIterator {
+        0..self.num_active
+    }
+
+    /// Only start the first `n` logical processors. Must be between 1 and the number of
+    /// processors, and must only be called when no task is running.
+    pub fn set_num_active(&mut self, n: usize) {
+        assert!((1..=self.lps.len()).contains(&n));
+        self.num_active = n;
+    }
 }
 
 pub struct LogicalProcessor {
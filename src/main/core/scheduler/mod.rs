@@ -1,7 +1,9 @@
+pub mod partition;
 pub mod runahead;
+pub mod thread_clocks;
 
 // re-export schedulers
-pub use thread_per_core::ThreadPerCoreSched;
+pub use thread_per_core::{HostClasses, ThreadPerCoreSched};
 pub use thread_per_host::ThreadPerHostSched;
 
 mod logical_processor;
@@ -54,6 +56,15 @@ impl Scheduler {
         }
     }
 
+    /// The number of times a host was run by a different thread than the thread that last ran it.
+    /// Returns `None` if the scheduler doesn't move hosts between threads.
+    pub fn host_migrations(&self) -> Option<u64> {
+        match self {
+            Self::ThreadPerHost(_) => None,
+            Self::ThreadPerCore(sched) => Some(sched.host_migrations()),
+        }
+    }
+
     /// Join all threads started by the scheduler.
     pub fn join(self) {
         match self {
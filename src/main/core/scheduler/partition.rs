@@ -0,0 +1,198 @@
+//! Partitioning hosts between worker threads based on the latencies between their network nodes.
+//!
+//! Hosts that sit behind low-latency paths are put in the same partition, so that the smallest
+//! latency between hosts in different partitions (which bounds how far threads can run ahead of
+//! each other) is as large as possible, and so that hosts that are close to each other are run by
+//! the same thread.
+
+/// Partitions with more distinct network nodes than this aren't partitioned, since every pair of
+/// nodes is considered.
+pub const MAX_PARTITION_NODES: usize = 2048;
+
+/// The number of items in each of `num_parts` partitions when `num_items` items are assigned in a
+/// round-robin order: the first `num_items % num_parts` partitions get one more item than the
+/// others.
+pub fn round_robin_sizes(num_items: usize, num_parts: usize) -> Vec<usize> {
+    assert!(num_parts > 0);
+    (0..num_parts)
+        .map(|i| num_items / num_parts + usize::from(i < num_items % num_parts))
+        .collect()
+}
+
+/// Assign each item to one of `num_parts` partitions, where `nodes[i]` is the network node of item
+/// `i`, and `latency` gives the latency from one node to another (or `None` if there is no path).
+/// Partition `p` gets exactly `round_robin_sizes(nodes.len(), num_parts)[p]` items. Returns the
+/// partition of each item, or `None` if there are more than [`MAX_PARTITION_NODES`] distinct
+/// nodes.
+///
+/// This is a greedy min-cut heuristic: nodes are merged into clusters in order of increasing
+/// latency (single linkage) as long as a cluster would fit in a partition, and the clusters are
+/// then packed into the partitions from largest to smallest. A cluster is only split between
+/// partitions if it doesn't fit in any of them. The result is deterministic.
+pub fn partition_by_latency(
+    nodes: &[usize],
+    num_parts: usize,
+    latency: impl Fn(usize, usize) -> Option<u64>,
+) -> Option<Vec<usize>> {
+    let sizes = round_robin_sizes(nodes.len(), num_parts);
+    let max_size = sizes[0];
+
+    // the items at each distinct node
+    let mut distinct: Vec<usize> = nodes.to_vec();
+    distinct.sort_unstable();
+    distinct.dedup();
+    if distinct.len() > MAX_PARTITION_NODES {
+        return None;
+    }
+    let mut node_items: Vec<Vec<usize>> = vec![vec![]; distinct.len()];
+    for (item, node) in nodes.iter().enumerate() {
+        node_items[distinct.binary_search(node).unwrap()].push(item);
+    }
+
+    // the links between nodes, ordered by latency (the smaller of the two directions)
+    let mut links: Vec<(u64, usize, usize)> = vec![];
+    for a in 0..distinct.len() {
+        for b in (a + 1)..distinct.len() {
+            let ab = latency(distinct[a], distinct[b]);
+            let ba = latency(distinct[b], distinct[a]);
+            if let Some(x) = [ab, ba].into_iter().flatten().min() {
+                links.push((x, a, b));
+            }
+        }
+    }
+    links.sort_unstable();
+
+    // merge the clusters at the ends of each link if the result would fit in a partition
+    let mut parent: Vec<usize> = (0..distinct.len()).collect();
+    let mut cluster_size: Vec<usize> = node_items.iter().map(|x| x.len()).collect();
+    fn root(parent: &mut [usize], mut x: usize) -> usize {
+        while parent[x] != x {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        x
+    }
+    for (_, a, b) in links {
+        let (a, b) = (root(&mut parent, a), root(&mut parent, b));
+        if a == b || cluster_size[a] + cluster_size[b] > max_size {
+            continue;
+        }
+        let (a, b) = (std::cmp::min(a, b), std::cmp::max(a, b));
+        parent[b] = a;
+        cluster_size[a] += cluster_size[b];
+    }
+
+    let mut clusters: Vec<Vec<usize>> = vec![vec![]; distinct.len()];
+    for (node, items) in node_items.into_iter().enumerate() {
+        clusters[root(&mut parent, node)].extend(items);
+    }
+    let mut clusters: Vec<Vec<usize>> = clusters.into_iter().filter(|x| !x.is_empty()).collect();
+    // largest first, ties broken by their first item
+    clusters.sort_by_key(|x| (std::cmp::Reverse(x.len()), x[0]));
+
+    // put each cluster in the partition with the most remaining room, splitting clusters that
+    // don't fit in any partition
+    let mut remaining = sizes;
+    let mut assignment = vec![usize::MAX; nodes.len()];
+    for cluster in clusters {
+        let mut items = &cluster[..];
+        while !items.is_empty() {
+            let part = (0..num_parts)
+                .max_by_key(|p| (remaining[*p], std::cmp::Reverse(*p)))
+                .unwrap();
+            let len = std::cmp::min(remaining[part], items.len());
+            for item in &items[..len] {
+                assignment[*item] = part;
+            }
+            remaining[part] -= len;
+            items = &items[len..];
+        }
+    }
+
+    debug_assert!(remaining.iter().all(|x| *x == 0));
+    Some(assignment)
+}
+
+/// The smallest latency between items in different partitions, or `None` if there are no paths
+/// between partitions. See [`partition_by_latency`] for the arguments.
+pub fn min_cross_latency(
+    nodes: &[usize],
+    assignment: &[usize],
+    latency: impl Fn(usize, usize) -> Option<u64>,
+) -> Option<u64> {
+    assert_eq!(nodes.len(), assignment.len());
+
+    // the (node, partition) pairs that are used
+    let mut used: Vec<(usize, usize)> = nodes
+        .iter()
+        .copied()
+        .zip(assignment.iter().copied())
+        .collect();
+    used.sort_unstable();
+    used.dedup();
+
+    let mut min = None;
+    for (src_node, src_part) in &used {
+        for (dst_node, dst_part) in &used {
+            if src_part == dst_part {
+                continue;
+            }
+            if let Some(x) = latency(*src_node, *dst_node) {
+                min = Some(min.map_or(x, |min: u64| std::cmp::min(min, x)));
+            }
+        }
+    }
+    min
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Two groups of nodes, {0, 1} and {2, 3}, with low latencies within each group.
+    fn latency(a: usize, b: usize) -> Option<u64> {
+        Some(if a == b {
+            1
+        } else if a / 2 == b / 2 {
+            5
+        } else {
+            100
+        })
+    }
+
+    #[test]
+    fn test_round_robin_sizes() {
+        assert_eq!(round_robin_sizes(7, 3), [3, 2, 2]);
+        assert_eq!(round_robin_sizes(2, 4), [1, 1, 0, 0]);
+    }
+
+    #[test]
+    fn test_groups() {
+        let nodes = [0, 0, 1, 1, 2, 2, 3, 3];
+        let assignment = partition_by_latency(&nodes, 2, latency).unwrap();
+
+        for (i, node) in nodes.iter().enumerate() {
+            for (j, other) in nodes.iter().enumerate() {
+                assert_eq!(
+                    assignment[i] == assignment[j],
+                    node / 2 == other / 2,
+                    "{assignment:?}"
+                );
+            }
+        }
+
+        assert_eq!(min_cross_latency(&nodes, &assignment, latency), Some(100));
+        let round_robin: Vec<usize> = (0..nodes.len()).map(|x| x % 2).collect();
+        assert_eq!(min_cross_latency(&nodes, &round_robin, latency), Some(1));
+    }
+
+    #[test]
+    fn test_sizes() {
+        // every item is on one node, so it must be split
+        let nodes = [7; 10];
+        let assignment = partition_by_latency(&nodes, 3, latency).unwrap();
+        for (part, size) in round_robin_sizes(nodes.len(), 3).into_iter().enumerate() {
+            assert_eq!(assignment.iter().filter(|x| **x == part).count(), size);
+        }
+    }
+}
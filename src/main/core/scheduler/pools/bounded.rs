@@ -146,6 +146,49 @@ impl ParallelismBoundedThreadPool {
         self.shared_state.logical_processors.borrow().iter().len()
     }
 
+    /// The number of logical processors that are started when a task is run.
+    pub fn num_active_processors(&self) -> usize {
+        self.shared_state
+            .logical_processors
+            .borrow()
+            .active_iter()
+            .len()
+    }
+
+    /// Only run the task on the first `n` logical processors, which then run the threads of the
+    /// other processors. The threads of the inactive processors stay parked until they're run by
+    /// an active processor. `n` must be between 1 and [`Self::num_processors`].
+    pub fn set_active_processors(&mut self, n: usize) {
+        self.shared_state
+            .logical_processors
+            .borrow_mut()
+            .set_num_active(n);
+    }
+
+    /// Move each thread `i` to logical processor `assignment[i]`, where each processor runs its
+    /// threads in order of decreasing `costs`. Threads may still be stolen by other processors
+    /// when their own processor runs out of threads.
+    pub fn reassign_threads(&mut self, assignment: &[usize], costs: &[u64]) {
+        assert_eq!(assignment.len(), self.num_threads());
+        assert_eq!(costs.len(), self.num_threads());
+
+        let mut order: Vec<usize> = (0..assignment.len()).collect();
+        order.sort_by_key(|&i| (std::cmp::Reverse(costs[i]), i));
+
+        let mut logical_processors = self.shared_state.logical_processors.borrow_mut();
+        logical_processors.clear_workers();
+
+        for thread_idx in order {
+            let thread = &self.shared_state.threads[thread_idx];
+            let processor_idx = assignment[thread_idx];
+
+            if thread.logical_processor_idx.load(Ordering::Relaxed) != processor_idx {
+                assign_to_processor(thread, processor_idx, &logical_processors);
+            }
+            logical_processors.add_worker(processor_idx, thread_idx);
+        }
+    }
+
     /// The total number of threads.
     pub fn num_threads(&self) -> usize {
         self.thread_handles.len()
@@ -291,8 +334,9 @@ impl<'a, 'scope> TaskRunner<'a, 'scope> {
 
         let logical_processors = self.scope.pool.shared_state.logical_processors.borrow();
 
-        // start the first thread for each logical processor
-        for processor_idx in logical_processors.iter() {
+        // start the first thread for each active logical processor; the inactive processors'
+        // threads will be stolen by the active processors
+        for processor_idx in logical_processors.active_iter() {
             start_next_thread(
                 processor_idx,
                 &self.scope.pool.shared_state,
@@ -554,6 +598,62 @@ mod tests {
         assert_eq!(counter.load(Ordering::SeqCst), 300);
     }
 
+    #[test]
+    fn test_active_processors() {
+        let mut pool = ParallelismBoundedThreadPool::new(&[None, None, None], 10, "worker");
+
+        for num_active in [1, 3, 2] {
+            pool.set_active_processors(num_active);
+            assert_eq!(pool.num_active_processors(), num_active);
+
+            let counter = AtomicU32::new(0);
+            let processors: Vec<AtomicBool> = (0..3).map(|_| AtomicBool::new(false)).collect();
+            pool.scope(|s| {
+                s.run(|t| {
+                    counter.fetch_add(1, Ordering::SeqCst);
+                    processors[t.processor_idx].store(true, Ordering::SeqCst);
+                });
+            });
+
+            // every thread ran, but only on the active processors
+            assert_eq!(counter.load(Ordering::SeqCst), 10);
+            for (i, ran) in processors.iter().enumerate() {
+                if i >= num_active {
+                    assert_eq!(ran.load(Ordering::SeqCst), false);
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_reassign_threads() {
+        let mut pool = ParallelismBoundedThreadPool::new(&[None, None, None], 6, "worker");
+
+        let assignment = [2, 2, 0, 2, 0, 1];
+        let costs = [5, 1, 3, 4, 2, 6];
+        pool.reassign_threads(&assignment, &costs);
+
+        for _ in 0..3 {
+            let counter = AtomicU32::new(0);
+            pool.scope(|s| {
+                s.run(|_| {
+                    counter.fetch_add(1, Ordering::SeqCst);
+                });
+            });
+            assert_eq!(counter.load(Ordering::SeqCst), 6);
+        }
+
+        // the threads can still be moved after they've been stolen
+        pool.reassign_threads(&[0; 6], &[0; 6]);
+        let counter = AtomicU32::new(0);
+        pool.scope(|s| {
+            s.run(|_| {
+                counter.fetch_add(1, Ordering::SeqCst);
+            });
+        });
+        assert_eq!(counter.load(Ordering::SeqCst), 6);
+    }
+
     #[test]
     fn test_scope_runner_order() {
         let mut pool = ParallelismBoundedThreadPool::new(&[None], 1, "worker");
@@ -9,8 +9,10 @@ use std::sync::Arc;
 
 use atomic_refcell::AtomicRefCell;
 
-use crate::utility::synchronization::count_down_latch::{self, build_count_down_latch};
 use crate::utility::synchronization::simple_latch;
+use crate::utility::synchronization::tree_latch::{
+    build_tree_latch, TreeLatchCounter, TreeLatchWaiter,
+};
 
 // If making substantial changes to this scheduler, you should verify the compilation error message
 // for each test at the end of this file to make sure that they correctly cause the expected
@@ -34,7 +36,7 @@ pub struct UnboundedThreadPool {
     /// running the task.
     task_start_latch: simple_latch::Latch,
     /// The main thread uses this to wait for the threads to finish running the task.
-    task_end_waiter: count_down_latch::LatchWaiter,
+    task_end_waiter: TreeLatchWaiter,
 }
 
 pub struct SharedState {
@@ -51,29 +53,24 @@ impl UnboundedThreadPool {
             has_thread_panicked: AtomicBool::new(false),
         });
 
-        let (task_end_counter, task_end_waiter) = build_count_down_latch();
+        // the threads count down in a tree so that they don't all contend on a single lock or
+        // cache line at the end of each task
+        let (task_end_counters, task_end_waiter) = build_tree_latch(num_threads, yield_spin);
         let mut task_start_latch = simple_latch::Latch::new();
 
         let mut thread_handles = Vec::new();
 
-        for i in 0..num_threads {
+        for (i, task_end_counter) in task_end_counters.into_iter().enumerate() {
             let shared_state_clone = Arc::clone(&shared_state);
 
             // enabling spinning on the threads may improve performance under some conditions
             // (see https://github.com/shadow/shadow/issues/2877)
             let task_start_waiter = task_start_latch.waiter(yield_spin);
 
-            let task_end_counter_clone = task_end_counter.clone();
-
             let handle = std::thread::Builder::new()
                 .name(thread_name.to_string())
                 .spawn(move || {
-                    work_loop(
-                        i,
-                        shared_state_clone,
-                        task_start_waiter,
-                        task_end_counter_clone,
-                    )
+                    work_loop(i, shared_state_clone, task_start_waiter, task_end_counter)
                 })
                 .unwrap();
 
@@ -224,7 +221,7 @@ fn work_loop(
     thread_index: usize,
     shared_state: Arc<SharedState>,
     mut start_waiter: simple_latch::LatchWaiter,
-    mut end_counter: count_down_latch::LatchCounter,
+    mut end_counter: TreeLatchCounter,
 ) {
     // we don't use `catch_unwind` here for two main reasons:
     //
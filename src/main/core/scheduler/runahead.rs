@@ -1,4 +1,7 @@
+use std::collections::BTreeMap;
+use std::sync::atomic::{AtomicU64, Ordering};
 use std::sync::RwLock;
+use std::time::Duration;
 
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
@@ -15,8 +18,8 @@ pub struct Runahead {
     /// only updated if dynamic runahead is enabled for the simulation.
     min_used_latency: RwLock<Option<SimulationTime>>,
     /// The lowest latency that's possible in the simulation (the graph edge with the lowest
-    /// latency).
-    min_possible_latency: SimulationTime,
+    /// latency), in nanoseconds. Only lowered between scheduling rounds.
+    min_possible_latency_ns: AtomicU64,
     /// A lower bound for the runahead as specified by the user.
     min_runahead_config: Option<SimulationTime>,
     /// Is dynamic runahead enabled?
@@ -33,7 +36,9 @@ impl Runahead {
 
         Self {
             min_used_latency: RwLock::new(None),
-            min_possible_latency,
+            min_possible_latency_ns: AtomicU64::new(
+                u64::try_from(min_possible_latency.as_nanos()).unwrap(),
+            ),
             min_runahead_config,
             is_runahead_dynamic,
         }
@@ -48,13 +53,46 @@ impl Runahead {
             .min_used_latency
             .read()
             .unwrap()
-            .unwrap_or(self.min_possible_latency);
+            .unwrap_or_else(|| self.min_possible_latency());
 
         // the 'runahead' config option sets a lower bound for the runahead
         let runahead_config = self.min_runahead_config.unwrap_or(SimulationTime::ZERO);
         std::cmp::max(runahead, runahead_config)
     }
 
+    fn min_possible_latency(&self) -> SimulationTime {
+        SimulationTime::from_nanos(self.min_possible_latency_ns.load(Ordering::Relaxed))
+    }
+
+    /// Lower the smallest possible latency if `latency` is smaller, such as when a path's latency
+    /// has been changed. This shortens the runahead for future rounds, even if dynamic runahead is
+    /// enabled and no packet has used the latency yet. Must only be called between rounds.
+    pub fn lower_min_possible_latency(&self, latency: SimulationTime) {
+        assert!(!latency.is_zero());
+
+        let old = self.min_possible_latency();
+        if latency >= old {
+            return;
+        }
+        self.min_possible_latency_ns.store(
+            u64::try_from(latency.as_nanos()).unwrap(),
+            Ordering::Relaxed,
+        );
+
+        // the used latency is only a better bound than the possible latency until a smaller
+        // latency becomes possible
+        let mut min_used_latency = self.min_used_latency.write().unwrap();
+        if min_used_latency.is_some_and(|x| x > latency) {
+            *min_used_latency = Some(latency);
+        }
+
+        log::info!(
+            "Minimum possible latency lowered from {} ns to {} ns",
+            old.as_nanos(),
+            latency.as_nanos()
+        );
+    }
+
     /// If dynamic runahead is enabled, will compare and update the stored lowest packet latency.
     /// This may shorten the runahead for future rounds.
     pub fn update_lowest_used_latency(&self, latency: SimulationTime) {
@@ -114,3 +152,62 @@ impl Runahead {
         );
     }
 }
+
+/// The estimated effect of a larger lower bound on the runahead, from the scheduling statistics
+/// of a finished simulation.
+#[derive(Debug, Copy, Clone)]
+pub struct RunaheadEstimate {
+    pub runahead: SimulationTime,
+    /// The estimated number of scheduling rounds.
+    pub rounds: u64,
+    /// The estimated real time spent in the scheduling rounds.
+    pub real_time: Duration,
+    /// The number of packets sent with a latency smaller than `runahead`. These packets may be
+    /// delivered later than their latency, by less than `runahead`.
+    pub delayed_packets: u64,
+}
+
+/// Estimate how a simulation would have run with each packet latency larger than `runahead` as
+/// the lower bound of the runahead. `rounds` rounds ran in `real_time`, of which the threads were
+/// busy for `busy_time` on average, and `latency_counts` is the number of packets sent with each
+/// latency in nanoseconds.
+///
+/// This assumes that the events are spread evenly over the simulation, so that the number of
+/// rounds is inversely proportional to the runahead, and that each round has a fixed overhead
+/// in addition to the time spent running hosts.
+pub fn estimate_runahead_lower_bounds(
+    runahead: SimulationTime,
+    rounds: u64,
+    real_time: Duration,
+    busy_time: Duration,
+    latency_counts: &BTreeMap<u64, u64>,
+) -> Vec<RunaheadEstimate> {
+    if rounds == 0 || runahead.is_zero() {
+        return Vec::new();
+    }
+
+    let overhead_per_round = real_time.saturating_sub(busy_time).as_secs_f64() / rounds as f64;
+    let runahead_ns = u64::try_from(runahead.as_nanos()).unwrap();
+
+    let mut delayed_packets = latency_counts.range(..runahead_ns).map(|(_, x)| x).sum();
+
+    let mut estimates = Vec::new();
+    for (&latency_ns, &count) in latency_counts.range(runahead_ns..) {
+        if latency_ns > runahead_ns {
+            // rounds can merge but not split, so there are never more rounds than before
+            let candidate_rounds =
+                u128::from(rounds) * u128::from(runahead_ns) / u128::from(latency_ns);
+            let candidate_rounds = std::cmp::max(1, u64::try_from(candidate_rounds).unwrap());
+            estimates.push(RunaheadEstimate {
+                runahead: SimulationTime::from_nanos(latency_ns),
+                rounds: candidate_rounds,
+                real_time: busy_time
+                    + Duration::from_secs_f64(overhead_per_round * candidate_rounds as f64),
+                delayed_packets,
+            });
+        }
+        delayed_packets += count;
+    }
+
+    estimates
+}
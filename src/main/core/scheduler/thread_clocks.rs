@@ -0,0 +1,483 @@
+use std::collections::HashMap;
+use std::hash::Hash;
+use std::sync::atomic::{AtomicU32, AtomicU64, Ordering};
+
+use nix::errno::Errno;
+use once_cell::sync::OnceCell;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+use shadow_shim_helper_rs::HostId;
+
+/// Per-thread clocks for running scheduling windows without a global barrier between rounds
+/// (conservative parallel discrete-event simulation).
+///
+/// Each worker thread owns a fixed set of hosts and publishes a lower bound on the time of any
+/// event it may still run. A thread may run its hosts up to the minimum over all threads of each
+/// thread's bound plus the lookahead from that thread to this thread (the smallest possible latency
+/// of a packet between their hosts), since no thread can send it an event earlier than that. Events
+/// sent between threads are tracked in a per-thread "pending" bound until the receiving thread has
+/// seen them in its hosts' event queues.
+///
+/// The bounds are read together as a [`ClockSnapshot`]. Since an event can move from one bound to
+/// another (from a sender's lower bound to the receiver's pending bound, and from there to the
+/// receiver's lower bound), reading the bounds one at a time could miss an event that moved while
+/// they were being read. Every change that can raise a bound is preceded by an increment of an
+/// epoch counter, and a snapshot is retried until the epoch is the same before and after reading
+/// the bounds. Threads that have nothing to run also wait on the epoch for the clocks to change.
+///
+/// For this to be safe, the lookahead between two threads must not be larger than the latency of
+/// any packet sent between their hosts, and hosts must not move between threads while the clocks
+/// are in use.
+#[derive(Debug)]
+pub struct ThreadClocks {
+    /// For each thread, a lower bound on the time of the next event it will run.
+    lower_bounds: Vec<AtomicU64>,
+    /// For each thread, the earliest time of an event pushed by another thread that the thread may
+    /// not have included in its lower bound yet.
+    pending: Vec<AtomicU64>,
+    /// For each host, the index of the thread that owns it.
+    host_owners: Vec<AtomicU32>,
+    /// The lookahead between all threads if `pair_lookaheads` isn't set.
+    lookahead: SimulationTime,
+    /// The lookahead from each thread to each other thread, indexed by `src * num_threads + dst`.
+    pair_lookaheads: OnceCell<Vec<SimulationTime>>,
+    /// Incremented before any bound may be raised, and after any bound changes. This is also the
+    /// futex word that idle threads wait on. It wraps, but a snapshot would need to be interrupted
+    /// by 2^32 changes to be wrongly accepted.
+    epoch: AtomicU32,
+    /// The number of threads that are (or are about to be) futex-waiting on `epoch`.
+    sleepers: AtomicU32,
+}
+
+/// A consistent view of all of the threads' bounds, from [`ThreadClocks::snapshot`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct ClockSnapshot {
+    /// The epoch that the bounds were read at, for [`ThreadClocks::wait_for_change`].
+    pub epoch: u32,
+    /// The minimum lower bound over all threads, including events still pending for each thread,
+    /// or `None` if no thread will run any more events.
+    pub global_lower_bound: Option<EmulatedTime>,
+    /// The time that the thread may safely run its hosts up to (exclusive), or `None` if no thread
+    /// will run any more events.
+    pub safe_window_end: Option<EmulatedTime>,
+}
+
+impl ThreadClocks {
+    pub fn new(num_threads: usize, num_hosts: usize, lookahead: SimulationTime) -> Self {
+        assert!(!lookahead.is_zero());
+
+        let start = EmulatedTime::to_c_emutime(Some(EmulatedTime::SIMULATION_START));
+        let none = EmulatedTime::to_c_emutime(None);
+
+        Self {
+            lower_bounds: (0..num_threads).map(|_| AtomicU64::new(start)).collect(),
+            pending: (0..num_threads).map(|_| AtomicU64::new(none)).collect(),
+            host_owners: (0..num_hosts).map(|_| AtomicU32::new(u32::MAX)).collect(),
+            lookahead,
+            pair_lookaheads: OnceCell::new(),
+            epoch: AtomicU32::new(0),
+            sleepers: AtomicU32::new(0),
+        }
+    }
+
+    fn num_threads(&self) -> usize {
+        self.lower_bounds.len()
+    }
+
+    /// The lookahead from thread `src` to thread `dst`.
+    fn pair_lookahead(&self, src: usize, dst: usize) -> SimulationTime {
+        match self.pair_lookaheads.get() {
+            Some(lookaheads) => lookaheads[src * self.num_threads() + dst],
+            None => self.lookahead,
+        }
+    }
+
+    /// Set the lookahead between each pair of threads from the latencies between their hosts'
+    /// network nodes, so that a low-latency path only shortens the windows of the threads at its
+    /// ends. `host_nodes` gives the network node of every host, and `latency` gives the smallest
+    /// possible latency of a packet from one node to another, or `None` if there is no path. Must
+    /// be called after all host owners are set and before any thread starts running its hosts, and
+    /// can only be called once.
+    ///
+    /// `latency` is only called for pairs of nodes whose hosts are owned by different threads, and
+    /// all calls with the same source node are made together. The lookahead from a thread to
+    /// itself is the lookahead between all threads, so the paths between a thread's own nodes
+    /// aren't looked up.
+    pub fn set_pair_lookaheads<N: Copy + Eq + Hash>(
+        &self,
+        host_nodes: impl IntoIterator<Item = (HostId, N)>,
+        latency: impl Fn(N, N) -> Option<SimulationTime>,
+    ) {
+        let num_threads = self.num_threads();
+
+        // the threads that own a host at each node
+        let mut node_threads: HashMap<N, Vec<usize>> = HashMap::new();
+        for (host, node) in host_nodes {
+            let owner =
+                self.host_owners[usize::try_from(u32::from(host)).unwrap()].load(Ordering::Relaxed);
+            let threads = node_threads.entry(node).or_default();
+            let owner = usize::try_from(owner).unwrap();
+            if !threads.contains(&owner) {
+                threads.push(owner);
+            }
+        }
+
+        // the smallest latency between any nodes of each pair of threads
+        let mut lookaheads = vec![SimulationTime::MAX; num_threads * num_threads];
+        for thread in 0..num_threads {
+            lookaheads[thread * num_threads + thread] = self.lookahead;
+        }
+        for (src_node, src_threads) in &node_threads {
+            for (dst_node, dst_threads) in &node_threads {
+                let is_cross_thread = src_threads
+                    .iter()
+                    .any(|src| dst_threads.iter().any(|dst| src != dst));
+                if !is_cross_thread {
+                    continue;
+                }
+                let Some(latency) = latency(*src_node, *dst_node) else {
+                    continue;
+                };
+                for src in src_threads {
+                    for dst in dst_threads.iter().filter(|dst| *dst != src) {
+                        let lookahead = &mut lookaheads[src * num_threads + dst];
+                        *lookahead = std::cmp::min(*lookahead, latency);
+                    }
+                }
+            }
+        }
+
+        // an event can also reach a thread through other threads (for example a packet that causes
+        // a host to send another packet), so the lookahead must be the shortest path through threads
+        for via in 0..num_threads {
+            for src in 0..num_threads {
+                for dst in 0..num_threads {
+                    let through = lookaheads[src * num_threads + via]
+                        .saturating_add(lookaheads[via * num_threads + dst]);
+                    let lookahead = &mut lookaheads[src * num_threads + dst];
+                    *lookahead = std::cmp::min(*lookahead, through);
+                }
+            }
+        }
+
+        assert!(lookaheads.iter().all(|x| !x.is_zero()));
+        self.pair_lookaheads.set(lookaheads).unwrap();
+    }
+
+    /// Record that `thread` owns `host`. All owners must be set before any thread starts running
+    /// its hosts.
+    pub fn set_host_owner(&self, host: HostId, thread: usize) {
+        let thread = u32::try_from(thread).unwrap();
+        self.host_owners[usize::try_from(u32::from(host)).unwrap()]
+            .store(thread, Ordering::Relaxed);
+    }
+
+    /// Must be called after an event at time `time` was pushed to the event queue of host `dst`.
+    pub fn event_pushed(&self, dst: HostId, time: EmulatedTime) {
+        let owner =
+            self.host_owners[usize::try_from(u32::from(dst)).unwrap()].load(Ordering::Relaxed);
+        let owner = usize::try_from(owner).unwrap();
+        self.pending[owner].fetch_min(EmulatedTime::to_c_emutime(Some(time)), Ordering::SeqCst);
+
+        // the owner may be waiting for something to run
+        self.notify();
+    }
+
+    /// Update the lower bound of `thread`. `next_event_time` must return the earliest event time
+    /// in the event queues of all hosts owned by `thread`, and is called after any pending events
+    /// pushed to `thread` have been folded into its lower bound. Returns the new lower bound.
+    pub fn update_lower_bound(
+        &self,
+        thread: usize,
+        next_event_time: impl FnOnce() -> Option<EmulatedTime>,
+    ) -> Option<EmulatedTime> {
+        let none = EmulatedTime::to_c_emutime(None);
+
+        // Move the pending time into our lower bound. The pending time must stay visible to other
+        // threads (either in `pending` or in `lower_bounds`) until we've looked at our event
+        // queues, otherwise another thread could compute a window end past the pending event.
+        loop {
+            let pending = self.pending[thread].load(Ordering::SeqCst);
+            if pending == none {
+                break;
+            }
+            self.lower_bounds[thread].fetch_min(pending, Ordering::SeqCst);
+            // clearing the pending time raises that bound
+            self.epoch.fetch_add(1, Ordering::SeqCst);
+            if self.pending[thread]
+                .compare_exchange(pending, none, Ordering::SeqCst, Ordering::SeqCst)
+                .is_ok()
+            {
+                break;
+            }
+        }
+
+        // any events that were pending are now in the event queues, and any events pushed after
+        // this point will be in `pending`
+        let next_event_time = next_event_time();
+        self.publish_lower_bound(thread, next_event_time);
+
+        next_event_time
+    }
+
+    /// Publish a new lower bound for `thread`, or `None` if the thread has no more events to run.
+    fn publish_lower_bound(&self, thread: usize, time: Option<EmulatedTime>) {
+        self.epoch.fetch_add(1, Ordering::SeqCst);
+        // `None` is represented as `u64::MAX`, so is larger than any time
+        self.lower_bounds[thread].store(EmulatedTime::to_c_emutime(time), Ordering::SeqCst);
+        self.notify();
+    }
+
+    /// Read the bounds of all threads at once, and compute the global lower bound and the window
+    /// end of `thread` from them.
+    pub fn snapshot(&self, thread: usize) -> ClockSnapshot {
+        loop {
+            let epoch = self.epoch.load(Ordering::SeqCst);
+
+            let mut global_lower_bound = EmulatedTime::to_c_emutime(None);
+            let mut safe_window_end = None;
+            for (src, (bound, pending)) in self.lower_bounds.iter().zip(&self.pending).enumerate() {
+                let bound =
+                    std::cmp::min(bound.load(Ordering::SeqCst), pending.load(Ordering::SeqCst));
+                global_lower_bound = std::cmp::min(global_lower_bound, bound);
+
+                if let Some(bound) = EmulatedTime::from_c_emutime(bound) {
+                    let end = bound
+                        .checked_add(self.pair_lookahead(src, thread))
+                        .unwrap_or(EmulatedTime::MAX);
+                    safe_window_end = Some(safe_window_end.map_or(end, |x| std::cmp::min(x, end)));
+                }
+            }
+
+            // if any bound may have been raised while we were reading them, we may have missed an
+            // event that moved from a bound we hadn't read yet to one we already had
+            if self.epoch.load(Ordering::SeqCst) == epoch {
+                return ClockSnapshot {
+                    epoch,
+                    global_lower_bound: EmulatedTime::from_c_emutime(global_lower_bound),
+                    safe_window_end,
+                };
+            }
+        }
+    }
+
+    /// The minimum lower bound over all threads, including events still pending for each thread.
+    /// Returns `None` if no thread will run any more events.
+    pub fn global_lower_bound(&self) -> Option<EmulatedTime> {
+        self.snapshot(0).global_lower_bound
+    }
+
+    /// The time that `thread` may safely run its hosts up to (exclusive). Returns `None` if no
+    /// thread will run any more events.
+    pub fn safe_window_end(&self, thread: usize) -> Option<EmulatedTime> {
+        self.snapshot(thread).safe_window_end
+    }
+
+    /// Block `thread` until the clocks may have changed since `epoch` was read (from a
+    /// [`ClockSnapshot`]), or until events are pending for it. May return spuriously.
+    pub fn wait_for_change(&self, thread: usize, epoch: u32) {
+        static_assertions::assert_eq_size!(AtomicU32, u32);
+        static_assertions::assert_eq_align!(AtomicU32, u32);
+
+        // the orderings must be `SeqCst` so that a thread that changes the clocks after we
+        // increment `sleepers` is guaranteed to wake us (see `notify()`)
+        self.sleepers.fetch_add(1, Ordering::SeqCst);
+
+        // events may have been pushed to us after we looked at our event queues but before the
+        // snapshot was taken
+        if self.pending[thread].load(Ordering::SeqCst) != EmulatedTime::to_c_emutime(None) {
+            self.sleepers.fetch_sub(1, Ordering::SeqCst);
+            return;
+        }
+
+        let rv = Errno::result(unsafe {
+            libc::syscall(
+                libc::SYS_futex,
+                self.epoch.as_ptr(),
+                libc::FUTEX_WAIT | libc::FUTEX_PRIVATE_FLAG,
+                epoch,
+                std::ptr::null::<libc::timespec>(),
+                std::ptr::null_mut::<u32>(),
+                0u32,
+            )
+        });
+        self.sleepers.fetch_sub(1, Ordering::SeqCst);
+        assert!(
+            rv.is_ok() || rv == Err(Errno::EAGAIN) || rv == Err(Errno::EINTR),
+            "FUTEX_WAIT failed with {rv:?}"
+        );
+    }
+
+    /// Must be called after changing any bound, to wake the threads that are waiting for a change.
+    fn notify(&self) {
+        self.epoch.fetch_add(1, Ordering::SeqCst);
+
+        // waiters increment `sleepers` before futex-waiting, so if there are none then we don't
+        // need to make a syscall
+        if self.sleepers.load(Ordering::SeqCst) == 0 {
+            return;
+        }
+
+        let rv = unsafe {
+            libc::syscall(
+                libc::SYS_futex,
+                self.epoch.as_ptr(),
+                libc::FUTEX_WAKE | libc::FUTEX_PRIVATE_FLAG,
+                // the man page says to use INT_MAX, even though this is a uint32_t
+                i32::MAX,
+                std::ptr::null::<libc::timespec>(),
+                std::ptr::null_mut::<u32>(),
+                0u32,
+            )
+        };
+        assert!(rv >= 0);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn time(ns: u64) -> EmulatedTime {
+        EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(ns)
+    }
+
+    #[test]
+    fn test_window_end() {
+        let clocks = ThreadClocks::new(2, 2, SimulationTime::from_nanos(10));
+        clocks.set_host_owner(HostId::from(0), 0);
+        clocks.set_host_owner(HostId::from(1), 1);
+
+        assert_eq!(clocks.safe_window_end(0), Some(time(10)));
+
+        clocks.publish_lower_bound(0, Some(time(30)));
+        clocks.publish_lower_bound(1, None);
+        assert_eq!(clocks.safe_window_end(0), Some(time(40)));
+
+        // an event pushed to thread 1 is included in the bound until thread 1 updates its lower
+        // bound
+        clocks.event_pushed(HostId::from(1), time(35));
+        clocks.publish_lower_bound(0, Some(time(60)));
+        assert_eq!(clocks.safe_window_end(0), Some(time(45)));
+
+        let bound = clocks.update_lower_bound(1, || {
+            // the pending event must still be visible while we look at the event queues
+            assert_eq!(clocks.global_lower_bound(), Some(time(35)));
+            Some(time(35))
+        });
+        assert_eq!(bound, Some(time(35)));
+        assert_eq!(clocks.safe_window_end(0), Some(time(45)));
+
+        clocks.update_lower_bound(1, || Some(time(100)));
+        assert_eq!(clocks.safe_window_end(0), Some(time(70)));
+    }
+
+    #[test]
+    fn test_wait_for_change() {
+        let clocks = ThreadClocks::new(2, 2, SimulationTime::from_nanos(10));
+        clocks.set_host_owner(HostId::from(0), 0);
+        clocks.set_host_owner(HostId::from(1), 1);
+
+        // the clocks already changed since this snapshot, so this doesn't block
+        let snapshot = clocks.snapshot(0);
+        clocks.publish_lower_bound(1, Some(time(20)));
+        clocks.wait_for_change(0, snapshot.epoch);
+        assert_ne!(clocks.snapshot(0), snapshot);
+
+        let snapshot = clocks.snapshot(0);
+        assert_eq!(snapshot, clocks.snapshot(0));
+        std::thread::scope(|s| {
+            s.spawn(|| {
+                std::thread::sleep(std::time::Duration::from_millis(10));
+                clocks.event_pushed(HostId::from(0), time(15));
+            });
+            while clocks.snapshot(0).epoch == snapshot.epoch {
+                clocks.wait_for_change(0, snapshot.epoch);
+            }
+        });
+        assert_eq!(clocks.global_lower_bound(), Some(time(0)));
+        assert_eq!(clocks.snapshot(1).safe_window_end, Some(time(10)));
+    }
+
+    #[test]
+    fn test_finished() {
+        let clocks = ThreadClocks::new(1, 1, SimulationTime::from_nanos(10));
+        clocks.set_host_owner(HostId::from(0), 0);
+        clocks.publish_lower_bound(0, None);
+        assert_eq!(clocks.global_lower_bound(), None);
+        assert_eq!(clocks.safe_window_end(0), None);
+    }
+
+    #[test]
+    fn test_pair_lookaheads() {
+        let clocks = ThreadClocks::new(3, 4, SimulationTime::from_nanos(1));
+        for (host, thread) in [(0, 0), (1, 0), (2, 1), (3, 2)] {
+            clocks.set_host_owner(HostId::from(host), thread);
+        }
+
+        // hosts 0 and 1 share node 'a'; the latency between nodes is their distance apart in ns
+        // (with a latency of 1 within a node), except that there is no path to or from node 'z'
+        let host_nodes =
+            [(0, 'a'), (1, 'a'), (2, 'm'), (3, 'z')].map(|(h, n)| (HostId::from(h), n));
+        clocks.set_pair_lookaheads(host_nodes, |src, dst| {
+            if src == 'z' || dst == 'z' {
+                return None;
+            }
+            Some(SimulationTime::from_nanos(std::cmp::max(
+                1,
+                (u32::from(src) as i64 - u32::from(dst) as i64).unsigned_abs(),
+            )))
+        });
+
+        assert_eq!(clocks.pair_lookahead(0, 0), SimulationTime::from_nanos(1));
+        assert_eq!(clocks.pair_lookahead(0, 1), SimulationTime::from_nanos(12));
+        assert_eq!(clocks.pair_lookahead(1, 0), SimulationTime::from_nanos(12));
+        assert_eq!(clocks.pair_lookahead(0, 2), SimulationTime::MAX);
+
+        clocks.publish_lower_bound(0, Some(time(100)));
+        clocks.publish_lower_bound(1, Some(time(50)));
+        clocks.publish_lower_bound(2, Some(time(0)));
+
+        // thread 0 is limited by thread 1, and threads 1 and 2 by their own hosts (thread 2 can't
+        // receive packets from other threads)
+        assert_eq!(clocks.safe_window_end(0), Some(time(62)));
+        assert_eq!(clocks.safe_window_end(1), Some(time(51)));
+        assert_eq!(clocks.safe_window_end(2), Some(time(1)));
+    }
+
+    #[test]
+    fn test_pair_lookaheads_cross_thread_only() {
+        let clocks = ThreadClocks::new(2, 4, SimulationTime::from_nanos(1));
+        for (host, thread) in [(0, 0), (1, 0), (2, 1), (3, 1)] {
+            clocks.set_host_owner(HostId::from(host), thread);
+        }
+
+        // node 'a' is only used by thread 0, 'c' by thread 1, and 'b' by both
+        let host_nodes =
+            [(0, 'a'), (1, 'b'), (2, 'c'), (3, 'b')].map(|(h, n)| (HostId::from(h), n));
+        let calls = std::cell::RefCell::new(Vec::new());
+        clocks.set_pair_lookaheads(host_nodes, |src, dst| {
+            calls.borrow_mut().push((src, dst));
+            Some(SimulationTime::from_nanos(5))
+        });
+
+        let calls = calls.into_inner();
+        // each source node's calls are made together
+        let mut sources: Vec<char> = calls.iter().map(|(src, _)| *src).collect();
+        sources.dedup();
+        let mut sorted = sources.clone();
+        sorted.sort();
+        sorted.dedup();
+        assert_eq!(sources.len(), sorted.len());
+
+        // no paths between nodes that are only used by the same thread are looked up
+        assert!(!calls.contains(&('a', 'a')));
+        assert!(!calls.contains(&('c', 'c')));
+        assert!(calls.contains(&('a', 'c')));
+        assert!(calls.contains(&('b', 'b')));
+
+        assert_eq!(clocks.pair_lookahead(0, 0), SimulationTime::from_nanos(1));
+        assert_eq!(clocks.pair_lookahead(0, 1), SimulationTime::from_nanos(5));
+        assert_eq!(clocks.pair_lookahead(1, 0), SimulationTime::from_nanos(5));
+    }
+}
@@ -1,4 +1,9 @@
+use std::cmp::Reverse;
+use std::collections::{BinaryHeap, VecDeque};
 use std::fmt::Debug;
+use std::num::NonZeroU32;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Instant;
 
 use crossbeam::queue::ArrayQueue;
 
@@ -12,9 +17,71 @@ impl<T> Host for T where T: Debug + Send {}
 pub struct ThreadPerCoreSched<HostType: Host> {
     pool: UnboundedThreadPool,
     num_threads: usize,
-    thread_hosts: Vec<ArrayQueue<HostType>>,
-    thread_hosts_processed: Vec<ArrayQueue<HostType>>,
+    thread_hosts: Vec<ArrayQueue<HostEntry<HostType>>>,
+    thread_hosts_processed: Vec<ArrayQueue<HostEntry<HostType>>>,
     hosts_need_swap: bool,
+    /// For each thread, the order in which it takes hosts from the threads' queues. The first
+    /// entry is always the thread itself.
+    steal_order: Vec<Vec<usize>>,
+    /// The steal order when all threads are in the same class.
+    base_steal_order: Vec<Vec<usize>>,
+    /// If set, hosts are split into light and heavy classes when rebalancing.
+    classes: Option<HostClasses<HostType>>,
+    /// The number of threads (at the start of `thread_hosts`) that run the heavy hosts.
+    num_heavy_threads: usize,
+    /// For each thread, the number of hosts it has stolen from other threads.
+    migrations: Vec<AtomicU64>,
+    /// How many host rounds to run between reassigning hosts to threads based on their measured
+    /// costs. If `None`, hosts are never reassigned (but may still be stolen).
+    rebalance_interval: Option<NonZeroU32>,
+    /// The number of host rounds run since the last reassignment.
+    rounds_since_rebalance: u32,
+}
+
+/// How the hybrid scheduler splits hosts into classes. A host is heavy if it's running many
+/// threads, or if its measured cost is far above the average. Each heavy host is given a thread of
+/// its own (if there are enough threads), the light hosts share the remaining threads, and threads
+/// only steal hosts from threads of the same class. Thousands of cheap hosts then don't queue
+/// behind a few expensive ones, and expensive hosts aren't stolen by threads that still have many
+/// cheap hosts to run.
+pub struct HostClasses<HostType> {
+    /// Hosts with at least this many threads are heavy.
+    pub min_heavy_threads: usize,
+    /// Hosts whose average cost is at least this multiple of the mean host cost are heavy.
+    pub min_heavy_cost_factor: u64,
+    /// Returns the number of threads that a host is running.
+    pub num_threads: fn(&HostType) -> usize,
+}
+
+impl<HostType> HostClasses<HostType> {
+    fn is_heavy(&self, host: &HostType, cost: u64, mean_cost: u64) -> bool {
+        (self.num_threads)(host) >= self.min_heavy_threads
+            || (mean_cost > 0 && cost >= mean_cost.saturating_mul(self.min_heavy_cost_factor))
+    }
+}
+
+/// A host along with scheduler bookkeeping for that host.
+#[derive(Debug)]
+struct HostEntry<HostType> {
+    host: HostType,
+    /// An exponentially weighted moving average of the wall-clock time spent running this host
+    /// each round, in nanoseconds. Only updated when rebalancing is enabled.
+    avg_cost_ns: u64,
+}
+
+impl<HostType> HostEntry<HostType> {
+    fn new(host: HostType) -> Self {
+        Self {
+            host,
+            avg_cost_ns: 0,
+        }
+    }
+
+    fn update_cost(&mut self, sample: std::time::Duration) {
+        let sample = u64::try_from(sample.as_nanos()).unwrap_or(u64::MAX);
+        // weight of 1/8 for the new sample
+        self.avg_cost_ns = self.avg_cost_ns - self.avg_cost_ns / 8 + sample / 8;
+    }
 }
 
 impl<HostType: Host> ThreadPerCoreSched<HostType> {
@@ -22,6 +89,39 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
     /// is assigned many hosts, and threads may steal hosts from other threads. The number of
     /// threads created will be the length of `cpu_ids`.
     pub fn new<T>(cpu_ids: &[Option<u32>], hosts: T, yield_spin: bool) -> Self
+    where
+        T: IntoIterator<Item = HostType>,
+        <T as IntoIterator>::IntoIter: ExactSizeIterator,
+    {
+        let steal_order = round_robin_steal_order(cpu_ids.len());
+        Self::new_with_steal_order(cpu_ids, hosts, yield_spin, steal_order)
+    }
+
+    /// Like [`ThreadPerCoreSched::new`], but threads steal hosts from the threads running on the
+    /// nearest cores first. `distance` should return the topological distance between two OS
+    /// processors (for example the result of `affinity_getCPUDistance()`), or `None` if unknown.
+    /// If the threads aren't pinned to processors, this behaves the same as
+    /// [`ThreadPerCoreSched::new`].
+    pub fn new_with_locality<T>(
+        cpu_ids: &[Option<u32>],
+        hosts: T,
+        yield_spin: bool,
+        distance: impl Fn(u32, u32) -> Option<u32>,
+    ) -> Self
+    where
+        T: IntoIterator<Item = HostType>,
+        <T as IntoIterator>::IntoIter: ExactSizeIterator,
+    {
+        let steal_order = locality_steal_order(cpu_ids, distance);
+        Self::new_with_steal_order(cpu_ids, hosts, yield_spin, steal_order)
+    }
+
+    fn new_with_steal_order<T>(
+        cpu_ids: &[Option<u32>],
+        hosts: T,
+        yield_spin: bool,
+        steal_order: Vec<Vec<usize>>,
+    ) -> Self
     where
         T: IntoIterator<Item = HostType>,
         <T as IntoIterator>::IntoIter: ExactSizeIterator,
@@ -29,6 +129,7 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
         let hosts = hosts.into_iter();
 
         let num_threads = cpu_ids.len();
+        assert_eq!(steal_order.len(), num_threads);
         let mut pool = UnboundedThreadPool::new(num_threads, "shadow-worker", yield_spin);
 
         // set the affinity of each thread
@@ -57,7 +158,7 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
 
         // assign hosts to threads in a round-robin manner
         for (thread_queue, host) in thread_hosts.iter().cycle().zip(hosts) {
-            thread_queue.push(host).unwrap();
+            thread_queue.push(HostEntry::new(host)).unwrap();
         }
 
         Self {
@@ -66,7 +167,98 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
             thread_hosts,
             thread_hosts_processed: thread_hosts_2,
             hosts_need_swap: false,
+            steal_order: steal_order.clone(),
+            base_steal_order: steal_order,
+            classes: None,
+            num_heavy_threads: 0,
+            migrations: (0..num_threads).map(|_| AtomicU64::new(0)).collect(),
+            rebalance_interval: None,
+            rounds_since_rebalance: 0,
+        }
+    }
+
+    /// Measure the time spent running each host, and every `interval` host rounds reassign hosts
+    /// to threads so that each thread has a similar total cost. If `None`, hosts stay on the
+    /// threads that last ran them.
+    pub fn set_rebalance_interval(&mut self, interval: Option<NonZeroU32>) {
+        self.rebalance_interval = interval;
+        self.rounds_since_rebalance = 0;
+    }
+
+    /// Split hosts into light and heavy classes each time they're rebalanced (see
+    /// [`HostClasses`]). Only has an effect if a rebalance interval is set. If `None`, all hosts
+    /// and threads are in the same class.
+    pub fn set_host_classes(&mut self, classes: Option<HostClasses<HostType>>) {
+        self.classes = classes;
+    }
+
+    /// The number of threads that are running heavy hosts.
+    pub fn num_heavy_threads(&self) -> usize {
+        self.num_heavy_threads
+    }
+
+    /// Reassign all hosts to threads using a longest-processing-time-first assignment of the hosts'
+    /// average costs, within each host class. Must only be called between scopes, when all hosts
+    /// are in `thread_hosts`.
+    fn rebalance(&mut self) {
+        debug_assert!(self.thread_hosts_processed.iter().all(|q| q.is_empty()));
+
+        let mut entries: Vec<Option<HostEntry<HostType>>> = self
+            .thread_hosts
+            .iter()
+            .flat_map(|queue| std::iter::from_fn(move || queue.pop()))
+            .map(Some)
+            .collect();
+
+        let costs: Vec<u64> = entries
+            .iter()
+            .map(|x| x.as_ref().unwrap().avg_cost_ns)
+            .collect();
+
+        let heavy: Vec<bool> = match &self.classes {
+            Some(classes) => {
+                let mean_cost = costs.iter().sum::<u64>() / std::cmp::max(costs.len(), 1) as u64;
+                entries
+                    .iter()
+                    .zip(&costs)
+                    .map(|(entry, cost)| {
+                        classes.is_heavy(&entry.as_ref().unwrap().host, *cost, mean_cost)
+                    })
+                    .collect()
+            }
+            None => vec![false; entries.len()],
+        };
+
+        let (assignment, num_heavy_threads) = class_assignment(&costs, &heavy, self.num_threads);
+
+        if num_heavy_threads != self.num_heavy_threads {
+            log::debug!(
+                "Running {} heavy hosts on {num_heavy_threads} of {} threads",
+                heavy.iter().filter(|x| **x).count(),
+                self.num_threads,
+            );
+            self.num_heavy_threads = num_heavy_threads;
+            self.steal_order = class_steal_order(&self.base_steal_order, num_heavy_threads);
         }
+
+        // push in order of decreasing cost so that each thread runs its most expensive hosts
+        // first, leaving cheap hosts at the end of its queue for other threads to steal
+        let mut order: Vec<usize> = (0..entries.len()).collect();
+        order.sort_by_key(|&i| (Reverse(costs[i]), i));
+
+        for i in order {
+            let entry = entries[i].take().unwrap();
+            self.thread_hosts[assignment[i]].push(entry).unwrap();
+        }
+    }
+
+    /// The total number of times that a thread ran a host that was last run by a different
+    /// thread.
+    pub fn host_migrations(&self) -> u64 {
+        self.migrations
+            .iter()
+            .map(|x| x.load(Ordering::Relaxed))
+            .sum()
     }
 
     /// See [`crate::core::scheduler::Scheduler::parallelism`].
@@ -86,12 +278,23 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
 
             std::mem::swap(&mut self.thread_hosts, &mut self.thread_hosts_processed);
             self.hosts_need_swap = false;
+
+            if let Some(interval) = self.rebalance_interval {
+                self.rounds_since_rebalance += 1;
+                if self.rounds_since_rebalance >= interval.get() {
+                    self.rebalance();
+                    self.rounds_since_rebalance = 0;
+                }
+            }
         }
 
         // data/references that we'll pass to the scope
         let thread_hosts = &self.thread_hosts;
         let thread_hosts_processed = &self.thread_hosts_processed;
         let hosts_need_swap = &mut self.hosts_need_swap;
+        let steal_order = &self.steal_order;
+        let migrations = &self.migrations;
+        let measure_cost = self.rebalance_interval.is_some();
 
         // we cannot access `self` after calling `pool.scope()` since `SchedulerScope` has a
         // lifetime of `'scope` (which at minimum spans the entire current function)
@@ -101,6 +304,9 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
                 thread_hosts,
                 thread_hosts_processed,
                 hosts_need_swap,
+                steal_order,
+                migrations,
+                measure_cost,
                 runner: s,
             };
 
@@ -119,9 +325,12 @@ pub struct SchedulerScope<'sched, 'pool, 'scope, HostType: Host>
 where
     'sched: 'scope,
 {
-    thread_hosts: &'sched Vec<ArrayQueue<HostType>>,
-    thread_hosts_processed: &'sched Vec<ArrayQueue<HostType>>,
+    thread_hosts: &'sched Vec<ArrayQueue<HostEntry<HostType>>>,
+    thread_hosts_processed: &'sched Vec<ArrayQueue<HostEntry<HostType>>>,
     hosts_need_swap: &'sched mut bool,
+    steal_order: &'sched Vec<Vec<usize>>,
+    migrations: &'sched Vec<AtomicU64>,
+    measure_cost: bool,
     runner: TaskRunner<'pool, 'scope>,
 }
 
@@ -140,7 +349,9 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
             let mut host_iter = HostIter {
                 thread_hosts_from: self.thread_hosts,
                 thread_hosts_to: &self.thread_hosts_processed[i],
-                this_thread_index: i,
+                steal_order: &self.steal_order[i],
+                migrations: &self.migrations[i],
+                measure_cost: self.measure_cost,
             };
 
             f(i, &mut host_iter);
@@ -163,7 +374,9 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
             let mut host_iter = HostIter {
                 thread_hosts_from: self.thread_hosts,
                 thread_hosts_to: &self.thread_hosts_processed[i],
-                this_thread_index: i,
+                steal_order: &self.steal_order[i],
+                migrations: &self.migrations[i],
+                measure_cost: self.measure_cost,
             };
 
             f(i, &mut host_iter, this_elem);
@@ -177,12 +390,16 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
 /// the iterator may steal hosts from other threads.
 pub struct HostIter<'a, HostType: Host> {
     /// Queues to take hosts from.
-    thread_hosts_from: &'a [ArrayQueue<HostType>],
+    thread_hosts_from: &'a [ArrayQueue<HostEntry<HostType>>],
     /// The queue to add hosts to when done with them.
-    thread_hosts_to: &'a ArrayQueue<HostType>,
-    /// The index of this thread. This is the first queue of `thread_hosts_from` that we take hosts
-    /// from.
-    this_thread_index: usize,
+    thread_hosts_to: &'a ArrayQueue<HostEntry<HostType>>,
+    /// The order in which we take hosts from the queues of `thread_hosts_from`. The first index is
+    /// the index of this thread.
+    steal_order: &'a [usize],
+    /// The number of hosts this thread has taken from other threads' queues.
+    migrations: &'a AtomicU64,
+    /// Whether to measure the time spent running each host.
+    measure_cost: bool,
 }
 
 impl<'a, HostType: Host> HostIter<'a, HostType> {
@@ -191,19 +408,176 @@ impl<'a, HostType: Host> HostIter<'a, HostType> {
     where
         F: FnMut(HostType) -> HostType,
     {
-        for from_queue in self
-            .thread_hosts_from
-            .iter()
-            .cycle()
-            // start from the current thread index
-            .skip(self.this_thread_index)
-            .take(self.thread_hosts_from.len())
-        {
-            while let Some(host) = from_queue.pop() {
-                self.thread_hosts_to.push(f(host)).unwrap();
+        let mut stolen = 0;
+
+        for (i, from_index) in self.steal_order.iter().enumerate() {
+            let from_queue = &self.thread_hosts_from[*from_index];
+            while let Some(mut entry) = from_queue.pop() {
+                // the first queue is our own
+                if i != 0 {
+                    stolen += 1;
+                }
+
+                let start = self.measure_cost.then(Instant::now);
+                entry.host = f(entry.host);
+                if let Some(start) = start {
+                    entry.update_cost(start.elapsed());
+                }
+
+                self.thread_hosts_to.push(entry).unwrap();
             }
         }
+
+        if stolen > 0 {
+            self.migrations.fetch_add(stolen, Ordering::Relaxed);
+        }
     }
+
+    /// Calls `f` with all hosts assigned to this thread, without taking hosts from any other
+    /// threads. All hosts must still be in the `VecDeque` when `f` returns. Only this scheduler
+    /// keeps hosts assigned to threads, so this isn't part of
+    /// [`crate::core::scheduler::HostIter`].
+    pub fn with_own_hosts<F>(&mut self, f: F)
+    where
+        F: FnOnce(&mut VecDeque<HostType>),
+    {
+        // the first queue is our own
+        let own_queue = &self.thread_hosts_from[self.steal_order[0]];
+
+        let mut hosts: VecDeque<HostType> = std::iter::from_fn(|| own_queue.pop())
+            .map(|entry| entry.host)
+            .collect();
+        let num_hosts = hosts.len();
+
+        f(&mut hosts);
+
+        assert_eq!(hosts.len(), num_hosts, "Hosts were added or removed");
+        for host in hosts {
+            self.thread_hosts_to.push(HostEntry::new(host)).unwrap();
+        }
+    }
+}
+
+/// Assign items with the given costs to `num_bins` bins using the longest-processing-time-first
+/// heuristic: items are considered in order of decreasing cost, and each is put in the bin with the
+/// lowest total cost so far. Returns the bin index for each item. Ties are broken by index so the
+/// result is deterministic.
+pub(crate) fn lpt_assignment(costs: &[u64], num_bins: usize) -> Vec<usize> {
+    assert!(num_bins > 0);
+
+    let mut order: Vec<usize> = (0..costs.len()).collect();
+    order.sort_by_key(|&i| (Reverse(costs[i]), i));
+
+    // min-heap of (total cost, number of items, bin index), so that items with no measured cost
+    // are still spread across the bins
+    let mut bins: BinaryHeap<Reverse<(u64, usize, usize)>> =
+        (0..num_bins).map(|bin| Reverse((0, 0, bin))).collect();
+
+    let mut assignment = vec![0; costs.len()];
+    for i in order {
+        let Reverse((total, count, bin)) = bins.pop().unwrap();
+        assignment[i] = bin;
+        bins.push(Reverse((total.saturating_add(costs[i]), count + 1, bin)));
+    }
+
+    assignment
+}
+
+/// Assign items to `num_bins` bins like [`lpt_assignment`], but heavy items are only put in the
+/// first bins and light items only in the remaining bins. Each heavy item gets a bin of its own if
+/// there are enough bins, and one bin is always kept for the light items if there are any. Returns
+/// the bin index for each item and the number of bins used for heavy items.
+fn class_assignment(costs: &[u64], heavy: &[bool], num_bins: usize) -> (Vec<usize>, usize) {
+    assert!(num_bins > 0);
+    assert_eq!(costs.len(), heavy.len());
+
+    let num_heavy = heavy.iter().filter(|x| **x).count();
+    let num_light = heavy.len() - num_heavy;
+    let max_heavy_bins = if num_light > 0 {
+        num_bins - 1
+    } else {
+        num_bins
+    };
+    let num_heavy_bins = std::cmp::min(num_heavy, max_heavy_bins);
+
+    if num_heavy_bins == 0 {
+        return (lpt_assignment(costs, num_bins), 0);
+    }
+
+    let heavy_items: Vec<usize> = (0..costs.len()).filter(|&i| heavy[i]).collect();
+    let light_items: Vec<usize> = (0..costs.len()).filter(|&i| !heavy[i]).collect();
+    let cost_of = |items: &[usize]| items.iter().map(|&i| costs[i]).collect::<Vec<_>>();
+
+    let mut assignment = vec![0; costs.len()];
+    for (&i, bin) in heavy_items
+        .iter()
+        .zip(lpt_assignment(&cost_of(&heavy_items), num_heavy_bins))
+    {
+        assignment[i] = bin;
+    }
+    if num_light > 0 {
+        for (&i, bin) in light_items.iter().zip(lpt_assignment(
+            &cost_of(&light_items),
+            num_bins - num_heavy_bins,
+        )) {
+            assignment[i] = num_heavy_bins + bin;
+        }
+    }
+
+    (assignment, num_heavy_bins)
+}
+
+/// Restrict each thread's steal order to the threads of its own class, where the first
+/// `num_heavy_threads` threads are heavy. The relative order of the remaining threads is kept.
+fn class_steal_order(base: &[Vec<usize>], num_heavy_threads: usize) -> Vec<Vec<usize>> {
+    base.iter()
+        .enumerate()
+        .map(|(this_index, order)| {
+            let is_heavy = |i: usize| i < num_heavy_threads;
+            order
+                .iter()
+                .copied()
+                .filter(|&i| is_heavy(i) == is_heavy(this_index))
+                .collect()
+        })
+        .collect()
+}
+
+/// Each thread takes hosts from its own queue first, and then from the other threads' queues in
+/// round-robin order.
+fn round_robin_steal_order(num_threads: usize) -> Vec<Vec<usize>> {
+    (0..num_threads)
+        .map(|i| (0..num_threads).cycle().skip(i).take(num_threads).collect())
+        .collect()
+}
+
+/// Each thread takes hosts from its own queue first, and then from the other threads' queues in
+/// order of increasing distance between the threads' processors. Ties are broken in round-robin
+/// order so that threads at the same distance don't all pick the same victim.
+fn locality_steal_order(
+    cpu_ids: &[Option<u32>],
+    distance: impl Fn(u32, u32) -> Option<u32>,
+) -> Vec<Vec<usize>> {
+    let mut steal_order = round_robin_steal_order(cpu_ids.len());
+
+    for (this_index, order) in steal_order.iter_mut().enumerate() {
+        let Some(this_cpu) = cpu_ids[this_index] else {
+            continue;
+        };
+
+        // a stable sort, so the round-robin order is kept for equal distances; our own queue has
+        // the smallest possible key and stays first
+        order.sort_by_key(|&other_index| {
+            if other_index == this_index {
+                return (false, 0);
+            }
+            let dist = cpu_ids[other_index].and_then(|other_cpu| distance(this_cpu, other_cpu));
+            // unknown distances are sorted after all known distances
+            (dist.is_none(), dist.unwrap_or(0))
+        });
+    }
+
+    steal_order
 }
 
 #[cfg(any(test, doctest))]
@@ -320,4 +694,194 @@ mod tests {
 
         sched.join();
     }
+
+    #[test]
+    fn test_run_with_hosts_rebalance() {
+        let hosts = [(); 5].map(|_| TestHost {});
+        let mut sched: ThreadPerCoreSched<TestHost> =
+            ThreadPerCoreSched::new(&[None, None], hosts, false);
+        sched.set_rebalance_interval(Some(NonZeroU32::new(2).unwrap()));
+
+        let counter = AtomicU32::new(0);
+
+        for _ in 0..5 {
+            sched.scope(|s| {
+                s.run_with_hosts(|_, hosts| {
+                    hosts.for_each(|host| {
+                        counter.fetch_add(1, Ordering::SeqCst);
+                        host
+                    });
+                });
+            });
+        }
+
+        assert_eq!(counter.load(Ordering::SeqCst), 5 * 5);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_lpt_assignment() {
+        assert_eq!(lpt_assignment(&[], 2), Vec::<usize>::new());
+        assert_eq!(lpt_assignment(&[1, 1, 1], 1), vec![0, 0, 0]);
+        assert_eq!(lpt_assignment(&[0, 0, 0], 3), vec![0, 1, 2]);
+
+        // the two expensive items go to different bins, and the cheap items fill in around them
+        assert_eq!(lpt_assignment(&[1, 100, 1, 90, 5], 2), vec![1, 0, 1, 1, 1]);
+
+        let costs = [7, 3, 9, 2, 2, 8, 1, 6];
+        let assignment = lpt_assignment(&costs, 3);
+        let mut totals = [0; 3];
+        for (cost, bin) in costs.iter().zip(&assignment) {
+            totals[*bin] += cost;
+        }
+        // total cost is 38, so a perfect split is ~12.7
+        assert!(totals.iter().all(|x| (12..=14).contains(x)), "{totals:?}");
+    }
+
+    #[test]
+    fn test_class_assignment() {
+        // no heavy items is the same as an lpt assignment
+        assert_eq!(
+            class_assignment(&[1, 100, 1, 90, 5], &[false; 5], 2),
+            (lpt_assignment(&[1, 100, 1, 90, 5], 2), 0)
+        );
+
+        // each heavy item gets its own bin, and the light items share the rest
+        let (assignment, num_heavy_bins) = class_assignment(
+            &[1, 100, 1, 90, 5, 2],
+            &[false, true, false, true, false, false],
+            4,
+        );
+        assert_eq!(num_heavy_bins, 2);
+        assert_eq!(assignment[1] + assignment[3], 1);
+        for i in [0, 2, 4, 5] {
+            assert!((2..4).contains(&assignment[i]), "{assignment:?}");
+        }
+
+        // more heavy items than bins, but one bin is kept for the light item
+        let (assignment, num_heavy_bins) =
+            class_assignment(&[5, 5, 5, 1], &[true, true, true, false], 3);
+        assert_eq!(num_heavy_bins, 2);
+        assert_eq!(assignment[3], 2);
+
+        // no light items, so all bins are used for heavy items
+        let (assignment, num_heavy_bins) = class_assignment(&[5, 5], &[true, true], 3);
+        assert_eq!(num_heavy_bins, 2);
+        assert_ne!(assignment[0], assignment[1]);
+
+        // a single bin can't be split
+        assert_eq!(
+            class_assignment(&[5, 1], &[true, false], 1),
+            (vec![0, 0], 0)
+        );
+    }
+
+    #[test]
+    fn test_class_steal_order() {
+        let base = round_robin_steal_order(4);
+        assert_eq!(
+            class_steal_order(&base, 1),
+            vec![vec![0], vec![1, 2, 3], vec![2, 3, 1], vec![3, 1, 2]]
+        );
+        assert_eq!(class_steal_order(&base, 0), base);
+    }
+
+    #[test]
+    fn test_run_with_hosts_classes() {
+        #[derive(Debug)]
+        struct ThreadedHost {
+            threads: usize,
+        }
+
+        let hosts = [1, 1, 8, 1, 1].map(|threads| ThreadedHost { threads });
+        let mut sched: ThreadPerCoreSched<ThreadedHost> =
+            ThreadPerCoreSched::new(&[None, None, None], hosts, false);
+        sched.set_rebalance_interval(Some(NonZeroU32::new(1).unwrap()));
+        sched.set_host_classes(Some(HostClasses {
+            min_heavy_threads: 4,
+            min_heavy_cost_factor: u64::MAX,
+            num_threads: |host| host.threads,
+        }));
+
+        let heavy_thread = std::sync::Mutex::new(Vec::new());
+
+        for _ in 0..4 {
+            sched.scope(|s| {
+                s.run_with_hosts(|i, hosts| {
+                    hosts.for_each(|host| {
+                        if host.threads > 1 {
+                            heavy_thread.lock().unwrap().push(i);
+                        }
+                        host
+                    });
+                });
+            });
+        }
+
+        assert_eq!(sched.num_heavy_threads(), 1);
+        // after the first rebalance, the heavy host always runs on the first thread
+        assert!(heavy_thread.lock().unwrap()[1..].iter().all(|x| *x == 0));
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_round_robin_steal_order() {
+        assert_eq!(
+            round_robin_steal_order(3),
+            vec![vec![0, 1, 2], vec![1, 2, 0], vec![2, 0, 1]]
+        );
+    }
+
+    #[test]
+    fn test_locality_steal_order() {
+        // cpus 0 and 1 are on one node, cpus 2 and 3 are on another
+        let distance = |a: u32, b: u32| Some(if a / 2 == b / 2 { 1 } else { 4 });
+        let cpus = [Some(0), Some(2), Some(1), Some(3)];
+
+        assert_eq!(
+            locality_steal_order(&cpus, distance),
+            vec![
+                vec![0, 2, 1, 3],
+                vec![1, 3, 2, 0],
+                vec![2, 0, 3, 1],
+                vec![3, 1, 0, 2],
+            ]
+        );
+
+        // not pinned, so fall back to round-robin
+        assert_eq!(
+            locality_steal_order(&[None, None, None], distance),
+            round_robin_steal_order(3)
+        );
+    }
+
+    #[test]
+    fn test_run_with_hosts_locality() {
+        let hosts = [(); 5].map(|_| TestHost {});
+        let mut sched: ThreadPerCoreSched<TestHost> =
+            ThreadPerCoreSched::new_with_locality(&[None, None], hosts, false, |a, b| {
+                Some(a.abs_diff(b))
+            });
+
+        let counter = AtomicU32::new(0);
+
+        for _ in 0..3 {
+            sched.scope(|s| {
+                s.run_with_hosts(|_, hosts| {
+                    hosts.for_each(|host| {
+                        counter.fetch_add(1, Ordering::SeqCst);
+                        host
+                    });
+                });
+            });
+        }
+
+        assert_eq!(counter.load(Ordering::SeqCst), 5 * 3);
+        // can never migrate more hosts than were run
+        assert!(sched.host_migrations() <= 5 * 3);
+
+        sched.join();
+    }
 }
@@ -1,8 +1,12 @@
 use std::cell::RefCell;
+use std::num::NonZeroU32;
+use std::sync::atomic::{AtomicU64, Ordering};
 use std::sync::Mutex;
+use std::time::{Duration, Instant};
 
 use super::CORE_AFFINITY;
 use crate::core::scheduler::pools::bounded::{ParallelismBoundedThreadPool, TaskRunner};
+use crate::core::scheduler::thread_per_core::lpt_assignment;
 use crate::host::host::Host;
 
 std::thread_local! {
@@ -13,6 +17,20 @@ std::thread_local! {
 /// A host scheduler.
 pub struct ThreadPerHostSched {
     pool: ParallelismBoundedThreadPool,
+    /// Adjusts the number of active logical processors, if enabled.
+    elastic: Option<ElasticParallelism>,
+    /// The total time that the threads spent running tasks during the current scope, if `elastic`
+    /// is enabled.
+    busy_ns: AtomicU64,
+    /// The number of active logical processors to use starting with the next scope.
+    next_active: Option<usize>,
+    /// The number of scopes between reassignments of threads to logical processors, if enabled.
+    rebalance_interval: Option<NonZeroU32>,
+    /// The number of scopes since the threads were last reassigned.
+    scopes_since_rebalance: u32,
+    /// The moving average of the time that each thread spent running its host in a scope, if
+    /// `rebalance_interval` is set.
+    thread_costs_ns: Vec<AtomicU64>,
 }
 
 impl ThreadPerHostSched {
@@ -41,7 +59,48 @@ impl ThreadPerHostSched {
             });
         });
 
-        Self { pool }
+        let thread_costs_ns = (0..pool.num_threads()).map(|_| AtomicU64::new(0)).collect();
+
+        Self {
+            pool,
+            elastic: None,
+            busy_ns: AtomicU64::new(0),
+            next_active: None,
+            rebalance_interval: None,
+            scopes_since_rebalance: 0,
+            thread_costs_ns,
+        }
+    }
+
+    /// Measure how much of each scope the logical processors spend running tasks, and change the
+    /// number of active logical processors so that processors aren't woken up and synchronized
+    /// when there isn't enough work for them (see [`ElasticParallelism`]). If false, all logical
+    /// processors are used.
+    pub fn set_elastic_parallelism(&mut self, enabled: bool) {
+        self.elastic = enabled.then(|| ElasticParallelism::new(self.pool.num_processors()));
+        self.next_active = None;
+        self.pool.set_active_processors(self.pool.num_processors());
+    }
+
+    /// Measure how long each thread spends running its host, and every `interval` scopes reassign
+    /// the threads to the active logical processors using the longest-processing-time-first
+    /// heuristic, so that each processor has a similar amount of work. Each processor then runs
+    /// its most expensive threads first, and a processor that runs out of threads still steals
+    /// from the others. If `None`, threads only move between processors when they're stolen.
+    pub fn set_rebalance_interval(&mut self, interval: Option<NonZeroU32>) {
+        self.rebalance_interval = interval;
+        self.scopes_since_rebalance = 0;
+    }
+
+    /// Reassign the threads to the active logical processors based on their measured costs.
+    fn rebalance(&mut self) {
+        let costs: Vec<u64> = self
+            .thread_costs_ns
+            .iter()
+            .map(|x| x.load(Ordering::Relaxed))
+            .collect();
+        let assignment = lpt_assignment(&costs, self.pool.num_active_processors());
+        self.pool.reassign_threads(&assignment, &costs);
     }
 
     /// See [`crate::core::scheduler::Scheduler::parallelism`].
@@ -54,11 +113,46 @@ impl ThreadPerHostSched {
         &'scope mut self,
         f: impl for<'a> FnOnce(SchedulerScope<'a, 'scope>) + 'scope,
     ) {
+        // the pool stays borrowed until the end of 'scope, so a change chosen at the end of the
+        // previous scope is applied here
+        if let Some(n) = self.next_active.take() {
+            log::debug!("Changing the number of active logical processors to {n}");
+            self.pool.set_active_processors(n);
+        }
+
+        if let Some(interval) = self.rebalance_interval {
+            self.scopes_since_rebalance += 1;
+            if self.scopes_since_rebalance >= interval.get() {
+                self.scopes_since_rebalance = 0;
+                self.rebalance();
+            }
+        }
+
+        let num_active = self.pool.num_active_processors();
+        let busy_ns = self.elastic.is_some().then_some(&self.busy_ns);
+        let thread_costs_ns = self
+            .rebalance_interval
+            .is_some()
+            .then_some(&self.thread_costs_ns[..]);
+        let start = Instant::now();
+
         self.pool.scope(move |s| {
-            let sched_scope = SchedulerScope { runner: s };
+            let sched_scope = SchedulerScope {
+                runner: s,
+                busy_ns,
+                thread_costs_ns,
+            };
 
             (f)(sched_scope);
         });
+
+        if let Some(elastic) = &mut self.elastic {
+            let busy = Duration::from_nanos(self.busy_ns.swap(0, Ordering::Relaxed));
+            // scopes that didn't run a task don't say anything about the amount of work
+            if !busy.is_zero() {
+                self.next_active = elastic.update(busy, start.elapsed(), num_active);
+            }
+        }
     }
 
     /// See [`crate::core::scheduler::Scheduler::join`].
@@ -84,23 +178,30 @@ impl ThreadPerHostSched {
 /// A wrapper around the work pool's scoped runner.
 pub struct SchedulerScope<'pool, 'scope> {
     runner: TaskRunner<'pool, 'scope>,
+    /// If set, the time spent running each task is added to this.
+    busy_ns: Option<&'scope AtomicU64>,
+    /// If set, the time that each thread spends running its host is added to its moving average.
+    thread_costs_ns: Option<&'scope [AtomicU64]>,
 }
 
 impl<'pool, 'scope> SchedulerScope<'pool, 'scope> {
     /// See [`crate::core::scheduler::SchedulerScope::run`].
     pub fn run(self, f: impl Fn(usize) + Sync + Send + 'scope) {
+        let busy_ns = self.busy_ns;
         self.runner.run(move |task_context| {
             // update the thread-local core affinity
             if let Some(cpu_id) = task_context.cpu_id {
                 CORE_AFFINITY.with(|x| *x.borrow_mut() = Some(cpu_id));
             }
 
-            (f)(task_context.thread_idx)
+            measure_busy(busy_ns, None, || (f)(task_context.thread_idx))
         });
     }
 
     /// See [`crate::core::scheduler::SchedulerScope::run_with_hosts`].
     pub fn run_with_hosts(self, f: impl Fn(usize, &mut HostIter) + Send + Sync + 'scope) {
+        let busy_ns = self.busy_ns;
+        let thread_costs_ns = self.thread_costs_ns;
         self.runner.run(move |task_context| {
             // update the thread-local core affinity
             if let Some(cpu_id) = task_context.cpu_id {
@@ -112,7 +213,10 @@ impl<'pool, 'scope> SchedulerScope<'pool, 'scope> {
 
                 let mut host_iter = HostIter { host: host.take() };
 
-                f(task_context.thread_idx, &mut host_iter);
+                let cost_ns = thread_costs_ns.map(|x| &x[task_context.thread_idx]);
+                measure_busy(busy_ns, cost_ns, || {
+                    f(task_context.thread_idx, &mut host_iter)
+                });
 
                 host.replace(host_iter.host.take().unwrap());
             });
@@ -127,6 +231,8 @@ impl<'pool, 'scope> SchedulerScope<'pool, 'scope> {
     ) where
         T: Sync,
     {
+        let busy_ns = self.busy_ns;
+        let thread_costs_ns = self.thread_costs_ns;
         self.runner.run(move |task_context| {
             // update the thread-local core affinity
             if let Some(cpu_id) = task_context.cpu_id {
@@ -140,7 +246,10 @@ impl<'pool, 'scope> SchedulerScope<'pool, 'scope> {
 
                 let mut host_iter = HostIter { host: host.take() };
 
-                f(task_context.thread_idx, &mut host_iter, this_elem);
+                let cost_ns = thread_costs_ns.map(|x| &x[task_context.thread_idx]);
+                measure_busy(busy_ns, cost_ns, || {
+                    f(task_context.thread_idx, &mut host_iter, this_elem)
+                });
 
                 host.replace(host_iter.host.unwrap());
             });
@@ -148,6 +257,97 @@ impl<'pool, 'scope> SchedulerScope<'pool, 'scope> {
     }
 }
 
+/// Run `f`, and add the time that it took to `busy_ns` if set, and to the moving average `cost_ns`
+/// if set.
+fn measure_busy(busy_ns: Option<&AtomicU64>, cost_ns: Option<&AtomicU64>, f: impl FnOnce()) {
+    if busy_ns.is_none() && cost_ns.is_none() {
+        return f();
+    }
+
+    let start = Instant::now();
+    f();
+    let elapsed = u64::try_from(start.elapsed().as_nanos()).unwrap_or(u64::MAX);
+
+    if let Some(busy_ns) = busy_ns {
+        busy_ns.fetch_add(elapsed, Ordering::Relaxed);
+    }
+    if let Some(cost_ns) = cost_ns {
+        // only this thread updates its own cost, so a load and store is enough
+        let avg = cost_ns.load(Ordering::Relaxed);
+        cost_ns.store(avg - avg / 8 + elapsed / 8, Ordering::Relaxed);
+    }
+}
+
+/// Chooses the number of active logical processors from how busy they were in recent scopes.
+///
+/// Over each window of [`ElasticParallelism::WINDOW`] scopes, the achieved parallelism is the
+/// total time spent running tasks divided by the total wall time of the scopes. If the active
+/// processors were busy for less than [`ElasticParallelism::LOW`] of the time (for example because
+/// the rounds are too short for the time spent waking up and synchronizing the processors), the
+/// number of processors is reduced. If they were busy for more than
+/// [`ElasticParallelism::HIGH`] of the time, more processors are used. The new number of
+/// processors is the achieved parallelism divided by [`ElasticParallelism::TARGET`].
+#[derive(Debug)]
+pub struct ElasticParallelism {
+    max_processors: usize,
+    scopes: u32,
+    busy: Duration,
+    wall: Duration,
+}
+
+impl ElasticParallelism {
+    const WINDOW: u32 = 16;
+    const LOW: f64 = 0.4;
+    const HIGH: f64 = 0.8;
+    const TARGET: f64 = 0.6;
+
+    pub fn new(max_processors: usize) -> Self {
+        assert!(max_processors > 0);
+        Self {
+            max_processors,
+            scopes: 0,
+            busy: Duration::ZERO,
+            wall: Duration::ZERO,
+        }
+    }
+
+    /// Record a scope that took `wall` time, where the `num_active` active processors spent a
+    /// total of `busy` running tasks. Returns the new number of active processors if it should
+    /// change.
+    pub fn update(&mut self, busy: Duration, wall: Duration, num_active: usize) -> Option<usize> {
+        self.scopes += 1;
+        self.busy += busy;
+        self.wall += wall;
+
+        if self.scopes < Self::WINDOW {
+            return None;
+        }
+
+        let busy = std::mem::take(&mut self.busy).as_secs_f64();
+        let wall = std::mem::take(&mut self.wall).as_secs_f64();
+        self.scopes = 0;
+
+        if wall <= 0.0 {
+            return None;
+        }
+
+        let achieved = busy / wall;
+        let efficiency = achieved / num_active as f64;
+
+        let new = if efficiency < Self::LOW {
+            (achieved / Self::TARGET).ceil() as usize
+        } else if efficiency > Self::HIGH {
+            // grow by at least one processor
+            std::cmp::max((achieved / Self::TARGET).ceil() as usize, num_active + 1)
+        } else {
+            num_active
+        };
+        let new = new.clamp(1, self.max_processors);
+
+        (new != num_active).then_some(new)
+    }
+}
+
 /// Supports iterating over all hosts assigned to this thread. For this thread-per-host scheduler,
 /// there will only ever be one host per thread.
 pub struct HostIter {
@@ -164,3 +364,47 @@ impl HostIter {
         self.host.replace(f(host));
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Run `n` scopes with the same timings.
+    fn update_n(
+        elastic: &mut ElasticParallelism,
+        n: u32,
+        busy_ms: u64,
+        wall_ms: u64,
+        num_active: usize,
+    ) -> Option<usize> {
+        let busy = Duration::from_millis(busy_ms);
+        let wall = Duration::from_millis(wall_ms);
+        let mut rv = None;
+        for _ in 0..n {
+            rv = elastic.update(busy, wall, num_active);
+        }
+        rv
+    }
+
+    #[test]
+    fn test_elastic_parallelism() {
+        let mut elastic = ElasticParallelism::new(8);
+        let window = ElasticParallelism::WINDOW;
+
+        // nothing changes until the end of the window
+        assert_eq!(update_n(&mut elastic, window - 1, 10, 10, 8), None);
+        // 8 processors with a parallelism of 1.2 (15% efficiency)
+        assert_eq!(update_n(&mut elastic, 1, 12, 10, 8), Some(2));
+
+        // 2 processors with 70% efficiency
+        assert_eq!(update_n(&mut elastic, window, 14, 10, 2), None);
+
+        // 2 processors with 95% efficiency
+        assert_eq!(update_n(&mut elastic, window, 19, 10, 2), Some(4));
+
+        // can't grow past the maximum
+        assert_eq!(update_n(&mut elastic, window, 80, 10, 8), None);
+        // or shrink below 1
+        assert_eq!(update_n(&mut elastic, window, 0, 10, 1), None);
+    }
+}
@@ -2,9 +2,10 @@ use std::collections::hash_map::Entry;
 use std::collections::{BTreeMap, HashMap, HashSet};
 use std::ffi::{OsStr, OsString};
 use std::hash::{Hash, Hasher};
+use std::num::{NonZeroU32, NonZeroU64};
 use std::os::unix::fs::MetadataExt;
 use std::path::PathBuf;
-use std::sync::RwLock;
+use std::sync::{Arc, RwLock};
 use std::time::Duration;
 
 use anyhow::Context;
@@ -15,11 +16,18 @@ use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
 use crate::core::support::configuration::Flatten;
 use crate::core::support::configuration::{
-    parse_string_as_args, ConfigOptions, EnvName, HostOptions, LogInfoFlag, LogLevel, ProcessArgs,
-    ProcessOptions, QDiscMode,
+    parse_string_as_args, ConfigOptions, EnvName, HostOptions, LogInfoFlag, LogLevel,
+    NetworkChange, NetworkScheduleSource, ProcessArgs, ProcessOptions, QDiscMode,
+    TcpCongestionControl, TrafficModel, TrafficOptions,
 };
 use crate::core::support::units::{self, Unit};
-use crate::network::graph::{load_network_graph, IpAssignment, NetworkGraph, RoutingInfo};
+use crate::host::disk::DiskParameters;
+use crate::network::graph::routing_cache::{self, RoutingCache};
+use crate::network::graph::{
+    open_file_source, IpAssignment, NetworkGraph, PathProperties, RoutingInfo,
+};
+use crate::network::schedule::{BandwidthChange, PathChange, PathSchedule};
+use crate::utility::pcap_writer::PcapFilter;
 use crate::utility::tilde_expansion;
 
 use super::support::configuration::ProcessFinalState;
@@ -40,6 +48,9 @@ pub struct SimConfig {
 
     // a list of hosts and their processes
     pub hosts: Vec<HostInfo>,
+
+    // changes to the paths between graph nodes at given times
+    pub path_schedule: PathSchedule,
 }
 
 impl SimConfig {
@@ -55,7 +66,7 @@ impl SimConfig {
         // build the host list
         let mut hosts = vec![];
         for (name, host_options) in &config.hosts {
-            let new_host = build_host(
+            let new_hosts = build_hosts(
                 config,
                 host_options,
                 name,
@@ -63,7 +74,17 @@ impl SimConfig {
                 hosts_to_debug,
             )
             .with_context(|| format!("Failed to configure host '{name}'"))?;
-            hosts.push(new_host);
+            hosts.extend(new_hosts);
+        }
+
+        // sort the hosts by their hostname as if each host of a host entry with a `quantity` had
+        // been listed separately
+        hosts.sort_unstable_by(|a, b| a.name.cmp(&b.name));
+        if let Some(x) = hosts.windows(2).find(|x| x[0].name == x[1].name) {
+            return Err(anyhow::anyhow!(
+                "The hostname '{}' is used by more than one host",
+                x[0].name
+            ));
         }
         if hosts.is_empty() {
             return Err(anyhow::anyhow!(
@@ -72,12 +93,16 @@ impl SimConfig {
         }
 
         // load and parse the network graph
-        let graph: String = load_network_graph(config.network.graph.as_ref().unwrap())
-            .map_err(|e| anyhow::anyhow!(e))
-            .context("Failed to load the network graph")?;
-        let graph = NetworkGraph::parse(&graph)
-            .map_err(|e| anyhow::anyhow!(e))
-            .context("Failed to parse the network graph")?;
+        let (graph, graph_hash) =
+            routing_cache::parse_and_hash_graph(config.network.graph.as_ref().unwrap())?;
+
+        let routing_cache = match config.experimental.routing_cache.flatten_ref() {
+            Some(path) if config.network.use_shortest_path.unwrap() => Some(
+                RoutingCache::open(tilde_expansion(path), graph_hash)
+                    .with_context(|| format!("Failed to load the routing cache {path}"))?,
+            ),
+            _ => None,
+        };
 
         // check that each node ID is valid
         for host in &hosts {
@@ -132,11 +157,30 @@ impl SimConfig {
         // assign IP addresses to hosts and graph nodes
         let ip_assignment = assign_ips(&mut hosts)?;
 
+        let latency_quantum_ns = config
+            .experimental
+            .latency_quantum
+            .flatten()
+            // a quantum of 0 doesn't change the latencies
+            .and_then(|x| NonZeroU64::new(Duration::from(x).as_nanos().try_into().unwrap()));
+
+        // load the scheduled network changes while we still have the graph to check them against
+        let edge_changes = match &config.network.schedule {
+            Some(source) => {
+                load_network_schedule(source, config, &mut hosts, &graph, latency_quantum_ns)
+                    .context("Failed to load the network schedule")?
+            }
+            None => Vec::new(),
+        };
+
         // generate routing info between every pair of in-use nodes
         let routing_info = generate_routing_info(
-            &graph,
+            graph,
             &ip_assignment.get_nodes(),
             config.network.use_shortest_path.unwrap(),
+            config.experimental.shortest_path_cache_size.flatten(),
+            routing_cache.as_ref(),
+            latency_quantum_ns,
         )?;
 
         // get all host bandwidths
@@ -153,12 +197,15 @@ impl SimConfig {
             })
             .collect();
 
+        let path_schedule = build_path_schedule(&edge_changes, &routing_info);
+
         Ok(Self {
             random,
             ip_assignment,
             routing_info,
             host_bandwidths,
             hosts,
+            path_schedule,
         })
     }
 }
@@ -166,7 +213,10 @@ impl SimConfig {
 #[derive(Clone)]
 pub struct HostInfo {
     pub name: String,
-    pub processes: Vec<ProcessInfo>,
+    // shared by all hosts of the same host entry
+    pub processes: Arc<[ProcessInfo]>,
+    // shared by all hosts of the same host entry
+    pub traffic: Arc<[TrafficInfo]>,
     pub seed: u64,
     pub network_node_id: u32,
     pub pause_for_debugging: bool,
@@ -185,6 +235,9 @@ pub struct HostInfo {
     pub autotune_send_buf: bool,
     pub autotune_recv_buf: bool,
     pub qdisc: QDiscMode,
+    pub tcp_congestion_control: TcpCongestionControl,
+    pub disk: DiskParameters,
+    pub bandwidth_changes: Vec<BandwidthChange>,
 }
 
 #[derive(Clone)]
@@ -198,27 +251,118 @@ pub struct ProcessInfo {
     pub expected_final_state: ProcessFinalState,
 }
 
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct TrafficInfo {
+    pub model: TrafficModel,
+    pub peer_host: String,
+    pub peer_port: u16,
+    pub rate_bits: u64,
+    pub packet_size: usize,
+    pub start_time: SimulationTime,
+    pub stop_time: Option<SimulationTime>,
+}
+
 #[derive(Debug, Clone)]
 pub struct Bandwidth {
     pub up_bytes: u64,
     pub down_bytes: u64,
 }
 
-#[derive(Debug, Clone, Copy)]
+#[derive(Debug, Clone)]
 pub struct PcapConfig {
     pub capture_size: u64,
+    pub filter: PcapFilter,
 }
 
-/// For a host entry in the configuration options, build `HostInfo` object.
-fn build_host(
+/// For a host entry in the configuration options, build a `HostInfo` object for each of the hosts
+/// that it describes. The hosts share a single copy of the entry's processes and traffic models.
+fn build_hosts(
     config: &ConfigOptions,
     host: &HostOptions,
-    hostname: &str,
+    name: &str,
     randomness_for_seed_calc: u64,
     hosts_to_debug: &HashSet<String>,
-) -> anyhow::Result<HostInfo> {
-    let hostname = hostname.to_string();
+) -> anyhow::Result<Vec<HostInfo>> {
+    let processes: Vec<_> = host
+        .processes
+        .iter()
+        .map(|proc| {
+            build_process(proc, config)
+                .with_context(|| format!("Failed to configure process '{}'", proc.path.display()))
+        })
+        .collect::<anyhow::Result<_>>()?;
+    let processes: Arc<[ProcessInfo]> = processes.into();
+
+    let traffic: Vec<_> = host
+        .traffic
+        .iter()
+        .map(|traffic| {
+            build_traffic(traffic, config)
+                .with_context(|| format!("Failed to configure traffic to '{}'", traffic.peer))
+        })
+        .collect::<anyhow::Result<_>>()?;
+    let traffic: Arc<[TrafficInfo]> = traffic.into();
+
+    let cache_hit_rate = host.host_options.file_io_cache_hit_rate.unwrap();
+    if !(0.0..=1.0).contains(&cache_hit_rate) {
+        return Err(anyhow::anyhow!(
+            "The file I/O cache hit rate must be between 0 and 1, not {cache_hit_rate}"
+        ));
+    }
 
+    let Some(quantity) = host.quantity else {
+        return Ok(vec![build_host(
+            config,
+            host,
+            name.to_string(),
+            processes,
+            traffic,
+            randomness_for_seed_calc,
+            hosts_to_debug,
+        )]);
+    };
+
+    if host.ip_addr.is_some() {
+        return Err(anyhow::anyhow!(
+            "An IP address can't be set for a host entry with a quantity"
+        ));
+    }
+
+    (1..=quantity.get())
+        .map(|i| {
+            let hostname = format!("{name}{i}");
+
+            // hostname(7): "the entire hostname, including the dots, can be at most 253
+            // characters long"
+            if hostname.len() > 253 {
+                return Err(anyhow::anyhow!(
+                    "The hostname '{hostname}' exceeds 253 characters"
+                ));
+            }
+
+            Ok(build_host(
+                config,
+                host,
+                hostname,
+                Arc::clone(&processes),
+                Arc::clone(&traffic),
+                randomness_for_seed_calc,
+                hosts_to_debug,
+            ))
+        })
+        .collect()
+}
+
+/// For a host in the configuration options, build a `HostInfo` object.
+fn build_host(
+    config: &ConfigOptions,
+    host: &HostOptions,
+    hostname: String,
+    processes: Arc<[ProcessInfo]>,
+    traffic: Arc<[TrafficInfo]>,
+    randomness_for_seed_calc: u64,
+    hosts_to_debug: &HashSet<String>,
+) -> HostInfo {
     // hostname hash is used as part of the host's seed
     let hostname_hash = {
         let mut hasher = std::collections::hash_map::DefaultHasher::new();
@@ -228,24 +372,21 @@ fn build_host(
 
     let pause_for_debugging = hosts_to_debug.contains(&hostname);
 
-    let processes: Vec<_> = host
-        .processes
-        .iter()
-        .map(|proc| {
-            build_process(proc, config)
-                .with_context(|| format!("Failed to configure process '{}'", proc.path.display()))
-        })
-        .collect::<anyhow::Result<_>>()?;
-
-    Ok(HostInfo {
+    HostInfo {
         name: hostname,
         processes,
+        traffic,
 
         seed: randomness_for_seed_calc ^ hostname_hash,
         network_node_id: host.network_node_id,
         pause_for_debugging,
 
-        cpu_threshold: None,
+        // the cpu model only applies delays when native execution is measured
+        cpu_threshold: config
+            .experimental
+            .cpu_instruction_rate
+            .flatten()
+            .map(|_| config.max_unapplied_cpu_latency()),
         cpu_precision: Some(SimulationTime::from_nanos(200)),
 
         bandwidth_down_bits: host
@@ -269,7 +410,28 @@ fn build_host(
                     .convert(units::SiPrefixUpper::Base)
                     .unwrap()
                     .value(),
+                filter: PcapFilter {
+                    sample_interval: host.host_options.pcap_sample_interval.unwrap(),
+                    control_only: host.host_options.pcap_control_only.unwrap(),
+                    ports: host.host_options.pcap_ports.clone().unwrap(),
+                },
             }),
+        tcp_congestion_control: host.host_options.tcp_congestion_control.unwrap(),
+        disk: DiskParameters {
+            latency: Duration::from(host.host_options.file_io_latency.unwrap())
+                .try_into()
+                .unwrap(),
+            latency_model: host.host_options.file_io_latency_model.unwrap(),
+            bandwidth_bits: host
+                .host_options
+                .file_io_bandwidth
+                .flatten()
+                .map(|x| x.convert(units::SiPrefixUpper::Base).unwrap().value()),
+            iops: host.host_options.file_io_iops.flatten(),
+            cache_hit_rate: host.host_options.file_io_cache_hit_rate.unwrap(),
+        },
+        // added from the network schedule once all hosts have been built
+        bandwidth_changes: Vec::new(),
 
         // some options come from the config options and not the host options
         heartbeat_log_level: config.experimental.host_heartbeat_log_level,
@@ -300,6 +462,249 @@ fn build_host(
         autotune_send_buf: config.experimental.socket_send_autotune.unwrap(),
         autotune_recv_buf: config.experimental.socket_recv_autotune.unwrap(),
         qdisc: config.experimental.interface_qdisc.unwrap(),
+    }
+}
+
+/// A scheduled change to a graph edge, by the gml ids of its nodes.
+struct EdgeChange {
+    time: SimulationTime,
+    source: u32,
+    target: u32,
+    latency_ns: Option<u64>,
+    packet_loss: Option<f32>,
+}
+
+/// Read the network schedule, add its bandwidth changes to the hosts, and return its edge changes
+/// (in both directions if the graph is undirected).
+fn load_network_schedule(
+    source: &NetworkScheduleSource,
+    config: &ConfigOptions,
+    hosts: &mut [HostInfo],
+    graph: &NetworkGraph,
+    latency_quantum_ns: Option<NonZeroU64>,
+) -> anyhow::Result<Vec<EdgeChange>> {
+    let changes: Vec<NetworkChange> = match source {
+        NetworkScheduleSource::Inline(x) => x.clone(),
+        NetworkScheduleSource::File(file) => {
+            let reader = open_file_source(file)
+                .map_err(|e| anyhow::anyhow!(e))
+                .with_context(|| format!("Failed to open '{}'", file.path))?;
+            serde_yaml::from_reader(std::io::BufReader::new(reader))
+                .with_context(|| format!("Failed to parse '{}'", file.path))?
+        }
+    };
+
+    let mut edge_changes = Vec::new();
+    for (i, change) in changes.iter().enumerate() {
+        add_network_change(
+            change,
+            config,
+            hosts,
+            graph,
+            latency_quantum_ns,
+            &mut edge_changes,
+        )
+        .with_context(|| format!("Invalid change {i} at time '{}'", change.time))?;
+    }
+
+    Ok(edge_changes)
+}
+
+fn add_network_change(
+    change: &NetworkChange,
+    config: &ConfigOptions,
+    hosts: &mut [HostInfo],
+    graph: &NetworkGraph,
+    latency_quantum_ns: Option<NonZeroU64>,
+    edge_changes: &mut Vec<EdgeChange>,
+) -> anyhow::Result<()> {
+    let time: SimulationTime = Duration::from(change.time).try_into().unwrap();
+    let bits = |x: Option<units::BitsPerSec<units::SiPrefixUpper>>| {
+        x.map(|x| x.convert(units::SiPrefixUpper::Base).unwrap().value())
+    };
+    let down_bits = bits(change.bandwidth_down);
+    let up_bits = bits(change.bandwidth_up);
+
+    match (&change.host, change.edge) {
+        (Some(name), None) => {
+            if change.latency.is_some() || change.packet_loss.is_some() {
+                anyhow::bail!("A host's change can only set 'bandwidth_down' and 'bandwidth_up'");
+            }
+            if down_bits.is_none() && up_bits.is_none() {
+                anyhow::bail!("A host's change must set 'bandwidth_down' or 'bandwidth_up'");
+            }
+            let host = hosts
+                .iter_mut()
+                .find(|x| &x.name == name)
+                .with_context(|| format!("The host '{name}' doesn't exist"))?;
+            host.bandwidth_changes.push(BandwidthChange {
+                time,
+                up_bits,
+                down_bits,
+            });
+        }
+        (None, Some([source, target])) => {
+            if down_bits.is_some() || up_bits.is_some() {
+                anyhow::bail!("An edge's change can only set 'latency' and 'packet_loss'");
+            }
+            if change.latency.is_none() && change.packet_loss.is_none() {
+                anyhow::bail!("An edge's change must set 'latency' or 'packet_loss'");
+            }
+            // with shortest paths, a change to one edge could change the route of any path
+            if config.network.use_shortest_path.unwrap() {
+                anyhow::bail!(
+                    "Edges can only be changed when 'network.use_shortest_path' is false"
+                );
+            }
+            for id in [source, target] {
+                if graph.node_id_to_index(id).is_none() {
+                    anyhow::bail!("The network node id {id} does not exist");
+                }
+            }
+
+            let latency_ns = change
+                .latency
+                .map(|x| u64::try_from(Duration::from(x).as_nanos()).unwrap());
+            if latency_ns == Some(0) {
+                anyhow::bail!("An edge's latency must not be 0");
+            }
+            let latency_ns = latency_ns.map(|latency_ns| {
+                let path = PathProperties {
+                    latency_ns,
+                    packet_loss: 0.0,
+                };
+                match latency_quantum_ns {
+                    Some(quantum_ns) => path.with_latency_quantum(quantum_ns).latency_ns,
+                    None => path.latency_ns,
+                }
+            });
+            if change
+                .packet_loss
+                .is_some_and(|x| !(0.0..=1.0).contains(&x))
+            {
+                anyhow::bail!("An edge's packet loss must be in the range [0,1]");
+            }
+
+            let mut ends = vec![(source, target)];
+            if !graph.is_directed() && source != target {
+                ends.push((target, source));
+            }
+            for (source, target) in ends {
+                edge_changes.push(EdgeChange {
+                    time,
+                    source,
+                    target,
+                    latency_ns,
+                    packet_loss: change.packet_loss,
+                });
+            }
+        }
+        _ => anyhow::bail!("A change must set exactly one of 'host' and 'edge'"),
+    }
+
+    Ok(())
+}
+
+/// Convert the edge changes to changes of the paths in `routing_info`. With direct paths, the path
+/// between two nodes is the edge between them.
+fn build_path_schedule(changes: &[EdgeChange], routing_info: &RoutingInfo<u32>) -> PathSchedule {
+    if !changes.is_empty() {
+        // direct paths are never computed lazily
+        assert!(routing_info.is_mutable());
+    }
+
+    let mut path_changes = Vec::new();
+    for change in changes {
+        let (Some(src), Some(dst)) = (
+            routing_info.node_index(change.source),
+            routing_info.node_index(change.target),
+        ) else {
+            log::warn!(
+                "The network schedule's change to edge {}->{} has no effect since a node has no \
+                 hosts",
+                change.source,
+                change.target
+            );
+            continue;
+        };
+        path_changes.push(PathChange {
+            time: change.time,
+            src,
+            dst,
+            latency_ns: change.latency_ns,
+            packet_loss: change.packet_loss,
+        });
+    }
+
+    PathSchedule::new(path_changes)
+}
+
+/// The largest payload of a UDP datagram.
+const MAX_UDP_PAYLOAD: u64 = 65_507;
+
+/// For a traffic entry in the configuration options, build a `TrafficInfo` object.
+fn build_traffic(traffic: &TrafficOptions, config: &ConfigOptions) -> anyhow::Result<TrafficInfo> {
+    let (peer_host, peer_port) = traffic
+        .peer
+        .rsplit_once(':')
+        .filter(|(host, _)| !host.is_empty())
+        .context("The traffic peer must be of the form 'host:port'")?;
+    let peer_port: u16 = peer_port
+        .parse()
+        .ok()
+        .filter(|x| *x != 0)
+        .with_context(|| format!("Invalid traffic peer port '{peer_port}'"))?;
+
+    let rate_bits = traffic
+        .rate
+        .convert(units::SiPrefixUpper::Base)
+        .unwrap()
+        .value();
+    if rate_bits == 0 {
+        return Err(anyhow::anyhow!("The traffic rate must be positive"));
+    }
+
+    let packet_size = traffic
+        .packet_size
+        .convert(units::SiPrefixUpper::Base)
+        .unwrap()
+        .value();
+    if !(1..=MAX_UDP_PAYLOAD).contains(&packet_size) {
+        return Err(anyhow::anyhow!(
+            "The traffic packet size must be between 1 and {MAX_UDP_PAYLOAD} bytes"
+        ));
+    }
+
+    let start_time: SimulationTime = Duration::from(traffic.start_time).try_into().unwrap();
+    let stop_time: Option<SimulationTime> = traffic
+        .stop_time
+        .map(|x| Duration::from(x).try_into().unwrap());
+    let sim_stop_time =
+        SimulationTime::try_from(Duration::from(config.general.stop_time.unwrap())).unwrap();
+
+    if start_time >= sim_stop_time {
+        return Err(anyhow::anyhow!(
+            "Traffic start time '{}' must be earlier than the simulation stop time '{}'",
+            traffic.start_time,
+            config.general.stop_time.unwrap(),
+        ));
+    }
+    if stop_time.is_some_and(|x| x <= start_time) {
+        return Err(anyhow::anyhow!(
+            "Traffic start time '{}' must be earlier than its stop time '{}'",
+            traffic.start_time,
+            traffic.stop_time.unwrap(),
+        ));
+    }
+
+    Ok(TrafficInfo {
+        model: traffic.model,
+        peer_host: peer_host.to_string(),
+        peer_port,
+        rate_bits,
+        packet_size: packet_size.try_into().unwrap(),
+        start_time,
+        stop_time,
     })
 }
 
@@ -420,12 +825,41 @@ fn assign_ips(hosts: &mut [HostInfo]) -> anyhow::Result<IpAssignment<u32>> {
 }
 
 /// Generate a map containing routing information (latency, packet loss, etc) for each pair of
-/// nodes.
+/// nodes. If shortest paths are used, they're taken from `routing_cache` if it's set. Otherwise if
+/// `shortest_path_cache_size` is set, the paths are computed lazily during the simulation. If
+/// `latency_quantum_ns` is set, the latency of each path is rounded up to a multiple of it.
 fn generate_routing_info(
-    graph: &NetworkGraph,
+    graph: NetworkGraph,
     nodes: &std::collections::HashSet<u32>,
     use_shortest_paths: bool,
+    shortest_path_cache_size: Option<NonZeroU32>,
+    routing_cache: Option<&RoutingCache>,
+    latency_quantum_ns: Option<NonZeroU64>,
 ) -> anyhow::Result<RoutingInfo<u32>> {
+    let quantize = move |path: PathProperties| match latency_quantum_ns {
+        Some(quantum_ns) => path.with_latency_quantum(quantum_ns),
+        None => path,
+    };
+
+    if let (true, Some(routing_cache)) = (use_shortest_paths, routing_cache) {
+        let paths = nodes
+            .iter()
+            .flat_map(|src| nodes.iter().map(move |dst| (*src, *dst)))
+            .map(|(src, dst)| {
+                let path = routing_cache
+                    .path(src, dst)
+                    .ok_or_else(|| anyhow::anyhow!("No path from node {src} to {dst}"))?;
+                Ok(((src, dst), quantize(path)))
+            })
+            .collect::<anyhow::Result<_>>()
+            .context("Failed to get the shortest paths from the routing cache")?;
+        return Ok(RoutingInfo::new(paths));
+    }
+
+    if let (true, Some(cache_size)) = (use_shortest_paths, shortest_path_cache_size) {
+        return generate_lazy_routing_info(graph, nodes, cache_size, latency_quantum_ns);
+    }
+
     // convert gml node IDs to petgraph indexes
     let nodes: Vec<_> = nodes
         .iter()
@@ -436,7 +870,7 @@ fn generate_routing_info(
     let to_ids = |((src, dst), path)| {
         let src = graph.node_index_to_id(src).unwrap();
         let dst = graph.node_index_to_id(dst).unwrap();
-        ((src, dst), path)
+        ((src, dst), quantize(path))
     };
 
     let paths = if use_shortest_paths {
@@ -460,6 +894,66 @@ fn generate_routing_info(
     Ok(RoutingInfo::new(paths))
 }
 
+/// Generate routing information where the shortest paths from a node are computed the first time
+/// that a packet is sent from it, and are kept in a cache of at most `cache_size` source nodes.
+fn generate_lazy_routing_info(
+    graph: NetworkGraph,
+    nodes: &std::collections::HashSet<u32>,
+    cache_size: NonZeroU32,
+    latency_quantum_ns: Option<NonZeroU64>,
+) -> anyhow::Result<RoutingInfo<u32>> {
+    // sort so that the node indices don't depend on the hash set's order
+    let mut node_ids: Vec<u32> = nodes.iter().copied().collect();
+    node_ids.sort();
+
+    // convert gml node IDs to petgraph indexes
+    let indices: Vec<_> = node_ids
+        .iter()
+        .map(|x| *graph.node_id_to_index(*x).unwrap())
+        .collect();
+
+    // check for errors now rather than when the paths are first used
+    graph
+        .verify_self_loops(&indices)
+        .map_err(|e| anyhow::anyhow!(e))
+        .context("Failed to compute shortest paths between graph nodes")?;
+
+    // rounding up is monotonic, so the rounded smallest edge latency is still a lower bound on the
+    // rounded path latencies
+    let smallest_latency_ns = graph
+        .smallest_edge_latency_ns()
+        .map(|x| match latency_quantum_ns {
+            Some(quantum_ns) => {
+                let path = PathProperties {
+                    latency_ns: x,
+                    ..Default::default()
+                };
+                path.with_latency_quantum(quantum_ns).latency_ns
+            }
+            None => x,
+        });
+
+    let compute = Box::new(move |src: usize| {
+        let paths = graph
+            .shortest_paths_from(indices[src], &indices)
+            .expect("Self-loops were verified");
+        match latency_quantum_ns {
+            Some(quantum_ns) => paths
+                .into_iter()
+                .map(|x| x.map(|x| x.with_latency_quantum(quantum_ns)))
+                .collect(),
+            None => paths,
+        }
+    });
+
+    Ok(RoutingInfo::new_lazy(
+        node_ids,
+        compute,
+        cache_size.try_into().unwrap(),
+        smallest_latency_ns,
+    ))
+}
+
 /// Check that the plugin path is valid.
 fn verify_plugin_path(path: impl AsRef<std::path::Path>) -> anyhow::Result<()> {
     let path = path.as_ref();
@@ -1,10 +1,16 @@
 use std::cell::RefCell;
+use std::collections::BTreeMap;
+use std::io::Write;
 use std::sync::Mutex;
+use std::time::Duration;
 
 use anyhow::Context;
 use serde::Serialize;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
 use crate::utility::counter::Counter;
+use crate::utility::histogram::LatencyHistogram;
+use crate::utility::numa::PageMoveStats;
 
 /// Simulation statistics to be accessed by a single thread.
 #[derive(Debug)]
@@ -12,6 +18,13 @@ pub struct LocalSimStats {
     pub alloc_counts: RefCell<Counter>,
     pub dealloc_counts: RefCell<Counter>,
     pub syscall_counts: RefCell<Counter>,
+    pub event_buffers: RefCell<EventBufferStats>,
+    pub memory_manager_misses: RefCell<Counter>,
+    pub syscall_condition_wakeups: RefCell<WakeupStats>,
+    pub cpu_affinity: RefCell<AffinityStats>,
+    pub syscall_latencies: RefCell<SyscallLatencies>,
+    pub native_syscalls: RefCell<NativeSyscallStats>,
+    pub executed_events: RefCell<u64>,
 }
 
 impl LocalSimStats {
@@ -20,6 +33,13 @@ impl LocalSimStats {
             alloc_counts: RefCell::new(Counter::new()),
             dealloc_counts: RefCell::new(Counter::new()),
             syscall_counts: RefCell::new(Counter::new()),
+            event_buffers: RefCell::new(EventBufferStats::default()),
+            memory_manager_misses: RefCell::new(Counter::new()),
+            syscall_condition_wakeups: RefCell::new(WakeupStats::default()),
+            cpu_affinity: RefCell::new(AffinityStats::default()),
+            syscall_latencies: RefCell::new(SyscallLatencies::default()),
+            native_syscalls: RefCell::new(NativeSyscallStats::default()),
+            executed_events: RefCell::new(0),
         }
     }
 }
@@ -30,12 +50,200 @@ impl Default for LocalSimStats {
     }
 }
 
+/// Statistics about the manager's scheduling rounds.
+#[derive(Serialize, Clone, Debug, Default)]
+pub struct RoundStats {
+    /// The number of scheduling rounds that were run.
+    pub executed: u64,
+    /// The number of runahead-sized rounds that were skipped because no host had any events in
+    /// them.
+    pub skipped: u64,
+    /// The total time that worker threads spent running hosts, in nanoseconds.
+    pub thread_busy_ns: u64,
+    /// The part of `thread_busy_ns` that was spent locking the hosts' shared memory.
+    pub thread_lock_shmem_ns: u64,
+    /// The total time that worker threads spent waiting at the round barrier for other threads, in
+    /// nanoseconds.
+    pub thread_barrier_wait_ns: u64,
+    /// The total time by which the slowest thread of each round exceeded the average thread's
+    /// busy time, in nanoseconds. A large value relative to `thread_busy_ns` means that the hosts'
+    /// work was imbalanced across threads.
+    pub straggler_ns: u64,
+    /// The real time that the scheduling loop took, in nanoseconds.
+    pub real_time_ns: u64,
+}
+
+/// Where the hosts' memory was placed when they booted, if NUMA placement was enabled.
+#[derive(Serialize, Clone, Debug, Default)]
+pub struct HostPlacementStats {
+    /// The number of hosts that booted on each NUMA node.
+    pub hosts_per_node: BTreeMap<u32, u64>,
+    /// The number of pages of host state that were moved to the host's node.
+    pub pages_moved: u64,
+    /// The number of pages of host state that were already on the host's node.
+    pub pages_local: u64,
+    /// The number of pages of host state that couldn't be moved.
+    pub pages_failed: u64,
+}
+
+impl HostPlacementStats {
+    pub fn add_host(&mut self, node: u32, pages: &PageMoveStats) {
+        *self.hosts_per_node.entry(node).or_default() += 1;
+        self.pages_moved += pages.moved;
+        self.pages_local += pages.local;
+        self.pages_failed += pages.failed;
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.hosts_per_node.is_empty()
+    }
+}
+
+/// Which processes' memory was marked as mergeable by the kernel, if memory merging was enabled.
+#[derive(Serialize, Clone, Debug, Default)]
+pub struct MemoryMergingStats {
+    /// The number of processes whose whole address space was marked as mergeable.
+    pub processes: u64,
+    /// The number of processes on kernels that can't mark a whole process, for which only some
+    /// regions were marked as mergeable.
+    pub processes_regions_only: u64,
+    /// The number of processes that couldn't be marked.
+    pub processes_failed: u64,
+    /// The number of regions that were marked in the `processes_regions_only` processes.
+    pub regions: u64,
+    /// The total size of those regions, in bytes.
+    pub region_bytes: u64,
+    /// The bytes of memory that the kernel had merged in the processes that were still running at
+    /// the end of the simulation, sampled just before they were stopped.
+    pub merged_bytes_at_end: u64,
+}
+
+impl MemoryMergingStats {
+    pub fn is_empty(&self) -> bool {
+        self.processes == 0 && self.processes_regions_only == 0 && self.processes_failed == 0
+    }
+}
+
+/// Statistics about the buffers used to send batches of events between hosts.
+#[derive(Serialize, Clone, Debug, Default)]
+pub struct EventBufferStats {
+    /// The number of buffers that were reused from a host's buffer pool.
+    pub reused: u64,
+    /// The number of buffers that were newly allocated.
+    pub allocated: u64,
+}
+
+impl EventBufferStats {
+    pub fn add(&mut self, other: &Self) {
+        self.reused += other.reused;
+        self.allocated += other.allocated;
+    }
+}
+
+/// Statistics about the wakeups of threads blocked in a syscall.
+#[derive(Serialize, Clone, Debug, Default)]
+pub struct WakeupStats {
+    /// The number of wakeup tasks that were scheduled.
+    pub scheduled: u64,
+    /// The number of wakeups that weren't scheduled since one was already pending.
+    pub elided: u64,
+    /// The number of scheduled wakeups that didn't run the thread since its condition was no
+    /// longer satisfied, for example because another thread accepted the connection first.
+    pub spurious: u64,
+}
+
+impl WakeupStats {
+    pub fn add(&mut self, other: &Self) {
+        self.scheduled += other.scheduled;
+        self.elided += other.elided;
+        self.spurious += other.spurious;
+    }
+}
+
+/// Statistics about pinning managed threads to the CPU cores of the workers that run them.
+#[derive(Serialize, Clone, Debug, Default)]
+pub struct AffinityStats {
+    /// The number of times that a host moved its threads to a new worker core.
+    pub host_changes: u64,
+    /// The number of rounds in which a host ran on a different core than its threads are pinned
+    /// to, and didn't move its threads since it hadn't been on that core for a full round yet.
+    pub host_changes_deferred: u64,
+    /// The number of times that a managed thread's CPU affinity was set.
+    pub thread_changes: u64,
+}
+
+impl AffinityStats {
+    pub fn add(&mut self, other: &Self) {
+        self.host_changes += other.host_changes;
+        self.host_changes_deferred += other.host_changes_deferred;
+        self.thread_changes += other.thread_changes;
+    }
+}
+
+/// Wall-clock latency histograms, keyed by syscall number. These are only recorded when Shadow is
+/// built with the `perf_timers` feature.
+#[derive(Serialize, Clone, Debug, Default)]
+pub struct SyscallLatencies {
+    /// The time spent in Shadow's syscall handler.
+    pub handler: BTreeMap<i64, LatencyHistogram>,
+    /// The time from resuming the plugin until it made the syscall, which includes the IPC round
+    /// trip and the plugin's native execution.
+    pub plugin: BTreeMap<i64, LatencyHistogram>,
+}
+
+impl SyscallLatencies {
+    pub fn add(&mut self, other: &Self) {
+        for (map, other_map) in [
+            (&mut self.handler, &other.handler),
+            (&mut self.plugin, &other.plugin),
+        ] {
+            for (num, hist) in other_map {
+                map.entry(*num).or_default().add(hist);
+            }
+        }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.handler.is_empty() && self.plugin.is_empty()
+    }
+}
+
+/// Statistics about syscalls that managed processes execute natively.
+#[derive(Serialize, Clone, Debug, Default)]
+pub struct NativeSyscallStats {
+    /// The syscalls that the shim's seccomp filter lets through, by number. These never reach
+    /// Shadow, so they aren't counted anywhere.
+    pub passthrough: Vec<i64>,
+    /// The number of syscalls, by number, that reached Shadow only for Shadow to tell the shim to
+    /// execute them natively. Each of these is a round trip that passing the syscall through would
+    /// avoid.
+    pub trapped: BTreeMap<i64, u64>,
+}
+
+impl NativeSyscallStats {
+    pub fn add(&mut self, other: &Self) {
+        for (num, count) in &other.trapped {
+            *self.trapped.entry(*num).or_default() += count;
+        }
+    }
+}
+
 /// Simulation statistics to be accessed by multiple threads.
 #[derive(Debug)]
 pub struct SharedSimStats {
     pub alloc_counts: Mutex<Counter>,
     pub dealloc_counts: Mutex<Counter>,
     pub syscall_counts: Mutex<Counter>,
+    pub rounds: Mutex<RoundStats>,
+    pub host_placement: Mutex<HostPlacementStats>,
+    pub memory_merging: Mutex<MemoryMergingStats>,
+    pub event_buffers: Mutex<EventBufferStats>,
+    pub memory_manager_misses: Mutex<Counter>,
+    pub syscall_condition_wakeups: Mutex<WakeupStats>,
+    pub cpu_affinity: Mutex<AffinityStats>,
+    pub syscall_latencies: Mutex<SyscallLatencies>,
+    pub native_syscalls: Mutex<NativeSyscallStats>,
+    pub executed_events: Mutex<u64>,
 }
 
 impl SharedSimStats {
@@ -44,6 +252,16 @@ impl SharedSimStats {
             alloc_counts: Mutex::new(Counter::new()),
             dealloc_counts: Mutex::new(Counter::new()),
             syscall_counts: Mutex::new(Counter::new()),
+            rounds: Mutex::new(RoundStats::default()),
+            host_placement: Mutex::new(HostPlacementStats::default()),
+            memory_merging: Mutex::new(MemoryMergingStats::default()),
+            event_buffers: Mutex::new(EventBufferStats::default()),
+            memory_manager_misses: Mutex::new(Counter::new()),
+            syscall_condition_wakeups: Mutex::new(WakeupStats::default()),
+            cpu_affinity: Mutex::new(AffinityStats::default()),
+            syscall_latencies: Mutex::new(SyscallLatencies::default()),
+            native_syscalls: Mutex::new(NativeSyscallStats::default()),
+            executed_events: Mutex::new(0),
         }
     }
 
@@ -64,6 +282,44 @@ impl SharedSimStats {
         *local_alloc_counts = Counter::new();
         *local_dealloc_counts = Counter::new();
         *local_syscall_counts = Counter::new();
+
+        self.event_buffers
+            .lock()
+            .unwrap()
+            .add(&std::mem::take(&mut local.event_buffers.borrow_mut()));
+
+        self.memory_manager_misses
+            .lock()
+            .unwrap()
+            .add_counter(&std::mem::replace(
+                &mut local.memory_manager_misses.borrow_mut(),
+                Counter::new(),
+            ));
+
+        self.syscall_condition_wakeups
+            .lock()
+            .unwrap()
+            .add(&std::mem::take(
+                &mut local.syscall_condition_wakeups.borrow_mut(),
+            ));
+
+        self.cpu_affinity
+            .lock()
+            .unwrap()
+            .add(&std::mem::take(&mut local.cpu_affinity.borrow_mut()));
+
+        self.syscall_latencies
+            .lock()
+            .unwrap()
+            .add(&std::mem::take(&mut local.syscall_latencies.borrow_mut()));
+
+        self.native_syscalls
+            .lock()
+            .unwrap()
+            .add(&std::mem::take(&mut local.native_syscalls.borrow_mut()));
+
+        *self.executed_events.lock().unwrap() +=
+            std::mem::take(&mut *local.executed_events.borrow_mut());
     }
 }
 
@@ -78,6 +334,21 @@ impl Default for SharedSimStats {
 struct SimStatsForOutput {
     pub objects: ObjectStatsForOutput,
     pub syscalls: Counter,
+    pub rounds: RoundStats,
+    #[serde(skip_serializing_if = "HostPlacementStats::is_empty")]
+    pub host_placement: HostPlacementStats,
+    #[serde(skip_serializing_if = "MemoryMergingStats::is_empty")]
+    pub memory_merging: MemoryMergingStats,
+    pub event_buffers: EventBufferStats,
+    /// Plugin memory accesses that weren't served from memory mapped into Shadow, by region.
+    pub memory_manager_misses: Counter,
+    pub syscall_condition_wakeups: WakeupStats,
+    pub cpu_affinity: AffinityStats,
+    #[serde(skip_serializing_if = "SyscallLatencies::is_empty")]
+    pub syscall_latencies: SyscallLatencies,
+    pub native_syscalls: NativeSyscallStats,
+    /// The number of events that hosts executed, including packet arrivals.
+    pub executed_events: u64,
 }
 
 #[derive(Serialize, Clone, Debug)]
@@ -102,10 +373,79 @@ impl SimStatsForOutput {
                 ),
             },
             syscalls: std::mem::replace(&mut stats.syscall_counts.lock().unwrap(), Counter::new()),
+            rounds: std::mem::take(&mut stats.rounds.lock().unwrap()),
+            host_placement: std::mem::take(&mut stats.host_placement.lock().unwrap()),
+            memory_merging: std::mem::take(&mut stats.memory_merging.lock().unwrap()),
+            event_buffers: std::mem::take(&mut stats.event_buffers.lock().unwrap()),
+            memory_manager_misses: std::mem::replace(
+                &mut stats.memory_manager_misses.lock().unwrap(),
+                Counter::new(),
+            ),
+            syscall_condition_wakeups: std::mem::take(
+                &mut stats.syscall_condition_wakeups.lock().unwrap(),
+            ),
+            cpu_affinity: std::mem::take(&mut stats.cpu_affinity.lock().unwrap()),
+            syscall_latencies: std::mem::take(&mut stats.syscall_latencies.lock().unwrap()),
+            native_syscalls: std::mem::take(&mut stats.native_syscalls.lock().unwrap()),
+            executed_events: std::mem::take(&mut stats.executed_events.lock().unwrap()),
         }
     }
 }
 
+/// Statistics taken while the simulation is running. Unlike [`SimStatsForOutput`], the counts are
+/// totals since the start of the simulation, so taking a snapshot doesn't reset them.
+#[derive(Serialize, Debug)]
+struct SimStatsSnapshot<'a> {
+    pub sim_time_ns: u64,
+    pub real_time_ns: u64,
+    pub runahead_ns: u64,
+    pub objects: ObjectStatsSnapshot<'a>,
+    pub syscalls: &'a Counter,
+    pub rounds: &'a RoundStats,
+    pub executed_events: u64,
+}
+
+#[derive(Serialize, Debug)]
+struct ObjectStatsSnapshot<'a> {
+    pub alloc_counts: &'a Counter,
+    pub dealloc_counts: &'a Counter,
+}
+
+/// Write a snapshot of `stats` to `writer` as a single line of JSON. The worker threads' local
+/// stats should be added to `stats` first. `rounds` are the manager's round stats so far, since
+/// `stats.rounds` is only set at the end of the simulation.
+pub fn write_stats_snapshot(
+    mut writer: impl Write,
+    stats: &SharedSimStats,
+    rounds: &RoundStats,
+    sim_time: SimulationTime,
+    real_time: Duration,
+    runahead: SimulationTime,
+) -> anyhow::Result<()> {
+    let alloc_counts = stats.alloc_counts.lock().unwrap();
+    let dealloc_counts = stats.dealloc_counts.lock().unwrap();
+    let syscall_counts = stats.syscall_counts.lock().unwrap();
+
+    let snapshot = SimStatsSnapshot {
+        sim_time_ns: sim_time.as_nanos().try_into().unwrap(),
+        real_time_ns: real_time.as_nanos().try_into().unwrap(),
+        runahead_ns: runahead.as_nanos().try_into().unwrap(),
+        objects: ObjectStatsSnapshot {
+            alloc_counts: &alloc_counts,
+            dealloc_counts: &dealloc_counts,
+        },
+        syscalls: &syscall_counts,
+        rounds,
+        executed_events: *stats.executed_events.lock().unwrap(),
+    };
+
+    serde_json::to_writer(&mut writer, &snapshot).context("Failed to serialize stats snapshot")?;
+    writeln!(writer)?;
+    writer.flush()?;
+
+    Ok(())
+}
+
 /// May reset fields of `stats`.
 pub fn write_stats_to_file(
     filename: &std::path::Path,
@@ -1,5 +1,6 @@
 use std::collections::{BTreeMap, HashSet};
 use std::ffi::{CStr, CString, OsStr, OsString};
+use std::num::{NonZeroU32, NonZeroU64};
 use std::os::unix::ffi::OsStrExt;
 use std::str::FromStr;
 
@@ -13,7 +14,7 @@ use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
 use super::units::{self, Unit};
 use crate::cshadow as c;
-use crate::host::syscall::formatter::FmtOptions;
+use crate::host::syscall::formatter::{FmtOptions, StraceOutput};
 
 const START_HELP_TEXT: &str = "\
     Run real applications over simulated networks.\n\n\
@@ -34,7 +35,7 @@ const END_HELP_TEXT: &str = "\
 #[clap(hide_possible_values = true)]
 pub struct CliOptions {
     /// Path to the Shadow configuration file. Use '-' to read from stdin
-    #[clap(required_unless_present_any(&["show_build_info", "shm_cleanup"]))]
+    #[clap(required_unless_present_any(&["show_build_info", "shm_cleanup", "precompute_routing"]))]
     pub config: Option<String>,
 
     /// Pause to allow gdb to attach
@@ -58,6 +59,25 @@ pub struct CliOptions {
     #[clap(long)]
     pub show_config: bool,
 
+    /// Exit after computing the shortest paths between all nodes of a GML graph file (which may be
+    /// xz-compressed) and writing them to the routing cache file given by '--output'
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "graph-path", requires("output"))]
+    #[clap(conflicts_with_all(&["config", "show_build_info", "shm_cleanup", "show_config"]))]
+    pub precompute_routing: Option<String>,
+
+    /// The routing cache file to write with '--precompute-routing'
+    #[clap(hide_short_help = true)]
+    #[clap(long, short = 'o', value_name = "path", requires("precompute_routing"))]
+    pub output: Option<String>,
+
+    /// Before running the simulation, run its first 'seconds' of simulated time several times with
+    /// different parallelism, scheduler, CPU pinning, runahead, and CPU latency options, then run
+    /// with the fastest options that don't change the results and log the others
+    #[clap(long, value_name = "seconds")]
+    #[clap(conflicts_with_all(&["show_config", "gdb"]))]
+    pub autotune: Option<units::Time<units::TimePrefix>>,
+
     #[clap(flatten)]
     pub general: GeneralOptions,
 
@@ -158,10 +178,11 @@ impl ConfigOptions {
         SimulationTime::from_nanos(nanos)
     }
 
-    pub fn strace_logging_mode(&self) -> Option<FmtOptions> {
+    pub fn strace_logging_mode(&self) -> Option<StraceOutput> {
         match self.experimental.strace_logging_mode.as_ref().unwrap() {
-            StraceLoggingMode::Standard => Some(FmtOptions::Standard),
-            StraceLoggingMode::Deterministic => Some(FmtOptions::Deterministic),
+            StraceLoggingMode::Standard => Some(StraceOutput::Text(FmtOptions::Standard)),
+            StraceLoggingMode::Deterministic => Some(StraceOutput::Text(FmtOptions::Deterministic)),
+            StraceLoggingMode::Binary => Some(StraceOutput::Binary),
             StraceLoggingMode::Off => None,
         }
     }
@@ -274,6 +295,10 @@ pub struct NetworkOptions {
     #[clap(long, value_name = "bool")]
     #[clap(help = NETWORK_HELP.get("use_shortest_path").unwrap().as_str())]
     pub use_shortest_path: Option<bool>,
+
+    /// Changes to host bandwidths and to graph edges at given simulation times
+    #[clap(skip)]
+    pub schedule: Option<NetworkScheduleSource>,
 }
 
 impl NetworkOptions {
@@ -334,6 +359,14 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_preload_openssl_crypto").unwrap().as_str())]
     pub use_preload_openssl_crypto: Option<bool>,
 
+    /// Charge simulated CPU time for the OpenSSL crypto operations intercepted by our OpenSSL
+    /// crypto library, using rough per-byte and per-operation costs. Requires
+    /// `use_preload_openssl_crypto`.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_openssl_crypto_cost_model").unwrap().as_str())]
+    pub use_openssl_crypto_cost_model: Option<bool>,
+
     /// Use the MemoryManager. It can be useful to disable for debugging, but will hurt performance in
     /// most cases
     #[clap(hide_short_help = true)]
@@ -341,12 +374,54 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_memory_manager").unwrap().as_str())]
     pub use_memory_manager: Option<bool>,
 
+    /// Back the plugin memory that the MemoryManager maps into Shadow (the heap, stack, and
+    /// private anonymous mappings) with transparent huge pages when possible, which can reduce TLB
+    /// misses for plugins that use a lot of memory. This is ignored if `use_memory_manager` is
+    /// false.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_memory_manager_huge_pages").unwrap().as_str())]
+    pub use_memory_manager_huge_pages: Option<bool>,
+
+    /// Mark the memory of managed processes as mergeable by the kernel's same-page merging (KSM)
+    /// once the shim has initialized, so that identical pages in many processes of the same program
+    /// are stored once. KSM doesn't merge the memory that the MemoryManager remaps, so this has
+    /// the most effect when `use_memory_manager` is false.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_memory_merging").unwrap().as_str())]
+    pub use_memory_merging: Option<bool>,
+
     /// Pin each thread and any processes it executes to the same logical CPU Core to improve cache affinity
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
     #[clap(help = EXP_HELP.get("use_cpu_pinning").unwrap().as_str())]
     pub use_cpu_pinning: Option<bool>,
 
+    /// Add tokens to the bandwidth limiters' token buckets continuously, keeping fractions of a
+    /// byte, instead of once per millisecond. Bandwidths that aren't a whole number of bytes per
+    /// millisecond are then enforced exactly, and packets aren't delayed to millisecond boundaries.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_continuous_token_refill").unwrap().as_str())]
+    pub use_continuous_token_refill: Option<bool>,
+
+    /// Write the log records of each host to `hosts/<name>/shadow.log.zst` instead of stdout.
+    /// Records are formatted by the worker threads and compressed in the background, so that
+    /// logging doesn't bottleneck on a single logger thread. Errors are also written to stdout
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_per_host_log_files").unwrap().as_str())]
+    pub use_per_host_log_files: Option<bool>,
+
+    /// Pin each worker thread to one logical CPU of a core and the plugin threads it runs to
+    /// another logical CPU (an SMT sibling) of the same core, and have them spin while waiting
+    /// for each other instead of sleeping. Requires `use_cpu_pinning`
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_smt_sibling_pinning").unwrap().as_str())]
+    pub use_smt_sibling_pinning: Option<bool>,
+
     /// Each worker thread will spin in a `sched_yield` loop while waiting for a new task. This is
     /// ignored if not using the thread-per-core scheduler.
     #[clap(hide_short_help = true)]
@@ -354,18 +429,75 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_worker_spinning").unwrap().as_str())]
     pub use_worker_spinning: Option<bool>,
 
+    /// Record the packets that arrive at the host with this name into 'packets.recording' in its
+    /// data directory, so that the host can be replayed on its own with `replay_host`
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "hostname")]
+    #[clap(help = EXP_HELP.get("record_host").unwrap().as_str())]
+    pub record_host: Option<NullableOption<String>>,
+
+    /// Run only the host recorded in the recording at this path, replaying the packets that it
+    /// received and dropping the packets that it sends to other hosts
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "path")]
+    #[clap(help = EXP_HELP.get("replay_host").unwrap().as_str())]
+    pub replay_host: Option<NullableOption<String>>,
+
+    /// Connect to an external program's Unix socket at this path, and let it inject events into
+    /// the simulation and decide how far the simulation may run between syncs
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "path")]
+    #[clap(help = EXP_HELP.get("round_hook_socket").unwrap().as_str())]
+    pub round_hook_socket: Option<NullableOption<String>>,
+
+    /// Write each worker thread's time spent running hosts and waiting at the round barrier in
+    /// each scheduling round to 'round-timeline.csv' in the data directory
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("round_timeline").unwrap().as_str())]
+    pub round_timeline: Option<bool>,
+
+    /// Publish live metrics of the simulation's progress in a shared-memory file that can be read
+    /// with 'shadow-top.py' while the simulation runs
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("live_metrics").unwrap().as_str())]
+    pub live_metrics: Option<bool>,
+
     /// If set, overrides the automatically calculated minimum time workers may run ahead when sending events between nodes
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "seconds")]
     #[clap(help = EXP_HELP.get("runahead").unwrap().as_str())]
     pub runahead: Option<NullableOption<units::Time<units::TimePrefix>>>,
 
+    /// After the simulation, log estimates of the number of rounds and the time that the
+    /// simulation would have taken with larger values of 'runahead'
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("runahead_advisor").unwrap().as_str())]
+    pub runahead_advisor: Option<bool>,
+
+    /// Round the latency of each path between graph nodes up to a multiple of this time, which
+    /// allows a larger runahead
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("latency_quantum").unwrap().as_str())]
+    pub latency_quantum: Option<NullableOption<units::Time<units::TimePrefix>>>,
+
     /// Update the minimum runahead dynamically throughout the simulation.
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
     #[clap(help = EXP_HELP.get("use_dynamic_runahead").unwrap().as_str())]
     pub use_dynamic_runahead: Option<bool>,
 
+    /// The total size of the contents of read-only files that Shadow can keep in memory and share
+    /// between hosts, so that each host doesn't need to read the files from the OS. 0 disables the
+    /// cache
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bytes")]
+    #[clap(help = EXP_HELP.get("file_cache_size").unwrap().as_str())]
+    pub file_cache_size: Option<units::Bytes<units::SiPrefixUpper>>,
+
     /// Initial size of the socket's send buffer
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bytes")]
@@ -396,6 +528,12 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("interface_qdisc").unwrap().as_str())]
     pub interface_qdisc: Option<QDiscMode>,
 
+    /// The data structure to use for each host's event queue
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "type")]
+    #[clap(help = EXP_HELP.get("event_queue").unwrap().as_str())]
+    pub event_queue: Option<EventQueueMode>,
+
     /// Log level at which to print host statistics
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "level")]
@@ -409,12 +547,79 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("host_heartbeat_log_info").unwrap().as_str())]
     pub host_heartbeat_log_info: Option<HashSet<LogInfoFlag>>,
 
+    /// Release the memory that a host's event queue, router queue, and event buffer pool have
+    /// allocated but aren't using when the host's next event is at least this much simulated time
+    /// away
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("host_compaction_idle_time").unwrap().as_str())]
+    pub host_compaction_idle_time: Option<NullableOption<units::Time<units::TimePrefix>>>,
+
+    /// Write the throughput, retransmits, congestion window, RTT, and buffer occupancy of each TCP
+    /// connection to 'flow-metrics.csv' in the host's data directory, summed over intervals of
+    /// this much simulated time
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("flow_metrics_interval").unwrap().as_str())]
+    pub flow_metrics_interval: Option<NullableOption<units::Time<units::TimePrefix>>>,
+
     /// Amount of time between heartbeat messages for this host
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "seconds")]
     #[clap(help = EXP_HELP.get("host_heartbeat_interval").unwrap().as_str())]
     pub host_heartbeat_interval: Option<NullableOption<units::Time<units::TimePrefix>>>,
 
+    /// Write the memory usage of each host to 'host-memory.csv' in the data directory at this
+    /// interval of simulated time
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("host_memory_interval").unwrap().as_str())]
+    pub host_memory_interval: Option<NullableOption<units::Time<units::TimePrefix>>>,
+
+    /// Serve the latest memory usage of each host in the Prometheus text format on this port of
+    /// localhost. Requires 'host_memory_interval'
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "port")]
+    #[clap(help = EXP_HELP.get("host_memory_metrics_port").unwrap().as_str())]
+    pub host_memory_metrics_port: Option<NullableOption<u16>>,
+
+    /// Sample the CPU time of each worker thread at this interval, and write the number of samples
+    /// spent on each host and kind of work to 'host-profile.csv' in the data directory
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("host_profiler_interval").unwrap().as_str())]
+    pub host_profiler_interval: Option<NullableOption<units::Time<units::TimePrefix>>>,
+
+    /// Record a timeline of the worker threads' rounds, hosts, syscalls, and packets in one of
+    /// every this many scheduling rounds, and write it to 'timeline.json' in the data directory
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "rounds")]
+    #[clap(help = EXP_HELP.get("timeline_round_interval").unwrap().as_str())]
+    pub timeline_round_interval: Option<NullableOption<NonZeroU32>>,
+
+    /// Append a snapshot of the simulation statistics to 'sim-stats-snapshots.jsonl' in the data
+    /// directory at this interval of simulated time
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("sim_stats_snapshot_interval").unwrap().as_str())]
+    pub sim_stats_snapshot_interval: Option<NullableOption<units::Time<units::TimePrefix>>>,
+
+    /// Compute the shortest paths from each graph node only when they're first needed, and cache
+    /// the paths for at most this many source nodes. This reduces the startup time and memory use
+    /// for large graphs. This is ignored if `network.use_shortest_path` is false.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "nodes")]
+    #[clap(help = EXP_HELP.get("shortest_path_cache_size").unwrap().as_str())]
+    pub shortest_path_cache_size: Option<NullableOption<NonZeroU32>>,
+
+    /// Use the shortest paths from a routing cache file generated by 'shadow --precompute-routing'
+    /// instead of computing them at startup. The file must have been generated from the same
+    /// network graph. This is ignored if `network.use_shortest_path` is false.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "path")]
+    #[clap(help = EXP_HELP.get("routing_cache").unwrap().as_str())]
+    pub routing_cache: Option<NullableOption<String>>,
+
     /// Log the syscalls for each process to individual "strace" files
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "mode")]
@@ -431,6 +636,18 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("max_unapplied_cpu_latency").unwrap().as_str())]
     pub max_unapplied_cpu_latency: Option<units::Time<units::TimePrefix>>,
 
+    /// Count the instructions that each managed thread executes natively using
+    /// a hardware performance counter, and move the host's clock forward by
+    /// one second for every this many instructions. Requires access to
+    /// `perf_event_open` (see `/proc/sys/kernel/perf_event_paranoid`). If
+    /// null, native execution doesn't take any simulated time. Enabling this
+    /// makes simulated time depend on measured host CPU work, so simulations
+    /// aren't deterministic.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "instructions")]
+    #[clap(help = EXP_HELP.get("cpu_instruction_rate").unwrap().as_str())]
+    pub cpu_instruction_rate: Option<NullableOption<NonZeroU64>>,
+
     /// Simulated latency of an unblocked syscall. For efficiency Shadow only
     /// actually adds this latency if and when `max_unapplied_cpu_latency` is
     /// reached.
@@ -447,6 +664,15 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("unblocked_vdso_latency").unwrap().as_str())]
     pub unblocked_vdso_latency: Option<units::Time<units::TimePrefix>>,
 
+    /// After a thread makes this many consecutive non-blocking syscalls that find nothing ready
+    /// (such as a `recv` that returns `EAGAIN` or an `epoll_wait` with a zero timeout that returns
+    /// no events), block the thread until the host's next event or the end of the scheduling
+    /// round, whichever is first. If null, busy-polling threads are never blocked.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "syscalls")]
+    #[clap(help = EXP_HELP.get("busy_poll_threshold").unwrap().as_str())]
+    pub busy_poll_threshold: Option<NullableOption<NonZeroU32>>,
+
     /// The host scheduler implementation, which decides how to assign hosts to threads and threads
     /// to CPU cores
     #[clap(hide_short_help = true)]
@@ -454,6 +680,48 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("scheduler").unwrap().as_str())]
     pub scheduler: Option<Scheduler>,
 
+    /// Reassign hosts to threads every N scheduling rounds based on each host's measured execution
+    /// time, so that each thread has a similar amount of work. With the thread-per-host scheduler,
+    /// host threads are instead reassigned to CPU cores. This is ignored if not using a
+    /// thread-per-core or thread-per-host scheduler.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "rounds")]
+    #[clap(help = EXP_HELP.get("scheduler_rebalance_interval").unwrap().as_str())]
+    pub scheduler_rebalance_interval: Option<NullableOption<NonZeroU32>>,
+
+    /// Hosts running at least this many threads are heavy hosts, and are given worker threads of
+    /// their own. This is ignored if not using the thread-per-core-hybrid scheduler.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "threads")]
+    #[clap(help = EXP_HELP.get("scheduler_heavy_host_threads").unwrap().as_str())]
+    pub scheduler_heavy_host_threads: Option<NonZeroU32>,
+
+    /// Don't synchronize all worker threads at the end of every scheduling round. Instead each
+    /// thread runs its own hosts and advances its own scheduling window as far as the other
+    /// threads' progress and the smallest network latency allow. Requires a thread-per-core
+    /// scheduler, and ignores the runahead options.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_async_rounds").unwrap().as_str())]
+    pub use_async_rounds: Option<bool>,
+
+    /// Change the number of logical processors used by the thread-per-host scheduler during the
+    /// simulation, based on how much of each round the processors spend running hosts. Rounds
+    /// with little work then use fewer processors.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_elastic_parallelism").unwrap().as_str())]
+    pub use_elastic_parallelism: Option<bool>,
+
+    /// Assign hosts to worker threads so that hosts behind low-latency network paths are run by
+    /// the same thread, instead of assigning them randomly. This increases the smallest latency
+    /// between hosts on different threads, which is the lookahead between threads when using
+    /// asynchronous rounds.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_host_partitioning").unwrap().as_str())]
+    pub use_host_partitioning: Option<bool>,
+
     /// When true, log error-level messages to stderr in addition to stdout when
     /// stdout is not a tty but stderr is.
     #[clap(hide_short_help = true)]
@@ -461,11 +729,72 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("log_errors_to_tty").unwrap().as_str())]
     pub log_errors_to_tty: Option<bool>,
 
+    /// The format of Shadow's log messages on stdout
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "format")]
+    #[clap(help = EXP_HELP.get("log_format").unwrap().as_str())]
+    pub log_format: Option<LogFormat>,
+
+    /// When true, log each change to a packet's delivery status at the trace log level. When
+    /// false, packets only record which statuses they've had, which is cheaper.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("log_packet_status").unwrap().as_str())]
+    pub log_packet_status: Option<bool>,
+
     /// Use the rust TCP implementation
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
     #[clap(help = EXP_HELP.get("use_new_tcp").unwrap().as_str())]
     pub use_new_tcp: Option<bool>,
+
+    /// Read and write OS-backed files on a pool of background threads, so that the worker thread
+    /// can run other hosts while the managed process waits for the file operation
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_async_file_io").unwrap().as_str())]
+    pub use_async_file_io: Option<bool>,
+
+    /// Open regular files in the host's data directory natively in the managed process, so that
+    /// reads, writes, seeks, and stats of the file don't need to go through Shadow
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_native_file_io").unwrap().as_str())]
+    pub use_native_file_io: Option<bool>,
+
+    /// When copying the template directory, hard link files that can't be cloned by the
+    /// filesystem instead of copying them. A file is copied when it's first opened for writing.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_template_hard_links").unwrap().as_str())]
+    pub use_template_hard_links: Option<bool>,
+
+    /// When each host boots on its worker thread, move the host's state to the NUMA node of the
+    /// thread's CPU. Requires `use_cpu_pinning`
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_numa_host_placement").unwrap().as_str())]
+    pub use_numa_host_placement: Option<bool>,
+
+    /// At the end of the simulation, kill all managed processes at once and don't free memory
+    /// that the OS will reclaim when Shadow exits
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_fast_teardown").unwrap().as_str())]
+    pub use_fast_teardown: Option<bool>,
+
+    /// Let managed processes execute the syscalls that Shadow always has them execute natively
+    /// without trapping into Shadow
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_native_syscall_passthrough").unwrap().as_str())]
+    pub use_native_syscall_passthrough: Option<bool>,
+
+    /// Also let managed processes execute these syscalls, by number, without trapping into Shadow
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "numbers", value_delimiter = ',')]
+    #[clap(help = EXP_HELP.get("native_passthrough_syscalls").unwrap().as_str())]
+    pub native_passthrough_syscalls: Option<Vec<u32>>,
 }
 
 impl ExperimentalOptions {
@@ -485,7 +814,9 @@ impl Default for ExperimentalOptions {
             use_preload_libc: Some(true),
             use_preload_openssl_rng: Some(true),
             use_preload_openssl_crypto: Some(false),
+            use_openssl_crypto_cost_model: Some(false),
             max_unapplied_cpu_latency: Some(units::Time::new(1, units::TimePrefix::Micro)),
+            cpu_instruction_rate: Some(NullableOption::Null),
             // 1-2 microseconds is a ballpark estimate of the minimal latency for
             // context switching to the kernel and back on modern machines.
             // Default to the lower end to minimize effect in simualations without busy loops.
@@ -493,29 +824,67 @@ impl Default for ExperimentalOptions {
             // Actual latencies vary from ~40 to ~400 CPU cycles. https://stackoverflow.com/a/13096917
             // Default to the lower end to minimize effect in simualations without busy loops.
             unblocked_vdso_latency: Some(units::Time::new(10, units::TimePrefix::Nano)),
+            busy_poll_threshold: Some(NullableOption::Null),
             use_memory_manager: Some(true),
+            use_memory_manager_huge_pages: Some(false),
+            use_memory_merging: Some(false),
             use_cpu_pinning: Some(true),
+            use_continuous_token_refill: Some(false),
+            use_per_host_log_files: Some(false),
+            use_smt_sibling_pinning: Some(false),
             use_worker_spinning: Some(true),
+            record_host: Some(NullableOption::Null),
+            replay_host: Some(NullableOption::Null),
+            round_hook_socket: Some(NullableOption::Null),
+            round_timeline: Some(false),
+            live_metrics: Some(false),
             runahead: Some(NullableOption::Value(units::Time::new(
                 1,
                 units::TimePrefix::Milli,
             ))),
+            runahead_advisor: Some(false),
+            latency_quantum: Some(NullableOption::Null),
             use_dynamic_runahead: Some(false),
             socket_send_buffer: Some(units::Bytes::new(131_072, units::SiPrefixUpper::Base)),
             socket_send_autotune: Some(true),
             socket_recv_buffer: Some(units::Bytes::new(174_760, units::SiPrefixUpper::Base)),
             socket_recv_autotune: Some(true),
             interface_qdisc: Some(QDiscMode::Fifo),
+            event_queue: Some(EventQueueMode::Heap),
             host_heartbeat_log_level: Some(LogLevel::Info),
             host_heartbeat_log_info: Some(IntoIterator::into_iter([LogInfoFlag::Node]).collect()),
             host_heartbeat_interval: Some(NullableOption::Value(units::Time::new(
                 1,
                 units::TimePrefix::Sec,
             ))),
+            host_memory_interval: Some(NullableOption::Null),
+            flow_metrics_interval: Some(NullableOption::Null),
+            host_compaction_idle_time: Some(NullableOption::Null),
+            host_memory_metrics_port: Some(NullableOption::Null),
+            host_profiler_interval: Some(NullableOption::Null),
+            timeline_round_interval: Some(NullableOption::Null),
+            sim_stats_snapshot_interval: Some(NullableOption::Null),
+            shortest_path_cache_size: Some(NullableOption::Null),
+            routing_cache: Some(NullableOption::Null),
             strace_logging_mode: Some(StraceLoggingMode::Off),
             scheduler: Some(Scheduler::ThreadPerCore),
+            scheduler_rebalance_interval: Some(NullableOption::Null),
+            scheduler_heavy_host_threads: Some(NonZeroU32::new(8).unwrap()),
+            use_async_rounds: Some(false),
+            use_elastic_parallelism: Some(false),
+            use_host_partitioning: Some(false),
             log_errors_to_tty: Some(true),
+            log_format: Some(LogFormat::Text),
+            log_packet_status: Some(true),
             use_new_tcp: Some(false),
+            use_async_file_io: Some(false),
+            use_native_file_io: Some(false),
+            use_template_hard_links: Some(false),
+            use_numa_host_placement: Some(false),
+            use_fast_teardown: Some(false),
+            use_native_syscall_passthrough: Some(false),
+            native_passthrough_syscalls: Some(Vec::new()),
+            file_cache_size: Some(units::Bytes::new(0, units::SiPrefixUpper::Base)),
         }
     }
 }
@@ -547,6 +916,56 @@ pub struct HostDefaultOptions {
     #[clap(long, value_name = "bytes")]
     #[clap(help = HOST_HELP.get("pcap_capture_size").unwrap().as_str())]
     pub pcap_capture_size: Option<units::Bytes<units::SiPrefixUpper>>,
+
+    /// Capture only one of every N packets if pcap logging is enabled
+    #[clap(long, value_name = "N")]
+    #[clap(help = HOST_HELP.get("pcap_sample_interval").unwrap().as_str())]
+    pub pcap_sample_interval: Option<NonZeroU32>,
+
+    /// Capture only TCP packets with the SYN, FIN, or RST flag if pcap logging is enabled
+    #[clap(long, value_name = "bool")]
+    #[clap(help = HOST_HELP.get("pcap_control_only").unwrap().as_str())]
+    pub pcap_control_only: Option<bool>,
+
+    /// Capture only packets to or from these ports if pcap logging is enabled, or all packets if
+    /// empty
+    #[clap(value_parser = parse_set_port)]
+    #[clap(long, value_name = "ports")]
+    #[clap(help = HOST_HELP.get("pcap_ports").unwrap().as_str())]
+    pub pcap_ports: Option<HashSet<u16>>,
+
+    /// The default congestion control algorithm for TCP sockets
+    #[clap(long, value_name = "name")]
+    #[clap(help = HOST_HELP.get("tcp_congestion_control").unwrap().as_str())]
+    pub tcp_congestion_control: Option<TcpCongestionControl>,
+
+    /// The simulated time that each read or write of an OS-backed file takes, in addition to the
+    /// time that `file_io_bandwidth` adds
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = HOST_HELP.get("file_io_latency").unwrap().as_str())]
+    pub file_io_latency: Option<units::Time<units::TimePrefix>>,
+
+    /// The simulated bandwidth of reads and writes of OS-backed files, or unlimited if null
+    #[clap(long, value_name = "bandwidth")]
+    #[clap(help = HOST_HELP.get("file_io_bandwidth").unwrap().as_str())]
+    pub file_io_bandwidth: Option<NullableOption<units::BitsPerSec<units::SiPrefixUpper>>>,
+
+    /// The most reads and writes of OS-backed files that the host's disk can start per second, or
+    /// unlimited if null
+    #[clap(long, value_name = "N")]
+    #[clap(help = HOST_HELP.get("file_io_iops").unwrap().as_str())]
+    pub file_io_iops: Option<NullableOption<NonZeroU32>>,
+
+    /// The distribution of the time that `file_io_latency` adds to each file operation
+    #[clap(long, value_name = "name")]
+    #[clap(help = HOST_HELP.get("file_io_latency_model").unwrap().as_str())]
+    pub file_io_latency_model: Option<FileIoLatencyModel>,
+
+    /// The fraction of reads of OS-backed files that are served from the page cache without
+    /// waiting for the disk
+    #[clap(long, value_name = "rate")]
+    #[clap(help = HOST_HELP.get("file_io_cache_hit_rate").unwrap().as_str())]
+    pub file_io_cache_hit_rate: Option<f64>,
 }
 
 impl HostDefaultOptions {
@@ -558,6 +977,15 @@ impl HostDefaultOptions {
             // capture all the data available from the packet". The maximum length of an IP packet
             // (including the header) is 65535 bytes.
             pcap_capture_size: Some(units::Bytes::new(65535, units::SiPrefixUpper::Base)),
+            pcap_sample_interval: Some(NonZeroU32::new(1).unwrap()),
+            pcap_control_only: Some(false),
+            pcap_ports: Some(HashSet::new()),
+            tcp_congestion_control: Some(TcpCongestionControl::Reno),
+            file_io_latency: Some(units::Time::new(0, units::TimePrefix::Sec)),
+            file_io_bandwidth: Some(NullableOption::Null),
+            file_io_iops: Some(NullableOption::Null),
+            file_io_latency_model: Some(FileIoLatencyModel::Constant),
+            file_io_cache_hit_rate: Some(0.0),
         }
     }
 
@@ -580,6 +1008,15 @@ impl Default for HostDefaultOptions {
             log_level: None,
             pcap_enabled: None,
             pcap_capture_size: None,
+            pcap_sample_interval: None,
+            pcap_control_only: None,
+            pcap_ports: None,
+            tcp_congestion_control: None,
+            file_io_latency: None,
+            file_io_bandwidth: None,
+            file_io_iops: None,
+            file_io_latency_model: None,
+            file_io_cache_hit_rate: None,
         }
     }
 }
@@ -654,14 +1091,57 @@ pub struct ProcessOptions {
     pub expected_final_state: ProcessFinalState,
 }
 
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "kebab-case")]
+pub enum TrafficModel {
+    /// UDP datagrams sent at a constant interval
+    UdpConstant,
+    /// UDP datagrams sent at exponentially distributed intervals
+    UdpPoisson,
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
+#[serde(deny_unknown_fields)]
+pub struct TrafficOptions {
+    pub model: TrafficModel,
+
+    /// The host name or IP address and the port to send to (ex: `server:8000`)
+    pub peer: String,
+
+    /// The average rate at which to send, including only the datagrams' payloads
+    pub rate: units::BitsPerSec<units::SiPrefixUpper>,
+
+    /// The payload size of each datagram
+    #[serde(default = "default_traffic_packet_size")]
+    pub packet_size: units::Bytes<units::SiPrefixUpper>,
+
+    /// The simulated time at which to start sending
+    #[serde(default)]
+    pub start_time: units::Time<units::TimePrefix>,
+
+    /// The simulated time at which to stop sending
+    #[serde(default)]
+    pub stop_time: Option<units::Time<units::TimePrefix>>,
+}
+
 #[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
 #[serde(deny_unknown_fields)]
 pub struct HostOptions {
     /// Network graph node ID to assign the host to
     pub network_node_id: u32,
 
+    #[serde(default)]
     pub processes: Vec<ProcessOptions>,
 
+    /// Traffic models that Shadow runs natively on the host, without a managed process
+    #[serde(default)]
+    pub traffic: Vec<TrafficOptions>,
+
+    /// Create this many hosts from this entry, named by appending the numbers 1 to `quantity` to
+    /// the entry's name. The hosts share the entry's options.
+    #[serde(default)]
+    pub quantity: Option<NonZeroU32>,
+
     /// IP address to assign to the host
     #[serde(default)]
     pub ip_addr: Option<std::net::Ipv4Addr>,
@@ -879,6 +1359,8 @@ impl std::fmt::Display for EnvName {
 pub enum Scheduler {
     ThreadPerHost,
     ThreadPerCore,
+    ThreadPerCoreLocality,
+    ThreadPerCoreHybrid,
 }
 
 impl FromStr for Scheduler {
@@ -934,6 +1416,14 @@ fn parse_set_log_info_flags(
     parse_set(s)
 }
 
+/// Parse a string as a comma-delimited set of port numbers.
+fn parse_set_port(s: &str) -> Result<HashSet<u16>, <u16 as FromStr>::Err> {
+    if s.trim().is_empty() {
+        return Ok(HashSet::new());
+    }
+    parse_set(s)
+}
+
 /// Parse a string as a comma-delimited set of `String` values.
 fn parse_set_str(s: &str) -> Result<HashSet<String>, <String as FromStr>::Err> {
     parse_set(s)
@@ -955,6 +1445,66 @@ impl FromStr for QDiscMode {
     }
 }
 
+#[derive(Debug, Clone, Copy, Hash, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "kebab-case")]
+pub enum TcpCongestionControl {
+    Reno,
+    Cubic,
+}
+
+impl FromStr for TcpCongestionControl {
+    type Err = serde_yaml::Error;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        serde_yaml::from_str(s)
+    }
+}
+
+#[derive(Debug, Clone, Copy, Hash, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "kebab-case")]
+pub enum FileIoLatencyModel {
+    Constant,
+    Exponential,
+}
+
+impl FromStr for FileIoLatencyModel {
+    type Err = serde_yaml::Error;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        serde_yaml::from_str(s)
+    }
+}
+
+#[derive(Debug, Clone, Copy, Hash, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "kebab-case")]
+pub enum LogFormat {
+    Text,
+    Binary,
+}
+
+impl FromStr for LogFormat {
+    type Err = serde_yaml::Error;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        serde_yaml::from_str(s)
+    }
+}
+
+#[derive(Debug, Clone, Copy, Hash, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "kebab-case")]
+pub enum EventQueueMode {
+    Heap,
+    TimingWheel,
+}
+
+impl FromStr for EventQueueMode {
+    type Err = serde_yaml::Error;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        serde_yaml::from_str(s)
+    }
+}
+
 #[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
 #[serde(rename_all = "kebab-case")]
 pub enum Compression {
@@ -977,6 +1527,35 @@ pub enum GraphSource {
     Inline(String),
 }
 
+/// A change to the network at a simulation time. Changes either a host's bandwidth or the
+/// properties of a graph edge.
+#[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
+#[serde(deny_unknown_fields)]
+pub struct NetworkChange {
+    /// The simulation time of the change
+    pub time: units::Time<units::TimePrefix>,
+    /// The name of the host whose bandwidth changes
+    pub host: Option<String>,
+    /// The host's new downstream bandwidth
+    pub bandwidth_down: Option<units::BitsPerSec<units::SiPrefixUpper>>,
+    /// The host's new upstream bandwidth
+    pub bandwidth_up: Option<units::BitsPerSec<units::SiPrefixUpper>>,
+    /// The source and target node ids of the graph edge that changes
+    pub edge: Option<[u32; 2]>,
+    /// The edge's new latency
+    pub latency: Option<units::Time<units::TimePrefix>>,
+    /// The edge's new packet loss
+    pub packet_loss: Option<f32>,
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "kebab-case")]
+pub enum NetworkScheduleSource {
+    /// A YAML file with a list of changes
+    File(FileSource),
+    Inline(Vec<NetworkChange>),
+}
+
 #[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
 // we use "kebab-case" for other shadow options, but are leaving this as "snake_case" for backwards
 // compatibility
@@ -1148,6 +1727,7 @@ pub enum StraceLoggingMode {
     Off,
     Standard,
     Deterministic,
+    Binary,
 }
 
 impl FromStr for StraceLoggingMode {
@@ -1296,6 +1876,11 @@ fn default_args_empty() -> ProcessArgs {
     ProcessArgs::Str("".to_string())
 }
 
+/// Helper function for serde default traffic `packet_size`.
+fn default_traffic_packet_size() -> units::Bytes<units::SiPrefixUpper> {
+    units::Bytes::new(1000, units::SiPrefixUpper::Base)
+}
+
 /// Helper function for serde default `shutdown_signal`.
 fn default_shutdown_signal() -> Signal {
     Signal(nix::sys::signal::Signal::SIGTERM)
@@ -1607,10 +2192,28 @@ mod export {
         config.experimental.use_syscall_counters.unwrap()
     }
 
+    #[no_mangle]
+    pub extern "C" fn config_getBusyPollThreshold(config: *const ConfigOptions) -> u32 {
+        assert!(!config.is_null());
+        let config = unsafe { &*config };
+        config
+            .experimental
+            .busy_poll_threshold
+            .flatten()
+            .map_or(0, |x| x.get())
+    }
+
     #[no_mangle]
     pub extern "C" fn config_getUseMemoryManager(config: *const ConfigOptions) -> bool {
         assert!(!config.is_null());
         let config = unsafe { &*config };
         config.experimental.use_memory_manager.unwrap()
     }
+
+    #[no_mangle]
+    pub extern "C" fn config_getLogPacketStatus(config: *const ConfigOptions) -> bool {
+        assert!(!config.is_null());
+        let config = unsafe { &*config };
+        config.experimental.log_packet_status.unwrap()
+    }
 }
@@ -0,0 +1,343 @@
+//! A timeline trace of what Shadow's worker threads were doing, written in the Chrome trace event
+//! format so that it can be opened in Perfetto (<https://ui.perfetto.dev>) or `chrome://tracing`.
+//!
+//! The trace has a span for each scheduling round on each worker thread, a span for each host that
+//! the thread ran in the round, spans for the syscalls that Shadow handled and the time that it
+//! waited for managed threads to run, and a span for the time that the thread waited at the round
+//! barrier. Packets between hosts are drawn as flow arrows from the span that sent the packet to
+//! the span that received it.
+//!
+//! Each worker thread appends spans to its own buffer, so recording doesn't need any
+//! synchronization between threads. A trace of every round of a large simulation would be huge, so
+//! only one of every few rounds is recorded. Whether the current round is being recorded is a
+//! single relaxed load, so the hooks are cheap when it isn't. Packets usually arrive in a later round
+//! than they were sent in, so they're sampled by packet rather than by round: one of every few
+//! packets is recorded at both ends, chosen by a hash of its source host and event id.
+
+use std::cell::RefCell;
+use std::io::Write;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::{Mutex, OnceLock};
+use std::time::Instant;
+
+use shadow_shim_helper_rs::HostId;
+
+/// Whether spans that start now should be recorded.
+static RECORDING: AtomicBool = AtomicBool::new(false);
+
+/// One of every this many packets is recorded, or none if 0.
+static PACKET_INTERVAL: AtomicU64 = AtomicU64::new(0);
+
+/// The real time that trace timestamps are relative to.
+static EPOCH: OnceLock<Instant> = OnceLock::new();
+
+/// The events of every thread that has finished recording.
+static FINISHED: Mutex<Vec<ThreadEvents>> = Mutex::new(Vec::new());
+
+thread_local! {
+    static EVENTS: RefCell<Option<ThreadEvents>> = const { RefCell::new(None) };
+    /// When this thread started waiting at the round barrier, if it's in a recorded round.
+    static WAIT_START: RefCell<Option<u64>> = const { RefCell::new(None) };
+}
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+enum EventKind {
+    /// A span with a duration in nanoseconds.
+    Span(u64),
+    /// The start of a packet's flow arrow.
+    FlowStart,
+    /// The end of a packet's flow arrow.
+    FlowEnd,
+}
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+struct Event {
+    name: &'static str,
+    host: Option<HostId>,
+    /// Nanoseconds since [`EPOCH`].
+    start: u64,
+    kind: EventKind,
+    /// Identifies a packet by its source host and the event id on that host.
+    flow: Option<(HostId, u64)>,
+}
+
+struct ThreadEvents {
+    thread: u32,
+    name: String,
+    events: Vec<Event>,
+}
+
+fn now() -> u64 {
+    let epoch = EPOCH.get_or_init(Instant::now);
+    epoch.elapsed().as_nanos().try_into().unwrap()
+}
+
+fn push(event: Event) {
+    EVENTS.with(|events| {
+        if let Some(events) = &mut *events.borrow_mut() {
+            events.events.push(event);
+        }
+    });
+}
+
+/// Records a span on the current thread when dropped.
+#[must_use]
+pub struct SpanGuard {
+    name: &'static str,
+    host: Option<HostId>,
+    /// `None` if the span isn't being recorded.
+    start: Option<u64>,
+}
+
+impl Drop for SpanGuard {
+    fn drop(&mut self) {
+        if let Some(start) = self.start {
+            push(Event {
+                name: self.name,
+                host: self.host,
+                start,
+                kind: EventKind::Span(now().saturating_sub(start)),
+                flow: None,
+            });
+        }
+    }
+}
+
+/// Record a span named `name` on the current thread, from now until the returned guard is dropped.
+pub fn span(name: &'static str, host: Option<HostId>) -> SpanGuard {
+    let start = RECORDING.load(Ordering::Relaxed).then(now);
+    SpanGuard { name, host, start }
+}
+
+/// Set whether spans that start from now on are recorded. Should be called between rounds.
+pub fn set_recording(recording: bool) {
+    RECORDING.store(recording, Ordering::Relaxed);
+}
+
+/// Record one of every `interval` packets, independently of which rounds are recorded.
+pub fn set_packet_interval(interval: u64) {
+    PACKET_INTERVAL.store(interval, Ordering::Relaxed);
+}
+
+/// Whether the packet identified by `src_host` and `event_id` is recorded. The sender and the
+/// receiver make the same choice without having to communicate.
+fn packet_is_sampled(src_host: HostId, event_id: u64) -> bool {
+    let interval = PACKET_INTERVAL.load(Ordering::Relaxed);
+    if interval == 0 {
+        return false;
+    }
+
+    // the splitmix64 finalizer, so that packets with consecutive event ids aren't sampled in step
+    let mut x = (u64::from(u32::from(src_host)) << 40) ^ event_id;
+    x = (x ^ (x >> 30)).wrapping_mul(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)).wrapping_mul(0x94d049bb133111eb);
+    x ^= x >> 31;
+
+    x % interval == 0
+}
+
+/// Record that the packet identified by `src_host` and `event_id` was sent from the current span.
+pub fn packet_sent(src_host: HostId, event_id: u64) {
+    if packet_is_sampled(src_host, event_id) {
+        push(Event {
+            name: "packet",
+            host: Some(src_host),
+            start: now(),
+            kind: EventKind::FlowStart,
+            flow: Some((src_host, event_id)),
+        });
+    }
+}
+
+/// Record that the packet identified by `src_host` and `event_id` was received in the current span.
+/// If the packet was sent or received in a round that isn't recorded, that end of the arrow isn't
+/// attached to a span.
+pub fn packet_received(src_host: HostId, event_id: u64) {
+    if packet_is_sampled(src_host, event_id) {
+        push(Event {
+            name: "packet",
+            host: None,
+            start: now(),
+            kind: EventKind::FlowEnd,
+            flow: Some((src_host, event_id)),
+        });
+    }
+}
+
+/// Start waiting at the round barrier. The wait is recorded when [`end_barrier_wait`] is next
+/// called on this thread.
+pub fn start_barrier_wait() {
+    let start = RECORDING.load(Ordering::Relaxed).then(now);
+    WAIT_START.with(|x| *x.borrow_mut() = start);
+}
+
+/// Stop waiting at the round barrier.
+pub fn end_barrier_wait() {
+    if let Some(start) = WAIT_START.with(|x| x.borrow_mut().take()) {
+        push(Event {
+            name: "barrier wait",
+            host: None,
+            start,
+            kind: EventKind::Span(now().saturating_sub(start)),
+            flow: None,
+        });
+    }
+}
+
+/// Start buffering events on the current thread, which will be shown in the trace as `thread`.
+pub fn start_thread(thread: u32) {
+    // start the clock before any thread records an event
+    now();
+    let name = std::thread::current()
+        .name()
+        .map(str::to_string)
+        .unwrap_or_else(|| format!("worker {thread}"));
+    EVENTS.with(|events| {
+        *events.borrow_mut() = Some(ThreadEvents {
+            thread,
+            name,
+            events: Vec::new(),
+        })
+    });
+}
+
+/// Stop buffering events on the current thread, and keep its events for [`write_trace`].
+pub fn stop_thread() {
+    // the thread has been waiting since the last round, which isn't a barrier wait
+    WAIT_START.with(|x| x.borrow_mut().take());
+    if let Some(events) = EVENTS.with(|events| events.borrow_mut().take()) {
+        FINISHED.lock().unwrap().push(events);
+    }
+}
+
+/// Write a string as a JSON string literal.
+fn write_json_str(mut writer: impl Write, s: &str) -> std::io::Result<()> {
+    write!(writer, "\"")?;
+    for c in s.chars() {
+        match c {
+            '"' => write!(writer, "\\\"")?,
+            '\\' => write!(writer, "\\\\")?,
+            c if u32::from(c) < 0x20 => write!(writer, "\\u{:04x}", u32::from(c))?,
+            c => write!(writer, "{c}")?,
+        }
+    }
+    write!(writer, "\"")
+}
+
+/// Write the events of all threads that have stopped recording to `writer` as a Chrome trace.
+/// `host_names` is indexed by host id.
+pub fn write_trace(mut writer: impl Write, host_names: &[String]) -> std::io::Result<()> {
+    let mut threads = FINISHED.lock().unwrap();
+    threads.sort_by_key(|x| x.thread);
+
+    let host_name = |host: HostId| host_names[usize::try_from(u32::from(host)).unwrap()].as_str();
+
+    // timestamps are in microseconds
+    let us = |ns: u64| format!("{}.{:03}", ns / 1000, ns % 1000);
+
+    writeln!(writer, "{{\"displayTimeUnit\":\"ns\",\"traceEvents\":[")?;
+    let mut first = true;
+    for thread in threads.iter() {
+        if !first {
+            writeln!(writer, ",")?;
+        }
+        first = false;
+
+        write!(
+            writer,
+            "{{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":",
+            thread.thread
+        )?;
+        write_json_str(&mut writer, &thread.name)?;
+        write!(writer, "}}}}")?;
+
+        for event in &thread.events {
+            writeln!(writer, ",")?;
+            write!(writer, "{{\"name\":\"{}\",", event.name)?;
+            match event.kind {
+                EventKind::Span(dur) => write!(writer, "\"ph\":\"X\",\"dur\":{},", us(dur))?,
+                EventKind::FlowStart => write!(writer, "\"ph\":\"s\",\"cat\":\"packet\",")?,
+                EventKind::FlowEnd => {
+                    write!(writer, "\"ph\":\"f\",\"bp\":\"e\",\"cat\":\"packet\",")?
+                }
+            }
+            if let Some((host, event_id)) = event.flow {
+                write!(writer, "\"id\":\"{}.{event_id}\",", u32::from(host))?;
+            }
+            write!(
+                writer,
+                "\"ts\":{},\"pid\":1,\"tid\":{}",
+                us(event.start),
+                thread.thread
+            )?;
+            if let Some(host) = event.host {
+                write!(writer, ",\"args\":{{\"host\":")?;
+                write_json_str(&mut writer, host_name(host))?;
+                write!(writer, "}}")?;
+            }
+            write!(writer, "}}")?;
+        }
+    }
+    writeln!(writer, "\n]}}")?;
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_json_str() {
+        let mut out = Vec::new();
+        write_json_str(&mut out, "a\"b\\c\n").unwrap();
+        assert_eq!(std::str::from_utf8(&out).unwrap(), r#""a\"b\\c\u000a""#);
+    }
+
+    #[test]
+    fn test_span_only_recorded_when_recording() {
+        start_thread(0);
+
+        set_recording(false);
+        drop(span("ignored", None));
+
+        set_recording(true);
+        drop(span("recorded", Some(HostId::from(0))));
+        set_recording(false);
+
+        let events = EVENTS.with(|events| events.borrow().as_ref().unwrap().events.clone());
+        assert_eq!(events.len(), 1);
+        assert_eq!(events[0].name, "recorded");
+        assert_eq!(events[0].host, Some(HostId::from(0)));
+        assert!(matches!(events[0].kind, EventKind::Span(_)));
+
+        EVENTS.with(|events| events.borrow_mut().take());
+    }
+
+    #[test]
+    fn test_packets_sampled_regardless_of_round() {
+        start_thread(0);
+        set_recording(false);
+        set_packet_interval(4);
+
+        let sampled: Vec<u64> = (0..1000)
+            .filter(|&id| packet_is_sampled(HostId::from(1), id))
+            .collect();
+        assert!((150..350).contains(&sampled.len()));
+
+        // both ends of a sampled packet are recorded even though the round isn't
+        packet_sent(HostId::from(1), sampled[0]);
+        packet_received(HostId::from(1), sampled[0]);
+
+        set_packet_interval(0);
+        packet_sent(HostId::from(1), sampled[1]);
+
+        let events = EVENTS.with(|events| events.borrow().as_ref().unwrap().events.clone());
+        assert_eq!(events.len(), 2);
+        assert_eq!(events[0].kind, EventKind::FlowStart);
+        assert_eq!(events[1].kind, EventKind::FlowEnd);
+        assert_eq!(events[0].flow, events[1].flow);
+
+        EVENTS.with(|events| events.borrow_mut().take());
+    }
+}
@@ -18,13 +18,23 @@ impl Event {
     /// A new packet event, which is an event for packets arriving from the Internet. Packet events
     /// do not include packets on localhost.
     pub fn new_packet(packet: PacketRc, time: EmulatedTime, src_host: &Host) -> Self {
+        Self::new_packet_with_source(packet, time, (src_host.id(), src_host.get_new_event_id()))
+    }
+
+    /// Like [`Event::new_packet()`], but with the source host and event id given rather than drawn
+    /// from the source host, such as for a packet that was sent in a recorded simulation.
+    pub fn new_packet_with_source(
+        packet: PacketRc,
+        time: EmulatedTime,
+        (src_host_id, src_host_event_id): (HostId, u64),
+    ) -> Self {
         Self {
             magic: Magic::new(),
             time,
             data: EventData::Packet(PacketEventData {
                 packet,
-                src_host_id: src_host.id(),
-                src_host_event_id: src_host.get_new_event_id(),
+                src_host_id,
+                src_host_event_id,
             }),
             _counter: ObjectCounter::new("Event"),
         }
@@ -33,17 +43,50 @@ impl Event {
     /// A new local event, which is an event that was generated locally by the host itself (timers,
     /// localhost packets, etc).
     pub fn new_local(task: TaskRef, time: EmulatedTime, host: &Host) -> Self {
+        Self::new_local_with_id(task, time, host.get_new_event_id(), false)
+    }
+
+    /// Like [`Event::new_local()`], but the event has a [handle](Self::handle) that can be used to
+    /// cancel it.
+    pub fn new_cancellable_local(task: TaskRef, time: EmulatedTime, host: &Host) -> Self {
+        Self::new_local_with_id(task, time, host.get_new_event_id(), true)
+    }
+
+    /// Like [`Event::new_local()`], but with the given event id rather than one drawn from the
+    /// host. The id must not be one that the host will draw, or that's used by another event.
+    pub fn new_local_with_reserved_id(task: TaskRef, time: EmulatedTime, event_id: u64) -> Self {
+        Self::new_local_with_id(task, time, event_id, false)
+    }
+
+    fn new_local_with_id(
+        task: TaskRef,
+        time: EmulatedTime,
+        event_id: u64,
+        cancellable: bool,
+    ) -> Self {
         Self {
             magic: Magic::new(),
             time,
             data: EventData::Local(LocalEventData {
                 task,
-                event_id: host.get_new_event_id(),
+                event_id,
+                cancellable,
             }),
             _counter: ObjectCounter::new("Event"),
         }
     }
 
+    /// A new local event with the given event id, for tests that don't have a host.
+    #[cfg(test)]
+    pub fn new_local_for_test(
+        task: TaskRef,
+        time: EmulatedTime,
+        event_id: u64,
+        cancellable: bool,
+    ) -> Self {
+        Self::new_local_with_id(task, time, event_id, cancellable)
+    }
+
     pub fn time(&self) -> EmulatedTime {
         self.magic.debug_check();
         self.time
@@ -54,6 +97,28 @@ impl Event {
         self.time = time;
     }
 
+    /// A handle that can be used to cancel the event, or `None` if this isn't a cancellable local
+    /// event.
+    pub fn handle(&self) -> Option<EventHandle> {
+        self.magic.debug_check();
+        match &self.data {
+            EventData::Local(data) if data.cancellable => Some(EventHandle {
+                event_id: data.event_id,
+            }),
+            _ => None,
+        }
+    }
+
+    /// The source host and the event id on that host of a packet event, or `None` if this isn't a
+    /// packet event.
+    pub fn packet_source(&self) -> Option<(HostId, u64)> {
+        self.magic.debug_check();
+        match &self.data {
+            EventData::Packet(data) => Some(data.source()),
+            EventData::Local(_) => None,
+        }
+    }
+
     /// The event data.
     pub fn data(self) -> EventData {
         self.magic.debug_check();
@@ -98,6 +163,19 @@ impl PartialOrd for Event {
     }
 }
 
+/// Identifies a local event on its host, so that it can be cancelled. See
+/// [`Host::cancel_event()`].
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub struct EventHandle {
+    event_id: u64,
+}
+
+impl EventHandle {
+    pub fn event_id(&self) -> u64 {
+        self.event_id
+    }
+}
+
 /// Data for an event. Different event types will contain different data.
 #[derive(Debug, PartialEq, Eq, PartialOrd)]
 pub enum EventData {
@@ -120,6 +198,16 @@ pub struct PacketEventData {
 pub struct LocalEventData {
     task: TaskRef,
     event_id: u64,
+    /// Whether the event was given a handle that can be used to cancel it.
+    cancellable: bool,
+}
+
+impl PacketEventData {
+    /// The host that sent the packet, and the event id on that host. Together they identify the
+    /// packet.
+    pub fn source(&self) -> (HostId, u64) {
+        (self.src_host_id, self.src_host_event_id)
+    }
 }
 
 impl From<PacketEventData> for PacketRc {
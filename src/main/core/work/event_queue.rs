@@ -1,22 +1,102 @@
 use std::cmp::Reverse;
 use std::collections::binary_heap::BinaryHeap;
+use std::collections::HashSet;
 
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
-use super::event::Event;
+use super::event::{Event, EventHandle};
+use crate::core::support::configuration::EventQueueMode;
 
 /// A queue of [`Event`]s ordered by their times.
+///
+/// Cancellable local events can be cancelled with [`EventQueue::cancel()`]. A cancelled event is
+/// skipped when it reaches the front of the queue, and if cancelled events make up a large
+/// fraction of the queue, they're all removed at once.
 #[derive(Debug)]
 pub struct EventQueue {
-    queue: BinaryHeap<Reverse<PanickingOrd<Event>>>,
+    queue: Queue<PanickingOrd<Event>>,
     last_popped_event_time: EmulatedTime,
+    /// The ids of the cancellable events in the queue that haven't been cancelled.
+    cancellable: HashSet<u64>,
+    /// The ids of the cancelled events that are still in the queue.
+    cancelled: HashSet<u64>,
+}
+
+/// Queues with more than this many cancelled events are compacted if at least half of their
+/// events have been cancelled.
+const MIN_CANCELLED_TO_COMPACT: usize = 64;
+
+#[derive(Debug)]
+enum Queue<T: Ord + Timed> {
+    Heap(BinaryHeap<Reverse<T>>),
+    TimingWheel(TimingWheel<T>),
+}
+
+impl<T: Ord + Timed> Queue<T> {
+    fn push(&mut self, item: T) {
+        match self {
+            Queue::Heap(heap) => heap.push(Reverse(item)),
+            Queue::TimingWheel(wheel) => wheel.push(item),
+        }
+    }
+
+    fn pop(&mut self) -> Option<T> {
+        match self {
+            Queue::Heap(heap) => heap.pop().map(|x| x.0),
+            Queue::TimingWheel(wheel) => wheel.pop(),
+        }
+    }
+
+    fn peek(&self) -> Option<&T> {
+        match self {
+            Queue::Heap(heap) => heap.peek().map(|x| &x.0),
+            Queue::TimingWheel(wheel) => wheel.peek(),
+        }
+    }
+
+    fn len(&self) -> usize {
+        match self {
+            Queue::Heap(heap) => heap.len(),
+            Queue::TimingWheel(wheel) => wheel.len(),
+        }
+    }
+
+    /// Keep only the items for which `f` returns true.
+    fn retain(&mut self, mut f: impl FnMut(&T) -> bool) {
+        match self {
+            Queue::Heap(heap) => heap.retain(|x| f(&x.0)),
+            Queue::TimingWheel(wheel) => wheel.retain(f),
+        }
+    }
+
+    fn shrink_to_fit(&mut self) {
+        match self {
+            Queue::Heap(heap) => heap.shrink_to_fit(),
+            Queue::TimingWheel(wheel) => wheel.shrink_to_fit(),
+        }
+    }
 }
 
 impl EventQueue {
     pub fn new() -> Self {
+        Self::new_with_mode(EventQueueMode::Heap)
+    }
+
+    pub fn new_with_mode(mode: EventQueueMode) -> Self {
+        let queue = match mode {
+            EventQueueMode::Heap => Queue::Heap(BinaryHeap::new()),
+            EventQueueMode::TimingWheel => Queue::TimingWheel(TimingWheel::new(
+                TIMING_WHEEL_SLOT_WIDTH,
+                TIMING_WHEEL_NUM_SLOTS,
+            )),
+        };
+
         Self {
-            queue: BinaryHeap::new(),
+            queue,
             last_popped_event_time: EmulatedTime::SIMULATION_START,
+            cancellable: HashSet::new(),
+            cancelled: HashSet::new(),
         }
     }
 
@@ -26,25 +106,115 @@ impl EventQueue {
     /// (`event_a.partial_cmp(&event_b) == None`). Will be non-deterministic if two events are
     /// pushed that are equal (`event_a == event_b`).
     pub fn push(&mut self, event: Event) {
-        self.queue.push(Reverse(event.into()));
+        if let Some(handle) = event.handle() {
+            self.cancellable.insert(handle.event_id());
+        }
+        self.queue.push(event.into());
     }
 
     /// Pop the earliest [`Event`] from the queue.
     pub fn pop(&mut self) -> Option<Event> {
-        let event = self.queue.pop().map(|x| x.0.into_inner());
+        self.skip_cancelled();
+        let event = self.queue.pop();
+        self.popped(event)
+    }
+
+    /// Pop the earliest [`Event`] from the queue if it's earlier than `until`. This is equivalent
+    /// to checking [`next_event_time()`](Self::next_event_time) and then calling
+    /// [`pop()`](Self::pop), but only looks up the earliest event once.
+    pub fn pop_before(&mut self, until: EmulatedTime) -> Option<Event> {
+        self.skip_cancelled();
+        if self.queue.peek()?.time() >= until {
+            return None;
+        }
+        let event = self.queue.pop();
+        self.popped(event)
+    }
+
+    fn popped(&mut self, event: Option<PanickingOrd<Event>>) -> Option<Event> {
+        let event = event.map(|x| x.into_inner());
 
-        // make sure time never moves backward
         if let Some(ref event) = event {
+            // make sure time never moves backward
             assert!(event.time() >= self.last_popped_event_time);
             self.last_popped_event_time = event.time();
+
+            // the event is no longer in the queue, so it can't be cancelled unless it's pushed
+            // again
+            if let Some(handle) = event.handle() {
+                self.cancellable.remove(&handle.event_id());
+            }
         }
 
         event
     }
 
     /// The time of the next [`Event`] (the time of the earliest event in the queue).
-    pub fn next_event_time(&self) -> Option<EmulatedTime> {
-        self.queue.peek().map(|x| x.0.time())
+    pub fn next_event_time(&mut self) -> Option<EmulatedTime> {
+        self.skip_cancelled();
+        self.queue.peek().map(|x| x.time())
+    }
+
+    /// The number of events in the queue, including cancelled events that haven't been removed
+    /// yet.
+    pub fn len(&self) -> usize {
+        self.queue.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Cancel the event with the handle `handle`, so that it's never popped. Does nothing if the
+    /// event isn't in the queue, such as if it has already been popped.
+    pub fn cancel(&mut self, handle: EventHandle) {
+        if !self.cancellable.remove(&handle.event_id()) {
+            return;
+        }
+        self.cancelled.insert(handle.event_id());
+
+        if self.cancelled.len() > MIN_CANCELLED_TO_COMPACT
+            && self.cancelled.len() * 2 > self.queue.len()
+        {
+            self.compact();
+        }
+    }
+
+    /// Release any memory that the queue has allocated but isn't using, such as after a burst of
+    /// events. The queue will allocate again as needed.
+    pub fn shrink_to_fit(&mut self) {
+        self.skip_cancelled();
+        self.queue.shrink_to_fit();
+        self.cancellable.shrink_to_fit();
+        self.cancelled.shrink_to_fit();
+    }
+
+    /// Drop cancelled events from the front of the queue.
+    fn skip_cancelled(&mut self) {
+        if self.cancelled.is_empty() {
+            return;
+        }
+        while let Some(event) = self.queue.peek() {
+            let Some(handle) = event.handle() else {
+                break;
+            };
+            if !self.cancelled.remove(&handle.event_id()) {
+                break;
+            }
+            self.queue.pop();
+        }
+    }
+
+    /// Remove all cancelled events from the queue. The events aren't popped, so this doesn't
+    /// affect the order or the timing wheel's position.
+    fn compact(&mut self) {
+        let cancelled = &self.cancelled;
+        self.queue.retain(|event| {
+            !event
+                .handle()
+                .is_some_and(|x| cancelled.contains(&x.event_id()))
+        });
+        self.cancelled.clear();
     }
 }
 
@@ -54,6 +224,190 @@ impl Default for EventQueue {
     }
 }
 
+/// The width of each slot of a host's timing wheel. Most packet latencies and timers are at least
+/// a millisecond apart, so each slot should usually hold few events.
+pub const TIMING_WHEEL_SLOT_WIDTH: SimulationTime = SimulationTime::MILLISECOND;
+
+/// The number of slots in a host's timing wheel. Events more than this many slots past the most
+/// recently popped event are kept in an overflow heap until the wheel reaches them.
+pub const TIMING_WHEEL_NUM_SLOTS: usize = 256;
+
+/// Something that is scheduled at a time.
+pub trait Timed {
+    fn time(&self) -> EmulatedTime;
+}
+
+impl Timed for PanickingOrd<Event> {
+    fn time(&self) -> EmulatedTime {
+        self.0.time()
+    }
+}
+
+/// A timing wheel (also known as a calendar queue) of items ordered by [`Ord`], where an item's
+/// time must be consistent with its order (`a < b` implies `a.time() <= b.time()`).
+///
+/// Items are stored in a ring of fixed-width time slots, which together span the time from the
+/// slot of the most recently popped item up to the wheel's horizon. Each slot is a small heap, so
+/// items in the same slot keep their total order. Items past the horizon are stored in an
+/// overflow heap, and are moved into the wheel as the wheel advances. Pushing an item is
+/// usually `O(1)` rather than `O(log n)`, and popping an item only scans the empty slots between
+/// it and the previous item.
+///
+/// This is public so that it can be benchmarked without creating [`Event`]s, which need a host.
+#[derive(Debug)]
+pub struct TimingWheel<T: Ord + Timed> {
+    slots: Vec<BinaryHeap<Reverse<T>>>,
+    slot_width_ns: u64,
+    /// The absolute slot number (time divided by slot width) of the first slot in the wheel. No
+    /// item in the wheel or overflow heap is earlier than this slot.
+    base: u64,
+    /// The absolute slot number of the earliest non-empty slot, or `None` if all slots are empty.
+    first_non_empty: Option<u64>,
+    /// Items at or past the horizon (`base + slots.len()`).
+    overflow: BinaryHeap<Reverse<T>>,
+    len: usize,
+}
+
+impl<T: Ord + Timed> TimingWheel<T> {
+    pub fn new(slot_width: SimulationTime, num_slots: usize) -> Self {
+        assert!(num_slots > 0);
+        let slot_width_ns = u64::try_from(slot_width.as_nanos()).unwrap();
+        assert!(slot_width_ns > 0);
+
+        Self {
+            slots: (0..num_slots).map(|_| BinaryHeap::new()).collect(),
+            slot_width_ns,
+            base: 0,
+            first_non_empty: None,
+            overflow: BinaryHeap::new(),
+            len: 0,
+        }
+    }
+
+    fn abs_slot(&self, time: EmulatedTime) -> u64 {
+        let ns = u64::try_from((time - EmulatedTime::SIMULATION_START).as_nanos()).unwrap();
+        ns / self.slot_width_ns
+    }
+
+    fn horizon(&self) -> u64 {
+        self.base + u64::try_from(self.slots.len()).unwrap()
+    }
+
+    fn slot_mut(&mut self, abs_slot: u64) -> &mut BinaryHeap<Reverse<T>> {
+        let len = u64::try_from(self.slots.len()).unwrap();
+        &mut self.slots[usize::try_from(abs_slot % len).unwrap()]
+    }
+
+    /// Insert an item into the wheel or overflow heap without updating `len`.
+    fn insert(&mut self, item: T) {
+        let abs_slot = self.abs_slot(item.time());
+        assert!(
+            abs_slot >= self.base,
+            "Item is earlier than the timing wheel"
+        );
+
+        if abs_slot >= self.horizon() {
+            self.overflow.push(Reverse(item));
+            return;
+        }
+
+        self.slot_mut(abs_slot).push(Reverse(item));
+        self.first_non_empty = Some(match self.first_non_empty {
+            Some(x) => std::cmp::min(x, abs_slot),
+            None => abs_slot,
+        });
+    }
+
+    pub fn push(&mut self, item: T) {
+        self.insert(item);
+        self.len += 1;
+    }
+
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    pub fn peek(&self) -> Option<&T> {
+        // any item in the wheel is earlier than every item in the overflow heap
+        match self.first_non_empty {
+            Some(abs_slot) => {
+                let len = u64::try_from(self.slots.len()).unwrap();
+                let slot = &self.slots[usize::try_from(abs_slot % len).unwrap()];
+                Some(&slot.peek().unwrap().0)
+            }
+            None => self.overflow.peek().map(|x| &x.0),
+        }
+    }
+
+    /// Keep only the items for which `f` returns true. The wheel doesn't move, so items may still
+    /// be pushed at any time that they could have been before.
+    pub fn retain(&mut self, mut f: impl FnMut(&T) -> bool) {
+        for slot in &mut self.slots {
+            slot.retain(|x| f(&x.0));
+        }
+        self.overflow.retain(|x| f(&x.0));
+
+        self.len = self.slots.iter().map(|x| x.len()).sum::<usize>() + self.overflow.len();
+
+        self.first_non_empty = None;
+        if self.len > self.overflow.len() {
+            let mut abs_slot = self.base;
+            while self.slot_mut(abs_slot).is_empty() {
+                abs_slot += 1;
+            }
+            debug_assert!(abs_slot < self.horizon());
+            self.first_non_empty = Some(abs_slot);
+        }
+    }
+
+    /// Release the unused capacity of every slot and of the overflow heap.
+    pub fn shrink_to_fit(&mut self) {
+        for slot in &mut self.slots {
+            slot.shrink_to_fit();
+        }
+        self.overflow.shrink_to_fit();
+    }
+
+    pub fn pop(&mut self) -> Option<T> {
+        let item = match self.first_non_empty {
+            Some(abs_slot) => self.slot_mut(abs_slot).pop().unwrap().0,
+            None => self.overflow.pop()?.0,
+        };
+        self.len -= 1;
+
+        // no remaining item is earlier than the item we popped, so we can move the wheel forward
+        let old_horizon = self.horizon();
+        self.base = self.abs_slot(item.time());
+
+        // find the new earliest non-empty slot, starting from the slot of the item we popped
+        self.first_non_empty = None;
+        if self.len > self.overflow.len() {
+            let mut abs_slot = self.base;
+            while self.slot_mut(abs_slot).is_empty() {
+                abs_slot += 1;
+            }
+            debug_assert!(abs_slot < old_horizon);
+            self.first_non_empty = Some(abs_slot);
+        }
+
+        // move any overflow items that are now within the horizon into the wheel
+        let horizon = self.horizon();
+        while let Some(x) = self.overflow.peek() {
+            if self.abs_slot(x.0.time()) >= horizon {
+                break;
+            }
+            let item = self.overflow.pop().unwrap().0;
+            self.insert(item);
+        }
+
+        Some(item)
+    }
+}
+
 /// A wrapper type that implements [`Ord`] for types that implement [`PartialOrd`]. If the two
 /// objects cannot be compared (`PartialOrd::partial_cmp` returns `None`), the comparison will
 /// panic.
@@ -97,3 +451,245 @@ impl<T: PartialOrd + Eq> std::ops::DerefMut for PanickingOrd<T> {
         &mut self.0
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::core::work::task::TaskRef;
+
+    #[derive(Debug, PartialEq, Eq, PartialOrd, Ord)]
+    struct Item {
+        time: EmulatedTime,
+        id: u32,
+    }
+
+    impl Timed for Item {
+        fn time(&self) -> EmulatedTime {
+            self.time
+        }
+    }
+
+    fn item(ns: u64, id: u32) -> Item {
+        Item {
+            time: EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(ns),
+            id,
+        }
+    }
+
+    fn nanos(time: EmulatedTime) -> u64 {
+        u64::try_from((time - EmulatedTime::SIMULATION_START).as_nanos()).unwrap()
+    }
+
+    fn drain(wheel: &mut TimingWheel<Item>) -> Vec<(u64, u32)> {
+        std::iter::from_fn(|| {
+            let peeked = wheel.peek().map(|x| (x.time, x.id));
+            let item = wheel.pop();
+            assert_eq!(peeked, item.as_ref().map(|x| (x.time, x.id)));
+            item
+        })
+        .map(|x| (nanos(x.time), x.id))
+        .collect()
+    }
+
+    #[test]
+    fn test_timing_wheel_order() {
+        let mut wheel = TimingWheel::new(SimulationTime::from_nanos(10), 4);
+        assert!(wheel.peek().is_none());
+        assert!(wheel.pop().is_none());
+
+        // items in the same slot, across several slots, and past the horizon
+        for (ns, id) in [
+            (35, 0),
+            (5, 1),
+            (5, 0),
+            (1000, 0),
+            (12, 0),
+            (41, 0),
+            (39, 0),
+            (2, 0),
+        ] {
+            wheel.push(item(ns, id));
+        }
+
+        assert_eq!(
+            drain(&mut wheel),
+            [
+                (2, 0),
+                (5, 0),
+                (5, 1),
+                (12, 0),
+                (35, 0),
+                (39, 0),
+                (41, 0),
+                (1000, 0)
+            ],
+        );
+    }
+
+    #[test]
+    fn test_timing_wheel_interleaved() {
+        let mut wheel = TimingWheel::new(SimulationTime::from_nanos(10), 4);
+
+        wheel.push(item(100, 0));
+        wheel.push(item(15, 0));
+        assert_eq!(wheel.pop(), Some(item(15, 0)));
+
+        // earlier than the next item, but not earlier than the last popped item
+        wheel.push(item(15, 1));
+        wheel.push(item(48, 0));
+        wheel.push(item(60, 0));
+        assert_eq!(wheel.pop(), Some(item(15, 1)));
+        assert_eq!(wheel.pop(), Some(item(48, 0)));
+
+        // the wheel has advanced, so these are now within the horizon
+        wheel.push(item(70, 0));
+        wheel.push(item(55, 0));
+        assert_eq!(drain(&mut wheel), [(55, 0), (60, 0), (70, 0), (100, 0)]);
+    }
+
+    #[test]
+    fn test_timing_wheel_matches_heap() {
+        use rand::{Rng, SeedableRng};
+
+        let mut rng = rand_xoshiro::Xoshiro256PlusPlus::seed_from_u64(0);
+        let mut wheel = TimingWheel::new(SimulationTime::from_nanos(7), 16);
+        let mut heap = BinaryHeap::new();
+        let mut now = 0;
+
+        for id in 0..10_000 {
+            if rng.gen_bool(0.6) {
+                let ns = now + rng.gen_range(0..500);
+                wheel.push(item(ns, id));
+                heap.push(Reverse(item(ns, id)));
+            } else {
+                let expected = heap.pop().map(|x| x.0);
+                assert_eq!(wheel.peek(), expected.as_ref());
+                assert_eq!(wheel.pop(), expected);
+                if let Some(x) = expected {
+                    now = nanos(x.time);
+                }
+            }
+        }
+
+        let rest: Vec<_> = std::iter::from_fn(|| heap.pop())
+            .map(|x| (nanos(x.0.time), x.0.id))
+            .collect();
+        assert_eq!(drain(&mut wheel), rest);
+    }
+
+    fn event(ms: u64, id: u64, cancellable: bool) -> Event {
+        let time = EmulatedTime::SIMULATION_START + SimulationTime::from_millis(ms);
+        Event::new_local_for_test(TaskRef::new(|_| {}), time, id, cancellable)
+    }
+
+    /// The event's id, or `None` if it isn't cancellable.
+    fn event_id(event: &Event) -> Option<u64> {
+        event.handle().map(|x| x.event_id())
+    }
+
+    fn check_cancel(mode: EventQueueMode) {
+        let mut queue = EventQueue::new_with_mode(mode);
+        let handles: Vec<_> = (0..3)
+            .map(|id| {
+                let event = event(id + 1, id, true);
+                let handle = event.handle().unwrap();
+                queue.push(event);
+                handle
+            })
+            .collect();
+        // not cancellable
+        queue.push(event(2, 3, false));
+        assert!(event(2, 3, false).handle().is_none());
+
+        queue.cancel(handles[1]);
+        assert_eq!(queue.len(), 4);
+        assert_eq!(queue.pop().map(|x| event_id(&x)), Some(Some(0)));
+        // the cancelled event is skipped
+        assert_eq!(queue.pop().map(|x| event_id(&x)), Some(None));
+        assert_eq!(queue.next_event_time(), Some(event(3, 0, false).time()));
+
+        // cancelling events that have already been popped does nothing
+        queue.cancel(handles[0]);
+        queue.cancel(handles[1]);
+        assert!(queue.cancelled.is_empty());
+
+        assert_eq!(queue.pop().map(|x| event_id(&x)), Some(Some(2)));
+        assert!(queue.pop().is_none());
+        assert!(queue.cancellable.is_empty());
+    }
+
+    fn check_compact(mode: EventQueueMode) {
+        let mut queue = EventQueue::new_with_mode(mode);
+        // some past the timing wheel's horizon
+        let handles: Vec<_> = (0..200)
+            .map(|id| {
+                let event = event(id * 2, id, true);
+                let handle = event.handle().unwrap();
+                queue.push(event);
+                handle
+            })
+            .collect();
+
+        // move the timing wheel forward
+        assert_eq!(queue.pop().map(|x| event_id(&x)), Some(Some(0)));
+        let last_popped_time = event(0, 0, false).time();
+
+        // compacted once more than half of the 199 events have been cancelled
+        for handle in &handles[1..=100] {
+            queue.cancel(*handle);
+        }
+        assert_eq!(queue.len(), 99);
+        assert!(queue.cancelled.is_empty());
+        for handle in &handles[101..=150] {
+            queue.cancel(*handle);
+        }
+        assert_eq!(queue.len(), 99);
+
+        // events can still be pushed at the time of the last popped event
+        queue.push(event(0, 1000, true));
+        assert_eq!(queue.next_event_time(), Some(last_popped_time));
+
+        let ids: Vec<_> = std::iter::from_fn(|| queue.pop())
+            .map(|x| event_id(&x))
+            .collect();
+        let expected: Vec<_> = [1000].into_iter().chain(151..200).map(Some).collect();
+        assert_eq!(ids, expected);
+        assert!(queue.cancellable.is_empty());
+        assert!(queue.cancelled.is_empty());
+    }
+
+    #[test]
+    fn test_cancel_heap() {
+        check_cancel(EventQueueMode::Heap);
+    }
+
+    #[test]
+    fn test_cancel_timing_wheel() {
+        check_cancel(EventQueueMode::TimingWheel);
+    }
+
+    #[test]
+    fn test_compact_heap() {
+        check_compact(EventQueueMode::Heap);
+    }
+
+    #[test]
+    fn test_compact_timing_wheel() {
+        check_compact(EventQueueMode::TimingWheel);
+    }
+
+    #[test]
+    fn test_timing_wheel_retain() {
+        let mut wheel = TimingWheel::new(SimulationTime::from_nanos(10), 4);
+        for (ns, id) in [(5, 0), (12, 0), (12, 1), (25, 0), (1000, 0), (1000, 1)] {
+            wheel.push(item(ns, id));
+        }
+        assert_eq!(wheel.pop(), Some(item(5, 0)));
+
+        wheel.retain(|x| x.id == 1 || x.time == item(25, 0).time);
+        assert_eq!(wheel.len(), 3);
+        // not earlier than the last popped item
+        wheel.push(item(5, 2));
+        assert_eq!(drain(&mut wheel), [(5, 2), (12, 1), (25, 0), (1000, 1)]);
+    }
+}
@@ -1,3 +1,4 @@
 pub mod event;
 pub mod event_queue;
+pub mod packet_inbox;
 pub mod task;
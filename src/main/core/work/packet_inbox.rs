@@ -0,0 +1,98 @@
+use std::sync::atomic::{AtomicU64, Ordering};
+
+use crossbeam::queue::SegQueue;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+
+use super::event::Event;
+
+/// Batches of packet events pushed to a host by other hosts, which may be running on other
+/// threads. The inbox also keeps a lower bound on the host's next event time that can be read
+/// without locking the host, so that hosts with no events in a scheduling window can be skipped.
+#[derive(Debug)]
+pub struct PacketInbox {
+    events: SegQueue<Vec<Event>>,
+    /// A lower bound on the host's next event time (including events in the inbox), in the
+    /// [`EmulatedTime::to_c_emutime`] representation so that "no events" is larger than any time.
+    next_event_time: AtomicU64,
+}
+
+impl PacketInbox {
+    /// Create an empty inbox for a host whose next event time is unknown.
+    pub fn new() -> Self {
+        Self {
+            events: SegQueue::new(),
+            next_event_time: AtomicU64::new(EmulatedTime::to_c_emutime(Some(
+                EmulatedTime::SIMULATION_START,
+            ))),
+        }
+    }
+
+    /// Push a batch of events, where `time` is the earliest time of the events.
+    pub fn push(&self, events: Vec<Event>, time: EmulatedTime) {
+        self.events.push(events);
+        // must be done after pushing the events so that the host sees the events if it resets the
+        // time in between (see `reset_next_event_time`)
+        self.lower_next_event_time(time);
+    }
+
+    pub fn pop(&self) -> Option<Vec<Event>> {
+        self.events.pop()
+    }
+
+    /// A lower bound on the host's next event time, or `None` if the host has no events.
+    pub fn next_event_time(&self) -> Option<EmulatedTime> {
+        EmulatedTime::from_c_emutime(self.next_event_time.load(Ordering::SeqCst))
+    }
+
+    /// Lower the host's next event time to `time` if it's earlier. Should be called when the host
+    /// pushes an event to its own event queue.
+    pub fn lower_next_event_time(&self, time: EmulatedTime) {
+        let time = EmulatedTime::to_c_emutime(Some(time));
+        // always a read-modify-write so that it's ordered with `reset_next_event_time`; a relaxed
+        // pre-check could see a stale time from before a reset and skip lowering the time
+        self.next_event_time.fetch_min(time, Ordering::SeqCst);
+    }
+
+    /// Forget the host's next event time, before the host drains the inbox and calls
+    /// [`lower_next_event_time`](Self::lower_next_event_time) with the time of its next event.
+    /// Events pushed after this is called lower the time again, so they're never lost.
+    pub fn reset_next_event_time(&self) {
+        self.next_event_time
+            .store(EmulatedTime::to_c_emutime(None), Ordering::SeqCst);
+    }
+}
+
+impl Default for PacketInbox {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+    use super::*;
+
+    #[test]
+    fn test_next_event_time() {
+        let inbox = PacketInbox::new();
+        let t = |x| EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(x);
+
+        // unknown until the host has checked its events
+        assert_eq!(inbox.next_event_time(), Some(t(0)));
+
+        inbox.reset_next_event_time();
+        assert_eq!(inbox.next_event_time(), None);
+
+        inbox.lower_next_event_time(t(20));
+        inbox.push(Vec::new(), t(30));
+        assert_eq!(inbox.next_event_time(), Some(t(20)));
+        inbox.push(Vec::new(), t(10));
+        assert_eq!(inbox.next_event_time(), Some(t(10)));
+
+        assert!(inbox.pop().is_some());
+        assert!(inbox.pop().is_some());
+        assert!(inbox.pop().is_none());
+    }
+}
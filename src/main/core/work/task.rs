@@ -60,12 +60,57 @@ impl PartialEq for TaskRef {
 impl Eq for TaskRef {}
 
 pub mod export {
+    use std::cell::RefCell;
+    use std::mem::MaybeUninit;
+
     use shadow_shim_helper_rs::util::SyncSendPointer;
     use shadow_shim_helper_rs::{notnull::notnull_mut, HostId};
 
     use super::*;
     use crate::{host::host::Host, utility::HostTreePointer};
 
+    /// The maximum number of unused `TaskRef` allocations to keep for each thread.
+    const MAX_POOLED_ALLOCATIONS: usize = 1024;
+
+    std::thread_local! {
+        /// Unused `TaskRef` allocations. C code creates and drops a `TaskRef` every time it
+        /// schedules a task, so we reuse the allocations rather than freeing them.
+        static TASKREF_POOL: RefCell<Vec<Box<MaybeUninit<TaskRef>>>> = RefCell::new(Vec::new());
+    }
+
+    /// Move `task` to the heap, reusing a pooled allocation if possible. The returned pointer can
+    /// be freed either with `taskref_drop` or with `Box::from_raw`.
+    fn into_raw_pooled(task: TaskRef) -> *mut TaskRef {
+        let slot = TASKREF_POOL
+            .try_with(|pool| pool.borrow_mut().pop())
+            .ok()
+            .flatten();
+        let mut slot = slot.unwrap_or_else(|| Box::new(MaybeUninit::uninit()));
+        slot.write(task);
+        // `MaybeUninit<T>` has the same layout as `T`
+        Box::into_raw(slot).cast()
+    }
+
+    /// Drop the `TaskRef` at `task` and return its allocation to the pool.
+    ///
+    /// # Safety
+    ///
+    /// `task` must have been created by `Box::into_raw` or `into_raw_pooled`, and must not be used
+    /// again.
+    unsafe fn drop_pooled(task: *mut TaskRef) {
+        let mut slot: Box<MaybeUninit<TaskRef>> = unsafe { Box::from_raw(task.cast()) };
+        unsafe { slot.assume_init_drop() };
+
+        // if the pool is full or this thread's pool was already destroyed, the allocation is
+        // freed when `slot` is dropped
+        let _ = TASKREF_POOL.try_with(|pool| {
+            let mut pool = pool.borrow_mut();
+            if pool.len() < MAX_POOLED_ALLOCATIONS {
+                pool.push(slot);
+            }
+        });
+    }
+
     pub type TaskCallbackFunc = extern "C" fn(*const Host, *mut libc::c_void, *mut libc::c_void);
     pub type TaskObjectFreeFunc = Option<extern "C" fn(*mut libc::c_void)>;
     pub type TaskArgumentFreeFunc = Option<extern "C" fn(*mut libc::c_void)>;
@@ -217,7 +262,7 @@ pub mod export {
         // pointer indirection. Unfortunately that doesn't work because of the
         // internal dynamic Trait object, making the resulting pointer non-ABI
         // safe.
-        Box::into_raw(Box::new(task))
+        into_raw_pooled(task)
     }
 
     /// Create a new reference-counted task that may be executed on any Host.
@@ -256,7 +301,7 @@ pub mod export {
         // pointer indirection. Unfortunately that doesn't work because of the
         // internal dynamic Trait object, making the resulting pointer non-ABI
         // safe.
-        Box::into_raw(Box::new(task))
+        into_raw_pooled(task)
     }
 
     /// Destroys this reference to the `Task`, dropping the `Task` if no references remain.
@@ -268,6 +313,55 @@ pub mod export {
     /// `task` must be legally dereferencable.
     #[no_mangle]
     pub unsafe extern "C" fn taskref_drop(task: *mut TaskRef) {
-        drop(unsafe { Box::from_raw(notnull_mut(task)) });
+        unsafe { drop_pooled(notnull_mut(task)) };
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::atomic::{AtomicU32, Ordering};
+
+    use super::export::*;
+
+    static FREE_COUNT: AtomicU32 = AtomicU32::new(0);
+
+    extern "C" fn callback(
+        _host: *const crate::host::host::Host,
+        _obj: *mut libc::c_void,
+        _arg: *mut libc::c_void,
+    ) {
+    }
+
+    extern "C" fn free(_obj: *mut libc::c_void) {
+        FREE_COUNT.fetch_add(1, Ordering::SeqCst);
+    }
+
+    #[test]
+    fn test_pooled_drop() {
+        let task_1 = unsafe {
+            taskref_new_unbound(
+                callback,
+                std::ptr::null_mut(),
+                std::ptr::null_mut(),
+                Some(free),
+                None,
+            )
+        };
+        unsafe { taskref_drop(task_1) };
+        assert_eq!(FREE_COUNT.load(Ordering::SeqCst), 1);
+
+        // the allocation should be reused, and the new task should be dropped normally
+        let task_2 = unsafe {
+            taskref_new_unbound(
+                callback,
+                std::ptr::null_mut(),
+                std::ptr::null_mut(),
+                Some(free),
+                None,
+            )
+        };
+        assert_eq!(task_1, task_2);
+        unsafe { taskref_drop(task_2) };
+        assert_eq!(FREE_COUNT.load(Ordering::SeqCst), 2);
     }
 }
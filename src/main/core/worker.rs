@@ -1,7 +1,8 @@
 use std::cell::{Cell, RefCell};
 use std::collections::HashMap;
 use std::sync::atomic::{AtomicBool, AtomicU32};
-use std::sync::{Arc, Mutex};
+use std::sync::Arc;
+use std::time::Duration;
 
 use atomic_refcell::{AtomicRef, AtomicRefCell};
 use once_cell::sync::Lazy;
@@ -14,20 +15,24 @@ use shadow_shim_helper_rs::simulation_time::SimulationTime;
 use shadow_shim_helper_rs::util::SyncSendPointer;
 use shadow_shim_helper_rs::HostId;
 
-use super::work::event_queue::EventQueue;
 use crate::core::controller::ShadowStatusBarState;
 use crate::core::scheduler::runahead::Runahead;
+use crate::core::scheduler::thread_clocks::ThreadClocks;
 use crate::core::sim_config::Bandwidth;
 use crate::core::sim_stats::{LocalSimStats, SharedSimStats};
+use crate::core::timeline;
 use crate::core::work::event::Event;
+use crate::core::work::packet_inbox::PacketInbox;
 use crate::cshadow;
 use crate::host::host::Host;
 use crate::host::process::{Process, ProcessId};
 use crate::host::thread::{Thread, ThreadId};
-use crate::network::graph::{IpAssignment, RoutingInfo};
+use crate::network::graph::{IpAssignment, PathProperties, RoutingInfo};
+use crate::network::multicast::{self, MulticastGroups};
 use crate::network::packet::PacketRc;
 use crate::utility::childpid_watcher::ChildPidWatcher;
 use crate::utility::counter::Counter;
+use crate::utility::file_cache::FileCache;
 use crate::utility::status_bar;
 
 static USE_OBJECT_COUNTERS: AtomicBool = AtomicBool::new(false);
@@ -51,6 +56,22 @@ pub static WORKER_SHARED: Lazy<AtomicRefCell<Option<WorkerShared>>> =
 #[derive(Copy, Clone, Debug)]
 pub struct WorkerThreadID(pub u32);
 
+/// The destination host and network path for packets sent from a host to an IP address.
+#[derive(Copy, Clone, Debug)]
+pub struct PacketRoute {
+    pub dst_ip: std::net::Ipv4Addr,
+    /// `None` if the destination host isn't being simulated, which is only the case when replaying
+    /// a single host.
+    pub dst_host_id: Option<HostId>,
+    /// The routing index of the source host's network node.
+    pub src_route: usize,
+    /// The routing index of the destination host's network node.
+    pub dst_route: usize,
+    pub path: PathProperties,
+    /// The routing generation (see [`RoutingInfo::generation`]) in which `path` was looked up.
+    pub generation: u64,
+}
+
 struct Clock {
     now: Option<EmulatedTime>,
     barrier: Option<EmulatedTime>,
@@ -63,11 +84,21 @@ pub struct Worker {
     // A shared reference to the state in `WORKER_SHARED`.
     shared: AtomicRef<'static, WorkerShared>,
 
+    // Copies of values in `shared` that never change, so that hot paths don't need to go through
+    // `shared`.
+    sim_end_time: EmulatedTime,
+    bootstrap_end_time: EmulatedTime,
+    // Whether threads run without a round barrier (`WorkerShared::thread_clocks` is set).
+    is_async: bool,
+
     // These store some information about the current Host, Process, and Thread,
     // when applicable. These are used to make this information available to
     // code that might not have access to the objects themselves, such as the
     // ShadowLogger.
     active_host: RefCell<Option<Box<Host>>>,
+    // The address of the host in `active_host` (or null), for the C API which hands out raw
+    // pointers anyway and shouldn't need to borrow `active_host`.
+    active_host_ptr: Cell<*const Host>,
     active_process: RefCell<Option<RootedRc<RootedRefCell<Process>>>>,
     active_thread: RefCell<Option<RootedRc<RootedRefCell<Thread>>>>,
 
@@ -81,16 +112,24 @@ pub struct Worker {
     sim_stats: LocalSimStats,
 
     next_event_time: Cell<Option<EmulatedTime>>,
+
+    // Packet events that have been sent, but not yet pushed to their destination hosts.
+    outgoing_packets: RefCell<Vec<(HostId, Event)>>,
 }
 
 impl Worker {
     // Create worker for this thread.
     pub fn new_for_this_thread(worker_id: WorkerThreadID) {
         WORKER.with(|worker| {
+            let shared = AtomicRef::map(WORKER_SHARED.borrow(), |x| x.as_ref().unwrap());
             let res = worker.set(RefCell::new(Self {
                 worker_id,
-                shared: AtomicRef::map(WORKER_SHARED.borrow(), |x| x.as_ref().unwrap()),
+                sim_end_time: shared.sim_end_time,
+                bootstrap_end_time: shared.bootstrap_end_time,
+                is_async: shared.thread_clocks.is_some(),
+                shared,
                 active_host: RefCell::new(None),
+                active_host_ptr: Cell::new(std::ptr::null()),
                 active_process: RefCell::new(None),
                 active_thread: RefCell::new(None),
                 clock: RefCell::new(Clock {
@@ -100,6 +139,7 @@ impl Worker {
                 min_latency_cache: Cell::new(None),
                 sim_stats: LocalSimStats::new(),
                 next_event_time: Cell::new(None),
+                outgoing_packets: RefCell::new(Vec::new()),
             }));
             assert!(res.is_ok(), "Worker already initialized");
         });
@@ -185,17 +225,34 @@ impl Worker {
         Worker::with(|w| f(w.shared.dns())).unwrap()
     }
 
+    /// Run `f` with a reference to the global cache of read-only file contents.
+    ///
+    /// Panics if the Worker hasn't yet been initialized.
+    pub fn with_file_cache<F, R>(f: F) -> R
+    where
+        F: FnOnce(&FileCache) -> R,
+    {
+        Worker::with(|w| f(&w.shared.file_cache)).unwrap()
+    }
+
     /// Set the currently-active Host.
     pub fn set_active_host(host: Box<Host>) {
-        let old = Worker::with(|w| w.active_host.borrow_mut().replace(host)).unwrap();
+        let old = Worker::with(|w| {
+            w.active_host_ptr.set(&*host);
+            w.active_host.borrow_mut().replace(host)
+        })
+        .unwrap();
         debug_assert!(old.is_none());
     }
 
     /// Clear the currently-active Host.
     pub fn take_active_host() -> Box<Host> {
-        Worker::with(|w| w.active_host.borrow_mut().take())
-            .unwrap()
-            .unwrap()
+        Worker::with(|w| {
+            w.active_host_ptr.set(std::ptr::null());
+            w.active_host.borrow_mut().take()
+        })
+        .unwrap()
+        .unwrap()
     }
 
     /// Set the currently-active Process.
@@ -294,16 +351,17 @@ impl Worker {
     }
 
     pub fn update_lowest_used_latency(t: SimulationTime) {
+        Worker::with(|w| w.update_lowest_used_latency_local(t)).unwrap();
+    }
+
+    fn update_lowest_used_latency_local(&self, t: SimulationTime) {
         assert!(t != SimulationTime::ZERO);
 
-        Worker::with(|w| {
-            let min_latency_cache = w.min_latency_cache.get();
-            if min_latency_cache.is_none() || t < min_latency_cache.unwrap() {
-                w.min_latency_cache.set(Some(t));
-                w.shared.update_lowest_used_latency(t);
-            }
-        })
-        .unwrap();
+        let min_latency_cache = self.min_latency_cache.get();
+        if min_latency_cache.is_none() || t < min_latency_cache.unwrap() {
+            self.min_latency_cache.set(Some(t));
+            self.shared.update_lowest_used_latency(t);
+        }
     }
 
     pub fn reset_next_event_time() {
@@ -315,13 +373,14 @@ impl Worker {
     }
 
     pub fn update_next_event_time(t: EmulatedTime) {
-        Worker::with(|w| {
-            let next_event_time = w.next_event_time.get();
-            if next_event_time.is_none() || t < next_event_time.unwrap() {
-                w.next_event_time.set(Some(t));
-            }
-        })
-        .unwrap();
+        Worker::with(|w| w.update_next_event_time_local(t)).unwrap();
+    }
+
+    fn update_next_event_time_local(&self, t: EmulatedTime) {
+        let next_event_time = self.next_event_time.get();
+        if next_event_time.is_none() || t < next_event_time.unwrap() {
+            self.next_event_time.set(Some(t));
+        }
     }
 
     /// # Safety
@@ -331,46 +390,97 @@ impl Worker {
     pub unsafe fn send_packet(src_host: &Host, packet: *mut cshadow::Packet) {
         assert!(!packet.is_null());
 
-        let current_time = Worker::current_time().unwrap();
-        let round_end_time = Worker::round_end_time().unwrap();
+        // get the worker once for the whole send
+        Worker::with(|w| unsafe { w.send_packet_local(src_host, packet) }).unwrap();
+    }
+
+    /// See [`Worker::send_packet`].
+    unsafe fn send_packet_local(&self, src_host: &Host, packet: *mut cshadow::Packet) {
+        let (current_time, round_end_time) = {
+            let clock = self.clock.borrow();
+            (clock.now.unwrap(), clock.barrier.unwrap())
+        };
 
-        let is_completed = current_time >= Worker::with(|w| w.shared.sim_end_time).unwrap();
-        let is_bootstrapping =
-            current_time < Worker::with(|w| w.shared.bootstrap_end_time).unwrap();
+        let is_completed = current_time >= self.sim_end_time;
+        let is_bootstrapping = current_time < self.bootstrap_end_time;
 
         if is_completed {
             // the simulation is over, don't bother
             return;
         }
 
-        let src_ip = unsafe { cshadow::packet_getSourceIP(packet) };
         let dst_ip = unsafe { cshadow::packet_getDestinationIP(packet) };
         let payload_size = unsafe { cshadow::packet_getPayloadSize(packet) };
 
-        let src_ip: std::net::Ipv4Addr = u32::from_be(src_ip).into();
         let dst_ip: std::net::Ipv4Addr = u32::from_be(dst_ip).into();
 
-        let dst_host_id = Worker::with(|w| {
-            w.shared
-                .resolve_ip_to_host_id(dst_ip)
-                .expect("No host ID for dest address {dst_ip}")
-        })
-        .unwrap();
-
-        let src_ip = std::net::IpAddr::V4(src_ip);
-        let dst_ip = std::net::IpAddr::V4(dst_ip);
+        if multicast::is_fan_out_address(dst_ip) {
+            unsafe {
+                self.send_packet_fan_out(
+                    src_host,
+                    packet,
+                    dst_ip,
+                    current_time,
+                    round_end_time,
+                    is_bootstrapping,
+                )
+            };
+            return;
+        }
 
-        // check if network reliability forces us to 'drop' the packet
-        let reliability: f64 = Worker::with(|w| w.shared.reliability(src_ip, dst_ip).unwrap())
-            .unwrap()
-            .try_into()
-            .unwrap();
-        let chance: f64 = src_host.random_mut().gen();
+        let generation = self.shared.routing_info.generation();
+        let route = src_host.packet_route(dst_ip, generation, || {
+            let Some(dst_host_id) = self.shared.resolve_ip_to_host_id(dst_ip) else {
+                panic!("No host ID for dest address {dst_ip}");
+            };
 
-        // don't drop control packets with length 0, otherwise congestion control has problems
-        // responding to packet loss
+            // look up the path using the hosts' routing indices, which avoids hashing the
+            // addresses
+            let (src_route, dst_route) = self.shared.host_route_indices(src_host.id(), dst_host_id);
+            let path = self
+                .shared
+                .routing_info
+                .path_by_index(src_route, dst_route)
+                .unwrap();
+
+            // when replaying a host, the other hosts are registered but aren't built, so the packet
+            // takes the same path but nothing receives it
+            let dst_host_id = self
+                .shared
+                .is_host_built(dst_host_id)
+                .then_some(dst_host_id);
+
+            PacketRoute {
+                dst_ip,
+                dst_host_id,
+                src_route,
+                dst_route,
+                path,
+                generation,
+            }
+        });
+        let PacketRoute {
+            dst_host_id,
+            src_route,
+            dst_route,
+            path,
+            ..
+        } = route;
+
+        // check if network reliability forces us to 'drop' the packet; don't drop control packets
+        // with length 0, otherwise congestion control has problems responding to packet loss
         // https://github.com/shadow/shadow/issues/2517
-        if !is_bootstrapping && chance >= reliability && payload_size > 0 {
+        //
+        // we only draw from the host's random stream when the packet could be dropped, so
+        // lossless paths don't pay for it
+        let can_drop = !is_bootstrapping && payload_size > 0 && path.packet_loss > 0.0;
+        let is_dropped = can_drop && {
+            let reliability = f64::from(1.0 - path.packet_loss);
+            let chance: f64 = src_host.random_mut().gen();
+            chance >= reliability
+        };
+
+        if is_dropped {
             unsafe {
                 cshadow::packet_addDeliveryStatus(
                     packet,
@@ -380,13 +490,16 @@ impl Worker {
             return;
         }
 
-        let delay = Worker::with(|w| w.shared.latency(src_ip, dst_ip).unwrap()).unwrap();
+        let delay = SimulationTime::from_nanos(path.latency_ns);
 
-        Worker::update_lowest_used_latency(delay);
-        Worker::with(|w| w.shared.increment_packet_count(src_ip, dst_ip)).unwrap();
+        self.update_lowest_used_latency_local(delay);
+        self.shared
+            .routing_info
+            .increment_packet_count_by_index(src_route, dst_route);
 
-        // TODO: this should change for sending to remote manager (on a different machine); this is
-        // the only place where tasks are sent between separate host
+        // this and `flush_outgoing_packets()` are the only places where events are sent between
+        // hosts, so a manager that exchanged packets with managers on other machines would batch
+        // them in `flush_outgoing_packets()`
 
         unsafe {
             cshadow::packet_addDeliveryStatus(
@@ -395,22 +508,155 @@ impl Worker {
             )
         };
 
+        // the destination isn't being simulated, so nothing will receive the packet (the loss
+        // check above has still drawn from the host's random stream as it did when recorded)
+        let Some(dst_host_id) = dst_host_id else {
+            return;
+        };
+
         // copy the packet
         let packet = PacketRc::from_raw(unsafe { cshadow::packet_copy(packet) });
 
-        // delay the packet until the next round
+        // delay the packet until the next round (when running without a round barrier, each
+        // thread's window already ends before any packet it can receive, and the destination's
+        // window may end earlier than ours)
         let mut deliver_time = current_time + delay;
-        if deliver_time < round_end_time {
+        if deliver_time < round_end_time && !self.is_async {
             deliver_time = round_end_time;
         }
 
         // we may have sent this packet after the destination host finished running the current
         // round and calculated its min event time, so we put this in our min event time instead
-        Worker::update_next_event_time(deliver_time);
+        self.update_next_event_time_local(deliver_time);
+
+        // the packet will be pushed to the destination host in the next call to
+        // `flush_outgoing_packets()`
+        let event = Event::new_packet(packet, deliver_time, src_host);
+        if let Some((src_host_id, src_host_event_id)) = event.packet_source() {
+            timeline::packet_sent(src_host_id, src_host_event_id);
+        }
+        self.outgoing_packets
+            .borrow_mut()
+            .push((dst_host_id, event));
+    }
+
+    /// Send a multicast or broadcast packet to each of its destination hosts other than the
+    /// sender. The destinations are looked up once for the whole packet, every copy shares the
+    /// packet's payload, and the copies are added to the outgoing packets together. Each copy
+    /// follows the path to its own destination, including that path's latency and packet loss.
+    ///
+    /// # Safety
+    ///
+    /// See [`Worker::send_packet`].
+    unsafe fn send_packet_fan_out(
+        &self,
+        src_host: &Host,
+        packet: *mut cshadow::Packet,
+        dst_ip: std::net::Ipv4Addr,
+        current_time: EmulatedTime,
+        round_end_time: EmulatedTime,
+        is_bootstrapping: bool,
+    ) {
+        // the recording doesn't have the hosts that received the packet, so a replay can't draw
+        // the packet's losses from the host's random stream as it did when it was recorded, and
+        // everything the host does afterwards would differ from the recording
+        if self.shared.is_replaying {
+            panic!(
+                "Host '{}' sent a multicast or broadcast packet to {dst_ip}, which isn't \
+                 supported when replaying a host",
+                src_host.name()
+            );
+        }
+
+        let payload_size = unsafe { cshadow::packet_getPayloadSize(packet) };
+
+        unsafe {
+            cshadow::packet_addDeliveryStatus(
+                packet,
+                cshadow::_PacketDeliveryStatusFlags_PDS_INET_SENT,
+            )
+        };
+
+        let Some(dst_host_ids) = self.shared.multicast.destinations(src_host.id(), dst_ip) else {
+            // a group with no members
+            return;
+        };
+
+        let mut events = Vec::with_capacity(dst_host_ids.len());
+        let mut min_delay: Option<SimulationTime> = None;
+
+        for &dst_host_id in dst_host_ids.iter() {
+            // the sender doesn't receive its own packets, as if `IP_MULTICAST_LOOP` were disabled
+            if dst_host_id == src_host.id() {
+                continue;
+            }
+
+            let (src_route, dst_route) = self.shared.host_route_indices(src_host.id(), dst_host_id);
+            let path = self
+                .shared
+                .routing_info
+                .path_by_index(src_route, dst_route)
+                .unwrap();
+
+            // the same loss rules as a unicast packet (see `send_packet_local`)
+            let can_drop = !is_bootstrapping && payload_size > 0 && path.packet_loss > 0.0;
+            let is_dropped = can_drop && {
+                let reliability = f64::from(1.0 - path.packet_loss);
+                let chance: f64 = src_host.random_mut().gen();
+                chance >= reliability
+            };
+            if is_dropped {
+                continue;
+            }
+
+            let delay = SimulationTime::from_nanos(path.latency_ns);
+            min_delay = Some(min_delay.map_or(delay, |x| std::cmp::min(x, delay)));
+            self.shared
+                .routing_info
+                .increment_packet_count_by_index(src_route, dst_route);
+
+            let copy = PacketRc::from_raw(unsafe { cshadow::packet_copy(packet) });
+
+            let mut deliver_time = current_time + delay;
+            if deliver_time < round_end_time && !self.is_async {
+                deliver_time = round_end_time;
+            }
+            self.update_next_event_time_local(deliver_time);
+
+            let event = Event::new_packet(copy, deliver_time, src_host);
+            if let Some((src_host_id, src_host_event_id)) = event.packet_source() {
+                timeline::packet_sent(src_host_id, src_host_event_id);
+            }
+            events.push((dst_host_id, event));
+        }
 
+        if let Some(min_delay) = min_delay {
+            self.update_lowest_used_latency_local(min_delay);
+        }
+
+        self.outgoing_packets.borrow_mut().extend(events);
+    }
+
+    /// Push all packets sent by `src_host` since the last flush to their destination hosts, with
+    /// one push for each destination host. This must be called before the worker's next event
+    /// time is taken at the end of the round.
+    pub fn flush_outgoing_packets(src_host: &Host) {
         Worker::with(|w| {
-            w.shared
-                .push_packet_to_host(packet, dst_host_id, deliver_time, src_host)
+            let mut packets = w.outgoing_packets.borrow_mut();
+
+            // group the packets by destination host; the sort is stable so packets to the same
+            // host stay in the order they were sent
+            packets.sort_by_key(|(dst_host_id, _)| *dst_host_id);
+
+            let mut packets = packets.drain(..).peekable();
+            while let Some((dst_host_id, event)) = packets.next() {
+                let mut events = src_host.take_event_buffer();
+                events.push(event);
+                while let Some((_, event)) = packets.next_if(|(x, _)| *x == dst_host_id) {
+                    events.push(event);
+                }
+                w.shared.push_packets_to_host(dst_host_id, events);
+            }
         })
         .unwrap();
     }
@@ -477,6 +723,128 @@ impl Worker {
         });
     }
 
+    /// Add the number of plugin memory accesses that `MemoryManager` couldn't serve from memory
+    /// mapped into Shadow, keyed by the path of the accessed region.
+    pub fn add_memory_manager_misses(misses: &Counter) {
+        Worker::with(|w| {
+            w.sim_stats
+                .memory_manager_misses
+                .borrow_mut()
+                .add_counter(misses);
+        })
+        .unwrap_or_else(|| {
+            // no live worker (for example processes dropped during shutdown); fall back to the
+            // shared counter
+            SIM_STATS
+                .memory_manager_misses
+                .lock()
+                .unwrap()
+                .add_counter(misses);
+        });
+    }
+
+    /// Count an event buffer taken from a host's buffer pool, or newly allocated if the pool was
+    /// empty.
+    pub fn count_event_buffer(reused: bool) {
+        Worker::with(|w| {
+            let mut stats = w.sim_stats.event_buffers.borrow_mut();
+            if reused {
+                stats.reused += 1;
+            } else {
+                stats.allocated += 1;
+            }
+        })
+        .unwrap();
+    }
+
+    /// Count a wakeup of a thread blocked in a syscall, or a wakeup that was elided because one
+    /// was already pending.
+    pub fn count_syscall_condition_wakeup(elided: bool) {
+        Worker::with(|w| {
+            let mut stats = w.sim_stats.syscall_condition_wakeups.borrow_mut();
+            if elided {
+                stats.elided += 1;
+            } else {
+                stats.scheduled += 1;
+            }
+        })
+        .unwrap();
+    }
+
+    /// Count a syscall that Shadow told the shim to execute natively.
+    pub fn count_native_syscall(num: i64) {
+        Worker::with(|w| {
+            *w.sim_stats
+                .native_syscalls
+                .borrow_mut()
+                .trapped
+                .entry(num)
+                .or_default() += 1;
+        })
+        .unwrap();
+    }
+
+    /// Count a scheduled wakeup of a thread blocked in a syscall that didn't run the thread since
+    /// its condition was no longer satisfied.
+    pub fn count_syscall_condition_spurious_wakeup() {
+        Worker::with(|w| {
+            w.sim_stats.syscall_condition_wakeups.borrow_mut().spurious += 1;
+        })
+        .unwrap();
+    }
+
+    /// Count a host that moved its managed threads to a new worker core, or that ran on a new
+    /// core but didn't move its threads yet.
+    pub fn count_host_affinity_change(deferred: bool) {
+        Worker::with(|w| {
+            let mut stats = w.sim_stats.cpu_affinity.borrow_mut();
+            if deferred {
+                stats.host_changes_deferred += 1;
+            } else {
+                stats.host_changes += 1;
+            }
+        })
+        .unwrap();
+    }
+
+    /// Count a change of a managed thread's CPU affinity.
+    pub fn count_thread_affinity_change() {
+        Worker::with(|w| w.sim_stats.cpu_affinity.borrow_mut().thread_changes += 1).unwrap();
+    }
+
+    /// Count events that a host executed.
+    pub fn count_executed_events(count: u64) {
+        Worker::with(|w| *w.sim_stats.executed_events.borrow_mut() += count).unwrap();
+    }
+
+    /// Record the wall-clock time that Shadow's handler spent on a syscall.
+    pub fn record_syscall_handler_latency(syscall_num: i64, duration: Duration) {
+        Worker::with(|w| {
+            w.sim_stats
+                .syscall_latencies
+                .borrow_mut()
+                .handler
+                .entry(syscall_num)
+                .or_default()
+                .record(duration);
+        })
+        .unwrap();
+    }
+
+    /// Record the wall-clock time from resuming a plugin thread until it made a syscall.
+    pub fn record_syscall_plugin_latency(syscall_num: i64, duration: Duration) {
+        Worker::with(|w| {
+            w.sim_stats
+                .syscall_latencies
+                .borrow_mut()
+                .plugin
+                .entry(syscall_num)
+                .or_default()
+                .record(duration);
+        })
+        .unwrap();
+    }
+
     pub fn add_to_global_sim_stats() {
         Worker::with(|w| SIM_STATS.add_from_local_stats(&w.sim_stats)).unwrap()
     }
@@ -489,11 +857,17 @@ impl Worker {
         Worker::with(|w| w.shared.increment_plugin_error_count()).unwrap()
     }
 
+    /// Record that `host` has joined or left the multicast `group`. See
+    /// [`crate::network::multicast`].
+    pub fn update_multicast_membership(host: HostId, group: std::net::Ipv4Addr, is_member: bool) {
+        Worker::with(|w| w.shared.multicast.update(group, host, is_member)).unwrap()
+    }
+
     /// Shadow allows configuration of a "bootstrapping" interval, during which
     /// hosts' network activity does not consume bandwidth. Returns `true` if we
     /// are still within this preliminary interval, or `false` otherwise.
     pub fn is_bootstrapping() -> bool {
-        Worker::with(|w| w.clock.borrow().now.unwrap() < w.shared.bootstrap_end_time).unwrap()
+        Worker::with(|w| w.clock.borrow().now.unwrap() < w.bootstrap_end_time).unwrap()
     }
 }
 
@@ -501,6 +875,12 @@ impl Worker {
 pub struct WorkerShared {
     pub ip_assignment: IpAssignment<u32>,
     pub routing_info: RoutingInfo<u32>,
+    /// The routing index (see [`RoutingInfo::node_index`]) of each host's network node, indexed by
+    /// host ID.
+    pub host_route_indices: Vec<usize>,
+    /// Whether each host was built, indexed by host ID. Only the replayed host is built when
+    /// replaying a host, but all hosts are registered in the DNS.
+    pub built_hosts: Vec<bool>,
     pub host_bandwidths: HashMap<std::net::IpAddr, Bandwidth>,
     pub dns: SyncSendPointer<cshadow::DNS>,
     // allows for easy updating of the status bar's state
@@ -510,10 +890,18 @@ pub struct WorkerShared {
     // calculates the runahead for the next simulation round
     pub runahead: Runahead,
     pub child_pid_watcher: ChildPidWatcher,
-    /// Event queues for each host. This should only be used to push packet events.
-    pub event_queues: HashMap<HostId, Arc<Mutex<EventQueue>>>,
+    /// Contents of read-only files that are shared by all hosts.
+    pub file_cache: FileCache,
+    /// Packet inboxes for each host.
+    pub packet_inboxes: HashMap<HostId, Arc<PacketInbox>>,
+    /// Per-thread clocks, if the scheduling windows are run without a global barrier.
+    pub thread_clocks: Option<ThreadClocks>,
     pub bootstrap_end_time: EmulatedTime,
     pub sim_end_time: EmulatedTime,
+    /// Set when only a single recorded host is being simulated (see [`crate::host::replay`]).
+    pub is_replaying: bool,
+    /// The hosts that receive multicast and broadcast packets.
+    pub multicast: MulticastGroups,
 }
 
 impl WorkerShared {
@@ -549,11 +937,16 @@ impl WorkerShared {
         self.host_bandwidths.get(&ip)
     }
 
-    pub fn increment_packet_count(&self, src: std::net::IpAddr, dst: std::net::IpAddr) {
-        let src = self.ip_assignment.get_node(src).unwrap();
-        let dst = self.ip_assignment.get_node(dst).unwrap();
+    /// The routing indices of the network nodes of two hosts.
+    pub fn host_route_indices(&self, src: HostId, dst: HostId) -> (usize, usize) {
+        let index =
+            |host: HostId| self.host_route_indices[usize::try_from(u32::from(host)).unwrap()];
+        (index(src), index(dst))
+    }
 
-        self.routing_info.increment_packet_count(src, dst)
+    /// Whether a host was built. Packets to hosts that weren't built aren't delivered.
+    pub fn is_host_built(&self, host: HostId) -> bool {
+        self.built_hosts[usize::try_from(u32::from(host)).unwrap()]
     }
 
     pub fn is_routable(&self, src: std::net::IpAddr, dst: std::net::IpAddr) -> bool {
@@ -617,18 +1010,22 @@ impl WorkerShared {
         &self.child_pid_watcher
     }
 
-    /// Push a packet to the destination host's event queue. Does not check that the time is valid
-    /// (is outside of the current scheduling round, etc).
-    pub fn push_packet_to_host(
-        &self,
-        packet: PacketRc,
-        dst_host_id: HostId,
-        time: EmulatedTime,
-        src_host: &Host,
-    ) {
-        let event = Event::new_packet(packet, time, src_host);
-        let event_queue = self.event_queues.get(&dst_host_id).unwrap();
-        event_queue.lock().unwrap().push(event);
+    /// Push packet events to the destination host's packet inbox. Does not check that the times
+    /// are valid (are outside of the current scheduling round, etc).
+    pub fn push_packets_to_host(&self, dst_host_id: HostId, events: Vec<Event>) {
+        let Some(time) = events.iter().map(|x| x.time()).min() else {
+            return;
+        };
+
+        self.packet_inboxes
+            .get(&dst_host_id)
+            .unwrap()
+            .push(events, time);
+
+        // must be done after pushing the events
+        if let Some(thread_clocks) = &self.thread_clocks {
+            thread_clocks.event_pushed(dst_host_id, time);
+        }
     }
 }
 
@@ -723,6 +1120,24 @@ mod export {
         Worker::increment_object_dealloc_counter(s);
     }
 
+    /// Count a syscall that Shadow told the shim to execute natively.
+    #[no_mangle]
+    pub extern "C" fn worker_count_native_syscall(num: libc::c_long) {
+        Worker::count_native_syscall(num);
+    }
+
+    /// Count a wakeup of a thread blocked in a syscall, or a wakeup that was elided because one
+    /// was already pending.
+    #[no_mangle]
+    pub extern "C" fn worker_count_syscall_condition_wakeup(elided: bool) {
+        Worker::count_syscall_condition_wakeup(elided);
+    }
+
+    #[no_mangle]
+    pub extern "C" fn worker_count_syscall_condition_spurious_wakeup() {
+        Worker::count_syscall_condition_spurious_wakeup();
+    }
+
     /// Aggregate the given syscall counts in a worker syscall counter.
     #[no_mangle]
     pub extern "C" fn worker_add_syscall_counts(syscall_counts: *const Counter) {
@@ -771,7 +1186,16 @@ mod export {
     /// invalidated the next time the worker switches hosts.
     #[no_mangle]
     pub extern "C" fn worker_getCurrentHost() -> *const Host {
-        Worker::with_active_host(|h| h as *const _).unwrap()
+        let host = Worker::with(|w| w.active_host_ptr.get()).unwrap();
+        assert!(!host.is_null());
+        host
+    }
+
+    /// Like `worker_getCurrentHost()`, but returns NULL instead of panicking if no host is
+    /// running, for code such as destructors that may also run outside of a host.
+    #[no_mangle]
+    pub extern "C" fn worker_getCurrentHostIfAny() -> *const Host {
+        Worker::with(|w| w.active_host_ptr.get()).unwrap_or(std::ptr::null())
     }
 
     /// Returns a pointer to the current running process. The returned pointer is
@@ -1,3 +1,4 @@
+use std::num::NonZeroU64;
 use std::time::Duration;
 
 use shadow_shim_helper_rs::{emulated_time::EmulatedTime, simulation_time::SimulationTime};
@@ -56,9 +57,23 @@ impl Cpu {
         let simulated_delay_nanos = cycles / (self.simulated_frequency as u128);
         // Theoretically possible to overflow (and then panic) here, but only
         // for a delay of > ~500 years.
-        let mut adjusted_delay =
-            SimulationTime::from_nanos(simulated_delay_nanos.try_into().unwrap());
+        let adjusted_delay = SimulationTime::from_nanos(simulated_delay_nanos.try_into().unwrap());
 
+        self.add_simulated_delay(adjusted_delay);
+    }
+
+    /// Account for `instructions` natively executed by a simulated CPU that
+    /// executes `rate` instructions per second.
+    pub fn add_instructions(&mut self, instructions: u64, rate: NonZeroU64) {
+        let simulated_delay_nanos =
+            u128::from(instructions) * 1_000_000_000 / u128::from(rate.get());
+        let adjusted_delay = SimulationTime::from_nanos(simulated_delay_nanos.try_into().unwrap());
+
+        self.add_simulated_delay(adjusted_delay);
+    }
+
+    /// Account for a delay that has already been converted to simulated time.
+    fn add_simulated_delay(&mut self, mut adjusted_delay: SimulationTime) {
         // round the adjusted delay to the nearest precision if needed
         if let Some(precision) = self.precision {
             let remainder = adjusted_delay % precision;
@@ -77,6 +92,12 @@ impl Cpu {
         self.time_cpu_available += adjusted_delay;
     }
 
+    /// Whether this CPU ever reports a delay. If not, there's no need to keep its time up to date
+    /// or to check [`delay()`](Self::delay).
+    pub fn delay_enabled(&self) -> bool {
+        self.threshold.is_some()
+    }
+
     /// Calculate the simulated delay until this CPU is ready to run again.
     pub fn delay(&self) -> SimulationTime {
         let Some(threshold) = self.threshold else {
@@ -190,6 +211,7 @@ mod tests {
     fn thresholded() {
         let threshold = SimulationTime::from_millis(100);
         let mut cpu = Cpu::new(1000 * MHZ, 1000 * MHZ, Some(threshold), None);
+        assert!(cpu.delay_enabled());
         assert_eq!(cpu.delay(), SimulationTime::ZERO);
 
         // Simulate having spent 1 ms.
@@ -205,6 +227,28 @@ mod tests {
         assert_eq!(cpu.delay(), SimulationTime::from_millis(101));
     }
 
+    #[test]
+    fn instructions() {
+        let mut cpu = Cpu::new(
+            1000 * MHZ,
+            1000 * MHZ,
+            Some(SimulationTime::NANOSECOND),
+            None,
+        );
+        let rate = NonZeroU64::new(2_000_000_000).unwrap();
+
+        // 2 billion instructions per second is 2 instructions per nanosecond.
+        cpu.add_instructions(2_000_000, rate);
+        assert_eq!(cpu.delay(), SimulationTime::from_millis(1));
+
+        // Partial nanoseconds are truncated.
+        cpu.add_instructions(3, rate);
+        assert_eq!(
+            cpu.delay(),
+            SimulationTime::from_millis(1) + SimulationTime::NANOSECOND
+        );
+    }
+
     #[test]
     fn round_lt_half_precision() {
         let precision = SimulationTime::from_millis(100);
@@ -11,17 +11,23 @@ use crate::utility::ObjectCounter;
 /// POSIX requires fds to be assigned as `libc::c_int`, so we can't allow any fds larger than this.
 pub const FD_MAX: u32 = i32::MAX as u32;
 
+/// The largest number of unused indices that we'll add to the dense part of the table in order to
+/// place a descriptor at a higher index. Descriptors further past the end of the dense part are
+/// stored sparsely, so that a `dup2` to a large fd doesn't need a huge allocation.
+const MAX_DENSE_GAP: u32 = 1024;
+
 /// Map of file handles to file descriptors. Typically owned by a Process.
 #[derive(Clone)]
 pub struct DescriptorTable {
-    descriptors: HashMap<DescriptorHandle, Descriptor>,
+    // Descriptors indexed by their handle, for handles below `dense.len()`. The last entry is never
+    // `None`.
+    dense: Vec<Option<Descriptor>>,
 
-    // Indices less than `next_index` known to be available.
-    available_indices: BTreeSet<u32>,
+    // Descriptors with handles at or above `dense.len()`.
+    sparse: HashMap<DescriptorHandle, Descriptor>,
 
-    // Lowest index not in `available_indices` that *might* be available. We still need to verify
-    // availability in `descriptors`, though.
-    next_index: u32,
+    // Indices less than `dense.len()` that are available.
+    available_indices: BTreeSet<u32>,
 
     _counter: ObjectCounter,
 }
@@ -29,13 +35,48 @@ pub struct DescriptorTable {
 impl DescriptorTable {
     pub fn new() -> Self {
         DescriptorTable {
-            descriptors: HashMap::new(),
+            dense: Vec::new(),
+            sparse: HashMap::new(),
             available_indices: BTreeSet::new(),
-            next_index: 0,
             _counter: ObjectCounter::new("DescriptorTable"),
         }
     }
 
+    fn dense_len(&self) -> u32 {
+        // the dense part never extends past `FD_MAX`
+        self.dense.len().try_into().unwrap()
+    }
+
+    /// Whether `idx` is at or past the end of the dense part, but close enough to grow the dense
+    /// part to include it.
+    fn can_grow_dense_to(&self, idx: u32) -> bool {
+        idx >= self.dense_len() && idx - self.dense_len() <= MAX_DENSE_GAP
+    }
+
+    /// Grow the dense part to include `idx`, and move any sparse descriptors that are now within
+    /// (or directly following) the dense part. The new entries below `idx` are available.
+    fn grow_dense_to(&mut self, idx: u32) {
+        debug_assert!(self.can_grow_dense_to(idx));
+
+        for i in self.dense_len()..idx {
+            let desc = self.sparse.remove(&DescriptorHandle::new(i).unwrap());
+            if desc.is_none() {
+                self.available_indices.insert(i);
+            }
+            self.dense.push(desc);
+        }
+
+        let desc = self.sparse.remove(&DescriptorHandle::new(idx).unwrap());
+        self.dense.push(desc);
+
+        // Keep the sparse part strictly after the dense part.
+        while let Some(desc) =
+            DescriptorHandle::new(self.dense_len()).and_then(|next| self.sparse.remove(&next))
+        {
+            self.dense.push(Some(desc));
+        }
+    }
+
     /// Add the descriptor at an unused index, and return the index. If the descriptor could not be
     /// added, the descriptor is returned in the `Err`.
     fn add(
@@ -43,103 +84,124 @@ impl DescriptorTable {
         descriptor: Descriptor,
         min_index: DescriptorHandle,
     ) -> Result<DescriptorHandle, Descriptor> {
-        let idx = if let Some(idx) = self.available_indices.range(min_index.val()..).next() {
+        if let Some(idx) = self.available_indices.range(min_index.val()..).next() {
             // Un-borrow from `available_indices`.
             let idx = *idx;
             // Take from `available_indices`
             trace!("Reusing available index {}", idx);
             self.available_indices.remove(&idx);
-            idx
-        } else {
-            // Start our search at either the next likely available index or the minimum index,
-            // whichever is larger.
-            let mut idx = std::cmp::max(self.next_index, min_index.val());
+            let prev = self.dense[idx as usize].replace(descriptor);
+            assert!(prev.is_none(), "Already a descriptor at {}", idx);
+            return Ok(DescriptorHandle::new(idx).unwrap());
+        }
+
+        // Start our search at either the end of the dense part or the minimum index, whichever is
+        // larger.
+        let idx = std::cmp::max(self.dense_len(), min_index.val());
 
-            // Check if this index out of range.
+        if self.can_grow_dense_to(idx) {
+            // Check if this index is out of range.
             if idx > FD_MAX {
                 return Err(descriptor);
             }
 
-            // Only update next_index if we started at it, otherwise there may be other
-            // available indexes lower than idx.
-            let should_update_next_index = idx == self.next_index;
-
-            // Skip past any indexes that are in use. This can happen after
-            // calling `set` with a value greater than `next_index`.
-            while self
-                .descriptors
-                .contains_key(&DescriptorHandle::new(idx).unwrap())
-            {
-                trace!("Skipping past in-use index {}", idx);
+            self.grow_dense_to(idx);
 
+            // If a sparse descriptor was already at `idx`, use the next unused index instead.
+            let idx = if self.dense[idx as usize].is_none() {
+                idx
+            } else if let Some(idx) = self.available_indices.range(idx..).next().copied() {
+                self.available_indices.remove(&idx);
+                idx
+            } else {
                 // Check if the next index is out of range.
-                if idx >= FD_MAX {
+                if self.dense_len() > FD_MAX {
                     return Err(descriptor);
                 }
+                let idx = self.dense_len();
+                self.dense.push(None);
+                idx
+            };
 
-                // Won't overflow because of the check above.
-                idx += 1;
-            }
-
-            if should_update_next_index {
-                self.next_index = idx + 1;
-            }
-
-            // Take the next index.
             trace!("Using index {}", idx);
-            idx
-        };
+            self.dense[idx as usize] = Some(descriptor);
+            return Ok(DescriptorHandle::new(idx).unwrap());
+        }
 
-        let idx = DescriptorHandle::new(idx).unwrap();
+        // The index is far past the dense part. Skip past any indexes that are in use.
+        let mut idx = idx;
+        loop {
+            let Some(handle) = DescriptorHandle::new(idx) else {
+                return Err(descriptor);
+            };
+            if !self.sparse.contains_key(&handle) {
+                break;
+            }
+            trace!("Skipping past in-use index {}", idx);
+            idx += 1;
+        }
 
-        let prev = self.descriptors.insert(idx, descriptor);
+        trace!("Using sparse index {}", idx);
+        let handle = DescriptorHandle::new(idx).unwrap();
+        let prev = self.sparse.insert(handle, descriptor);
         assert!(prev.is_none(), "Already a descriptor at {}", idx);
 
-        Ok(idx)
+        Ok(handle)
     }
 
-    // Call after inserting to `available_indices`, to free any that are contiguous
-    // with `next_index`.
+    // Call after removing from the last dense index, to shrink the dense part so that its last
+    // entry isn't `None`.
     fn trim_tail(&mut self) {
-        while let Some(last_in_available) = self.available_indices.iter().next_back().copied() {
-            if (last_in_available + 1) == self.next_index {
-                // Last entry in available_indices is adjacent to next_index.
-                // We can merge them, freeing an entry in `available_indices`.
-                self.next_index -= 1;
-                self.available_indices.remove(&last_in_available);
-            } else {
-                break;
-            }
+        while let Some(None) = self.dense.last() {
+            self.dense.pop();
+            self.available_indices.remove(&self.dense_len());
         }
     }
 
+    /// Iterate over all descriptors in the table, in no particular order.
+    pub fn iter(&self) -> impl Iterator<Item = &Descriptor> {
+        self.dense.iter().flatten().chain(self.sparse.values())
+    }
+
     /// Get the descriptor at `idx`, if any.
     pub fn get(&self, idx: DescriptorHandle) -> Option<&Descriptor> {
-        self.descriptors.get(&idx)
+        match self.dense.get(idx.val() as usize) {
+            Some(desc) => desc.as_ref(),
+            None => self.sparse.get(&idx),
+        }
     }
 
     /// Get the descriptor at `idx`, if any.
     pub fn get_mut(&mut self, idx: DescriptorHandle) -> Option<&mut Descriptor> {
-        self.descriptors.get_mut(&idx)
+        match self.dense.get_mut(idx.val() as usize) {
+            Some(desc) => desc.as_mut(),
+            None => self.sparse.get_mut(&idx),
+        }
     }
 
     /// Insert a descriptor at `index`. If a descriptor is already present at that index, it is
     /// unregistered from that index and returned.
     #[must_use]
     fn set(&mut self, index: DescriptorHandle, descriptor: Descriptor) -> Option<Descriptor> {
-        // We ensure the index is no longer in `self.available_indices`. We *don't* ensure
-        // `self.next_index` is > `index`, since that'd require adding the indices in between to
-        // `self.available_indices`. It uses less memory and is no more expensive to iterate when
-        // *using* `self.available_indices` instead.
-        self.available_indices.remove(&index.val());
+        let idx = index.val();
 
-        if let Some(prev) = self.descriptors.insert(index, descriptor) {
+        let prev = if idx < self.dense_len() {
+            self.available_indices.remove(&idx);
+            self.dense[idx as usize].replace(descriptor)
+        } else if self.can_grow_dense_to(idx) {
+            self.grow_dense_to(idx);
+            self.dense[idx as usize].replace(descriptor)
+        } else {
+            self.sparse.insert(index, descriptor)
+        };
+
+        if prev.is_some() {
             trace!("Overwriting index {}", index);
-            Some(prev)
         } else {
             trace!("Setting to unused index {}", index);
-            None
         }
+
+        prev
     }
 
     /// Register a descriptor and return its fd handle. Equivalent to
@@ -179,9 +241,17 @@ impl DescriptorTable {
     /// Deregister the descriptor with the given fd handle and return it.
     #[must_use]
     pub fn deregister_descriptor(&mut self, fd: DescriptorHandle) -> Option<Descriptor> {
-        let maybe_descriptor = self.descriptors.remove(&fd);
-        self.available_indices.insert(fd.val());
-        self.trim_tail();
+        let idx = fd.val();
+
+        if idx >= self.dense_len() {
+            return self.sparse.remove(&fd);
+        }
+
+        let maybe_descriptor = self.dense[idx as usize].take();
+        if maybe_descriptor.is_some() {
+            self.available_indices.insert(idx);
+            self.trim_tail();
+        }
         maybe_descriptor
     }
 
@@ -190,7 +260,11 @@ impl DescriptorTable {
         // reset the descriptor table
         let old_self = std::mem::replace(self, Self::new());
         // return the old descriptors
-        old_self.descriptors.into_values()
+        old_self
+            .dense
+            .into_iter()
+            .flatten()
+            .chain(old_self.sparse.into_values())
     }
 }
 
@@ -309,3 +383,150 @@ impl std::fmt::Display for DescriptorHandleError {
 }
 
 impl std::error::Error for DescriptorHandleError {}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::Arc;
+
+    use atomic_refcell::AtomicRefCell;
+
+    use super::*;
+    use crate::host::descriptor::eventfd::EventFd;
+    use crate::host::descriptor::{CompatFile, File, FileStatus, OpenFile};
+
+    fn new_descriptor() -> Descriptor {
+        let eventfd = EventFd::new(0, false, FileStatus::empty());
+        let file = File::EventFd(Arc::new(AtomicRefCell::new(eventfd)));
+        Descriptor::new(CompatFile::New(OpenFile::new(file)))
+    }
+
+    fn handle(fd: u32) -> DescriptorHandle {
+        DescriptorHandle::new(fd).unwrap()
+    }
+
+    fn register(table: &mut DescriptorTable) -> u32 {
+        table.register_descriptor(new_descriptor()).unwrap().val()
+    }
+
+    #[test]
+    fn test_lowest_free_fd() {
+        let mut table = DescriptorTable::new();
+        for fd in 0..4 {
+            assert_eq!(register(&mut table), fd);
+        }
+
+        assert!(table.deregister_descriptor(handle(1)).is_some());
+        assert!(table.deregister_descriptor(handle(2)).is_some());
+        assert_eq!(register(&mut table), 1);
+        assert_eq!(register(&mut table), 2);
+        assert_eq!(register(&mut table), 4);
+
+        let fd = table
+            .register_descriptor_with_min_fd(new_descriptor(), handle(3))
+            .unwrap();
+        assert_eq!(fd.val(), 5);
+    }
+
+    #[test]
+    fn test_dense_sparse_boundary() {
+        let mut table = DescriptorTable::new();
+        assert_eq!(register(&mut table), 0);
+
+        // far past the end of the dense part, so it's stored sparsely
+        let high = 10 * MAX_DENSE_GAP;
+        assert!(table
+            .register_descriptor_with_fd(new_descriptor(), handle(high))
+            .is_none());
+        assert_eq!(table.dense_len(), 1);
+        assert!(table.get(handle(high)).is_some());
+        assert!(table.get(handle(high - 1)).is_none());
+
+        // new descriptors still get the lowest free fds
+        assert_eq!(register(&mut table), 1);
+        assert_eq!(register(&mut table), 2);
+
+        // a minimum fd near the sparse descriptor skips past it
+        let fd = table
+            .register_descriptor_with_min_fd(new_descriptor(), handle(high))
+            .unwrap();
+        assert_eq!(fd.val(), high + 1);
+
+        // a minimum fd close to the end of the dense part grows it
+        let fd = table
+            .register_descriptor_with_min_fd(new_descriptor(), handle(MAX_DENSE_GAP))
+            .unwrap();
+        assert_eq!(fd.val(), MAX_DENSE_GAP);
+        assert_eq!(table.dense_len(), MAX_DENSE_GAP + 1);
+        assert_eq!(register(&mut table), 3);
+
+        assert_eq!(table.iter().count(), 7);
+    }
+
+    #[test]
+    fn test_set_above_dense() {
+        let mut table = DescriptorTable::new();
+        assert_eq!(register(&mut table), 0);
+
+        // within the gap, so the dense part grows and the skipped fds are free
+        assert!(table
+            .register_descriptor_with_fd(new_descriptor(), handle(5))
+            .is_none());
+        assert_eq!(table.dense_len(), 6);
+        assert_eq!(register(&mut table), 1);
+
+        // replacing returns the previous descriptor, in both parts
+        let high = 10 * MAX_DENSE_GAP;
+        assert!(table
+            .register_descriptor_with_fd(new_descriptor(), handle(high))
+            .is_none());
+        assert!(table
+            .register_descriptor_with_fd(new_descriptor(), handle(high))
+            .is_some());
+        assert!(table
+            .register_descriptor_with_fd(new_descriptor(), handle(5))
+            .is_some());
+
+        // growing the dense part up to a sparse descriptor moves it into the dense part
+        let below = high - MAX_DENSE_GAP / 2;
+        for fd in (6..=below).step_by(usize::try_from(MAX_DENSE_GAP).unwrap()) {
+            assert!(table
+                .register_descriptor_with_fd(new_descriptor(), handle(fd))
+                .is_none());
+        }
+        assert!(table
+            .register_descriptor_with_fd(new_descriptor(), handle(high - 1))
+            .is_none());
+        assert_eq!(table.dense_len(), high + 1);
+        assert!(table.sparse.is_empty());
+        assert!(table.get(handle(high)).is_some());
+    }
+
+    #[test]
+    fn test_remove_and_reuse() {
+        let mut table = DescriptorTable::new();
+        for _ in 0..3 {
+            register(&mut table);
+        }
+        let high = 10 * MAX_DENSE_GAP;
+        assert!(table
+            .register_descriptor_with_fd(new_descriptor(), handle(high))
+            .is_none());
+
+        // removing a sparse descriptor
+        assert!(table.deregister_descriptor(handle(high)).is_some());
+        assert!(table.deregister_descriptor(handle(high)).is_none());
+        assert!(table.get(handle(high)).is_none());
+
+        // removing the last dense descriptors shrinks the dense part
+        assert!(table.deregister_descriptor(handle(1)).is_some());
+        assert!(table.deregister_descriptor(handle(2)).is_some());
+        assert_eq!(table.dense_len(), 1);
+        assert!(table.deregister_descriptor(handle(2)).is_none());
+
+        assert_eq!(register(&mut table), 1);
+        assert_eq!(register(&mut table), 2);
+
+        assert_eq!(table.remove_all().count(), 3);
+        assert_eq!(register(&mut table), 0);
+    }
+}
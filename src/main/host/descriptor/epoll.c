@@ -52,6 +52,8 @@ enum _EpollWatchFlags {
     /* used to track that ONESHOT mode is used, an event was already reported, and the
      * socket has not been modified since. This prevents duplicate reporting in ONESHOT mode. */
     EWF_ONESHOT_REPORTED = 1 << 12,
+    /* set if the watch was added with EPOLLEXCLUSIVE, in which case it can't be modified */
+    EWF_EXCLUSIVE = 1 << 13,
 };
 
 typedef enum _EpollWatchTypes EpollWatchTypes;
@@ -107,8 +109,9 @@ struct _Epoll {
     /* holds the wrappers for the descriptors we are watching for events */
     GHashTable* watching;
 
-    /* holds the descriptors that we are watching that have events */
-    GHashTable* ready;
+    /* holds the descriptors that we are watching that have events, sorted by fd so that they are
+     * reported in a deterministic order without sorting them on every epoll_wait */
+    GTree* ready;
 
     /* A counter for sorting watches, for guaranteeing determinism when reporting events. */
     uint64_t watch_id_counter;
@@ -137,17 +140,20 @@ static gboolean _epollkey_equal(gconstpointer ptr_1, gconstpointer ptr_2) {
     return key_1->fd == key_2->fd && key_1->objectPtr == key_2->objectPtr;
 }
 
-/* compare by the associated file descriptor */
-static gint _epollkey_compare(gconstpointer ptr_1, gconstpointer ptr_2) {
+/* compare by the associated file descriptor, and then by the object so that the keys have a total
+ * order. Two keys with the same fd but different objects should never both be ready, so the
+ * (non-deterministic) object order doesn't affect the order in which events are reported. */
+static gint _epollkey_compare(gconstpointer ptr_1, gconstpointer ptr_2, gpointer userData) {
     const EpollKey* key_1 = ptr_1;
     const EpollKey* key_2 = ptr_2;
 
-    /* if the fds are the same but the objects are different, something went wrong */
-    if (key_1->fd == key_2->fd) {
-        assert(key_1->objectPtr == key_2->objectPtr);
+    if (key_1->fd != key_2->fd) {
+        return (key_1->fd < key_2->fd) ? -1 : 1;
     }
-
-    return key_1->fd - key_2->fd;
+    if (key_1->objectPtr != key_2->objectPtr) {
+        return (key_1->objectPtr < key_2->objectPtr) ? -1 : 1;
+    }
+    return 0;
 }
 
 static gint _epollwatch_compare(gconstpointer ptr_1, gconstpointer ptr_2) {
@@ -248,6 +254,10 @@ static void _epollwatch_unref(EpollWatch* watch) {
     }
 }
 
+static GTree* _epoll_newReadyTree(void) {
+    return g_tree_new_full(_epollkey_compare, NULL, g_free, (GDestroyNotify)_epollwatch_unref);
+}
+
 static Epoll* _epoll_fromLegacyFile(LegacyFile* descriptor) {
     utility_debugAssert(legacyfile_getType(descriptor) == DT_EPOLL);
     return (Epoll*)descriptor;
@@ -260,7 +270,7 @@ static void _epoll_free(LegacyFile* descriptor) {
 
     /* this unrefs all of the remaining watches */
     g_hash_table_destroy(epoll->watching);
-    g_hash_table_destroy(epoll->ready);
+    g_tree_destroy(epoll->ready);
 
     legacyfile_clear((LegacyFile*)epoll);
     MAGIC_CLEAR(epoll);
@@ -311,8 +321,12 @@ void epoll_clearWatchListeners(Epoll* epoll) {
 void epoll_reset(Epoll* epoll) {
     MAGIC_ASSERT(epoll);
     epoll_clearWatchListeners(epoll);
-    // Removing will also unref previously stored descriptors
-    g_hash_table_remove_all(epoll->ready);
+    // Removing will also unref previously stored descriptors. poll and select reset their epoll on
+    // every call, so skip reallocating the tree when there is nothing to remove.
+    if (g_tree_nnodes(epoll->ready) > 0) {
+        g_tree_destroy(epoll->ready);
+        epoll->ready = _epoll_newReadyTree();
+    }
     g_hash_table_remove_all(epoll->watching);
 }
 
@@ -332,7 +346,7 @@ Epoll* epoll_new() {
 
     /* allocate backend needed for managing events for this descriptor */
     epoll->watching = g_hash_table_new_full(_epollkey_hash, _epollkey_equal, g_free, (GDestroyNotify)_epollwatch_unref);
-    epoll->ready = g_hash_table_new_full(_epollkey_hash, _epollkey_equal, g_free, (GDestroyNotify)_epollwatch_unref);
+    epoll->ready = _epoll_newReadyTree();
 
     /* the epoll descriptor itself is always able to be epolled */
     legacyfile_adjustStatus(&(epoll->super), STATUS_FILE_ACTIVE, TRUE);
@@ -373,6 +387,7 @@ static void _epollwatch_updateStatus(EpollWatch* watch) {
     watch->flags |= (watch->event.events & EPOLLOUT) ? EWF_WAITINGWRITE : EWF_NONE;
     watch->flags |= (watch->event.events & EPOLLET) ? EWF_EDGETRIGGER : EWF_NONE;
     watch->flags |= (watch->event.events & EPOLLONESHOT) ? EWF_ONESHOT : EWF_NONE;
+    watch->flags |= (watch->event.events & EPOLLEXCLUSIVE) ? EWF_EXCLUSIVE : EWF_NONE;
 
     /* add back in our lazyFlags that we dont check separately */
     watch->flags |= lazyFlags;
@@ -386,6 +401,23 @@ static void _epollwatch_updateStatus(EpollWatch* watch) {
     }
 }
 
+/* Listen only for the status changes that can affect the events this watch reports, so that
+ * unrelated changes (for example a readable socket becoming writable when only EPOLLIN is
+ * requested) don't call back into the epoll. */
+static void _epollwatch_updateMonitorStatus(EpollWatch* watch) {
+    MAGIC_ASSERT(watch);
+
+    Status monitoring = STATUS_FILE_ACTIVE | STATUS_FILE_CLOSED;
+    if (watch->event.events & EPOLLIN) {
+        monitoring |= STATUS_FILE_READABLE;
+    }
+    if (watch->event.events & EPOLLOUT) {
+        monitoring |= STATUS_FILE_WRITABLE;
+    }
+
+    statuslistener_setMonitorStatus(watch->listener, monitoring, SLF_ALWAYS);
+}
+
 static gboolean _epollwatch_isReady(EpollWatch* watch) {
     MAGIC_ASSERT(watch);
 
@@ -515,20 +547,31 @@ gint epoll_control(Epoll* epoll, gint operation, int fd, const Descriptor* descr
                 break;
             }
 
+            /* EINVAL EPOLLEXCLUSIVE was specified with flags other than the ones
+             * below (the same as Linux's EPOLLEXCLUSIVE_OK_BITS), or the target is
+             * an epoll instance. Shadow never wakes more than the one thread that
+             * the event was reported to (threads that lose the race re-check their
+             * condition and keep blocking), so otherwise the flag needs no special
+             * handling. */
+            if (event->events & EPOLLEXCLUSIVE) {
+                const uint32_t allowed = EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLWAKEUP |
+                                         EPOLLET | EPOLLEXCLUSIVE;
+                if ((event->events & ~allowed) ||
+                    (watchType == EWT_LEGACY_FILE &&
+                     legacyfile_getType(watchObject.as_legacy_file) == DT_EPOLL)) {
+                    rv = -EINVAL;
+                    break;
+                }
+            }
+
             /* start watching for status changes */
             watch = _epollwatch_new(epoll, fd, watchType, watchObject, event, host);
             watch->flags |= EWF_WATCHING;
             gpointer new_key = _epollkey_new(key.fd, key.objectPtr);
             g_hash_table_replace(epoll->watching, new_key, watch);
 
-            /* It's added, so we need to listen for changes. Here we listen for
-             * all statuses, because epoll will filter what it needs.
-             * TODO: lean more heavily on statuslistener and simplify epoll.
-             */
-            statuslistener_setMonitorStatus(watch->listener,
-                                            STATUS_FILE_ACTIVE | STATUS_FILE_CLOSED |
-                                                STATUS_FILE_READABLE | STATUS_FILE_WRITABLE,
-                                            SLF_ALWAYS);
+            /* It's added, so we need to listen for changes. */
+            _epollwatch_updateMonitorStatus(watch);
             if (watch->watchType == EWT_LEGACY_FILE) {
                 legacyfile_addListener(watch->watchObject.as_legacy_file, watch->listener);
             } else if (watch->watchType == EWT_GENERIC_FILE) {
@@ -551,11 +594,20 @@ gint epoll_control(Epoll* epoll, gint operation, int fd, const Descriptor* descr
             MAGIC_ASSERT(watch);
             utility_debugAssert(event && (watch->flags & EWF_WATCHING));
 
+            /* EINVAL op was EPOLL_CTL_MOD and either the events include
+             * EPOLLEXCLUSIVE or it was previously set for this fd. */
+            if ((event->events & EPOLLEXCLUSIVE) || (watch->flags & EWF_EXCLUSIVE)) {
+                rv = -EINVAL;
+                break;
+            }
+
             /* the user set new events */
             watch->event = *event;
             /* we would need to report the new event again if in ET or ONESHOT modes */
             watch->flags &= ~EWF_EDGETRIGGER_REPORTED;
             watch->flags &= ~EWF_ONESHOT_REPORTED;
+            /* the status changes that we need to listen for may have changed */
+            _epollwatch_updateMonitorStatus(watch);
 
             /* initiate a callback if the new event type on the watched object is ready */
             _epoll_fileStatusChanged(epoll, &key);
@@ -582,7 +634,7 @@ gint epoll_control(Epoll* epoll, gint operation, int fd, const Descriptor* descr
             }
 
             /* unref gets called on the watch when it is removed from these tables */
-            g_hash_table_remove(epoll->ready, &key);
+            g_tree_remove(epoll->ready, &key);
             g_hash_table_remove(epoll->watching, &key);
             /* if that was the last watch, this epoll is not readable to its parents */
             _epoll_fileStatusChanged(epoll, NULL);
@@ -612,117 +664,114 @@ gint epoll_control(Epoll* epoll, gint operation, int fd, const Descriptor* descr
 
 guint epoll_getNumReadyEvents(Epoll* epoll) {
     MAGIC_ASSERT(epoll);
-    return g_hash_table_size(epoll->ready);
+    return g_tree_nnodes(epoll->ready);
 }
 
-gint epoll_getEvents(Epoll* epoll, struct epoll_event* eventArray, gint eventArrayLength, gint* nEvents) {
-    MAGIC_ASSERT(epoll);
-    utility_debugAssert(nEvents);
-
-    /* return the available events in the eventArray, making sure not to
-     * overflow. the number of actual events is returned in nEvents. */
-    gint eventIndex = 0;
+typedef struct _EpollCollectState EpollCollectState;
+struct _EpollCollectState {
+    Epoll* epoll;
+    struct epoll_event* eventArray;
+    gint eventArrayLength;
+    gint eventIndex;
+    /* the keys of the watches that are no longer ready after being reported */
+    GList* notReadyList;
+};
 
-    /*
-     * We need to guarantee that the events are returned in a deterministic order when the
-     * simulation is run multiple times, so we cannot use hash table iterator.
-     * Using a list here has some potential performance implications:
-     * - O(n) to loop the hash table and create the list of values
-     * - O(n) to sort the list
-     * - O(n) for our iteration of the list
-     * We think that the ready list is typically small and so 3*O(n) will be small in practice.
-     * If this turns out not to be the case, we could consider maintaining a sorted object of the
-     * ready watch values alongside the epoll->ready hash table instead, which may allow us
-     * to improve the performance of this function. One option is to use binary trees, e.g.,
-     * https://developer.gnome.org/glib/2.68/glib-Balanced-Binary-Trees.html
-     * We should test the performance before and after such a change.
-     */
-    GList* ready_list = g_hash_table_get_keys(epoll->ready);
-    GList* next_key = NULL;
+/* GTraverseFunc that reports the event for a ready watch; returns TRUE to stop the traversal */
+static gboolean _epoll_collectEvent(gpointer keyPtr, gpointer watchPtr, gpointer statePtr) {
+    EpollKey* key = keyPtr;
+    EpollWatch* watch = watchPtr;
+    EpollCollectState* state = statePtr;
+    assert(key != NULL);
+    MAGIC_ASSERT(watch);
 
-    /* Prepare the list for deterministic iteration. */
-    if (ready_list != NULL) {
-        ready_list = g_list_sort(ready_list, _epollkey_compare);
-        next_key = g_list_first(ready_list);
+    if (state->eventIndex >= state->eventArrayLength) {
+        return TRUE;
     }
 
-    GList* not_ready_list = NULL;
+    if (_epollwatch_isReady(watch)) {
+        struct epoll_event* event = &state->eventArray[state->eventIndex];
 
-    /* Iterate the list. */
-    while ((next_key != NULL) && (eventIndex < eventArrayLength)) {
-        EpollKey* key = next_key->data;
-        assert(key != NULL);
-
-        EpollWatch* watch = g_hash_table_lookup(epoll->ready, key);
-        MAGIC_ASSERT(watch);
-
-        if (_epollwatch_isReady(watch)) {
-            /* report the event */
-            eventArray[eventIndex] = watch->event;
-            eventArray[eventIndex].events = 0;
-
-            if((watch->flags & EWF_READABLE) && (watch->flags & EWF_WAITINGREAD)) {
-                eventArray[eventIndex].events |= EPOLLIN;
-            }
-            if((watch->flags & EWF_WRITEABLE) && (watch->flags & EWF_WAITINGWRITE)) {
-                eventArray[eventIndex].events |= EPOLLOUT;
-            }
+        /* report the event */
+        *event = watch->event;
+        event->events = 0;
 
-            /* Record that we are reporting the event now. */
-            watch->last_reported_event_time = worker_getCurrentEmulatedTime();
+        if ((watch->flags & EWF_READABLE) && (watch->flags & EWF_WAITINGREAD)) {
+            event->events |= EPOLLIN;
+        }
+        if ((watch->flags & EWF_WRITEABLE) && (watch->flags & EWF_WAITINGWRITE)) {
+            event->events |= EPOLLOUT;
+        }
 
-            /* event was just collected, unset the change status */
-            watch->flags &= ~EWF_READCHANGED;
-            watch->flags &= ~EWF_WRITECHANGED;
+        /* Record that we are reporting the event now. */
+        watch->last_reported_event_time = worker_getCurrentEmulatedTime();
 
-            eventIndex++;
-            utility_debugAssert(eventIndex <= eventArrayLength);
+        /* event was just collected, unset the change status */
+        watch->flags &= ~EWF_READCHANGED;
+        watch->flags &= ~EWF_WRITECHANGED;
 
-            if(watch->flags & EWF_EDGETRIGGER) {
-                /* tag that an event was collected in ET mode */
-                watch->flags |= EWF_EDGETRIGGER_REPORTED;
-            }
-            if(watch->flags & EWF_ONESHOT) {
-                /* they collected the event, dont report any more */
-                watch->flags |= EWF_ONESHOT_REPORTED;
-            }
+        state->eventIndex++;
+        utility_debugAssert(state->eventIndex <= state->eventArrayLength);
 
-            /* record any that are no longer ready */
-            if (!_epollwatch_isReady(watch)) {
-                not_ready_list = g_list_append(not_ready_list, key);
-            }
-        } else {
-            error("epoll %p ready list has items that aren't ready", &epoll->super);
+        if (watch->flags & EWF_EDGETRIGGER) {
+            /* tag that an event was collected in ET mode */
+            watch->flags |= EWF_EDGETRIGGER_REPORTED;
+        }
+        if (watch->flags & EWF_ONESHOT) {
+            /* they collected the event, dont report any more */
+            watch->flags |= EWF_ONESHOT_REPORTED;
         }
 
-        next_key = g_list_next(next_key);
-    }
-
-    /* Cleanup just the list but not the list values, which are owned by the hash table. */
-    if (ready_list) {
-        g_list_free(ready_list);
+        /* record any that are no longer ready; we can't remove them from the tree while
+         * traversing it */
+        if (!_epollwatch_isReady(watch)) {
+            state->notReadyList = g_list_prepend(state->notReadyList, key);
+        }
+    } else {
+        error("epoll %p ready list has items that aren't ready", &state->epoll->super);
     }
 
-    *nEvents = eventIndex;
+    return state->eventIndex >= state->eventArrayLength;
+}
 
-    trace("epoll descriptor %p collected %i events", &epoll->super, eventIndex);
+gint epoll_getEvents(Epoll* epoll, struct epoll_event* eventArray, gint eventArrayLength, gint* nEvents) {
+    MAGIC_ASSERT(epoll);
+    utility_debugAssert(nEvents);
 
-    next_key = NULL;
-    if (not_ready_list) {
-        next_key = g_list_first(not_ready_list);
+    /* return the available events in the eventArray, making sure not to
+     * overflow. the number of actual events is returned in nEvents.
+     *
+     * We need to guarantee that the events are returned in a deterministic order when the
+     * simulation is run multiple times. The ready tree is kept sorted by fd, so an in-order
+     * traversal that stops once the array is full only visits the events we return. */
+    EpollCollectState state = {
+        .epoll = epoll,
+        .eventArray = eventArray,
+        .eventArrayLength = eventArrayLength,
+        .eventIndex = 0,
+        .notReadyList = NULL,
+    };
+
+    if (eventArrayLength > 0) {
+        g_tree_foreach(epoll->ready, _epoll_collectEvent, &state);
     }
 
+    *nEvents = state.eventIndex;
+
+    trace("epoll descriptor %p collected %i events", &epoll->super, state.eventIndex);
+
     /* We modified some watched objects above, so remove any that are no longer ready. */
+    GList* next_key = state.notReadyList;
     while (next_key != NULL) {
         EpollKey* key = next_key->data;
-        gboolean removed = g_hash_table_remove(epoll->ready, key);
+        gboolean removed = g_tree_remove(epoll->ready, key);
         assert(removed);
 
         next_key = g_list_next(next_key);
     }
 
-    if (not_ready_list) {
-        g_list_free(not_ready_list);
+    if (state.notReadyList) {
+        g_list_free(state.notReadyList);
     }
 
     /* if we consumed all the events that we had to report,
@@ -748,14 +797,14 @@ static void _epoll_fileStatusChanged(Epoll* epoll, const EpollKey* key) {
 
             /* check if its ready (has an event to report) now */
             if (_epollwatch_isReady(watch)) {
-                if (!g_hash_table_contains(epoll->ready, key)) {
+                if (g_tree_lookup(epoll->ready, key) == NULL) {
                     _epollwatch_ref(watch);
                     gpointer keyCopy = _epollkey_new(key->fd, key->objectPtr);
-                    g_hash_table_replace(epoll->ready, keyCopy, watch);
+                    g_tree_insert(epoll->ready, keyCopy, watch);
                 }
             } else {
-                /* this calls unref on the watch if its in the table */
-                g_hash_table_remove(epoll->ready, key);
+                /* this calls unref on the watch if its in the tree */
+                g_tree_remove(epoll->ready, key);
             }
 
             /* if it's closed, then remove it from the watching list */
@@ -763,7 +812,7 @@ static void _epoll_fileStatusChanged(Epoll* epoll, const EpollKey* key) {
                 /* unref gets called on the watch when it is removed from these tables */
                 g_hash_table_remove(epoll->watching, key);
                 /* we should have removed it from the ready list earlier */
-                utility_debugAssert(!g_hash_table_contains(epoll->ready, key));
+                utility_debugAssert(g_tree_lookup(epoll->ready, key) == NULL);
             }
         }
     }
@@ -2,20 +2,29 @@ use std::io::{Read, Write};
 
 use linux_api::errno::Errno;
 use linux_api::ioctls::IoctlRequest;
+use shadow_shim_helper_rs::eventfd_table::EventFdTable;
 use shadow_shim_helper_rs::syscall_types::ForeignPtr;
 
+use crate::core::worker::Worker;
 use crate::cshadow as c;
+use crate::host::descriptor::descriptor_table::DescriptorHandle;
 use crate::host::descriptor::{
     FileMode, FileState, FileStatus, StateEventSource, StateListenerFilter,
 };
+use crate::host::host::Host;
 use crate::host::memory_manager::MemoryManager;
+use crate::host::process::ProcessId;
 use crate::host::syscall::io::{IoVec, IoVecReader, IoVecWriter};
 use crate::host::syscall_types::{SyscallError, SyscallResult};
 use crate::utility::callback_queue::{CallbackQueue, Handle};
 use crate::utility::HostTreePointer;
 
 pub struct EventFd {
+    /// The counter, unless it's in the host's shared memory (see `shim_slot`).
     counter: u64,
+    /// The eventfd's slot in the host's shared [`EventFdTable`], which holds the counter while the
+    /// shim is allowed to read and write it directly.
+    shim_slot: Option<usize>,
     is_semaphore_mode: bool,
     event_source: StateEventSource,
     state: FileState,
@@ -29,6 +38,7 @@ impl EventFd {
     pub fn new(init_value: u64, is_semaphore_mode: bool, status: FileStatus) -> Self {
         Self {
             counter: init_value,
+            shim_slot: None,
             is_semaphore_mode,
             event_source: StateEventSource::new(),
             state: FileState::ACTIVE | FileState::WRITABLE,
@@ -61,7 +71,69 @@ impl EventFd {
         self.has_open_file = val;
     }
 
+    /// Move the counter into the host's shared memory, so that the shim can handle reads and
+    /// writes of `fd` in process `pid` that don't block while Shadow has no listeners on the
+    /// eventfd. Does nothing if there's no room in shared memory or `fd` is too large.
+    pub fn share_with_shim(&mut self, host: &Host, pid: ProcessId, fd: DescriptorHandle) {
+        if self.shim_slot.is_some() || self.state.contains(FileState::CLOSED) {
+            return;
+        }
+        self.shim_slot = host.shim_shmem().eventfds.alloc(
+            pid.into(),
+            fd.into(),
+            self.counter,
+            self.is_semaphore_mode,
+        );
+    }
+
+    /// Stop the shim from accessing the eventfd, and move the counter back out of shared memory.
+    /// Called when the descriptor that the shim accesses is closed or replaced.
+    pub fn stop_sharing_with_shim(&mut self) {
+        let Some(idx) = self.shim_slot else {
+            return;
+        };
+        // if there's no active host, the host is being freed along with its shared memory
+        if let Some(counter) = Worker::with_active_host(|host| host.shim_shmem().eventfds.free(idx))
+        {
+            self.counter = counter;
+        }
+        self.shim_slot = None;
+    }
+
+    /// Returns `None` if there's no active host, in which case the host is being freed along with
+    /// its shared memory (see [`Self::stop_sharing_with_shim`]).
+    fn with_shim_table<R>(f: impl FnOnce(&EventFdTable) -> R) -> Option<R> {
+        Worker::with_active_host(|host| f(&host.shim_shmem().eventfds))
+    }
+
+    fn counter(&self) -> u64 {
+        self.shim_slot
+            .and_then(|idx| Self::with_shim_table(|table| table.counter(idx)))
+            .unwrap_or(self.counter)
+    }
+
+    fn set_counter(&mut self, counter: u64) {
+        let shared = self
+            .shim_slot
+            .and_then(|idx| Self::with_shim_table(|table| table.set_counter(idx, counter)));
+        if shared.is_none() {
+            self.counter = counter;
+        }
+    }
+
+    /// Allow the shim to change the counter only while nothing is listening for changes to our
+    /// state, since it doesn't notify anyone. Called after adding a listener, and after each
+    /// operation that Shadow handles, so that the shim can resume once listeners are removed.
+    fn update_shim_listening(&self) {
+        if let Some(idx) = self.shim_slot {
+            let listening = self.event_source.num_listeners() > 0;
+            Self::with_shim_table(|table| table.set_shadow_listening(idx, listening));
+        }
+    }
+
     pub fn close(&mut self, cb_queue: &mut CallbackQueue) -> Result<(), SyscallError> {
+        self.stop_sharing_with_shim();
+
         // set the closed flag and remove the active, readable, and writable flags
         self.copy_state(
             FileState::CLOSED | FileState::ACTIVE | FileState::READABLE | FileState::WRITABLE,
@@ -100,8 +172,13 @@ impl EventFd {
             return Err(Errno::EINVAL.into());
         }
 
-        if self.counter == 0 {
+        // the shim may have changed the counter since we last updated our state
+        self.update_state(cb_queue);
+
+        let counter = self.counter();
+        if counter == 0 {
             log::trace!("Eventfd counter is 0 and cannot be read right now");
+            self.update_shim_listening();
             return Err(Errno::EWOULDBLOCK.into());
         }
 
@@ -111,14 +188,15 @@ impl EventFd {
         if self.is_semaphore_mode {
             const ONE: [u8; NUM_BYTES] = 1u64.to_ne_bytes();
             writer.write_all(&ONE)?;
-            self.counter -= 1;
+            self.set_counter(counter - 1);
         } else {
-            let to_write: [u8; NUM_BYTES] = self.counter.to_ne_bytes();
+            let to_write: [u8; NUM_BYTES] = counter.to_ne_bytes();
             writer.write_all(&to_write)?;
-            self.counter = 0;
+            self.set_counter(0);
         }
 
         self.update_state(cb_queue);
+        self.update_shim_listening();
 
         Ok(NUM_BYTES.try_into().unwrap())
     }
@@ -168,14 +246,20 @@ impl EventFd {
             return Err(Errno::EINVAL.into());
         }
 
+        // the shim may have changed the counter since we last updated our state
+        self.update_state(cb_queue);
+
         const MAX_ALLOWED: u64 = u64::MAX - 1;
-        if value > MAX_ALLOWED - self.counter {
+        let counter = self.counter();
+        if value > MAX_ALLOWED - counter {
             log::trace!("The write value does not currently fit into the counter");
+            self.update_shim_listening();
             return Err(Errno::EWOULDBLOCK.into());
         }
 
-        self.counter += value;
+        self.set_counter(counter + value);
         self.update_state(cb_queue);
+        self.update_shim_listening();
 
         Ok(NUM_BYTES.try_into().unwrap())
     }
@@ -196,12 +280,18 @@ impl EventFd {
         filter: StateListenerFilter,
         notify_fn: impl Fn(FileState, FileState, &mut CallbackQueue) + Send + Sync + 'static,
     ) -> Handle<(FileState, FileState)> {
-        self.event_source
-            .add_listener(monitoring, filter, notify_fn)
+        self.sync_shim_state();
+        let handle = self
+            .event_source
+            .add_listener(monitoring, filter, notify_fn);
+        self.update_shim_listening();
+        handle
     }
 
     pub fn add_legacy_listener(&mut self, ptr: HostTreePointer<c::StatusListener>) {
+        self.sync_shim_state();
         self.event_source.add_legacy_listener(ptr);
+        self.update_shim_listening();
     }
 
     pub fn remove_legacy_listener(&mut self, ptr: *mut c::StatusListener) {
@@ -209,20 +299,41 @@ impl EventFd {
     }
 
     pub fn state(&self) -> FileState {
-        self.state
+        if self.shim_slot.is_none() || self.state.contains(FileState::CLOSED) {
+            return self.state;
+        }
+        // the shim may have changed the counter since we last updated our state
+        let mut state = self.state;
+        state.remove(FileState::READABLE | FileState::WRITABLE);
+        state.insert(Self::readable_writable(self.counter()));
+        state
     }
 
-    fn update_state(&mut self, cb_queue: &mut CallbackQueue) {
-        if self.state.contains(FileState::CLOSED) {
-            return;
+    /// Update our state with any changes that the shim made to the counter. Since the shim only
+    /// changes the counter while there are no listeners, there's no one to notify.
+    fn sync_shim_state(&mut self) {
+        if self.shim_slot.is_some() {
+            CallbackQueue::queue_and_run(|cb_queue| self.update_state(cb_queue));
         }
+    }
 
+    fn readable_writable(counter: u64) -> FileState {
         let mut readable_writable = FileState::empty();
 
         // set the descriptor as readable if we have a non-zero counter
-        readable_writable.set(FileState::READABLE, self.counter > 0);
+        readable_writable.set(FileState::READABLE, counter > 0);
         // set the descriptor as writable if we can write a value of at least 1
-        readable_writable.set(FileState::WRITABLE, self.counter < u64::MAX - 1);
+        readable_writable.set(FileState::WRITABLE, counter < u64::MAX - 1);
+
+        readable_writable
+    }
+
+    fn update_state(&mut self, cb_queue: &mut CallbackQueue) {
+        if self.state.contains(FileState::CLOSED) {
+            return;
+        }
+
+        let readable_writable = Self::readable_writable(self.counter());
 
         self.copy_state(
             FileState::READABLE | FileState::WRITABLE,
@@ -9,7 +9,9 @@ use socket::{Socket, SocketRef, SocketRefMut};
 use super::host::Host;
 use crate::core::worker;
 use crate::cshadow as c;
+use crate::host::descriptor::descriptor_table::DescriptorHandle;
 use crate::host::memory_manager::MemoryManager;
+use crate::host::process::ProcessId;
 use crate::host::syscall::io::IoVec;
 use crate::host::syscall_types::{SyscallError, SyscallResult};
 use crate::utility::callback_queue::{CallbackQueue, EventSource, Handle};
@@ -279,6 +281,11 @@ impl StateEventSource {
         self.legacy_helper.remove_listener(ptr);
     }
 
+    /// The number of listeners (including legacy listeners) that are currently subscribed.
+    pub fn num_listeners(&self) -> usize {
+        self.inner.num_listeners()
+    }
+
     pub fn notify_listeners(
         &mut self,
         state: FileState,
@@ -595,6 +602,13 @@ pub struct Descriptor {
     file: CompatFile,
     /// Descriptor flags.
     flags: DescriptorFlags,
+    /// Whether the managed process also has this descriptor open natively with the same fd
+    /// number, sharing the same open file description. I/O syscalls on such a descriptor can run
+    /// natively in the managed process.
+    native_in_plugin: bool,
+    /// Set if the shim may access the eventfd that this descriptor points to directly by the
+    /// descriptor's fd, which it must stop doing when the descriptor is closed or replaced.
+    shim_eventfd: Option<ShimEventFdGuard>,
     _counter: ObjectCounter,
 }
 
@@ -607,6 +621,8 @@ impl Descriptor {
         Self {
             file,
             flags: DescriptorFlags::empty(),
+            native_in_plugin: false,
+            shim_eventfd: None,
             _counter: ObjectCounter::new("Descriptor"),
         }
     }
@@ -623,6 +639,28 @@ impl Descriptor {
         self.flags = flags;
     }
 
+    pub fn is_native_in_plugin(&self) -> bool {
+        self.native_in_plugin
+    }
+
+    pub fn set_native_in_plugin(&mut self, native_in_plugin: bool) {
+        self.native_in_plugin = native_in_plugin;
+    }
+
+    /// Let the shim access the eventfd that this descriptor points to directly as `fd` in process
+    /// `pid`, until this descriptor is dropped. `fd` must be this descriptor's fd in the
+    /// descriptor table of `pid`.
+    pub fn share_eventfd_with_shim(&mut self, host: &Host, pid: ProcessId, fd: DescriptorHandle) {
+        let CompatFile::New(open_file) = &self.file else {
+            return;
+        };
+        let File::EventFd(eventfd) = open_file.inner_file() else {
+            return;
+        };
+        eventfd.borrow_mut().share_with_shim(host, pid, fd);
+        self.shim_eventfd = Some(ShimEventFdGuard(Arc::clone(eventfd)));
+    }
+
     pub fn into_file(self) -> CompatFile {
         self.file
     }
@@ -638,11 +676,15 @@ impl Descriptor {
 
     /// Duplicate the descriptor, with both descriptors pointing to the same `OpenFile`. In
     /// Linux, the descriptor flags aren't typically copied to the new descriptor, so we
-    /// explicitly require a flags value to avoid confusion.
+    /// explicitly require a flags value to avoid confusion. The new descriptor is never native in
+    /// the plugin, since the managed process doesn't have a native fd with the new number. For
+    /// the same reason, the shim can't access the new descriptor's eventfd directly.
     pub fn dup(&self, flags: DescriptorFlags) -> Self {
         Self {
             file: self.file.clone(),
             flags,
+            native_in_plugin: false,
+            shim_eventfd: None,
             _counter: ObjectCounter::new("Descriptor"),
         }
     }
@@ -728,6 +770,26 @@ impl Drop for CountedLegacyFileRef {
     }
 }
 
+/// Stops the shim from accessing an eventfd directly when the descriptor that it's accessed through
+/// is dropped. A copy of the descriptor in another descriptor table (after a fork) also stops the
+/// shim when it's dropped, since we don't track which copy the shim uses.
+#[derive(Clone)]
+struct ShimEventFdGuard(Arc<AtomicRefCell<eventfd::EventFd>>);
+
+impl std::fmt::Debug for ShimEventFdGuard {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_tuple("ShimEventFdGuard")
+            .field(&Arc::as_ptr(&self.0))
+            .finish()
+    }
+}
+
+impl Drop for ShimEventFdGuard {
+    fn drop(&mut self) {
+        self.0.borrow_mut().stop_sharing_with_shim();
+    }
+}
+
 /// Used to track how many descriptors are open for a `LegacyFile`. When the `close()` method is
 /// called, the legacy file's `legacyfile_close()` will only be called if this is the last
 /// descriptor for that legacy file. This is similar to an `OpenFile` object.
@@ -906,6 +968,27 @@ mod export {
         descriptor.set_flags(flags);
     }
 
+    #[no_mangle]
+    pub extern "C" fn descriptor_isNativeInPlugin(descriptor: *const Descriptor) -> bool {
+        assert!(!descriptor.is_null());
+
+        let descriptor = unsafe { &*descriptor };
+        descriptor.is_native_in_plugin()
+    }
+
+    /// Mark the descriptor as also being open natively in the managed process with the same fd
+    /// number, sharing the same open file description.
+    #[no_mangle]
+    pub extern "C" fn descriptor_setNativeInPlugin(
+        descriptor: *mut Descriptor,
+        native_in_plugin: bool,
+    ) {
+        assert!(!descriptor.is_null());
+
+        let descriptor = unsafe { &mut *descriptor };
+        descriptor.set_native_in_plugin(native_in_plugin);
+    }
+
     /// Decrement the ref count of the `OpenFile` object. The pointer must not be used after calling
     /// this function.
     #[no_mangle]
@@ -181,6 +181,33 @@ impl Pipe {
             return Err(linux_api::errno::Errno::EBADF.into());
         }
 
+        let len: libc::size_t = iovs.iter().map(|x| x.len).sum();
+
+        let reader = IoVecReader::new(iovs, mem);
+
+        self.write_helper(reader, len, cb_queue)
+    }
+
+    /// Write bytes from shadow's memory rather than the plugin's, for example for `sendfile()`.
+    pub fn write_bytes(
+        &mut self,
+        bytes: &[u8],
+        cb_queue: &mut CallbackQueue,
+    ) -> Result<libc::ssize_t, SyscallError> {
+        // if the file is not open for writing, return EBADF
+        if !self.mode.contains(FileMode::WRITE) {
+            return Err(linux_api::errno::Errno::EBADF.into());
+        }
+
+        self.write_helper(bytes, bytes.len(), cb_queue)
+    }
+
+    fn write_helper(
+        &mut self,
+        mut reader: impl std::io::Read,
+        len: libc::size_t,
+        cb_queue: &mut CallbackQueue,
+    ) -> Result<libc::ssize_t, SyscallError> {
         let mut buffer = self.buffer.as_ref().unwrap().borrow_mut();
 
         if buffer.num_readers() == 0 {
@@ -199,10 +226,6 @@ impl Pipe {
             }
         }
 
-        let len: libc::size_t = iovs.iter().map(|x| x.len).sum();
-
-        let mut reader = IoVecReader::new(iovs, mem);
-
         let num_copied = match self.write_mode {
             WriteMode::Stream => buffer.write_stream(&mut reader, len, cb_queue)?,
             WriteMode::Packet => {
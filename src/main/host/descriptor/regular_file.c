@@ -61,6 +61,10 @@ struct _RegularFile {
             mode_t modeAtOpen;
             /* The path of the file when it was opened. */
             char* absPathAtOpen;
+            /* The file's contents if they're in the shared file cache, in which case reads are
+             * served from the cache and `cachedOffset` is used instead of the fd's offset. */
+            CachedFile* cached;
+            off_t cachedOffset;
         } osfile;
         struct {
             off_t cursor;
@@ -122,8 +126,42 @@ static inline bool _fd_isValid(int fd) { return fd >= 0; }
 
 int regularfile_getOSBackedFD(RegularFile* file) { return _regularfile_getOSBackedFD(file); }
 
+void regularfile_replaceOSBackedFD(RegularFile* file, int osfd) {
+    MAGIC_ASSERT(file);
+    utility_debugAssert(file->type == FILE_TYPE_REGULAR);
+    utility_debugAssert(_fd_isValid(file->osfile.fd) && _fd_isValid(osfd));
+
+    trace("On file %p, replacing os-backed file %i with %i", file, file->osfile.fd, osfd);
+
+    close(file->osfile.fd);
+    file->osfile.fd = osfd;
+}
+
+bool regularfile_isRegularFileInDir(RegularFile* file, const char* dirPath) {
+    MAGIC_ASSERT(file);
+
+    if (file->type != FILE_TYPE_REGULAR || !_fd_isValid(file->osfile.fd) ||
+        !file->osfile.absPathAtOpen || file->osfile.cached) {
+        return false;
+    }
+
+    size_t dirLen = strlen(dirPath);
+    if (strncmp(file->osfile.absPathAtOpen, dirPath, dirLen) != 0 ||
+        file->osfile.absPathAtOpen[dirLen] != '/') {
+        return false;
+    }
+
+    struct stat statbuf;
+    return fstat(file->osfile.fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode);
+}
+
 static void _regularfile_closeHelper(RegularFile* file) {
     if(file && file->type != FILE_TYPE_IN_MEMORY) {
+        if (file->osfile.cached) {
+            cachedfile_free(file->osfile.cached);
+            file->osfile.cached = NULL;
+        }
+
         if (file && _fd_isValid(file->osfile.fd)) {
             trace("On file %p, closing os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
@@ -334,6 +372,17 @@ int regularfile_openat(RegularFile* file, RegularFile* dir, const char* pathname
     // we should always use O_CLOEXEC for files opened in shadow
     flags |= O_CLOEXEC;
 
+    // a file that's hard linked to the template directory must be copied before it's modified
+    if (file->type == FILE_TYPE_REGULAR && abspath &&
+        ((flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC))) {
+        int rv = utility_breakTemplateHardLink(abspath);
+        if (rv < 0) {
+            free(abspath);
+            file->type = FILE_TYPE_NOTSET;
+            return rv;
+        }
+    }
+
     // TODO: we should open the os-backed file in non-blocking mode even if a
     // non-block is not requested, and then properly handle the io by, e.g.,
     // epolling on all such files with a shadow support thread.
@@ -350,6 +399,12 @@ int regularfile_openat(RegularFile* file, RegularFile* dir, const char* pathname
         return -errcode;
     }
 
+    /* Read-only files can be served from the file cache that's shared by all hosts. */
+    if (file->type == FILE_TYPE_REGULAR && (originalFlags & O_ACCMODE) == O_RDONLY &&
+        !(originalFlags & (O_PATH | O_TRUNC))) {
+        file->osfile.cached = filecache_get(osfd);
+    }
+
     /* Store the create information, which is used if we mmap the file later. */
     file->osfile.fd = osfd;
     file->osfile.absPathAtOpen = abspath;
@@ -410,6 +465,15 @@ ssize_t regularfile_read(RegularFile* file, const Host* host, void* buf, size_t
         return -EBADF;
     }
 
+    if (file->osfile.cached) {
+        ssize_t result =
+            cachedfile_read(file->osfile.cached, buf, bufSize, file->osfile.cachedOffset);
+        if (result > 0) {
+            file->osfile.cachedOffset += result;
+        }
+        return result;
+    }
+
     trace("RegularFile %p will read %zu bytes from os-backed file %i at path '%s'", file, bufSize,
           _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
@@ -440,6 +504,10 @@ ssize_t regularfile_pread(RegularFile* file, const Host* host, void* buf, size_t
         return -EBADF;
     }
 
+    if (file->osfile.cached) {
+        return cachedfile_read(file->osfile.cached, buf, bufSize, offset);
+    }
+
     trace("RegularFile %p will pread %zu bytes from os-backed file %i offset %ld at path '%s'",
           file, bufSize, _regularfile_getOSBackedFD(file), offset, file->osfile.absPathAtOpen);
 
@@ -449,6 +517,23 @@ ssize_t regularfile_pread(RegularFile* file, const Host* host, void* buf, size_t
     return (result < 0) ? -errno : result;
 }
 
+static ssize_t _regularfile_preadvCached(RegularFile* file, const struct iovec* iov, int iovcnt,
+                                        off_t offset) {
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        ssize_t result =
+            cachedfile_read(file->osfile.cached, iov[i].iov_base, iov[i].iov_len, offset + total);
+        if (result < 0) {
+            return result;
+        }
+        total += result;
+        if ((size_t)result < iov[i].iov_len) {
+            break;
+        }
+    }
+    return total;
+}
+
 ssize_t regularfile_preadv(RegularFile* file, const Host* host, const struct iovec* iov, int iovcnt,
                            off_t offset) {
     MAGIC_ASSERT(file);
@@ -492,6 +577,10 @@ ssize_t regularfile_preadv(RegularFile* file, const Host* host, const struct iov
         return -EBADF;
     }
 
+    if (file->osfile.cached) {
+        return _regularfile_preadvCached(file, iov, iovcnt, offset);
+    }
+
     trace("RegularFile %p will preadv %d vector items from os-backed file %i at path '%s'", file,
           iovcnt, _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
@@ -519,6 +608,19 @@ ssize_t regularfile_preadv2(RegularFile* file, const Host* host, const struct io
         return -EBADF;
     }
 
+    if (file->osfile.cached) {
+        // the flags only change how the read is performed, and a cached read never blocks
+        if (offset == -1) {
+            ssize_t result =
+                _regularfile_preadvCached(file, iov, iovcnt, file->osfile.cachedOffset);
+            if (result > 0) {
+                file->osfile.cachedOffset += result;
+            }
+            return result;
+        }
+        return _regularfile_preadvCached(file, iov, iovcnt, offset);
+    }
+
     trace("RegularFile %p will preadv2 %d vector items from os-backed file %i at path '%s'", file,
           iovcnt, _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
@@ -570,6 +672,129 @@ ssize_t regularfile_pwrite(RegularFile* file, const void* buf, size_t bufSize, o
     return (result < 0) ? -errno : result;
 }
 
+bool regularfile_supportsFileIO(RegularFile* file) {
+    MAGIC_ASSERT(file);
+    return file->type == FILE_TYPE_REGULAR && _fd_isValid(_regularfile_getOSBackedFD(file)) &&
+           !file->osfile.cached;
+}
+
+struct _RegularFilePendingIO {
+    /* Holds a reference. */
+    RegularFile* file;
+    FileIoOp* op;
+    RegularFileIO request;
+    /* For a non-positional operation, the file offset when it started and the offset just past
+     * the bytes that it reserved. */
+    off_t startOffset;
+    off_t reservedEnd;
+    bool append;
+};
+
+int regularfile_startIO(RegularFile* file, const RegularFileIO* io, const void* writeBuf,
+                        bool runAsync, RegularFilePendingIO** pendingOut) {
+    MAGIC_ASSERT(file);
+    utility_debugAssert(regularfile_supportsFileIO(file));
+
+    int fd = _regularfile_getOSBackedFD(file);
+    off_t offset = io->offset;
+    off_t reservedEnd = 0;
+    bool append = false;
+
+    if (!io->positional) {
+        int flags = fcntl(fd, F_GETFL);
+        append = io->isWrite && flags >= 0 && (flags & O_APPEND);
+
+        offset = lseek(fd, 0, SEEK_CUR);
+        if (offset < 0) {
+            return -errno;
+        }
+
+        /* Reserve the bytes at the current offset by moving past them now, so that a read or
+         * write of the same open file that another thread starts before this one finishes uses
+         * the bytes after them, as it would on Linux. The offset of an appending write is set
+         * when it finishes. */
+        reservedEnd = offset + (off_t)io->bufSize;
+        if (!append && lseek(fd, reservedEnd, SEEK_SET) < 0) {
+            return -errno;
+        }
+    }
+
+    trace("RegularFile %p will %s %zu bytes %s os-backed file %i offset %ld at path '%s'", file,
+          io->isWrite ? "write" : "read", io->bufSize, io->isWrite ? "to" : "from", fd, offset,
+          file->osfile.absPathAtOpen);
+
+    /* Linux ignores the offset of a pwrite to a file opened with O_APPEND, so appending writes
+     * still append. */
+    FileIoOp* op = NULL;
+    int rv = io->isWrite ? fileio_pwrite(fd, writeBuf, io->bufSize, offset, runAsync, &op)
+                         : fileio_pread(fd, io->bufSize, offset, runAsync, &op);
+    if (rv < 0) {
+        if (!io->positional && !append) {
+            lseek(fd, offset, SEEK_SET);
+        }
+        return rv;
+    }
+
+    RegularFilePendingIO* pending = malloc(sizeof(*pending));
+    *pending = (RegularFilePendingIO){
+        .file = file,
+        .op = op,
+        .request = *io,
+        .startOffset = offset,
+        .reservedEnd = reservedEnd,
+        .append = append,
+    };
+    legacyfile_ref(file);
+
+    *pendingOut = pending;
+    return 0;
+}
+
+bool regularfile_isPendingIOFor(const RegularFilePendingIO* pending, RegularFile* file,
+                                const RegularFileIO* io) {
+    const RegularFileIO* req = &pending->request;
+    return pending->file == file && req->bufPtr == io->bufPtr && req->bufSize == io->bufSize &&
+           req->positional == io->positional && req->isWrite == io->isWrite &&
+           (!io->positional || req->offset == io->offset);
+}
+
+/* Waits for the operation, moves the file offset to just past the bytes that were read or
+ * written, and frees the operation. */
+static ssize_t _regularfile_completeIO(RegularFilePendingIO* pending, void* readBuf,
+                                       bool discard) {
+    RegularFile* file = pending->file;
+    const RegularFileIO* io = &pending->request;
+    ssize_t result = fileio_wait(pending->op, readBuf, io->bufSize);
+
+    /* A discarded read has no effect, but a discarded write has already changed the file. */
+    ssize_t moved = (result < 0 || (discard && !io->isWrite)) ? 0 : result;
+
+    int fd = _regularfile_getOSBackedFD(file);
+    if (!io->positional && _fd_isValid(fd)) {
+        if (pending->append) {
+            lseek(fd, 0, SEEK_END);
+        } else if (moved < (ssize_t)io->bufSize && lseek(fd, 0, SEEK_CUR) == pending->reservedEnd) {
+            /* Give back the bytes that weren't used, unless the offset has since been moved. */
+            lseek(fd, pending->startOffset + moved, SEEK_SET);
+        }
+    }
+
+    legacyfile_unref(file);
+    free(pending);
+    return result;
+}
+
+ssize_t regularfile_finishIO(RegularFilePendingIO* pending, void* readBuf) {
+    return _regularfile_completeIO(pending, readBuf, false);
+}
+
+void regularfile_discardIO(RegularFilePendingIO* pending) {
+    /* Regular file syscalls generally can't be interrupted on Linux, so this should be rare. */
+    trace("RegularFile %p discarding a pending %s", pending->file,
+          pending->request.isWrite ? "write" : "read");
+    _regularfile_completeIO(pending, NULL, true);
+}
+
 ssize_t regularfile_pwritev(RegularFile* file, const struct iovec* iov, int iovcnt, off_t offset) {
     MAGIC_ASSERT(file);
 
@@ -812,6 +1037,37 @@ ssize_t regularfile_readahead(RegularFile* file, off64_t offset, size_t count) {
     return (result < 0) ? -errno : result;
 }
 
+static off_t _regularfile_lseekCached(RegularFile* file, off_t offset, int whence) {
+    off_t len = cachedfile_len(file->osfile.cached);
+    off_t base = 0;
+
+    switch (whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = file->osfile.cachedOffset; break;
+        case SEEK_END: base = len; break;
+        case SEEK_DATA:
+        case SEEK_HOLE:
+            /* The cached contents have no holes. */
+            if (offset < 0 || offset >= len) {
+                return -ENXIO;
+            }
+            file->osfile.cachedOffset = (whence == SEEK_DATA) ? offset : len;
+            return file->osfile.cachedOffset;
+        default: return -EINVAL;
+    }
+
+    off_t newOffset;
+    if (__builtin_add_overflow(base, offset, &newOffset)) {
+        return -EOVERFLOW;
+    }
+    if (newOffset < 0) {
+        return -EINVAL;
+    }
+
+    file->osfile.cachedOffset = newOffset;
+    return newOffset;
+}
+
 off_t regularfile_lseek(RegularFile* file, off_t offset, int whence) {
     MAGIC_ASSERT(file);
 
@@ -819,6 +1075,10 @@ off_t regularfile_lseek(RegularFile* file, off_t offset, int whence) {
         return -EBADF;
     }
 
+    if (file->osfile.cached) {
+        return _regularfile_lseekCached(file, offset, whence);
+    }
+
     trace("RegularFile %p lseek os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
     ssize_t result = lseek(_regularfile_getOSBackedFD(file), offset, whence);
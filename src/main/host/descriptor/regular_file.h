@@ -7,7 +7,9 @@
 #define SRC_MAIN_HOST_DESCRIPTOR_FILE_H_
 
 #include <poll.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <sys/statfs.h>
 #include <sys/syscall.h>
@@ -26,6 +28,22 @@ extern const int SHADOW_FLAG_MASK;
 /* Opaque type representing a file-backed file descriptor. */
 typedef struct _RegularFile RegularFile;
 
+/* Identifies a read or write of an OS-backed file that's run by the file I/O
+ * pool, so that a syscall that blocked while waiting for it can find it again. */
+typedef struct _RegularFileIO RegularFileIO;
+struct _RegularFileIO {
+    /* The address of the syscall's buffer in the managed process. */
+    uint64_t bufPtr;
+    size_t bufSize;
+    /* Ignored unless `positional` is set (pread/pwrite). */
+    off_t offset;
+    bool positional;
+    bool isWrite;
+};
+
+/* A read or write that was started by regularfile_startIO(). */
+typedef struct _RegularFilePendingIO RegularFilePendingIO;
+
 /* In order to operate on a file, you must first create one with regularfile_new()
  * and open it with either regularfile_open() or regularfile_openat(). Internally, we use
  * OS-backed files to support the Shadow file descriptor API.
@@ -65,6 +83,13 @@ int regularfile_getShadowFlags(RegularFile* file);
 
 /* Returns the linux-backed fd that shadow uses to perform the file operations.  */
 int regularfile_getOSBackedFD(RegularFile* file);
+/* Replaces the linux-backed fd that shadow uses to perform the file operations
+ * with `osfd`, which must refer to the same file, and closes the old fd. */
+void regularfile_replaceOSBackedFD(RegularFile* file, int osfd);
+
+/* Returns true if the file is a regular OS-backed file that was opened at a
+ * path within the directory `dirPath`, which must be an absolute path. */
+bool regularfile_isRegularFileInDir(RegularFile* file, const char* dirPath);
 
 // ****************************************
 // Operations that require a non-null RegularFile*
@@ -109,6 +134,28 @@ int regularfile_ioctl(RegularFile* file, unsigned long request, void* arg);
 int regularfile_fcntl(RegularFile* file, unsigned long command, void* arg);
 int regularfile_poll(RegularFile* file, struct pollfd* pfd);
 
+/* Returns true if reads and writes of the file can use regularfile_startIO(),
+ * which is only the case for regular OS-backed files. */
+bool regularfile_supportsFileIO(RegularFile* file);
+/* Starts the read or write `io`, with the bytes to write in `writeBuf`. The
+ * operation runs on the file I/O pool if `runAsync` is set, and otherwise
+ * before this returns. A read() or write() reserves its bytes at the file
+ * offset right away. Returns 0 and writes the pending operation to
+ * `pendingOut`, which belongs to the calling syscall and must be passed to
+ * regularfile_finishIO() or regularfile_discardIO(). Returns a negative errno
+ * if the operation couldn't be started. */
+int regularfile_startIO(RegularFile* file, const RegularFileIO* io, const void* writeBuf,
+                        bool runAsync, RegularFilePendingIO** pendingOut);
+/* Returns true if `pending` was started for `io` on `file`. */
+bool regularfile_isPendingIOFor(const RegularFilePendingIO* pending, RegularFile* file,
+                                const RegularFileIO* io);
+/* Waits for the pending operation to finish, copying any bytes that were read
+ * to `readBuf`, and frees it. Returns the syscall's result. */
+ssize_t regularfile_finishIO(RegularFilePendingIO* pending, void* readBuf);
+/* Waits for a pending operation whose syscall won't be resumed (for example
+ * if it was interrupted), and frees it. */
+void regularfile_discardIO(RegularFilePendingIO* pending);
+
 // ******************************************
 // Operations where the dir RegularFile* may be null
 // ******************************************
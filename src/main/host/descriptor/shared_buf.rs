@@ -105,9 +105,10 @@ impl SharedBuf {
             return Err(Errno::EAGAIN.into());
         }
 
+        let len = std::cmp::min(len, self.space_available());
         let written = self
             .queue
-            .push_stream(bytes.take(self.space_available().try_into().unwrap()))?;
+            .push_stream_with_size_hint(bytes.take(len.try_into().unwrap()), len)?;
 
         self.refresh_state(cb_queue);
 
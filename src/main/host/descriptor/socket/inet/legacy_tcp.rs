@@ -1,8 +1,9 @@
-use std::ffi::CStr;
+use std::ffi::{CStr, CString};
 use std::net::{Ipv4Addr, SocketAddrV4};
 use std::sync::Arc;
 
 use atomic_refcell::AtomicRefCell;
+use bytes::Bytes;
 use linux_api::errno::Errno;
 use linux_api::ioctls::IoctlRequest;
 use nix::sys::socket::{MsgFlags, Shutdown, SockaddrIn};
@@ -23,7 +24,7 @@ use crate::host::network::namespace::NetworkNamespace;
 use crate::host::syscall::io::{write_partial, IoVec};
 use crate::host::syscall_types::{ForeignArrayPtr, SyscallError};
 use crate::host::thread::ThreadId;
-use crate::network::packet::PacketRc;
+use crate::network::packet::{PacketRc, PayloadBytes};
 use crate::utility::callback_queue::{CallbackQueue, Handle};
 use crate::utility::sockaddr::SockaddrStorage;
 use crate::utility::{HostTreePointer, ObjectCounter};
@@ -183,6 +184,14 @@ impl LegacyTcpSocket {
         self.peek_packet().is_some()
     }
 
+    /// The number of bytes in the socket's input buffers (including out-of-order data) and output
+    /// buffers (including the retransmission queue).
+    pub fn buffered_bytes(&self) -> (usize, usize) {
+        let input = unsafe { c::tcp_getInputBufferLength(self.as_legacy_tcp()) };
+        let output = unsafe { c::tcp_getOutputBufferLength(self.as_legacy_tcp()) };
+        (input.try_into().unwrap(), output.try_into().unwrap())
+    }
+
     pub fn getsockname(&self) -> Result<Option<SockaddrIn>, SyscallError> {
         let mut ip: libc::in_addr_t = 0;
         let mut port: libc::in_port_t = 0;
@@ -349,7 +358,10 @@ impl LegacyTcpSocket {
             return Err(Errno::EBADF.into());
         }
 
-        let Some(mut flags) = MsgFlags::from_bits(args.flags) else {
+        // nix's `MsgFlags` doesn't have `MSG_MORE`
+        let more = args.flags & libc::MSG_MORE != 0;
+
+        let Some(mut flags) = MsgFlags::from_bits(args.flags & !libc::MSG_MORE) else {
             log::warn!("Unrecognized send flags: {:#b}", args.flags);
             return Err(Errno::EINVAL.into());
         };
@@ -362,31 +374,13 @@ impl LegacyTcpSocket {
         let result = (|| {
             let mut bytes_sent = 0;
 
-            for iov in args.iovs {
-                let errcode = unsafe { c::tcp_getConnectionError(tcp) };
+            for (i, iov) in args.iovs.iter().enumerate() {
+                // like linux, the iovs are coalesced as if they were a single write
+                let more = more || i + 1 < args.iovs.len();
 
-                log::trace!("Connection error state is currently {errcode}");
-
-                #[allow(clippy::if_same_then_else)]
-                if errcode > 0 {
-                    // connect() was not called yet
-                    // TODO: Can they can piggy back a connect() on sendto() if they provide an
-                    // address for the connection?
+                if let Err(e) = Self::check_can_send(tcp) {
                     if bytes_sent == 0 {
-                        return Err(Errno::EPIPE);
-                    } else {
-                        break;
-                    }
-                } else if errcode == 0 {
-                    // They connected, but never read the success code with a second call to
-                    // connect(). That's OK, proceed to send as usual.
-                } else if errcode == -libc::EISCONN {
-                    // they are connected, and we can send now
-                } else if errcode == -libc::EALREADY {
-                    // connection in progress
-                    // TODO: should we wait, or just return -EALREADY?
-                    if bytes_sent == 0 {
-                        return Err(Errno::EWOULDBLOCK);
+                        return Err(e);
                     } else {
                         break;
                     }
@@ -400,6 +394,7 @@ impl LegacyTcpSocket {
                         host,
                         iov.base.cast::<()>(),
                         iov.len.try_into().unwrap(),
+                        more,
                         0,
                         0,
                         mem,
@@ -438,6 +433,69 @@ impl LegacyTcpSocket {
         Ok(result?.try_into().unwrap())
     }
 
+    /// Check the connection state before sending. Returns `EPIPE` if `connect()` wasn't called,
+    /// or `EWOULDBLOCK` if the connection is in progress.
+    fn check_can_send(tcp: *mut c::TCP) -> Result<(), Errno> {
+        let errcode = unsafe { c::tcp_getConnectionError(tcp) };
+
+        log::trace!("Connection error state is currently {errcode}");
+
+        #[allow(clippy::if_same_then_else)]
+        if errcode > 0 {
+            // connect() was not called yet
+            // TODO: Can they can piggy back a connect() on sendto() if they provide an
+            // address for the connection?
+            Err(Errno::EPIPE)
+        } else if errcode == 0 {
+            // They connected, but never read the success code with a second call to
+            // connect(). That's OK, proceed to send as usual.
+            Ok(())
+        } else if errcode == -libc::EISCONN {
+            // they are connected, and we can send now
+            Ok(())
+        } else if errcode == -libc::EALREADY {
+            // connection in progress
+            // TODO: should we wait, or just return -EALREADY?
+            Err(Errno::EWOULDBLOCK)
+        } else {
+            Ok(())
+        }
+    }
+
+    /// Send bytes from shadow's memory rather than the plugin's. The packets share the buffer of
+    /// `bytes` rather than copying it. Unlike [`sendmsg`](Self::sendmsg), this never blocks and
+    /// returns `EWOULDBLOCK` instead.
+    pub fn send_bytes(
+        socket: &Arc<AtomicRefCell<Self>>,
+        bytes: Bytes,
+        _cb_queue: &mut CallbackQueue,
+    ) -> Result<libc::ssize_t, SyscallError> {
+        let socket_ref = socket.borrow_mut();
+        let tcp = socket_ref.as_legacy_tcp();
+
+        if socket_ref.state().contains(FileState::CLOSED) {
+            // see the comment in `sendmsg()`
+            log::warn!("Sending on a closed TCP socket");
+            return Err(Errno::EBADF.into());
+        }
+
+        Self::check_can_send(tcp)?;
+
+        let len = bytes.len();
+        let bytes = PayloadBytes::from(bytes);
+
+        let rv = Worker::with_active_host(|host| unsafe {
+            c::tcp_sendUserBytes(tcp, host, &bytes, len.try_into().unwrap())
+        })
+        .unwrap();
+
+        if rv < 0 {
+            return Err(Errno::try_from(-rv).unwrap().into());
+        }
+
+        Ok(rv.try_into().unwrap())
+    }
+
     pub fn recvmsg(
         socket: &Arc<AtomicRefCell<Self>>,
         mut args: RecvmsgArgs,
@@ -983,9 +1041,16 @@ impl LegacyTcpSocket {
                 Ok(bytes_written as libc::socklen_t)
             }
             (libc::SOL_TCP, libc::TCP_NODELAY) => {
-                // shadow doesn't support nagle's algorithm, so shadow always behaves as if
-                // TCP_NODELAY is enabled
-                let val = 1;
+                let val: libc::c_int = unsafe { c::tcp_getNoDelay(self.as_legacy_tcp()) }.into();
+
+                let optval_ptr = optval_ptr.cast::<libc::c_int>();
+                let bytes_written =
+                    write_partial(memory_manager, &val, optval_ptr, optlen as usize)?;
+
+                Ok(bytes_written as libc::socklen_t)
+            }
+            (libc::SOL_TCP, libc::TCP_CORK) => {
+                let val: libc::c_int = unsafe { c::tcp_getCork(self.as_legacy_tcp()) }.into();
 
                 let optval_ptr = optval_ptr.cast::<libc::c_int>();
                 let bytes_written =
@@ -1114,12 +1179,7 @@ impl LegacyTcpSocket {
         memory_manager: &MemoryManager,
     ) -> Result<(), SyscallError> {
         match (level, optname) {
-            (libc::SOL_TCP, libc::TCP_NODELAY) => {
-                // Shadow doesn't support nagle's algorithm, so Shadow always behaves as if
-                // TCP_NODELAY is enabled. Some programs will fail if `setsockopt(fd, SOL_TCP,
-                // TCP_NODELAY, &1, sizeof(int))` returns an error, so we treat this as a no-op for
-                // compatibility.
-
+            (libc::SOL_TCP, libc::TCP_NODELAY | libc::TCP_CORK) => {
                 type OptType = libc::c_int;
 
                 if usize::try_from(optlen).unwrap() < std::mem::size_of::<OptType>() {
@@ -1127,16 +1187,17 @@ impl LegacyTcpSocket {
                 }
 
                 let optval_ptr = optval_ptr.cast::<OptType>();
-                let enable = memory_manager.read(optval_ptr)?;
+                let enable = memory_manager.read(optval_ptr)? != 0;
 
-                if enable != 0 {
-                    // wants to enable TCP_NODELAY
-                    log::debug!("Ignoring TCP_NODELAY");
-                } else {
-                    // wants to disable TCP_NODELAY
-                    log::warn!("Cannot disable TCP_NODELAY since shadow does not implement Nagle's algorithm.");
-                    return Err(Errno::ENOPROTOOPT.into());
-                }
+                // may send data that was held back
+                Worker::with_active_host(|host| unsafe {
+                    if optname == libc::TCP_NODELAY {
+                        c::tcp_setNoDelay(self.as_legacy_tcp(), host, enable)
+                    } else {
+                        c::tcp_setCork(self.as_legacy_tcp(), host, enable)
+                    }
+                })
+                .unwrap();
             }
             (libc::SOL_TCP, libc::TCP_CONGESTION) => {
                 // the value of TCP_CA_NAME_MAX in linux
@@ -1159,14 +1220,17 @@ impl LegacyTcpSocket {
                     .map(|x| &name[..x])
                     .unwrap_or(name);
 
-                let reno = unsafe { CStr::from_ptr(c::TCP_CONG_RENO_NAME) }.to_bytes();
+                // a name with a NUL would have been truncated above
+                let name = CString::new(name).unwrap();
 
-                if name != reno {
-                    log::warn!("Shadow sockets only support '{reno:?}' for TCP_CONGESTION");
+                if !unsafe { c::tcpcong_set(self.as_legacy_tcp(), name.as_ptr()) } {
+                    log::warn!(
+                        "Shadow sockets don't support {name:?} for TCP_CONGESTION, only {:?} and {:?}",
+                        unsafe { CStr::from_ptr(c::TCP_CONG_RENO_NAME) },
+                        unsafe { CStr::from_ptr(c::TCP_CONG_CUBIC_NAME) },
+                    );
                     return Err(Errno::ENOENT.into());
                 }
-
-                // shadow doesn't support other congestion types, so do nothing
             }
             (libc::SOL_SOCKET, libc::SO_SNDBUF) => {
                 type OptType = libc::c_int;
@@ -2,7 +2,6 @@ use std::net::{Ipv4Addr, SocketAddrV4};
 use std::sync::{Arc, Weak};
 
 use atomic_refcell::AtomicRefCell;
-use bytes::BytesMut;
 use linux_api::errno::Errno;
 use linux_api::ioctls::IoctlRequest;
 use nix::sys::socket::{AddressFamily, MsgFlags, Shutdown, SockaddrIn};
@@ -196,14 +195,8 @@ impl TcpSocket {
             .get_tcp()
             .expect("TCP socket received a non-tcp packet");
 
-        // in the future, the packet could contain an array of `Bytes` objects and we could simply
-        // transfer the `Bytes` objects directly from the payload to the tcp state without copying
-        // the bytes themselves
-
-        let mut payload = BytesMut::zeroed(packet.payload_size());
-        let num_bytes_copied = packet.get_payload(&mut payload);
-        assert_eq!(num_bytes_copied, packet.payload_size());
-        let payload = tcp::Payload(vec![payload.freeze()]);
+        // shares the sender's buffer rather than copying the bytes
+        let payload = tcp::Payload(vec![packet.payload_bytes()]);
 
         self.with_tcp_state(cb_queue, |s| s.push_packet(&header, payload))
             .unwrap();
@@ -241,16 +234,12 @@ impl TcpSocket {
 
         let mut packet = PacketRc::new();
 
-        // TODO: This is expensive. Here we allocate a new buffer, copy all of the payload bytes to
-        // this new buffer, and then copy the bytes in this new buffer to the packet's buffer. In
-        // the future, the packet could contain an array of `Bytes` objects and we could simply
-        // transfer the `Bytes` objects directly from the tcp state's `Payload` object to the packet
-        // without copying the bytes themselves.
+        // this only copies the bytes if the payload has more than one chunk
         let payload = payload.concat();
 
         packet.set_tcp(&header);
         // TODO: set packet priority?
-        packet.set_payload(&payload, /* priority= */ 0);
+        packet.set_payload_bytes(payload, /* priority= */ 0);
         packet.add_status(PacketStatus::SndCreated);
 
         Some(packet)
@@ -1,4 +1,4 @@
-use std::collections::LinkedList;
+use std::collections::VecDeque;
 use std::io::{Read, Write};
 use std::net::{Ipv4Addr, SocketAddrV4};
 use std::sync::Arc;
@@ -21,9 +21,10 @@ use crate::host::descriptor::{
 };
 use crate::host::memory_manager::MemoryManager;
 use crate::host::network::interface::FifoPacketPriority;
-use crate::host::network::namespace::{AssociationHandle, NetworkNamespace};
+use crate::host::network::namespace::{AssociationHandle, MulticastMembership, NetworkNamespace};
 use crate::host::syscall::io::{write_partial, IoVec, IoVecReader, IoVecWriter};
 use crate::host::syscall_types::SyscallError;
+use crate::network::multicast;
 use crate::network::packet::{PacketRc, PacketStatus};
 use crate::utility::callback_queue::{CallbackQueue, Handle};
 use crate::utility::sockaddr::SockaddrStorage;
@@ -33,6 +34,10 @@ use crate::utility::{HostTreePointer, ObjectCounter};
 // 65,535 (2^16 - 1) - 20 (ip header) - 8 (udp header)
 const CONFIG_DATAGRAM_MAX_SIZE: usize = 65507;
 
+/// The most multicast groups that a socket can join, the default of Linux's
+/// `net.ipv4.igmp_max_memberships`.
+const MAX_MULTICAST_MEMBERSHIPS: usize = 20;
+
 pub struct UdpSocket {
     event_source: StateEventSource,
     status: FileStatus,
@@ -43,6 +48,10 @@ pub struct UdpSocket {
     peer_addr: Option<SocketAddrV4>,
     bound_addr: Option<SocketAddrV4>,
     association: Option<AssociationHandle>,
+    /// The multicast groups that the socket has joined.
+    multicast_memberships: Vec<MulticastMembership>,
+    /// Set by `SO_BROADCAST`, which is required to send to the broadcast address.
+    broadcast: bool,
     /// The receive time of the last packet returned to the managed process during a call to
     /// `recvmsg()`. Used for `SIOCGSTAMP`.
     recv_time_of_last_read_packet: Option<EmulatedTime>,
@@ -68,6 +77,8 @@ impl UdpSocket {
             peer_addr: None,
             bound_addr: None,
             association: None,
+            multicast_memberships: Vec::new(),
+            broadcast: false,
             recv_time_of_last_read_packet: None,
             has_open_file: false,
             _counter: ObjectCounter::new("UdpSocket"),
@@ -131,7 +142,22 @@ impl UdpSocket {
             }
         };
 
-        // TODO: also check the dst address to make sure we are the intended socket?
+        // TODO: also check the dst address of unicast packets to make sure we are the intended
+        // socket?
+        let dst_ip = *packet.dst_address().ip();
+        let is_accepted = if multicast::is_fan_out_address(dst_ip) {
+            self.accepts_fan_out(dst_ip)
+        } else {
+            // a socket bound to a multicast or broadcast address is associated with the internet
+            // interface's address (see `bind`), but doesn't receive unicast packets
+            !self
+                .bound_addr
+                .is_some_and(|x| multicast::is_fan_out_address(*x.ip()))
+        };
+        if !is_accepted {
+            packet.add_status(PacketStatus::RcvSocketDropped);
+            return;
+        }
 
         // don't bother copying the bytes if we know the push will fail
         if !self.recv_buffer.has_space() {
@@ -139,12 +165,8 @@ impl UdpSocket {
             return;
         }
 
-        // in the future, the packet could contain the `Bytes` object itself and we could simply
-        // transfer the `Bytes` directly from the packet to the buffer without copying the bytes
-
-        let mut message = BytesMut::zeroed(packet.payload_size());
-        let num_bytes_copied = packet.get_payload(&mut message);
-        assert_eq!(num_bytes_copied, packet.payload_size());
+        // shares the sender's buffer rather than copying the bytes
+        let message = packet.payload_bytes();
 
         let header = MessageRecvHeader {
             src: packet.src_address(),
@@ -154,9 +176,7 @@ impl UdpSocket {
 
         // push the message to the receive buffer (shouldn't fail since we checked for available
         // space above)
-        self.recv_buffer
-            .push_message(message.freeze(), header)
-            .unwrap();
+        self.recv_buffer.push_message(message, header).unwrap();
 
         log::trace!("Added a packet to the UDP socket's recv buffer");
         packet.add_status(PacketStatus::RcvSocketBuffered);
@@ -179,11 +199,8 @@ impl UdpSocket {
         let mut packet = PacketRc::new();
         let priority = header.packet_priority;
 
-        // in the future, the packet could contain the `Bytes` object itself and we could simply
-        // transfer the `Bytes` directly from the buffer to the packet without copying the bytes
-
         packet.set_udp(header.src, header.dst);
-        packet.set_payload(&message, priority);
+        packet.set_payload_bytes(message, priority);
         packet.add_status(PacketStatus::SndCreated);
 
         self.refresh_readable_writable(cb_queue);
@@ -226,6 +243,7 @@ impl UdpSocket {
     pub fn close(&mut self, cb_queue: &mut CallbackQueue) -> Result<(), SyscallError> {
         // drop the existing association handle to disassociate the socket
         self.association = None;
+        self.multicast_memberships.clear();
 
         self.copy_state(
             /* mask= */ FileState::all(),
@@ -272,15 +290,28 @@ impl UdpSocket {
         // this will allow us to receive packets from any peer
         let unspecified_addr = SocketAddrV4::new(Ipv4Addr::UNSPECIFIED, 0);
 
+        // a socket bound to a multicast or broadcast address receives those packets from the
+        // internet interface, but no others (see `push_in_packet`). Since it's associated with the
+        // interface's address, it uses the port for every other group (and unicast) too.
+        let fan_out_ip = Some(*addr.ip()).filter(|x| multicast::is_fan_out_address(*x));
+        let interface_addr = match fan_out_ip {
+            Some(_) => SocketAddrV4::new(net_ns.default_ip, addr.port()),
+            None => addr,
+        };
+
         // associate the socket
         let (addr, handle) = inet::associate_socket(
             InetSocket::Udp(Arc::clone(socket)),
-            addr,
+            interface_addr,
             unspecified_addr,
             /* check_generic_peer= */ true,
             net_ns,
             rng,
         )?;
+        let addr = match fan_out_ip {
+            Some(ip) => SocketAddrV4::new(ip, addr.port()),
+            None => addr,
+        };
 
         // update the socket's local address
         {
@@ -320,6 +351,21 @@ impl UdpSocket {
         panic!("Called UdpSocket::writev() on a UDP socket");
     }
 
+    /// Whether the socket should receive a packet sent to a multicast or broadcast address. Like
+    /// Linux, a socket bound to the wildcard address receives the packets of every group that any
+    /// socket on the host has joined.
+    fn accepts_fan_out(&self, dst_ip: Ipv4Addr) -> bool {
+        let bound_ip = *self.bound_addr.unwrap().ip();
+        if !bound_ip.is_unspecified() && bound_ip != dst_ip {
+            return false;
+        }
+        if dst_ip.is_broadcast() {
+            return true;
+        }
+        Worker::with_active_host(|host| host.network_namespace_borrow().is_multicast_member(dst_ip))
+            .unwrap()
+    }
+
     pub fn sendmsg(
         socket: &Arc<AtomicRefCell<Self>>,
         args: SendmsgArgs,
@@ -354,6 +400,19 @@ impl UdpSocket {
             },
         };
 
+        if dst_addr.ip().is_broadcast() && !socket_ref.broadcast {
+            return Err(Errno::EACCES.into());
+        }
+
+        // multicast and broadcast packets can only be sent on the internet interface
+        if multicast::is_fan_out_address(*dst_addr.ip())
+            && socket_ref
+                .bound_addr
+                .is_some_and(|x| x.ip() == &Ipv4Addr::LOCALHOST)
+        {
+            return Err(Errno::ENETUNREACH.into());
+        }
+
         if socket_ref.get_status().contains(FileStatus::NONBLOCK) {
             flags.insert(MsgFlags::MSG_DONTWAIT);
         }
@@ -412,47 +471,14 @@ impl UdpSocket {
                 .read_exact(&mut message[..])
                 .map_err(|e| Errno::try_from(e).unwrap())?;
 
-            // get the priority that we'll assign to the eventual packet
-            let packet_priority =
-                Worker::with_active_host(|host| host.get_next_packet_priority()).unwrap();
-
-            let src_addr = socket_ref.bound_addr.unwrap();
-            let src_addr = if src_addr.ip().is_unspecified() {
-                // depending on the destination address, choose either localhost or the public IP
-                // address
-                if dst_addr.ip() == &std::net::Ipv4Addr::LOCALHOST {
-                    SocketAddrV4::new(Ipv4Addr::LOCALHOST, src_addr.port())
-                } else {
-                    SocketAddrV4::new(net_ns.default_ip, src_addr.port())
-                }
-            } else {
-                src_addr
-            };
-
-            let header = MessageSendHeader {
-                src: src_addr,
-                dst: dst_addr,
-                packet_priority,
-            };
-
-            // push the message to the send buffer (shouldn't fail since we checked for available
-            // space above)
-            socket_ref
-                .send_buffer
-                .push_message(message.freeze(), header)
-                .unwrap();
-
-            // notify the host that this socket has packets to send
-            let socket = Arc::clone(socket);
-            let interface_ip = *socket_ref.bound_addr.unwrap().ip();
-            cb_queue.add(move |_cb_queue| {
-                Worker::with_active_host(|host| {
-                    let inet_socket = InetSocket::Udp(socket);
-                    let compat_socket = unsafe { c::compatsocket_fromInetSocket(&inet_socket) };
-                    host.notify_socket_has_packets(interface_ip, &compat_socket);
-                })
-                .unwrap();
-            });
+            Self::push_send_message(
+                socket,
+                &mut socket_ref,
+                dst_addr,
+                message.freeze(),
+                net_ns,
+                cb_queue,
+            );
 
             Ok(len)
         })();
@@ -471,6 +497,91 @@ impl UdpSocket {
         Ok(result?.try_into().unwrap())
     }
 
+    /// Push a message to the send buffer, which must have space, and notify the host that the
+    /// socket has packets to send. The socket must be bound.
+    fn push_send_message(
+        socket: &Arc<AtomicRefCell<Self>>,
+        socket_ref: &mut Self,
+        dst_addr: SocketAddrV4,
+        message: Bytes,
+        net_ns: &NetworkNamespace,
+        cb_queue: &mut CallbackQueue,
+    ) {
+        // get the priority that we'll assign to the eventual packet
+        let packet_priority =
+            Worker::with_active_host(|host| host.get_next_packet_priority()).unwrap();
+
+        let src_addr = socket_ref.bound_addr.unwrap();
+        let is_fan_out_bound = multicast::is_fan_out_address(*src_addr.ip());
+        let src_addr = if is_fan_out_bound {
+            // a multicast or broadcast address can't be a source address
+            SocketAddrV4::new(net_ns.default_ip, src_addr.port())
+        } else if src_addr.ip().is_unspecified() {
+            // depending on the destination address, choose either localhost or the public IP
+            // address
+            if dst_addr.ip() == &std::net::Ipv4Addr::LOCALHOST {
+                SocketAddrV4::new(Ipv4Addr::LOCALHOST, src_addr.port())
+            } else {
+                SocketAddrV4::new(net_ns.default_ip, src_addr.port())
+            }
+        } else {
+            src_addr
+        };
+
+        let header = MessageSendHeader {
+            src: src_addr,
+            dst: dst_addr,
+            packet_priority,
+        };
+
+        // push the message to the send buffer (shouldn't fail since the caller checked for
+        // available space)
+        socket_ref
+            .send_buffer
+            .push_message(message, header)
+            .unwrap();
+
+        // notify the host that this socket has packets to send
+        let socket = Arc::clone(socket);
+        let interface_ip = match is_fan_out_bound {
+            true => net_ns.default_ip,
+            false => *socket_ref.bound_addr.unwrap().ip(),
+        };
+        cb_queue.add(move |_cb_queue| {
+            Worker::with_active_host(|host| {
+                let inet_socket = InetSocket::Udp(socket);
+                let compat_socket = unsafe { c::compatsocket_fromInetSocket(&inet_socket) };
+                host.notify_socket_has_packets(interface_ip, &compat_socket);
+            })
+            .unwrap();
+        });
+    }
+
+    /// Send a datagram on behalf of something other than a managed process, such as a traffic
+    /// model (see [`crate::host::traffic`]). The payload is shared rather than copied. The socket
+    /// must be bound. Returns `EWOULDBLOCK` rather than blocking if the send buffer is full.
+    pub fn send_native(
+        socket: &Arc<AtomicRefCell<Self>>,
+        dst_addr: SocketAddrV4,
+        message: Bytes,
+        net_ns: &NetworkNamespace,
+        cb_queue: &mut CallbackQueue,
+    ) -> Result<(), Errno> {
+        let mut socket_ref = socket.borrow_mut();
+        assert!(socket_ref.bound_addr.is_some());
+
+        if message.len() > CONFIG_DATAGRAM_MAX_SIZE {
+            return Err(Errno::EMSGSIZE);
+        }
+        if !socket_ref.send_buffer.has_space() {
+            return Err(Errno::EWOULDBLOCK);
+        }
+
+        Self::push_send_message(socket, &mut socket_ref, dst_addr, message, net_ns, cb_queue);
+        socket_ref.refresh_readable_writable(cb_queue);
+        Ok(())
+    }
+
     pub fn recvmsg(
         socket: &Arc<AtomicRefCell<Self>>,
         args: RecvmsgArgs,
@@ -680,7 +791,13 @@ impl UdpSocket {
 
         // make sure we will be able to route this later
         // TODO: UDP sockets probably shouldn't return `ECONNREFUSED`
-        if peer_addr.ip() != &std::net::Ipv4Addr::LOCALHOST {
+        if peer_addr.ip().is_broadcast() && !socket.borrow().broadcast {
+            return Err(Errno::EACCES.into());
+        }
+
+        if peer_addr.ip() != &std::net::Ipv4Addr::LOCALHOST
+            && !multicast::is_fan_out_address(*peer_addr.ip())
+        {
             let is_routable =
                 Worker::is_routable(net_ns.default_ip.into(), (*peer_addr.ip()).into());
 
@@ -809,6 +926,14 @@ impl UdpSocket {
 
                 Ok(bytes_written as libc::socklen_t)
             }
+            (libc::SOL_SOCKET, libc::SO_BROADCAST) => {
+                let broadcast = libc::c_int::from(self.broadcast);
+
+                let optval_ptr = optval_ptr.cast::<libc::c_int>();
+                let bytes_written = write_partial(mem, &broadcast, optval_ptr, optlen as usize)?;
+
+                Ok(bytes_written as libc::socklen_t)
+            }
             (libc::SOL_SOCKET, libc::SO_ERROR) => {
                 let error = 0;
 
@@ -933,8 +1058,60 @@ impl UdpSocket {
                 log::warn!("setsockopt SO_KEEPALIVE not yet implemented");
             }
             (libc::SOL_SOCKET, libc::SO_BROADCAST) => {
-                // TODO: implement this, pkg.go.dev/net uses it
-                log::warn!("setsockopt SO_BROADCAST not yet implemented");
+                type OptType = libc::c_int;
+
+                if usize::try_from(optlen).unwrap() < std::mem::size_of::<OptType>() {
+                    return Err(Errno::EINVAL.into());
+                }
+
+                let optval_ptr = optval_ptr.cast::<OptType>();
+                self.broadcast = mem.read(optval_ptr)? != 0;
+            }
+            (libc::IPPROTO_IP, libc::IP_ADD_MEMBERSHIP | libc::IP_DROP_MEMBERSHIP) => {
+                // the group is the first field of both `ip_mreq` and `ip_mreqn`, and shadow only
+                // has one interface for multicast, so the rest is ignored
+                type OptType = libc::ip_mreq;
+
+                if usize::try_from(optlen).unwrap() < std::mem::size_of::<OptType>() {
+                    return Err(Errno::EINVAL.into());
+                }
+
+                let optval_ptr = optval_ptr.cast::<OptType>();
+                let mreq = mem.read(optval_ptr)?;
+                let group = Ipv4Addr::from(u32::from_be(mreq.imr_multiaddr.s_addr));
+
+                if !group.is_multicast() {
+                    return Err(Errno::EINVAL.into());
+                }
+
+                let index = self
+                    .multicast_memberships
+                    .iter()
+                    .position(|x| x.group() == group);
+
+                if optname == libc::IP_ADD_MEMBERSHIP {
+                    if index.is_some() {
+                        return Err(Errno::EADDRINUSE.into());
+                    }
+                    if self.multicast_memberships.len() >= MAX_MULTICAST_MEMBERSHIPS {
+                        return Err(Errno::ENOBUFS.into());
+                    }
+                    let membership = Worker::with_active_host(|host| {
+                        host.network_namespace_borrow().join_multicast_group(group)
+                    })
+                    .unwrap();
+                    self.multicast_memberships.push(membership);
+                } else {
+                    let Some(index) = index else {
+                        return Err(Errno::EADDRNOTAVAIL.into());
+                    };
+                    self.multicast_memberships.swap_remove(index);
+                }
+            }
+            (libc::IPPROTO_IP, libc::IP_MULTICAST_TTL | libc::IP_MULTICAST_LOOP) => {
+                // shadow doesn't model hop counts, and a host never receives its own multicast
+                // packets (see `crate::network::multicast`)
+                log::debug!("setsockopt IP_MULTICAST_TTL and IP_MULTICAST_LOOP have no effect");
             }
             _ => {
                 log::debug!("setsockopt called with unsupported level {level} and opt {optname}");
@@ -1033,9 +1210,9 @@ struct MessageRecvHeader {
 #[derive(Debug)]
 struct MessageBuffer<Hdr> {
     /// The message payloads and headers.
-    // use a `LinkedList` so that socket buffers can shrink when they're empty (as opposed to
-    // `VecDeque`)
-    buffer: LinkedList<(Bytes, Hdr)>,
+    // use a `VecDeque` so that we don't allocate for each message, and release its memory when the
+    // buffer is drained (see `pop_message()`) so that idle sockets don't keep large buffers
+    buffer: VecDeque<(Bytes, Hdr)>,
     /// The number of payload bytes in this socket.
     len_bytes: usize,
     /// A soft limit for the maximum number of payload bytes this buffer can hold.
@@ -1043,9 +1220,14 @@ struct MessageBuffer<Hdr> {
 }
 
 impl<Hdr> MessageBuffer<Hdr> {
+    /// The number of messages that an empty buffer may keep space for. This avoids reallocating when
+    /// a socket repeatedly receives and drains a small number of messages, but lets a buffer shrink
+    /// again after a burst.
+    const MAX_IDLE_CAPACITY: usize = 16;
+
     pub fn new(soft_limit_bytes: usize) -> Self {
         Self {
-            buffer: std::collections::LinkedList::new(),
+            buffer: VecDeque::new(),
             len_bytes: 0,
             soft_limit_bytes,
         }
@@ -1074,6 +1256,10 @@ impl<Hdr> MessageBuffer<Hdr> {
         let (message, header) = self.buffer.pop_front()?;
         self.len_bytes -= message.len();
 
+        if self.buffer.is_empty() && self.buffer.capacity() > Self::MAX_IDLE_CAPACITY {
+            self.buffer.shrink_to(Self::MAX_IDLE_CAPACITY);
+        }
+
         Some((message, header))
     }
 
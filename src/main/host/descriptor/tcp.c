@@ -26,7 +26,6 @@
 #include "main/host/descriptor/descriptor.h"
 #include "main/host/descriptor/socket.h"
 #include "main/host/descriptor/tcp_cong.h"
-#include "main/host/descriptor/tcp_cong_reno.h"
 #include "main/host/descriptor/tcp_retransmit_tally.h"
 #include "main/host/protocol.h"
 #include "main/host/tracker.h"
@@ -87,7 +86,7 @@ enum TCPReceiveState {
 typedef struct _TCPChild TCPChild;
 struct _TCPChild {
     enum TCPChildState state;
-    guint key; /* hash(peerIP, peerPort) */
+    guint64 key; /* _ipPortKey(peerIP, peerPort) */
     TCP* parent;
     /* the handle to return when the socket is accepted */
     int handle;
@@ -113,6 +112,136 @@ struct _TCPServer {
     MAGIC_DECLARE;
 };
 
+/* Packets indexed by sequence number, such as the sent packets that haven't been acknowledged
+ * yet or the received packets that arrived out of order. Our sequence numbers count packets
+ * rather than bytes, so the queued packets cover a mostly contiguous range of sequence numbers.
+ * The range [firstSequence, firstSequence + numSlots) is stored in a ring buffer of slots, where a
+ * slot is NULL if there is no packet with that sequence (for example if it was selectively acked,
+ * is being retransmitted, or hasn't arrived yet). In-order packets are taken from the front.
+ * Slots outside of the range are always NULL. */
+typedef struct _TCPPacketRing TCPPacketRing;
+struct _TCPPacketRing {
+    Packet** slots;
+    /* always a power of 2, or 0 if no slots have been allocated */
+    guint capacity;
+    /* index of the slot for firstSequence */
+    guint head;
+    guint numSlots;
+    guint firstSequence;
+    /* number of non-NULL slots */
+    guint numPackets;
+};
+
+static Packet** _tcppacketring_slot(TCPPacketRing* queue, guint sequence) {
+    utility_debugAssert(sequence >= queue->firstSequence);
+    utility_debugAssert(sequence - queue->firstSequence < queue->numSlots);
+    return &queue->slots[(queue->head + (sequence - queue->firstSequence)) & (queue->capacity - 1)];
+}
+
+/* make sure the queue has room for `numSlots` slots, keeping the existing slots in order */
+static void _tcppacketring_reserve(TCPPacketRing* queue, guint numSlots) {
+    if (numSlots <= queue->capacity) {
+        return;
+    }
+
+    guint newCapacity = MAX(queue->capacity, 16);
+    while (newCapacity < numSlots) {
+        newCapacity *= 2;
+    }
+
+    Packet** newSlots = g_new0(Packet*, newCapacity);
+    for (guint i = 0; i < queue->numSlots; i++) {
+        newSlots[i] = queue->slots[(queue->head + i) & (queue->capacity - 1)];
+    }
+
+    g_free(queue->slots);
+    queue->slots = newSlots;
+    queue->capacity = newCapacity;
+    queue->head = 0;
+}
+
+/* remove empty slots from both ends of the range */
+static void _tcppacketring_trim(TCPPacketRing* queue) {
+    while (queue->numSlots > 0 && queue->slots[queue->head] == NULL) {
+        queue->head = (queue->head + 1) & (queue->capacity - 1);
+        queue->firstSequence++;
+        queue->numSlots--;
+    }
+    while (queue->numSlots > 0 &&
+           *_tcppacketring_slot(queue, queue->firstSequence + queue->numSlots - 1) == NULL) {
+        queue->numSlots--;
+    }
+}
+
+static Packet* _tcppacketring_get(TCPPacketRing* queue, guint sequence) {
+    if (sequence < queue->firstSequence || sequence - queue->firstSequence >= queue->numSlots) {
+        return NULL;
+    }
+    return *_tcppacketring_slot(queue, sequence);
+}
+
+/* the queue takes the packet reference; there must not already be a packet with this sequence */
+static void _tcppacketring_insert(TCPPacketRing* queue, guint sequence, Packet* packet) {
+    utility_debugAssert(packet != NULL);
+
+    if (queue->numSlots == 0) {
+        queue->firstSequence = sequence;
+    }
+
+    if (sequence < queue->firstSequence) {
+        /* grow the range at the front */
+        guint numNew = queue->firstSequence - sequence;
+        _tcppacketring_reserve(queue, queue->numSlots + numNew);
+        queue->head = (queue->head + queue->capacity - numNew) & (queue->capacity - 1);
+        queue->firstSequence = sequence;
+        queue->numSlots += numNew;
+    } else if (sequence - queue->firstSequence >= queue->numSlots) {
+        /* grow the range at the back */
+        _tcppacketring_reserve(queue, sequence - queue->firstSequence + 1);
+        queue->numSlots = sequence - queue->firstSequence + 1;
+    }
+
+    Packet** slot = _tcppacketring_slot(queue, sequence);
+    utility_debugAssert(*slot == NULL);
+    *slot = packet;
+    queue->numPackets++;
+}
+
+/* returns the packet with this sequence and its reference, or NULL if there isn't one */
+static Packet* _tcppacketring_steal(TCPPacketRing* queue, guint sequence) {
+    Packet* packet = _tcppacketring_get(queue, sequence);
+    if (packet == NULL) {
+        return NULL;
+    }
+
+    *_tcppacketring_slot(queue, sequence) = NULL;
+    queue->numPackets--;
+    _tcppacketring_trim(queue);
+    return packet;
+}
+
+/* returns the packet with the lowest sequence and its reference, or NULL if the queue is empty */
+static Packet* _tcppacketring_stealFirst(TCPPacketRing* queue, guint* sequence) {
+    if (queue->numPackets == 0) {
+        return NULL;
+    }
+
+    /* the range is trimmed, so the first slot is never empty */
+    *sequence = queue->firstSequence;
+    return _tcppacketring_steal(queue, queue->firstSequence);
+}
+
+static void _tcppacketring_destroy(TCPPacketRing* queue) {
+    for (guint i = 0; i < queue->numSlots; i++) {
+        Packet* packet = queue->slots[(queue->head + i) & (queue->capacity - 1)];
+        if (packet != NULL) {
+            packet_unref(packet);
+        }
+    }
+    g_free(queue->slots);
+    *queue = (TCPPacketRing){0};
+}
+
 static void _tcp_logCongestionInfo(TCP* tcp);
 
 struct _TCP {
@@ -148,7 +277,6 @@ struct _TCP {
         guint32 lastAcknowledgment;
         guint32 lastSequence;
         gboolean windowUpdatePending;
-        GList* lastSelectiveACKs;
     } receive;
 
     /* sequence numbers we track for outgoing packets */
@@ -161,6 +289,14 @@ struct _TCP {
         guint32 window;
         /* the last byte that was sent by the app, possibly not yet sent to the network */
         guint32 end;
+        /* user data that was written by the app but not yet packetized, as a queue of
+         * `PayloadBytes` buffers (one per write). packets are only created once they fit in the
+         * send window, so that a large send buffer doesn't hold many packets. */
+        GQueue* unsentData;
+        /* how many bytes of the first buffer in the queue were already packetized */
+        gsize unsentOffset;
+        /* total number of bytes in the queue that weren't packetized */
+        gsize unsentLength;
         /* the last ack number we sent them */
         guint32 lastAcknowledgment;
         /* the last advertised window we sent them */
@@ -173,25 +309,48 @@ struct _TCP {
         guint32 numQuickACKsSent;
         gboolean delayedACKIsScheduled;
         guint32 delayedACKCounter;
-        /* list of selective ACKs, packets received after a missing packet */
-        GList* selectiveACKs;
+        /* TCP_NODELAY: send segments smaller than the MSS even if sent data is unacknowledged,
+         * instead of coalescing them with later writes (Nagle's algorithm) */
+        gboolean noDelay;
+        /* TCP_CORK: hold back segments smaller than the MSS until uncorked */
+        gboolean cork;
+        /* the last write had MSG_MORE, so hold back segments smaller than the MSS until the next
+         * write */
+        gboolean more;
+        /* send any segment smaller than the MSS that is held back, even if corked */
+        gboolean push;
+        /* the sequence number of the last segment smaller than the MSS that we created, if any */
+        gboolean createdSmallSegment;
+        guint32 smallSegmentSequence;
+        gboolean corkTimerIsScheduled;
+        /* selective ACKs, packets received after a missing packet, as a sorted array of disjoint
+         * [begin, end) sequence ranges (flattened pairs of guints) */
+        GArray* selectiveACKs;
     } send;
 
     struct {
         /* TCP provides reliable transport, keep track of packets until they are acked */
-        GHashTable* queue;
+        TCPPacketRing queue;
         /* track amount of queued application data */
         gsize queueLength;
         /* retransmission timeout value (rto), in milliseconds */
         gint timeout;
-        /* when the scheduled timer events will expire; empty if no retransmit is scheduled */
-        PriorityQueue* scheduledTimerExpirations;
+        /* when the earliest scheduled timer event will expire, or 0 if we don't know of one.
+         * events are only scheduled when the desired expiration moves earlier than this, so any
+         * other scheduled events will expire later and are ignored if they are stale. */
+        CSimulationTime scheduledTimerExpiration;
         /* our updated expiration time, to determine if previous events are still valid */
         CSimulationTime desiredTimerExpiration;
         /* number of times we backed off due to congestion */
         guint backoffCount;
 
         void *tally;
+        /* set when the tally may have gained lost ranges since the last flush, so that a flush
+         * only asks the tally for lost ranges when it could have some */
+        gboolean tallyChanged;
+        /* reused by each flush to hold the lost ranges, grown as needed */
+        uint32_t* lostRanges;
+        size_t lostRangesCapacity;
     } retransmit;
 
     /* tcp autotuning for the send and recv buffers */
@@ -224,13 +383,26 @@ struct _TCP {
         guint32 rtt;
     } info;
 
+    /* totals for the current flow metrics interval, see host_recordFlowMetrics() */
+    struct {
+        CSimulationTime intervalStart;
+        gsize bytesSent;
+        gsize bytesReceived;
+        gsize retransmits;
+        /* the congestion state when the last packet of the interval was counted */
+        guint32 cwnd;
+        guint32 srttMs;
+        gsize sendQueueBytes;
+        gsize recvQueueBytes;
+    } metrics;
+
     /* TCP throttles outgoing data packets if too many are in flight */
     PriorityQueue* throttledOutput;
     /* track amount of queued application data */
     gsize throttledOutputLength;
 
     /* TCP ensures that the user receives data in-order */
-    PriorityQueue* unorderedInput;
+    TCPPacketRing unorderedInput;
     /* track amount of queued application data */
     gsize unorderedInputLength;
 
@@ -260,19 +432,10 @@ static void _rswlog(const TCP *tcp, const char *format, ...) {
 #endif // RSWLOG
 }
 
-static guint _ipPortHash(in_addr_t ip, in_port_t port) {
-    GString* buffer = g_string_new(NULL);
-    g_string_printf(buffer, "%u:%u", ip, port);
-    guint hash_value = g_str_hash(buffer->str);
-    g_string_free(buffer, TRUE);
-    return hash_value;
-}
-
-static gint _simulationTimeCompare(const CSimulationTime* value1, const CSimulationTime* value2,
-                                   gpointer userData) {
-    utility_debugAssert(value1 && value2);
-    /* return neg if first before second, pos if second before first, 0 if equal */
-    return (*value1) == (*value2) ? 0 : (*value1) < (*value2) ? -1 : +1;
+/* A unique key for a peer's ip and port, so that a child can be found with a single integer lookup
+ * (a hash of the formatted address could collide between peers). */
+static guint64 _ipPortKey(in_addr_t ip, in_port_t port) {
+    return ((guint64)ip << 16) | port;
 }
 
 static void _tcp_flush(TCP* tcp, const Host* host);
@@ -292,7 +455,7 @@ static TCPChild* _tcpchild_new(TCP* tcp, TCP* parent, int handle, in_addr_t peer
     MAGIC_INIT(child);
 
     /* my parent can find me by my key */
-    child->key = _ipPortHash(peerIP, peerPort);
+    child->key = _ipPortKey(peerIP, peerPort);
 
     legacyfile_ref(parent);
     child->parent = parent;
@@ -355,8 +518,8 @@ static TCPServer* _tcpserver_new(gint backlog, pid_t processForChildren) {
     MAGIC_INIT(server);
 
     // store weak references to children
-    server->children =
-        g_hash_table_new_full(g_int_hash, g_int_equal, NULL, (GDestroyNotify)legacyfile_unrefWeak);
+    server->children = g_hash_table_new_full(
+        g_int64_hash, g_int64_equal, NULL, (GDestroyNotify)legacyfile_unrefWeak);
     server->pending = g_queue_new();
     server->pendingMax = 0;
 
@@ -390,6 +553,16 @@ struct TCPCong_ *tcp_cong(TCP *tcp) {
     return &tcp->cong;
 }
 
+gint tcp_getSmoothedRTT(TCP* tcp) {
+    MAGIC_ASSERT(tcp);
+    return tcp->timing.rttSmoothed;
+}
+
+guint32 tcp_getPeerReceiveWindow(TCP* tcp) {
+    MAGIC_ASSERT(tcp);
+    return tcp->receive.lastWindow;
+}
+
 void tcp_clearAllChildrenIfServer(TCP* tcp) {
     MAGIC_ASSERT(tcp);
     if(tcp->server && tcp->server->children) {
@@ -643,6 +816,37 @@ static void _tcp_autotuneSendBuffer(TCP* tcp, const Host* host) {
     }
 }
 
+bool tcp_getNoDelay(TCP* tcp) {
+    MAGIC_ASSERT(tcp);
+    return tcp->send.noDelay;
+}
+
+void tcp_setNoDelay(TCP* tcp, const Host* host, bool noDelay) {
+    MAGIC_ASSERT(tcp);
+    tcp->send.noDelay = noDelay;
+    if (noDelay && tcp->send.unsentLength > 0) {
+        /* like linux, setting TCP_NODELAY sends the data that Nagle's algorithm held back */
+        tcp->send.push = TRUE;
+        _tcp_flush(tcp, host);
+    }
+}
+
+bool tcp_getCork(TCP* tcp) {
+    MAGIC_ASSERT(tcp);
+    return tcp->send.cork;
+}
+
+void tcp_setCork(TCP* tcp, const Host* host, bool cork) {
+    MAGIC_ASSERT(tcp);
+    bool wasCorked = tcp->send.cork;
+    tcp->send.cork = cork;
+    if (wasCorked && !cork && tcp->send.unsentLength > 0) {
+        /* uncorking sends the data that was held back */
+        tcp->send.push = TRUE;
+        _tcp_flush(tcp, host);
+    }
+}
+
 void tcp_disableSendBufferAutotuning(TCP* tcp) {
     MAGIC_ASSERT(tcp);
     tcp->autotune.userDisabledSend = TRUE;
@@ -657,6 +861,58 @@ void tcp_disableReceiveBufferAutotuning(TCP* tcp) {
 static void _tcp_runCloseTimerExpiredTask(const Host* host, gpointer tcp, gpointer userData);
 static void _tcp_clearRetransmit(TCP* tcp, guint sequence);
 
+/* report the totals of the current flow metrics interval to the host, if there were any */
+static void _tcp_reportFlowMetrics(TCP* tcp, const Host* host) {
+    if (tcp->metrics.bytesSent == 0 && tcp->metrics.bytesReceived == 0 &&
+        tcp->metrics.retransmits == 0) {
+        return;
+    }
+
+    host_recordFlowMetrics(host, tcp->metrics.intervalStart, tcp->super.boundAddress,
+                           tcp->super.boundPort, tcp->super.peerIP, tcp->super.peerPort,
+                           tcp->metrics.bytesSent, tcp->metrics.bytesReceived,
+                           tcp->metrics.retransmits, tcp->metrics.cwnd, tcp->metrics.srttMs,
+                           tcp->metrics.sendQueueBytes, tcp->metrics.recvQueueBytes);
+
+    tcp->metrics.bytesSent = 0;
+    tcp->metrics.bytesReceived = 0;
+    tcp->metrics.retransmits = 0;
+}
+
+/* add to the totals of the current flow metrics interval. the counters live in the socket so this
+ * is only a few additions per packet, and the previous interval is reported when the first packet
+ * after its end is counted. the last interval is reported when the socket closes or is freed, or
+ * when the host shuts down. */
+static void _tcp_addFlowMetrics(TCP* tcp, const Host* host, gsize bytesSent, gsize bytesReceived,
+                                gsize retransmits) {
+    CSimulationTime interval = host_getFlowMetricsInterval(host);
+    if (interval == 0) {
+        return;
+    }
+
+    CSimulationTime now = worker_getCurrentSimulationTime();
+    if (now >= tcp->metrics.intervalStart + interval) {
+        _tcp_reportFlowMetrics(tcp, host);
+        /* intervals are aligned so that samples of different sockets can be compared */
+        tcp->metrics.intervalStart = now - (now % interval);
+    }
+
+    tcp->metrics.bytesSent += bytesSent;
+    tcp->metrics.bytesReceived += bytesReceived;
+    tcp->metrics.retransmits += retransmits;
+
+    /* the interval could end at any later packet, so keep the state as of this one */
+    tcp->metrics.cwnd = tcp->cong.cwnd;
+    tcp->metrics.srttMs = (guint32)MAX(tcp->timing.rttSmoothed, 0);
+    tcp->metrics.sendQueueBytes = tcp_getOutputBufferLength(tcp);
+    tcp->metrics.recvQueueBytes = tcp_getInputBufferLength(tcp);
+}
+
+void tcp_flushFlowMetrics(TCP* tcp, const Host* host) {
+    MAGIC_ASSERT(tcp);
+    _tcp_reportFlowMetrics(tcp, host);
+}
+
 static void _tcp_setState(TCP* tcp, const Host* host, enum TCPState state) {
     MAGIC_ASSERT(tcp);
 
@@ -692,6 +948,7 @@ static void _tcp_setState(TCP* tcp, const Host* host, enum TCPState state) {
         }
         case TCPS_CLOSED: {
             _tcp_clearRetransmit(tcp, (guint)-1);
+            _tcp_reportFlowMetrics(tcp, host);
 
             /* user can no longer use socket */
             legacyfile_adjustStatus((LegacyFile*)tcp, STATUS_FILE_ACTIVE, FALSE);
@@ -783,7 +1040,7 @@ gsize tcp_getOutputBufferLength(TCP* tcp) {
     MAGIC_ASSERT(tcp);
     /* this does not include the socket output buffer to avoid double counting, since the
      * data in the socket output buffer is already counted as part of the tcp retransmit queue */
-    return tcp->throttledOutputLength + tcp->retransmit.queueLength;
+    return tcp->send.unsentLength + tcp->throttledOutputLength + tcp->retransmit.queueLength;
 }
 
 /* returns the total amount of buffered data in this TCP socket, including TCP-specific buffers */
@@ -795,7 +1052,7 @@ gsize tcp_getInputBufferLength(TCP* tcp) {
 /* returns the total number of bytes that we have not yet sent out into the network */
 gsize tcp_getNotSentBytes(TCP* tcp) {
     MAGIC_ASSERT(tcp);
-    return tcp->throttledOutputLength;
+    return tcp->send.unsentLength + tcp->throttledOutputLength;
 }
 
 static gsize _tcp_getBufferSpaceOut(TCP* tcp) {
@@ -840,9 +1097,10 @@ static void _tcp_bufferPacketIn(TCP* tcp, Packet* packet) {
     PacketTCPHeader* hdr = packet_getTCPHeader(packet);
     bool already_received = hdr->sequence < tcp->receive.next;
 
-    if (!already_received && !priorityqueue_find(tcp->unorderedInput, packet)) {
+    /* if we already have a copy of this packet, the new copy would be a duplicate */
+    if (!already_received && _tcppacketring_get(&tcp->unorderedInput, hdr->sequence) == NULL) {
         /* TCP wants in-order data */
-        priorityqueue_push(tcp->unorderedInput, packet);
+        _tcppacketring_insert(&tcp->unorderedInput, hdr->sequence, packet);
         packet_ref(packet);
 
         /* account for the packet length */
@@ -930,20 +1188,155 @@ static Packet* _tcp_createPacketWithoutPayload(TCP* tcp, const Host* host,
     return packet;
 }
 
-static Packet* _tcp_createDataPacket(TCP* tcp, const Host* host, enum ProtocolTCPFlags flags,
-                                     UntypedForeignPtr payload, gsize payloadLength,
-                                     const MemoryManager* mem) {
+/* The payload is the `payloadLength` bytes at `offset` in `bytes`, which the packet shares rather
+ * than copies. */
+static Packet* _tcp_createDataPacketFromBytes(TCP* tcp, const Host* host,
+                                              enum ProtocolTCPFlags flags,
+                                              const PayloadBytes* bytes, gsize offset,
+                                              gsize payloadLength) {
     MAGIC_ASSERT(tcp);
 
     bool isEmpty = payloadLength == 0;
     Packet* packet = _tcp_createPacketWithoutPayload(tcp, host, flags, isEmpty);
     if (!isEmpty) {
         uint64_t priority = host_getNextPacketPriority(host);
-        packet_setPayloadWithMemoryManager(packet, payload, payloadLength, mem, priority);
+        PayloadBytes* slice = payloadbytes_slice(bytes, offset, payloadLength);
+        packet_setPayloadFromBytes(
+            packet, slice, payloadbytes_getData(slice), payloadLength, priority);
     }
     return packet;
 }
 
+static void _tcp_corkTimerCallback(const Host* host, gpointer voidInetSocket, gpointer userData);
+
+/* Returns true if the last segment of the unsent data, which is smaller than the MSS, should be
+ * held back so that it can be coalesced with later writes. */
+static bool _tcp_shouldHoldPartialSegment(TCP* tcp) {
+    MAGIC_ASSERT(tcp);
+
+    if (tcp->send.push) {
+        return false;
+    }
+    if (tcp->send.cork || tcp->send.more) {
+        return true;
+    }
+    /* Nagle's algorithm, with Minshall's change as in linux: only one segment smaller than the
+     * MSS may be unacknowledged, so hold this one back until the last one is acknowledged */
+    return !tcp->send.noDelay && tcp->send.createdSmallSegment &&
+           tcp->send.smallSegmentSequence >= tcp->send.unacked;
+}
+
+/* Like linux, a segment that is held back because of TCP_CORK or MSG_MORE is sent after at most
+ * 200 ms, in case the app never writes or uncorks. */
+static void _tcp_scheduleCorkTimer(TCP* tcp, const Host* host) {
+    MAGIC_ASSERT(tcp);
+
+    if (tcp->send.corkTimerIsScheduled) {
+        return;
+    }
+
+    utility_alwaysAssert(tcp->rustSocket != NULL);
+    const InetSocket* inetSocket = inetsocketweak_upgrade(tcp->rustSocket);
+    utility_alwaysAssert(inetSocket != NULL);
+    TaskRef* corkTask = taskref_new_bound(host_getID(host), _tcp_corkTimerCallback,
+                                          (void*)inetSocket, NULL, inetsocket_dropVoid, NULL);
+    host_scheduleTaskWithDelay(host, corkTask, 200 * SIMTIME_ONE_MILLISECOND);
+    taskref_drop(corkTask);
+
+    tcp->send.corkTimerIsScheduled = TRUE;
+}
+
+/* Create data packets from the unsent user data and queue them for sending. Unless `all` is set,
+ * packets are only created while they fit in the send window, and a last segment smaller than the
+ * MSS may be held back to be coalesced with later writes (see `_tcp_shouldHoldPartialSegment`).
+ * A segment can span several writes, in which case its payload is copied; otherwise the packet
+ * shares the buffer of the write. */
+static void _tcp_packetizeUnsentData(TCP* tcp, const Host* host, bool all) {
+    MAGIC_ASSERT(tcp);
+
+    while (tcp->send.unsentLength > 0 &&
+           (all || tcp->send.next < (guint)(tcp->send.unacked + tcp->send.window))) {
+        gsize segmentLength = MIN(CONFIG_TCP_MAX_SEGMENT_SIZE, tcp->send.unsentLength);
+
+        if (segmentLength < CONFIG_TCP_MAX_SEGMENT_SIZE && !all &&
+            _tcp_shouldHoldPartialSegment(tcp)) {
+            trace("%s <-> %s: holding back %" G_GSIZE_FORMAT " bytes", tcp->super.boundString,
+                  tcp->super.peerString, segmentLength);
+            if (tcp->send.cork || tcp->send.more) {
+                _tcp_scheduleCorkTimer(tcp, host);
+            }
+            break;
+        }
+
+        const PayloadBytes* bytes = g_queue_peek_head(tcp->send.unsentData);
+        utility_debugAssert(bytes != NULL);
+
+        gsize bytesLength = payloadbytes_getLength(bytes);
+        utility_debugAssert(tcp->send.unsentOffset < bytesLength);
+
+        Packet* packet = NULL;
+        if (segmentLength <= bytesLength - tcp->send.unsentOffset) {
+            /* the segment is within one write */
+            packet = _tcp_createDataPacketFromBytes(
+                tcp, host, PTCP_ACK, bytes, tcp->send.unsentOffset, segmentLength);
+
+            tcp->send.unsentOffset += segmentLength;
+            if (tcp->send.unsentOffset == bytesLength) {
+                payloadbytes_free(g_queue_pop_head(tcp->send.unsentData));
+                tcp->send.unsentOffset = 0;
+            }
+        } else {
+            /* coalesce the segment from several writes */
+            guint8* segment = g_malloc(segmentLength);
+            gsize copied = 0;
+            while (copied < segmentLength) {
+                bytes = g_queue_peek_head(tcp->send.unsentData);
+                utility_debugAssert(bytes != NULL);
+                bytesLength = payloadbytes_getLength(bytes);
+
+                gsize copyLength =
+                    MIN(segmentLength - copied, bytesLength - tcp->send.unsentOffset);
+                memcpy(segment + copied,
+                       (const guint8*)payloadbytes_getData(bytes) + tcp->send.unsentOffset,
+                       copyLength);
+                copied += copyLength;
+
+                tcp->send.unsentOffset += copyLength;
+                if (tcp->send.unsentOffset == bytesLength) {
+                    payloadbytes_free(g_queue_pop_head(tcp->send.unsentData));
+                    tcp->send.unsentOffset = 0;
+                }
+            }
+
+            PayloadBytes* coalesced = payloadbytes_newFromBuffer(segment, segmentLength);
+            g_free(segment);
+            packet =
+                _tcp_createDataPacketFromBytes(tcp, host, PTCP_ACK, coalesced, 0, segmentLength);
+            payloadbytes_free(coalesced);
+        }
+
+        if (segmentLength < CONFIG_TCP_MAX_SEGMENT_SIZE) {
+            tcp->send.createdSmallSegment = TRUE;
+            tcp->send.smallSegmentSequence = packet_getTCPHeader(packet)->sequence;
+        }
+
+        /* we are sending more user data */
+        tcp->send.end++;
+        tcp->send.unsentLength -= segmentLength;
+
+        if (tcp->send.unsentLength == 0) {
+            /* nothing is held back anymore */
+            tcp->send.push = FALSE;
+        }
+
+        /* buffer the outgoing packet in TCP */
+        _tcp_bufferPacketOut(tcp, packet);
+
+        /* the output buffer holds the packet ref now */
+        packet_unref(packet);
+    }
+}
+
 static Packet* _tcp_createControlPacket(TCP* tcp, const Host* host, enum ProtocolTCPFlags flags) {
     MAGIC_ASSERT(tcp);
 
@@ -974,12 +1367,11 @@ static void _tcp_addRetransmit(TCP* tcp, Packet* packet) {
     MAGIC_ASSERT(tcp);
 
     PacketTCPHeader* header = packet_getTCPHeader(packet);
-    gpointer key = GINT_TO_POINTER(header->sequence);
 
     /* if it is already in the queue, it won't consume another packet reference */
-    if(g_hash_table_lookup(tcp->retransmit.queue, key) == NULL) {
+    if(_tcppacketring_get(&tcp->retransmit.queue, header->sequence) == NULL) {
         /* its not in the queue yet */
-        g_hash_table_insert(tcp->retransmit.queue, key, packet);
+        _tcppacketring_insert(&tcp->retransmit.queue, header->sequence, packet);
         packet_ref(packet);
 
         packet_addDeliveryStatus(packet, PDS_SND_TCP_ENQUEUE_RETRANSMIT);
@@ -991,45 +1383,23 @@ static void _tcp_addRetransmit(TCP* tcp, Packet* packet) {
     }
 }
 
-static gint _tcp_compare_sequence(gconstpointer ptr_1, gconstpointer ptr_2, gpointer user_data) {
-    const guint seq_1 = GPOINTER_TO_INT(ptr_1);
-    const guint seq_2 = GPOINTER_TO_INT(ptr_2);
-    return (seq_1 < seq_2) ? -1 : (seq_1 > seq_2) ? 1 : 0;
-}
-
 /* remove all packets with a sequence number less than the sequence parameter */
 static void _tcp_clearRetransmit(TCP* tcp, guint sequence) {
     MAGIC_ASSERT(tcp);
 
-    // Clear the retrans packets in a deterministic order
-    GQueue* keys_sorted = g_queue_new();
-    GHashTableIter iter;
-    gpointer key;
-
-    // First get the keys that need to be removed
-    g_hash_table_iter_init(&iter, tcp->retransmit.queue);
-
-    while (g_hash_table_iter_next(&iter, &key, NULL)) {
-        guint ackedSequence = GPOINTER_TO_INT(key);
-        if(ackedSequence < sequence) {
-            g_queue_insert_sorted(keys_sorted, key, _tcp_compare_sequence, NULL);
-        }
+    // The queue is ordered by sequence, so the acked packets are at the front and are cleared in
+    // a deterministic order
+    Packet* ackedPacket = NULL;
+    guint ackedSequence = 0;
+    while (tcp->retransmit.queue.numPackets > 0 &&
+           tcp->retransmit.queue.firstSequence < sequence &&
+           (ackedPacket = _tcppacketring_stealFirst(&tcp->retransmit.queue, &ackedSequence))) {
+        utility_debugAssert(ackedSequence < sequence);
+        tcp->retransmit.queueLength -= packet_getPayloadSize(ackedPacket);
+        packet_addDeliveryStatus(ackedPacket, PDS_SND_TCP_DEQUEUE_RETRANSMIT);
+        packet_unref(ackedPacket);
     }
 
-    // Now remove the packets in order
-    while (g_queue_get_length(keys_sorted) > 0) {
-        key = g_queue_pop_head(keys_sorted);
-        Packet* ackedPacket = g_hash_table_lookup(tcp->retransmit.queue, key);
-        if (ackedPacket) {
-            tcp->retransmit.queueLength -= packet_getPayloadSize(ackedPacket);
-            packet_addDeliveryStatus(ackedPacket, PDS_SND_TCP_DEQUEUE_RETRANSMIT);
-            g_hash_table_remove(tcp->retransmit.queue, key);
-        }
-    }
-
-    // Cleanup
-    g_queue_free(keys_sorted);
-
     if(_tcp_getBufferSpaceOut(tcp) > 0) {
         legacyfile_adjustStatus((LegacyFile*)tcp, STATUS_FILE_WRITABLE, TRUE);
     }
@@ -1040,16 +1410,18 @@ static void _tcp_clearRetransmitRange(TCP* tcp, guint begin, guint end) {
     MAGIC_ASSERT(tcp);
 
 
-    for (uint32_t seq = begin; seq < end; ++seq) {
-        Packet *packet = g_hash_table_lookup(tcp->retransmit.queue,
-                                             GINT_TO_POINTER(seq));
+    /* only the queued range of sequences needs to be checked */
+    TCPPacketRing* queue = &tcp->retransmit.queue;
+    begin = MAX(begin, queue->firstSequence);
+    end = MIN(end, queue->firstSequence + queue->numSlots);
+
+    for (uint32_t seq = begin; seq < end && queue->numPackets > 0; ++seq) {
+        Packet* packet = _tcppacketring_steal(queue, seq);
 
         if (packet != NULL) {
             tcp->retransmit.queueLength -= packet_getPayloadSize(packet);
             packet_addDeliveryStatus(packet, PDS_SND_TCP_DEQUEUE_RETRANSMIT);
-            bool success = g_hash_table_remove(tcp->retransmit.queue,
-                                               GINT_TO_POINTER(seq));
-            utility_debugAssert(success);
+            packet_unref(packet);
         }
     }
 
@@ -1066,34 +1438,25 @@ static void _tcp_scheduleRetransmitTimer(TCP* tcp, const Host* host, CSimulation
                                          CSimulationTime delay) {
     MAGIC_ASSERT(tcp);
 
-    CSimulationTime* expireTimePtr = g_new0(CSimulationTime, 1);
-    *expireTimePtr = now + delay;
-    gboolean success = priorityqueue_push(tcp->retransmit.scheduledTimerExpirations, expireTimePtr);
+    utility_alwaysAssert(tcp->rustSocket != NULL);
+    const InetSocket* inetSocket = inetsocketweak_upgrade(tcp->rustSocket);
+    utility_alwaysAssert(inetSocket != NULL);
+    TaskRef* retexpTask = taskref_new_bound(host_getID(host), _tcp_runRetransmitTimerExpiredTask,
+                                            (void*)inetSocket, NULL, inetsocket_dropVoid, NULL);
+    host_scheduleTaskWithDelay(host, retexpTask, delay);
+    taskref_drop(retexpTask);
 
-    if(success) {
-        utility_alwaysAssert(tcp->rustSocket != NULL);
-        const InetSocket* inetSocket = inetsocketweak_upgrade(tcp->rustSocket);
-        utility_alwaysAssert(inetSocket != NULL);
-        TaskRef* retexpTask =
-            taskref_new_bound(host_getID(host), _tcp_runRetransmitTimerExpiredTask,
-                              (void*)inetSocket, NULL, inetsocket_dropVoid, NULL);
-        host_scheduleTaskWithDelay(host, retexpTask, delay);
-        taskref_drop(retexpTask);
-
-        trace("%s retransmit timer scheduled for %"G_GUINT64_FORMAT" ns",
-                tcp->super.boundString, *expireTimePtr);
-    } else {
-        warning("%s could not schedule a retransmit timer for %"G_GUINT64_FORMAT" ns",
-                tcp->super.boundString, *expireTimePtr);
-        g_free(expireTimePtr);
-    }
+    tcp->retransmit.scheduledTimerExpiration = now + delay;
+
+    trace("%s retransmit timer scheduled for %" G_GUINT64_FORMAT " ns", tcp->super.boundString,
+          tcp->retransmit.scheduledTimerExpiration);
 }
 
 static void _tcp_scheduleRetransmitTimerIfNeeded(TCP* tcp, const Host* host, CSimulationTime now) {
     /* logic for scheduling retransmission events. we only need to schedule one if
      * we have no events that will allow us to schedule one later. */
-    CSimulationTime* nextTimePtr = priorityqueue_peek(tcp->retransmit.scheduledTimerExpirations);
-    if(nextTimePtr && *nextTimePtr <= tcp->retransmit.desiredTimerExpiration) {
+    CSimulationTime nextTime = tcp->retransmit.scheduledTimerExpiration;
+    if(nextTime != 0 && nextTime <= tcp->retransmit.desiredTimerExpiration) {
         /* another event will fire before the RTO expires, check again then */
         return;
     }
@@ -1171,7 +1534,8 @@ static void _tcp_updateRTTEstimate(TCP* tcp, const Host* host, CSimulationTime t
 static void _tcp_retransmitPacket(TCP* tcp, const Host* host, gint sequence) {
     MAGIC_ASSERT(tcp);
 
-    Packet* packet = g_hash_table_lookup(tcp->retransmit.queue, GINT_TO_POINTER(sequence));
+    /* remove from queue; the packet ref count is not decremented */
+    Packet* packet = _tcppacketring_steal(&tcp->retransmit.queue, (guint)sequence);
     /* if packet wasn't found is was most likely retransmitted from a previous SACK
      * but has yet to be received/acknowledged by the receiver */
     if(!packet) {
@@ -1184,10 +1548,6 @@ static void _tcp_retransmitPacket(TCP* tcp, const Host* host, gint sequence) {
     trace("retransmitting packet %d", sequence);
     // fprintf(stderr, "R- retransmitting packet %d with ts %llu\n", sequence, hdr.timestampValue);
 
-    /* remove from queue and update length and status.
-     * calling steal means that the packet ref count is not decremented */
-    g_hash_table_steal(tcp->retransmit.queue, GINT_TO_POINTER(sequence));
-
     /* update queue length and status */
     tcp->retransmit.queueLength -= packet_getPayloadSize(packet);
     packet_addDeliveryStatus(packet, PDS_SND_TCP_DEQUEUE_RETRANSMIT);
@@ -1203,6 +1563,7 @@ static void _tcp_retransmitPacket(TCP* tcp, const Host* host, gint sequence) {
     _tcp_bufferPacketOut(tcp, packet);
     packet_addDeliveryStatus(packet, PDS_SND_TCP_RETRANSMITTED);
     tcp->info.retransmitCount++;
+    _tcp_addFlowMetrics(tcp, host, 0, 0, 1);
 
     /* free the ref that we stole */
     packet_unref(packet);
@@ -1221,6 +1582,9 @@ static void _tcp_sendShutdownFin(TCP* tcp, const Host* host) {
     }
 
     if(sendFin) {
+        /* the fin must come after all of the user data */
+        _tcp_packetizeUnsentData(tcp, host, true);
+
         /* send a fin */
         Packet* fin = _tcp_createControlPacket(tcp, host, PTCP_FIN);
         _tcp_bufferPacketOut(tcp, fin);
@@ -1237,14 +1601,18 @@ void tcp_networkInterfaceIsAboutToSendPacket(TCP* tcp, const Host* host, Packet*
     CSimulationTime now = worker_getCurrentSimulationTime();
 
     /* update TCP header to our current advertised window and acknowledgment and timestamps */
-    packet_updateTCP(packet, tcp->receive.next, tcp->send.selectiveACKs, tcp->receive.window, 0,
-                     false, now, tcp->receive.lastTimestamp);
+    packet_updateTCP(packet, tcp->receive.next, tcp->receive.window, 0, false, now,
+                     tcp->receive.lastTimestamp);
+    packet_setTCPSelectiveACKs(packet, (const guint*)tcp->send.selectiveACKs->data,
+                               tcp->send.selectiveACKs->len);
 
     /* keep track of the last things we sent them */
     tcp->send.lastAcknowledgment = tcp->receive.next;
     tcp->send.lastWindow = tcp->receive.window;
     tcp->info.lastAckSent = now;
 
+    _tcp_addFlowMetrics(tcp, host, packet_getPayloadSize(packet), 0, 0);
+
     PacketTCPHeader* header = packet_getTCPHeader(packet);
 
     if(header->flags & PTCP_ACK) {
@@ -1273,11 +1641,24 @@ static void _tcp_flush(TCP* tcp, const Host* host) {
     CSimulationTime now = worker_getCurrentSimulationTime();
     double dtime = (double)(now) / (1.0E9);
 
-    size_t num_lost_ranges =
-       retransmit_tally_num_lost_ranges(tcp->retransmit.tally);
+    /* every lost range is retransmitted below, so there can only be new lost ranges if the tally
+     * has been updated since the last flush */
+    size_t num_lost_ranges = 0;
+    if (tcp->retransmit.tallyChanged) {
+        num_lost_ranges = retransmit_tally_num_lost_ranges(tcp->retransmit.tally);
+        tcp->retransmit.tallyChanged = FALSE;
+    }
 
     if (num_lost_ranges > 0) {
-        uint32_t *lost_ranges = malloc(2 * num_lost_ranges * sizeof(uint32_t));
+        if (num_lost_ranges > tcp->retransmit.lostRangesCapacity) {
+            tcp->retransmit.lostRangesCapacity =
+                MAX(num_lost_ranges, 2 * tcp->retransmit.lostRangesCapacity);
+            tcp->retransmit.lostRanges =
+                realloc(tcp->retransmit.lostRanges,
+                        2 * tcp->retransmit.lostRangesCapacity * sizeof(uint32_t));
+            utility_alwaysAssert(tcp->retransmit.lostRanges != NULL);
+        }
+        uint32_t* lost_ranges = tcp->retransmit.lostRanges;
         retransmit_tally_populate_lost_ranges(tcp->retransmit.tally,
                                               lost_ranges);
 
@@ -1296,12 +1677,13 @@ static void _tcp_flush(TCP* tcp, const Host* host) {
                                                begin, end);
 
         }
-
-        free(lost_ranges);
     }
 
     /* find all packets to retransmit and add them throttled output */
 
+    /* new data packets that now fit in the window can be created */
+    _tcp_packetizeUnsentData(tcp, host, false);
+
     // bool print = true;
 
     /* flush packets that can now be sent to socket */
@@ -1361,48 +1743,48 @@ static void _tcp_flush(TCP* tcp, const Host* host) {
         utility_debugAssert(success);
     }
 
-    /* any packets now in order can be pushed to our user input buffer */
-    while(!priorityqueue_isEmpty(tcp->unorderedInput)) {
-        Packet* packet = priorityqueue_peek(tcp->unorderedInput);
+    /* remove any (probably retransmitted) copies of packets we already delivered to the plugin */
+    Packet* packet = NULL;
+    guint sequence = 0;
+    while (tcp->unorderedInput.numPackets > 0 &&
+           tcp->unorderedInput.firstSequence < tcp->receive.next &&
+           (packet = _tcppacketring_stealFirst(&tcp->unorderedInput, &sequence))) {
+        trace("Removing packet %u with duplicate data", sequence);
+        tcp->unorderedInputLength -= packet_getPayloadSize(packet);
+        packet_unref(packet);
+    }
 
+    /* any packets now in order can be pushed to our user input buffer; the run of packets to
+     * deliver starts at the front of the ring */
+    while (tcp->unorderedInput.numPackets > 0 &&
+           (packet = _tcppacketring_get(&tcp->unorderedInput, tcp->receive.next)) != NULL) {
         PacketTCPHeader* header = packet_getTCPHeader(packet);
+        utility_debugAssert(header->sequence == tcp->receive.next);
 
         _rswlog(tcp, "I just received packet %d\n", header->sequence);
-        if (header->sequence < tcp->receive.next) {
-            // This is a (probably retransmitted) copy of a packet we already stored
-            // and delivered to the plugin.
-            trace("Removing packet %u with duplicate data", header->sequence);
-            priorityqueue_pop(tcp->unorderedInput);
-            tcp->unorderedInputLength -= packet_getPayloadSize(packet);
-            packet_unref(packet);
-        } else if (header->sequence == tcp->receive.next) {
-            /* move from the unordered buffer to user input buffer */
-            gboolean fitInBuffer = legacysocket_addToInputBuffer(&(tcp->super), host, packet);
-
-            if(fitInBuffer) {
-                // fprintf(stderr, "SND/RCV Recv %s %s %d @ %f\n", tcp->super.boundString, tcp->super.peerString, header.sequence, dtime);
-                tcp->receive.lastSequence = header->sequence;
-                priorityqueue_pop(tcp->unorderedInput);
-                tcp->unorderedInputLength -= packet_getPayloadSize(packet);
-                packet_unref(packet);
-                (tcp->receive.next)++;
-                continue;
-            }
-        }
 
-        _rswlog(tcp, "Could not buffer %d, was expecting %d\n", header->sequence,
-                tcp->receive.next);
+        /* move from the unordered buffer to user input buffer */
+        gboolean fitInBuffer = legacysocket_addToInputBuffer(&(tcp->super), host, packet);
+
+        if(!fitInBuffer) {
+            _rswlog(tcp, "Could not buffer %d, no space\n", header->sequence);
+            break;
+        }
 
-        /* we could not buffer it because its out of order or we have no space */
-        break;
+        // fprintf(stderr, "SND/RCV Recv %s %s %d @ %f\n", tcp->super.boundString, tcp->super.peerString, header.sequence, dtime);
+        tcp->receive.lastSequence = header->sequence;
+        _tcppacketring_steal(&tcp->unorderedInput, header->sequence);
+        tcp->unorderedInputLength -= packet_getPayloadSize(packet);
+        packet_unref(packet);
+        (tcp->receive.next)++;
     }
 
     /* update the tracker input/output buffer stats */
     Tracker* tracker = host_getTracker(host);
     LegacySocket* socket = (LegacySocket*)tcp;
-    gsize inSize = legacysocket_getInputBufferSize(&(tcp->super));
-    gsize outSize = legacysocket_getOutputBufferSize(&(tcp->super));
     if (tracker != NULL) {
+        gsize inSize = legacysocket_getInputBufferSize(&(tcp->super));
+        gsize outSize = legacysocket_getOutputBufferSize(&(tcp->super));
         CompatSocket compatSocket = compatsocket_fromLegacySocket(socket);
         tracker_updateSocketInputBuffer(
             tracker, &compatSocket, inSize - _tcp_getBufferSpaceIn(tcp), inSize);
@@ -1450,12 +1832,12 @@ static void _tcp_runRetransmitTimerExpiredTask(const Host* host, gpointer voidIn
     TCP* tcp = inetsocket_asLegacyTcp(inetSocket);
     MAGIC_ASSERT(tcp);
 
-    /* a timer expired, update our timer tracking state */
+    /* a timer expired, update our timer tracking state. if this isn't the earliest event we know
+     * of, it's an older event that was superseded by an earlier one. */
     CSimulationTime now = worker_getCurrentSimulationTime();
-    CSimulationTime* scheduledTimerExpirationPtr =
-        priorityqueue_pop(tcp->retransmit.scheduledTimerExpirations);
-    utility_debugAssert(scheduledTimerExpirationPtr);
-    g_free(scheduledTimerExpirationPtr);
+    if(tcp->retransmit.scheduledTimerExpiration == now) {
+        tcp->retransmit.scheduledTimerExpiration = 0;
+    }
 
     trace("%s a scheduled retransmit timer expired", tcp->super.boundString);
 
@@ -1466,7 +1848,7 @@ static void _tcp_runRetransmitTimerExpiredTask(const Host* host, gpointer voidIn
         return;
     }
 
-    if(g_hash_table_size(tcp->retransmit.queue) == 0) {
+    if(tcp->retransmit.queue.numPackets == 0) {
         _tcp_stopRetransmitTimer(tcp);
         return;
     }
@@ -1497,6 +1879,7 @@ static void _tcp_runRetransmitTimerExpiredTask(const Host* host, gpointer voidIn
     retransmit_tally_mark_lost(tcp->retransmit.tally,
                                tcp->receive.lastAcknowledgment,
                                tcp->send.highestSequence + 1);
+    tcp->retransmit.tallyChanged = TRUE;
 
     _rswlog(tcp, "Timeout, marking %d as lost.\n", tcp->receive.lastAcknowledgment);
 
@@ -1778,7 +2161,7 @@ static TCP* _tcp_getSourceTCP(TCP* tcp, in_addr_t ip, in_port_t port) {
         MAGIC_ASSERT(tcp->server);
 
         /* children are multiplexed based on remote ip and port */
-        guint childKey = _ipPortHash(ip, port);
+        guint64 childKey = _ipPortKey(ip, port);
         TCP* tcpChild = g_hash_table_lookup(tcp->server->children, &childKey);
 
         if(tcpChild) {
@@ -1789,22 +2172,38 @@ static TCP* _tcp_getSourceTCP(TCP* tcp, in_addr_t ip, in_port_t port) {
     return tcp;
 }
 
-static GList* _tcp_removeSacks(GList* selectiveACKs, gint sequence) {
-    GList *unacked = NULL;
-    if(selectiveACKs) {
-        GList *iter = selectiveACKs;
-        while(iter) {
-            gint sackSequence = GPOINTER_TO_INT(iter->data);
+#define SACK_BEGIN(sacks, i) g_array_index((sacks), guint, 2 * (i))
+#define SACK_END(sacks, i) g_array_index((sacks), guint, 2 * (i) + 1)
 
-            if(sackSequence > sequence) {
-                unacked = g_list_append(unacked, iter->data);
-            }
+/* add the sequence to the selective ACK ranges, merging it with its neighbouring ranges */
+static void _tcp_addSack(GArray* selectiveACKs, guint sequence) {
+    guint numRanges = selectiveACKs->len / 2;
+
+    /* find the first range that ends at or after the sequence */
+    guint i = 0;
+    while (i < numRanges && SACK_END(selectiveACKs, i) < sequence) {
+        i++;
+    }
+
+    if (i < numRanges && SACK_BEGIN(selectiveACKs, i) <= sequence &&
+        sequence < SACK_END(selectiveACKs, i)) {
+        /* already sacked */
+        return;
+    }
 
-            iter = g_list_next(iter);
+    if (i < numRanges && SACK_END(selectiveACKs, i) == sequence) {
+        /* extend the range, and merge it with the next range if they now touch */
+        SACK_END(selectiveACKs, i) = sequence + 1;
+        if (i + 1 < numRanges && SACK_BEGIN(selectiveACKs, i + 1) == sequence + 1) {
+            SACK_END(selectiveACKs, i) = SACK_END(selectiveACKs, i + 1);
+            g_array_remove_range(selectiveACKs, 2 * (i + 1), 2);
         }
-        g_list_free(selectiveACKs);
+    } else if (i < numRanges && SACK_BEGIN(selectiveACKs, i) == sequence + 1) {
+        SACK_BEGIN(selectiveACKs, i) = sequence;
+    } else {
+        guint range[2] = {sequence, sequence + 1};
+        g_array_insert_vals(selectiveACKs, 2 * i, range, 2);
     }
-    return unacked;
 }
 
 TCPProcessFlags _tcp_dataProcessing(TCP* tcp, Packet* packet, PacketTCPHeader *header) {
@@ -1834,26 +2233,17 @@ TCPProcessFlags _tcp_dataProcessing(TCP* tcp, Packet* packet, PacketTCPHeader *h
 
         /* SACK: if not next packet, one was dropped and we need to include this in the selective ACKs */
         if(!isNextPacket && packetFits) {
-            tcp->send.selectiveACKs = g_list_append(tcp->send.selectiveACKs, GINT_TO_POINTER(header->sequence));
-        } else if(tcp->send.selectiveACKs && g_list_length(tcp->send.selectiveACKs) > 0) {
-            /* find the first gap in SACKs and remove everything before it */
-            GList *iter = g_list_first(tcp->send.selectiveACKs);
-            GList *next = g_list_next(iter);
-
-            gint firstSequence = GPOINTER_TO_INT(iter->data);
-            if(firstSequence <= header->sequence + 1) {
-                while(next) {
-                    gint currSequence = GPOINTER_TO_INT(iter->data);
-                    gint nextSequence = GPOINTER_TO_INT(next->data);
-                    /* check for a gap in sequences */
-                    if(currSequence + 1 < nextSequence && currSequence > header->sequence) {
-                        break;
-                    }
-                    iter = next;
-                    next = g_list_next(iter);
+            _tcp_addSack(tcp->send.selectiveACKs, header->sequence);
+        } else if(tcp->send.selectiveACKs->len > 0) {
+            /* find the first gap in SACKs after this packet and remove everything before it */
+            GArray* sacks = tcp->send.selectiveACKs;
+            if(SACK_BEGIN(sacks, 0) <= header->sequence + 1) {
+                guint numRanges = sacks->len / 2;
+                guint i = 0;
+                while(i + 1 < numRanges && SACK_END(sacks, i) <= header->sequence + 1) {
+                    i++;
                 }
-
-                tcp->send.selectiveACKs = _tcp_removeSacks(tcp->send.selectiveACKs, GPOINTER_TO_INT(iter->data));
+                g_array_remove_range(sacks, 0, 2 * (i + 1));
             }
         }
 
@@ -1906,6 +2296,7 @@ TCPProcessFlags _tcp_ackProcessing(TCP* tcp, const Host* host, Packet* packet,
     flags |= retransmit_tally_update(tcp->retransmit.tally,
                                     (guint32)header->acknowledgment,
                                     tcp->send.next, is_dup);
+    tcp->retransmit.tallyChanged = TRUE;
 
     if (is_dup) {
         debug("[CONG-AVOID] duplicate ack");
@@ -2003,6 +2394,20 @@ static void _tcp_sendACKTaskCallback(const Host* host, gpointer voidInetSocket,
     }
 }
 
+static void _tcp_corkTimerCallback(const Host* host, gpointer voidInetSocket, gpointer userData) {
+    const InetSocket* inetSocket = voidInetSocket;
+    utility_alwaysAssert(inetSocket != NULL);
+    TCP* tcp = inetsocket_asLegacyTcp(inetSocket);
+    MAGIC_ASSERT(tcp);
+
+    tcp->send.corkTimerIsScheduled = FALSE;
+    if (tcp->send.unsentLength > 0 && (tcp->send.cork || tcp->send.more)) {
+        trace("sending corked data now");
+        tcp->send.push = TRUE;
+        _tcp_flush(tcp, host);
+    }
+}
+
 /* return TRUE if the packet should be retransmitted */
 static void _tcp_processPacket(LegacySocket* socket, const Host* host, Packet* packet) {
     TCP* tcp = _tcp_fromLegacyFile((LegacyFile*)socket);
@@ -2018,6 +2423,8 @@ static void _tcp_processPacket(LegacySocket* socket, const Host* host, Packet* p
     MAGIC_ASSERT(tcp);
     PacketTCPHeader* header = packet_getTCPHeader(packet);
 
+    _tcp_addFlowMetrics(tcp, host, 0, packetLength, 0);
+
     /* if packet is reset, don't process */
     if(header->flags & PTCP_RST) {
         /* @todo: not sure if this is handled correctly */
@@ -2093,6 +2500,12 @@ static void _tcp_processPacket(LegacySocket* socket, const Host* host, Packet* p
 
                 /* we need to multiplex a new child */
                 TCP* multiplexed = tcp_new(host, recvBufSize, sendBufSize);
+                /* like linux, the child uses the listener's congestion control algorithm */
+                bool congSet = tcpcong_set(multiplexed, tcpcong_nameStr(&tcp->cong));
+                utility_debugAssert(congSet);
+                /* and its TCP_NODELAY and TCP_CORK options */
+                multiplexed->send.noDelay = tcp->send.noDelay;
+                multiplexed->send.cork = tcp->send.cork;
                 Descriptor* desc = descriptor_fromLegacyTcp(multiplexed, /* flags= */ 0);
                 int handle = thread_registerDescriptor(registerInThread, desc);
 
@@ -2284,14 +2697,12 @@ static void _tcp_processPacket(LegacySocket* socket, const Host* host, Packet* p
         return;
     }
 
-    GList* selectiveACKs = packet_copyTCPSelectiveACKs(packet);
-
-    if (selectiveACKs) {
-       retransmit_tally_mark_sacked(tcp->retransmit.tally, selectiveACKs);
-    }
+    guint numSelectiveACKs = 0;
+    const guint* selectiveACKs = packet_getTCPSelectiveACKs(packet, &numSelectiveACKs);
 
-    if(selectiveACKs) {
-        g_list_free(selectiveACKs);
+    if (numSelectiveACKs > 0) {
+        retransmit_tally_mark_sacked(tcp->retransmit.tally, selectiveACKs, numSelectiveACKs);
+        tcp->retransmit.tallyChanged = TRUE;
     }
 
     /* update the last time stamp value (RFC 1323) */
@@ -2405,9 +2816,10 @@ static void _tcp_endOfFileSignalled(TCP* tcp, enum TCPFlags flags) {
     }
 }
 
-/* Address and port must be in network byte order. */
-gssize tcp_sendUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gsize nBytes,
-                        in_addr_t ip, in_port_t port, const MemoryManager* mem) {
+/* Sends user data from either the plugin's `buffer` (if `bytes` is NULL), or from `bytes`. */
+static gssize _tcp_sendUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer,
+                                const PayloadBytes* bytes, gsize nBytes, bool more,
+                                const MemoryManager* mem) {
     MAGIC_ASSERT(tcp);
 
     /* return 0 to signal close, if necessary */
@@ -2427,43 +2839,34 @@ gssize tcp_sendUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gs
     gsize space = _tcp_getBufferSpaceOut(tcp);
     gsize remaining = MIN(acceptable, space);
 
-    /* break data into segments and send each in a packet */
-    gsize maxPacketLength = CONFIG_TCP_MAX_SEGMENT_SIZE;
-    gsize bytesCopied = 0;
-
     /* Need non-NULL buffer. */
-    /* FIXME: should push this check to the point the data is actually read, to correctly handle
-     * non-NULL pointers that aren't accessible. This is currently in the Payload code; need to
-     * bubble up errors from there. If we do bubble up from the payload code, we also need to undo
-     * the TCP state changes made earlier, for example the sequence number increment in the
-     * _tcp_createPacketWithoutPayload code.
-     */
-    if (buffer.val == 0) {
+    if (buffer.val == 0 && bytes == NULL) {
         return -EFAULT;
     }
 
-    /* create as many packets as needed */
-    while(remaining > 0) {
-        gsize copyLength = MIN(maxPacketLength, remaining);
-
-        /* use helper to create the packet */
-        Packet* packet = _tcp_createDataPacket(tcp, host, PTCP_ACK,
-                                               (UntypedForeignPtr){.val = buffer.val + bytesCopied},
-                                               copyLength, mem);
-
-        if(copyLength > 0) {
-            /* we are sending more user data */
-            tcp->send.end++;
+    /* keep the data as unsent bytes; it's split into packets when it can be sent */
+    gsize bytesCopied = 0;
+    if (remaining > 0) {
+        PayloadBytes* unsent = NULL;
+        if (bytes != NULL) {
+            unsent = payloadbytes_slice(bytes, 0, remaining);
+        } else {
+            /* no tcp state was changed yet, so we can return an error if the buffer can't be
+             * read */
+            unsent = payloadbytes_newFromMemoryManager(buffer, remaining, mem);
+            if (unsent == NULL) {
+                return -EFAULT;
+            }
         }
 
-        /* buffer the outgoing packet in TCP */
-        _tcp_bufferPacketOut(tcp, packet);
+        g_queue_push_tail(tcp->send.unsentData, unsent);
+        tcp->send.unsentLength += remaining;
+        bytesCopied = remaining;
+        tcp->send.more = more;
 
-        /* the output buffer holds the packet ref now */
-        packet_unref(packet);
-
-        remaining -= copyLength;
-        bytesCopied += copyLength;
+        if (_tcp_getBufferSpaceOut(tcp) == 0) {
+            legacyfile_adjustStatus((LegacyFile*)tcp, STATUS_FILE_WRITABLE, FALSE);
+        }
     }
 
     trace("%s <-> %s: sending %"G_GSIZE_FORMAT" user bytes", tcp->super.boundString, tcp->super.peerString, bytesCopied);
@@ -2474,6 +2877,17 @@ gssize tcp_sendUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gs
     return (gssize)(bytesCopied == 0 && nBytes != 0 ? -EWOULDBLOCK : bytesCopied);
 }
 
+/* Address and port must be in network byte order. */
+gssize tcp_sendUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gsize nBytes,
+                        bool more, in_addr_t ip, in_port_t port, const MemoryManager* mem) {
+    return _tcp_sendUserData(tcp, host, buffer, NULL, nBytes, more, mem);
+}
+
+gssize tcp_sendUserBytes(TCP* tcp, const Host* host, const PayloadBytes* bytes, gsize nBytes) {
+    return _tcp_sendUserData(
+        tcp, host, (UntypedForeignPtr){.val = 0}, bytes, nBytes, /*more=*/false, NULL);
+}
+
 static void _tcp_sendWindowUpdate(const Host* host, gpointer voidInetSocket, gpointer data) {
     const InetSocket* inetSocket = voidInetSocket;
     utility_alwaysAssert(inetSocket != NULL);
@@ -2680,10 +3094,16 @@ static void _tcp_free(LegacyFile* descriptor) {
     TCP* tcp = _tcp_fromLegacyFile(descriptor);
     MAGIC_ASSERT(tcp);
 
+    /* sockets that never reached CLOSED still have an unreported interval */
+    const Host* host = worker_getCurrentHostIfAny();
+    if (host != NULL) {
+        _tcp_reportFlowMetrics(tcp, host);
+    }
+
     priorityqueue_free(tcp->throttledOutput);
-    priorityqueue_free(tcp->unorderedInput);
-    g_hash_table_destroy(tcp->retransmit.queue);
-    priorityqueue_free(tcp->retransmit.scheduledTimerExpirations);
+    _tcppacketring_destroy(&tcp->unorderedInput);
+    _tcppacketring_destroy(&tcp->retransmit.queue);
+    g_array_free(tcp->send.selectiveACKs, TRUE);
 
     if (tcp->partialUserDataPacket != NULL) {
         packet_unref(tcp->partialUserDataPacket);
@@ -2702,6 +3122,9 @@ static void _tcp_free(LegacyFile* descriptor) {
 
     tcp->cong.hooks->tcp_cong_delete(tcp);
     retransmit_tally_destroy(tcp->retransmit.tally);
+    free(tcp->retransmit.lostRanges);
+
+    g_queue_free_full(tcp->send.unsentData, (GDestroyNotify)payloadbytes_free);
 
     if (tcp->rustSocket != NULL) {
         inetsocketweak_drop(tcp->rustSocket);
@@ -2839,9 +3262,10 @@ TCP* tcp_new(const Host* host, guint receiveBufferSize, guint sendBufferSize) {
     guint32 initial_window = 10;
     gint tcpSSThresh = 0;
 
-    /* in the future we'd like to support more congestion control types
-     * and allow it to be set as a host option */
-    tcp_cong_reno_init(tcp);
+    const char* congestionControl = host_getTCPCongestionControl(host);
+    if (!tcpcong_init(tcp, congestionControl)) {
+        utility_panic("Unsupported TCP congestion control algorithm '%s'", congestionControl);
+    }
 
     tcp->send.window = initial_window;
     tcp->send.lastWindow = initial_window;
@@ -2865,16 +3289,13 @@ TCP* tcp_new(const Host* host, guint receiveBufferSize, guint sendBufferSize) {
 
     tcp->throttledOutput =
             priorityqueue_new((GCompareDataFunc)packet_compareTCPSequence, NULL, (GDestroyNotify)packet_unref);
-    tcp->unorderedInput =
-            priorityqueue_new((GCompareDataFunc)packet_compareTCPSequence, NULL, (GDestroyNotify)packet_unref);
-    tcp->retransmit.queue =
-            g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)packet_unref);
+    tcp->unorderedInput = (TCPPacketRing){0};
+    tcp->retransmit.queue = (TCPPacketRing){0};
+    tcp->send.selectiveACKs = g_array_new(FALSE, FALSE, sizeof(guint));
+    tcp->send.unsentData = g_queue_new();
 
     retransmit_tally_init(&tcp->retransmit.tally);
 
-    tcp->retransmit.scheduledTimerExpirations =
-        priorityqueue_new((GCompareDataFunc)_simulationTimeCompare, NULL, g_free);
-
     /* initialize tcp retransmission timeout */
     _tcp_setRetransmitTimeout(tcp, CONFIG_TCP_RTO_INIT);
 
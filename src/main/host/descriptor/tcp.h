@@ -10,6 +10,7 @@
 #include <glib.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <stdbool.h>
 #include <sys/un.h>
 
 #include "main/core/support/definitions.h"
@@ -72,6 +73,10 @@ gint tcp_acceptServerPeer(TCP* tcp, const Host* host, in_addr_t* ip, in_port_t*
                           gint* acceptedHandle);
 
 struct TCPCong_ *tcp_cong(TCP *tcp);
+/* The smoothed round-trip time estimate, in milliseconds. */
+gint tcp_getSmoothedRTT(TCP* tcp);
+/* The last receive window that the peer advertised to us, in packets. */
+guint32 tcp_getPeerReceiveWindow(TCP* tcp);
 
 void tcp_clearAllChildrenIfServer(TCP* tcp);
 
@@ -79,14 +84,29 @@ gsize tcp_getOutputBufferLength(TCP* tcp);
 gsize tcp_getInputBufferLength(TCP* tcp);
 gsize tcp_getNotSentBytes(TCP* tcp);
 
+/* Report the socket's current flow metrics interval to the host, even though it hasn't ended. */
+void tcp_flushFlowMetrics(TCP* tcp, const Host* host);
+
+/* TCP_NODELAY, which disables Nagle's algorithm. */
+bool tcp_getNoDelay(TCP* tcp);
+void tcp_setNoDelay(TCP* tcp, const Host* host, bool noDelay);
+/* TCP_CORK */
+bool tcp_getCork(TCP* tcp);
+void tcp_setCork(TCP* tcp, const Host* host, bool cork);
+
 void tcp_disableSendBufferAutotuning(TCP* tcp);
 void tcp_disableReceiveBufferAutotuning(TCP* tcp);
 
 gboolean tcp_isValidListener(TCP* tcp);
 gboolean tcp_isListeningAllowed(TCP* tcp);
 
+/* If `more` is set (MSG_MORE), a last segment smaller than the MSS is held back until the next
+ * write. */
 gssize tcp_sendUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gsize nBytes,
-                        in_addr_t ip, in_port_t port, const MemoryManager* mem);
+                        bool more, in_addr_t ip, in_port_t port, const MemoryManager* mem);
+/* Like `tcp_sendUserData`, but sends the first `nBytes` of `bytes` from shadow's memory. The
+ * packets share the buffer of `bytes` rather than copying it. */
+gssize tcp_sendUserBytes(TCP* tcp, const Host* host, const PayloadBytes* bytes, gsize nBytes);
 gssize tcp_receiveUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gsize nBytes,
                            in_addr_t* ip, in_port_t* port, MemoryManager* mem);
 
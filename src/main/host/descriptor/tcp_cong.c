@@ -1,5 +1,65 @@
 #include "main/host/descriptor/tcp_cong.h"
 
+#include <stddef.h>
+#include <string.h>
+
+#include "main/host/descriptor/tcp_cong_cubic.h"
+#include "main/host/descriptor/tcp_cong_reno.h"
+
+typedef void (*TCPCongInit)(TCP *tcp);
+
+typedef struct TCPCongAlgorithm_ {
+    const char **name;
+    TCPCongInit init;
+} TCPCongAlgorithm;
+
+static const TCPCongAlgorithm algorithms_[] = {
+    {&TCP_CONG_RENO_NAME, tcp_cong_reno_init},
+    {&TCP_CONG_CUBIC_NAME, tcp_cong_cubic_init},
+};
+
+static const TCPCongAlgorithm *find_algorithm_(const char* name) {
+    for (size_t i = 0; i < sizeof(algorithms_) / sizeof(algorithms_[0]); i++) {
+        if (strcmp(*algorithms_[i].name, name) == 0) {
+            return &algorithms_[i];
+        }
+    }
+    return NULL;
+}
+
 const char* tcpcong_nameStr(const TCPCong *cong) {
     return cong->hooks->tcp_cong_name_str();
 }
+
+bool tcpcong_init(TCP *tcp, const char* name) {
+    const TCPCongAlgorithm *algorithm = find_algorithm_(name);
+    if (algorithm == NULL) {
+        return false;
+    }
+
+    algorithm->init(tcp);
+    return true;
+}
+
+bool tcpcong_set(TCP *tcp, const char* name) {
+    TCPCong *cong = tcp_cong(tcp);
+
+    if (strcmp(tcpcong_nameStr(cong), name) == 0) {
+        return true;
+    }
+
+    const TCPCongAlgorithm *algorithm = find_algorithm_(name);
+    if (algorithm == NULL) {
+        return false;
+    }
+
+    guint32 cwnd = cong->cwnd;
+    cong->hooks->tcp_cong_delete(tcp);
+    algorithm->init(tcp);
+    cong->cwnd = cwnd;
+    return true;
+}
+
+bool tcpcong_isReceiveWindowLimited(TCP *tcp) {
+    return tcp_cong(tcp)->cwnd > tcp_getPeerReceiveWindow(tcp);
+}
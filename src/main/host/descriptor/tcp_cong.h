@@ -33,4 +33,18 @@ typedef struct TCPCong_ {
 
 const char* tcpcong_nameStr(const TCPCong *cong);
 
+/* Initializes the congestion control algorithm with the given linux name (for example "reno"
+ * or "cubic"). Returns false if the algorithm isn't supported. */
+bool tcpcong_init(TCP *tcp, const char* name);
+
+/* Switches an initialized socket to the congestion control algorithm with the given linux name,
+ * keeping its current congestion window. Returns false if the algorithm isn't supported, in which
+ * case the current algorithm is kept. */
+bool tcpcong_set(TCP *tcp, const char* name);
+
+/* Returns true if the congestion window is larger than the peer's receive window, in which case
+ * growing the congestion window won't let us send any more data and algorithms can skip their
+ * per-ack window updates. */
+bool tcpcong_isReceiveWindowLimited(TCP *tcp);
+
 #endif // SHD_TCP_CONG_H_
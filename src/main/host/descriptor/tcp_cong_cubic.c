@@ -0,0 +1,299 @@
+#include "main/host/descriptor/tcp_cong_cubic.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "lib/logger/logger.h"
+#include "lib/shadow-shim-helper-rs/shim_helper.h"
+#include "main/core/worker.h"
+#include "main/host/descriptor/descriptor.h"
+#include "main/host/descriptor/tcp.h"
+#include "main/host/descriptor/tcp_cong.h"
+
+const char* TCP_CONG_CUBIC_NAME = "cubic";
+
+/* constants from RFC 8312 */
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+
+typedef struct CACubic_ {
+
+    const TCPCongHooks *state_hooks;
+
+    size_t duplicate_ack_n;
+
+    guint32 cong_avoid_nacked;
+    guint32 ssthresh;
+
+    /* the window just before the last window reduction */
+    double w_max;
+    /* the time (in seconds from the start of the epoch) at which the window reaches w_max */
+    double k;
+    /* the window that the cubic function increases towards */
+    double origin_point;
+    /* the window that standard (reno) TCP would have, to stay TCP-friendly */
+    double w_est;
+    /* start of the current congestion avoidance epoch, or 0 if a new epoch should start */
+    CSimulationTime epoch_start;
+
+} CACubic;
+
+/*
+ * Prototype these to avoid circular refs.
+ */
+static inline const struct TCPCongHooks_ *slow_start_hooks_();
+static inline const struct TCPCongHooks_ *fast_recovery_hooks_();
+static inline const struct TCPCongHooks_ *cong_avoid_hooks_();
+
+/* HELPERS *******************************************************/
+
+/* Reduce the window after a loss (RFC 8312, section 4.5 and 4.6). */
+static inline void ssthresh_reduce(TCP *tcp, CACubic *cubic) {
+    guint32 cwnd = tcp_cong(tcp)->cwnd;
+
+    /* fast convergence: release bandwidth to new flows if our window keeps shrinking */
+    if (cwnd < cubic->w_max) {
+        cubic->w_max = cwnd * (1.0 + CUBIC_BETA) / 2.0;
+    } else {
+        cubic->w_max = cwnd;
+    }
+
+    cubic->ssthresh = MAX((guint32)(cwnd * CUBIC_BETA), 2);
+    cubic->epoch_start = 0;
+}
+
+/*
+ * Pass in a non-zero value for n to ack n packets during the transition.
+ */
+static inline void transition_to_cong_avoid(TCP *tcp, CACubic *cubic, guint32 n) {
+    cubic->cong_avoid_nacked = 0;
+    cubic->epoch_start = 0;
+    cubic->state_hooks = cong_avoid_hooks_();
+    cubic->state_hooks->tcp_cong_new_ack_ev(tcp, n);
+    debug("[CONG] desc=%p transition_to_cong_avoid", (LegacyFile*)tcp);
+}
+
+/* SLOW START *******************************************************/
+
+static void ca_cubic_slow_start_duplicate_ack_ev_(TCP *tcp) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+    cubic->duplicate_ack_n++;
+
+    if (cubic->duplicate_ack_n == 3) { // transition to fast recovery
+
+        trace("[CONG-AVOID] three duplicate acks");
+        debug("[CONG] desc %p three duplicate acks transition_to_fast_recovery", (LegacyFile*)tcp);
+
+        ssthresh_reduce(tcp, cubic);
+        tcp_cong(tcp)->cwnd = cubic->ssthresh + 3;
+
+        cubic->state_hooks = fast_recovery_hooks_();
+    }
+}
+
+static void ca_cubic_slow_start_new_ack_ev_(TCP *tcp, guint32 n) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+
+    cubic->duplicate_ack_n = 0;
+
+    guint32 new_cwnd = tcp_cong(tcp)->cwnd;
+    new_cwnd += n;
+
+    if (new_cwnd >= cubic->ssthresh) { // transition to cong avoid
+        guint32 nleft = new_cwnd - cubic->ssthresh;
+        tcp_cong(tcp)->cwnd = cubic->ssthresh;
+        transition_to_cong_avoid(tcp, cubic, nleft);
+    } else {
+        tcp_cong(tcp)->cwnd = new_cwnd;
+    }
+}
+
+/* FAST RECOVERY *******************************************************/
+
+static void ca_cubic_fast_recovery_duplicate_ack_ev_(TCP *tcp) {
+    tcp_cong(tcp)->cwnd += 1;
+}
+
+static void ca_cubic_fast_recovery_new_ack_ev_(TCP *tcp, guint32 n) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+
+    cubic->duplicate_ack_n = 0;
+    tcp_cong(tcp)->cwnd = cubic->ssthresh;
+
+    transition_to_cong_avoid(tcp, cubic, n);
+}
+
+/* CONG AVOID *******************************************************/
+
+static void ca_cubic_cong_avoid_new_ack_ev_(TCP *tcp, guint32 n) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+    guint32 cwnd = tcp_cong(tcp)->cwnd;
+
+    cubic->duplicate_ack_n = 0;
+
+    if (n == 0) {
+        return;
+    }
+
+    if (tcpcong_isReceiveWindowLimited(tcp)) {
+        /* growing the window wouldn't let us send any more, so skip the cubic update and start a
+         * new epoch once the window limits us again */
+        cubic->epoch_start = 0;
+        return;
+    }
+
+    CSimulationTime now = worker_getCurrentSimulationTime();
+
+    if (cubic->epoch_start == 0) {
+        cubic->epoch_start = now;
+        cubic->cong_avoid_nacked = 0;
+        cubic->w_est = cwnd;
+
+        if (cwnd < cubic->w_max) {
+            cubic->k = cbrt((cubic->w_max - cwnd) / CUBIC_C);
+            cubic->origin_point = cubic->w_max;
+        } else {
+            cubic->k = 0;
+            cubic->origin_point = cwnd;
+        }
+    }
+
+    /* the target is the window one rtt from now (RFC 8312, section 4.1) */
+    double rtt = (double)tcp_getSmoothedRTT(tcp) / 1000.0;
+    double t = (double)(now - cubic->epoch_start) / (double)SIMTIME_ONE_SECOND + rtt;
+    double target = cubic->origin_point + CUBIC_C * pow(t - cubic->k, 3);
+
+    /* stay at least as aggressive as reno (RFC 8312, section 4.2) */
+    cubic->w_est += (3.0 * (1.0 - CUBIC_BETA) / (1.0 + CUBIC_BETA)) * ((double)n / cwnd);
+    target = MAX(target, cubic->w_est);
+
+    /* the number of acks needed to increase the window by one packet, where the window grows by
+     * at most 50% per rtt */
+    guint32 acks_per_increase = 100 * cwnd;
+    if (target > cwnd) {
+        acks_per_increase = MAX((guint32)(cwnd / (target - cwnd)), 2);
+    }
+
+    cubic->cong_avoid_nacked += n;
+
+    while (cubic->cong_avoid_nacked >= acks_per_increase) {
+        cubic->cong_avoid_nacked -= acks_per_increase;
+        tcp_cong(tcp)->cwnd += 1;
+    }
+}
+
+/*******************************************************************/
+
+static void ca_cubic_init_(TCP *tcp, CACubic *cubic) {
+    *cubic = (CACubic){0};
+    tcp_cong(tcp)->cwnd = 10;
+    cubic->ssthresh = INT32_MAX;
+    cubic->state_hooks = slow_start_hooks_();
+}
+
+static void tcp_cong_cubic_delete_(TCP *tcp) {
+    free(tcp_cong(tcp)->ca);
+}
+
+static void tcp_cong_cubic_duplicate_ack_ev_(TCP *tcp) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+    cubic->state_hooks->tcp_cong_duplicate_ack_ev(tcp);
+}
+
+static bool tcp_cong_cubic_fast_recovery_(TCP *tcp) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+    return cubic->state_hooks == fast_recovery_hooks_();
+}
+
+static void tcp_cong_cubic_new_ack_ev_(TCP *tcp, guint32 n) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+    cubic->state_hooks->tcp_cong_new_ack_ev(tcp, n);
+}
+
+/* All timeouts have the same behavior! */
+static void tcp_cong_cubic_timeout_ev_(TCP *tcp) {
+
+    CACubic *cubic = tcp_cong(tcp)->ca;
+
+    cubic->duplicate_ack_n = 0;
+    ssthresh_reduce(tcp, cubic);
+    tcp_cong(tcp)->cwnd = 10;
+
+    // transition to slow start
+    cubic->state_hooks = slow_start_hooks_();
+    debug("[CONG] desc %p transition_to_slow_start", (LegacyFile*)tcp);
+}
+
+static guint32 tcp_cong_cubic_ssthresh_(TCP *tcp) {
+    CACubic *cubic = tcp_cong(tcp)->ca;
+    return cubic->ssthresh;
+}
+
+static const char* tcp_cong_cubic_name_str_() {
+    return TCP_CONG_CUBIC_NAME;
+}
+
+static const struct TCPCongHooks_ cubic_hooks_ = {
+    .tcp_cong_delete = tcp_cong_cubic_delete_,
+    .tcp_cong_duplicate_ack_ev = tcp_cong_cubic_duplicate_ack_ev_,
+    .tcp_cong_fast_recovery = tcp_cong_cubic_fast_recovery_,
+    .tcp_cong_new_ack_ev = tcp_cong_cubic_new_ack_ev_,
+    .tcp_cong_timeout_ev = tcp_cong_cubic_timeout_ev_,
+    .tcp_cong_ssthresh = tcp_cong_cubic_ssthresh_,
+    .tcp_cong_name_str = tcp_cong_cubic_name_str_,
+};
+
+void tcp_cong_cubic_init(TCP *tcp) {
+    CACubic *cubic = malloc(sizeof(CACubic));
+    ca_cubic_init_(tcp, cubic);
+
+    tcp_cong(tcp)->cwnd = 1;
+    tcp_cong(tcp)->hooks = (TCPCongHooks*)&cubic_hooks_;
+    tcp_cong(tcp)->ca = cubic;
+}
+
+static const struct TCPCongHooks_ slow_start_hooks__ = {
+    .tcp_cong_delete = NULL,
+    .tcp_cong_duplicate_ack_ev = ca_cubic_slow_start_duplicate_ack_ev_,
+    .tcp_cong_fast_recovery = NULL,
+    .tcp_cong_new_ack_ev = ca_cubic_slow_start_new_ack_ev_,
+    .tcp_cong_timeout_ev = NULL,
+    .tcp_cong_ssthresh = NULL,
+    .tcp_cong_name_str = NULL,
+};
+
+static const struct TCPCongHooks_ fast_recovery_hooks__ = {
+    .tcp_cong_delete = NULL,
+    .tcp_cong_duplicate_ack_ev = ca_cubic_fast_recovery_duplicate_ack_ev_,
+    .tcp_cong_fast_recovery = NULL,
+    .tcp_cong_new_ack_ev = ca_cubic_fast_recovery_new_ack_ev_,
+    .tcp_cong_timeout_ev = NULL,
+    .tcp_cong_ssthresh = NULL,
+    .tcp_cong_name_str = NULL,
+};
+
+/* slow start and cong avoidance have the same dupl act behavior */
+static const struct TCPCongHooks_ cong_avoid_hooks__ = {
+    .tcp_cong_delete = NULL,
+    .tcp_cong_duplicate_ack_ev = ca_cubic_slow_start_duplicate_ack_ev_,
+    .tcp_cong_fast_recovery = NULL,
+    .tcp_cong_new_ack_ev = ca_cubic_cong_avoid_new_ack_ev_,
+    .tcp_cong_timeout_ev = NULL,
+    .tcp_cong_ssthresh = NULL,
+    .tcp_cong_name_str = NULL,
+};
+
+static inline const struct TCPCongHooks_ *slow_start_hooks_() {
+    return &slow_start_hooks__;
+}
+
+static inline const struct TCPCongHooks_ *fast_recovery_hooks_() {
+    return &fast_recovery_hooks__;
+}
+
+static inline const struct TCPCongHooks_ *cong_avoid_hooks_() {
+    return &cong_avoid_hooks__;
+}
@@ -1,7 +1,6 @@
 #include "main/host/descriptor/tcp_retransmit_tally.h"
 #include <algorithm>
 #include <cassert>
-#include <gmodule.h>
 #include <iostream>
 #include <random>
 #include <string>
@@ -219,28 +218,13 @@ enum TCPProcessFlags_ retransmit_tally_update(void *p, uint32_t last_ack, uint32
    return static_cast<TCPProcessFlags_>(ret);
 }
 
-/* We have to do an awful linear scan here because sacks use GList and there
- * is no efficient way to get the last element. */
-void retransmit_tally_mark_sacked(void *p, GList *sacked) {
+void retransmit_tally_mark_sacked(void *p, const uint32_t *sacked, size_t len) {
    auto rt = cast_and_assert(p);
-   SeqRange sacked_block{-1, -1};
+   assert(len % 2 == 0);
 
-   GList *n = g_list_first(sacked);
-
-   while (n != nullptr) {
-      int s = GPOINTER_TO_INT(n->data);
-      if (sacked_block.first == -1) { sacked_block.first = s; }
-
-      if (g_list_next(n) == nullptr
-          || GPOINTER_TO_INT(g_list_next(n)->data) != s + 1)
-      {
-         sacked_block.second = s + 1;
-         ranges_insert(&rt->sacked_, sacked_block);
-         sacked_block.first = -1;
-         sacked_block.second = -1;
-      }
-
-      n = g_list_next(n);
+   for (std::size_t idx = 0; idx + 1 < len; idx += 2) {
+      SeqRange sacked_block{sacked[idx], sacked[idx + 1]};
+      ranges_insert(&rt->sacked_, sacked_block);
    }
 }
 
@@ -11,8 +11,6 @@
 #include <vector>
 #endif // __cplusplus
 
-struct _GList;
-
 /* Really hacky and brittle.  Only doing an explicit copy because #including
  * shd-tcp.h and shadow.h is not working. */
 enum TCPProcessFlags_ {
@@ -36,7 +34,9 @@ size_t retransmit_tally_size_bytes();
 
 enum TCPProcessFlags_ retransmit_tally_update(void *p, uint32_t last_ack, uint32_t max_ack, bool is_dup);
 void retransmit_tally_cleanup_sacked(void *p);
-void retransmit_tally_mark_sacked(void *p, struct _GList *sacked);
+/* Marks the blocks in `sacked` as sacked, where `sacked` holds `len` sequence numbers as
+ * flattened [begin, end) pairs. */
+void retransmit_tally_mark_sacked(void *p, const uint32_t *sacked, size_t len);
 /* Marks the block [begin, end) as lost. */
 void retransmit_tally_mark_lost(void *p, uint32_t begin, uint32_t end);
 void retransmit_tally_mark_retransmitted(void *p, uint32_t begin, uint32_t end);
@@ -9,6 +9,7 @@ use shadow_shim_helper_rs::{
     emulated_time::EmulatedTime, simulation_time::SimulationTime, syscall_types::ForeignPtr,
 };
 
+use crate::core::worker::Worker;
 use crate::cshadow as c;
 use crate::host::descriptor::{
     FileMode, FileState, FileStatus, StateEventSource, StateListenerFilter,
@@ -44,7 +45,7 @@ impl TimerFd {
         Arc::new_cyclic(|weak| {
             let weak_cloned = weak.clone();
             AtomicRefCell::new(Self {
-                timer: Timer::new(move |_host| Self::timer_expired(&weak_cloned)),
+                timer: Timer::new(move |host| Self::timer_expired(&weak_cloned, host)),
                 event_source: StateEventSource::new(),
                 state: FileState::ACTIVE,
                 status,
@@ -54,7 +55,7 @@ impl TimerFd {
     }
 
     /// Called by the inner [`Timer`] when a timer expiration occurs.
-    fn timer_expired(timerfd_weak: &Weak<AtomicRefCell<TimerFd>>) {
+    fn timer_expired(timerfd_weak: &Weak<AtomicRefCell<TimerFd>>, host: &Host) {
         let Some(timerfd) = timerfd_weak.upgrade() else {
             log::trace!("Expired TimerFd no longer exists.");
             return;
@@ -64,10 +65,44 @@ impl TimerFd {
         // here to make sure that any listeners that need to wake up and handle a readable TimerFd
         // are not invoked until after we release the borrow.
         CallbackQueue::queue_and_run(|cb_queue| {
-            timerfd.borrow_mut().update_state(cb_queue);
+            let mut timerfd = timerfd.borrow_mut();
+            timerfd.update_state(cb_queue);
+            // listeners may have been removed since the last expiration
+            timerfd.update_timer_laziness(host);
         });
     }
 
+    /// While nothing is listening for the [`TimerFd`] to become readable (for example a blocked
+    /// reader or an epoll), the timer's expirations don't need to be delivered as they happen, so
+    /// we make the timer lazy: it schedules no events, and the expiration count is computed from
+    /// the elapsed time when it's read or polled.
+    fn update_timer_laziness(&mut self, host: &Host) {
+        // a listener stops the timer from being lazy when it's added (see `wake_timer()`)
+        if self.event_source.num_listeners() == 0 {
+            self.timer.set_lazy(host, true);
+        }
+    }
+
+    /// The expirations counted while the timer was lazy may have made us readable, but nobody was
+    /// listening, so there's no one to notify.
+    fn sync_readable_after_lazy(&mut self) {
+        if !self.state.contains(FileState::CLOSED) {
+            let readable = self.get_timer_count() > 0;
+            self.state.set(FileState::READABLE, readable);
+        }
+    }
+
+    /// Stop the timer from being lazy, since a listener is about to be added.
+    fn wake_timer(&mut self) {
+        if self.timer.is_lazy() {
+            Worker::with_active_host(|host| {
+                self.timer.set_lazy(host, false);
+            })
+            .unwrap();
+            self.sync_readable_after_lazy();
+        }
+    }
+
     /// Returns the number of expirations that have occured since the timer was last armed.
     fn get_timer_count(&self) -> u64 {
         self.timer.expiration_count()
@@ -94,6 +129,7 @@ impl TimerFd {
         interval: Option<SimulationTime>,
         cb_queue: &mut CallbackQueue,
     ) {
+        self.update_timer_laziness(host);
         // Make sure to update our READABLE status.
         self.timer.arm(host, expire_time, interval);
         self.update_state(cb_queue);
@@ -219,11 +255,13 @@ impl TimerFd {
         filter: StateListenerFilter,
         notify_fn: impl Fn(FileState, FileState, &mut CallbackQueue) + Send + Sync + 'static,
     ) -> Handle<(FileState, FileState)> {
+        self.wake_timer();
         self.event_source
             .add_listener(monitoring, filter, notify_fn)
     }
 
     pub fn add_legacy_listener(&mut self, ptr: HostTreePointer<c::StatusListener>) {
+        self.wake_timer();
         self.event_source.add_legacy_listener(ptr);
     }
 
@@ -232,7 +270,12 @@ impl TimerFd {
     }
 
     pub fn state(&self) -> FileState {
-        self.state
+        let mut state = self.state;
+        // a lazy timer's expirations aren't reflected in our state until it's queried
+        if self.timer.is_lazy() && !state.contains(FileState::CLOSED) {
+            state.set(FileState::READABLE, self.get_timer_count() > 0);
+        }
+        state
     }
 
     fn update_state(&mut self, cb_queue: &mut CallbackQueue) {
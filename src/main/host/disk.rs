@@ -0,0 +1,231 @@
+//! The simulated disk that delays reads, writes, and syncs of a host's OS-backed files.
+//!
+//! The host has one disk, which transfers the data of one operation at a time at the disk's
+//! bandwidth, and starts at most `iops` operations per second. The access latency of an operation
+//! is added after its transfer and doesn't keep the disk busy, so operations from several threads
+//! queue for the disk's bandwidth but not for each other's latency. A read may instead be served
+//! from the page cache, in which case it doesn't use the disk at all. Writes aren't cached, so a
+//! sync only waits for the disk to finish the writes that it has already started, plus the latency.
+//!
+//! The real file operations run natively (see [`crate::utility::file_io_pool`]), and only their
+//! simulated completion times come from this model.
+
+use std::num::NonZeroU32;
+
+use rand::Rng;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+use crate::core::support::configuration::FileIoLatencyModel;
+
+#[derive(Debug, Clone)]
+pub struct DiskParameters {
+    /// The mean access latency of each operation.
+    pub latency: SimulationTime,
+    pub latency_model: FileIoLatencyModel,
+    /// The transfer bandwidth, or unlimited if `None`.
+    pub bandwidth_bits: Option<u64>,
+    /// The most operations that the disk can start per second, or unlimited if `None`.
+    pub iops: Option<NonZeroU32>,
+    /// The probability that a read is served from the page cache.
+    pub cache_hit_rate: f64,
+}
+
+impl DiskParameters {
+    /// Whether operations may take simulated time.
+    pub fn is_enabled(&self) -> bool {
+        self.latency != SimulationTime::ZERO || self.bandwidth_bits.is_some() || self.iops.is_some()
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DiskOp {
+    Read,
+    Write,
+    Sync,
+}
+
+#[derive(Debug)]
+pub struct Disk {
+    params: DiskParameters,
+    /// The time at which the disk will have finished transferring the data of all of the
+    /// operations started so far.
+    busy_until: EmulatedTime,
+}
+
+impl Disk {
+    pub fn new(params: DiskParameters) -> Self {
+        Self {
+            params,
+            busy_until: EmulatedTime::SIMULATION_START,
+        }
+    }
+
+    /// Start an operation of `nbytes` bytes at time `now`, and return the time at which it
+    /// completes. Only draws from `rng` if the page cache or an exponential latency is enabled.
+    pub fn start(
+        &mut self,
+        op: DiskOp,
+        nbytes: u64,
+        now: EmulatedTime,
+        rng: &mut impl Rng,
+    ) -> EmulatedTime {
+        if op == DiskOp::Read
+            && self.params.cache_hit_rate > 0.0
+            && rng.gen::<f64>() < self.params.cache_hit_rate
+        {
+            return now;
+        }
+
+        let occupancy = match op {
+            DiskOp::Read | DiskOp::Write => {
+                std::cmp::max(self.transfer_time(nbytes), self.min_op_interval())
+            }
+            DiskOp::Sync => SimulationTime::ZERO,
+        };
+
+        self.busy_until = std::cmp::max(now, self.busy_until) + occupancy;
+        self.busy_until + self.latency(rng)
+    }
+
+    fn transfer_time(&self, nbytes: u64) -> SimulationTime {
+        let Some(bits_per_sec) = self.params.bandwidth_bits else {
+            return SimulationTime::ZERO;
+        };
+        let nanos = u128::from(nbytes) * 8 * 1_000_000_000 / u128::from(bits_per_sec);
+        SimulationTime::from_nanos(nanos.try_into().unwrap())
+    }
+
+    fn min_op_interval(&self) -> SimulationTime {
+        match self.params.iops {
+            Some(iops) => SimulationTime::from_nanos(1_000_000_000 / u64::from(iops.get())),
+            None => SimulationTime::ZERO,
+        }
+    }
+
+    fn latency(&self, rng: &mut impl Rng) -> SimulationTime {
+        let mean = self.params.latency;
+        match self.params.latency_model {
+            FileIoLatencyModel::Constant => mean,
+            FileIoLatencyModel::Exponential if mean == SimulationTime::ZERO => mean,
+            FileIoLatencyModel::Exponential => {
+                let nanos = -(mean.as_nanos() as f64) * (1.0 - rng.gen::<f64>()).ln();
+                SimulationTime::from_nanos(nanos.round() as u64)
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use rand::SeedableRng;
+    use rand_xoshiro::Xoshiro256PlusPlus;
+
+    use super::*;
+
+    fn params() -> DiskParameters {
+        DiskParameters {
+            latency: SimulationTime::from_micros(100),
+            latency_model: FileIoLatencyModel::Constant,
+            // 8 Mbit/s, or 1 byte per microsecond
+            bandwidth_bits: Some(8_000_000),
+            iops: None,
+            cache_hit_rate: 0.0,
+        }
+    }
+
+    fn time(micros: u64) -> EmulatedTime {
+        EmulatedTime::SIMULATION_START + SimulationTime::from_micros(micros)
+    }
+
+    #[test]
+    fn test_queueing() {
+        let mut rng = Xoshiro256PlusPlus::seed_from_u64(1);
+        let mut disk = Disk::new(params());
+
+        // an idle disk
+        assert_eq!(
+            disk.start(DiskOp::Read, 1000, time(0), &mut rng),
+            time(1100)
+        );
+        assert_eq!(
+            disk.start(DiskOp::Write, 500, time(5000), &mut rng),
+            time(5600)
+        );
+
+        // the second write waits for the first write's transfer, but not its latency
+        assert_eq!(
+            disk.start(DiskOp::Write, 1000, time(10_000), &mut rng),
+            time(11_100)
+        );
+        assert_eq!(
+            disk.start(DiskOp::Write, 1000, time(10_000), &mut rng),
+            time(12_100)
+        );
+
+        // a sync waits for the writes' transfers
+        assert_eq!(
+            disk.start(DiskOp::Sync, 0, time(10_000), &mut rng),
+            time(12_100)
+        );
+        assert_eq!(
+            disk.start(DiskOp::Sync, 0, time(20_000), &mut rng),
+            time(20_100)
+        );
+    }
+
+    #[test]
+    fn test_iops() {
+        let mut rng = Xoshiro256PlusPlus::seed_from_u64(1);
+        let mut disk = Disk::new(DiskParameters {
+            iops: NonZeroU32::new(1000),
+            ..params()
+        });
+
+        // small operations are limited by the iops, and large ones by the bandwidth
+        assert_eq!(disk.start(DiskOp::Read, 1, time(0), &mut rng), time(1100));
+        assert_eq!(disk.start(DiskOp::Read, 1, time(0), &mut rng), time(2100));
+        assert_eq!(
+            disk.start(DiskOp::Read, 5000, time(0), &mut rng),
+            time(7100)
+        );
+    }
+
+    #[test]
+    fn test_cache_hit_rate() {
+        let mut rng = Xoshiro256PlusPlus::seed_from_u64(1);
+        let mut disk = Disk::new(DiskParameters {
+            cache_hit_rate: 0.25,
+            ..params()
+        });
+
+        let n = 10_000;
+        let hits = (0..n)
+            .filter(|_| disk.start(DiskOp::Read, 0, time(0), &mut rng) == time(0))
+            .count();
+        assert!((hits as f64 / n as f64 - 0.25).abs() < 0.02);
+
+        // writes are never cached
+        assert!((0..100).all(|_| disk.start(DiskOp::Write, 0, time(0), &mut rng) > time(0)));
+    }
+
+    #[test]
+    fn test_exponential_latency() {
+        let mut rng = Xoshiro256PlusPlus::seed_from_u64(1);
+        let mut disk = Disk::new(DiskParameters {
+            latency_model: FileIoLatencyModel::Exponential,
+            bandwidth_bits: None,
+            ..params()
+        });
+
+        let n = 100_000;
+        let total: u64 = (0..n)
+            .map(|_| {
+                let done = disk.start(DiskOp::Read, 0, time(0), &mut rng);
+                (done - time(0)).as_nanos() as u64
+            })
+            .sum();
+        let mean = total as f64 / n as f64;
+        assert!((mean - 100_000.0).abs() < 2_000.0);
+    }
+}
@@ -19,9 +19,12 @@ struct _Futex {
     // The unique physical address that is used to refer to this futex
     ManagedPhysicalMemoryAddr word;
     // Listeners waiting for wakups on this futex
-    // The key is a listener of type StatusListener*, the value is a boolean that indicates
-    // whether or not a wakeup has already been performed on the listener.
+    // The key is a listener of type StatusListener*, the value is the listener's link in
+    // `unwokenListeners`, or NULL if a wakeup has already been performed on the listener.
     GHashTable* listeners;
+    // The listeners that have not been woken up yet, sorted in deterministic order so that a wake
+    // only needs to visit the listeners that it wakes up. These are borrowed from `listeners`.
+    GQueue unwokenListeners;
     // Manage references
     int referenceCount;
     MAGIC_DECLARE;
@@ -32,6 +35,7 @@ Futex* futex_new(ManagedPhysicalMemoryAddr word) {
     *futex = (Futex){.word = word,
                      .listeners = g_hash_table_new_full(
                          g_direct_hash, g_direct_equal, (GDestroyNotify)statuslistener_unref, NULL),
+                     .unwokenListeners = G_QUEUE_INIT,
                      .referenceCount = 1,
                      MAGIC_INITIALIZER};
 
@@ -43,6 +47,7 @@ Futex* futex_new(ManagedPhysicalMemoryAddr word) {
 static void _futex_free(Futex* futex) {
     MAGIC_ASSERT(futex);
 
+    g_queue_clear(&futex->unwokenListeners);
     g_hash_table_destroy(futex->listeners);
 
     MAGIC_CLEAR(futex);
@@ -73,63 +78,63 @@ ManagedPhysicalMemoryAddr futex_getAddress(Futex* futex) {
 unsigned int futex_wake(Futex* futex, unsigned int numWakeups) {
     MAGIC_ASSERT(futex);
 
-    // We cannot use an iterator here, in case the hash table is modified
-    // in the status changed callback.
-    GList* listenerList = g_hash_table_get_keys(futex->listeners);
-
-    // Iterate the listeners in deterministic order and perform the requested
-    // number of wakeups if we can. It's probably better to maintain the items
-    // in a sorted structure, e.g. a ring, to make it easier / more efficient to
-    // iterate deterministically while also moving the ring entry pointer so we
-    // don't always wake up the same listener first on every iteration and
-    // possibly starve the others.
-    GList* item = NULL;
-    if(listenerList != NULL) {
-        listenerList = g_list_sort(listenerList, status_listener_compare);
-        item = g_list_first(listenerList);
-    }
-
     unsigned int numWoken = 0;
 
-    while (item && (numWoken < numWakeups)) {
-        StatusListener* listener = item->data;
+    while (numWoken < numWakeups && !g_queue_is_empty(&futex->unwokenListeners)) {
+        StatusListener* listener = g_queue_pop_head(&futex->unwokenListeners);
 
-        // Only call if the listener is still valid
-        if (g_hash_table_contains(futex->listeners, listener)) {
-            // If this listener was already woken up, skip it this time
-            bool did_wakeup =
-                (bool)GPOINTER_TO_UINT(g_hash_table_lookup(futex->listeners, listener));
-            if (!did_wakeup) {
-                // Tell the status listener to unblock the thread waiting on the futex
-                statuslistener_onStatusChanged(listener, STATUS_FUTEX_WAKEUP, STATUS_FUTEX_WAKEUP);
+        // Track that we did a wakeup on this listener without destroying the listener. We do this
+        // before the callback, in case the callback modifies the listeners.
+        g_hash_table_steal(futex->listeners, listener);
+        g_hash_table_insert(futex->listeners, listener, NULL);
 
-                // Track that we did a wakeup on this listener without destroying the listener
-                g_hash_table_steal(futex->listeners, listener);
-                g_hash_table_insert(futex->listeners, listener, GUINT_TO_POINTER(true));
+        // Tell the status listener to unblock the thread waiting on the futex. The callback may
+        // remove the listener, so hold a reference while it runs.
+        statuslistener_ref(listener);
+        statuslistener_onStatusChanged(listener, STATUS_FUTEX_WAKEUP, STATUS_FUTEX_WAKEUP);
+        statuslistener_unref(listener);
 
-                // Count the wake-up
-                numWoken++;
-            }
-        }
+        // Count the wake-up
+        numWoken++;
+    }
 
-        item = g_list_next(item);
+    return numWoken;
+}
+
+// Insert the listener into the sorted queue of unwoken listeners, and return its link. Listeners
+// are almost always newer than those already waiting, so we search from the tail.
+static GList* _futex_insertUnwokenListener(Futex* futex, StatusListener* listener) {
+    GList* item = g_queue_peek_tail_link(&futex->unwokenListeners);
+    while (item && status_listener_compare(item->data, listener) > 0) {
+        item = item->prev;
     }
 
-    if(listenerList != NULL) {
-        g_list_free(listenerList);
+    if (item) {
+        g_queue_insert_after(&futex->unwokenListeners, item, listener);
+        return item->next;
+    } else {
+        g_queue_push_head(&futex->unwokenListeners, listener);
+        return g_queue_peek_head_link(&futex->unwokenListeners);
     }
-    return numWoken;
 }
 
 void futex_addListener(Futex* futex, StatusListener* listener) {
     MAGIC_ASSERT(futex);
     utility_debugAssert(listener);
     statuslistener_ref(listener);
-    g_hash_table_insert(futex->listeners, listener, GUINT_TO_POINTER(false));
+    if (g_hash_table_contains(futex->listeners, listener)) {
+        futex_removeListener(futex, listener);
+    }
+    GList* link = _futex_insertUnwokenListener(futex, listener);
+    g_hash_table_insert(futex->listeners, listener, link);
 }
 
 void futex_removeListener(Futex* futex, StatusListener* listener) {
     MAGIC_ASSERT(futex);
+    GList* link = g_hash_table_lookup(futex->listeners, listener);
+    if (link) {
+        g_queue_delete_link(&futex->unwokenListeners, link);
+    }
     g_hash_table_remove(futex->listeners, listener); // Will unref the listener
 }
 
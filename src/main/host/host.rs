@@ -1,19 +1,20 @@
 use std::cell::{Cell, Ref, RefCell, RefMut, UnsafeCell};
-use std::collections::BTreeMap;
+use std::collections::{BTreeMap, HashSet};
 use std::ffi::{CStr, CString, OsString};
 use std::net::{Ipv4Addr, SocketAddrV4};
-use std::num::NonZeroU8;
+use std::num::{NonZeroU64, NonZeroU8};
 use std::ops::{Deref, DerefMut};
 use std::os::unix::prelude::OsStringExt;
 use std::path::{Path, PathBuf};
-use std::sync::{Arc, Mutex};
+use std::sync::Arc;
 
 use atomic_refcell::AtomicRefCell;
 use linux_api::signal::{siginfo_t, Signal};
 use log::{debug, trace};
 use logger::LogLevel;
 use once_cell::unsync::OnceCell;
-use rand::SeedableRng;
+use rand::{Rng, RngCore, SeedableRng};
+use rand_chacha::ChaCha8Rng;
 use rand_xoshiro::Xoshiro256PlusPlus;
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
 use shadow_shim_helper_rs::explicit_drop::ExplicitDrop;
@@ -29,25 +30,104 @@ use shadow_shmem::allocator::ShMemBlock;
 use shadow_tsc::Tsc;
 use vasi_sync::scmutex::SelfContainedMutexGuard;
 
+use crate::core::logger::host_log_sink::HostLogSink;
+use crate::core::logger::shadow_logger;
+use crate::core::profiler;
+use crate::core::resource_usage::{self, HostMemoryUsage};
 use crate::core::sim_config::PcapConfig;
-use crate::core::support::configuration::{ProcessFinalState, QDiscMode};
-use crate::core::work::event::{Event, EventData};
+use crate::core::support::configuration::{
+    EventQueueMode, ProcessFinalState, QDiscMode, TcpCongestionControl,
+};
+use crate::core::timeline;
+use crate::core::work::event::{Event, EventData, EventHandle};
 use crate::core::work::event_queue::EventQueue;
+use crate::core::work::packet_inbox::PacketInbox;
 use crate::core::work::task::TaskRef;
-use crate::core::worker::Worker;
+use crate::core::worker::{PacketRoute, Worker};
 use crate::cshadow;
 use crate::host::descriptor::socket::abstract_unix_ns::AbstractUnixNamespace;
+use crate::host::descriptor::socket::inet::udp::UdpSocket;
+use crate::host::descriptor::socket::inet::InetSocket;
+use crate::host::descriptor::socket::Socket;
+use crate::host::descriptor::{CompatFile, File};
+use crate::host::memory_manager::merging;
+use crate::host::network::flow_metrics::{FlowMetrics, FlowSample};
 use crate::host::network::interface::{FifoPacketPriority, NetworkInterface, PcapOptions};
 use crate::host::network::namespace::NetworkNamespace;
 use crate::host::process::Process;
+use crate::host::replay::PacketRecorder;
 use crate::host::thread::ThreadId;
+use crate::network::multicast;
 use crate::network::relay::{RateLimit, Relay};
 use crate::network::router::Router;
-use crate::network::PacketDevice;
+use crate::network::{PacketDevice, PacketRc};
 use crate::utility;
+use crate::utility::callback_queue::CallbackQueue;
+use crate::utility::numa;
 #[cfg(feature = "perf_timers")]
 use crate::utility::perf_timer::PerfTimer;
 
+/// The maximum number of empty event buffers to keep in each host's buffer pool.
+const MAX_POOLED_EVENT_BUFFERS: usize = 64;
+
+/// The number of entries in each host's packet route cache.
+const PACKET_ROUTE_CACHE_SIZE: usize = 64;
+
+/// Requests for at least this many random bytes are filled from the host's bulk random stream.
+const BULK_RANDOM_MIN_BYTES: usize = 256;
+
+/// Identifies one of a host's packet devices, so that the device for an address only needs to be
+/// looked up once. See [`Host::get_packet_device`].
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum PacketDeviceId {
+    Localhost,
+    Internet,
+    Router,
+}
+
+/// A borrowed packet device of a host. Calls to the device are dispatched statically, unlike
+/// through a `Ref<dyn PacketDevice>`.
+pub enum PacketDeviceRef<'a> {
+    Interface(Ref<'a, NetworkInterface>),
+    Router(Ref<'a, Router>),
+}
+
+impl PacketDevice for PacketDeviceRef<'_> {
+    fn get_address(&self) -> Ipv4Addr {
+        match self {
+            Self::Interface(x) => x.get_address(),
+            Self::Router(x) => x.get_address(),
+        }
+    }
+
+    fn pop(&self) -> Option<PacketRc> {
+        match self {
+            Self::Interface(x) => x.pop(),
+            Self::Router(x) => x.pop(),
+        }
+    }
+
+    fn push(&self, packet: PacketRc) {
+        match self {
+            Self::Interface(x) => x.push(packet),
+            Self::Router(x) => x.push(packet),
+        }
+    }
+}
+
+/// A managed process to start on a host. Hosts from the same host entry share one
+/// `ApplicationInfo` for each of the entry's processes.
+pub struct ApplicationInfo {
+    pub start_time: SimulationTime,
+    pub shutdown_time: Option<SimulationTime>,
+    pub shutdown_signal: nix::sys::signal::Signal,
+    pub plugin_name: CString,
+    pub plugin_path: CString,
+    pub envv: Vec<CString>,
+    pub argv: Vec<CString>,
+    pub expected_final_state: ProcessFinalState,
+}
+
 pub struct HostParameters {
     pub id: HostId,
     pub node_seed: u64,
@@ -62,12 +142,14 @@ pub struct HostParameters {
     pub cpu_frequency: u64,
     pub cpu_threshold: Option<SimulationTime>,
     pub cpu_precision: Option<SimulationTime>,
+    pub cpu_instruction_rate: Option<NonZeroU64>,
     pub heartbeat_interval: Option<SimulationTime>,
     pub heartbeat_log_level: LogLevel,
     pub heartbeat_log_info: cshadow::LogInfoFlags,
     pub log_level: LogLevel,
     pub pcap_config: Option<PcapConfig>,
     pub qdisc: QDiscMode,
+    pub event_queue: EventQueueMode,
     pub init_sock_recv_buf_size: u64,
     pub autotune_recv_buf: bool,
     pub init_sock_send_buf_size: u64,
@@ -77,14 +159,29 @@ pub struct HostParameters {
     pub max_unapplied_cpu_latency: SimulationTime,
     pub unblocked_syscall_latency: SimulationTime,
     pub unblocked_vdso_latency: SimulationTime,
-    pub strace_logging_options: Option<FmtOptions>,
+    pub strace_logging: Option<StraceOutput>,
     pub shim_log_level: LogLevel,
     pub use_new_tcp: bool,
+    pub use_memory_manager_huge_pages: bool,
+    pub use_memory_merging: bool,
+    pub tcp_congestion_control: TcpCongestionControl,
+    pub use_async_file_io: bool,
+    pub disk: DiskParameters,
+    pub use_native_file_io: bool,
+    pub flow_metrics_interval: Option<SimulationTime>,
+    /// Compact the host's state once it has had no events for this long. See [`Host::compact`].
+    pub compaction_idle_time: Option<SimulationTime>,
+    /// How long Shadow and the shim spin while waiting for each other's IPC messages (see
+    /// [`IPCData::set_max_spins`](shadow_shim_helper_rs::ipc::IPCData::set_max_spins)).
+    pub ipc_max_spins: u32,
+    pub use_continuous_token_refill: bool,
+    pub use_per_host_log_files: bool,
 }
 
 use super::cpu::Cpu;
+use super::disk::{Disk, DiskOp, DiskParameters};
 use super::process::ProcessId;
-use super::syscall::formatter::FmtOptions;
+use super::syscall::formatter::StraceOutput;
 
 /// Immutable information about the Host.
 #[derive(Debug, Clone)]
@@ -93,6 +190,8 @@ pub struct HostInfo {
     pub name: String,
     pub default_ip: Ipv4Addr,
     pub log_level: Option<log::LevelFilter>,
+    /// The host's own log file, if records shouldn't be written to stdout.
+    pub log_sink: Option<Arc<HostLogSink>>,
 }
 
 /// A simulated Host.
@@ -111,9 +210,34 @@ pub struct Host {
     // This makes the Host !Sync.
     root: Root,
 
-    event_queue: Arc<Mutex<EventQueue>>,
+    event_queue: RefCell<EventQueue>,
+
+    // Batches of packet events pushed by other hosts, which may be running on other threads. These
+    // are moved into the event queue by the thread running this host, so that neither the senders
+    // nor this host need to lock the event queue. The inbox also tracks the host's next event time
+    // so that idle hosts can be skipped without locking them.
+    packet_inbox: Arc<PacketInbox>,
+
+    // Empty event buffers that were received in the packet inbox, which are reused when sending
+    // events to other hosts.
+    event_buffers: RefCell<Vec<Vec<Event>>>,
+
+    // Records the packets that arrive from the internet, if this host is being recorded.
+    packet_recorder: RefCell<Option<PacketRecorder>>,
+
+    // The sockets of the host's traffic models, which are closed when the host shuts down.
+    traffic_sockets: RefCell<Vec<Arc<AtomicRefCell<UdpSocket>>>>,
+
+    // Set when the host's state has been compacted, and cleared when the host next runs an event.
+    compacted: Cell<bool>,
 
     random: RefCell<Xoshiro256PlusPlus>,
+    // a keystream for large random requests, seeded from `random` when it's first needed
+    bulk_random: RefCell<Option<ChaCha8Rng>>,
+
+    // A direct-mapped cache of the routes for packets sent from this host, indexed by the low bits
+    // of the destination IP address.
+    packet_routes: RefCell<[Option<PacketRoute>; PACKET_ROUTE_CACHE_SIZE]>,
 
     // The upstream router that will queue packets until we can receive them.
     // This only applies to the internet interface; the localhost interface
@@ -130,6 +254,12 @@ pub struct Host {
     // a statistics tracker for in/out bytes, CPU, memory, etc.
     tracker: RefCell<Option<SyncSendPointer<cshadow::Tracker>>>,
 
+    // per-interval samples of the host's TCP connections, if enabled
+    flow_metrics: Option<FlowMetrics>,
+
+    // the host's own log file, if enabled
+    log_sink: Option<Arc<HostLogSink>>,
+
     // map address to futex objects
     futex_table: RefCell<SyncSendPointer<cshadow::FutexTable>>,
 
@@ -140,6 +270,8 @@ pub struct Host {
 
     cpu: RefCell<Cpu>,
 
+    disk: RefCell<Disk>,
+
     net_ns: NetworkNamespace,
 
     // Store as a CString so that we can return a borrowed pointer to C code
@@ -161,6 +293,12 @@ pub struct Host {
     // track the order in which the application sent us application data
     packet_priority_counter: Cell<FifoPacketPriority>,
 
+    // The CPU core that this host's managed threads should be pinned to, and a core that the host
+    // has started running on but that its threads haven't been moved to yet. See
+    // `update_cpu_affinity()`.
+    cpu_affinity: Cell<Option<u32>>,
+    pending_cpu_affinity: Cell<Option<u32>>,
+
     // Owned pointers to processes.
     processes: RefCell<BTreeMap<ProcessId, RootedRc<RootedRefCell<Process>>>>,
 
@@ -269,6 +407,22 @@ impl Host {
         let pcap_options = params.pcap_config.as_ref().map(|x| PcapOptions {
             path: data_dir_path.clone(),
             capture_size_bytes: x.capture_size.try_into().unwrap(),
+            filter: x.filter.clone(),
+        });
+
+        let log_sink = params
+            .use_per_host_log_files
+            .then(|| {
+                HostLogSink::new(&data_dir_path, shadow_logger::is_binary_format())
+                    .map_err(|e| log::warn!("Could not create the host's log file: {e}"))
+                    .ok()
+            })
+            .flatten();
+
+        let flow_metrics = params.flow_metrics_interval.and_then(|interval| {
+            FlowMetrics::new(&data_dir_path, interval)
+                .map_err(|e| log::warn!("Could not create the flow metrics file: {e}"))
+                .ok()
         });
 
         let net_ns = unsafe {
@@ -286,15 +440,20 @@ impl Host {
         // Use `Ipv4Addr::UNSPECIFIED` for the router to encode this for our
         // routing table logic inside of `Host::get_packet_device()`.
         let router = Router::new(Ipv4Addr::UNSPECIFIED);
-        let relay_inet_out = Relay::new(
-            RateLimit::BytesPerSecond(params.requested_bw_up_bits / 8),
+        let rate_limit = |bits_per_second: u64| Self::rate_limit(&params, bits_per_second);
+        let relay = |rate: RateLimit, src_dev_address: Ipv4Addr| {
+            let src_dev = Self::packet_device_id_for(src_dev_address, net_ns.default_ip);
+            Relay::new(rate, src_dev_address, src_dev)
+        };
+        let relay_inet_out = relay(
+            rate_limit(params.requested_bw_up_bits),
             net_ns.internet.borrow().get_address(),
         );
-        let relay_inet_in = Relay::new(
-            RateLimit::BytesPerSecond(params.requested_bw_down_bits / 8),
+        let relay_inet_in = relay(
+            rate_limit(params.requested_bw_down_bits),
             router.get_address(),
         );
-        let relay_loopback = Relay::new(
+        let relay_loopback = relay(
             RateLimit::Unlimited,
             net_ns.localhost.borrow().get_address(),
         );
@@ -304,15 +463,25 @@ impl Host {
         let res = Self {
             info: OnceCell::new(),
             root,
-            event_queue: Arc::new(Mutex::new(EventQueue::new())),
+            event_queue: RefCell::new(EventQueue::new_with_mode(params.event_queue)),
+            packet_inbox: Arc::new(PacketInbox::new()),
+            event_buffers: RefCell::new(Vec::new()),
+            packet_recorder: RefCell::new(None),
+            traffic_sockets: RefCell::new(Vec::new()),
+            compacted: Cell::new(false),
+            disk: RefCell::new(Disk::new(params.disk.clone())),
             params,
             router: RefCell::new(router),
             relay_inet_out: Arc::new(relay_inet_out),
             relay_inet_in: Arc::new(relay_inet_in),
             relay_loopback: Arc::new(relay_loopback),
             tracker: RefCell::new(None),
+            flow_metrics,
+            log_sink,
             futex_table: RefCell::new(unsafe { SyncSendPointer::new(cshadow::futextable_new()) }),
             random,
+            bulk_random: RefCell::new(None),
+            packet_routes: RefCell::new([None; PACKET_ROUTE_CACHE_SIZE]),
             shim_shmem,
             shim_shmem_lock: RefCell::new(None),
             cpu,
@@ -323,6 +492,8 @@ impl Host {
             event_id_counter,
             packet_id_counter,
             packet_priority_counter,
+            cpu_affinity: Cell::new(None),
+            pending_cpu_affinity: Cell::new(None),
             determinism_sequence_counter,
             tsc,
             processes: RefCell::new(BTreeMap::new()),
@@ -378,38 +549,25 @@ impl Host {
         &self.data_dir_path
     }
 
-    pub fn add_application(
-        &self,
-        start_time: SimulationTime,
-        shutdown_time: Option<SimulationTime>,
-        shutdown_signal: nix::sys::signal::Signal,
-        plugin_name: CString,
-        plugin_path: CString,
-        envv: Vec<CString>,
-        argv: Vec<CString>,
-        pause_for_debugging: bool,
-        expected_final_state: ProcessFinalState,
-    ) {
-        debug_assert!(shutdown_time.is_none() || shutdown_time.unwrap() > start_time);
+    /// Schedule the application to be started at its start time. The application's arguments and
+    /// environment are only copied when the process is spawned, so hosts can share a single
+    /// `ApplicationInfo`.
+    pub fn add_application(&self, app: Arc<ApplicationInfo>, pause_for_debugging: bool) {
+        debug_assert!(app.shutdown_time.is_none() || app.shutdown_time.unwrap() > app.start_time);
+
+        let start_time = app.start_time;
 
         // Schedule spawning the process.
         let task = TaskRef::new(move |host| {
-            // We can't move out of these captured variables, since TaskRef takes
-            // a Fn, not a FnOnce.
-            // TODO: Add support for FnOnce?
-            let envv = envv.clone();
-            let argv = argv.clone();
-            let plugin_name = plugin_name.clone();
-
             let process = Process::spawn(
                 host,
-                plugin_name,
-                &plugin_path,
-                envv,
-                argv,
+                app.plugin_name.clone(),
+                &app.plugin_path,
+                &app.envv,
+                &app.argv,
                 pause_for_debugging,
-                host.params.strace_logging_options,
-                expected_final_state,
+                host.params.strace_logging,
+                app.expected_final_state,
             );
             let (process_id, thread_id) = {
                 let process = process.borrow(host.root());
@@ -417,7 +575,8 @@ impl Host {
             };
             host.processes.borrow_mut().insert(process_id, process);
 
-            if let Some(shutdown_time) = shutdown_time {
+            if let Some(shutdown_time) = app.shutdown_time {
+                let shutdown_signal = app.shutdown_signal;
                 let task = TaskRef::new(move |host| {
                     let Some(process) = host.process_borrow(process_id) else {
                         debug!("Can't send shutdown signal to process {process_id}; it no longer exists");
@@ -437,11 +596,30 @@ impl Host {
                 );
             }
 
-            host.resume(process_id, thread_id);
+            // Run the process in a separate task, so that other processes that
+            // start at the same time are spawned before we wait for this one to
+            // finish loading.
+            let task = TaskRef::new(move |host| {
+                host.resume(process_id, thread_id);
+            });
+            host.schedule_task_with_delay(task, SimulationTime::ZERO);
         });
         self.schedule_task_at_emulated_time(task, EmulatedTime::SIMULATION_START + start_time);
     }
 
+    /// Send `signal` to each of the host's processes, as if by `kill` from outside of the simulation.
+    pub fn signal_all_processes(&self, signal: Signal) {
+        let siginfo_t = siginfo_t::new_for_kill(signal, 1, 0);
+        // like the shutdown signal, each process is only borrowed while it's being signalled
+        let processes: Vec<ProcessId> = self.processes.borrow().keys().copied().collect();
+        for process_id in processes {
+            let Some(process) = self.process_borrow(process_id) else {
+                continue;
+            };
+            process.borrow(self.root()).signal(self, None, &siginfo_t);
+        }
+    }
+
     pub fn add_and_schedule_forked_process(
         &self,
         host: &Host,
@@ -559,6 +737,14 @@ impl Host {
         self.processes.borrow()
     }
 
+    /// Add the syscall counts of the host's live threads to the worker's syscall counts, which
+    /// otherwise only happens when each thread exits.
+    pub fn flush_syscall_counts(&self) {
+        for process in self.processes_borrow().values() {
+            process.borrow(self.root()).flush_syscall_counts(self);
+        }
+    }
+
     pub fn cpu_borrow(&self) -> impl Deref<Target = Cpu> + '_ {
         self.cpu.borrow()
     }
@@ -578,6 +764,7 @@ impl Host {
                 name: self.params.hostname.to_str().unwrap().to_owned(),
                 default_ip: self.default_ip(),
                 log_level: self.log_level(),
+                log_sink: self.log_sink.clone(),
             })
         })
     }
@@ -591,9 +778,7 @@ impl Host {
     }
 
     pub fn default_ip(&self) -> Ipv4Addr {
-        let addr = self.net_ns.default_address.ptr();
-        let addr = unsafe { cshadow::address_toNetworkIP(addr) };
-        u32::from_be(addr).into()
+        self.net_ns.default_ip
     }
 
     pub fn abstract_unix_namespace(
@@ -674,6 +859,45 @@ impl Host {
         self.random.borrow_mut()
     }
 
+    /// Fill `buf` with pseudo-random bytes for a managed process, such as for `getrandom` or reads
+    /// of `/dev/urandom`. Large requests are filled from a ChaCha8 keystream, which generates
+    /// several blocks at a time and is much faster than [`Self::random_mut`] for bulk data. The
+    /// keystream is seeded from the host's RNG the first time that it's needed, so the bytes are
+    /// still determined by the host's seed.
+    pub fn fill_random_bytes(&self, buf: &mut [u8]) {
+        if buf.len() < BULK_RANDOM_MIN_BYTES {
+            self.random_mut().fill_bytes(buf);
+            return;
+        }
+
+        let mut bulk_random = self.bulk_random.borrow_mut();
+        let bulk_random =
+            bulk_random.get_or_insert_with(|| ChaCha8Rng::from_seed(self.random_mut().gen()));
+        bulk_random.fill_bytes(buf);
+    }
+
+    /// The route for packets sent from this host to `dst_ip`. If it's not in this host's route
+    /// cache, or was cached in an older routing `generation`, `lookup` is called to find it.
+    pub fn packet_route(
+        &self,
+        dst_ip: Ipv4Addr,
+        generation: u64,
+        lookup: impl FnOnce() -> PacketRoute,
+    ) -> PacketRoute {
+        let index = u32::from(dst_ip) as usize % PACKET_ROUTE_CACHE_SIZE;
+
+        if let Some(route) = self.packet_routes.borrow()[index] {
+            if route.dst_ip == dst_ip && route.generation == generation {
+                return route;
+            }
+        }
+
+        let route = lookup();
+        debug_assert_eq!(route.dst_ip, dst_ip);
+        self.packet_routes.borrow_mut()[index] = Some(route);
+        route
+    }
+
     pub fn get_new_event_id(&self) -> u64 {
         let res = self.event_id_counter.get();
         self.event_id_counter.set(res + 1);
@@ -715,27 +939,95 @@ impl Host {
         self.execution_timer.borrow_mut().stop();
     }
 
+    fn rate_limit(params: &HostParameters, bits_per_second: u64) -> RateLimit {
+        if params.use_continuous_token_refill {
+            RateLimit::BytesPerSecondContinuous(bits_per_second / 8)
+        } else {
+            RateLimit::BytesPerSecond(bits_per_second / 8)
+        }
+    }
+
+    /// Change the rate limits of the host's internet interface, in bits per second. The
+    /// configured bandwidths that are reported to the TCP autotuning aren't changed.
+    pub fn set_bandwidth(&self, up_bits: Option<u64>, down_bits: Option<u64>) {
+        if let Some(bits) = up_bits {
+            self.relay_inet_out
+                .set_rate(Self::rate_limit(&self.params, bits));
+        }
+        if let Some(bits) = down_bits {
+            self.relay_inet_in
+                .set_rate(Self::rate_limit(&self.params, bits));
+        }
+    }
+
     pub fn schedule_task_at_emulated_time(&self, task: TaskRef, t: EmulatedTime) -> bool {
         let event = Event::new_local(task, t, self);
         self.push_local_event(event)
     }
 
+    /// Like [`Host::schedule_task_at_emulated_time()`], but returns a handle that can be used to
+    /// cancel the task with [`Host::cancel_event()`], or `None` if the task wasn't scheduled.
+    pub fn schedule_cancellable_task_at_emulated_time(
+        &self,
+        task: TaskRef,
+        t: EmulatedTime,
+    ) -> Option<EventHandle> {
+        let event = Event::new_cancellable_local(task, t, self);
+        let handle = event.handle();
+        self.push_local_event(event).then_some(handle).flatten()
+    }
+
+    /// Cancel an event so that it doesn't run. Does nothing if the event has already run.
+    pub fn cancel_event(&self, handle: EventHandle) {
+        self.event_queue.borrow_mut().cancel(handle);
+    }
+
     pub fn schedule_task_with_delay(&self, task: TaskRef, t: SimulationTime) -> bool {
         self.schedule_task_at_emulated_time(task, Worker::current_time().unwrap() + t)
     }
 
-    pub fn event_queue(&self) -> &Arc<Mutex<EventQueue>> {
-        &self.event_queue
+    /// The inbox for packet events sent to this host from other hosts. Events pushed to the inbox
+    /// are added to the host's event queue the next time the host is executed or its next event
+    /// time is checked.
+    pub fn packet_inbox(&self) -> &Arc<PacketInbox> {
+        &self.packet_inbox
     }
 
     pub fn push_local_event(&self, event: Event) -> bool {
         if event.time() >= self.params.sim_end_time {
             return false;
         }
-        self.event_queue.lock().unwrap().push(event);
+        self.packet_inbox.lower_next_event_time(event.time());
+        self.event_queue.borrow_mut().push(event);
         true
     }
 
+    /// Move any events from the packet inbox into the event queue.
+    fn drain_packet_inbox(&self, event_queue: &mut EventQueue) {
+        while let Some(mut events) = self.packet_inbox.pop() {
+            for event in events.drain(..) {
+                event_queue.push(event);
+            }
+            self.recycle_event_buffer(events);
+        }
+    }
+
+    /// Get an empty buffer for sending events to other hosts.
+    pub fn take_event_buffer(&self) -> Vec<Event> {
+        let buffer = self.event_buffers.borrow_mut().pop();
+        Worker::count_event_buffer(buffer.is_some());
+        buffer.unwrap_or_default()
+    }
+
+    /// Return an empty event buffer to this host's buffer pool.
+    fn recycle_event_buffer(&self, buffer: Vec<Event>) {
+        debug_assert!(buffer.is_empty());
+        let mut buffers = self.event_buffers.borrow_mut();
+        if buffers.len() < MAX_POOLED_EVENT_BUFFERS {
+            buffers.push(buffer);
+        }
+    }
+
     pub fn boot(&self) {
         // must be done after the default IP exists so tracker_heartbeat works
         if let Some(heartbeat_interval) = self.params.heartbeat_interval {
@@ -755,17 +1047,78 @@ impl Host {
         }
     }
 
+    /// Move the host's fixed-size state (the `Host` itself, its shared memory, and its relays) to
+    /// the NUMA node `node`. Memory that the host allocates later is allocated by the thread that
+    /// runs the host, so it's usually already on that thread's node.
+    pub fn move_to_numa_node(&self, node: u32) -> numa::PageMoveStats {
+        fn range<T>(x: *const T) -> (*const u8, usize) {
+            (x.cast(), std::mem::size_of::<T>())
+        }
+
+        let shmem: &HostShmem = self.shim_shmem();
+        let ranges = [
+            range(self as *const Self),
+            range(shmem as *const HostShmem),
+            range(Arc::as_ptr(&self.relay_inet_out)),
+            range(Arc::as_ptr(&self.relay_inet_in)),
+            range(Arc::as_ptr(&self.relay_loopback)),
+        ];
+        numa::move_to_node(&ranges, node)
+    }
+
+    /// Record the packets that arrive at this host from now on into its data directory. See
+    /// [`crate::host::replay`].
+    pub fn start_recording(&self) -> std::io::Result<()> {
+        let recorder = PacketRecorder::new(self.data_dir_path(), self.name())?;
+        *self.packet_recorder.borrow_mut() = Some(recorder);
+        Ok(())
+    }
+
+    /// Start an operation on the host's simulated disk, and return the time at which it
+    /// completes. See [`crate::host::disk`].
+    pub fn start_disk_op(&self, op: DiskOp, nbytes: u64) -> EmulatedTime {
+        let now = Worker::current_time().unwrap();
+        self.disk
+            .borrow_mut()
+            .start(op, nbytes, now, &mut *self.random_mut())
+    }
+
+    /// Keep a traffic model's socket open until the host shuts down. See [`crate::host::traffic`].
+    pub fn add_traffic_socket(&self, socket: Arc<AtomicRefCell<UdpSocket>>) {
+        self.traffic_sockets.borrow_mut().push(socket);
+    }
+
     /// Shut down the host. This should be called while `Worker` has the active host set.
     pub fn shutdown(&self) {
         self.continue_execution_timer();
 
         debug!("shutting down host {}", self.name());
 
+        // the sockets must be disassociated from the network namespace while the host is active
+        for socket in self.traffic_sockets.take() {
+            CallbackQueue::queue_and_run(|cb_queue| socket.borrow_mut().close(cb_queue)).unwrap();
+        }
+
         // the network namespace object needs to be cleaned up before it's dropped
         Worker::with_dns(|dns| self.net_ns.cleanup(dns));
 
         assert!(self.processes.borrow().is_empty());
 
+        self.upstream_router_borrow_mut()
+            .log_queue_stats(self.name());
+
+        if let Some(recorder) = self.packet_recorder.borrow_mut().as_mut() {
+            recorder.flush();
+        }
+
+        let lock_stats = self.shim_shmem().protected().contention_stats();
+        debug!(
+            "host '{}' shared memory lock was contended {} times, and slept {} times",
+            self.name(),
+            lock_stats.contended,
+            lock_stats.sleeps
+        );
+
         self.stop_execution_timer();
         #[cfg(feature = "perf_timers")]
         debug!(
@@ -773,9 +1126,24 @@ impl Host {
             self.name(),
             self.execution_timer.borrow().elapsed()
         );
+
+        // anything logged after this goes to stdout
+        if let Some(sink) = &self.log_sink {
+            sink.close();
+        }
     }
 
     pub fn free_all_applications(&self) {
+        self.stop_all_applications(true);
+    }
+
+    /// Like [`Self::free_all_applications`], but leaks the Shadow-side state of the processes
+    /// instead of dropping it, for when Shadow is about to exit anyway.
+    pub fn stop_all_applications_without_free(&self) {
+        self.stop_all_applications(false);
+    }
+
+    fn stop_all_applications(&self, free: bool) {
         trace!("start freeing applications for host '{}'", self.name());
         let processes = std::mem::take(&mut *self.processes.borrow_mut());
         for (_id, processrc) in processes.into_iter() {
@@ -789,23 +1157,48 @@ impl Host {
                 process.set_parent_id(ProcessId::INIT);
             }
 
-            processrc.explicit_drop(self.root());
+            if free {
+                processrc.explicit_drop(self.root());
+            } else {
+                std::mem::forget(processrc);
+            }
         }
         trace!("done freeing application for host '{}'", self.name());
     }
 
+    /// Send SIGKILL to all of the host's processes without waiting for them to exit, so that the
+    /// OS can tear them down while other processes are being killed. They must still be stopped
+    /// with [`Self::free_all_applications`].
+    pub fn kill_all_applications(&self) {
+        for processrc in self.processes.borrow().values() {
+            processrc.borrow(self.root()).kill_native();
+        }
+    }
+
     pub fn execute(&self, until: EmulatedTime) {
+        let _profile = profiler::enter_host(self.id());
+        let _span = timeline::span("host", Some(self.id()));
+
+        self.update_cpu_affinity();
+
+        // packets sent to us during this round will be for a later round, so we only need to check
+        // the inbox once
+        self.drain_packet_inbox(&mut self.event_queue.borrow_mut());
+
+        let mut executed_events = 0;
+
+        // without a threshold the CPU never delays events, so we don't need to check it per event
+        let cpu_delay_enabled = self.cpu.borrow().delay_enabled();
+
+        // time the whole round rather than each event, which takes two clock reads per round
+        self.continue_execution_timer();
+
         loop {
-            let mut event = {
-                let mut event_queue = self.event_queue.lock().unwrap();
-                match event_queue.next_event_time() {
-                    Some(t) if t < until => {}
-                    _ => break,
-                };
-                event_queue.pop().unwrap()
+            let Some(mut event) = self.event_queue.borrow_mut().pop_before(until) else {
+                break;
             };
 
-            {
+            if cpu_delay_enabled {
                 let mut cpu = self.cpu.borrow_mut();
                 cpu.update_time(event.time());
                 let cpu_delay = cpu.delay();
@@ -837,22 +1230,176 @@ impl Host {
 
             // run the event
             Worker::set_current_time(event.time());
-            self.continue_execution_timer();
             match event.data() {
                 EventData::Packet(data) => {
-                    self.upstream_router_borrow_mut()
-                        .route_incoming_packet(data.into());
-                    self.notify_router_has_packets();
+                    let _profile = profiler::enter_phase(profiler::Phase::Packet);
+                    let (src_host_id, src_host_event_id) = data.source();
+                    timeline::packet_received(src_host_id, src_host_event_id);
+                    let packet = PacketRc::from(data);
+                    if let Some(recorder) = self.packet_recorder.borrow_mut().as_mut() {
+                        recorder.record(
+                            &packet,
+                            Worker::current_time().unwrap(),
+                            (src_host_id, src_host_event_id),
+                        );
+                    }
+                    self.route_incoming_packet(packet);
                 }
                 EventData::Local(data) => TaskRef::from(data).execute(self),
             }
-            self.stop_execution_timer();
-            Worker::clear_current_time();
+            executed_events += 1;
+        }
+
+        // nothing between events uses the current time, so it's only cleared after the last one
+        Worker::clear_current_time();
+        self.stop_execution_timer();
+
+        Worker::count_executed_events(executed_events);
+
+        // deliver the packets we sent to their destination hosts
+        Worker::flush_outgoing_packets(self);
+
+        if executed_events > 0 {
+            self.compacted.set(false);
+        }
+        if let Some(idle_time) = self.params.compaction_idle_time {
+            if !self.compacted.get() {
+                let next_event_time = self.event_queue.borrow_mut().next_event_time();
+                if should_compact(next_event_time, until, idle_time) {
+                    self.compact();
+                }
+            }
+        }
+    }
+
+    /// Release the memory that the host's event queue, router queue, and event buffer pool have
+    /// allocated but aren't using. This is done once a host expects to be idle for a while, so
+    /// that simulations with many mostly-idle hosts don't keep the capacity from each host's
+    /// busiest moment. Everything grows again as needed when the host is next active.
+    fn compact(&self) {
+        self.event_queue.borrow_mut().shrink_to_fit();
+        let mut event_buffers = self.event_buffers.borrow_mut();
+        event_buffers.clear();
+        event_buffers.shrink_to_fit();
+        self.router.borrow().shrink_to_fit();
+        self.compacted.set(true);
+        trace!("Compacted the state of idle host '{}'", self.name());
+    }
+
+    /// The CPU core that this host's managed threads should be pinned to, or `None` if CPU pinning
+    /// is disabled. Threads are moved to this core lazily when they're next resumed.
+    pub fn cpu_affinity(&self) -> Option<u32> {
+        self.cpu_affinity
+            .get()
+            .or_else(crate::core::scheduler::core_affinity)
+    }
+
+    /// Choose the core for the host's managed threads at the start of a round. A host that was
+    /// moved to a different worker core only moves its threads once it runs on the new core for a
+    /// second round in a row, so a host that's briefly stolen by another worker doesn't cause a
+    /// `sched_setaffinity()` for each of its threads.
+    fn update_cpu_affinity(&self) {
+        let Some(core) = crate::core::scheduler::core_affinity() else {
+            return;
+        };
+
+        match self.cpu_affinity.get() {
+            None => self.cpu_affinity.set(Some(core)),
+            Some(x) if x == core => self.pending_cpu_affinity.set(None),
+            Some(_) if self.pending_cpu_affinity.get() == Some(core) => {
+                self.cpu_affinity.set(Some(core));
+                self.pending_cpu_affinity.set(None);
+                Worker::count_host_affinity_change(false);
+            }
+            Some(_) => {
+                self.pending_cpu_affinity.set(Some(core));
+                Worker::count_host_affinity_change(true);
+            }
         }
     }
 
     pub fn next_event_time(&self) -> Option<EmulatedTime> {
-        self.event_queue.lock().unwrap().next_event_time()
+        // reset the cached time before draining the inbox, so that events pushed by other threads
+        // while we're looking at the event queue are never missed
+        self.packet_inbox.reset_next_event_time();
+
+        let mut event_queue = self.event_queue.borrow_mut();
+        self.drain_packet_inbox(&mut event_queue);
+        let next_event_time = event_queue.next_event_time();
+
+        if let Some(time) = next_event_time {
+            self.packet_inbox.lower_next_event_time(time);
+        }
+        next_event_time
+    }
+
+    /// A lower bound on the host's next event time which can be checked without locking the host,
+    /// or `None` if the host has no events. See [`PacketInbox::next_event_time`].
+    pub fn cached_next_event_time(&self) -> Option<EmulatedTime> {
+        self.packet_inbox.next_event_time()
+    }
+
+    /// Sample the memory used by this host's processes and some of its larger Shadow-side
+    /// structures.
+    pub fn memory_usage(&self) -> HostMemoryUsage {
+        let mut usage = HostMemoryUsage {
+            pending_events: self.event_queue.borrow().len().try_into().unwrap(),
+            ..Default::default()
+        };
+
+        // sockets can be shared between processes, so only count each once
+        let mut seen_sockets = HashSet::new();
+
+        for process in self.processes.borrow().values() {
+            let process = process.borrow(self.root());
+            if !process.is_running() {
+                continue;
+            }
+
+            usage.processes += 1;
+            match resource_usage::statm_resident_bytes(process.native_pid()) {
+                Ok(rss) => usage.plugin_rss += rss,
+                Err(e) => debug!(
+                    "Unable to read the memory usage of {:?}: {e}",
+                    &*process.name()
+                ),
+            }
+            if self.params.use_memory_merging {
+                match merging::merged_bytes(process.native_pid()) {
+                    Ok(bytes) => usage.plugin_merged += bytes,
+                    Err(e) => debug!(
+                        "Unable to read the merged pages of {:?}: {e}",
+                        &*process.name()
+                    ),
+                }
+            }
+
+            let Some(thread) = process.first_live_thread_borrow(self.root()) else {
+                continue;
+            };
+            let thread = thread.borrow(self.root());
+            let desc_table = thread.descriptor_table_borrow(self);
+
+            for desc in desc_table.iter() {
+                let CompatFile::New(file) = desc.file() else {
+                    continue;
+                };
+                let File::Socket(Socket::Inet(InetSocket::LegacyTcp(socket))) = file.inner_file()
+                else {
+                    continue;
+                };
+                if !seen_sockets.insert(file.inner_file().canonical_handle()) {
+                    continue;
+                }
+
+                let (input, output) = socket.borrow().buffered_bytes();
+                usage.tcp_sockets += 1;
+                usage.tcp_input_bytes += u64::try_from(input).unwrap();
+                usage.tcp_output_bytes += u64::try_from(output).unwrap();
+            }
+        }
+
+        usage
     }
 
     /// The unprotected part of the Host's shared memory.
@@ -876,6 +1423,15 @@ impl Host {
         false
     }
 
+    /// The total number of threads in the host's processes.
+    pub fn num_threads(&self) -> usize {
+        self.processes
+            .borrow()
+            .values()
+            .map(|process| process.borrow(self.root()).num_threads())
+            .sum()
+    }
+
     /// Locks the Host's shared memory, caching the lock internally.
     ///
     /// Dropping the Host before calling [`Host::unlock_shmem`] will panic.
@@ -949,16 +1505,76 @@ impl Host {
     /// that will receive and process packets with a given destination address.
     /// In the latter case, if the packet destination is not on this host, we
     /// return the router to route it to the correct host.
-    pub fn get_packet_device(&self, address: Ipv4Addr) -> Ref<dyn PacketDevice> {
+    pub fn get_packet_device(&self, address: Ipv4Addr) -> PacketDeviceRef {
+        self.packet_device(self.packet_device_id(address))
+    }
+
+    /// Get the id of the packet device that handles packets for the given address. See
+    /// [`Self::get_packet_device`].
+    pub fn packet_device_id(&self, address: Ipv4Addr) -> PacketDeviceId {
+        Self::packet_device_id_for(address, self.net_ns.default_ip)
+    }
+
+    fn packet_device_id_for(address: Ipv4Addr, default_ip: Ipv4Addr) -> PacketDeviceId {
         if address == Ipv4Addr::LOCALHOST {
-            self.net_ns.localhost.borrow()
-        } else if address == self.default_ip() {
-            self.net_ns.internet.borrow()
+            PacketDeviceId::Localhost
+        } else if address == default_ip {
+            PacketDeviceId::Internet
         } else {
-            self.router.borrow()
+            PacketDeviceId::Router
         }
     }
 
+    /// Get the packet device that a relay from the device `src` should forward a packet with the
+    /// given destination address to. This is the same as [`Self::get_packet_device`], except that
+    /// multicast and broadcast packets have no single destination host: those that arrive from the
+    /// router are for this host, and the host's own are sent to the router.
+    pub fn get_next_packet_device(
+        &self,
+        src: PacketDeviceId,
+        address: Ipv4Addr,
+    ) -> PacketDeviceRef {
+        if !multicast::is_fan_out_address(address) {
+            return self.get_packet_device(address);
+        }
+        match src {
+            PacketDeviceId::Router => self.packet_device(PacketDeviceId::Internet),
+            _ => self.packet_device(PacketDeviceId::Router),
+        }
+    }
+
+    /// Get a packet device from an id returned by [`Self::packet_device_id`].
+    pub fn packet_device(&self, id: PacketDeviceId) -> PacketDeviceRef {
+        match id {
+            PacketDeviceId::Localhost => PacketDeviceRef::Interface(self.net_ns.localhost.borrow()),
+            PacketDeviceId::Internet => PacketDeviceRef::Interface(self.net_ns.internet.borrow()),
+            PacketDeviceId::Router => PacketDeviceRef::Router(self.router.borrow()),
+        }
+    }
+
+    /// Deliver a packet that arrived from the simulated network. If the router's
+    /// queue is empty and the download relay can forward the packet right away,
+    /// it's handed straight to the network interface instead of going through
+    /// the router's CoDel queue and a relay forwarding task.
+    fn route_incoming_packet(&self, packet: PacketRc) {
+        let packet = if self.upstream_router_borrow_mut().has_inbound_packets() {
+            packet
+        } else {
+            let res = self.relay_inet_in.try_forward_now(self, packet, |packet| {
+                self.upstream_router_borrow_mut()
+                    .bypass_incoming_packet(packet)
+            });
+            match res {
+                Ok(()) => return,
+                Err(packet) => packet,
+            }
+        };
+
+        self.upstream_router_borrow_mut()
+            .route_incoming_packet(packet);
+        self.notify_router_has_packets();
+    }
+
     /// Call to trigger the forwarding of packets from the router to the network
     /// interface.
     pub fn notify_router_has_packets(&self) {
@@ -1023,6 +1639,19 @@ impl Drop for Host {
     }
 }
 
+/// Whether a host that has run all of its events before `until` should be compacted: it's
+/// compacted if its next event is at least `idle_time` after `until`, or if it has no events at
+/// all. This looks ahead at the time until the host's next event rather than back at its last
+/// event, so a host is compacted as soon as it goes idle for a long enough period, and never if
+/// it only has short gaps between events.
+fn should_compact(
+    next_event_time: Option<EmulatedTime>,
+    until: EmulatedTime,
+    idle_time: SimulationTime,
+) -> bool {
+    next_event_time.map_or(true, |t| t >= until.saturating_add(idle_time))
+}
+
 mod export {
     use std::{
         ops::{Deref, DerefMut},
@@ -1119,6 +1748,113 @@ mod export {
         hostrc.params.autotune_send_buf
     }
 
+    #[no_mangle]
+    pub unsafe extern "C" fn host_getTCPCongestionControl(hostrc: *const Host) -> *const c_char {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        match hostrc.params.tcp_congestion_control {
+            TcpCongestionControl::Reno => unsafe { cshadow::TCP_CONG_RENO_NAME },
+            TcpCongestionControl::Cubic => unsafe { cshadow::TCP_CONG_CUBIC_NAME },
+        }
+    }
+
+    /// Returns true if reads and writes of the host's OS-backed files should run on the file I/O
+    /// pool, or are delayed by a simulated disk model.
+    #[no_mangle]
+    pub unsafe extern "C" fn host_usesFileIOModel(hostrc: *const Host) -> bool {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        hostrc.params.use_async_file_io || hostrc.params.disk.is_enabled()
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C" fn host_useAsyncFileIO(hostrc: *const Host) -> bool {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        hostrc.params.use_async_file_io
+    }
+
+    /// Returns true if regular files in the host's data directory should also be opened natively
+    /// in the managed process. This is never true if the host uses a file I/O model, since the
+    /// model needs Shadow to handle each read and write.
+    #[no_mangle]
+    pub unsafe extern "C" fn host_useNativeFileIO(hostrc: *const Host) -> bool {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        hostrc.params.use_native_file_io && !unsafe { host_usesFileIOModel(hostrc) }
+    }
+
+    /// Start reading or writing `nbytes` of an OS-backed file on the host's simulated disk, and
+    /// return the time at which the operation completes.
+    #[no_mangle]
+    pub unsafe extern "C" fn host_startFileIO(
+        hostrc: *const Host,
+        nbytes: u64,
+        is_write: bool,
+    ) -> CEmulatedTime {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        let op = if is_write {
+            DiskOp::Write
+        } else {
+            DiskOp::Read
+        };
+        EmulatedTime::to_c_emutime(Some(hostrc.start_disk_op(op, nbytes)))
+    }
+
+    /// Start syncing an OS-backed file on the host's simulated disk, and return the time at which
+    /// the sync completes.
+    #[no_mangle]
+    pub unsafe extern "C" fn host_startFileSync(hostrc: *const Host) -> CEmulatedTime {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        EmulatedTime::to_c_emutime(Some(hostrc.start_disk_op(DiskOp::Sync, 0)))
+    }
+
+    /// The length of the intervals that TCP sockets should sum their flow metrics over, or 0 if
+    /// flow metrics are disabled.
+    #[no_mangle]
+    pub unsafe extern "C" fn host_getFlowMetricsInterval(hostrc: *const Host) -> CSimulationTime {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        match &hostrc.flow_metrics {
+            Some(metrics) => SimulationTime::to_c_simtime(Some(metrics.interval())),
+            None => 0,
+        }
+    }
+
+    /// Record the flow metrics of a TCP socket over the interval starting at `interval_start`.
+    /// Addresses and ports are in network byte order.
+    #[no_mangle]
+    pub unsafe extern "C" fn host_recordFlowMetrics(
+        hostrc: *const Host,
+        interval_start: CSimulationTime,
+        local_ip: in_addr_t,
+        local_port: in_port_t,
+        peer_ip: in_addr_t,
+        peer_port: in_port_t,
+        bytes_sent: u64,
+        bytes_received: u64,
+        retransmits: u64,
+        cwnd: u32,
+        srtt_ms: u32,
+        send_queue_bytes: u64,
+        recv_queue_bytes: u64,
+    ) {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        let Some(metrics) = &hostrc.flow_metrics else {
+            return;
+        };
+        let addr = |ip: in_addr_t, port: in_port_t| {
+            SocketAddrV4::new(u32::from_be(ip).into(), u16::from_be(port))
+        };
+        metrics.record(&FlowSample {
+            interval_start: SimulationTime::from_c_simtime(interval_start).unwrap(),
+            local: addr(local_ip, local_port),
+            peer: addr(peer_ip, peer_port),
+            bytes_sent,
+            bytes_received,
+            retransmits,
+            cwnd,
+            srtt_ms,
+            send_queue_bytes,
+            recv_queue_bytes,
+        });
+    }
+
     #[no_mangle]
     pub unsafe extern "C" fn host_getConfiguredRecvBufSize(hostrc: *const Host) -> u64 {
         let hostrc = unsafe { hostrc.as_ref().unwrap() };
@@ -1381,7 +2117,7 @@ mod export {
     pub extern "C" fn host_rngNextNBytes(host: *const Host, buf: *mut u8, len: usize) {
         let host = unsafe { host.as_ref().unwrap() };
         let buf = unsafe { std::slice::from_raw_parts_mut(buf, len) };
-        host.random_mut().fill_bytes(buf);
+        host.fill_random_bytes(buf);
     }
 
     #[no_mangle]
@@ -1432,3 +2168,39 @@ mod export {
         host.resume(pid.try_into().unwrap(), tid.try_into().unwrap())
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_should_compact() {
+        let until = EmulatedTime::SIMULATION_START + SimulationTime::from_millis(100);
+        let idle_time = SimulationTime::from_millis(10);
+        let next = |ms| Some(until + SimulationTime::from_millis(ms));
+
+        // no events at all
+        assert!(should_compact(None, until, idle_time));
+        // the next event is at least the idle time away
+        assert!(should_compact(next(10), until, idle_time));
+        assert!(should_compact(next(1000), until, idle_time));
+        // the next event is sooner, regardless of how long ago the last event was
+        assert!(!should_compact(next(0), until, idle_time));
+        assert!(!should_compact(next(9), until, idle_time));
+    }
+
+    #[test]
+    fn test_should_compact_saturates() {
+        let idle_time = SimulationTime::from_millis(10);
+        assert!(should_compact(
+            Some(EmulatedTime::MAX),
+            EmulatedTime::MAX,
+            idle_time
+        ));
+        assert!(!should_compact(
+            Some(EmulatedTime::MAX - SimulationTime::from_millis(1)),
+            EmulatedTime::MAX - SimulationTime::from_millis(1),
+            idle_time
+        ));
+    }
+}
@@ -1,7 +1,7 @@
 use std::cell::{Cell, RefCell};
 use std::ffi::{CStr, CString};
 use std::os::fd::RawFd;
-use std::sync::{atomic, Arc};
+use std::sync::Arc;
 
 use linux_api::sched::CloneFlags;
 use log::{debug, error, log_enabled, trace, Level};
@@ -20,10 +20,15 @@ use vasi_sync::scchannel::SelfContainedChannelError;
 use super::context::ThreadContext;
 use super::host::Host;
 use super::syscall_condition::SysCallCondition;
-use crate::core::scheduler;
+use crate::core::live_metrics;
+use crate::core::logger::shadow_logger;
+use crate::core::profiler;
+use crate::core::timeline;
 use crate::core::worker::{Worker, WORKER_SHARED};
 use crate::cshadow;
+use crate::host::syscall::formatter::write_syscall_binary;
 use crate::host::syscall_types::SyscallReturn;
+use crate::utility::instruction_counter::InstructionCounter;
 use crate::utility::syscall;
 
 /// The ManagedThread's state after having been allowed to execute some code.
@@ -43,8 +48,9 @@ pub struct ManagedThread {
     is_running: Cell<bool>,
     return_code: Cell<Option<i32>>,
 
-    /* holds the event for the most recent call from the plugin/shim */
-    current_event: RefCell<ShimEventToShadow>,
+    /* holds the event for the most recent call from the plugin/shim, or `None`
+     * if we haven't received the shim's start event yet */
+    current_event: RefCell<Option<ShimEventToShadow>>,
 
     native_pid: nix::unistd::Pid,
     native_tid: nix::unistd::Pid,
@@ -54,6 +60,11 @@ pub struct ManagedThread {
     // to AFFINITY_UNINIT if CPU pinning is not enabled or if the thread has
     // not yet been pinned to a CPU.
     affinity: Cell<i32>,
+
+    // Counts the instructions executed by the native thread, if the host's CPU
+    // model is based on instruction counts. Opened the first time that we
+    // transfer control to the thread.
+    instruction_counter: RefCell<Option<InstructionCounter>>,
 }
 
 impl ManagedThread {
@@ -86,15 +97,17 @@ impl ManagedThread {
 
     pub fn spawn(
         plugin_path: &CStr,
-        argv: Vec<CString>,
-        mut envv: Vec<CString>,
+        argv: &[CString],
+        envv: &[CString],
         working_dir: &CStr,
         strace_fd: Option<RawFd>,
         log_path: &CStr,
+        ipc_max_spins: u32,
     ) -> Self {
         let ipc_shmem = Arc::new(shadow_shmem::allocator::shmalloc(IPCData::new()));
-        envv.push(CString::new(format!("SHADOW_IPC_BLK={}", ipc_shmem.serialize())).unwrap());
-        debug!("spawning new mthread '{plugin_path:?}' with environment '{envv:?}', arguments '{argv:?}', and working directory '{working_dir:?}'");
+        ipc_shmem.set_max_spins(ipc_max_spins);
+        let ipc_env = CString::new(format!("SHADOW_IPC_BLK={}", ipc_shmem.serialize())).unwrap();
+        debug!("spawning new mthread '{plugin_path:?}' with environment '{envv:?}' and '{ipc_env:?}', arguments '{argv:?}', and working directory '{working_dir:?}'");
 
         let shimlog_fd = nix::fcntl::open(
             log_path,
@@ -103,8 +116,15 @@ impl ManagedThread {
         )
         .unwrap();
 
-        let child_pid =
-            Self::spawn_native(plugin_path, argv, envv, working_dir, strace_fd, shimlog_fd);
+        let child_pid = Self::spawn_native(
+            plugin_path,
+            argv,
+            envv,
+            vec![ipc_env],
+            working_dir,
+            strace_fd,
+            shimlog_fd,
+        );
 
         // should be opened in the shim, so no need for it anymore
         nix::unistd::close(shimlog_fd).unwrap();
@@ -126,31 +146,26 @@ impl ManagedThread {
                 })
         };
 
-        trace!(
-            "waiting for start event from shim with native pid {}",
-            native_pid
-        );
-        let start_req = ipc_shmem.from_plugin().receive().unwrap();
-        match &start_req {
-            ShimEventToShadow::StartReq(_) => (),
-            other => panic!("Unexpected result from shim: {other:?}"),
-        };
-
+        // We don't wait for the shim's start event here. The new process still
+        // needs to be loaded and initialized, and waiting for that in `resume`
+        // instead lets other processes that start at the same time be spawned
+        // in the meantime.
         Self {
             ipc_shmem,
             is_running: Cell::new(true),
             return_code: Cell::new(None),
-            current_event: RefCell::new(start_req),
+            current_event: RefCell::new(None),
             native_pid,
             native_tid,
             affinity: Cell::new(cshadow::AFFINITY_UNINIT),
+            instruction_counter: RefCell::new(None),
         }
     }
 
     pub fn resume(&self, ctx: &ThreadContext) -> ResumeResult {
         debug_assert!(self.is_running());
 
-        self.sync_affinity_with_worker();
+        self.sync_affinity_with_host(ctx.host);
 
         // Flush any pending writes, e.g. from a previous mthread that exited
         // without flushing.
@@ -158,8 +173,11 @@ impl ManagedThread {
 
         loop {
             let mut current_event = self.current_event.borrow_mut();
-            let last_event = *current_event;
-            *current_event = match last_event {
+            let last_event = match *current_event {
+                Some(event) => event,
+                None => self.wait_for_start_req(),
+            };
+            *current_event = Some(match last_event {
                 ShimEventToShadow::StartReq(start_req) => {
                     // Write the serialized thread shmem handle directly to shim
                     // memory.
@@ -188,12 +206,18 @@ impl ManagedThread {
                     self.continue_plugin(ctx.host, &ShimEventToShim::StartRes)
                 }
                 ShimEventToShadow::ProcessDeath => {
+                    shadow_logger::drain_shim_log_ring(&ctx.process.shmem().log_ring);
+
                     // The native threads are all dead or zombies. Nothing to do but
                     // clean up.
                     self.cleanup_after_exit_initiated();
                     return ResumeResult::ExitedProcess;
                 }
                 ShimEventToShadow::Syscall(syscall) => {
+                    // Log any records that the shim logged since its last syscall, so that they're
+                    // logged before anything Shadow logs while handling this one.
+                    shadow_logger::drain_shim_log_ring(&ctx.process.shmem().log_ring);
+
                     // Emulate the given syscall.
 
                     // `exit` is tricky since it only exits the *mthread*, and we don't have a way
@@ -219,13 +243,36 @@ impl ManagedThread {
                         return ResumeResult::ExitedThread(return_code);
                     }
 
+                    #[cfg(feature = "perf_timers")]
+                    let handler_start = std::time::Instant::now();
+
+                    live_metrics::count_syscall();
                     let scr = unsafe {
+                        let _profile = profiler::enter_phase(profiler::Phase::Syscall);
+                        let _span = timeline::span("syscall", Some(ctx.host.id()));
                         cshadow::syscallhandler_make_syscall(
                             ctx.thread.csyscallhandler(),
                             &syscall.syscall_args,
                         )
                     };
 
+                    #[cfg(feature = "perf_timers")]
+                    Worker::record_syscall_handler_latency(
+                        syscall.syscall_args.number,
+                        handler_start.elapsed(),
+                    );
+
+                    ctx.process.with_binary_strace_file(|file| {
+                        write_syscall_binary(
+                            file,
+                            &Worker::current_time().unwrap(),
+                            ctx.thread.id(),
+                            &syscall.syscall_args,
+                            &scr,
+                        )
+                        .unwrap()
+                    });
+
                     // remove the mthread's old syscall condition since it's no longer needed
                     ctx.thread.cleanup_syscall_condition();
 
@@ -269,11 +316,25 @@ impl ManagedThread {
                     )
                 }
                 e @ ShimEventToShadow::SyscallComplete(_) => panic!("Unexpected event: {e:?}"),
-            };
+            });
             assert!(self.is_running());
         }
     }
 
+    /// Wait for the first event from a newly spawned process's shim.
+    fn wait_for_start_req(&self) -> ShimEventToShadow {
+        trace!(
+            "waiting for start event from shim with native pid {}",
+            self.native_pid
+        );
+        let start_req = self.ipc_shmem.from_plugin().receive().unwrap();
+        match &start_req {
+            ShimEventToShadow::StartReq(_) => (),
+            other => panic!("Unexpected result from shim: {other:?}"),
+        };
+        start_req
+    }
+
     pub fn handle_process_exit(&self) {
         // TODO: Only do this once per process; maybe by moving into `Process`.
         WORKER_SHARED
@@ -309,6 +370,7 @@ impl ManagedThread {
         newtls: libc::c_ulong,
     ) -> Result<ManagedThread, linux_api::errno::Errno> {
         let child_ipc_shmem = Arc::new(shadow_shmem::allocator::shmalloc(IPCData::new()));
+        child_ipc_shmem.set_max_spins(ctx.host.params.ipc_max_spins);
 
         // Send the IPC block for the new mthread to use.
         let clone_res: i64 = match self.continue_plugin(
@@ -372,39 +434,73 @@ impl ManagedThread {
             ipc_shmem: child_ipc_shmem,
             is_running: Cell::new(true),
             return_code: Cell::new(None),
-            current_event: RefCell::new(start_req),
+            current_event: RefCell::new(Some(start_req)),
             native_pid,
             native_tid: nix::unistd::Pid::from_raw(child_native_tid),
             // TODO: can we assume it's inherited from the current thread affinity?
             affinity: Cell::new(cshadow::AFFINITY_UNINIT),
+            instruction_counter: RefCell::new(None),
         })
     }
 
     #[must_use]
     fn continue_plugin(&self, host: &Host, event: &ShimEventToShim) -> ShimEventToShadow {
         // Update shared state before transferring control.
-        host.shim_shmem_lock_borrow_mut().unwrap().max_runahead_time =
-            Worker::max_event_runahead_time(host);
-        host.shim_shmem()
-            .sim_time
-            .store(Worker::current_time().unwrap(), atomic::Ordering::Relaxed);
+        host.shim_shmem().time.store(
+            Worker::current_time().unwrap(),
+            Worker::max_event_runahead_time(host),
+        );
+
+        if host.params.cpu_instruction_rate.is_some() {
+            // Start counting before the thread runs, so that the first
+            // instructions are counted.
+            let mut counter = self.instruction_counter.borrow_mut();
+            if counter.is_none() {
+                *counter = Some(
+                    InstructionCounter::new(self.native_tid).unwrap_or_else(|e| {
+                        panic!(
+                            "Couldn't count the instructions of thread {:?}: {e}. Check that \
+                         /proc/sys/kernel/perf_event_paranoid allows user-space measurements, \
+                         or unset `experimental.cpu_instruction_rate`.",
+                            self.native_tid
+                        )
+                    }),
+                );
+            }
+        }
 
         // Release lock so that plugin can take it. Reacquired in `wait_for_next_event`.
         host.unlock_shmem();
 
-        self.ipc_shmem.to_plugin().send(*event);
+        #[cfg(feature = "perf_timers")]
+        let plugin_start = std::time::Instant::now();
+
+        let event = {
+            let _profile = profiler::enter_phase(profiler::Phase::Plugin);
+            let _span = timeline::span("plugin", Some(host.id()));
+
+            self.ipc_shmem.to_plugin().send(*event);
 
-        let event = match self.ipc_shmem.from_plugin().receive() {
-            Ok(e) => e,
-            Err(SelfContainedChannelError::WriterIsClosed) => ShimEventToShadow::ProcessDeath,
+            match self.ipc_shmem.from_plugin().receive() {
+                Ok(e) => e,
+                Err(SelfContainedChannelError::WriterIsClosed) => ShimEventToShadow::ProcessDeath,
+            }
         };
 
+        #[cfg(feature = "perf_timers")]
+        if let ShimEventToShadow::Syscall(syscall) = &event {
+            Worker::record_syscall_plugin_latency(
+                syscall.syscall_args.number,
+                plugin_start.elapsed(),
+            );
+        }
+
         // Reacquire the shared memory lock, now that the shim has yielded control
         // back to us.
         host.lock_shmem();
 
         // Update time, which may have been incremented in the shim.
-        let shim_time = host.shim_shmem().sim_time.load(atomic::Ordering::Relaxed);
+        let shim_time = host.shim_shmem().time.sim_time();
         if log_enabled!(Level::Trace) {
             let worker_time = Worker::current_time().unwrap();
             if shim_time != worker_time {
@@ -416,6 +512,17 @@ impl ManagedThread {
         }
         Worker::set_current_time(shim_time);
 
+        // Account for the instructions that the thread executed natively.
+        if let Some(rate) = host.params.cpu_instruction_rate {
+            let instructions = self
+                .instruction_counter
+                .borrow_mut()
+                .as_mut()
+                .unwrap()
+                .take();
+            host.cpu_borrow_mut().add_instructions(instructions, rate);
+        }
+
         event
     }
 
@@ -483,23 +590,40 @@ impl ManagedThread {
         }
     }
 
-    fn sync_affinity_with_worker(&self) {
-        let current_affinity = scheduler::core_affinity()
-            .map(|x| i32::try_from(x).unwrap())
+    /// Pin the native thread to the host's chosen core, if it isn't already. The host only
+    /// changes its core between rounds (see [`Host::cpu_affinity`]), so this usually doesn't make a
+    /// syscall. If the worker on that core reserved an SMT sibling for its plugins, the thread is
+    /// pinned to the sibling instead.
+    fn sync_affinity_with_host(&self, host: &Host) {
+        let new_affinity = host
+            .cpu_affinity()
+            .map(|x| unsafe { cshadow::affinity_getPluginAffinity(i32::try_from(x).unwrap()) })
             .unwrap_or(cshadow::AFFINITY_UNINIT);
-        self.affinity.set(unsafe {
+        let old_affinity = self.affinity.get();
+        if new_affinity == cshadow::AFFINITY_UNINIT || new_affinity == old_affinity {
+            return;
+        }
+
+        let affinity = unsafe {
             cshadow::affinity_setProcessAffinity(
                 self.native_tid().into(),
-                current_affinity,
-                self.affinity.get(),
+                new_affinity,
+                old_affinity,
             )
-        });
+        };
+        if affinity != old_affinity {
+            Worker::count_thread_affinity_change();
+        }
+        self.affinity.set(affinity);
     }
 
+    /// `extra_envv` is the process's own environment, which is added after `envv`, the environment
+    /// that the process shares with the other processes of its host entry.
     fn spawn_native(
         plugin_path: &CStr,
-        argv: Vec<CString>,
-        mut envv: Vec<CString>,
+        argv: &[CString],
+        envv: &[CString],
+        mut extra_envv: Vec<CString>,
         working_dir: &CStr,
         strace_fd: Option<RawFd>,
         shimlog_fd: RawFd,
@@ -510,7 +634,7 @@ impl ManagedThread {
         // in glibc 2.29. We should be able to do so once we've dropped support
         // for some platforms, as planned for the shadow 3.0 release.
         // https://github.com/shadow/shadow/discussions/2496
-        envv.push(
+        extra_envv.push(
             CString::new(format!(
                 "SHADOW_WORKING_DIR={}",
                 working_dir.to_str().unwrap()
@@ -519,19 +643,20 @@ impl ManagedThread {
         );
 
         // posix_spawn is documented as taking pointers to *mutable* char for argv and
-        // envv. It *probably* doesn't actually mutate them, but we
-        // conservatively give it what it asks for. We have to "reconstitute"
-        // the CString's after the fork + exec to deallocate them.
+        // envv, but like the exec functions it doesn't modify the strings, so we can
+        // give it pointers to the shared strings instead of copying them for every
+        // process.
         let argv_ptrs: Vec<*mut i8> = argv
-            .into_iter()
-            .map(CString::into_raw)
+            .iter()
+            .map(|x| x.as_ptr().cast_mut())
             // the last element of argv must be NULL
             .chain(std::iter::once(std::ptr::null_mut()))
             .collect();
         let envv_ptrs: Vec<*mut i8> = envv
-            .into_iter()
-            .map(CString::into_raw)
-            // the last element of argv must be NULL
+            .iter()
+            .chain(extra_envv.iter())
+            .map(|x| x.as_ptr().cast_mut())
+            // the last element of envv must be NULL
             .chain(std::iter::once(std::ptr::null_mut()))
             .collect();
 
@@ -634,20 +759,6 @@ impl ManagedThread {
             .child_pid_watcher()
             .register_pid(child_pid);
 
-        // Drop the cloned argv and env.
-        drop(
-            argv_ptrs
-                .into_iter()
-                .filter(|p| !p.is_null())
-                .map(|p| unsafe { CString::from_raw(p) }),
-        );
-        drop(
-            envv_ptrs
-                .into_iter()
-                .filter(|p| !p.is_null())
-                .map(|p| unsafe { CString::from_raw(p) }),
-        );
-
         debug!(
             "started process {} with PID {child_pid:?}",
             plugin_path.to_str().unwrap()
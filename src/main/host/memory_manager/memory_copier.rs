@@ -9,6 +9,10 @@ use crate::core::worker::Worker;
 use crate::host::memory_manager::page_size;
 use crate::host::syscall_types::ForeignArrayPtr;
 
+/// The most iovecs that `process_vm_readv` and `process_vm_writev` accept in a
+/// single call.
+const MAX_IOVECS: usize = libc::UIO_MAXIOV as usize;
+
 /// A utility for copying data to and from a process's memory.
 #[derive(Debug, Clone)]
 pub struct MemoryCopier {
@@ -125,6 +129,27 @@ impl MemoryCopier {
         Ok(())
     }
 
+    // Copy each of `srcs` into the corresponding buffer in `dsts`, using as
+    // few syscalls as possible.
+    /// SAFETY: A mutable reference to the process memory must not exist.
+    pub unsafe fn copy_many_from_ptrs(
+        &self,
+        dsts: &mut [&mut [u8]],
+        srcs: &[ForeignArrayPtr<u8>],
+    ) -> Result<(), Errno> {
+        assert_eq!(dsts.len(), srcs.len());
+        for (dsts, srcs) in dsts.chunks_mut(MAX_IOVECS).zip(srcs.chunks(MAX_IOVECS)) {
+            let toread: usize = srcs.iter().map(|src| src.len()).sum();
+            debug_assert_eq!(toread, dsts.iter().map(|dst| dst.len()).sum::<usize>());
+            let bytes_read = unsafe { self.readv_ptrs(dsts, srcs)? };
+            if bytes_read != toread {
+                warn!("Tried to read {} bytes but only got {}", toread, bytes_read);
+                return Err(Errno::EFAULT);
+            }
+        }
+        Ok(())
+    }
+
     // Low level helper for reading directly from `srcs` to `dsts`.
     // Returns the number of bytes read. Panics if the
     // MemoryManager's process isn't currently active.
@@ -216,6 +241,60 @@ impl MemoryCopier {
             len: towrite,
         }];
 
+        let nwritten = unsafe { self.writev_iovecs(&local, &remote)? };
+        // There shouldn't be any partial writes with a single remote iovec.
+        assert_eq!(nwritten, towrite);
+        Ok(())
+    }
+
+    // Copy each of `srcs` into the corresponding region in `dsts`, using as
+    // few syscalls as possible. On error, some of the regions may have been
+    // written.
+    /// SAFETY: A reference to the process memory must not exist.
+    pub unsafe fn copy_many_to_ptrs(
+        &self,
+        dsts: &[ForeignArrayPtr<u8>],
+        srcs: &[&[u8]],
+    ) -> Result<(), Errno> {
+        assert_eq!(dsts.len(), srcs.len());
+        for (dsts, srcs) in dsts.chunks(MAX_IOVECS).zip(srcs.chunks(MAX_IOVECS)) {
+            let towrite: usize = srcs.iter().map(|src| src.len()).sum();
+            trace!("copy_many_to_ptrs writing {} bytes", towrite);
+            let local: Vec<_> = srcs.iter().map(|src| std::io::IoSlice::new(src)).collect();
+            let remote: Vec<_> = dsts
+                .iter()
+                .zip(srcs)
+                .map(|(dst, src)| {
+                    assert_eq!(dst.len(), src.len());
+                    nix::sys::uio::RemoteIoVec {
+                        base: usize::from(dst.ptr()),
+                        len: dst.len(),
+                    }
+                })
+                .collect();
+            let nwritten = unsafe { self.writev_iovecs(&local, &remote)? };
+            // With several remote iovecs, the write stops at the first one
+            // that isn't writable.
+            if nwritten != towrite {
+                warn!(
+                    "Tried to write {} bytes but only wrote {}",
+                    towrite, nwritten
+                );
+                return Err(Errno::EFAULT);
+            }
+        }
+        Ok(())
+    }
+
+    // Low level helper for writing directly from `srcs` to `dsts`. Returns the
+    // number of bytes written. Panics if the MemoryManager's process isn't
+    // currently active.
+    /// SAFETY: A reference to the process memory must not exist.
+    unsafe fn writev_iovecs(
+        &self,
+        srcs: &[std::io::IoSlice],
+        dsts: &[nix::sys::uio::RemoteIoVec],
+    ) -> Result<usize, Errno> {
         // While the documentation for process_vm_writev says to use the pid, in
         // practice it needs to be the tid of a still-running thread. i.e. using the
         // pid after the thread group leader has exited will fail.
@@ -243,10 +322,7 @@ impl MemoryCopier {
         })
         .unwrap();
 
-        let nwritten = nix::sys::uio::process_vm_writev(tid, &local, &remote)
-            .map_err(|e| Errno::try_from(e as i32).unwrap())?;
-        // There shouldn't be any partial writes with a single remote iovec.
-        assert_eq!(nwritten, towrite);
-        Ok(())
+        nix::sys::uio::process_vm_writev(tid, srcs, dsts)
+            .map_err(|e| Errno::try_from(e as i32).unwrap())
     }
 }
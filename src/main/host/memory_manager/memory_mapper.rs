@@ -1,5 +1,4 @@
-use std::cell::RefCell;
-use std::collections::HashMap;
+use std::cell::{Cell, RefCell};
 use std::ffi::CString;
 use std::fmt::Debug;
 use std::fs::File;
@@ -18,10 +17,12 @@ use shadow_pod::Pod;
 use shadow_shim_helper_rs::notnull::*;
 use shadow_shim_helper_rs::syscall_types::ForeignPtr;
 
+use crate::core::worker::Worker;
 use crate::host::context::ProcessContext;
 use crate::host::context::ThreadContext;
 use crate::host::memory_manager::{page_size, MemoryManager};
 use crate::host::syscall_types::ForeignArrayPtr;
+use crate::utility::counter::Counter;
 use crate::utility::interval_map::{Interval, IntervalMap, Mutation};
 use crate::utility::proc_maps;
 use crate::utility::proc_maps::{MappingPath, Sharing};
@@ -82,7 +83,7 @@ pub struct MemoryMapper {
     shm_file: ShmFile,
     regions: IntervalMap<Region>,
 
-    misses_by_path: RefCell<HashMap<String, u32>>,
+    misses_by_path: RefCell<Counter>,
 
     /// The bounds of the heap. Note that before the plugin's first `brk` syscall this will be a
     /// zero-sized interval (though in the case of thread-preload that'll have already happened
@@ -96,6 +97,11 @@ struct ShmFile {
     shm_file: File,
     shm_plugin_fd: i32,
     len: libc::off_t,
+    /// The name that the file was created with.
+    name: String,
+    /// Whether to advise the kernel to use huge pages for mappings of the file. Cleared if the
+    /// kernel doesn't support it.
+    huge_pages: Cell<bool>,
 }
 
 impl ShmFile {
@@ -126,7 +132,7 @@ impl ShmFile {
 
     /// Map the given interval of the file into shadow's address space.
     fn mmap_into_shadow(&self, interval: &Interval, prot: i32) -> *mut c_void {
-        unsafe {
+        let ptr = unsafe {
             sys::mman::mmap(
                 None,
                 NonZeroUsize::new(interval.len()).unwrap(),
@@ -136,7 +142,18 @@ impl ShmFile {
                 interval.start as i64,
             )
         }
-        .unwrap()
+        .unwrap();
+
+        if self.huge_pages.get() {
+            if let Err(e) = unsafe {
+                sys::mman::madvise(ptr, interval.len(), sys::mman::MmapAdvise::MADV_HUGEPAGE)
+            } {
+                warn!("Couldn't use huge pages for the MemoryManager ({e}); using base pages");
+                self.huge_pages.set(false);
+            }
+        }
+
+        ptr
     }
 
     /// Copy data from the plugin's address space into the file. `interval` must be contained within
@@ -187,6 +204,57 @@ impl ShmFile {
                 interval.start as i64,
             )
             .unwrap();
+
+        if self.huge_pages.get() {
+            // The kernel allocates the file's pages from whichever mapping first touches them, so
+            // the plugin's mapping needs the same advice as shadow's.
+            ctx.thread
+                .native_madvise(
+                    &ProcessContext::new(ctx.host, ctx.process),
+                    ForeignPtr::from(interval.start).cast::<u8>(),
+                    interval.len(),
+                    libc::MADV_HUGEPAGE,
+                )
+                .unwrap_or_else(|e| debug!("madvise in plugin: {e}"));
+        }
+    }
+
+    /// The total size of shadow's mappings of the file that are resident, and how much of that is
+    /// mapped with huge pages, in KiB. Returns `None` if it couldn't be read from
+    /// `/proc/self/smaps`.
+    fn huge_page_coverage(&self) -> Option<(u64, u64)> {
+        let smaps = std::fs::read_to_string("/proc/self/smaps").ok()?;
+        let path = format!("/memfd:{}", self.name);
+
+        let mut in_file_mapping = false;
+        let mut rss_kib = 0;
+        let mut huge_kib = 0;
+        for line in smaps.lines() {
+            let mut fields = line.split_whitespace();
+            let Some(first) = fields.next() else {
+                continue;
+            };
+            if !first.ends_with(':') {
+                // the start of a new mapping, like:
+                // 7f0000000000-7f0000200000 rw-s 00000000 00:01 1234 /memfd:name (deleted)
+                in_file_mapping = line.contains(&path);
+                continue;
+            }
+            if !in_file_mapping {
+                continue;
+            }
+            let value = fields
+                .next()
+                .and_then(|x| x.parse::<u64>().ok())
+                .unwrap_or(0);
+            match first {
+                "Rss:" => rss_kib += value,
+                "ShmemPmdMapped:" => huge_kib += value,
+                _ => {}
+            }
+        }
+
+        Some((rss_kib, huge_kib))
     }
 }
 
@@ -318,12 +386,19 @@ fn map_stack(
 impl Drop for MemoryMapper {
     fn drop(&mut self) {
         let misses = self.misses_by_path.borrow();
-        if misses.is_empty() {
+        if *misses == Counter::new() {
             debug!("MemoryManager misses: None");
         } else {
             debug!("MemoryManager misses: (consider extending MemoryManager to remap regions with a high miss count)");
-            for (path, count) in misses.iter() {
-                debug!("\t{} in {}", count, path);
+            debug!("\t{}", misses);
+        }
+        // also include them in the simulation's stats
+        Worker::add_memory_manager_misses(&misses);
+
+        // reading smaps is slow, so only do it if the result is logged
+        if self.shm_file.huge_pages.get() && log::log_enabled!(log::Level::Debug) {
+            if let Some((rss_kib, huge_kib)) = self.shm_file.huge_page_coverage() {
+                debug!("MemoryManager huge pages: {huge_kib} of {rss_kib} resident KiB");
             }
         }
 
@@ -418,6 +493,8 @@ impl MemoryMapper {
             shm_file,
             shm_plugin_fd,
             len: 0,
+            name: shm_name.to_string_lossy().into_owned(),
+            huge_pages: Cell::new(ctx.host.params.use_memory_manager_huge_pages),
         };
         let regions = get_regions(memory_manager.pid);
         let mut regions = coalesce_regions(regions);
@@ -427,7 +504,7 @@ impl MemoryMapper {
         MemoryMapper {
             shm_file,
             regions,
-            misses_by_path: RefCell::new(HashMap::new()),
+            misses_by_path: RefCell::new(Counter::new()),
             heap,
         }
     }
@@ -1079,9 +1156,7 @@ impl MemoryMapper {
             Some((_, original_path)) => format!("{:?}", original_path),
             None => "not found".to_string(),
         };
-        let mut misses = self.misses_by_path.borrow_mut();
-        let counter = misses.entry(key).or_insert(0);
-        *counter += 1;
+        self.misses_by_path.borrow_mut().add_one(&key);
     }
 }
 
@@ -0,0 +1,181 @@
+//! Kernel same-page merging (KSM) of plugin memory, enabled with
+//! `experimental.use_memory_merging`.
+//!
+//! Simulations often run many processes of the same program, which fill much of their memory with
+//! identical pages. KSM scans the memory that's marked as mergeable and replaces identical pages
+//! with a single copy-on-write page. Once the shim has initialized, the whole process is marked with
+//! `prctl(PR_SET_MEMORY_MERGE)` (Linux 6.4 or later), which also covers the mappings that it makes
+//! later. On older kernels we instead mark the heap and the large private anonymous regions that
+//! exist at that point with `madvise(MADV_MERGEABLE)`.
+//!
+//! KSM only merges private anonymous pages. The regions that the [`MemoryMapper`] has remapped
+//! into its shared memory file (the heap, the stack, and the plugin's later anonymous mmaps) are
+//! shared mappings and are never merged, so most of the savings need
+//! `experimental.use_memory_manager` to be disabled. KSM itself must also be running
+//! (`/sys/kernel/mm/ksm/run`).
+//!
+//! [`MemoryMapper`]: super::memory_mapper::MemoryMapper
+
+use std::ops::Range;
+
+use linux_api::errno::Errno;
+use log::*;
+use nix::unistd::Pid;
+use shadow_shim_helper_rs::syscall_types::ForeignPtr;
+
+use crate::core::worker;
+use crate::host::context::{ProcessContext, ThreadContext};
+use crate::host::memory_manager::page_size;
+use crate::utility::proc_maps::{self, Mapping, MappingPath, Sharing};
+
+/// Not yet defined by the libc crate.
+const PR_SET_MEMORY_MERGE: i32 = 67;
+
+/// Smaller anonymous regions are rarely worth the kernel's time to scan.
+const MIN_ANONYMOUS_REGION_LEN: usize = 64 * 1024;
+
+/// Mark the process's memory as mergeable. `ctx.thread` must be running and ready to make native
+/// syscalls.
+pub fn enable(ctx: &ThreadContext) {
+    warn_if_ksm_stopped();
+
+    let pctx = ProcessContext::new(ctx.host, ctx.process);
+
+    match ctx.thread.native_prctl(&pctx, PR_SET_MEMORY_MERGE, 1) {
+        Ok(_) => {
+            debug!("Marked process {:?} as mergeable", ctx.process.id());
+            worker::with_global_sim_stats(|stats| {
+                stats.memory_merging.lock().unwrap().processes += 1;
+            });
+            return;
+        }
+        // the kernel doesn't support it
+        Err(Errno::EINVAL) => {}
+        Err(e) => {
+            warn!(
+                "Couldn't mark process {:?} as mergeable: {e}",
+                ctx.process.id()
+            );
+            worker::with_global_sim_stats(|stats| {
+                stats.memory_merging.lock().unwrap().processes_failed += 1;
+            });
+            return;
+        }
+    }
+
+    let mappings = match proc_maps::mappings_for_pid(ctx.process.native_pid().as_raw()) {
+        Ok(x) => x,
+        Err(e) => {
+            warn!(
+                "Couldn't read the mappings of process {:?}: {e}",
+                ctx.process.id()
+            );
+            worker::with_global_sim_stats(|stats| {
+                stats.memory_merging.lock().unwrap().processes_failed += 1;
+            });
+            return;
+        }
+    };
+
+    let mut advised = 0;
+    let mut advised_bytes = 0;
+    for region in mergeable_regions(&mappings) {
+        let len = region.len();
+        let rv = ctx.thread.native_madvise(
+            &pctx,
+            ForeignPtr::from(region.start).cast::<u8>(),
+            len,
+            libc::MADV_MERGEABLE,
+        );
+        match rv {
+            Ok(()) => {
+                advised += 1;
+                advised_bytes += u64::try_from(len).unwrap();
+            }
+            Err(e) => debug!("madvise(MADV_MERGEABLE) of {region:x?}: {e}"),
+        }
+    }
+
+    debug!(
+        "Marked {advised} regions ({advised_bytes} bytes) of process {:?} as mergeable",
+        ctx.process.id()
+    );
+    worker::with_global_sim_stats(|stats| {
+        let mut stats = stats.memory_merging.lock().unwrap();
+        stats.processes_regions_only += 1;
+        stats.regions += advised;
+        stats.region_bytes += advised_bytes;
+    });
+}
+
+/// The regions to mark as mergeable when the whole process can't be: the heap and large private
+/// anonymous regions.
+fn mergeable_regions(mappings: &[Mapping]) -> impl Iterator<Item = Range<usize>> + '_ {
+    mappings
+        .iter()
+        .filter(|m| m.sharing == Sharing::Private && m.write)
+        .filter(|m| match &m.path {
+            Some(MappingPath::Heap) => true,
+            None => m.end - m.begin >= MIN_ANONYMOUS_REGION_LEN,
+            _ => false,
+        })
+        .map(|m| m.begin..m.end)
+}
+
+/// The bytes of the process's memory that are currently shared with other pages by KSM, from
+/// '/proc/\<pid\>/ksm_merging_pages' (Linux 6.1 or later).
+pub fn merged_bytes(pid: Pid) -> std::io::Result<u64> {
+    let pages = std::fs::read_to_string(format!("/proc/{pid}/ksm_merging_pages"))?;
+    let pages: u64 = pages.trim().parse().map_err(|_| {
+        std::io::Error::new(
+            std::io::ErrorKind::InvalidData,
+            "Unexpected ksm_merging_pages",
+        )
+    })?;
+    Ok(pages * u64::try_from(page_size()).unwrap())
+}
+
+fn warn_if_ksm_stopped() {
+    static CHECK: std::sync::Once = std::sync::Once::new();
+    CHECK.call_once(|| {
+        match std::fs::read_to_string("/sys/kernel/mm/ksm/run") {
+            // 1 is running, and 2 is unmerging all pages and stopping
+            Ok(x) if x.trim() == "1" => {}
+            Ok(_) => warn!(
+                "Memory merging is enabled but KSM isn't running, so no pages will be merged until \
+                 it's started with /sys/kernel/mm/ksm/run"
+            ),
+            Err(e) => warn!("Memory merging is enabled but KSM's state couldn't be read: {e}"),
+        }
+    });
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_mergeable_regions() {
+        let mappings = proc_maps::parse_file_contents(
+            "\
+555555554000-555555556000 r--p 00000000 fd:01 1 /usr/bin/prog
+555555556000-555555560000 rw-p 00002000 fd:01 1 /usr/bin/prog
+555555560000-555555561000 rw-p 00000000 00:00 0 [heap]
+7ffff7000000-7ffff7100000 rw-p 00000000 00:00 0
+7ffff7100000-7ffff7101000 rw-p 00000000 00:00 0
+7ffff7200000-7ffff7300000 r--p 00000000 00:00 0
+7ffff7300000-7ffff7400000 rw-s 00000000 00:01 2 /memfd:shadow (deleted)
+7ffffffde000-7ffffffff000 rw-p 00000000 00:00 0 [stack]
+",
+        )
+        .unwrap();
+
+        assert_eq!(
+            mergeable_regions(&mappings).collect::<Vec<_>>(),
+            [
+                0x555555560000..0x555555561000,
+                0x7ffff7000000..0x7ffff7100000
+            ]
+        );
+    }
+}
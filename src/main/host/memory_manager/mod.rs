@@ -34,6 +34,7 @@ use crate::host::thread::Thread;
 
 mod memory_copier;
 mod memory_mapper;
+pub mod merging;
 
 /// An object implementing std::io::Read and std::io::Seek for
 /// a range of plugin memory.
@@ -469,6 +470,38 @@ impl MemoryManager {
         unsafe { self.memory_copier.copy_from_ptr(dst, src) }
     }
 
+    /// Copies each of the regions in `srcs` into the corresponding buffer in
+    /// `dsts`. Equivalent to calling `copy_from_ptr` for each region, but the
+    /// regions that aren't mapped into Shadow are read together in a single
+    /// syscall (when there are at most `UIO_MAXIOV` of them) instead of one
+    /// syscall per region.
+    pub fn copy_many_from_ptrs(
+        &self,
+        dsts: &mut [&mut [u8]],
+        srcs: &[ForeignArrayPtr<u8>],
+    ) -> Result<(), Errno> {
+        assert_eq!(dsts.len(), srcs.len());
+
+        let mut copier_dsts = Vec::new();
+        let mut copier_srcs = Vec::new();
+        for (dst, src) in dsts.iter_mut().zip(srcs) {
+            if let Some(src) = self.mapped_ref(*src) {
+                dst.copy_from_slice(src);
+            } else {
+                copier_dsts.push(&mut **dst);
+                copier_srcs.push(*src);
+            }
+        }
+
+        if copier_srcs.is_empty() {
+            return Ok(());
+        }
+        unsafe {
+            self.memory_copier
+                .copy_many_from_ptrs(&mut copier_dsts, &copier_srcs)
+        }
+    }
+
     // Copies memory from the beginning of the given pointer to the last address
     // in the pointer that's accessible. Not exposed as a public interface
     // because this is generally only useful for strings, and
@@ -587,6 +620,41 @@ impl MemoryManager {
         unsafe { self.memory_copier.copy_to_ptr(dst, src) }
     }
 
+    /// Writes each of the buffers in `srcs` into the corresponding region in
+    /// `dsts`. Equivalent to calling `copy_to_ptr` for each region, but the
+    /// regions that aren't mapped into Shadow are written together in a single
+    /// syscall (when there are at most `UIO_MAXIOV` of them) instead of one
+    /// syscall per region. On error, some of the regions may have been
+    /// written.
+    pub fn copy_many_to_ptrs(
+        &mut self,
+        dsts: &[ForeignArrayPtr<u8>],
+        srcs: &[&[u8]],
+    ) -> Result<(), Errno> {
+        assert_eq!(dsts.len(), srcs.len());
+
+        let mut copier_dsts = Vec::new();
+        let mut copier_srcs = Vec::new();
+        for (dst, src) in dsts.iter().zip(srcs) {
+            if let Some(dst) = self.mapped_mut(*dst) {
+                dst.copy_from_slice(src);
+            } else {
+                copier_dsts.push(*dst);
+                copier_srcs.push(*src);
+            }
+        }
+
+        if copier_dsts.is_empty() {
+            return Ok(());
+        }
+        // SAFETY: No other refs to process memory exist by preconditions of
+        // MemoryManager::new + we have an exclusive reference.
+        unsafe {
+            self.memory_copier
+                .copy_many_to_ptrs(&copier_dsts, &copier_srcs)
+        }
+    }
+
     /// Which process's address space this MemoryManager manages.
     pub fn pid(&self) -> Pid {
         self.pid
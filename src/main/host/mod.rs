@@ -1,15 +1,18 @@
 pub mod context;
 pub mod cpu;
 pub mod descriptor;
+pub mod disk;
 #[allow(clippy::module_inception)]
 pub mod host;
 pub mod managed_thread;
 pub mod memory_manager;
 pub mod network;
 pub mod process;
+pub mod replay;
 pub mod status_listener;
 pub mod syscall;
 pub mod syscall_condition;
 pub mod syscall_types;
 pub mod thread;
 pub mod timer;
+pub mod traffic;
@@ -0,0 +1,130 @@
+//! Time series of the throughput and congestion state of a host's TCP connections.
+//!
+//! Each legacy TCP socket counts the bytes that it sends and receives in fixed intervals of
+//! simulated time, using counters in the socket itself so that nothing needs to be looked up when
+//! a packet is sent or received. When a packet arrives after the end of the socket's current
+//! interval, the socket reports the interval's totals together with its congestion window, RTT, and
+//! buffer occupancy as of the last packet counted in the interval. The last interval is reported
+//! when the socket closes or is freed, or when the host shuts down. Intervals in which the socket
+//! didn't send or receive anything aren't reported.
+//!
+//! The samples are written to `flow-metrics.csv` in the host's data directory by the same
+//! background thread that writes packet captures, so the worker threads never wait on disk I/O.
+
+use std::cell::RefCell;
+use std::io::Write;
+use std::net::SocketAddrV4;
+use std::path::Path;
+
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+use crate::utility::pcap_writer::BackgroundFileWriter;
+
+/// The totals of one TCP connection over one interval.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub struct FlowSample {
+    pub interval_start: SimulationTime,
+    pub local: SocketAddrV4,
+    pub peer: SocketAddrV4,
+    /// Payload bytes sent, including retransmissions.
+    pub bytes_sent: u64,
+    /// Payload bytes received.
+    pub bytes_received: u64,
+    pub retransmits: u64,
+    /// The congestion window at the end of the interval, in packets.
+    pub cwnd: u32,
+    /// The smoothed RTT at the end of the interval, in milliseconds.
+    pub srtt_ms: u32,
+    /// Bytes written by the application that haven't been acknowledged yet.
+    pub send_queue_bytes: u64,
+    /// Bytes received that the application hasn't read yet.
+    pub recv_queue_bytes: u64,
+}
+
+impl FlowSample {
+    pub const CSV_HEADER: &'static str = "interval_start_ns,local,peer,bytes_sent,bytes_received,\
+                                          retransmits,cwnd,srtt_ms,send_queue_bytes,\
+                                          recv_queue_bytes";
+
+    pub fn write_csv(&self, mut writer: impl Write) -> std::io::Result<()> {
+        writeln!(
+            writer,
+            "{},{},{},{},{},{},{},{},{},{}",
+            self.interval_start.as_nanos(),
+            self.local,
+            self.peer,
+            self.bytes_sent,
+            self.bytes_received,
+            self.retransmits,
+            self.cwnd,
+            self.srtt_ms,
+            self.send_queue_bytes,
+            self.recv_queue_bytes,
+        )
+    }
+}
+
+/// Writes the flow samples of a host.
+pub struct FlowMetrics {
+    interval: SimulationTime,
+    writer: RefCell<BackgroundFileWriter>,
+}
+
+impl FlowMetrics {
+    /// Create `flow-metrics.csv` in `dir`, for samples taken every `interval`.
+    pub fn new(dir: &Path, interval: SimulationTime) -> std::io::Result<Self> {
+        let file = std::fs::File::create(dir.join("flow-metrics.csv"))?;
+        let mut writer = BackgroundFileWriter::new(file);
+        writeln!(writer, "{}", FlowSample::CSV_HEADER)?;
+        writer.end_record();
+
+        Ok(Self {
+            interval,
+            writer: RefCell::new(writer),
+        })
+    }
+
+    /// The length of each interval.
+    pub fn interval(&self) -> SimulationTime {
+        self.interval
+    }
+
+    pub fn record(&self, sample: &FlowSample) {
+        let mut writer = self.writer.borrow_mut();
+        if let Err(e) = sample.write_csv(&mut *writer) {
+            log::warn!("Unable to write flow metrics: {e}");
+        }
+        writer.end_record();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::net::Ipv4Addr;
+
+    use super::*;
+
+    #[test]
+    fn test_write_csv() {
+        let sample = FlowSample {
+            interval_start: SimulationTime::from_millis(1500),
+            local: SocketAddrV4::new(Ipv4Addr::new(11, 0, 0, 1), 80),
+            peer: SocketAddrV4::new(Ipv4Addr::new(11, 0, 0, 2), 40000),
+            bytes_sent: 1000,
+            bytes_received: 20,
+            retransmits: 1,
+            cwnd: 10,
+            srtt_ms: 50,
+            send_queue_bytes: 300,
+            recv_queue_bytes: 0,
+        };
+
+        let mut out = Vec::new();
+        sample.write_csv(&mut out).unwrap();
+        assert_eq!(
+            std::str::from_utf8(&out).unwrap(),
+            "1500000000,11.0.0.1:80,11.0.0.2:40000,1000,20,1,10,50,300,0\n"
+        );
+        assert_eq!(FlowSample::CSV_HEADER.split(',').count(), 10);
+    }
+}
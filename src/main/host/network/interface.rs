@@ -1,3 +1,5 @@
+use std::cell::RefCell;
+use std::collections::HashMap;
 use std::ffi::{CString, OsStr};
 use std::net::{Ipv4Addr, SocketAddrV4};
 use std::os::unix::ffi::OsStrExt;
@@ -11,6 +13,7 @@ use crate::core::worker::Worker;
 use crate::cshadow as c;
 use crate::network::packet::PacketRc;
 use crate::network::PacketDevice;
+use crate::utility::pcap_writer::PcapFilter;
 use crate::utility::{self, HostTreePointer};
 
 /// The priority used by the fifo qdisc to choose the next socket to send a packet from.
@@ -20,6 +23,7 @@ pub type FifoPacketPriority = u64;
 pub struct PcapOptions {
     pub path: PathBuf,
     pub capture_size_bytes: u32,
+    pub filter: PcapFilter,
 }
 
 /// Represents a network device that can send and receive packets. All accesses
@@ -27,6 +31,8 @@ pub struct PcapOptions {
 pub struct NetworkInterface {
     c_ptr: HostTreePointer<c::NetworkInterface>,
     addr: Ipv4Addr,
+    /// The ports that have associations for each protocol.
+    used_ports: RefCell<HashMap<c::ProtocolType, PortSet>>,
 }
 
 impl NetworkInterface {
@@ -57,12 +63,23 @@ impl NetworkInterface {
             .map(|x| x.capture_size_bytes)
             .unwrap_or(0);
 
+        let pcap_filter = pcap_options
+            .as_ref()
+            .map_or(std::ptr::null(), |x| &x.filter as *const PcapFilter);
+
         let mut name = name.as_bytes().to_vec();
         name.push(0);
         let name = CString::from_vec_with_nul(name).unwrap();
 
         let c_ptr = unsafe {
-            c::networkinterface_new(addr, name.as_ptr(), pcap_dir_cptr, pcap_capture_size, qdisc)
+            c::networkinterface_new(
+                addr,
+                name.as_ptr(),
+                pcap_dir_cptr,
+                pcap_capture_size,
+                pcap_filter,
+                qdisc,
+            )
         };
 
         let ipv4_addr: Ipv4Addr = {
@@ -73,6 +90,7 @@ impl NetworkInterface {
         NetworkInterface {
             c_ptr: HostTreePointer::new_for_host(host_id, c_ptr),
             addr: ipv4_addr,
+            used_ports: RefCell::new(HashMap::new()),
         }
     }
 
@@ -83,6 +101,10 @@ impl NetworkInterface {
         port: u16,
         peer_addr: SocketAddrV4,
     ) {
+        // a collision would replace the existing association, so it shouldn't be counted twice
+        let is_new = !self.is_associated(protocol_type, port, peer_addr);
+
+        let host_port = port;
         let port = port.to_be();
         let peer_ip = u32::from(*peer_addr.ip()).to_be();
         let peer_port = peer_addr.port().to_be();
@@ -97,9 +119,25 @@ impl NetworkInterface {
                 peer_port,
             )
         };
+
+        if is_new {
+            self.used_ports
+                .borrow_mut()
+                .entry(protocol_type)
+                .or_insert_with(PortSet::new)
+                .insert(host_port);
+        }
     }
 
     pub fn disassociate(&self, protocol_type: c::ProtocolType, port: u16, peer_addr: SocketAddrV4) {
+        // sockets may disassociate addresses that were never associated (or were already
+        // disassociated), which shouldn't be counted
+        if self.is_associated(protocol_type, port, peer_addr) {
+            if let Some(ports) = self.used_ports.borrow_mut().get_mut(&protocol_type) {
+                ports.remove(port);
+            }
+        }
+
         let port = port.to_be();
         let peer_ip = u32::from(*peer_addr.ip()).to_be();
         let peer_port = peer_addr.port().to_be();
@@ -116,6 +154,32 @@ impl NetworkInterface {
     }
 
     pub fn is_addr_in_use(&self, protocol: c::ProtocolType, port: u16, peer: SocketAddrV4) -> bool {
+        // most lookups are for unused ports, which don't need to be looked up in the C table
+        if !self.is_port_used(protocol, port) {
+            return false;
+        }
+
+        self.is_associated(protocol, port, peer)
+    }
+
+    /// Returns true if the port has any associations for the protocol, regardless of the peer.
+    pub fn is_port_used(&self, protocol: c::ProtocolType, port: u16) -> bool {
+        self.used_ports
+            .borrow()
+            .get(&protocol)
+            .is_some_and(|x| x.contains(port))
+    }
+
+    /// A bitmap of the used ports (see [`Self::is_port_used`]) from `64 * index` to
+    /// `64 * index + 63`, where the least significant bit is the lowest port.
+    pub fn used_ports_word(&self, protocol: c::ProtocolType, index: usize) -> u64 {
+        self.used_ports
+            .borrow()
+            .get(&protocol)
+            .map_or(0, |x| x.word(index))
+    }
+
+    fn is_associated(&self, protocol: c::ProtocolType, port: u16, peer: SocketAddrV4) -> bool {
         let port = port.to_be();
         let peer_ip = u32::from(*peer.ip()).to_be();
         let peer_port = peer.port().to_be();
@@ -133,6 +197,81 @@ impl NetworkInterface {
     /// called as part of the host's cleanup procedure.
     pub fn remove_all_sockets(&self) {
         unsafe { c::networkinterface_removeAllSockets(self.c_ptr.ptr()) };
+        self.used_ports.borrow_mut().clear();
+    }
+}
+
+/// The ports that have at least one association. Only the bitmap words that have a port set are
+/// stored, so that interfaces with few associations stay small.
+#[derive(Debug, Default)]
+struct PortSet {
+    /// The number of associations for each used port.
+    counts: HashMap<u16, u32>,
+    /// The non-zero words of a bitmap of the used ports.
+    words: HashMap<usize, u64>,
+}
+
+impl PortSet {
+    fn new() -> Self {
+        Self::default()
+    }
+
+    fn contains(&self, port: u16) -> bool {
+        self.word(usize::from(port) / 64) & (1 << (port % 64)) != 0
+    }
+
+    fn word(&self, index: usize) -> u64 {
+        self.words.get(&index).copied().unwrap_or(0)
+    }
+
+    fn insert(&mut self, port: u16) {
+        *self.counts.entry(port).or_insert(0) += 1;
+        *self.words.entry(usize::from(port) / 64).or_insert(0) |= 1 << (port % 64);
+    }
+
+    fn remove(&mut self, port: u16) {
+        let std::collections::hash_map::Entry::Occupied(mut count) = self.counts.entry(port) else {
+            debug_panic!("Removed port {port} which has no associations");
+            return;
+        };
+
+        *count.get_mut() -= 1;
+        if *count.get() > 0 {
+            return;
+        }
+        count.remove();
+
+        let index = usize::from(port) / 64;
+        let word = self.words.get_mut(&index).unwrap();
+        *word &= !(1 << (port % 64));
+        if *word == 0 {
+            self.words.remove(&index);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_port_set() {
+        let mut ports = PortSet::new();
+        assert!(!ports.contains(80));
+
+        ports.insert(80);
+        ports.insert(80);
+        ports.insert(u16::MAX);
+        assert!(ports.contains(80));
+        assert!(!ports.contains(81));
+        assert_eq!(ports.word(1), 1 << 16);
+        assert_eq!(ports.word(1023), 1 << 63);
+
+        ports.remove(80);
+        assert!(ports.contains(80));
+        ports.remove(80);
+        assert!(!ports.contains(80));
+        assert_eq!(ports.words.len(), 1);
     }
 }
 
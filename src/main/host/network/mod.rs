@@ -1,2 +1,3 @@
+pub mod flow_metrics;
 pub mod interface;
 pub mod namespace;
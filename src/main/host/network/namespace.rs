@@ -1,4 +1,5 @@
 use std::cell::{Cell, RefCell};
+use std::collections::HashMap;
 use std::ffi::{CString, OsStr};
 use std::net::{Ipv4Addr, SocketAddrV4};
 use std::num::NonZeroU8;
@@ -34,6 +35,11 @@ pub struct NetworkNamespace {
     pub default_address: SyncSendPointer<cshadow::Address>,
     pub default_ip: Ipv4Addr,
 
+    host_id: HostId,
+
+    // the number of sockets in each multicast group that the host has joined
+    multicast_groups: RefCell<HashMap<Ipv4Addr, u32>>,
+
     // used for debugging to make sure we've cleaned up before being dropped
     has_run_cleanup: Cell<bool>,
 }
@@ -86,6 +92,8 @@ impl NetworkNamespace {
             internet: RefCell::new(internet),
             default_address: unsafe { SyncSendPointer::new(public_addr) },
             default_ip: public_ip,
+            host_id,
+            multicast_groups: RefCell::new(HashMap::new()),
             has_run_cleanup: Cell::new(false),
         }
     }
@@ -139,6 +147,37 @@ impl NetworkNamespace {
         self.has_run_cleanup.set(true);
     }
 
+    /// Add a socket to a multicast group. The host is a member of the group while any of its
+    /// sockets are. The socket will leave the group when the returned handle is dropped.
+    pub fn join_multicast_group(&self, group: Ipv4Addr) -> MulticastMembership {
+        assert!(group.is_multicast());
+        let mut groups = self.multicast_groups.borrow_mut();
+        let count = groups.entry(group).or_insert(0);
+        *count += 1;
+        if *count == 1 {
+            Worker::update_multicast_membership(self.host_id, group, true);
+        }
+        MulticastMembership { group }
+    }
+
+    /// Is the host a member of the multicast group?
+    pub fn is_multicast_member(&self, group: Ipv4Addr) -> bool {
+        self.multicast_groups.borrow().contains_key(&group)
+    }
+
+    fn leave_multicast_group(&self, group: Ipv4Addr) {
+        let mut groups = self.multicast_groups.borrow_mut();
+        let std::collections::hash_map::Entry::Occupied(mut count) = groups.entry(group) else {
+            debug_panic!("Left multicast group {group} which has no members");
+            return;
+        };
+        *count.get_mut() -= 1;
+        if *count.get() == 0 {
+            count.remove();
+            Worker::update_multicast_membership(self.host_id, group, false);
+        }
+    }
+
     /// Returns `None` if there is no such interface.
     #[track_caller]
     pub fn interface_borrow(
@@ -214,40 +253,30 @@ impl NetworkNamespace {
         peer: SocketAddrV4,
         mut rng: impl rand::Rng,
     ) -> Option<u16> {
-        // we need a random port that is free everywhere we need it to be.
-        // we have two modes here: first we just try grabbing a random port until we
-        // get a free one. if we cannot find one fast enough, then as a fallback we
-        // do an inefficient linear search that is guaranteed to succeed or fail.
+        // we need a random port that is free everywhere we need it to be. a port with no
+        // associations on any of the interfaces is free for every peer, so we first look for the
+        // next unused port after a random port using the interfaces' port bitmaps. if every port
+        // has an association, then as a fallback we do an inefficient linear search that checks
+        // each port for this specific peer, which is guaranteed to succeed or fail.
+        let start = rng.gen_range(MIN_RANDOM_PORT..=u16::MAX);
 
-        // if choosing randomly doesn't succeed within 10 tries, then we have already
-        // allocated a lot of ports (>90% on average). then we fall back to linear search.
-        for _ in 0..10 {
-            let random_port = rng.gen_range(MIN_RANDOM_PORT..=u16::MAX);
+        let unused_port = if interface_ip.is_unspecified() {
+            let localhost = self.localhost.borrow();
+            let internet = self.internet.borrow();
+            next_unused_port(start, |i| {
+                localhost.used_ports_word(protocol_type, i)
+                    | internet.used_ports_word(protocol_type, i)
+            })
+        } else {
+            self.interface_borrow(interface_ip).and_then(|iface| {
+                next_unused_port(start, |i| iface.used_ports_word(protocol_type, i))
+            })
+        };
 
-            // `is_addr_in_use` will check all interfaces in the case of INADDR_ANY
-            let specific_in_use = self
-                .is_addr_in_use(
-                    protocol_type,
-                    SocketAddrV4::new(interface_ip, random_port),
-                    peer,
-                )
-                .unwrap_or(true);
-            let generic_in_use = self
-                .is_addr_in_use(
-                    protocol_type,
-                    SocketAddrV4::new(interface_ip, random_port),
-                    SocketAddrV4::new(Ipv4Addr::UNSPECIFIED, 0),
-                )
-                .unwrap_or(true);
-            if !specific_in_use && !generic_in_use {
-                return Some(random_port);
-            }
+        if unused_port.is_some() {
+            return unused_port;
         }
 
-        // now if we tried too many times and still don't have a port, fall back
-        // to a linear search to make sure we get a free port if we have one.
-        // but start from a random port instead of the min.
-        let start = rng.gen_range(MIN_RANDOM_PORT..=u16::MAX);
         for port in (start..=u16::MAX).chain(MIN_RANDOM_PORT..start) {
             let specific_in_use = self
                 .is_addr_in_use(protocol_type, SocketAddrV4::new(interface_ip, port), peer)
@@ -342,6 +371,35 @@ impl std::ops::Drop for NetworkNamespace {
     }
 }
 
+/// Returns the first port from `start` to `u16::MAX` and then from [`MIN_RANDOM_PORT`] to `start`
+/// that isn't set in the port bitmap, where `used_word(i)` returns the bitmap word for ports `64 *
+/// i` to `64 * i + 63`. This reads at most one word for every 64 ports.
+fn next_unused_port(start: u16, used_word: impl Fn(usize) -> u64) -> Option<u16> {
+    // search the inclusive range of ports `from..=to`
+    let search = |from: u16, to: u16| {
+        // ignore the ports before `from` in the first word
+        let mut mask = !0u64 << (from % 64);
+        for index in (usize::from(from) / 64)..=(usize::from(to) / 64) {
+            let unused = !used_word(index) & mask;
+            if unused != 0 {
+                // the port may be after `to` if this is the last word
+                let port = index * 64 + unused.trailing_zeros() as usize;
+                return u16::try_from(port).ok().filter(|x| *x <= to);
+            }
+            mask = !0;
+        }
+        None
+    };
+
+    search(start, u16::MAX).or_else(|| {
+        if start > MIN_RANDOM_PORT {
+            search(MIN_RANDOM_PORT, start - 1)
+        } else {
+            None
+        }
+    })
+}
+
 struct InterfaceOptions {
     pub host_id: HostId,
     pub hostname: Vec<NonZeroU8>,
@@ -393,3 +451,56 @@ impl std::ops::Drop for AssociationHandle {
         .unwrap();
     }
 }
+
+/// A socket's membership of a multicast group. The socket will leave the group when this handle is
+/// dropped (similar to [`AssociationHandle`]).
+#[derive(Debug)]
+pub struct MulticastMembership {
+    group: Ipv4Addr,
+}
+
+impl MulticastMembership {
+    pub fn group(&self) -> Ipv4Addr {
+        self.group
+    }
+}
+
+impl std::ops::Drop for MulticastMembership {
+    fn drop(&mut self) {
+        Worker::with_active_host(|host| {
+            host.network_namespace_borrow()
+                .leave_multicast_group(self.group);
+        })
+        .unwrap();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_next_unused_port() {
+        let none_used = |_| 0;
+        assert_eq!(next_unused_port(12345, none_used), Some(12345));
+
+        // every port from 12288 to 12351 is used
+        let word_used = |i| if i == 12288 / 64 { !0 } else { 0 };
+        assert_eq!(next_unused_port(12300, word_used), Some(12352));
+
+        // only the ports before `start` are unused
+        let high_used = |i| if i >= 12288 / 64 { !0 } else { 0 };
+        assert_eq!(next_unused_port(12300, high_used), Some(MIN_RANDOM_PORT));
+
+        // only ports below `MIN_RANDOM_PORT` are unused
+        let all_used = |i| {
+            if i >= usize::from(MIN_RANDOM_PORT) / 64 {
+                !0
+            } else {
+                0
+            }
+        };
+        assert_eq!(next_unused_port(MIN_RANDOM_PORT, all_used), None);
+        assert_eq!(next_unused_port(u16::MAX, all_used), None);
+    }
+}
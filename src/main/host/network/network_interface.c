@@ -41,7 +41,7 @@ struct _NetworkInterface {
     FifoSocketQueue fifoQueue;
 
     /* To support capturing incoming and outgoing packets */
-    PcapWriter_BufWriter_File* pcap;
+    PcapWriter_BackgroundFileWriter* pcap;
 
     MAGIC_DECLARE;
 };
@@ -57,33 +57,63 @@ static void _compatsocket_unrefTaggedVoid(void* taggedSocketPtr) {
     compatsocket_unref(&socket);
 }
 
-/* The address and ports must be in network byte order. */
-static gchar* _networkinterface_getAssociationKey(NetworkInterface* interface,
-        ProtocolType type, in_port_t port, in_addr_t peerAddr, in_port_t peerPort) {
-    MAGIC_ASSERT(interface);
+/* Identifies a socket bound to an interface. The interface's own address is the same for every
+ * socket bound to it, so it isn't part of the key. The address and ports are in network byte
+ * order. */
+typedef struct _AssociationKey AssociationKey;
+struct _AssociationKey {
+    in_addr_t peerAddr;
+    in_port_t port;
+    in_port_t peerPort;
+    ProtocolType type;
+};
+
+static AssociationKey _associationkey_new(ProtocolType type, in_port_t port, in_addr_t peerAddr,
+                                          in_port_t peerPort) {
+    return (AssociationKey){
+        .peerAddr = peerAddr,
+        .port = port,
+        .peerPort = peerPort,
+        .type = type,
+    };
+}
+
+static guint _associationkey_hash(gconstpointer ptr) {
+    const AssociationKey* key = ptr;
+
+    guint64 x = ((guint64)key->peerAddr << 32) | ((guint64)key->port << 16) | key->peerPort;
+    x ^= (guint64)key->type << 61;
+
+    /* mix the bits so that all fields affect the low bits (the murmur3 finalizer) */
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
 
-    GString* strBuffer = g_string_new(NULL);
-    g_string_printf(strBuffer,
-            "%s|%"G_GUINT32_FORMAT":%"G_GUINT16_FORMAT"|%"G_GUINT32_FORMAT":%"G_GUINT16_FORMAT,
-            protocol_toString(type),
-            (guint)address_toNetworkIP(interface->address),
-            port, peerAddr, peerPort);
+    return (guint)x;
+}
 
-    return g_string_free(strBuffer, FALSE);
+static gboolean _associationkey_equal(gconstpointer a, gconstpointer b) {
+    const AssociationKey* keyA = a;
+    const AssociationKey* keyB = b;
+    return keyA->peerAddr == keyB->peerAddr && keyA->port == keyB->port &&
+           keyA->peerPort == keyB->peerPort && keyA->type == keyB->type;
 }
 
+#define ASSOCIATION_KEY_FORMAT                                                                     \
+    "%s|%" G_GUINT32_FORMAT ":%" G_GUINT16_FORMAT "|%" G_GUINT32_FORMAT ":%" G_GUINT16_FORMAT
+#define ASSOCIATION_KEY_ARGS(interface, key)                                                       \
+    protocol_toString((key)->type), (guint)address_toNetworkIP((interface)->address), (key)->port, \
+        (key)->peerAddr, (key)->peerPort
+
 /* The address and ports must be in network byte order. */
 gboolean networkinterface_isAssociated(NetworkInterface* interface, ProtocolType type,
                                        in_port_t port, in_addr_t peerAddr, in_port_t peerPort) {
     MAGIC_ASSERT(interface);
 
-    gboolean isFound = FALSE;
-
-    gchar* key = _networkinterface_getAssociationKey(interface, type, port, peerAddr, peerPort);
-    isFound = g_hash_table_contains(interface->boundSockets, key);
-    g_free(key);
-
-    return isFound;
+    AssociationKey key = _associationkey_new(type, port, peerAddr, peerPort);
+    return g_hash_table_contains(interface->boundSockets, &key);
 }
 
 void networkinterface_associate(NetworkInterface* interface, const CompatSocket* socket,
@@ -91,7 +121,8 @@ void networkinterface_associate(NetworkInterface* interface, const CompatSocket*
                                 in_port_t peerPort) {
     MAGIC_ASSERT(interface);
 
-    gchar* key = _networkinterface_getAssociationKey(interface, type, port, peerIP, peerPort);
+    AssociationKey* key = g_new(AssociationKey, 1);
+    *key = _associationkey_new(type, port, peerIP, peerPort);
 
     /* make sure there is no collision */
     utility_debugAssert(!g_hash_table_contains(interface->boundSockets, key));
@@ -105,14 +136,14 @@ void networkinterface_associate(NetworkInterface* interface, const CompatSocket*
 
     utility_debugAssert(key_did_not_exist);
 
-    trace("associated socket key %s", key);
+    trace("associated socket key " ASSOCIATION_KEY_FORMAT, ASSOCIATION_KEY_ARGS(interface, key));
 }
 
 void networkinterface_disassociate(NetworkInterface* interface, ProtocolType type, in_port_t port,
                                    in_addr_t peerIP, in_port_t peerPort) {
     MAGIC_ASSERT(interface);
 
-    gchar* key = _networkinterface_getAssociationKey(interface, type, port, peerIP, peerPort);
+    AssociationKey key = _associationkey_new(type, port, peerIP, peerPort);
 
     /* we will no longer receive packets for this port, this unrefs descriptor */
     /* TODO: Return an error if the disassociation fails. Generally the
@@ -122,10 +153,10 @@ void networkinterface_disassociate(NetworkInterface* interface, ProtocolType typ
      * (including ones that have never been associated) and will try to
      * disassociate the same socket multiple times, so we can't just add an assert
      * here. */
-    g_hash_table_remove(interface->boundSockets, key);
+    g_hash_table_remove(interface->boundSockets, &key);
 
-    trace("disassociated socket key %s", key);
-    g_free(key);
+    trace(
+        "disassociated socket key " ASSOCIATION_KEY_FORMAT, ASSOCIATION_KEY_ARGS(interface, &key));
 }
 
 static void _networkinterface_capturePacket(NetworkInterface* interface, Packet* packet) {
@@ -145,7 +176,7 @@ static void _networkinterface_capturePacket(NetworkInterface* interface, Packet*
     }
 }
 
-static CompatSocket _boundsockets_lookup(GHashTable* table, gchar* key) {
+static CompatSocket _boundsockets_lookup(GHashTable* table, const AssociationKey* key) {
     void* ptr = g_hash_table_lookup(table, key);
 
     if (ptr == NULL) {
@@ -175,18 +206,18 @@ void networkinterface_push(NetworkInterface* interface, Packet* packet, CEmulate
     in_port_t peerPort = packet_getSourcePort(packet);
 
     /* first check for a socket with the specific association */
-    gchar* key = _networkinterface_getAssociationKey(interface, ptype, bindPort, peerIP, peerPort);
-    trace("looking for socket associated with specific key %s", key);
+    AssociationKey key = _associationkey_new(ptype, bindPort, peerIP, peerPort);
+    trace("looking for socket associated with specific key " ASSOCIATION_KEY_FORMAT,
+          ASSOCIATION_KEY_ARGS(interface, &key));
 
-    CompatSocket socket = _boundsockets_lookup(interface->boundSockets, key);
-    g_free(key);
+    CompatSocket socket = _boundsockets_lookup(interface->boundSockets, &key);
 
     if (socket.type == CST_NONE) {
         /* then check for a socket with a wildcard association */
-        key = _networkinterface_getAssociationKey(interface, ptype, bindPort, 0, 0);
-        trace("looking for socket associated with general key %s", key);
-        socket = _boundsockets_lookup(interface->boundSockets, key);
-        g_free(key);
+        key = _associationkey_new(ptype, bindPort, 0, 0);
+        trace("looking for socket associated with general key " ASSOCIATION_KEY_FORMAT,
+              ASSOCIATION_KEY_ARGS(interface, &key));
+        socket = _boundsockets_lookup(interface->boundSockets, &key);
     }
 
     /* record the packet before we process it, otherwise we may send more packets before we
@@ -379,6 +410,22 @@ void networkinterface_wantsSend(NetworkInterface* interface, const CompatSocket*
 void networkinterface_removeAllSockets(NetworkInterface* interface) {
     /* we want to unref all sockets, but also want to keep the network interface in a valid state */
 
+    /* sockets that are still open when the host shuts down won't report their last flow metrics
+     * interval themselves, and this is the last time we can reach them */
+    const Host* host = worker_getCurrentHostIfAny();
+    if (host != NULL && host_getFlowMetricsInterval(host) != 0) {
+        GHashTableIter iter;
+        g_hash_table_iter_init(&iter, interface->boundSockets);
+        gpointer taggedSocket = NULL;
+        while (g_hash_table_iter_next(&iter, NULL, &taggedSocket)) {
+            CompatSocket socket = compatsocket_fromTagged((uintptr_t)taggedSocket);
+            if (socket.type == CST_LEGACY_SOCKET &&
+                legacyfile_getType((LegacyFile*)socket.object.as_legacy_socket) == DT_TCPSOCKET) {
+                tcp_flushFlowMetrics((TCP*)socket.object.as_legacy_socket, host);
+            }
+        }
+    }
+
     rrsocketqueue_destroy(&interface->rrQueue, compatsocket_unref);
     fifosocketqueue_destroy(&interface->fifoQueue, compatsocket_unref);
 
@@ -389,7 +436,8 @@ void networkinterface_removeAllSockets(NetworkInterface* interface) {
 }
 
 NetworkInterface* networkinterface_new(Address* address, const char* name, const gchar* pcapDir,
-                                       guint32 pcapCaptureSize, QDiscMode qdisc) {
+                                       guint32 pcapCaptureSize, const PcapFilter* pcapFilter,
+                                       QDiscMode qdisc) {
     NetworkInterface* interface = g_new0(NetworkInterface, 1);
     MAGIC_INIT(interface);
 
@@ -398,7 +446,8 @@ NetworkInterface* networkinterface_new(Address* address, const char* name, const
 
     /* incoming packets get passed along to sockets */
     interface->boundSockets =
-        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _compatsocket_unrefTaggedVoid);
+        g_hash_table_new_full(_associationkey_hash, _associationkey_equal, g_free,
+                              _compatsocket_unrefTaggedVoid);
 
     /* sockets tell us when they want to start sending */
     rrsocketqueue_init(&interface->rrQueue);
@@ -418,7 +467,7 @@ NetworkInterface* networkinterface_new(Address* address, const char* name, const
 
         g_string_append_printf(filename, "%s.pcap", name);
 
-        interface->pcap = pcapwriter_new(filename->str, pcapCaptureSize);
+        interface->pcap = pcapwriter_new(filename->str, pcapCaptureSize, pcapFilter);
         g_string_free(filename, TRUE);
     }
 
@@ -20,7 +20,8 @@ typedef struct _NetworkInterface NetworkInterface;
 #include "main/routing/packet.minimal.h"
 
 NetworkInterface* networkinterface_new(Address* address, const char* name, const gchar* pcapDir,
-                                       guint32 pcapCaptureSize, QDiscMode qdisc);
+                                       guint32 pcapCaptureSize, const PcapFilter* pcapFilter,
+                                       QDiscMode qdisc);
 void networkinterface_free(NetworkInterface* interface);
 
 /* The address and ports must be in network byte order. */
@@ -7,34 +7,31 @@
 
 #include <glib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "main/host/descriptor/compat_socket.h"
-#include "main/routing/packet.h"
-#include "main/utility/priority_queue.h"
 #include "main/utility/utility.h"
 
-// returns 0 if the sockets' canonical handles are equal, otherwise returns 1
-static gint _compareTaggedSocket(gconstpointer a, gconstpointer b) {
-    if (a == b) {
-        // they must have equal canonical handles
-        return 0;
-    }
+#define RR_SOCKET_QUEUE_INITIAL_CAPACITY 16
 
-    CompatSocket sa = compatsocket_fromTagged((uintptr_t)a);
-    CompatSocket sb = compatsocket_fromTagged((uintptr_t)b);
-
-    return compatsocket_getCanonicalHandle(&sa) != compatsocket_getCanonicalHandle(&sb);
+static gpointer _socketKey(const CompatSocket* socket) {
+    return (gpointer)compatsocket_getCanonicalHandle(socket);
 }
 
 void rrsocketqueue_init(RrSocketQueue* self) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue == NULL);
-    self->queue = g_queue_new();
+    utility_debugAssert(self->ring == NULL);
+
+    self->ring = g_new(uintptr_t, RR_SOCKET_QUEUE_INITIAL_CAPACITY);
+    self->capacity = RR_SOCKET_QUEUE_INITIAL_CAPACITY;
+    self->head = 0;
+    self->length = 0;
+    self->members = g_hash_table_new(g_direct_hash, g_direct_equal);
 }
 
 void rrsocketqueue_destroy(RrSocketQueue* self, void (*fn_processItem)(const CompatSocket*)) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
+    utility_debugAssert(self->ring != NULL);
 
     if (fn_processItem != NULL) {
         while (!rrsocketqueue_isEmpty(self)) {
@@ -50,73 +47,104 @@ void rrsocketqueue_destroy(RrSocketQueue* self, void (*fn_processItem)(const Com
         }
     }
 
-    g_queue_free(self->queue);
-    self->queue = NULL;
+    g_free(self->ring);
+    self->ring = NULL;
+    self->capacity = 0;
+    self->head = 0;
+    self->length = 0;
+
+    g_hash_table_destroy(self->members);
+    self->members = NULL;
 }
 
 bool rrsocketqueue_isEmpty(RrSocketQueue* self) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
-    return g_queue_is_empty(self->queue);
+    utility_debugAssert(self->ring != NULL);
+    return self->length == 0;
 }
 
 bool rrsocketqueue_pop(RrSocketQueue* self, CompatSocket* socket) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
+    utility_debugAssert(self->ring != NULL);
 
-    uintptr_t taggedSocket = (uintptr_t)g_queue_pop_head(self->queue);
-    if (taggedSocket == 0) {
+    if (self->length == 0) {
         return false;
     }
 
+    uintptr_t taggedSocket = self->ring[self->head];
+    self->head = (self->head + 1) % self->capacity;
+    self->length--;
+
     *socket = compatsocket_fromTagged(taggedSocket);
+    g_hash_table_remove(self->members, _socketKey(socket));
     return true;
 }
 
 void rrsocketqueue_push(RrSocketQueue* self, const CompatSocket* socket) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
+    utility_debugAssert(self->ring != NULL);
     utility_debugAssert(socket->type != CST_NONE);
-    g_queue_push_tail(self->queue, (void*)compatsocket_toTagged(socket));
+
+    if (self->length == self->capacity) {
+        /* unwrap the ring into a larger buffer */
+        gsize newCapacity = self->capacity * 2;
+        uintptr_t* newRing = g_new(uintptr_t, newCapacity);
+        for (gsize i = 0; i < self->length; i++) {
+            newRing[i] = self->ring[(self->head + i) % self->capacity];
+        }
+        g_free(self->ring);
+        self->ring = newRing;
+        self->capacity = newCapacity;
+        self->head = 0;
+    }
+
+    self->ring[(self->head + self->length) % self->capacity] = compatsocket_toTagged(socket);
+    self->length++;
+
+    g_hash_table_add(self->members, _socketKey(socket));
 }
 
 bool rrsocketqueue_find(RrSocketQueue* self, const CompatSocket* socket) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
-    return g_queue_find_custom(
-        self->queue, (void*)compatsocket_toTagged(socket), _compareTaggedSocket);
+    utility_debugAssert(self->ring != NULL);
+    return g_hash_table_contains(self->members, _socketKey(socket));
 }
 
-static gint _compareSocket(const CompatSocket* sa, const CompatSocket* sb) {
-    uint64_t pa = 0;
-    uint64_t pb = 0;
+typedef struct _FifoSocketQueueEntry FifoSocketQueueEntry;
+struct _FifoSocketQueueEntry {
+    uint64_t priority;
+    uintptr_t taggedSocket;
+};
 
-    if (compatsocket_peekNextPacketPriority(sa, &pa) != 0) {
-        return -1;
-    }
-    if (compatsocket_peekNextPacketPriority(sb, &pb) != 0) {
-        return +1;
+/* The bucket for `priority`, which must not be less than `lastPriority`. */
+static guint _fifosocketqueue_bucket(const FifoSocketQueue* self, uint64_t priority) {
+    uint64_t diff = priority ^ self->lastPriority;
+    if (diff == 0) {
+        return 0;
     }
-
-    return pa > pb ? +1 : -1;
+    return 64 - __builtin_clzll(diff);
 }
 
-static gint _compareSocketTagged(uintptr_t sa_tagged, uintptr_t sb_tagged, gpointer userData) {
-    CompatSocket sa = compatsocket_fromTagged(sa_tagged);
-    CompatSocket sb = compatsocket_fromTagged(sb_tagged);
-
-    return _compareSocket(&sa, &sb);
+static void _fifosocketqueue_insert(FifoSocketQueue* self, FifoSocketQueueEntry entry) {
+    GArray* bucket = self->buckets[_fifosocketqueue_bucket(self, entry.priority)];
+    g_array_append_val(bucket, entry);
 }
 
 void fifosocketqueue_init(FifoSocketQueue* self) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue == NULL);
-    self->queue = priorityqueue_new((GCompareDataFunc)_compareSocketTagged, NULL, NULL);
+    utility_debugAssert(self->members == NULL);
+
+    for (int i = 0; i < FIFO_SOCKET_QUEUE_NUM_BUCKETS; i++) {
+        self->buckets[i] = g_array_new(FALSE, FALSE, sizeof(FifoSocketQueueEntry));
+    }
+    self->lastPriority = 0;
+    self->length = 0;
+    self->members = g_hash_table_new(g_direct_hash, g_direct_equal);
 }
 
 void fifosocketqueue_destroy(FifoSocketQueue* self, void (*fn_processItem)(const CompatSocket*)) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
+    utility_debugAssert(self->members != NULL);
 
     if (fn_processItem != NULL) {
         while (!fifosocketqueue_isEmpty(self)) {
@@ -132,39 +160,89 @@ void fifosocketqueue_destroy(FifoSocketQueue* self, void (*fn_processItem)(const
         }
     }
 
-    priorityqueue_free(self->queue);
-    self->queue = NULL;
+    for (int i = 0; i < FIFO_SOCKET_QUEUE_NUM_BUCKETS; i++) {
+        g_array_free(self->buckets[i], TRUE);
+        self->buckets[i] = NULL;
+    }
+    self->length = 0;
+
+    g_hash_table_destroy(self->members);
+    self->members = NULL;
 }
 
 bool fifosocketqueue_isEmpty(FifoSocketQueue* self) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
-    return priorityqueue_isEmpty(self->queue);
+    utility_debugAssert(self->members != NULL);
+    return self->length == 0;
 }
 
 bool fifosocketqueue_pop(FifoSocketQueue* self, CompatSocket* socket) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
+    utility_debugAssert(self->members != NULL);
 
-    uintptr_t taggedSocket = (uintptr_t)priorityqueue_pop(self->queue);
-    if (taggedSocket == 0) {
+    if (self->length == 0) {
         return false;
     }
 
-    *socket = compatsocket_fromTagged(taggedSocket);
+    if (self->buckets[0]->len == 0) {
+        /* find the first non-empty bucket; its smallest priority is the new minimum */
+        guint i = 1;
+        while (self->buckets[i]->len == 0) {
+            i++;
+        }
+
+        GArray* bucket = self->buckets[i];
+        uint64_t minPriority = UINT64_MAX;
+        for (guint j = 0; j < bucket->len; j++) {
+            minPriority = MIN(minPriority, g_array_index(bucket, FifoSocketQueueEntry, j).priority);
+        }
+
+        /* relative to the new minimum, every entry in bucket `i` belongs in a lower bucket, so
+         * we never append to the array we're reading from */
+        self->lastPriority = minPriority;
+        for (guint j = 0; j < bucket->len; j++) {
+            _fifosocketqueue_insert(self, g_array_index(bucket, FifoSocketQueueEntry, j));
+        }
+        g_array_set_size(bucket, 0);
+    }
+
+    /* all entries in bucket 0 have the same priority, so we can take any of them */
+    GArray* bucket = self->buckets[0];
+    utility_debugAssert(bucket->len > 0);
+    FifoSocketQueueEntry entry = g_array_index(bucket, FifoSocketQueueEntry, bucket->len - 1);
+    g_array_set_size(bucket, bucket->len - 1);
+    self->length--;
+
+    *socket = compatsocket_fromTagged(entry.taggedSocket);
+    g_hash_table_remove(self->members, _socketKey(socket));
     return true;
 }
 
 void fifosocketqueue_push(FifoSocketQueue* self, const CompatSocket* socket) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
+    utility_debugAssert(self->members != NULL);
     utility_debugAssert(socket->type != CST_NONE);
-    priorityqueue_push(self->queue, (void*)compatsocket_toTagged(socket));
+
+    uint64_t priority = 0;
+    if (compatsocket_peekNextPacketPriority(socket, &priority) != 0 ||
+        priority < self->lastPriority) {
+        /* sockets without a packet (or whose packet is older than the last one sent) go first;
+         * radix heap keys can't be smaller than the last key popped */
+        priority = self->lastPriority;
+    }
+
+    FifoSocketQueueEntry entry = {
+        .priority = priority,
+        .taggedSocket = compatsocket_toTagged(socket),
+    };
+    _fifosocketqueue_insert(self, entry);
+    self->length++;
+
+    g_hash_table_add(self->members, _socketKey(socket));
 }
 
 bool fifosocketqueue_find(FifoSocketQueue* self, const CompatSocket* socket) {
     utility_debugAssert(self != NULL);
-    utility_debugAssert(self->queue != NULL);
-    return priorityqueue_find_custom(
-        self->queue, (void*)compatsocket_toTagged(socket), _compareTaggedSocket);
+    utility_debugAssert(self->members != NULL);
+    return g_hash_table_contains(self->members, _socketKey(socket));
 }
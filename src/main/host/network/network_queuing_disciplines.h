@@ -8,20 +8,42 @@
 
 #include <glib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "main/host/descriptor/compat_socket.h"
-#include "main/utility/priority_queue.h"
 
-/* A round-robin socket queue. */
+/* A round-robin socket queue. Sockets are stored in a growable ring buffer, and the set of queued
+ * sockets is tracked separately so that all operations are constant time. */
 typedef struct _RrSocketQueue RrSocketQueue;
 struct _RrSocketQueue {
-    GQueue* queue;
+    /* tagged sockets */
+    uintptr_t* ring;
+    gsize capacity;
+    /* index of the first socket in `ring` */
+    gsize head;
+    gsize length;
+    /* the canonical handles of the queued sockets */
+    GHashTable* members;
 };
 
-/* A first-in-first-out socket queue. */
+/* The number of buckets in a radix heap of 64-bit keys. Bucket 0 holds the keys equal to the last
+ * key popped, and bucket `i` holds the keys whose highest bit that differs from the last popped key
+ * is bit `i - 1`. */
+#define FIFO_SOCKET_QUEUE_NUM_BUCKETS 65
+
+/* A first-in-first-out socket queue, ordered by the priority of each socket's next packet when the
+ * socket was pushed. Packet priorities come from a per-host counter that only increases, so the
+ * sockets are kept in a radix heap, which has constant amortized time operations for monotonic
+ * keys. */
 typedef struct _FifoSocketQueue FifoSocketQueue;
 struct _FifoSocketQueue {
-    PriorityQueue* queue;
+    /* arrays of `FifoSocketQueueEntry` */
+    GArray* buckets[FIFO_SOCKET_QUEUE_NUM_BUCKETS];
+    /* the priority of the last socket popped */
+    uint64_t lastPriority;
+    gsize length;
+    /* the canonical handles of the queued sockets */
+    GHashTable* members;
 };
 
 void rrsocketqueue_init(RrSocketQueue* self);
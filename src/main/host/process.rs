@@ -1,7 +1,9 @@
 use std::cell::{Cell, Ref, RefCell, RefMut};
+use std::collections::hash_map::DefaultHasher;
 use std::collections::BTreeMap;
 use std::ffi::{c_char, c_void, CStr, CString};
 use std::fmt::Write;
+use std::hash::{Hash, Hasher};
 use std::num::TryFromIntError;
 use std::ops::{Deref, DerefMut};
 use std::os::fd::{AsRawFd, RawFd};
@@ -32,7 +34,7 @@ use shadow_shmem::allocator::ShMemBlock;
 use super::descriptor::descriptor_table::{DescriptorHandle, DescriptorTable};
 use super::descriptor::{FileState, StateEventSource};
 use super::host::Host;
-use super::memory_manager::{MemoryManager, ProcessMemoryRef, ProcessMemoryRefMut};
+use super::memory_manager::{merging, MemoryManager, ProcessMemoryRef, ProcessMemoryRefMut};
 use super::syscall::formatter::StraceFmtMode;
 use super::syscall_types::ForeignArrayPtr;
 use super::thread::{Thread, ThreadId};
@@ -44,11 +46,12 @@ use crate::cshadow;
 use crate::host::context::ProcessContext;
 use crate::host::descriptor::Descriptor;
 use crate::host::managed_thread::ManagedThread;
-use crate::host::syscall::formatter::FmtOptions;
+use crate::host::syscall::formatter::{FmtOptions, StraceOutput, STRACE_BINARY_MAGIC};
 use crate::utility;
 use crate::utility::callback_queue::CallbackQueue;
 #[cfg(feature = "perf_timers")]
 use crate::utility::perf_timer::PerfTimer;
+use crate::utility::proc_maps::{self, Sharing};
 
 /// Virtual pid of a shadow process
 #[derive(Debug, PartialEq, Eq, Hash, Copy, Clone, Ord, PartialOrd)]
@@ -126,19 +129,39 @@ pub enum ExitStatus {
 }
 
 #[derive(Debug)]
-struct StraceLogging {
-    file: RefCell<std::fs::File>,
-    options: FmtOptions,
+enum StraceLogging {
+    Text {
+        file: RefCell<std::fs::File>,
+        options: FmtOptions,
+    },
+    // Only written by Shadow (not the shim), so can be buffered.
+    Binary {
+        file: RefCell<std::io::BufWriter<std::fs::File>>,
+    },
 }
 
 impl StraceLogging {
     pub fn try_clone(&self) -> Result<StraceLogging, std::io::Error> {
-        let file = self.file.borrow().try_clone()?;
-        Ok(StraceLogging {
-            file: RefCell::new(file),
-            options: self.options,
+        Ok(match self {
+            Self::Text { file, options } => Self::Text {
+                file: RefCell::new(file.borrow().try_clone()?),
+                options: *options,
+            },
+            Self::Binary { file } => Self::Binary {
+                file: RefCell::new(std::io::BufWriter::new(
+                    file.borrow().get_ref().try_clone()?,
+                )),
+            },
         })
     }
+
+    /// The descriptor that the shim should write its strace lines to, if any.
+    fn shim_fd(&self) -> Option<RawFd> {
+        match self {
+            Self::Text { file, .. } => Some(file.borrow().as_raw_fd()),
+            Self::Binary { .. } => None,
+        }
+    }
 }
 
 /// Parts of the process that are present in all states.
@@ -183,8 +206,10 @@ impl Common {
         // underlying physical memory, and that therefore (pid, virtual address)
         // uniquely defines a physical address.
         //
-        // If we ever want to support futexes in memory shared between processes,
-        // we'll need to change this.  The most foolproof way to do so is probably
+        // Futexes in memory shared between processes use
+        // `Process::shared_physical_address` instead, which hashes the region+offset
+        // as described below. If we want to support them more generally, we'll
+        // need to change this.  The most foolproof way to do so is probably
         // to change ManagedPhysicalMemoryAddr to be a bigger struct that identifies where
         // the mapped region came from (e.g. what file), and the offset into that
         // region. Such "fat" physical pointers might make memory management a
@@ -265,6 +290,9 @@ pub struct RunnableProcess {
     // SAFETY: Must be before memory_manager for drop order.
     unsafe_borrow_mut: RefCell<Option<UnsafeBorrowMut>>,
     unsafe_borrows: RefCell<Vec<UnsafeBorrow>>,
+    // Whether either of the above may be non-empty, so that freeing them is cheap when no legacy
+    // C code has borrowed memory, which is the case for most syscalls.
+    has_unsafe_borrows: Cell<bool>,
 
     // `clone(2)` documents that if `CLONE_THREAD` is set, then `CLONE_VM` must
     // also be set. Hence all threads in a process always share the same virtual
@@ -321,6 +349,10 @@ impl RunnableProcess {
     /// Writes the leftover mutable ref to memory (if any), and frees
     /// all memory refs.
     pub fn free_unsafe_borrows_flush(&self) -> Result<(), Errno> {
+        if !self.has_unsafe_borrows.replace(false) {
+            return Ok(());
+        }
+
         self.unsafe_borrows.borrow_mut().clear();
 
         let unsafe_borrow_mut = self.unsafe_borrow_mut.borrow_mut().take();
@@ -336,6 +368,10 @@ impl RunnableProcess {
     ///
     /// Frees all memory refs without writing back to memory.
     pub fn free_unsafe_borrows_noflush(&self) {
+        if !self.has_unsafe_borrows.replace(false) {
+            return;
+        }
+
         self.unsafe_borrows.borrow_mut().clear();
 
         let unsafe_borrow_mut = self.unsafe_borrow_mut.borrow_mut().take();
@@ -354,17 +390,35 @@ impl RunnableProcess {
         self.memory_manager.borrow_mut()
     }
 
+    /// The options for formatting syscalls, or `None` if strace logging is disabled or uses the
+    /// binary format.
     pub fn strace_logging_options(&self) -> Option<FmtOptions> {
-        self.strace_logging.as_ref().map(|x| x.options)
+        match &self.strace_logging {
+            Some(StraceLogging::Text { options, .. }) => Some(*options),
+            _ => None,
+        }
     }
 
-    /// If strace logging is disabled, this function will do nothing and return `None`.
+    /// If text strace logging is disabled, this function will do nothing and return `None`.
     pub fn with_strace_file<T>(&self, f: impl FnOnce(&mut std::fs::File) -> T) -> Option<T> {
-        let Some(ref strace_logging) = self.strace_logging else {
+        let Some(StraceLogging::Text { file, .. }) = &self.strace_logging else {
+            return None;
+        };
+
+        let mut file = file.borrow_mut();
+        Some(f(&mut file))
+    }
+
+    /// If binary strace logging is disabled, this function will do nothing and return `None`.
+    pub fn with_binary_strace_file<T>(
+        &self,
+        f: impl FnOnce(&mut std::io::BufWriter<std::fs::File>) -> T,
+    ) -> Option<T> {
+        let Some(StraceLogging::Binary { file }) = &self.strace_logging else {
             return None;
         };
 
-        let mut file = strace_logging.file.borrow_mut();
+        let mut file = file.borrow_mut();
         Some(f(&mut file))
     }
 
@@ -407,6 +461,19 @@ impl RunnableProcess {
         self.thread(virtual_tid)
     }
 
+    /// The number of threads in the process.
+    pub fn num_threads(&self) -> usize {
+        self.threads.borrow().len()
+    }
+
+    /// Add each thread's syscall counts since the last flush to the worker's syscall counts.
+    pub fn flush_syscall_counts(&self, host: &Host) {
+        for thread in self.threads.borrow().values() {
+            let thread = thread.borrow(host.root());
+            unsafe { cshadow::syscallhandler_flushCounts(thread.csyscallhandler()) };
+        }
+    }
+
     // Disposes of `self`, returning the internal `Common` for reuse.
     // Used internally when changing states.
     fn into_common(self) -> Common {
@@ -521,6 +588,20 @@ impl RunnableProcess {
             process_shmem_protected.set_pending_standard_siginfo(signal, siginfo_t);
         }
 
+        // any of the process's threads may handle the signal
+        let set_maybe_pending = |t: &Thread| {
+            t.shmem()
+                .maybe_pending_signals
+                .store(true, Ordering::Relaxed)
+        };
+        for (tid, thread) in self.threads.borrow().iter() {
+            match current_thread {
+                // the current thread may already be borrowed
+                Some(current) if current.id() == *tid => set_maybe_pending(current),
+                _ => set_maybe_pending(&thread.borrow(host.root())),
+            }
+        }
+
         if let Some(thread) = current_thread {
             if thread.process_id() == self.common.id() {
                 let host_shmem = host.shim_shmem_lock_borrow().unwrap();
@@ -618,7 +699,9 @@ impl RunnableProcess {
             &host.shim_shmem_lock_borrow().unwrap().root,
             host.shim_shmem().serialize(),
             host.id(),
-            strace_logging.as_ref().map(|x| x.file.borrow().as_raw_fd()),
+            strace_logging.as_ref().and_then(|x| x.shim_fd()),
+            pid.into(),
+            parent_pid.into(),
         );
         let shim_shared_mem_block = shadow_shmem::allocator::shmalloc(shim_shared_mem);
 
@@ -633,6 +716,7 @@ impl RunnableProcess {
             threads,
             unsafe_borrow_mut: RefCell::new(None),
             unsafe_borrows: RefCell::new(Vec::new()),
+            has_unsafe_borrows: Cell::new(false),
             memory_manager: Box::new(RefCell::new(unsafe { MemoryManager::new(native_pid) })),
             child_process_event_listeners: Default::default(),
         };
@@ -868,10 +952,10 @@ impl Process {
         host: &Host,
         plugin_name: CString,
         plugin_path: &CStr,
-        envv: Vec<CString>,
-        argv: Vec<CString>,
+        envv: &[CString],
+        argv: &[CString],
         pause_for_debugging: bool,
-        strace_logging_options: Option<FmtOptions>,
+        strace_output: Option<StraceOutput>,
         expected_final_state: ProcessFinalState,
     ) -> RootedRc<RootedRefCell<Process>> {
         debug!("starting process '{:?}'", plugin_name);
@@ -897,15 +981,25 @@ impl Process {
             id = u32::from(process_id)
         ));
 
-        let strace_logging = strace_logging_options.map(|options| {
+        let strace_logging = strace_output.map(|output| {
             let oflag = { OFlag::O_CREAT | OFlag::O_TRUNC | OFlag::O_WRONLY | OFlag::O_CLOEXEC };
             let mode = { Mode::S_IRUSR | Mode::S_IWUSR | Mode::S_IRGRP | Mode::S_IROTH };
             let filename = Self::static_output_file_name(&file_basename, "strace");
             let fd = nix::fcntl::open(&filename, oflag, mode).unwrap();
+            let file = unsafe { std::fs::File::from_raw_fd(fd) };
 
-            StraceLogging {
-                file: RefCell::new(unsafe { std::fs::File::from_raw_fd(fd) }),
-                options,
+            match output {
+                StraceOutput::Text(options) => StraceLogging::Text {
+                    file: RefCell::new(file),
+                    options,
+                },
+                StraceOutput::Binary => {
+                    let mut file = std::io::BufWriter::new(file);
+                    std::io::Write::write_all(&mut file, STRACE_BINARY_MAGIC).unwrap();
+                    StraceLogging::Binary {
+                        file: RefCell::new(file),
+                    }
+                }
             }
         });
 
@@ -913,7 +1007,9 @@ impl Process {
             &host.shim_shmem_lock_borrow().unwrap().root,
             host.shim_shmem().serialize(),
             host.id(),
-            strace_logging.as_ref().map(|x| x.file.borrow().as_raw_fd()),
+            strace_logging.as_ref().and_then(|x| x.shim_fd()),
+            process_id.into(),
+            ProcessId::INIT.into(),
         );
         let shim_shared_mem_block = shadow_shmem::allocator::shmalloc(shim_shared_mem);
 
@@ -970,8 +1066,9 @@ impl Process {
             argv,
             envv,
             &working_dir,
-            strace_logging.as_ref().map(|s| s.file.borrow().as_raw_fd()),
+            strace_logging.as_ref().and_then(|s| s.shim_fd()),
             &shimlog_path,
+            host.params.ipc_max_spins,
         );
         let native_pid = mthread.native_pid();
         let main_thread =
@@ -1039,6 +1136,7 @@ impl Process {
                         native_pid,
                         unsafe_borrow_mut: RefCell::new(None),
                         unsafe_borrows: RefCell::new(Vec::new()),
+                        has_unsafe_borrows: Cell::new(false),
                         threads,
                         #[cfg(feature = "perf_timers")]
                         cpu_delay_timer,
@@ -1060,7 +1158,15 @@ impl Process {
     }
 
     pub fn set_parent_id(&self, pid: ProcessId) {
-        self.common().parent_pid.set(pid)
+        self.common().parent_pid.set(pid);
+
+        // the shim handles `getppid` itself
+        if let Some(runnable) = self.runnable() {
+            runnable
+                .shim_shared_mem_block
+                .ppid
+                .store(pid.into(), Ordering::Relaxed);
+        }
     }
 
     pub fn group_id(&self) -> ProcessId {
@@ -1141,6 +1247,9 @@ impl Process {
         drop(thread);
         threadrc.explicit_drop_recursive(host.root(), host);
 
+        // log any records that the shim logged after its last syscall
+        crate::core::logger::shadow_logger::drain_shim_log_ring(&self.shmem().log_ring);
+
         #[cfg(feature = "perf_timers")]
         {
             let delay = self.stop_cpu_delay_timer(host);
@@ -1196,6 +1305,16 @@ impl Process {
             };
             debug!("terminating process {}", &*self.name());
 
+            if host.params.use_memory_merging {
+                // the kernel stops counting the merged pages once the process exits
+                match merging::merged_bytes(runnable.native_pid()) {
+                    Ok(bytes) => crate::core::worker::with_global_sim_stats(|stats| {
+                        stats.memory_merging.lock().unwrap().merged_bytes_at_end += bytes;
+                    }),
+                    Err(e) => debug!("Unable to read the merged pages of {}: {e}", &*self.name()),
+                }
+            }
+
             #[cfg(feature = "perf_timers")]
             runnable.start_cpu_delay_timer();
 
@@ -1216,6 +1335,18 @@ impl Process {
         self.handle_process_exit(host, true);
     }
 
+    /// Send SIGKILL to the native process without waiting for it to exit. The process must still
+    /// be stopped with [`Process::stop`], which reaps it.
+    ///
+    /// No-op if the `self` is a `ZombieProcess`.
+    pub fn kill_native(&self) {
+        if let Some(runnable) = self.runnable() {
+            if let Err(err) = nixsignal::kill(runnable.native_pid(), nixsignal::Signal::SIGKILL) {
+                warn!("kill: {:?}", err);
+            }
+        }
+    }
+
     /// See `RunnableProcess::signal`.
     ///
     /// No-op if the `self` is a `ZombieProcess`.
@@ -1313,6 +1444,14 @@ impl Process {
         self.runnable().unwrap().with_strace_file(f)
     }
 
+    /// Deprecated wrapper for `RunnableProcess::with_binary_strace_file`
+    pub fn with_binary_strace_file<T>(
+        &self,
+        f: impl FnOnce(&mut std::io::BufWriter<std::fs::File>) -> T,
+    ) -> Option<T> {
+        self.runnable().unwrap().with_binary_strace_file(f)
+    }
+
     /// Deprecated wrapper for `RunnableProcess::native_pid`
     pub fn native_pid(&self) -> Pid {
         self.runnable().unwrap().native_pid
@@ -1355,6 +1494,19 @@ impl Process {
         })
     }
 
+    /// The number of threads in the process, or 0 if it's a zombie.
+    pub fn num_threads(&self) -> usize {
+        self.runnable().map(|x| x.num_threads()).unwrap_or(0)
+    }
+
+    /// See [`RunnableProcess::flush_syscall_counts`]. A zombie's counts were already added when
+    /// its threads were freed.
+    pub fn flush_syscall_counts(&self, host: &Host) {
+        if let Some(runnable) = self.runnable() {
+            runnable.flush_syscall_counts(host);
+        }
+    }
+
     /// Deprecated wrapper for [`RunnableProcess::free_unsafe_borrows_flush`].
     pub fn free_unsafe_borrows_flush(&self) -> Result<(), Errno> {
         self.runnable().unwrap().free_unsafe_borrows_flush()
@@ -1369,6 +1521,41 @@ impl Process {
         self.common().physical_address(vptr)
     }
 
+    /// Like [`Process::physical_address`], but if `vptr` is in a `MAP_SHARED` mapping, the
+    /// returned address identifies the underlying file (device and inode) and the offset into it
+    /// rather than this process, so that it's the same in every process that maps it. This is
+    /// what a futex operation without `FUTEX_PRIVATE_FLAG` needs.
+    ///
+    /// The file and offset are hashed into the 48 bits used for the virtual address, with the pid
+    /// bits left 0. Process ids start at 1, so these can't collide with a private address,
+    /// although two shared addresses could collide with each other.
+    pub fn shared_physical_address(&self, vptr: ForeignPtr<()>) -> ManagedPhysicalMemoryAddr {
+        let addr = usize::from(vptr);
+        let mappings = match proc_maps::mappings_for_pid(self.native_pid().as_raw()) {
+            Ok(mappings) => mappings,
+            Err(e) => {
+                warn!("Couldn't read the memory mappings of {}: {e}", self.id());
+                return self.physical_address(vptr);
+            }
+        };
+        let Some(mapping) = mappings
+            .iter()
+            .find(|m| m.sharing == Sharing::Shared && (m.begin..m.end).contains(&addr))
+        else {
+            return self.physical_address(vptr);
+        };
+
+        let mut hasher = DefaultHasher::new();
+        (
+            mapping.device_major,
+            mapping.device_minor,
+            mapping.inode,
+            mapping.offset + (addr - mapping.begin),
+        )
+            .hash(&mut hasher);
+        ManagedPhysicalMemoryAddr::from(hasher.finish() & ((1 << 48) - 1))
+    }
+
     pub fn is_running(&self) -> bool {
         self.runnable().is_some()
     }
@@ -1480,11 +1667,10 @@ impl Process {
     /// FIXME: still needed? Time is now updated more granularly in the Thread code
     /// when xferring control to/from shim.
     fn set_shared_time(host: &Host) {
-        let mut host_shmem = host.shim_shmem_lock_borrow_mut().unwrap();
-        host_shmem.max_runahead_time = Worker::max_event_runahead_time(host);
-        host.shim_shmem()
-            .sim_time
-            .store(Worker::current_time().unwrap(), Ordering::Relaxed);
+        host.shim_shmem().time.store(
+            Worker::current_time().unwrap(),
+            Worker::max_event_runahead_time(host),
+        );
     }
 
     /// Deprecated wrapper for `RunnableProcess::shmem`
@@ -1574,6 +1760,7 @@ impl UnsafeBorrow {
             std::mem::transmute::<ProcessMemoryRef<'_, u8>, ProcessMemoryRef<'static, u8>>(memory)
         };
         let vptr = memory.as_ptr() as *mut c_void;
+        runnable.has_unsafe_borrows.set(true);
         runnable.unsafe_borrows.borrow_mut().push(Self {
             _manager: manager,
             _memory: memory,
@@ -1610,6 +1797,7 @@ impl UnsafeBorrow {
         assert_eq!(std::mem::size_of::<c_char>(), std::mem::size_of::<u8>());
         let ptr = memory.as_ptr() as *const c_char;
         let len = memory.len();
+        runnable.has_unsafe_borrows.set(true);
         runnable.unsafe_borrows.borrow_mut().push(Self {
             _manager: manager,
             _memory: memory,
@@ -1664,6 +1852,7 @@ impl UnsafeBorrowMut {
             )
         };
         let vptr = memory.as_mut_ptr() as *mut c_void;
+        runnable.has_unsafe_borrows.set(true);
         let prev = runnable.unsafe_borrow_mut.borrow_mut().replace(Self {
             _manager: manager,
             memory: Some(memory),
@@ -1699,6 +1888,7 @@ impl UnsafeBorrowMut {
             )
         };
         let vptr = memory.as_mut_ptr() as *mut c_void;
+        runnable.has_unsafe_borrows.set(true);
         let prev = runnable.unsafe_borrow_mut.borrow_mut().replace(Self {
             _manager: manager,
             memory: Some(memory),
@@ -2053,6 +2243,24 @@ mod export {
         .unwrap()
     }
 
+    /// Mark the process's memory as mergeable by the kernel, if the host is configured to. Called
+    /// after the MemoryManager has been initialized. `thread` must be running and ready to make
+    /// native syscalls.
+    #[no_mangle]
+    pub unsafe extern "C" fn process_initMemoryMergingIfNeeded(
+        proc: *const Process,
+        thread: *const Thread,
+    ) {
+        let process = unsafe { proc.as_ref().unwrap() };
+        let thread = unsafe { thread.as_ref().unwrap() };
+        Worker::with_active_host(|host| {
+            if host.params.use_memory_merging {
+                merging::enable(&ThreadContext::new(host, process, thread));
+            }
+        })
+        .unwrap()
+    }
+
     /// Returns the processID that was assigned to us in process_new
     #[no_mangle]
     pub unsafe extern "C" fn process_getProcessID(proc: *const Process) -> libc::pid_t {
@@ -2104,7 +2312,8 @@ mod export {
     pub unsafe extern "C" fn process_straceFd(proc: *const Process) -> RawFd {
         let proc = unsafe { proc.as_ref().unwrap() };
         match &proc.runnable().unwrap().strace_logging {
-            Some(x) => x.file.borrow().as_raw_fd(),
+            Some(StraceLogging::Text { file, .. }) => file.borrow().as_raw_fd(),
+            Some(StraceLogging::Binary { file }) => file.borrow().get_ref().as_raw_fd(),
             None => -1,
         }
     }
@@ -2211,6 +2420,15 @@ mod export {
         proc.physical_address(vptr)
     }
 
+    #[no_mangle]
+    pub unsafe extern "C" fn process_getSharedPhysicalAddress(
+        proc: *const Process,
+        vptr: UntypedForeignPtr,
+    ) -> ManagedPhysicalMemoryAddr {
+        let proc = unsafe { proc.as_ref().unwrap() };
+        proc.shared_physical_address(vptr)
+    }
+
     /// Send the signal described in `siginfo` to `process`. `currentRunningThread`
     /// should be set if there is one (e.g. if this is being called from a syscall
     /// handler), and NULL otherwise (e.g. when called from a timer expiration event).
@@ -0,0 +1,525 @@
+//! Recording the packets that arrive at a single host, and replaying them to that host with the
+//! rest of the network stubbed out. Enabled with `experimental.record_host` and
+//! `experimental.replay_host`.
+//!
+//! Since everything else that a host does is deterministic, the packets that arrive from the
+//! internet and their arrival times are the host's only inputs from the rest of the simulation.
+//! Replaying them to a host with the same configuration and seed makes the host behave as it did
+//! when it was recorded, without running any of the other hosts. The other hosts are still
+//! registered in the DNS so that their names resolve, but the packets that the host sends to them
+//! during a replay are dropped. Hosts that send multicast or broadcast packets
+//! can't be replayed, since the recording doesn't say which hosts the packets were sent to.
+//!
+//! Each packet event keeps the source host and event id that it had when recorded, and replayed
+//! packets and the tasks that push them don't draw any ids from the host, so the host's own event
+//! and packet ids are the same as in the recorded run. A replayed packet's id (as shown in log
+//! messages) is its source event id rather than the id that the sender gave it, and the packet
+//! doesn't have the delivery statuses that it gained before it arrived.
+//!
+//! The recording is a binary file in the host's data directory. It starts with a header that has
+//! the host's name, followed by one record for each packet in the order that the host received
+//! them. All integers are little-endian.
+
+use std::fs::File;
+use std::io::{BufReader, BufWriter, Read, Write};
+use std::net::{Ipv4Addr, SocketAddrV4};
+use std::path::Path;
+
+use anyhow::Context;
+use atomic_refcell::AtomicRefCell;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+use shadow_shim_helper_rs::HostId;
+
+use crate::core::work::event::Event;
+use crate::core::work::task::TaskRef;
+use crate::cshadow as c;
+use crate::host::host::Host;
+use crate::network::packet::PacketRc;
+
+/// The name of the recording in the recorded host's data directory.
+pub const RECORDING_FILE_NAME: &str = "packets.recording";
+
+const MAGIC: &[u8; 8] = b"SHDWREC\0";
+const VERSION: u32 = 2;
+
+/// The largest payload that a record can have, which is the largest UDP payload. TCP payloads are
+/// smaller.
+const MAX_PAYLOAD_LEN: usize = 65507;
+
+/// Packets that arrive within this many milliseconds of the next packet to replay are added to the
+/// host's event queue together, so that the replay doesn't run a task for every packet.
+const REPLAY_BATCH_MILLIS: u64 = 10;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+struct TcpRecord {
+    flags: u32,
+    seq: u32,
+    ack: u32,
+    window: u32,
+    window_scale: Option<u8>,
+    /// The raw `CSimulationTime` values, which are kept exactly.
+    timestamp: u64,
+    timestamp_echo: u64,
+}
+
+/// One received packet.
+#[derive(Debug, Clone, PartialEq, Eq)]
+struct PacketRecord {
+    /// The time the packet arrived, relative to the start of the simulation.
+    time: SimulationTime,
+    /// The host that sent the packet and the event id on that host, which order the packet among
+    /// other packets arriving at the same time.
+    source: (HostId, u64),
+    src: SocketAddrV4,
+    dst: SocketAddrV4,
+    priority: u64,
+    /// `None` for a UDP packet.
+    tcp: Option<TcpRecord>,
+    /// Flattened pairs of sequence numbers.
+    selective_acks: Vec<u32>,
+    payload: Vec<u8>,
+}
+
+impl PacketRecord {
+    fn from_packet(packet: &PacketRc, time: EmulatedTime, source: (HostId, u64)) -> Option<Self> {
+        let ptr = packet.borrow_inner();
+        let protocol = unsafe { c::packet_getProtocol(ptr) };
+
+        let (tcp, selective_acks) = match protocol {
+            c::_ProtocolType_PUDP => (None, Vec::new()),
+            c::_ProtocolType_PTCP => {
+                let header = unsafe { c::packet_getTCPHeader(ptr).as_ref() }.unwrap();
+                let tcp = TcpRecord {
+                    flags: header.flags,
+                    seq: header.sequence,
+                    ack: header.acknowledgment,
+                    window: header.window,
+                    window_scale: header.windowScaleSet.then_some(header.windowScale),
+                    timestamp: header.timestampValue,
+                    timestamp_echo: header.timestampEcho,
+                };
+
+                let mut num_selective_acks = 0;
+                let selective_acks =
+                    unsafe { c::packet_getTCPSelectiveACKs(ptr, &mut num_selective_acks) };
+                let selective_acks = unsafe {
+                    std::slice::from_raw_parts(
+                        selective_acks,
+                        num_selective_acks.try_into().unwrap(),
+                    )
+                };
+
+                (Some(tcp), selective_acks.to_vec())
+            }
+            // only tcp and udp packets go through the internet
+            _ => return None,
+        };
+
+        Some(Self {
+            time: time - EmulatedTime::SIMULATION_START,
+            source,
+            src: packet.src_address(),
+            dst: packet.dst_address(),
+            priority: packet.priority(),
+            tcp,
+            selective_acks,
+            payload: packet.payload_bytes().to_vec(),
+        })
+    }
+
+    /// Build the packet, without drawing a packet id from the host.
+    fn to_packet(&self) -> PacketRc {
+        let mut packet = PacketRc::new_with_id(self.source.0, self.source.1);
+        let ptr = packet.borrow_inner();
+        let ip = |addr: &SocketAddrV4| u32::from(*addr.ip()).to_be();
+        let port = |addr: &SocketAddrV4| addr.port().to_be();
+
+        match &self.tcp {
+            None => packet.set_udp(self.src, self.dst),
+            Some(tcp) => unsafe {
+                c::packet_setTCP(
+                    ptr,
+                    tcp.flags,
+                    ip(&self.src),
+                    port(&self.src),
+                    ip(&self.dst),
+                    port(&self.dst),
+                    tcp.seq,
+                );
+                c::packet_updateTCP(
+                    ptr,
+                    tcp.ack,
+                    tcp.window,
+                    tcp.window_scale.unwrap_or(0),
+                    tcp.window_scale.is_some(),
+                    tcp.timestamp,
+                    tcp.timestamp_echo,
+                );
+                c::packet_setTCPSelectiveACKs(
+                    ptr,
+                    self.selective_acks.as_ptr(),
+                    self.selective_acks.len().try_into().unwrap(),
+                );
+            },
+        }
+
+        packet.set_payload(&self.payload, self.priority);
+        packet
+    }
+
+    fn write(&self, w: &mut impl Write) -> std::io::Result<()> {
+        w.write_all(&u64::try_from(self.time.as_nanos()).unwrap().to_le_bytes())?;
+        w.write_all(&u32::from(self.source.0).to_le_bytes())?;
+        w.write_all(&self.source.1.to_le_bytes())?;
+        w.write_all(&[u8::from(self.tcp.is_some())])?;
+        for addr in [&self.src, &self.dst] {
+            w.write_all(&u32::from(*addr.ip()).to_le_bytes())?;
+            w.write_all(&addr.port().to_le_bytes())?;
+        }
+        w.write_all(&self.priority.to_le_bytes())?;
+
+        if let Some(tcp) = &self.tcp {
+            for x in [tcp.flags, tcp.seq, tcp.ack, tcp.window] {
+                w.write_all(&x.to_le_bytes())?;
+            }
+            w.write_all(&[
+                u8::from(tcp.window_scale.is_some()),
+                tcp.window_scale.unwrap_or(0),
+            ])?;
+            w.write_all(&tcp.timestamp.to_le_bytes())?;
+            w.write_all(&tcp.timestamp_echo.to_le_bytes())?;
+            w.write_all(
+                &u32::try_from(self.selective_acks.len())
+                    .unwrap()
+                    .to_le_bytes(),
+            )?;
+            for x in &self.selective_acks {
+                w.write_all(&x.to_le_bytes())?;
+            }
+        }
+
+        w.write_all(&u32::try_from(self.payload.len()).unwrap().to_le_bytes())?;
+        w.write_all(&self.payload)
+    }
+
+    /// Read the next record, or `None` at the end of the recording.
+    fn read(r: &mut impl Read) -> std::io::Result<Option<Self>> {
+        let mut time = [0; 8];
+        // the end of the file is only expected between records; a truncated record fails below
+        match r.read_exact(&mut time) {
+            Ok(()) => {}
+            Err(e) if e.kind() == std::io::ErrorKind::UnexpectedEof => return Ok(None),
+            Err(e) => return Err(e),
+        }
+        let time = SimulationTime::from_nanos(u64::from_le_bytes(time));
+        let source = (HostId::from(read_u32(r)?), read_u64(r)?);
+
+        let is_tcp = read_u8(r)? != 0;
+        let mut addr = || -> std::io::Result<SocketAddrV4> {
+            let ip = Ipv4Addr::from(read_u32(r)?);
+            let mut port = [0; 2];
+            r.read_exact(&mut port)?;
+            Ok(SocketAddrV4::new(ip, u16::from_le_bytes(port)))
+        };
+        let src = addr()?;
+        let dst = addr()?;
+        let priority = read_u64(r)?;
+
+        let mut selective_acks = Vec::new();
+        let tcp = if is_tcp {
+            let flags = read_u32(r)?;
+            let seq = read_u32(r)?;
+            let ack = read_u32(r)?;
+            let window = read_u32(r)?;
+            let window_scale_set = read_u8(r)? != 0;
+            let window_scale = read_u8(r)?;
+            let timestamp = read_u64(r)?;
+            let timestamp_echo = read_u64(r)?;
+            for _ in 0..read_u32(r)? {
+                selective_acks.push(read_u32(r)?);
+            }
+            Some(TcpRecord {
+                flags,
+                seq,
+                ack,
+                window,
+                window_scale: window_scale_set.then_some(window_scale),
+                timestamp,
+                timestamp_echo,
+            })
+        } else {
+            None
+        };
+
+        // don't trust a corrupt length with a huge allocation
+        let payload_len: usize = read_u32(r)?.try_into().unwrap();
+        if payload_len > MAX_PAYLOAD_LEN {
+            return Err(std::io::Error::new(
+                std::io::ErrorKind::InvalidData,
+                format!("Payload of {payload_len} bytes is larger than any packet"),
+            ));
+        }
+        let mut payload = vec![0; payload_len];
+        r.read_exact(&mut payload)?;
+
+        Ok(Some(Self {
+            time,
+            source,
+            src,
+            dst,
+            priority,
+            tcp,
+            selective_acks,
+            payload,
+        }))
+    }
+}
+
+fn read_u8(r: &mut impl Read) -> std::io::Result<u8> {
+    let mut buf = [0; 1];
+    r.read_exact(&mut buf)?;
+    Ok(buf[0])
+}
+
+fn read_u32(r: &mut impl Read) -> std::io::Result<u32> {
+    let mut buf = [0; 4];
+    r.read_exact(&mut buf)?;
+    Ok(u32::from_le_bytes(buf))
+}
+
+fn read_u64(r: &mut impl Read) -> std::io::Result<u64> {
+    let mut buf = [0; 8];
+    r.read_exact(&mut buf)?;
+    Ok(u64::from_le_bytes(buf))
+}
+
+fn write_header(w: &mut impl Write, host_name: &str) -> std::io::Result<()> {
+    w.write_all(MAGIC)?;
+    w.write_all(&VERSION.to_le_bytes())?;
+    w.write_all(&u32::try_from(host_name.len()).unwrap().to_le_bytes())?;
+    w.write_all(host_name.as_bytes())
+}
+
+/// Read the header and return the recorded host's name.
+fn read_header(r: &mut impl Read) -> anyhow::Result<String> {
+    let mut magic = [0; MAGIC.len()];
+    r.read_exact(&mut magic)?;
+    anyhow::ensure!(&magic == MAGIC, "Not a host recording");
+    let version = read_u32(r)?;
+    anyhow::ensure!(
+        version == VERSION,
+        "Unsupported host recording version {version}"
+    );
+    let mut name = vec![0; read_u32(r)?.try_into().unwrap()];
+    r.read_exact(&mut name)?;
+    Ok(String::from_utf8(name)?)
+}
+
+/// The name of the host that a recording is of.
+pub fn recorded_host_name(path: &Path) -> anyhow::Result<String> {
+    let mut file = BufReader::new(File::open(path)?);
+    read_header(&mut file).with_context(|| format!("Invalid host recording '{}'", path.display()))
+}
+
+/// Records the packets that arrive at a host.
+#[derive(Debug)]
+pub struct PacketRecorder {
+    file: BufWriter<File>,
+}
+
+impl PacketRecorder {
+    /// Create the recording [`RECORDING_FILE_NAME`] in `dir`.
+    pub fn new(dir: &Path, host_name: &str) -> std::io::Result<Self> {
+        let mut file = BufWriter::new(File::create(dir.join(RECORDING_FILE_NAME))?);
+        write_header(&mut file, host_name)?;
+        Ok(Self { file })
+    }
+
+    /// Record a packet that arrived from the internet at `time`, with the source host and event id
+    /// of its packet event. Errors are logged rather than returned, since they shouldn't stop the
+    /// simulation.
+    pub fn record(&mut self, packet: &PacketRc, time: EmulatedTime, source: (HostId, u64)) {
+        let Some(record) = PacketRecord::from_packet(packet, time, source) else {
+            return;
+        };
+        if let Err(e) = record.write(&mut self.file) {
+            log::warn!("Could not record a packet: {e}");
+        }
+    }
+
+    pub fn flush(&mut self) {
+        if let Err(e) = self.file.flush() {
+            log::warn!("Could not flush the packet recording: {e}");
+        }
+    }
+}
+
+/// Replays a recording to a host.
+#[derive(Debug)]
+pub struct PacketReplayer {
+    file: BufReader<File>,
+    /// The next record, which hasn't been added to the host's event queue yet.
+    next: Option<PacketRecord>,
+    /// The event id of the next task that pushes a batch. These count down from `u64::MAX` so that
+    /// they're never drawn by the host.
+    next_task_id: u64,
+}
+
+impl PacketReplayer {
+    pub fn new(path: &Path) -> anyhow::Result<Self> {
+        let mut file = BufReader::new(File::open(path)?);
+        read_header(&mut file)
+            .with_context(|| format!("Invalid host recording '{}'", path.display()))?;
+        let next = PacketRecord::read(&mut file)?;
+        Ok(Self {
+            file,
+            next,
+            next_task_id: u64::MAX,
+        })
+    }
+
+    /// Schedule the replay on the host. The replayer is moved into the host's tasks. Must be
+    /// called before the host is booted, so that a batch at the start of the simulation is pushed
+    /// before the host's own events.
+    pub fn start(self, host: &Host) {
+        if let Some(time) = self.next_time() {
+            Self::schedule(self, host, Self::batch_task_time(time));
+        }
+    }
+
+    /// The time to push the batch that starts with a packet arriving at `first`. This is strictly
+    /// before the packet (except at the start of the simulation), so that the packet events take
+    /// their place among the host's other events at that time as they did when recorded, rather
+    /// than after the events that were already queued.
+    fn batch_task_time(first: EmulatedTime) -> EmulatedTime {
+        std::cmp::max(
+            first - SimulationTime::NANOSECOND,
+            EmulatedTime::SIMULATION_START,
+        )
+    }
+
+    fn next_time(&self) -> Option<EmulatedTime> {
+        self.next
+            .as_ref()
+            .map(|x| EmulatedTime::SIMULATION_START + x.time)
+    }
+
+    fn schedule(mut replayer: Self, host: &Host, time: EmulatedTime) {
+        let event_id = replayer.next_task_id;
+        replayer.next_task_id -= 1;
+
+        // tasks are `Fn`, so the replayer is taken out of a cell when it runs
+        let replayer = AtomicRefCell::new(Some(replayer));
+        let task = TaskRef::new(move |host| {
+            if let Some(replayer) = replayer.borrow_mut().take() {
+                replayer.push_batch(host);
+            }
+        });
+        host.push_local_event(Event::new_local_with_reserved_id(task, time, event_id));
+    }
+
+    /// Add the packets that arrive within [`REPLAY_BATCH_MILLIS`] to the host's event queue as
+    /// packet events, and schedule the next batch.
+    fn push_batch(mut self, host: &Host) {
+        let batch_time = SimulationTime::from_millis(REPLAY_BATCH_MILLIS);
+        let Some(batch_end) = self.next_time().map(|x| x + batch_time) else {
+            return;
+        };
+
+        while let Some(time) = self.next_time().filter(|x| *x < batch_end) {
+            let record = self.next.take().unwrap();
+            let event = Event::new_packet_with_source(record.to_packet(), time, record.source);
+            host.push_local_event(event);
+
+            self.next = match PacketRecord::read(&mut self.file) {
+                Ok(x) => x,
+                Err(e) => {
+                    log::warn!("Stopping the replay after an unreadable packet record: {e}");
+                    None
+                }
+            };
+        }
+
+        // the next packet is at or after this batch's end, which is after the current time
+        if let Some(time) = self.next_time() {
+            Self::schedule(self, host, Self::batch_task_time(time));
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_record_round_trip() {
+        let udp = PacketRecord {
+            time: SimulationTime::from_nanos(5),
+            source: (HostId::from(2), 9),
+            src: "1.2.3.4:1000".parse().unwrap(),
+            dst: "5.6.7.8:2000".parse().unwrap(),
+            priority: 3,
+            tcp: None,
+            selective_acks: Vec::new(),
+            payload: b"hello".to_vec(),
+        };
+        let tcp = PacketRecord {
+            time: SimulationTime::from_nanos(1_000_000_007),
+            tcp: Some(TcpRecord {
+                flags: 1 << 3,
+                seq: 10,
+                ack: 20,
+                window: 30,
+                window_scale: Some(7),
+                timestamp: 40,
+                timestamp_echo: 50,
+            }),
+            selective_acks: vec![1, 2, 3, 4],
+            payload: Vec::new(),
+            ..udp.clone()
+        };
+
+        let mut bytes = Vec::new();
+        write_header(&mut bytes, "server").unwrap();
+        udp.write(&mut bytes).unwrap();
+        tcp.write(&mut bytes).unwrap();
+
+        let mut r = bytes.as_slice();
+        assert_eq!(read_header(&mut r).unwrap(), "server");
+        assert_eq!(PacketRecord::read(&mut r).unwrap(), Some(udp));
+        assert_eq!(PacketRecord::read(&mut r).unwrap(), Some(tcp));
+        assert_eq!(PacketRecord::read(&mut r).unwrap(), None);
+    }
+
+    #[test]
+    fn test_bad_header() {
+        let mut r: &[u8] = b"SHDWREC\0\x09\0\0\0";
+        assert!(read_header(&mut r).is_err());
+        let mut r: &[u8] = b"notarecording";
+        assert!(read_header(&mut r).is_err());
+    }
+
+    #[test]
+    fn test_payload_len_is_capped() {
+        let record = PacketRecord {
+            time: SimulationTime::from_nanos(5),
+            source: (HostId::from(2), 9),
+            src: "1.2.3.4:1000".parse().unwrap(),
+            dst: "5.6.7.8:2000".parse().unwrap(),
+            priority: 3,
+            tcp: None,
+            selective_acks: Vec::new(),
+            payload: Vec::new(),
+        };
+        let mut bytes = Vec::new();
+        record.write(&mut bytes).unwrap();
+
+        // replace the payload length with one that's too large
+        let len = bytes.len();
+        bytes[len - 4..].copy_from_slice(&u32::MAX.to_le_bytes());
+
+        let err = PacketRecord::read(&mut bytes.as_slice()).unwrap_err();
+        assert_eq!(err.kind(), std::io::ErrorKind::InvalidData);
+    }
+}
@@ -7,7 +7,9 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -18,6 +20,8 @@
 #include "main/host/process.h"
 #include "main/host/syscall/kernel_types.h"
 #include "main/host/syscall/protected.h"
+#include "main/host/syscall_condition.h"
+#include "main/utility/syscall.h"
 
 ///////////////////////////////////////////////////////////
 // Helpers
@@ -47,6 +51,68 @@ static int _syscallhandler_validateFileHelper(SysCallHandler* sys, int filefd,
     return 0;
 }
 
+void _syscallhandler_openNativeFileInPlugin(SysCallHandler* sys, int fd, RegularFile* file,
+                                            int cloexec) {
+    const Host* host = _syscallhandler_getHost(sys);
+    const Thread* thread = _syscallhandler_getThread(sys);
+
+    if (!host_useNativeFileIO(host) ||
+        !regularfile_isRegularFileInDir(file, host_getDataPath(host))) {
+        return;
+    }
+
+    /* The plugin's native fds are separate from its Shadow fds, so the fd number may already be
+     * in use natively (for example by the shim). */
+    long rv = thread_nativeSyscall(thread, SYS_fcntl, fd, F_GETFD);
+    if (syscall_rawReturnValueToErrno(rv) != EBADF) {
+        trace("Not opening file %i natively since the fd is in use in the plugin", fd);
+        return;
+    }
+
+    int pluginFD = _syscallhandler_openPluginFile(sys, fd, file);
+    if (pluginFD < 0) {
+        return;
+    }
+
+    /* Move the plugin's fd to the same number as the Shadow fd. */
+    if (pluginFD == fd) {
+        rv = thread_nativeSyscall(thread, SYS_fcntl, fd, F_SETFD, cloexec ? FD_CLOEXEC : 0);
+    } else {
+        rv = thread_nativeSyscall(thread, SYS_dup3, pluginFD, fd, cloexec);
+        _syscallhandler_closePluginFile(sys, pluginFD);
+    }
+    if (syscall_rawReturnValueToErrno(rv)) {
+        trace("Unable to move plugin fd %i to %i", pluginFD, fd);
+        if (pluginFD == fd) {
+            _syscallhandler_closePluginFile(sys, fd);
+        }
+        return;
+    }
+
+    /* The plugin's fd has its own open file description, so take a copy of it for Shadow's
+     * OS-backed file. Then the file offset and status flags are the same whether a syscall runs
+     * natively or in Shadow, for example on a dup of the fd. */
+    int sharedFD = -1;
+#if defined(SYS_pidfd_open) && defined(SYS_pidfd_getfd)
+    int pidfd = syscall(SYS_pidfd_open, process_getNativePid(_syscallhandler_getProcess(sys)), 0);
+    if (pidfd >= 0) {
+        sharedFD = syscall(SYS_pidfd_getfd, pidfd, fd, 0);
+        close(pidfd);
+    }
+#endif
+    if (sharedFD < 0) {
+        debug("Unable to share file %i with the plugin (%s); falling back to handling the file "
+              "in Shadow",
+              fd, strerror(errno));
+        _syscallhandler_closePluginFile(sys, fd);
+        return;
+    }
+
+    regularfile_replaceOSBackedFD(file, sharedFD);
+    descriptor_setNativeInPlugin(thread_getRegisteredDescriptorMut(thread, fd), true);
+    trace("File %i is open natively in the plugin", fd);
+}
+
 static SyscallReturn _syscallhandler_openHelper(SysCallHandler* sys, UntypedForeignPtr pathnamePtr,
                                                 int flags, mode_t mode) {
     trace("Trying to open file with path name at plugin addr %p",
@@ -75,6 +141,7 @@ static SyscallReturn _syscallhandler_openHelper(SysCallHandler* sys, UntypedFore
     utility_debugAssert(errcode == 0);
     Descriptor* desc = descriptor_fromLegacyFile((LegacyFile*)filed, flags & O_CLOEXEC);
     int handle = thread_registerDescriptor(_syscallhandler_getThread(sys), desc);
+    _syscallhandler_openNativeFileInPlugin(sys, handle, filed, flags & O_CLOEXEC);
     return syscallreturn_makeDoneI64(handle);
 }
 
@@ -86,6 +153,15 @@ static SyscallReturn _syscallhandler_fsyncHelper(SysCallHandler* sys, int fd) {
         return syscallreturn_makeDoneErrno(-errcode);
     }
 
+    /* Block until the host's disk model says the sync is done, and then sync the real file. */
+    const Host* host = _syscallhandler_getHost(sys);
+    if (host_usesFileIOModel(host) && regularfile_supportsFileIO(file_desc) &&
+        !_syscallhandler_wasBlocked(sys)) {
+        CEmulatedTime done = host_startFileSync(host);
+        return syscallreturn_makeBlocked(syscallcondition_newWithAbsTimeout(done),
+                                         legacyfile_supportsSaRestart((LegacyFile*)file_desc));
+    }
+
     return syscallreturn_makeDoneI64(regularfile_fsync(file_desc));
 }
 
@@ -106,6 +182,10 @@ SyscallReturn syscallhandler_open(SysCallHandler* sys, const SysCallArgs* args)
 
 SyscallReturn syscallhandler_fstat(SysCallHandler* sys, const SysCallArgs* args) {
     int fd = args->args[0].as_i64;
+
+    if (_syscallhandler_isNativeInPlugin(sys, fd)) {
+        return syscallreturn_makeNative();
+    }
     UntypedForeignPtr bufPtr = args->args[1].as_ptr; // struct stat*
 
     /* Get and validate the file descriptor. */
@@ -371,6 +451,10 @@ SyscallReturn syscallhandler_readahead(SysCallHandler* sys, const SysCallArgs* a
 
 SyscallReturn syscallhandler_lseek(SysCallHandler* sys, const SysCallArgs* args) {
     int fd = args->args[0].as_i64;
+
+    if (_syscallhandler_isNativeInPlugin(sys, fd)) {
+        return syscallreturn_makeNative();
+    }
     off_t offset = args->args[1].as_u64;
     int whence = args->args[2].as_i64;
 
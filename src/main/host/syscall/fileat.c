@@ -139,6 +139,7 @@ SyscallReturn syscallhandler_openat(SysCallHandler* sys, const SysCallArgs* args
     utility_debugAssert(errcode == 0);
     Descriptor* desc = descriptor_fromLegacyFile((LegacyFile*)file_desc, flags & O_CLOEXEC);
     int handle = thread_registerDescriptor(_syscallhandler_getThread(sys), desc);
+    _syscallhandler_openNativeFileInPlugin(sys, handle, file_desc, flags & O_CLOEXEC);
     return syscallreturn_makeDoneI64(handle);
 }
 
@@ -3,11 +3,11 @@ use std::fmt::Display;
 use std::marker::PhantomData;
 
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
-use shadow_shim_helper_rs::syscall_types::SysCallReg;
+use shadow_shim_helper_rs::syscall_types::{SysCallArgs, SysCallReg};
 use shadow_shim_helper_rs::util::time::TimeParts;
 
 use crate::host::memory_manager::MemoryManager;
-use crate::host::syscall_types::{SyscallError, SyscallResult};
+use crate::host::syscall_types::{SyscallError, SyscallResult, SyscallReturn};
 use crate::host::thread::ThreadId;
 
 #[derive(Copy, Clone, Debug, PartialEq, Eq)]
@@ -16,6 +16,18 @@ pub enum FmtOptions {
     Deterministic,
 }
 
+/// How a process's syscalls are written to its strace file.
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum StraceOutput {
+    /// Each syscall is written as a line of text, with its arguments and return value decoded
+    /// using these options.
+    Text(FmtOptions),
+    /// Each syscall is written as a binary record (see [`write_syscall_binary`]), which doesn't
+    /// read the plugin's memory or format anything. Decode the file with
+    /// `src/tools/decode-strace.py`.
+    Binary,
+}
+
 // this type is required until we no longer need to access the format options from C
 #[derive(Copy, Clone, Debug, PartialEq, Eq)]
 #[repr(C)]
@@ -265,6 +277,51 @@ pub fn write_syscall(
     writeln!(writer, "{sim_time} [tid {tid}] {name}({args}) = {rv}")
 }
 
+/// The first bytes of a binary strace file. The last byte is the version of the format.
+pub const STRACE_BINARY_MAGIC: &[u8; 8] = b"SHDWSTR\x01";
+
+/// Write the syscall as a binary record. Syscalls that blocked aren't written, since they'll be
+/// run again later.
+///
+/// Each record is the little-endian `u64` sim time in nanoseconds, `u32` thread id, `i64` syscall
+/// number, six `u64` arguments, a `u8` that is 0 if the syscall completed or 1 if it was run
+/// natively, and the `i64` return value (0 if run natively).
+pub fn write_syscall_binary(
+    mut writer: impl std::io::Write,
+    sim_time: &EmulatedTime,
+    tid: ThreadId,
+    args: &SysCallArgs,
+    rv: &SyscallReturn,
+) -> std::io::Result<()> {
+    let (kind, rv): (u8, i64) = match rv {
+        SyscallReturn::Done(done) => (0, done.retval.into()),
+        SyscallReturn::Native => (1, 0),
+        SyscallReturn::Block(_) => return Ok(()),
+    };
+
+    let sim_time = sim_time.duration_since(&EmulatedTime::SIMULATION_START);
+    let sim_time = u64::try_from(sim_time.as_nanos()).unwrap();
+
+    let mut record = [0u8; 77];
+    let mut offset = 0;
+    let mut put = |bytes: &[u8]| {
+        record[offset..][..bytes.len()].copy_from_slice(bytes);
+        offset += bytes.len();
+    };
+    put(&sim_time.to_le_bytes());
+    put(&u32::try_from(libc::pid_t::from(tid)).unwrap().to_le_bytes());
+    put(&args.number.to_le_bytes());
+    for arg in args.args {
+        put(&u64::from(arg).to_le_bytes());
+    }
+    put(&[kind]);
+    put(&rv.to_le_bytes());
+    assert_eq!(offset, record.len());
+
+    // a single write so that records from processes sharing the file aren't interleaved
+    writer.write_all(&record)
+}
+
 mod export {
     use std::ffi::CStr;
 
@@ -23,9 +23,19 @@
 // Helpers
 ///////////////////////////////////////////////////////////
 
+// Convert the virtual ptr to a physical ptr that can uniquely identify the futex. A futex that
+// isn't private to the process may be in memory shared with other processes.
+static ManagedPhysicalMemoryAddr _syscallhandler_futexPhysicalAddress(SysCallHandler* sys,
+                                                                      UntypedForeignPtr futexVPtr,
+                                                                      bool isPrivate) {
+    const Process* proc = _syscallhandler_getProcess(sys);
+    return isPrivate ? process_getPhysicalAddress(proc, futexVPtr)
+                     : process_getSharedPhysicalAddress(proc, futexVPtr);
+}
+
 static SyscallReturn _syscallhandler_futexWaitHelper(SysCallHandler* sys,
-                                                     UntypedForeignPtr futexVPtr, int expectedVal,
-                                                     UntypedForeignPtr timeoutVPtr,
+                                                     UntypedForeignPtr futexVPtr, bool isPrivate,
+                                                     int expectedVal, UntypedForeignPtr timeoutVPtr,
                                                      TimeoutType type) {
     // This is a new wait operation on the futex for this thread.
     // Check if a timeout was given in the syscall args.
@@ -60,9 +70,8 @@ static SyscallReturn _syscallhandler_futexWaitHelper(SysCallHandler* sys,
         return syscallreturn_makeDoneErrno(EAGAIN);
     }
 
-    // Convert the virtual ptr to a physical ptr that can uniquely identify the futex
     ManagedPhysicalMemoryAddr futexPPtr =
-        process_getPhysicalAddress(_syscallhandler_getProcess(sys), futexVPtr);
+        _syscallhandler_futexPhysicalAddress(sys, futexVPtr, isPrivate);
 
     // Check if we already have a futex
     FutexTable* ftable = host_getFutexTable(_syscallhandler_getHost(sys));
@@ -72,6 +81,11 @@ static SyscallReturn _syscallhandler_futexWaitHelper(SysCallHandler* sys,
         utility_debugAssert(futex != NULL);
         int result = 0;
 
+        // This thread is no longer blocked in a wait, so the shim of this process no longer needs
+        // to pass its wakes to us on its account.
+        shimshmem_removeFutexWaiter(
+            process_getSharedMem(_syscallhandler_getProcess(sys)), futexVPtr.val);
+
         // We already blocked on wait, so this is either a timeout or wakeup
         if (timeoutSimTime != SIMTIME_INVALID && _syscallhandler_didListenTimeoutExpire(sys)) {
             // Timeout while waiting for a wakeup
@@ -118,14 +132,18 @@ static SyscallReturn _syscallhandler_futexWaitHelper(SysCallHandler* sys,
                                                 : timeoutSimTime;
         syscallcondition_setTimeout(cond, timeoutEmulatedTime);
     }
+    // Until this thread is woken, the shim of this process must pass wakes on this address to us.
+    // The count is kept in the waiting thread's process and removed by the same thread above, so
+    // it stays balanced even when the futex is shared with other processes.
+    shimshmem_addFutexWaiter(process_getSharedMem(_syscallhandler_getProcess(sys)), futexVPtr.val);
     return syscallreturn_makeBlocked(cond, true);
 }
 
 static SyscallReturn _syscallhandler_futexWakeHelper(SysCallHandler* sys,
-                                                     UntypedForeignPtr futexVPtr, int numWakeups) {
-    // Convert the virtual ptr to a physical ptr that can uniquely identify the futex
+                                                     UntypedForeignPtr futexVPtr, bool isPrivate,
+                                                     int numWakeups) {
     ManagedPhysicalMemoryAddr futexPPtr =
-        process_getPhysicalAddress(_syscallhandler_getProcess(sys), futexVPtr);
+        _syscallhandler_futexPhysicalAddress(sys, futexVPtr, isPrivate);
 
     // Lookup the futex in the futex table
     FutexTable* ftable = host_getFutexTable(_syscallhandler_getHost(sys));
@@ -147,10 +165,9 @@ static SyscallReturn _syscallhandler_futexWakeHelper(SysCallHandler* sys,
 // System Calls
 ///////////////////////////////////////////////////////////
 
-// TODO: currently only supports uaddr from the same virtual address space (i.e., threads)
-// Support across different address spaces requires us to compute a unique id from the
-// hardware address (i.e., page table and offset). This is needed, e.g., when using
-// futexes across process boundaries.
+// Futexes without FUTEX_PRIVATE_FLAG are identified by the file and offset that they're mapped
+// from if they're in a MAP_SHARED mapping, so that they can be used across process boundaries.
+// Other futexes are only identified within the virtual address space of their process.
 SyscallReturn syscallhandler_futex(SysCallHandler* sys, const SysCallArgs* args) {
     utility_debugAssert(sys && args);
 
@@ -165,6 +182,8 @@ SyscallReturn syscallhandler_futex(SysCallHandler* sys, const SysCallArgs* args)
     int options = futex_op & possible_options;
     int operation = futex_op & ~possible_options;
 
+    bool isPrivate = options & FUTEX_PRIVATE_FLAG;
+
     trace("futex called with addr=%p op=%i (operation=%i and options=%i) and val=%i",
           (void*)uaddrptr.val, futex_op, operation, options, val);
 
@@ -172,19 +191,19 @@ SyscallReturn syscallhandler_futex(SysCallHandler* sys, const SysCallArgs* args)
         case FUTEX_WAIT: {
             trace("Handling FUTEX_WAIT operation %i", operation);
             return _syscallhandler_futexWaitHelper(
-                sys, uaddrptr, val, timeoutptr, TIMEOUT_RELATIVE);
+                sys, uaddrptr, isPrivate, val, timeoutptr, TIMEOUT_RELATIVE);
         }
 
         case FUTEX_WAKE: {
             trace("Handling FUTEX_WAKE operation %i", operation);
-            return _syscallhandler_futexWakeHelper(sys, uaddrptr, val);
+            return _syscallhandler_futexWakeHelper(sys, uaddrptr, isPrivate, val);
         }
 
         case FUTEX_WAIT_BITSET: {
             trace("Handling FUTEX_WAIT_BITSET operation %i bitset %d", operation, val3);
             if (val3 == FUTEX_BITSET_MATCH_ANY) {
                 return _syscallhandler_futexWaitHelper(
-                    sys, uaddrptr, val, timeoutptr, TIMEOUT_ABSOLUTE);
+                    sys, uaddrptr, isPrivate, val, timeoutptr, TIMEOUT_ABSOLUTE);
             }
             // Other bitsets not yet handled.
             break;
@@ -192,7 +211,7 @@ SyscallReturn syscallhandler_futex(SysCallHandler* sys, const SysCallArgs* args)
         case FUTEX_WAKE_BITSET: {
             trace("Handling FUTEX_WAKE_BITSET operation %i bitset %d", operation, val3);
             if (val3 == FUTEX_BITSET_MATCH_ANY) {
-                return _syscallhandler_futexWakeHelper(sys, uaddrptr, val);
+                return _syscallhandler_futexWakeHelper(sys, uaddrptr, isPrivate, val);
             }
             // Other bitsets not yet handled.
             break;
@@ -75,6 +75,10 @@ impl SyscallHandler {
 
             handled_flags.insert(CloneFlags::CLONE_THREAD);
         } else {
+            // The mapper's regions are `MAP_SHARED` mappings of a memfd, so a natively forked child
+            // would share them with the parent. Re-mapping them as `MAP_PRIVATE` in the child
+            // isn't enough, since the parent's later writes would still be visible in the pages
+            // that the child hasn't written to yet.
             if ctx.objs.process.memory_borrow().has_mapper() {
                 warn!("Fork with memory mapper unimplemented");
                 return Err(Errno::ENOTSUP.into());
@@ -110,7 +114,8 @@ impl SyscallHandler {
             // Child gets a reference to the same table.
             RootedRc::clone(ctx.objs.thread.descriptor_table(), ctx.objs.host.root())
         } else {
-            // Child gets a *copy* of the table.
+            // Child gets a *copy* of the table. This only copies the descriptors, which share
+            // their open files with the parent's descriptors.
             let root = ctx.objs.host.root();
             let table: DescriptorTable = ctx
                 .objs
@@ -72,13 +72,18 @@ impl SyscallHandler {
         let mut desc = Descriptor::new(CompatFile::New(OpenFile::new(File::EventFd(file))));
         desc.set_flags(descriptor_flags);
 
-        let fd = ctx
-            .objs
-            .thread
-            .descriptor_table_borrow_mut(ctx.objs.host)
+        let mut desc_table = ctx.objs.thread.descriptor_table_borrow_mut(ctx.objs.host);
+        let fd = desc_table
             .register_descriptor(desc)
             .or(Err(Errno::ENFILE))?;
 
+        // let the shim handle the reads and writes that don't need to go through us
+        desc_table.get_mut(fd).unwrap().share_eventfd_with_shim(
+            ctx.objs.host,
+            ctx.objs.process.id(),
+            fd,
+        );
+
         log::trace!("eventfd() returning fd {}", fd);
 
         Ok(fd.val().try_into().unwrap())
@@ -7,7 +7,7 @@ use syscall_logger::log_syscall;
 use crate::cshadow;
 use crate::host::descriptor::{CompatFile, File, FileStatus};
 use crate::host::syscall::handler::{SyscallContext, SyscallHandler};
-use crate::host::syscall_types::SyscallResult;
+use crate::host::syscall_types::{SyscallError, SyscallResult};
 
 impl SyscallHandler {
     #[log_syscall(/* rv */ std::ffi::c_int, /* fd */ std::ffi::c_int, /* cmd */ std::ffi::c_int)]
@@ -137,6 +137,11 @@ impl SyscallHandler {
                 let flags = i32::try_from(arg).or(Err(Errno::EINVAL))?;
                 let flags = DescriptorFlags::from_bits(flags).ok_or(Errno::EINVAL)?;
                 desc.set_flags(flags);
+                // keep the managed process's native copy of the descriptor in sync, so that
+                // both are closed (or not) on exec
+                if desc.is_native_in_plugin() {
+                    return Err(SyscallError::Native);
+                }
                 SysCallReg::from(0)
             }
             FcntlCommand::F_DUPFD => {
@@ -17,6 +17,7 @@ mod ioctl;
 mod mman;
 mod random;
 mod sched;
+mod sendfile;
 mod socket;
 mod sysinfo;
 mod time;
@@ -28,92 +29,144 @@ mod wait;
 type LegacySyscallFn =
     unsafe extern "C" fn(*mut c::SysCallHandler, *const SysCallArgs) -> SyscallReturn;
 
+/// The remaining work of a blocked syscall. When the syscall is resumed, this is run instead of
+/// the syscall's handler so that the handler doesn't need to re-read its arguments from plugin
+/// memory and redo its validation. See [`SyscallContext::set_continuation`].
+pub type SyscallContinuation = Box<dyn FnMut(&mut SyscallContext) -> SyscallResult>;
+
 pub struct SyscallHandler {
-    // Will eventually contain syscall handler state once migrated from the c handler
+    /// The continuation of the currently blocked syscall, and the syscall number it's for.
+    continuation: Option<(libc::c_long, SyscallContinuation)>,
 }
 
 impl SyscallHandler {
     #[allow(clippy::new_without_default)]
     pub fn new() -> SyscallHandler {
-        SyscallHandler {}
+        SyscallHandler { continuation: None }
     }
 
-    pub fn syscall(&self, mut ctx: SyscallContext) -> SyscallResult {
-        match ctx.args.number {
-            libc::SYS_accept => SyscallHandlerFn::call(Self::accept, &mut ctx),
-            libc::SYS_accept4 => SyscallHandlerFn::call(Self::accept4, &mut ctx),
-            libc::SYS_bind => SyscallHandlerFn::call(Self::bind, &mut ctx),
-            libc::SYS_brk => SyscallHandlerFn::call(Self::brk, &mut ctx),
-            libc::SYS_clock_getres => SyscallHandlerFn::call(Self::clock_getres, &mut ctx),
-            libc::SYS_clock_nanosleep => SyscallHandlerFn::call(Self::clock_nanosleep, &mut ctx),
-            libc::SYS_clone => SyscallHandlerFn::call(Self::clone, &mut ctx),
-            libc::SYS_clone3 => SyscallHandlerFn::call(Self::clone3, &mut ctx),
-            libc::SYS_close => SyscallHandlerFn::call(Self::close, &mut ctx),
-            libc::SYS_connect => SyscallHandlerFn::call(Self::connect, &mut ctx),
-            libc::SYS_dup => SyscallHandlerFn::call(Self::dup, &mut ctx),
-            libc::SYS_dup2 => SyscallHandlerFn::call(Self::dup2, &mut ctx),
-            libc::SYS_dup3 => SyscallHandlerFn::call(Self::dup3, &mut ctx),
-            libc::SYS_eventfd => SyscallHandlerFn::call(Self::eventfd, &mut ctx),
-            libc::SYS_eventfd2 => SyscallHandlerFn::call(Self::eventfd2, &mut ctx),
-            libc::SYS_fcntl => SyscallHandlerFn::call(Self::fcntl, &mut ctx),
-            libc::SYS_fork => SyscallHandlerFn::call(Self::fork, &mut ctx),
-            libc::SYS_getitimer => SyscallHandlerFn::call(Self::getitimer, &mut ctx),
-            libc::SYS_getpeername => SyscallHandlerFn::call(Self::getpeername, &mut ctx),
-            libc::SYS_getpgid => SyscallHandlerFn::call(Self::getpgid, &mut ctx),
-            libc::SYS_getpgrp => SyscallHandlerFn::call(Self::getpgrp, &mut ctx),
-            libc::SYS_getppid => SyscallHandlerFn::call(Self::getppid, &mut ctx),
-            libc::SYS_getrandom => SyscallHandlerFn::call(Self::getrandom, &mut ctx),
-            libc::SYS_getsid => SyscallHandlerFn::call(Self::getsid, &mut ctx),
-            libc::SYS_getsockname => SyscallHandlerFn::call(Self::getsockname, &mut ctx),
-            libc::SYS_getsockopt => SyscallHandlerFn::call(Self::getsockopt, &mut ctx),
-            libc::SYS_gettid => SyscallHandlerFn::call(Self::gettid, &mut ctx),
-            libc::SYS_ioctl => SyscallHandlerFn::call(Self::ioctl, &mut ctx),
-            libc::SYS_listen => SyscallHandlerFn::call(Self::listen, &mut ctx),
-            libc::SYS_mmap => SyscallHandlerFn::call(Self::mmap, &mut ctx),
-            libc::SYS_mprotect => SyscallHandlerFn::call(Self::mprotect, &mut ctx),
-            libc::SYS_mremap => SyscallHandlerFn::call(Self::mremap, &mut ctx),
-            libc::SYS_munmap => SyscallHandlerFn::call(Self::munmap, &mut ctx),
-            libc::SYS_nanosleep => SyscallHandlerFn::call(Self::nanosleep, &mut ctx),
-            libc::SYS_open => SyscallHandlerFn::call(Self::open, &mut ctx),
-            libc::SYS_openat => SyscallHandlerFn::call(Self::openat, &mut ctx),
-            libc::SYS_pipe => SyscallHandlerFn::call(Self::pipe, &mut ctx),
-            libc::SYS_pipe2 => SyscallHandlerFn::call(Self::pipe2, &mut ctx),
-            libc::SYS_pread64 => SyscallHandlerFn::call(Self::pread64, &mut ctx),
-            libc::SYS_preadv => SyscallHandlerFn::call(Self::preadv, &mut ctx),
-            libc::SYS_preadv2 => SyscallHandlerFn::call(Self::preadv2, &mut ctx),
-            libc::SYS_pwrite64 => SyscallHandlerFn::call(Self::pwrite64, &mut ctx),
-            libc::SYS_pwritev => SyscallHandlerFn::call(Self::pwritev, &mut ctx),
-            libc::SYS_pwritev2 => SyscallHandlerFn::call(Self::pwritev2, &mut ctx),
-            libc::SYS_rseq => SyscallHandlerFn::call(Self::rseq, &mut ctx),
-            libc::SYS_read => SyscallHandlerFn::call(Self::read, &mut ctx),
-            libc::SYS_readv => SyscallHandlerFn::call(Self::readv, &mut ctx),
-            libc::SYS_recvfrom => SyscallHandlerFn::call(Self::recvfrom, &mut ctx),
-            libc::SYS_recvmsg => SyscallHandlerFn::call(Self::recvmsg, &mut ctx),
-            libc::SYS_sched_getaffinity => {
-                SyscallHandlerFn::call(Self::sched_getaffinity, &mut ctx)
+    pub fn syscall(&mut self, mut ctx: SyscallContext) -> SyscallResult {
+        // the thread only has a syscall condition if its previous syscall blocked; otherwise the
+        // syscall was completed or interrupted, and any old continuation is stale
+        let was_blocked = ctx.objs.thread.syscall_condition().is_some();
+
+        // drop a stale continuation now rather than after the syscall is dispatched, since it may
+        // be keeping a file open that the syscall closes
+        let continuation = self
+            .continuation
+            .take()
+            .filter(|(number, _)| was_blocked && *number == ctx.args.number);
+
+        let result = match continuation {
+            Some((_, mut continuation)) => {
+                let result = continuation(&mut ctx);
+                // keep running the same continuation if it blocked again without replacing itself
+                if ctx.continuation.is_none() {
+                    ctx.continuation = Some(continuation);
+                }
+                result
             }
-            libc::SYS_sched_setaffinity => {
-                SyscallHandlerFn::call(Self::sched_setaffinity, &mut ctx)
+            None => self.dispatch(&mut ctx),
+        };
+
+        // only keep the continuation if the syscall will be resumed, and not when strace logging is
+        // enabled since the continuation would bypass the handler's logging
+        if matches!(result, Err(SyscallError::Blocked(_)))
+            && ctx.objs.process.strace_logging_options().is_none()
+            && !Self::will_be_interrupted(&ctx)
+        {
+            if let Some(continuation) = ctx.continuation.take() {
+                self.continuation = Some((ctx.args.number, continuation));
             }
-            libc::SYS_sched_yield => SyscallHandlerFn::call(Self::sched_yield, &mut ctx),
-            libc::SYS_sendmsg => SyscallHandlerFn::call(Self::sendmsg, &mut ctx),
-            libc::SYS_sendto => SyscallHandlerFn::call(Self::sendto, &mut ctx),
-            libc::SYS_setitimer => SyscallHandlerFn::call(Self::setitimer, &mut ctx),
-            libc::SYS_setpgid => SyscallHandlerFn::call(Self::setpgid, &mut ctx),
-            libc::SYS_setsid => SyscallHandlerFn::call(Self::setsid, &mut ctx),
-            libc::SYS_setsockopt => SyscallHandlerFn::call(Self::setsockopt, &mut ctx),
-            libc::SYS_shutdown => SyscallHandlerFn::call(Self::shutdown, &mut ctx),
-            libc::SYS_socket => SyscallHandlerFn::call(Self::socket, &mut ctx),
-            libc::SYS_socketpair => SyscallHandlerFn::call(Self::socketpair, &mut ctx),
-            libc::SYS_sysinfo => SyscallHandlerFn::call(Self::sysinfo, &mut ctx),
-            libc::SYS_timerfd_create => SyscallHandlerFn::call(Self::timerfd_create, &mut ctx),
-            libc::SYS_timerfd_gettime => SyscallHandlerFn::call(Self::timerfd_gettime, &mut ctx),
-            libc::SYS_timerfd_settime => SyscallHandlerFn::call(Self::timerfd_settime, &mut ctx),
-            libc::SYS_vfork => SyscallHandlerFn::call(Self::vfork, &mut ctx),
-            libc::SYS_waitid => SyscallHandlerFn::call(Self::waitid, &mut ctx),
-            libc::SYS_wait4 => SyscallHandlerFn::call(Self::wait4, &mut ctx),
-            libc::SYS_write => SyscallHandlerFn::call(Self::write, &mut ctx),
-            libc::SYS_writev => SyscallHandlerFn::call(Self::writev, &mut ctx),
+        }
+
+        result
+    }
+
+    /// Whether a blocked syscall will instead be interrupted with `EINTR` since a signal is
+    /// pending. This is checked by the C syscall handler after the syscall returns.
+    fn will_be_interrupted(ctx: &SyscallContext) -> bool {
+        let host_shmem = ctx.objs.host.shim_shmem_lock_borrow().unwrap();
+        ctx.objs
+            .thread
+            .unblocked_signal_pending(ctx.objs.process, &host_shmem)
+    }
+
+    fn dispatch(&self, ctx: &mut SyscallContext) -> SyscallResult {
+        match ctx.args.number {
+            libc::SYS_accept => SyscallHandlerFn::call(Self::accept, ctx),
+            libc::SYS_accept4 => SyscallHandlerFn::call(Self::accept4, ctx),
+            libc::SYS_bind => SyscallHandlerFn::call(Self::bind, ctx),
+            libc::SYS_brk => SyscallHandlerFn::call(Self::brk, ctx),
+            libc::SYS_clock_getres => SyscallHandlerFn::call(Self::clock_getres, ctx),
+            libc::SYS_clock_nanosleep => SyscallHandlerFn::call(Self::clock_nanosleep, ctx),
+            libc::SYS_clone => SyscallHandlerFn::call(Self::clone, ctx),
+            libc::SYS_clone3 => SyscallHandlerFn::call(Self::clone3, ctx),
+            libc::SYS_close => SyscallHandlerFn::call(Self::close, ctx),
+            libc::SYS_connect => SyscallHandlerFn::call(Self::connect, ctx),
+            libc::SYS_dup => SyscallHandlerFn::call(Self::dup, ctx),
+            libc::SYS_dup2 => SyscallHandlerFn::call(Self::dup2, ctx),
+            libc::SYS_dup3 => SyscallHandlerFn::call(Self::dup3, ctx),
+            libc::SYS_eventfd => SyscallHandlerFn::call(Self::eventfd, ctx),
+            libc::SYS_eventfd2 => SyscallHandlerFn::call(Self::eventfd2, ctx),
+            libc::SYS_fcntl => SyscallHandlerFn::call(Self::fcntl, ctx),
+            libc::SYS_fork => SyscallHandlerFn::call(Self::fork, ctx),
+            libc::SYS_getitimer => SyscallHandlerFn::call(Self::getitimer, ctx),
+            libc::SYS_getpeername => SyscallHandlerFn::call(Self::getpeername, ctx),
+            libc::SYS_getpgid => SyscallHandlerFn::call(Self::getpgid, ctx),
+            libc::SYS_getpgrp => SyscallHandlerFn::call(Self::getpgrp, ctx),
+            libc::SYS_getppid => SyscallHandlerFn::call(Self::getppid, ctx),
+            libc::SYS_getrandom => SyscallHandlerFn::call(Self::getrandom, ctx),
+            libc::SYS_getsid => SyscallHandlerFn::call(Self::getsid, ctx),
+            libc::SYS_getsockname => SyscallHandlerFn::call(Self::getsockname, ctx),
+            libc::SYS_getsockopt => SyscallHandlerFn::call(Self::getsockopt, ctx),
+            libc::SYS_gettid => SyscallHandlerFn::call(Self::gettid, ctx),
+            libc::SYS_ioctl => SyscallHandlerFn::call(Self::ioctl, ctx),
+            libc::SYS_listen => SyscallHandlerFn::call(Self::listen, ctx),
+            libc::SYS_mmap => SyscallHandlerFn::call(Self::mmap, ctx),
+            libc::SYS_mprotect => SyscallHandlerFn::call(Self::mprotect, ctx),
+            libc::SYS_mremap => SyscallHandlerFn::call(Self::mremap, ctx),
+            libc::SYS_munmap => SyscallHandlerFn::call(Self::munmap, ctx),
+            libc::SYS_nanosleep => SyscallHandlerFn::call(Self::nanosleep, ctx),
+            libc::SYS_open => SyscallHandlerFn::call(Self::open, ctx),
+            libc::SYS_openat => SyscallHandlerFn::call(Self::openat, ctx),
+            libc::SYS_pipe => SyscallHandlerFn::call(Self::pipe, ctx),
+            libc::SYS_pipe2 => SyscallHandlerFn::call(Self::pipe2, ctx),
+            libc::SYS_pread64 => SyscallHandlerFn::call(Self::pread64, ctx),
+            libc::SYS_preadv => SyscallHandlerFn::call(Self::preadv, ctx),
+            libc::SYS_preadv2 => SyscallHandlerFn::call(Self::preadv2, ctx),
+            libc::SYS_pwrite64 => SyscallHandlerFn::call(Self::pwrite64, ctx),
+            libc::SYS_pwritev => SyscallHandlerFn::call(Self::pwritev, ctx),
+            libc::SYS_pwritev2 => SyscallHandlerFn::call(Self::pwritev2, ctx),
+            libc::SYS_rseq => SyscallHandlerFn::call(Self::rseq, ctx),
+            libc::SYS_read => SyscallHandlerFn::call(Self::read, ctx),
+            libc::SYS_readv => SyscallHandlerFn::call(Self::readv, ctx),
+            libc::SYS_recvfrom => SyscallHandlerFn::call(Self::recvfrom, ctx),
+            libc::SYS_recvmmsg => SyscallHandlerFn::call(Self::recvmmsg, ctx),
+            libc::SYS_recvmsg => SyscallHandlerFn::call(Self::recvmsg, ctx),
+            libc::SYS_sched_getaffinity => SyscallHandlerFn::call(Self::sched_getaffinity, ctx),
+            libc::SYS_sched_setaffinity => SyscallHandlerFn::call(Self::sched_setaffinity, ctx),
+            libc::SYS_sched_yield => SyscallHandlerFn::call(Self::sched_yield, ctx),
+            libc::SYS_sendfile => SyscallHandlerFn::call(Self::sendfile, ctx),
+            libc::SYS_sendmmsg => SyscallHandlerFn::call(Self::sendmmsg, ctx),
+            libc::SYS_sendmsg => SyscallHandlerFn::call(Self::sendmsg, ctx),
+            libc::SYS_sendto => SyscallHandlerFn::call(Self::sendto, ctx),
+            libc::SYS_setitimer => SyscallHandlerFn::call(Self::setitimer, ctx),
+            libc::SYS_setpgid => SyscallHandlerFn::call(Self::setpgid, ctx),
+            libc::SYS_setsid => SyscallHandlerFn::call(Self::setsid, ctx),
+            libc::SYS_setsockopt => SyscallHandlerFn::call(Self::setsockopt, ctx),
+            libc::SYS_shutdown => SyscallHandlerFn::call(Self::shutdown, ctx),
+            libc::SYS_socket => SyscallHandlerFn::call(Self::socket, ctx),
+            libc::SYS_socketpair => SyscallHandlerFn::call(Self::socketpair, ctx),
+            libc::SYS_sysinfo => SyscallHandlerFn::call(Self::sysinfo, ctx),
+            libc::SYS_timerfd_create => SyscallHandlerFn::call(Self::timerfd_create, ctx),
+            libc::SYS_timerfd_gettime => SyscallHandlerFn::call(Self::timerfd_gettime, ctx),
+            libc::SYS_timerfd_settime => SyscallHandlerFn::call(Self::timerfd_settime, ctx),
+            libc::SYS_vfork => SyscallHandlerFn::call(Self::vfork, ctx),
+            libc::SYS_waitid => SyscallHandlerFn::call(Self::waitid, ctx),
+            libc::SYS_wait4 => SyscallHandlerFn::call(Self::wait4, ctx),
+            libc::SYS_write => SyscallHandlerFn::call(Self::write, ctx),
+            libc::SYS_writev => SyscallHandlerFn::call(Self::writev, ctx),
             _ => {
                 // if we added a HANDLE_RUST() macro for this syscall in
                 // 'syscallhandler_make_syscall()' but didn't add an entry here, we should get a
@@ -163,6 +216,30 @@ impl SyscallHandler {
 pub struct SyscallContext<'a, 'b> {
     pub objs: &'a mut ThreadContext<'b>,
     pub args: &'a SysCallArgs,
+    /// Set by the handler if the syscall blocks.
+    continuation: Option<SyscallContinuation>,
+}
+
+impl<'a, 'b> SyscallContext<'a, 'b> {
+    pub fn new(objs: &'a mut ThreadContext<'b>, args: &'a SysCallArgs) -> Self {
+        Self {
+            objs,
+            args,
+            continuation: None,
+        }
+    }
+
+    /// Resume the syscall by running `f` rather than the syscall's handler if the syscall returns
+    /// [`SyscallError::Blocked`]. `f` should capture whatever state the handler has already
+    /// parsed and validated. It's discarded if the syscall doesn't block, or if the blocked
+    /// syscall is interrupted rather than resumed. The handler may still be re-run instead (for
+    /// example when strace logging is enabled), so it must also handle being resumed itself.
+    pub fn set_continuation(
+        &mut self,
+        f: impl FnMut(&mut SyscallContext) -> SyscallResult + 'static,
+    ) {
+        self.continuation = Some(Box::new(f));
+    }
 }
 
 pub trait SyscallHandlerFn<T> {
@@ -321,10 +398,7 @@ mod export {
             let mut objs =
                 unsafe { ThreadContextObjs::from_syscallhandler(host, notnull_mut_debug(csys)) };
             objs.with_ctx(|ctx| {
-                let ctx = SyscallContext {
-                    objs: ctx,
-                    args: unsafe { args.as_ref().unwrap() },
-                };
+                let ctx = SyscallContext::new(ctx, unsafe { args.as_ref().unwrap() });
                 sys.syscall(ctx).into()
             })
         })
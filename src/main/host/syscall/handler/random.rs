@@ -1,6 +1,5 @@
 use linux_api::errno::Errno;
 use log::*;
-use rand::RngCore;
 use shadow_shim_helper_rs::syscall_types::ForeignPtr;
 use syscall_logger::log_syscall;
 
@@ -33,8 +32,7 @@ impl SyscallHandler {
         };
 
         // Get random bytes using host rng to maintain determinism.
-        let mut rng = ctx.objs.host.random_mut();
-        rng.fill_bytes(&mut mem_ref);
+        ctx.objs.host.fill_random_bytes(&mut mem_ref);
 
         // We must flush the memory reference to write it back.
         match mem_ref.flush() {
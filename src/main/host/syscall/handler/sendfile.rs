@@ -0,0 +1,210 @@
+use bytes::Bytes;
+use linux_api::errno::Errno;
+use linux_api::posix_types::kernel_off_t;
+use shadow_shim_helper_rs::syscall_types::ForeignPtr;
+use syscall_logger::log_syscall;
+
+use crate::cshadow as c;
+use crate::host::descriptor::socket::inet::legacy_tcp::LegacyTcpSocket;
+use crate::host::descriptor::socket::inet::InetSocket;
+use crate::host::descriptor::socket::Socket;
+use crate::host::descriptor::{CompatFile, File, FileState, FileStatus, LegacyFileCounter};
+use crate::host::syscall::handler::{SyscallContext, SyscallHandler};
+use crate::host::syscall_types::SyscallError;
+use crate::utility::callback_queue::CallbackQueue;
+
+/// The most bytes read from the input file at a time. A TCP socket accepts at most 65535 bytes per
+/// send, so larger chunks would mostly be re-read.
+const SENDFILE_CHUNK_SIZE: usize = 1 << 16;
+
+/// Linux transfers at most this many bytes in a single `sendfile()` call.
+const SENDFILE_MAX_COUNT: usize = 0x7ffff000;
+
+impl SyscallHandler {
+    #[log_syscall(/* rv */ isize, /* out_fd */ std::ffi::c_int, /* in_fd */ std::ffi::c_int,
+                  /* offset */ *const kernel_off_t, /* count */ usize)]
+    pub fn sendfile(
+        ctx: &mut SyscallContext,
+        out_fd: std::ffi::c_int,
+        in_fd: std::ffi::c_int,
+        offset_ptr: ForeignPtr<kernel_off_t>,
+        count: usize,
+    ) -> Result<isize, SyscallError> {
+        // if we were previously blocked, get the active file from the last syscall handler
+        // invocation since it may no longer exist in the descriptor table
+        let out_file = ctx
+            .objs
+            .thread
+            .syscall_condition()
+            .and_then(|x| x.active_file().cloned());
+
+        let (out_file, in_file) = {
+            let desc_table = ctx.objs.thread.descriptor_table_borrow(ctx.objs.host);
+
+            let out_file = match out_file {
+                // we were previously blocked, so re-use the file from the previous syscall
+                // invocation
+                Some(x) => x,
+                None => match Self::get_descriptor(&desc_table, out_fd)?.file() {
+                    CompatFile::New(file) => file.clone(),
+                    CompatFile::Legacy(_) => {
+                        log::warn!("sendfile() to a legacy file is not supported");
+                        return Err(Errno::ENOSYS.into());
+                    }
+                },
+            };
+
+            // the input must be a file that supports mmap-like operations, which for us is a
+            // regular file
+            let in_file = match Self::get_descriptor(&desc_table, in_fd)?.file() {
+                CompatFile::Legacy(file)
+                    if unsafe { c::legacyfile_getType(file.ptr()) }
+                        == c::_LegacyFileType_DT_FILE =>
+                {
+                    file.clone()
+                }
+                _ => return Err(Errno::EINVAL.into()),
+            };
+
+            (out_file, in_file)
+        };
+
+        // only pipes and legacy TCP sockets can be written to from shadow's memory
+        match out_file.inner_file() {
+            File::Pipe(_) | File::Socket(Socket::Inet(InetSocket::LegacyTcp(_))) => {}
+            _ => {
+                log::warn!("sendfile() to this file type is not supported");
+                return Err(Errno::ENOSYS.into());
+            }
+        }
+
+        let in_file_ptr = in_file.ptr() as *mut c::RegularFile;
+
+        // the position to start reading from
+        let start = if offset_ptr.is_null() {
+            unsafe { c::regularfile_lseek(in_file_ptr, 0, libc::SEEK_CUR) }
+        } else {
+            ctx.objs.process.memory_borrow().read(offset_ptr)?
+        };
+
+        if start < 0 {
+            // an in-memory file won't have an offset
+            return Err(Errno::EINVAL.into());
+        }
+
+        let count = std::cmp::min(count, SENDFILE_MAX_COUNT);
+
+        let mut result = Self::sendfile_helper(ctx, out_file.inner_file(), &in_file, start, count);
+
+        // if the syscall will block, keep the file open until the syscall restarts
+        if let Some(err) = result.as_mut().err() {
+            if let Some(cond) = err.blocked_condition() {
+                cond.set_active_file(out_file);
+            }
+        }
+
+        let bytes_sent = result?;
+
+        // we read from the file without changing its position, so update the position here with
+        // the number of bytes that were actually sent
+        let end = start + kernel_off_t::try_from(bytes_sent).unwrap();
+        if offset_ptr.is_null() {
+            let rv = unsafe { c::regularfile_lseek(in_file_ptr, end, libc::SEEK_SET) };
+            assert_eq!(rv, end);
+        } else {
+            ctx.objs
+                .process
+                .memory_borrow_mut()
+                .write(offset_ptr, &end)?;
+        }
+
+        Ok(bytes_sent.try_into().unwrap())
+    }
+
+    /// Send up to `count` bytes from `in_file` at position `start` to `out_file`. The bytes are
+    /// read into shadow's memory and given to the output file directly, rather than being copied
+    /// in and out of plugin memory.
+    fn sendfile_helper(
+        ctx: &mut SyscallContext,
+        out_file: &File,
+        in_file: &LegacyFileCounter,
+        start: kernel_off_t,
+        count: usize,
+    ) -> Result<usize, SyscallError> {
+        let in_file_ptr = in_file.ptr() as *mut c::RegularFile;
+        let file_status = out_file.borrow().get_status();
+
+        let mut bytes_sent = 0;
+
+        let result = loop {
+            if bytes_sent == count {
+                break Ok(());
+            }
+
+            let len = std::cmp::min(count - bytes_sent, SENDFILE_CHUNK_SIZE);
+            let pos = start + kernel_off_t::try_from(bytes_sent).unwrap();
+
+            let mut buf = vec![0u8; len];
+            let rv = unsafe {
+                c::regularfile_pread(
+                    in_file_ptr,
+                    ctx.objs.host,
+                    buf.as_mut_ptr() as *mut libc::c_void,
+                    len,
+                    pos,
+                )
+            };
+
+            if rv < 0 {
+                break Err(Errno::try_from(-rv).unwrap().into());
+            }
+            if rv == 0 {
+                // end of file
+                break Ok(());
+            }
+
+            buf.truncate(rv.try_into().unwrap());
+            let buf = Bytes::from(buf);
+            let buf_len = buf.len();
+
+            // write the bytes, and run any resulting events
+            let written = crate::utility::legacy_callback_queue::with_global_cb_queue(|| {
+                CallbackQueue::queue_and_run(|cb_queue| match out_file {
+                    File::Pipe(pipe) => pipe.borrow_mut().write_bytes(&buf, cb_queue),
+                    File::Socket(Socket::Inet(InetSocket::LegacyTcp(socket))) => {
+                        LegacyTcpSocket::send_bytes(socket, buf, cb_queue)
+                    }
+                    _ => unreachable!(),
+                })
+            });
+
+            match written {
+                Ok(written) => {
+                    let written: usize = written.try_into().unwrap();
+                    bytes_sent += written;
+                    if written < buf_len {
+                        // the output file is full
+                        break Ok(());
+                    }
+                }
+                Err(e) => break Err(e),
+            }
+        };
+
+        // if we've already sent bytes, return those instead of an error
+        if bytes_sent > 0 {
+            return Ok(bytes_sent);
+        }
+
+        // if the syscall would block and it's a blocking descriptor
+        if result == Err(Errno::EWOULDBLOCK.into()) && !file_status.contains(FileStatus::NONBLOCK) {
+            return Err(SyscallError::new_blocked_on_file(
+                out_file.clone(),
+                FileState::WRITABLE,
+                out_file.borrow().supports_sa_restart(),
+            ));
+        }
+
+        result.map(|()| 0)
+    }
+}
@@ -334,6 +334,41 @@ impl SyscallHandler {
             }
         };
 
+        let mut result =
+            Self::recvfrom_helper(ctx, &file, buf_ptr, buf_len, flags, addr_ptr, addr_len_ptr);
+
+        // if the syscall will block, keep the file open until the syscall restarts
+        if let Some(err) = result.as_mut().err() {
+            if let Some(cond) = err.blocked_condition() {
+                cond.set_active_file(file.clone());
+                // when resumed, retry the recv without looking up the descriptor again
+                ctx.set_continuation(move |ctx| {
+                    Self::recvfrom_helper(
+                        ctx,
+                        &file,
+                        buf_ptr,
+                        buf_len,
+                        flags,
+                        addr_ptr,
+                        addr_len_ptr,
+                    )
+                    .map(Into::into)
+                });
+            }
+        }
+
+        result
+    }
+
+    fn recvfrom_helper(
+        ctx: &mut SyscallContext,
+        file: &OpenFile,
+        buf_ptr: ForeignPtr<u8>,
+        buf_len: libc::size_t,
+        flags: std::ffi::c_int,
+        addr_ptr: ForeignPtr<u8>,
+        addr_len_ptr: ForeignPtr<libc::socklen_t>,
+    ) -> Result<libc::ssize_t, SyscallError> {
         let File::Socket(ref socket) = file.inner_file() else {
             return Err(Errno::ENOTSOCK.into());
         };
@@ -354,27 +389,17 @@ impl SyscallHandler {
         };
 
         // call the socket's recvmsg(), and run any resulting events
-        let mut result = crate::utility::legacy_callback_queue::with_global_cb_queue(|| {
-            CallbackQueue::queue_and_run(|cb_queue| {
-                Socket::recvmsg(socket, args, &mut mem, cb_queue)
-            })
-        });
-
-        // if the syscall will block, keep the file open until the syscall restarts
-        if let Some(err) = result.as_mut().err() {
-            if let Some(cond) = err.blocked_condition() {
-                cond.set_active_file(file);
-            }
-        }
-
         let RecvmsgReturn {
             return_val,
             addr: from_addr,
             ..
-        } = result?;
+        } = crate::utility::legacy_callback_queue::with_global_cb_queue(|| {
+            CallbackQueue::queue_and_run(|cb_queue| {
+                Socket::recvmsg(socket, args, &mut mem, cb_queue)
+            })
+        })?;
 
         if !addr_ptr.is_null() {
-            let addr_ptr = addr_ptr;
             io::write_sockaddr_and_len(&mut mem, from_addr.as_ref(), addr_ptr, addr_len_ptr)?;
         }
 
@@ -462,6 +487,242 @@ impl SyscallHandler {
         Ok(result.return_val)
     }
 
+    #[log_syscall(/* rv */ std::ffi::c_int, /* sockfd */ std::ffi::c_int,
+                  /* msgvec */ *const libc::mmsghdr, /* vlen */ std::ffi::c_uint,
+                  /* flags */ nix::sys::socket::MsgFlags)]
+    pub fn sendmmsg(
+        ctx: &mut SyscallContext,
+        fd: std::ffi::c_int,
+        msgvec_ptr: ForeignPtr<libc::mmsghdr>,
+        vlen: std::ffi::c_uint,
+        flags: std::ffi::c_int,
+    ) -> Result<std::ffi::c_int, SyscallError> {
+        // if we were previously blocked, get the active file from the last syscall handler
+        // invocation since it may no longer exist in the descriptor table
+        let file = ctx
+            .objs
+            .thread
+            .syscall_condition()
+            // if this was for a C descriptor, then there won't be an active file object
+            .and_then(|x| x.active_file().cloned());
+
+        let file = match file {
+            // we were previously blocked, so re-use the file from the previous syscall invocation
+            Some(x) => x,
+            // get the file from the descriptor table, or return early if it doesn't exist
+            None => {
+                let desc_table = ctx.objs.thread.descriptor_table_borrow(ctx.objs.host);
+                match Self::get_descriptor(&desc_table, fd)?.file() {
+                    CompatFile::New(file) => file.clone(),
+                    CompatFile::Legacy(_file) => {
+                        return Err(Errno::ENOTSOCK.into());
+                    }
+                }
+            }
+        };
+
+        let File::Socket(ref socket) = file.inner_file() else {
+            return Err(Errno::ENOTSOCK.into());
+        };
+
+        // sendmmsg(2): "The value specified in vlen is capped to UIO_MAXIOV (1024)."
+        let vlen = std::cmp::min(vlen, libc::UIO_MAXIOV.try_into().unwrap());
+
+        if vlen == 0 {
+            return Ok(0);
+        }
+
+        let mut mem = ctx.objs.process.memory_borrow_mut();
+        let mut rng = ctx.objs.host.random_mut();
+        let net_ns = ctx.objs.host.network_namespace_borrow();
+
+        let msgvec = ForeignArrayPtr::new(msgvec_ptr, vlen.try_into().unwrap());
+        let msgs = io::read_mmsghdrs(&mem, msgvec)?;
+
+        // the messages that were sent, and the number of bytes sent for each
+        let mut sent = Vec::with_capacity(msgs.len());
+
+        // call the socket's sendmsg() for each message, and run any resulting events
+        let result = crate::utility::legacy_callback_queue::with_global_cb_queue(|| {
+            CallbackQueue::queue_and_run(|cb_queue| -> Result<(), SyscallError> {
+                for msg in msgs {
+                    let addr = match io::read_sockaddr(&mem, msg.name, msg.name_len) {
+                        Ok(x) => x,
+                        // as below, the messages sent so far are still returned
+                        Err(_) if !sent.is_empty() => break,
+                        Err(e) => return Err(e.into()),
+                    };
+
+                    let args = SendmsgArgs {
+                        addr,
+                        iovs: &msg.iovs,
+                        control_ptr: ForeignArrayPtr::new(msg.control, msg.control_len),
+                        // only the first message may block; we return the messages sent so far
+                        // rather than blocking partway through the batch
+                        flags: if sent.is_empty() {
+                            flags
+                        } else {
+                            flags | libc::MSG_DONTWAIT
+                        },
+                    };
+
+                    match Socket::sendmsg(socket, args, &mut mem, &net_ns, &mut *rng, cb_queue) {
+                        Ok(bytes_sent) => {
+                            sent.push((msg, bytes_sent.try_into().unwrap()));
+                        }
+                        // sendmmsg(2): "If an error occurs after at least one message has been
+                        // sent, the call succeeds, and returns the number of messages sent."
+                        Err(_) if !sent.is_empty() => break,
+                        Err(e) => return Err(e),
+                    }
+                }
+
+                Ok(())
+            })
+        });
+
+        // if the syscall will block, keep the file open until the syscall restarts
+        if let Err(mut err) = result {
+            if let Some(cond) = err.blocked_condition() {
+                cond.set_active_file(file);
+            }
+            return Err(err);
+        }
+
+        // write the number of bytes sent for each message back to the plugin
+        io::update_mmsghdrs(&mut mem, msgvec_ptr, &sent)?;
+
+        Ok(sent.len().try_into().unwrap())
+    }
+
+    #[log_syscall(/* rv */ std::ffi::c_int, /* sockfd */ std::ffi::c_int,
+                  /* msgvec */ *const libc::mmsghdr, /* vlen */ std::ffi::c_uint,
+                  /* flags */ nix::sys::socket::MsgFlags,
+                  /* timeout */ *const linux_api::time::timespec)]
+    pub fn recvmmsg(
+        ctx: &mut SyscallContext,
+        fd: std::ffi::c_int,
+        msgvec_ptr: ForeignPtr<libc::mmsghdr>,
+        vlen: std::ffi::c_uint,
+        flags: std::ffi::c_int,
+        _timeout_ptr: ForeignPtr<linux_api::time::timespec>,
+    ) -> Result<std::ffi::c_int, SyscallError> {
+        // if we were previously blocked, get the active file from the last syscall handler
+        // invocation since it may no longer exist in the descriptor table
+        let file = ctx
+            .objs
+            .thread
+            .syscall_condition()
+            // if this was for a C descriptor, then there won't be an active file object
+            .and_then(|x| x.active_file().cloned());
+
+        let file = match file {
+            // we were previously blocked, so re-use the file from the previous syscall invocation
+            Some(x) => x,
+            // get the file from the descriptor table, or return early if it doesn't exist
+            None => {
+                let desc_table = ctx.objs.thread.descriptor_table_borrow(ctx.objs.host);
+                match Self::get_descriptor(&desc_table, fd)?.file() {
+                    CompatFile::New(file) => file.clone(),
+                    CompatFile::Legacy(_file) => {
+                        return Err(Errno::ENOTSOCK.into());
+                    }
+                }
+            }
+        };
+
+        let File::Socket(ref socket) = file.inner_file() else {
+            return Err(Errno::ENOTSOCK.into());
+        };
+
+        // recvmmsg(2) isn't capped like sendmmsg(2) is, but it also uses UIO_MAXIOV internally
+        let vlen = std::cmp::min(vlen, libc::UIO_MAXIOV.try_into().unwrap());
+
+        if vlen == 0 {
+            return Ok(0);
+        }
+
+        // We always behave as if MSG_WAITFORONE was given: we only block until the first message
+        // is received, and then receive any other messages that are already buffered. Since we
+        // never wait for more messages after the first, the timeout never has any effect.
+        let flags = flags & !libc::MSG_WAITFORONE;
+
+        let mut mem = ctx.objs.process.memory_borrow_mut();
+
+        let msgvec = ForeignArrayPtr::new(msgvec_ptr, vlen.try_into().unwrap());
+        let msgs = io::read_mmsghdrs(&mem, msgvec)?;
+
+        // the messages that were received, and the number of bytes received for each
+        let mut received = Vec::with_capacity(msgs.len());
+
+        // call the socket's recvmsg() for each message, and run any resulting events
+        let result = crate::utility::legacy_callback_queue::with_global_cb_queue(|| {
+            CallbackQueue::queue_and_run(|cb_queue| -> Result<(), SyscallError> {
+                for mut msg in msgs {
+                    let args = RecvmsgArgs {
+                        iovs: &msg.iovs,
+                        control_ptr: ForeignArrayPtr::new(msg.control, msg.control_len),
+                        flags: if received.is_empty() {
+                            flags
+                        } else {
+                            flags | libc::MSG_DONTWAIT
+                        },
+                    };
+
+                    let result = match Socket::recvmsg(socket, args, &mut mem, cb_queue) {
+                        Ok(x) => x,
+                        // recvmmsg(2): "If an error occurs after at least one message has been
+                        // received, the call succeeds, and returns the number of messages
+                        // received."
+                        Err(_) if !received.is_empty() => break,
+                        Err(e) => return Err(e),
+                    };
+
+                    // write the socket address to the plugin and update the length in msg
+                    if !msg.name.is_null() {
+                        if let Some(from_addr) = result.addr.as_ref() {
+                            msg.name_len = match io::write_sockaddr(
+                                &mut mem,
+                                from_addr,
+                                msg.name,
+                                msg.name_len,
+                            ) {
+                                Ok(x) => x,
+                                // like Linux, this message is lost but the messages received
+                                // so far are still returned
+                                Err(_) if !received.is_empty() => break,
+                                Err(e) => return Err(e.into()),
+                            };
+                        } else {
+                            msg.name_len = 0;
+                        }
+                    }
+
+                    // update the control len and flags in msg
+                    msg.control_len = result.control_len;
+                    msg.flags = result.msg_flags;
+
+                    received.push((msg, result.return_val.try_into().unwrap()));
+                }
+
+                Ok(())
+            })
+        });
+
+        // if the syscall will block, keep the file open until the syscall restarts
+        if let Err(mut err) = result {
+            if let Some(cond) = err.blocked_condition() {
+                cond.set_active_file(file);
+            }
+            return Err(err);
+        }
+
+        // write the msgs back to the plugin
+        io::update_mmsghdrs(&mut mem, msgvec_ptr, &received)?;
+
+        Ok(received.len().try_into().unwrap())
+    }
+
     #[log_syscall(/* rv */ std::ffi::c_int, /* sockfd */ std::ffi::c_int, /* addr */ *const libc::sockaddr,
                   /* addrlen */ *const libc::socklen_t)]
     pub fn getsockname(
@@ -616,7 +877,11 @@ impl SyscallHandler {
         // if the syscall will block, keep the file open until the syscall restarts
         if let Some(err) = result.as_mut().err() {
             if let Some(cond) = err.blocked_condition() {
-                cond.set_active_file(file);
+                cond.set_active_file(file.clone());
+                // when resumed, retry the accept without looking up the descriptor again
+                ctx.set_continuation(move |ctx| {
+                    Self::accept_helper(ctx, file.inner_file(), addr_ptr, addr_len_ptr, 0)
+                });
             }
         }
 
@@ -660,7 +925,11 @@ impl SyscallHandler {
         // if the syscall will block, keep the file open until the syscall restarts
         if let Some(err) = result.as_mut().err() {
             if let Some(cond) = err.blocked_condition() {
-                cond.set_active_file(file);
+                cond.set_active_file(file.clone());
+                // when resumed, retry the accept without looking up the descriptor again
+                ctx.set_continuation(move |ctx| {
+                    Self::accept_helper(ctx, file.inner_file(), addr_ptr, addr_len_ptr, flags)
+                });
             }
         }
 
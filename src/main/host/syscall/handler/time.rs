@@ -213,13 +213,34 @@ impl SyscallHandler {
             return Ok(0);
         }
 
-        // Condition will exist after a wakeup.
-        let Some(cond) = ctx.objs.thread.syscall_condition() else {
-            // Didn't sleep yet; block the thread now.
-            return Err(SyscallError::new_blocked_until(abs_wakeup_time, false));
+        // The remaining time isn't written for absolute sleeps.
+        let remain_ptr = if flags.contains(ClockNanosleepFlags::TIMER_ABSTIME) {
+            ForeignPtr::null()
+        } else {
+            remain_ptr
         };
 
+        // Condition will exist after a wakeup.
+        if ctx.objs.thread.syscall_condition().is_some() {
+            return Self::nanosleep_wakeup(ctx, remain_ptr);
+        }
+
+        // Didn't sleep yet; block the thread now. When woken up, we only need to check whether
+        // the sleep completed.
+        ctx.set_continuation(move |ctx| Self::nanosleep_wakeup(ctx, remain_ptr).map(Into::into));
+        Err(SyscallError::new_blocked_until(abs_wakeup_time, false))
+    }
+
+    /// Complete a nanosleep after waking up. The remaining time is written to `remain_ptr` if the
+    /// sleep was interrupted and `remain_ptr` is non-null.
+    fn nanosleep_wakeup(
+        ctx: &mut SyscallContext,
+        remain_ptr: ForeignPtr<linux_api::time::timespec>,
+    ) -> Result<std::ffi::c_int, SyscallError> {
+        let now = Worker::current_time().unwrap();
+
         // Woke up from sleep. We must have set a timeout to sleep.
+        let cond = ctx.objs.thread.syscall_condition().unwrap();
         let expected_wakeup_time = cond.timeout().unwrap();
 
         if expected_wakeup_time <= now {
@@ -227,7 +248,7 @@ impl SyscallHandler {
             Ok(0)
         } else {
             // Possibly write out the remaining time until the expected wakeup.
-            if !remain_ptr.is_null() && !flags.contains(ClockNanosleepFlags::TIMER_ABSTIME) {
+            if !remain_ptr.is_null() {
                 let remain_time =
                     linux_api::time::timespec::try_from(expected_wakeup_time - now).unwrap();
                 ctx.objs
@@ -9,6 +9,7 @@ use shadow_shim_helper_rs::syscall_types::ForeignPtr;
 use syscall_logger::log_syscall;
 
 use crate::cshadow as c;
+use crate::host::descriptor::descriptor_table::DescriptorHandle;
 use crate::host::descriptor::pipe;
 use crate::host::descriptor::shared_buf::SharedBuf;
 use crate::host::descriptor::{CompatFile, Descriptor, File, FileMode, FileStatus, OpenFile};
@@ -36,13 +37,32 @@ impl SyscallHandler {
             .deregister_descriptor(fd)
             .ok_or(linux_api::errno::Errno::EBADF)?;
 
+        let native_in_plugin = desc.is_native_in_plugin();
+
         // if there are still valid descriptors to the open file, close() will do nothing
         // and return None
-        crate::utility::legacy_callback_queue::with_global_cb_queue(|| {
+        let rv = crate::utility::legacy_callback_queue::with_global_cb_queue(|| {
             CallbackQueue::queue_and_run(|cb_queue| desc.close(ctx.objs.host, cb_queue))
                 .unwrap_or(Ok(()))
                 .map(|()| 0.into())
-        })
+        });
+
+        // the managed process also needs to close its native copy of the descriptor, which shares
+        // the open file description with ours, so its result is the one that matters
+        if native_in_plugin {
+            return Err(SyscallError::Native);
+        }
+
+        rv
+    }
+
+    /// Close the managed process's native copy of a descriptor that was replaced by `dup2()` or
+    /// `dup3()`.
+    fn close_replaced_native_fd(ctx: &SyscallContext, fd: DescriptorHandle) {
+        let (proc_ctx, thread) = ctx.objs.split_thread();
+        if let Err(e) = thread.native_close(&proc_ctx, fd.into()) {
+            debug!("Unable to natively close replaced fd {fd}: {e}");
+        }
     }
 
     #[log_syscall(/* rv */ std::ffi::c_int, /* oldfd */ std::ffi::c_int)]
@@ -85,6 +105,10 @@ impl SyscallHandler {
 
         // close the replaced descriptor
         if let Some(replaced_desc) = replaced_desc {
+            if replaced_desc.is_native_in_plugin() {
+                Self::close_replaced_native_fd(ctx, new_fd);
+            }
+
             // from 'man 2 dup2': "If newfd was open, any errors that would have been reported at
             // close(2) time are lost"
             CallbackQueue::queue_and_run(|cb_queue| replaced_desc.close(ctx.objs.host, cb_queue));
@@ -140,6 +164,10 @@ impl SyscallHandler {
 
         // close the replaced descriptor
         if let Some(replaced_desc) = replaced_desc {
+            if replaced_desc.is_native_in_plugin() {
+                Self::close_replaced_native_fd(ctx, new_fd);
+            }
+
             // from 'man 2 dup3': "If newfd was open, any errors that would have been reported at
             // close(2) time are lost"
             CallbackQueue::queue_and_run(|cb_queue| replaced_desc.close(ctx.objs.host, cb_queue));
@@ -216,8 +216,9 @@ impl<'a, I> IoVecReader<'a, I> {
     }
 }
 
-impl<'a, I: Iterator<Item = &'a IoVec>> std::io::Read for IoVecReader<'a, I> {
-    fn read(&mut self, mut buf: &mut [u8]) -> std::io::Result<usize> {
+impl<'a, I: Iterator<Item = &'a IoVec>> IoVecReader<'a, I> {
+    /// Read from each iov separately, stopping at the first iov that can't be read.
+    fn read_each(&mut self, mut buf: &mut [u8]) -> std::io::Result<usize> {
         let mut bytes_read = 0;
 
         loop {
@@ -262,6 +263,32 @@ impl<'a, I: Iterator<Item = &'a IoVec>> std::io::Read for IoVecReader<'a, I> {
     }
 }
 
+impl<'a, I: Iterator<Item = &'a IoVec> + Clone> std::io::Read for IoVecReader<'a, I> {
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        // Read all of the iovs that we need at once, which needs fewer syscalls than reading them
+        // separately if they aren't mapped into shadow.
+        let srcs = next_iov_regions(self.current_src, self.iovs.clone(), buf.len());
+        if srcs.len() > 1 {
+            let total: usize = srcs.iter().map(|src| src.len()).sum();
+            let mut dsts = Vec::with_capacity(srcs.len());
+            let mut rest = &mut buf[..total];
+            for src in &srcs {
+                let (dst, remaining) = std::mem::take(&mut rest).split_at_mut(src.len());
+                dsts.push(dst);
+                rest = remaining;
+            }
+
+            if self.mem.copy_many_from_ptrs(&mut dsts, &srcs).is_ok() {
+                skip_iov_regions(&mut self.current_src, &mut self.iovs, total);
+                return Ok(total);
+            }
+            // fall back to reading the iovs separately to find how many bytes can be read
+        }
+
+        self.read_each(buf)
+    }
+}
+
 /// A writer which writes data to [`IoVec`] buffers of plugin memory. If an error occurs while
 /// writing (for example if an `IoVec` points to an invalid memory address), the error will be
 /// returned only if no bytes have yet been written. If an error occurs after some bytes have
@@ -290,8 +317,9 @@ impl<'a, I> IoVecWriter<'a, I> {
     }
 }
 
-impl<'a, I: Iterator<Item = &'a IoVec>> std::io::Write for IoVecWriter<'a, I> {
-    fn write(&mut self, mut buf: &[u8]) -> std::io::Result<usize> {
+impl<'a, I: Iterator<Item = &'a IoVec>> IoVecWriter<'a, I> {
+    /// Write to each iov separately, stopping at the first iov that can't be written.
+    fn write_each(&mut self, mut buf: &[u8]) -> std::io::Result<usize> {
         let mut bytes_written = 0;
 
         loop {
@@ -334,12 +362,85 @@ impl<'a, I: Iterator<Item = &'a IoVec>> std::io::Write for IoVecWriter<'a, I> {
 
         Ok(bytes_written)
     }
+}
+
+impl<'a, I: Iterator<Item = &'a IoVec> + Clone> std::io::Write for IoVecWriter<'a, I> {
+    fn write(&mut self, buf: &[u8]) -> std::io::Result<usize> {
+        // Write all of the iovs that we need at once, which needs fewer syscalls than writing them
+        // separately if they aren't mapped into shadow.
+        let dsts = next_iov_regions(self.current_dst, self.iovs.clone(), buf.len());
+        if dsts.len() > 1 {
+            let total: usize = dsts.iter().map(|dst| dst.len()).sum();
+            let mut srcs = Vec::with_capacity(dsts.len());
+            let mut rest = &buf[..total];
+            for dst in &dsts {
+                let (src, remaining) = rest.split_at(dst.len());
+                srcs.push(src);
+                rest = remaining;
+            }
+
+            if self.mem.copy_many_to_ptrs(&dsts, &srcs).is_ok() {
+                skip_iov_regions(&mut self.current_dst, &mut self.iovs, total);
+                return Ok(total);
+            }
+            // fall back to writing the iovs separately to find how many bytes can be written
+        }
+
+        self.write_each(buf)
+    }
 
     fn flush(&mut self) -> std::io::Result<()> {
         Ok(())
     }
 }
 
+/// The regions of plugin memory that the next `len` bytes read from or written to a sequence of
+/// iovs would use, starting with `current` (the unused part of the current iov) followed by
+/// `iovs`. Empty regions are skipped.
+fn next_iov_regions<'a>(
+    current: Option<ForeignArrayPtr<u8>>,
+    iovs: impl Iterator<Item = &'a IoVec>,
+    mut len: usize,
+) -> Vec<ForeignArrayPtr<u8>> {
+    let mut regions = Vec::new();
+
+    for region in current.into_iter().chain(iovs.map(|iov| (*iov).into())) {
+        if len == 0 {
+            break;
+        }
+        let region_len = std::cmp::min(region.len(), len);
+        if region_len > 0 {
+            regions.push(region.slice(..region_len));
+            len -= region_len;
+        }
+    }
+
+    regions
+}
+
+/// Advance a reader's or writer's position in a sequence of iovs by `len` bytes, in the same way
+/// as reading or writing `len` bytes would.
+fn skip_iov_regions<'a>(
+    current: &mut Option<ForeignArrayPtr<u8>>,
+    iovs: &mut impl Iterator<Item = &'a IoVec>,
+    mut len: usize,
+) {
+    while len > 0 {
+        let region: ForeignArrayPtr<u8> = match current.take() {
+            Some(region) => region,
+            None => match iovs.next() {
+                Some(iov) => (*iov).into(),
+                None => break,
+            },
+        };
+        let region_len = std::cmp::min(region.len(), len);
+        len -= region_len;
+        if region_len < region.len() {
+            *current = Some(region.slice(region_len..));
+        }
+    }
+}
+
 /// Read a plugin's array of [`libc::iovec`] into a [`Vec<IoVec>`].
 pub fn read_iovecs(
     mem: &MemoryManager,
@@ -400,6 +501,46 @@ pub fn update_msghdr(
     Ok(())
 }
 
+/// Read the plugin's array of [`libc::mmsghdr`] (for example from `sendmmsg()` or `recvmmsg()`)
+/// into [`MsgHdr`]s. The array is read from plugin memory all at once rather than one message at a
+/// time.
+pub fn read_mmsghdrs(
+    mem: &MemoryManager,
+    msgvec: ForeignArrayPtr<libc::mmsghdr>,
+) -> Result<Vec<MsgHdr>, Errno> {
+    let mem_ref = mem.memory_ref(msgvec)?;
+
+    mem_ref
+        .deref()
+        .iter()
+        .map(|x| msghdr_to_rust(&x.msg_hdr, mem))
+        .collect()
+}
+
+/// Used to update the first `msgs.len()` entries of a plugin's array of [`libc::mmsghdr`]. For each
+/// entry, writes the `msg_len` field and the [`libc::msghdr`] fields written by
+/// [`update_msghdr()`].
+pub fn update_mmsghdrs(
+    mem: &mut MemoryManager,
+    msgvec_ptr: ForeignPtr<libc::mmsghdr>,
+    msgs: &[(MsgHdr, std::ffi::c_uint)],
+) -> Result<(), Errno> {
+    let msgvec = ForeignArrayPtr::new(msgvec_ptr, msgs.len());
+    let mut mem_ref = mem.memory_ref_mut(msgvec)?;
+
+    for (plugin_msg, (msg, msg_len)) in mem_ref.deref_mut().iter_mut().zip(msgs) {
+        // write only the msg fields that may have changed
+        plugin_msg.msg_hdr.msg_namelen = msg.name_len;
+        plugin_msg.msg_hdr.msg_controllen = msg.control_len;
+        plugin_msg.msg_hdr.msg_flags = msg.flags;
+        plugin_msg.msg_len = *msg_len;
+    }
+
+    mem_ref.flush()?;
+
+    Ok(())
+}
+
 /// Helper to read a plugin's [`libc::msghdr`] into a [`MsgHdr`]. While `msg` is a local struct, it
 /// should have been copied from plugin memory, meaning any pointers in the struct are pointers to
 /// plugin memory, not local memory.
@@ -113,7 +113,7 @@ static char* _file_createPersistentMMapPath(int file_fd, int osfile_fd) {
     return NULL;
 }
 
-static int _syscallhandler_openPluginFile(SysCallHandler* sys, int fd, RegularFile* file) {
+int _syscallhandler_openPluginFile(SysCallHandler* sys, int fd, RegularFile* file) {
     utility_debugAssert(file);
     int result = 0;
 
@@ -191,7 +191,7 @@ out:
     return result;
 }
 
-static void _syscallhandler_closePluginFile(SysCallHandler* sys, int pluginFD) {
+void _syscallhandler_closePluginFile(SysCallHandler* sys, int pluginFD) {
     /* Instruct the plugin to close the file at given fd. */
     int result = thread_nativeSyscall(_syscallhandler_getThread(sys), SYS_close, pluginFD);
     int err = syscall_rawReturnValueToErrno(result);
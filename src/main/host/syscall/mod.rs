@@ -8,6 +8,59 @@ pub mod type_formatting;
 
 // The helpers defined here are syscall-related but not handler-specific.
 
+/// Syscalls that Shadow's syscall handler always tells the shim to execute natively (the `NATIVE`
+/// entries in `syscallhandler_make_syscall()`), so that the shim's seccomp filter can let them
+/// through without trapping. This excludes `exit`, which Shadow should see so that it can follow
+/// the thread's exit, and `rt_sigreturn`, which the filter always allows.
+pub const NATIVE_SYSCALLS: &[libc::c_long] = &[
+    libc::SYS_access,
+    libc::SYS_arch_prctl,
+    libc::SYS_chmod,
+    libc::SYS_chown,
+    libc::SYS_getcwd,
+    libc::SYS_geteuid,
+    libc::SYS_getegid,
+    libc::SYS_getgid,
+    libc::SYS_getgroups,
+    libc::SYS_getresgid,
+    libc::SYS_getresuid,
+    libc::SYS_getrlimit,
+    libc::SYS_getuid,
+    libc::SYS_getxattr,
+    libc::SYS_lchown,
+    libc::SYS_lgetxattr,
+    libc::SYS_link,
+    libc::SYS_listxattr,
+    libc::SYS_llistxattr,
+    libc::SYS_lremovexattr,
+    libc::SYS_lsetxattr,
+    libc::SYS_lstat,
+    libc::SYS_madvise,
+    libc::SYS_mkdir,
+    libc::SYS_mknod,
+    libc::SYS_readlink,
+    libc::SYS_removexattr,
+    libc::SYS_rename,
+    libc::SYS_rmdir,
+    libc::SYS_setfsgid,
+    libc::SYS_setfsuid,
+    libc::SYS_setgid,
+    libc::SYS_setregid,
+    libc::SYS_setresgid,
+    libc::SYS_setresuid,
+    libc::SYS_setreuid,
+    libc::SYS_setrlimit,
+    libc::SYS_setuid,
+    libc::SYS_setxattr,
+    libc::SYS_stat,
+    libc::SYS_statfs,
+    libc::SYS_symlink,
+    libc::SYS_truncate,
+    libc::SYS_unlink,
+    libc::SYS_utime,
+    libc::SYS_utimes,
+];
+
 pub struct Trigger(c::Trigger);
 
 impl From<c::Trigger> for Trigger {
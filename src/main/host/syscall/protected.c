@@ -42,6 +42,11 @@ bool _syscallhandler_didListenTimeoutExpire(const SysCallHandler* sys) {
 
 bool _syscallhandler_wasBlocked(const SysCallHandler* sys) { return sys->blockedSyscallNR >= 0; }
 
+bool _syscallhandler_isNativeInPlugin(const SysCallHandler* sys, int fd) {
+    const Descriptor* desc = thread_getRegisteredDescriptor(_syscallhandler_getThread(sys), fd);
+    return desc && descriptor_isNativeInPlugin(desc);
+}
+
 int _syscallhandler_validateLegacyFile(LegacyFile* descriptor, LegacyFileType expectedType) {
     if (descriptor) {
         Status status = legacyfile_getStatus(descriptor);
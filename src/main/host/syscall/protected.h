@@ -18,6 +18,7 @@
 #include "lib/shadow-shim-helper-rs/shim_helper.h"
 #include "main/bindings/c/bindings-opaque.h"
 #include "main/host/descriptor/epoll.h"
+#include "main/host/descriptor/regular_file.h"
 #include "main/host/process.h"
 #include "main/host/syscall_handler.h"
 #include "main/host/syscall_types.h"
@@ -60,8 +61,10 @@ struct _SysCallHandler {
     //#endif
     /* The total number of syscalls that we have handled. */
     long numSyscalls;
-    // A counter for individual syscalls
-    Counter* syscall_counter;
+    // A counter for individual syscalls, indexed by syscall number
+    IndexedCounter* syscall_counter;
+    // The counts (including busy-poll elisions) that were already added to the worker's counts.
+    Counter* flushedSyscallCounts;
 
     // In some cases the syscallhandler comples, but we block the caller anyway
     // to move time forward. This stores the result of the completed syscall, to
@@ -69,6 +72,14 @@ struct _SysCallHandler {
     bool havePendingResult;
     SyscallReturn pendingResult;
 
+    // A read or write of a regular file that the blocked syscall started, if any.
+    RegularFilePendingIO* pendingFileIO;
+
+    // The number of consecutive syscalls that found nothing ready without blocking, and the
+    // number of times that we've blocked the thread because it reached the busy-poll threshold.
+    uint32_t numUnreadySyscalls;
+    long numBusyPollElisions;
+
     // Since this structure is shared with Rust, we should always include the magic struct
     // member so that the struct is always the same size regardless of compile-time options.
     MAGIC_DECLARE_ALWAYS;
@@ -96,4 +107,22 @@ const Process* _syscallhandler_getProcess(const SysCallHandler* sys);
 const char* _syscallhandler_getProcessName(const SysCallHandler* sys);
 const Thread* _syscallhandler_getThread(const SysCallHandler* sys);
 
+/* Opens the Shadow file `file`, registered at `fd`, in the plugin. Returns the
+ * plugin's native fd, or a negative value on error. Implemented in mman.c. */
+int _syscallhandler_openPluginFile(SysCallHandler* sys, int fd, RegularFile* file);
+/* Closes the plugin's native fd `pluginFD`. Implemented in mman.c. */
+void _syscallhandler_closePluginFile(SysCallHandler* sys, int pluginFD);
+
+/* If the host uses native file I/O and `file`, registered at `fd`, is a regular
+ * file in the host's data directory, also opens the file natively in the plugin
+ * at the same fd number, sharing the open file description with Shadow's
+ * OS-backed file. Otherwise, or if that isn't possible, the file is only handled
+ * by Shadow. `cloexec` is the O_CLOEXEC flag of the descriptor. Implemented in
+ * file.c. */
+void _syscallhandler_openNativeFileInPlugin(SysCallHandler* sys, int fd, RegularFile* file,
+                                            int cloexec);
+/* Returns true if `fd` is also open natively in the plugin, in which case
+ * syscalls that only use the fd's open file description can run natively. */
+bool _syscallhandler_isNativeInPlugin(const SysCallHandler* sys, int fd);
+
 #endif /* SRC_MAIN_HOST_SYSCALL_PROTECTED_H_ */
@@ -49,38 +49,42 @@ static SyscallReturn _syscallhandler_select_helper(SysCallHandler* sys, int nfds
     }
 
     // Translate to pollfds so we can handle with our poll() handler. We don't use epoll here
-    // because that doesn't directly call file_poll() on regular files.
-    struct pollfd* pfds = malloc(nfds_max * sizeof(*pfds));
+    // because that doesn't directly call file_poll() on regular files. There are at most
+    // FD_SETSIZE of them, so we keep them on the stack, and only include the fds that select
+    // asked about so that poll doesn't need to skip over the others.
+    struct pollfd pfds[FD_SETSIZE];
+    int npfds = 0;
 
     for (int i = 0; i < nfds_max; i++) {
-        struct pollfd* pfd = &pfds[i];
-
-        pfd->fd = -1; // poll will skip over this array slot
-        pfd->events = 0;
-        pfd->revents = 0;
+        struct pollfd pfd = {.fd = i, .events = 0, .revents = 0};
+        bool wanted = false;
 
         // If the syscall args were NULL, our local fd sets are zeroed.
         if (FD_ISSET(i, &readfds)) {
             trace("select wanting reads for fd %i", i);
-            pfd->fd = i; // poll will process this slot
-            pfd->events |= POLLIN;
+            pfd.events |= POLLIN;
+            wanted = true;
         }
         if (FD_ISSET(i, &writefds)) {
             trace("select wanting writes for fd %i", i);
-            pfd->fd = i; // poll will process this slot
-            pfd->events |= POLLOUT;
+            pfd.events |= POLLOUT;
+            wanted = true;
         }
         if (FD_ISSET(i, &exceptfds)) {
             // We need poll to process this slot to check for EBADF
             trace("select wanting exceptions for fd %i", i);
-            pfd->fd = i; // poll will process this slot
+            wanted = true;
+        }
+
+        if (wanted) {
+            pfds[npfds++] = pfd;
         }
     }
 
-    SyscallReturn scr = _syscallhandler_pollHelper(sys, pfds, (nfds_t)nfds_max, timeout);
+    SyscallReturn scr = _syscallhandler_pollHelper(sys, pfds, (nfds_t)npfds, timeout);
     if (scr.tag == SYSCALL_RETURN_BLOCK ||
         (scr.tag == SYSCALL_RETURN_DONE && syscallreturn_done(&scr)->retval.as_i64 < 0)) {
-        goto done;
+        return scr;
     }
 
     // Collect the pollfd results in our local fd sets
@@ -94,13 +98,9 @@ static SyscallReturn _syscallhandler_select_helper(SysCallHandler* sys, int nfds
     int num_bad_fds = 0;
 
     // Check the pollfd results.
-    for (int i = 0; i < nfds_max; i++) {
-        struct pollfd* pfd = &pfds[i];
-
-        if (pfd->fd < 0) {
-            // Select didn't ask about this fd.
-            continue;
-        }
+    for (int j = 0; j < npfds; j++) {
+        struct pollfd* pfd = &pfds[j];
+        int i = pfd->fd;
 
         // The exceptional states listed in `man select` don't apply in Shadow,
         // but POLLNVAL corresponds to an EBADF error.
@@ -124,34 +124,24 @@ static SyscallReturn _syscallhandler_select_helper(SysCallHandler* sys, int nfds
 
     // Overwrite the return val set above by poll()
     if (num_bad_fds > 0) {
-        scr = syscallreturn_makeDoneErrno(EBADF);
-        goto done;
+        return syscallreturn_makeDoneErrno(EBADF);
     }
 
     // OK now we know we have success; write back the result fd sets.
-    scr = syscallreturn_makeDoneI64(num_set_bits);
     if (readfds_ptr.val &&
         process_writePtr(_syscallhandler_getProcess(sys), readfds_ptr, &readfds, sizeof(readfds))) {
-        scr = syscallreturn_makeDoneErrno(EFAULT);
-        goto done;
+        return syscallreturn_makeDoneErrno(EFAULT);
     }
     if (writefds_ptr.val && process_writePtr(_syscallhandler_getProcess(sys), writefds_ptr,
                                              &writefds, sizeof(writefds))) {
-        scr = syscallreturn_makeDoneErrno(EFAULT);
-        goto done;
+        return syscallreturn_makeDoneErrno(EFAULT);
     }
     if (exceptfds_ptr.val && process_writePtr(_syscallhandler_getProcess(sys), exceptfds_ptr,
                                               &exceptfds, sizeof(exceptfds))) {
-        scr = syscallreturn_makeDoneErrno(EFAULT);
-        goto done;
+        return syscallreturn_makeDoneErrno(EFAULT);
     }
 
-done:
-    // Cleanup
-    if (pfds) {
-        free(pfds);
-    }
-    return scr;
+    return syscallreturn_makeDoneI64(num_set_bits);
 }
 
 static int _syscallhandler_check_nfds(int nfds) {
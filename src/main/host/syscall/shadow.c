@@ -98,6 +98,8 @@ SyscallReturn syscallhandler_shadow_init_memory_manager(SysCallHandler* sys,
     } else {
         trace("Not initializing memory manager");
     }
+    process_initMemoryMergingIfNeeded(
+        _syscallhandler_getProcess(sys), _syscallhandler_getThread(sys));
     return syscallreturn_makeDoneI64(0);
 }
 
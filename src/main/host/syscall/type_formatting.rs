@@ -180,6 +180,7 @@ safe_pointer_impl!(std::ffi::c_void);
 safe_pointer_impl!(libc::sockaddr);
 safe_pointer_impl!(linux_api::sysinfo::sysinfo);
 safe_pointer_impl!(libc::iovec);
+safe_pointer_impl!(libc::mmsghdr);
 
 // nix still uses an old bitflags version which isn't supported by `bitflags_impl`
 simple_debug_impl!(linux_api::time::ITimerId);
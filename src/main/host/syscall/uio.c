@@ -97,6 +97,11 @@ static SyscallReturn _syscallhandler_readvHelper(SysCallHandler* sys, int fd,
           "offset %ld, flags %d",
           fd, (void*)iovPtr.val, iovlen, pos_l, pos_h, offset, flags);
 
+    /* The plugin can do the I/O itself on its native copy of the fd. */
+    if (_syscallhandler_isNativeInPlugin(sys, fd)) {
+        return syscallreturn_makeNative();
+    }
+
     if (offset < 0 && doPreadv) {
         return syscallreturn_makeDoneI64(-EINVAL);
     }
@@ -229,6 +234,11 @@ static SyscallReturn _syscallhandler_writevHelper(SysCallHandler* sys, int fd,
           "offset %ld, flags %d",
           fd, (void*)iovPtr.val, iovlen, pos_l, pos_h, offset, flags);
 
+    /* The plugin can do the I/O itself on its native copy of the fd. */
+    if (_syscallhandler_isNativeInPlugin(sys, fd)) {
+        return syscallreturn_makeNative();
+    }
+
     if (offset < 0 && doPwritev) {
         return syscallreturn_makeDoneI64(-EINVAL);
     }
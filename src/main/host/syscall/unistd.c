@@ -27,11 +27,58 @@
 // Helpers
 ///////////////////////////////////////////////////////////
 
+/* Reads or writes a regular OS-backed file using the host's file I/O model. The operation is
+ * started (on the file I/O pool if enabled) and the syscall blocks for the simulated time that the
+ * host's disk model says it should take. The operation belongs to the thread's syscall handler, so
+ * other threads can use the same file in the meantime. When the syscall resumes, we wait for the
+ * operation if it's still running and return its result. */
+static SyscallReturn _syscallhandler_fileIOHelper(SysCallHandler* sys, LegacyFile* desc,
+                                                  UntypedForeignPtr bufPtr, size_t bufSize,
+                                                  off_t offset, bool positional, bool isWrite) {
+    RegularFile* file = (RegularFile*)desc;
+    const Host* host = _syscallhandler_getHost(sys);
+    const Process* proc = _syscallhandler_getProcess(sys);
+
+    RegularFileIO io = {
+        .bufPtr = bufPtr.val,
+        .bufSize = bufSize,
+        .offset = offset,
+        .positional = positional,
+        .isWrite = isWrite,
+    };
+
+    RegularFilePendingIO* pending = sys->pendingFileIO;
+    sys->pendingFileIO = NULL;
+    if (pending) {
+        if (_syscallhandler_wasBlocked(sys) && regularfile_isPendingIOFor(pending, file, &io)) {
+            void* readBuf = isWrite ? NULL : process_getWriteablePtr(proc, bufPtr, bufSize);
+            return syscallreturn_makeDoneI64(regularfile_finishIO(pending, readBuf));
+        }
+        regularfile_discardIO(pending);
+    }
+
+    const void* writeBuf = isWrite ? process_getReadablePtr(proc, bufPtr, bufSize) : NULL;
+    int rv = regularfile_startIO(file, &io, writeBuf, host_useAsyncFileIO(host), &pending);
+    if (rv < 0) {
+        return syscallreturn_makeDoneErrno(-rv);
+    }
+    sys->pendingFileIO = pending;
+
+    CEmulatedTime done = host_startFileIO(host, bufSize, isWrite);
+    return syscallreturn_makeBlocked(
+        syscallcondition_newWithAbsTimeout(done), legacyfile_supportsSaRestart(desc));
+}
+
 SyscallReturn _syscallhandler_readHelper(SysCallHandler* sys, int fd, UntypedForeignPtr bufPtr,
                                          size_t bufSize, off_t offset, bool doPread) {
     trace(
         "trying to read %zu bytes on fd %i at offset %li", bufSize, fd, offset);
 
+    /* The plugin can do the I/O itself on its native copy of the fd. */
+    if (_syscallhandler_isNativeInPlugin(sys, fd)) {
+        return syscallreturn_makeNative();
+    }
+
     /* Get the descriptor. */
     LegacyFile* desc = thread_getRegisteredLegacyFile(_syscallhandler_getThread(sys), fd);
     if (!desc) {
@@ -62,6 +109,11 @@ SyscallReturn _syscallhandler_readHelper(SysCallHandler* sys, int fd, UntypedFor
      * available in the descriptor. */
     size_t sizeNeeded = MIN(bufSize, SYSCALL_IO_BUFSIZE);
 
+    if (dType == DT_FILE && host_usesFileIOModel(_syscallhandler_getHost(sys)) &&
+        regularfile_supportsFileIO((RegularFile*)desc)) {
+        return _syscallhandler_fileIOHelper(sys, desc, bufPtr, sizeNeeded, offset, doPread, false);
+    }
+
     ssize_t result = 0;
     switch (dType) {
         case DT_FILE:
@@ -121,6 +173,11 @@ SyscallReturn _syscallhandler_writeHelper(SysCallHandler* sys, int fd, UntypedFo
     trace("trying to write %zu bytes on fd %i at offset %li", bufSize, fd,
           offset);
 
+    /* The plugin can do the I/O itself on its native copy of the fd. */
+    if (_syscallhandler_isNativeInPlugin(sys, fd)) {
+        return syscallreturn_makeNative();
+    }
+
     /* Get the descriptor. */
     LegacyFile* desc = thread_getRegisteredLegacyFile(_syscallhandler_getThread(sys), fd);
     if (!desc) {
@@ -151,6 +208,11 @@ SyscallReturn _syscallhandler_writeHelper(SysCallHandler* sys, int fd, UntypedFo
      * available in the descriptor. */
     size_t sizeNeeded = MIN(bufSize, SYSCALL_IO_BUFSIZE);
 
+    if (dType == DT_FILE && host_usesFileIOModel(_syscallhandler_getHost(sys)) &&
+        regularfile_supportsFileIO((RegularFile*)desc)) {
+        return _syscallhandler_fileIOHelper(sys, desc, bufPtr, sizeNeeded, offset, doPwrite, true);
+    }
+
     ssize_t result = 0;
     switch (dType) {
         case DT_FILE:
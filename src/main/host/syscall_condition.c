@@ -386,6 +386,7 @@ static void _syscallcondition_trigger(const Host* host, void* obj, void* arg) {
         // Spurious wakeup. Just return without running the process. The
         // condition's listeners should still be installed, and now that we've
         // flipped `wakeupScheduled`, they can schedule this wakeup again.
+        worker_count_syscall_condition_spurious_wakeup();
 #ifdef DEBUG
         _syscallcondition_logListeningState(cond, proc, "re-blocking");
 #endif
@@ -398,6 +399,7 @@ static void _syscallcondition_scheduleWakeupTask(SysCallCondition* cond, const H
     if (cond->wakeupScheduled) {
         // Deliver one wakeup even if condition is triggered multiple times or
         // ways.
+        worker_count_syscall_condition_wakeup(true);
         return;
     }
 
@@ -413,6 +415,7 @@ static void _syscallcondition_scheduleWakeupTask(SysCallCondition* cond, const H
     taskref_drop(wakeupTask);
 
     cond->wakeupScheduled = true;
+    worker_count_syscall_condition_wakeup(false);
 }
 
 static void _syscallcondition_notifyStatusChanged(void* obj, void* arg) {
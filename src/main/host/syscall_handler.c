@@ -53,6 +53,10 @@
 static bool _countSyscalls = false;
 ADD_CONFIG_HANDLER(config_getUseSyscallCounters, _countSyscalls)
 
+// 0 if disabled.
+static uint32_t _busyPollThreshold = 0;
+ADD_CONFIG_HANDLER(config_getBusyPollThreshold, _busyPollThreshold)
+
 const Host* _syscallhandler_getHost(const SysCallHandler* sys) {
     const Host* host = worker_getCurrentHost();
     utility_debugAssert(host_getID(host) == sys->hostId);
@@ -96,7 +100,8 @@ SysCallHandler* syscallhandler_new(HostId hostId, pid_t processId, pid_t threadI
     };
 
     if (_countSyscalls) {
-        sys->syscall_counter = counter_new();
+        sys->syscall_counter = indexedcounter_new();
+        sys->flushedSyscallCounts = counter_new();
     }
 
     MAGIC_INIT(sys);
@@ -105,6 +110,29 @@ SysCallHandler* syscallhandler_new(HostId hostId, pid_t processId, pid_t threadI
     return sys;
 }
 
+void syscallhandler_flushCounts(SysCallHandler* sys) {
+    MAGIC_ASSERT(sys);
+
+    if (!_countSyscalls || !sys->syscall_counter) {
+        return;
+    }
+
+    Counter* counts = indexedcounter_to_counter(sys->syscall_counter);
+    if (sys->numBusyPollElisions > 0) {
+        counter_add_value(counts, "busy_poll_elision", sys->numBusyPollElisions);
+    }
+
+    // only add the counts since the last flush
+    Counter* newCounts = counter_new();
+    counter_add_counter(newCounts, counts);
+    counter_sub_counter(newCounts, sys->flushedSyscallCounts);
+    worker_add_syscall_counts(newCounts);
+    counter_free(newCounts);
+
+    counter_free(sys->flushedSyscallCounts);
+    sys->flushedSyscallCounts = counts;
+}
+
 void syscallhandler_free(SysCallHandler* sys) {
     MAGIC_ASSERT(sys);
 
@@ -113,25 +141,33 @@ void syscallhandler_free(SysCallHandler* sys) {
 #else
     debug("handled %li syscalls", sys->numSyscalls);
 #endif
+    if (sys->numBusyPollElisions > 0) {
+        debug("blocked busy-polling thread %d %li times", sys->threadId, sys->numBusyPollElisions);
+    }
 
     if (_countSyscalls && sys->syscall_counter) {
+        // Add up the remaining counts at the worker level
+        syscallhandler_flushCounts(sys);
+
         // Log the plugin thread specific counts
-        char* str = counter_alloc_string(sys->syscall_counter);
+        char* str = counter_alloc_string(sys->flushedSyscallCounts);
         debug("Thread %d (%s) syscall counts: %s", sys->threadId,
               _syscallhandler_getProcessName(sys), str);
-        counter_free_string(sys->syscall_counter, str);
-
-        // Add up the counts at the worker level
-        worker_add_syscall_counts(sys->syscall_counter);
+        counter_free_string(sys->flushedSyscallCounts, str);
 
         // Cleanup
-        counter_free(sys->syscall_counter);
+        counter_free(sys->flushedSyscallCounts);
+        indexedcounter_free(sys->syscall_counter);
     }
 
     if (sys->syscall_handler_rs) {
         rustsyscallhandler_free(sys->syscall_handler_rs);
     }
 
+    if (sys->pendingFileIO) {
+        regularfile_discardIO(sys->pendingFileIO);
+    }
+
     if (sys->epoll) {
         legacyfile_unref(sys->epoll);
     }
@@ -156,7 +192,7 @@ static void _syscallhandler_pre_syscall(SysCallHandler* sys, long number,
     // This avoids double counting in the case where the initial call blocked at first,
     // but then later became unblocked and is now being handled again here.
     if (sys->syscall_counter && !_syscallhandler_wasBlocked(sys)) {
-        counter_add_value(sys->syscall_counter, name, 1);
+        indexedcounter_add_one(sys->syscall_counter, number, name);
     }
 
 #ifdef USE_PERF_TIMERS
@@ -220,6 +256,36 @@ static void _syscallhandler_post_syscall(SysCallHandler* sys, long number, const
     }
 }
 
+// Returns true if the syscall completed without blocking, but found nothing ready. A thread that
+// makes many of these in a row is probably busy-polling.
+static bool _syscallhandler_isUnreadyResult(SysCallHandler* sys, long number,
+                                            SyscallReturn* scr) {
+    if (scr->tag != SYSCALL_RETURN_DONE || _syscallhandler_wasBlocked(sys)) {
+        return false;
+    }
+
+    int64_t retval = syscallreturn_done(scr)->retval.as_i64;
+
+    switch (number) {
+        case SYS_accept:
+        case SYS_accept4:
+        case SYS_read:
+        case SYS_readv:
+        case SYS_recvfrom:
+        case SYS_recvmsg: return retval == -EAGAIN;
+        case SYS_epoll_pwait:
+        case SYS_epoll_pwait2:
+        case SYS_epoll_wait:
+        case SYS_poll:
+        case SYS_ppoll:
+        case SYS_pselect6:
+        case SYS_select:
+            // These only return 0 without blocking if the timeout was zero.
+            return retval == 0;
+        default: return false;
+    }
+}
+
 ///////////////////////////////////////////////////////////
 // Single public API function for calling Shadow syscalls
 ///////////////////////////////////////////////////////////
@@ -242,6 +308,7 @@ static void _syscallhandler_post_syscall(SysCallHandler* sys, long number, const
 #define NATIVE(s)                                                                                  \
     case SYS_##s:                                                                                  \
         trace("native syscall %ld " #s, args->number);                                             \
+        worker_count_native_syscall(args->number);                                                 \
         scr = syscallreturn_makeNative();                                                          \
         if (straceLoggingMode != STRACE_FMT_MODE_OFF) {                                            \
             scr = log_syscall(                                                                     \
@@ -296,6 +363,11 @@ SyscallReturn syscallhandler_make_syscall(SysCallHandler* sys, const SysCallArgs
         sys->blockedSyscallNR = -1;
         return sys->pendingResult;
     } else {
+        // This switch and the match in the Rust `SyscallHandler::syscall()` are both compiled to
+        // jump tables indexed by the syscall number. The syscall names are string literals that
+        // are only used for logging, and the per-thread syscall counter is indexed by the syscall
+        // number (it only reads the name the first time a syscall is counted), so a syscall
+        // doesn't do any string handling here unless strace or trace logging is enabled.
         switch (args->number) {
             HANDLE_RUST(accept);
             HANDLE_RUST(accept4);
@@ -416,6 +488,7 @@ SyscallReturn syscallhandler_make_syscall(SysCallHandler* sys, const SysCallArgs
             HANDLE_C(readlinkat);
             HANDLE_RUST(readv);
             HANDLE_RUST(recvfrom);
+            HANDLE_RUST(recvmmsg);
             HANDLE_RUST(recvmsg);
             HANDLE_C(renameat);
             HANDLE_C(renameat2);
@@ -427,6 +500,8 @@ SyscallReturn syscallhandler_make_syscall(SysCallHandler* sys, const SysCallArgs
             HANDLE_C(shadow_init_memory_manager);
             HANDLE_C(shadow_yield);
             HANDLE_C(select);
+            HANDLE_RUST(sendfile);
+            HANDLE_RUST(sendmmsg);
             HANDLE_RUST(sendmsg);
             HANDLE_RUST(sendto);
             HANDLE_RUST(setpgid);
@@ -489,18 +564,14 @@ SyscallReturn syscallhandler_make_syscall(SysCallHandler* sys, const SysCallArgs
 
             // copying data between various types of fds
             UNSUPPORTED(copy_file_range);
-            UNSUPPORTED(sendfile);
             UNSUPPORTED(splice);
             UNSUPPORTED(vmsplice);
             UNSUPPORTED(tee);
 
-            //// additional socket io
-            UNSUPPORTED(recvmmsg);
-            UNSUPPORTED(sendmmsg);
-
             // ***************************************
             // We think we don't need to handle these
-            // (because the plugin can natively):
+            // (because the plugin can natively).
+            // Keep `NATIVE_SYSCALLS` in syscall/mod.rs in sync.
             // ***************************************
             NATIVE(access);
             NATIVE(arch_prctl);
@@ -619,15 +690,15 @@ SyscallReturn syscallhandler_make_syscall(SysCallHandler* sys, const SysCallArgs
         }
     }
 
-    if (shimshmem_getModelUnblockedSyscallLatency(host_getSharedMem(host)) &&
-        process_isRunning(process) &&
+    if (process_isRunning(process) &&
         (scr.tag == SYSCALL_RETURN_DONE || scr.tag == SYSCALL_RETURN_NATIVE)) {
+        bool modelLatency = shimshmem_getModelUnblockedSyscallLatency(host_getSharedMem(host));
         CSimulationTime maxUnappliedCpuLatency =
             shimshmem_maxUnappliedCpuLatency(host_getSharedMem(host));
         // Increment unblocked syscall latency, but only for
         // non-shadow-syscalls, since the latter are part of Shadow's
         // internal plumbing; they shouldn't necessarily "consume" time.
-        if (!syscall_num_is_shadow(args->number)) {
+        if (modelLatency && !syscall_num_is_shadow(args->number)) {
             shimshmem_incrementUnappliedCpuLatency(
                 host_getShimShmemLock(host),
                 shimshmem_unblockedSyscallLatency(host_getSharedMem(host)));
@@ -635,7 +706,11 @@ SyscallReturn syscallhandler_make_syscall(SysCallHandler* sys, const SysCallArgs
         const CSimulationTime unappliedCpuLatency =
             shimshmem_getUnappliedCpuLatency(host_getShimShmemLock(host));
         trace("Unapplied CPU latency amt=%ld max=%ld", unappliedCpuLatency, maxUnappliedCpuLatency);
-        if (unappliedCpuLatency > maxUnappliedCpuLatency) {
+        // The shim yields with latency that it couldn't apply itself (for
+        // example CPU time charged by a preloaded library), which we apply
+        // even if it's below the max and syscall latency isn't modelled.
+        bool shimYielded = args->number == SYS_shadow_yield && unappliedCpuLatency > 0;
+        if (unappliedCpuLatency > maxUnappliedCpuLatency || shimYielded) {
             CEmulatedTime newTime = worker_getCurrentEmulatedTime() + unappliedCpuLatency;
             CEmulatedTime maxTime = worker_maxEventRunaheadTime(host);
             if (newTime <= maxTime) {
@@ -656,6 +731,32 @@ SyscallReturn syscallhandler_make_syscall(SysCallHandler* sys, const SysCallArgs
         }
     }
 
+    if (_busyPollThreshold > 0 && scr.tag == SYSCALL_RETURN_DONE && process_isRunning(process)) {
+        if (!_syscallhandler_isUnreadyResult(sys, args->number, &scr)) {
+            sys->numUnreadySyscalls = 0;
+        } else if (++sys->numUnreadySyscalls >= _busyPollThreshold) {
+            // Nothing can become ready until the host's next event runs, and events from other
+            // hosts can't arrive before the end of the round. The runahead bound already
+            // covers both.
+            CEmulatedTime now = worker_getCurrentEmulatedTime();
+            CEmulatedTime wakeTime = worker_maxEventRunaheadTime(host);
+            if (wakeTime > now) {
+                trace("Thread made %" PRIu32 " unready syscalls in a row. Blocking until %" PRIu64,
+                      sys->numUnreadySyscalls, wakeTime);
+                sys->numUnreadySyscalls = 0;
+                sys->numBusyPollElisions++;
+                // Block instead, but save the result so that we can return it
+                // later instead of re-executing the syscall.
+                utility_debugAssert(!sys->havePendingResult);
+                sys->havePendingResult = true;
+                sys->pendingResult = scr;
+                SysCallCondition* cond = syscallcondition_newWithAbsTimeout(wakeTime);
+
+                scr = syscallreturn_makeBlocked(cond, false);
+            }
+        }
+    }
+
     if (scr.tag == SYSCALL_RETURN_BLOCK) {
         /* We are blocking: store the syscall number so we know
          * to expect the same syscall again when it unblocks. */
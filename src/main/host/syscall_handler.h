@@ -18,6 +18,9 @@ typedef struct _SysCallHandler SysCallHandler;
 
 SysCallHandler* syscallhandler_new(HostId hostId, pid_t processId, pid_t threadId);
 void syscallhandler_free(SysCallHandler* sys);
+/* Adds the syscall counts since the last flush to the worker's syscall counts, so that they're
+ * included in stats snapshots before the thread exits. */
+void syscallhandler_flushCounts(SysCallHandler* sys);
 SyscallReturn syscallhandler_make_syscall(SysCallHandler* sys, const SysCallArgs* args);
 
 #endif /* SRC_MAIN_HOST_SHD_SYSCALL_HANDLER_H_ */
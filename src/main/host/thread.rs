@@ -259,6 +259,42 @@ impl Thread {
         Ok(())
     }
 
+    /// Natively execute madvise(2) on the given thread.
+    pub fn native_madvise(
+        &self,
+        ctx: &ProcessContext,
+        addr: ForeignPtr<u8>,
+        len: usize,
+        advice: i32,
+    ) -> Result<(), Errno> {
+        self.native_syscall(
+            ctx,
+            libc::SYS_madvise,
+            &[
+                SysCallReg::from(addr),
+                SysCallReg::from(len),
+                SysCallReg::from(advice),
+            ],
+        )?;
+        Ok(())
+    }
+
+    /// Natively execute prctl(2) on the given thread.
+    pub fn native_prctl(&self, ctx: &ProcessContext, option: i32, arg2: u64) -> Result<i32, Errno> {
+        let res = self.native_syscall(
+            ctx,
+            libc::SYS_prctl,
+            &[
+                SysCallReg::from(option),
+                SysCallReg::from(arg2),
+                SysCallReg::from(0u64),
+                SysCallReg::from(0u64),
+                SysCallReg::from(0u64),
+            ],
+        );
+        Ok(i32::from(res?))
+    }
+
     /// Natively execute open(2) on the given thread.
     pub fn native_open(
         &self,
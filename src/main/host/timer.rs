@@ -1,11 +1,12 @@
 use std::sync::{Arc, Weak};
 
-use atomic_refcell::AtomicRefCell;
+use atomic_refcell::{AtomicRefCell, AtomicRefMut};
 use log::trace;
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
 use super::host::Host;
+use crate::core::work::event::EventHandle;
 use crate::core::work::task::TaskRef;
 use crate::core::worker::Worker;
 use crate::utility::{Magic, ObjectCounter};
@@ -25,9 +26,20 @@ struct TimerInternal {
     next_expire_time: Option<EmulatedTime>,
     expire_interval: Option<SimulationTime>,
     expiration_count: u64,
-    next_expire_id: u64,
-    min_valid_expire_id: u64,
-    on_expire: Box<dyn Fn(&Host) + Send + Sync>,
+    // The time of the expiration event that is currently valid, if any. Events
+    // that were scheduled before the timer was reset run at other times (or
+    // after this one has run) and are ignored.
+    scheduled_event_time: Option<EmulatedTime>,
+    // The handle of that event, so that it can be removed from the host's
+    // event queue if the timer is reset.
+    scheduled_event: Option<EventHandle>,
+    // The task that is scheduled for every expiration event, allocated once
+    // per timer rather than once per event.
+    expire_task: TaskRef,
+    // If true, no expiration events are scheduled, and expirations are instead
+    // counted when the timer is queried.
+    lazy: bool,
+    on_expire: Arc<dyn Fn(&Host) + Send + Sync>,
 }
 
 impl TimerInternal {
@@ -36,30 +48,72 @@ impl TimerInternal {
         next_expire_time: Option<EmulatedTime>,
         expire_interval: Option<SimulationTime>,
     ) {
-        self.min_valid_expire_id = self.next_expire_id;
+        self.cancel_scheduled_event();
         self.expiration_count = 0;
         self.next_expire_time = next_expire_time;
         self.expire_interval = expire_interval;
     }
+
+    /// Cancel the scheduled expiration event, if any.
+    fn cancel_scheduled_event(&mut self) {
+        self.scheduled_event_time = None;
+        if let Some(handle) = self.scheduled_event.take() {
+            // If there's no active host, the event is left in the queue and is ignored when it
+            // runs.
+            let _ = Worker::with_active_host(|host| host.cancel_event(handle));
+        }
+    }
+
+    /// Count any expirations that have occurred up to and including `now`, without running
+    /// `on_expire`.
+    fn catch_up(&mut self, now: EmulatedTime) {
+        let Some(next_expire_time) = self.next_expire_time else {
+            return;
+        };
+        if next_expire_time > now {
+            return;
+        }
+
+        match self.expire_interval {
+            Some(interval) => {
+                let num = (now - next_expire_time).as_nanos() / interval.as_nanos() + 1;
+                self.expiration_count += u64::try_from(num).unwrap();
+                self.next_expire_time = Some(
+                    next_expire_time
+                        + SimulationTime::from_nanos(
+                            (interval.as_nanos() * num).try_into().unwrap(),
+                        ),
+                );
+            }
+            None => {
+                self.expiration_count += 1;
+                self.next_expire_time = None;
+            }
+        }
+    }
 }
 
 impl Timer {
     /// Create a new Timer that directly executes `on_expire` on
-    /// expiration. `on_expire` will cause a panic if it calls mutable methods
-    /// of the enclosing Timer.  If it may need to call mutable methods of the
-    /// Timer, it should push a new task to the scheduler to do so.
+    /// expiration. The timer isn't borrowed while `on_expire` runs, so it may
+    /// call methods of the enclosing Timer.
     pub fn new<F: 'static + Fn(&Host) + Send + Sync>(on_expire: F) -> Self {
         Self {
             magic: Magic::new(),
             _counter: ObjectCounter::new("Timer"),
-            internal: Arc::new(AtomicRefCell::new(TimerInternal {
-                next_expire_time: None,
-                expire_interval: None,
-                expiration_count: 0,
-                next_expire_id: 0,
-                min_valid_expire_id: 0,
-                on_expire: Box::new(on_expire),
-            })),
+            internal: Arc::new_cyclic(|internal_weak| {
+                let internal_weak = internal_weak.clone();
+                AtomicRefCell::new(TimerInternal {
+                    next_expire_time: None,
+                    expire_interval: None,
+                    expiration_count: 0,
+                    scheduled_event_time: None,
+                    scheduled_event: None,
+                    expire_task: TaskRef::new(move |host| Self::timer_expire(&internal_weak, host)),
+                    lazy: false,
+                    on_expire: Arc::new(on_expire),
+                })
+            }),
         }
     }
 
@@ -67,7 +121,7 @@ impl Timer {
     /// [`Timer::consume_expiration_count()`] was called without resetting the counter.
     pub fn expiration_count(&self) -> u64 {
         self.magic.debug_check();
-        self.internal.borrow().expiration_count
+        self.caught_up().expiration_count
     }
 
     /// Returns the currently configured timer expiration interval if this timer is configured to
@@ -81,7 +135,7 @@ impl Timer {
     /// [`Timer::consume_expiration_count()`] was called and resets the counter to zero.
     pub fn consume_expiration_count(&mut self) -> u64 {
         self.magic.debug_check();
-        let mut internal = self.internal.borrow_mut();
+        let mut internal = self.caught_up();
         let e = internal.expiration_count;
         internal.expiration_count = 0;
         e
@@ -91,11 +145,52 @@ impl Timer {
     /// armed, or None otherwise.
     pub fn remaining_time(&self) -> Option<SimulationTime> {
         self.magic.debug_check();
-        let t = self.internal.borrow().next_expire_time?;
+        let t = self.caught_up().next_expire_time?;
         let now = Worker::current_time().unwrap();
         Some(t.saturating_duration_since(&now))
     }
 
+    /// Borrow the internal state, after counting any expirations that a lazy timer hasn't
+    /// counted yet.
+    fn caught_up(&self) -> AtomicRefMut<TimerInternal> {
+        let mut internal = self.internal.borrow_mut();
+        if internal.lazy {
+            internal.catch_up(Worker::current_time().unwrap());
+        }
+        internal
+    }
+
+    /// Returns true if the timer is lazy. See [`Timer::set_lazy()`].
+    pub fn is_lazy(&self) -> bool {
+        self.magic.debug_check();
+        self.internal.borrow().lazy
+    }
+
+    /// Make the timer lazy or not. A lazy timer doesn't schedule expiration events or run
+    /// `on_expire()`; expirations are instead counted from the elapsed time when the timer is
+    /// queried. This is useful for periodic timers that nothing is currently waiting on, which
+    /// would otherwise schedule an event on every interval.
+    ///
+    /// When a timer stops being lazy, the expirations that occurred while it was lazy are counted
+    /// (without running `on_expire()`), and it resumes scheduling expiration events.
+    pub fn set_lazy(&mut self, host: &Host, lazy: bool) {
+        self.magic.debug_check();
+        let mut internal = self.internal.borrow_mut();
+        if internal.lazy == lazy {
+            return;
+        }
+        internal.lazy = lazy;
+
+        if lazy {
+            internal.cancel_scheduled_event();
+        } else {
+            internal.catch_up(Worker::current_time().unwrap());
+            if internal.next_expire_time.is_some() {
+                Self::schedule_new_expire_event(&mut internal, host);
+            }
+        }
+    }
+
     /// Deactivate the timer so that it does not issue `on_expire()` callback notifications.
     pub fn disarm(&mut self) {
         self.magic.debug_check();
@@ -103,11 +198,7 @@ impl Timer {
         internal.reset(None, None);
     }
 
-    fn timer_expire(
-        internal_weak: &Weak<AtomicRefCell<TimerInternal>>,
-        host: &Host,
-        expire_id: u64,
-    ) {
+    fn timer_expire(internal_weak: &Weak<AtomicRefCell<TimerInternal>>, host: &Host) {
         let internal = if let Some(internal) = Weak::upgrade(internal_weak) {
             internal
         } else {
@@ -116,21 +207,24 @@ impl Timer {
         };
 
         let mut internal_brw = internal.borrow_mut();
+        let now = Worker::current_time().unwrap();
         trace!(
-            "timer expire check; expireID={expire_id} minValidExpireID={}",
-            internal_brw.min_valid_expire_id
+            "timer expire check; now={now:?} scheduledEventTime={:?}",
+            internal_brw.scheduled_event_time
         );
 
         // The timer may have been canceled/disarmed after we scheduled the callback task.
-        if expire_id < internal_brw.min_valid_expire_id {
+        if internal_brw.scheduled_event_time != Some(now) {
             // Cancelled.
             return;
         }
+        internal_brw.scheduled_event_time = None;
+        internal_brw.scheduled_event = None;
 
         let next_expire_time = internal_brw.next_expire_time.unwrap();
-        if next_expire_time > Worker::current_time().unwrap() {
+        if next_expire_time > now {
             // Hasn't expired yet. Check again later.
-            Self::schedule_new_expire_event(&mut internal_brw, internal_weak.clone(), host);
+            Self::schedule_new_expire_event(&mut internal_brw, host);
             return;
         }
 
@@ -142,20 +236,18 @@ impl Timer {
             // The interval must be positive.
             debug_assert!(interval.is_positive());
             internal_brw.next_expire_time = Some(next_expire_time + interval);
-            Self::schedule_new_expire_event(&mut internal_brw, internal_weak.clone(), host);
+            Self::schedule_new_expire_event(&mut internal_brw, host);
+        } else {
+            internal_brw.next_expire_time = None;
         }
 
-        // Re-borrow as an immutable reference while executing the callback.
+        // Release the borrow while executing the callback, so that it can use the timer.
+        let on_expire = Arc::clone(&internal_brw.on_expire);
         drop(internal_brw);
-        let internal_brw = internal.borrow();
-        (internal_brw.on_expire)(host);
+        (on_expire)(host);
     }
 
-    fn schedule_new_expire_event(
-        internal_ref: &mut TimerInternal,
-        internal_ptr: Weak<AtomicRefCell<TimerInternal>>,
-        host: &Host,
-    ) {
+    fn schedule_new_expire_event(internal_ref: &mut TimerInternal, host: &Host) {
         let now = Worker::current_time().unwrap();
 
         // have the timer expire between (1,2] seconds from now, but on a 1-second edge so that all
@@ -169,10 +261,10 @@ impl Timer {
             internal_ref.next_expire_time.unwrap(),
             EmulatedTime::SIMULATION_START + early_expire_time_since_start,
         );
-        let expire_id = internal_ref.next_expire_id;
-        internal_ref.next_expire_id += 1;
-        let task = TaskRef::new(move |host| Self::timer_expire(&internal_ptr, host, expire_id));
-        host.schedule_task_at_emulated_time(task, time);
+        internal_ref.cancel_scheduled_event();
+        internal_ref.scheduled_event_time = Some(time);
+        internal_ref.scheduled_event =
+            host.schedule_cancellable_task_at_emulated_time(internal_ref.expire_task.clone(), time);
     }
 
     /// Activate the timer so that it starts issuing `on_expire()` callback notifications.
@@ -200,7 +292,16 @@ impl Timer {
 
         let mut internal = self.internal.borrow_mut();
         internal.reset(Some(expire_time), expire_interval);
-        Self::schedule_new_expire_event(&mut internal, Arc::downgrade(&self.internal), host);
+        if !internal.lazy {
+            Self::schedule_new_expire_event(&mut internal, host);
+        }
+    }
+}
+
+impl Drop for Timer {
+    fn drop(&mut self) {
+        // the expiration event would be a no-op, so remove it from the event queue
+        self.internal.borrow_mut().cancel_scheduled_event();
     }
 }
 
@@ -73,7 +73,15 @@ struct _Tracker {
     gsize deallocatedBytesLastInterval;
     guint numFailedFrees;
 
+    /* maps socket handles to SocketStats */
     GHashTable* socketStats;
+    /* the most recently looked up entry of socketStats; consecutive packets and buffer updates
+     * are usually for the same socket, so this avoids most of the hash table lookups */
+    guintptr cachedSocketHandle;
+    SocketStats* cachedSocketStats;
+
+    /* reused for building heartbeat messages */
+    GString* heartbeatBuffer;
 
     CEmulatedTime lastHeartbeat;
 
@@ -139,7 +147,9 @@ Tracker* tracker_new(const Host* host, CSimulationTime interval, LogLevel loglev
     tracker->loginfo = loginfo;
 
     tracker->allocatedLocations = g_hash_table_new(g_direct_hash, g_direct_equal);
-    tracker->socketStats = g_hash_table_new_full(g_int_hash, g_int_equal, NULL, (GDestroyNotify)_socketstats_free);
+    tracker->socketStats = g_hash_table_new_full(
+        g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)_socketstats_free);
+    tracker->heartbeatBuffer = g_string_new(NULL);
 
     /* send an alive message, and start periodic heartbeats */
     tracker_heartbeat(tracker, host);
@@ -159,11 +169,31 @@ void tracker_free(Tracker* tracker) {
     g_hash_table_foreach(tracker->allocatedLocations, _tracker_freeAllocatedLocations, NULL);
     g_hash_table_destroy(tracker->allocatedLocations);
     g_hash_table_destroy(tracker->socketStats);
+    g_string_free(tracker->heartbeatBuffer, TRUE);
 
     MAGIC_CLEAR(tracker);
     g_free(tracker);
 }
 
+static SocketStats* _tracker_lookupSocket(Tracker* tracker, guintptr handle) {
+    if (tracker->cachedSocketStats && tracker->cachedSocketHandle == handle) {
+        return tracker->cachedSocketStats;
+    }
+
+    SocketStats* ss = g_hash_table_lookup(tracker->socketStats, GSIZE_TO_POINTER(handle));
+    if (ss) {
+        tracker->cachedSocketHandle = handle;
+        tracker->cachedSocketStats = ss;
+    }
+    return ss;
+}
+
+static void _tracker_forgetCachedSocket(Tracker* tracker, guintptr handle) {
+    if (tracker->cachedSocketHandle == handle) {
+        tracker->cachedSocketStats = NULL;
+    }
+}
+
 void tracker_addProcessingTimeNanos(Tracker* tracker, uint64_t processingTimeNanos) {
     MAGIC_ASSERT(tracker);
 
@@ -239,7 +269,7 @@ void tracker_addInputBytes(Tracker* tracker, Packet* packet, const CompatSocket*
     }
 
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* ss = g_hash_table_lookup(tracker->socketStats, &handle);
+        SocketStats* ss = _tracker_lookupSocket(tracker, handle);
         if(ss) {
             if(isLocal) {
                 _tracker_updateCounters(&ss->local.inCounters, header, payload, status);
@@ -272,7 +302,7 @@ void tracker_addOutputBytes(Tracker* tracker, Packet* packet, const CompatSocket
     }
 
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* ss = g_hash_table_lookup(tracker->socketStats, &handle);
+        SocketStats* ss = _tracker_lookupSocket(tracker, handle);
         if(ss) {
             if(isLocal) {
                 _tracker_updateCounters(&ss->local.outCounters, header, payload, status);
@@ -318,7 +348,9 @@ void tracker_addSocket(Tracker* tracker, const CompatSocket* socket, ProtocolTyp
 
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
         SocketStats* ss = _socketstats_new(handle, type, inputBufferSize, outputBufferSize);
-        g_hash_table_insert(tracker->socketStats, &(ss->socket), ss);
+        /* the handle may be reused by a new socket before the old socket's stats were logged */
+        _tracker_forgetCachedSocket(tracker, handle);
+        g_hash_table_insert(tracker->socketStats, GSIZE_TO_POINTER(handle), ss);
     }
 }
 
@@ -328,7 +360,7 @@ void tracker_updateSocketPeer(Tracker* tracker, const CompatSocket* socket, in_a
     guintptr handle = _tracker_socketHandle(socket);
 
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* socket = g_hash_table_lookup(tracker->socketStats, &handle);
+        SocketStats* socket = _tracker_lookupSocket(tracker, handle);
         if(socket) {
             socket->peerIP = peerIP;
             socket->peerPort = peerPort;
@@ -361,7 +393,7 @@ void tracker_updateSocketInputBuffer(Tracker* tracker, const CompatSocket* socke
     guintptr handle = _tracker_socketHandle(socket);
 
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* ss = g_hash_table_lookup(tracker->socketStats, &handle);
+        SocketStats* ss = _tracker_lookupSocket(tracker, handle);
         if(ss) {
             ss->inputBufferLength = inputBufferLength;
             ss->inputBufferSize = inputBufferSize;
@@ -375,7 +407,7 @@ void tracker_updateSocketOutputBuffer(Tracker* tracker, const CompatSocket* sock
     guintptr handle = _tracker_socketHandle(socket);
 
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* ss = g_hash_table_lookup(tracker->socketStats, &handle);
+        SocketStats* ss = _tracker_lookupSocket(tracker, handle);
         if(ss) {
             ss->outputBufferLength = outputBufferLength;
             ss->outputBufferSize = outputBufferSize;
@@ -388,7 +420,7 @@ void tracker_removeSocket(Tracker* tracker, const CompatSocket* socket) {
     guintptr handle = _tracker_socketHandle(socket);
 
     if(tracker->loginfo & LOG_INFO_FLAGS_SOCKET) {
-        SocketStats* ss = g_hash_table_lookup(tracker->socketStats, &handle);
+        SocketStats* ss = _tracker_lookupSocket(tracker, handle);
         if(ss) {
             /* remove after we log the stats we have */
             ss->removeAfterNextLog = TRUE;
@@ -411,15 +443,14 @@ static const gchar* _tracker_getCounterHeaderString() {
             "packets-data-retrans,bytes-data-header-retrans,bytes-data-payload-retrans";
 }
 
-static gchar* _tracker_getCounterString(Counters* c) {
+static void _tracker_appendCounterString(GString* buffer, Counters* c) {
     utility_debugAssert(c);
 
     gsize totalPackets = c->packets.control + c->packets.controlRetransmit +
             c->packets.data + c->packets.dataRetransmit;
     gsize totalBytes = _tracker_sumBytes(&c->bytes);
 
-    GString* buffer = g_string_new(NULL);
-    g_string_printf(buffer,
+    g_string_append_printf(buffer,
             "%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT","
             "%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT","
             "%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT,
@@ -428,7 +459,18 @@ static gchar* _tracker_getCounterString(Counters* c) {
             c->packets.controlRetransmit, c->bytes.controlHeaderRetransmit,
             c->packets.data, c->bytes.dataHeader, c->bytes.dataPayload,
             c->packets.dataRetransmit, c->bytes.dataHeaderRetransmit, c->bytes.dataPayloadRetransmit);
-    return g_string_free(buffer, FALSE);
+}
+
+/* appends the inbound and outbound localhost and remote counters, separated by ';' */
+static void _tracker_appendIFaceCounterStrings(GString* buffer, IFaceCounters* local,
+                                               IFaceCounters* remote) {
+    _tracker_appendCounterString(buffer, &local->inCounters);
+    g_string_append_c(buffer, ';');
+    _tracker_appendCounterString(buffer, &local->outCounters);
+    g_string_append_c(buffer, ';');
+    _tracker_appendCounterString(buffer, &remote->inCounters);
+    g_string_append_c(buffer, ';');
+    _tracker_appendCounterString(buffer, &remote->outCounters);
 }
 
 static void _tracker_logNode(Tracker* tracker, LogLevel level, CSimulationTime interval) {
@@ -459,25 +501,15 @@ static void _tracker_logNode(Tracker* tracker, LogLevel level, CSimulationTime i
     gsize totalRecvBytes = _tracker_sumBytes(&tracker->remote.inCounters.bytes);
     gsize totalSendBytes = _tracker_sumBytes(&tracker->remote.outCounters.bytes);
 
-    gchar* inLocal = _tracker_getCounterString(&tracker->local.inCounters);
-    gchar* outLocal = _tracker_getCounterString(&tracker->local.outCounters);
-    gchar* inRemote = _tracker_getCounterString(&tracker->remote.inCounters);
-    gchar* outRemote = _tracker_getCounterString(&tracker->remote.outCounters);
-
-    GString* buffer = g_string_new("[shadow-heartbeat] [node] ");
+    GString* buffer = tracker->heartbeatBuffer;
+    g_string_assign(buffer, "[shadow-heartbeat] [node] ");
 
     g_string_append_printf(buffer, "%u,%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT",%f,%"G_GSIZE_FORMAT",%f;",
             seconds, totalRecvBytes, totalSendBytes, cpuutil, tracker->numDelayedLastInterval, avgdelayms);
-    g_string_append_printf(buffer, "%s;%s;%s;%s", inLocal, outLocal, inRemote, outRemote);
+    _tracker_appendIFaceCounterStrings(buffer, &tracker->local, &tracker->remote);
 
     logger_log(logger_getDefault(), level, __FILE__, __FUNCTION__, __LINE__,
                "%s", buffer->str);
-
-    g_free(inLocal);
-    g_free(outLocal);
-    g_free(inRemote);
-    g_free(outRemote);
-    g_string_free(buffer, TRUE);
 }
 
 static void _tracker_logSocket(Tracker* tracker, LogLevel level, CSimulationTime interval) {
@@ -492,7 +524,8 @@ static void _tracker_logSocket(Tracker* tracker, LogLevel level, CSimulationTime
     }
 
     /* construct the log message from all sockets we have in the hash table */
-    GString* msg = g_string_new("[shadow-heartbeat] [socket] ");
+    GString* msg = tracker->heartbeatBuffer;
+    g_string_assign(msg, "[shadow-heartbeat] [socket] ");
 
     SocketStats* ss = NULL;
     GHashTableIter socketIterator;
@@ -514,11 +547,6 @@ static void _tracker_logSocket(Tracker* tracker, LogLevel level, CSimulationTime
         gsize totalSendBytes = _tracker_sumBytes(&ss->local.outCounters.bytes) +
                 _tracker_sumBytes(&ss->remote.outCounters.bytes);
 
-        gchar* inLocal = _tracker_getCounterString(&ss->local.inCounters);
-        gchar* outLocal = _tracker_getCounterString(&ss->local.outCounters);
-        gchar* inRemote = _tracker_getCounterString(&ss->remote.inCounters);
-        gchar* outRemote = _tracker_getCounterString(&ss->remote.outCounters);
-
         /* print the node separator between node logs */
         if(socketLogCount > 0) {
             g_string_append_printf(msg, "|");
@@ -527,25 +555,19 @@ static void _tracker_logSocket(Tracker* tracker, LogLevel level, CSimulationTime
         socketLogCount++;
         g_string_append_printf(msg, "%ld,%s,%s:%u;"
                 "%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT";"
-                "%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT";"
-                "%s;%s;%s;%s",
+                "%"G_GSIZE_FORMAT",%"G_GSIZE_FORMAT";",
                 ss->socket, /*inet_ntoa((struct in_addr){socket->peerIP})*/
                 ss->type == PTCP ? "TCP" : ss->type == PUDP ? "UDP" :
                     ss->type == PLOCAL ? "LOCAL" : "UNKNOWN",
                 ss->peerHostname, ss->peerPort,
                 ss->inputBufferLength, ss->inputBufferSize,
                 ss->outputBufferLength, ss->outputBufferSize,
-                totalRecvBytes, totalSendBytes,
-                inLocal, outLocal, inRemote, outRemote);
-
-        g_free(inLocal);
-        g_free(outLocal);
-        g_free(inRemote);
-        g_free(outRemote);
+                totalRecvBytes, totalSendBytes);
+        _tracker_appendIFaceCounterStrings(msg, &ss->local, &ss->remote);
 
         /* check if we should remove the socket after iterating */
         if(ss->removeAfterNextLog) {
-            g_queue_push_tail(socketsToRemove, GINT_TO_POINTER(ss->socket));
+            g_queue_push_tail(socketsToRemove, GSIZE_TO_POINTER(ss->socket));
         }
     }
 
@@ -556,11 +578,10 @@ static void _tracker_logSocket(Tracker* tracker, LogLevel level, CSimulationTime
     /* free all the tracker instances of the sockets that were closed, now that we logged the info */
     while (!g_queue_is_empty(socketsToRemove)) {
         guintptr socket = (guintptr)g_queue_pop_head(socketsToRemove);
-        g_hash_table_remove(tracker->socketStats, &socket);
+        _tracker_forgetCachedSocket(tracker, socket);
+        g_hash_table_remove(tracker->socketStats, GSIZE_TO_POINTER(socket));
     }
     g_queue_free(socketsToRemove);
-
-    g_string_free(msg, TRUE);
 }
 
 static void _tracker_logRAM(Tracker* tracker, LogLevel level, CSimulationTime interval) {
@@ -0,0 +1,252 @@
+//! Traffic models that Shadow runs natively on a host, configured with `hosts.<hostname>.traffic`.
+//!
+//! A traffic model sends UDP datagrams to a peer from a socket that Shadow owns, so a host that
+//! only provides background traffic doesn't need a managed process, or the syscalls, memory
+//! copies, and context switches that come with one. The datagrams go through the host's network
+//! interface, qdisc, and bandwidth limits like any other packets. The peer doesn't need a socket to
+//! receive them; datagrams to a port without a socket are dropped when they arrive.
+
+use std::ffi::CString;
+use std::net::{Ipv4Addr, SocketAddrV4};
+use std::sync::{Arc, Weak};
+
+use atomic_refcell::AtomicRefCell;
+use bytes::Bytes;
+use linux_api::errno::Errno;
+use nix::sys::socket::SockaddrIn;
+use rand::Rng;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+use crate::core::sim_config::TrafficInfo;
+use crate::core::support::configuration::TrafficModel;
+use crate::core::work::task::TaskRef;
+use crate::core::worker::Worker;
+use crate::cshadow as c;
+use crate::host::descriptor::socket::inet::udp::UdpSocket;
+use crate::host::descriptor::FileStatus;
+use crate::host::host::Host;
+use crate::utility::callback_queue::CallbackQueue;
+use crate::utility::sockaddr::SockaddrStorage;
+
+/// The payload of every datagram. The models only generate load, so the contents don't matter,
+/// and sharing a static payload avoids an allocation per datagram.
+static PAYLOAD: [u8; 65_507] = [0; 65_507];
+
+/// Schedule a traffic model to start on the host at its start time.
+pub fn schedule(host: &Host, info: &TrafficInfo) {
+    let info = info.clone();
+    let start_time = EmulatedTime::SIMULATION_START + info.start_time;
+    let task = TaskRef::new(move |host| {
+        if let Some(generator) = Generator::new(host, info.clone()) {
+            let generator = Arc::new(generator);
+            let time = generator.send_time(0.0);
+            Generator::schedule_send(generator, host, time);
+        }
+    });
+    host.schedule_task_at_emulated_time(task, start_time);
+}
+
+/// Resolve a host name or IP address.
+fn resolve(name: &str) -> Option<Ipv4Addr> {
+    if let Ok(ip) = name.parse() {
+        return Some(ip);
+    }
+
+    let name = CString::new(name).ok()?;
+    let addr = Worker::with_dns(|dns| unsafe {
+        c::dns_resolveNameToAddress((dns as *const c::DNS).cast_mut(), name.as_ptr())
+    });
+    if addr.is_null() {
+        return None;
+    }
+    Some(u32::from_be(unsafe { c::address_toNetworkIP(addr) }).into())
+}
+
+/// A running traffic model.
+struct Generator {
+    info: TrafficInfo,
+    peer: SocketAddrV4,
+    /// The host keeps the socket open until it shuts down.
+    socket: Weak<AtomicRefCell<UdpSocket>>,
+    /// The mean interval between datagrams, in nanoseconds.
+    mean_interval_ns: f64,
+    /// The time at which the last datagram was sent, in nanoseconds after the start time. Kept as
+    /// a float so that intervals that aren't a whole number of nanoseconds don't accumulate
+    /// rounding errors.
+    elapsed_ns: AtomicRefCell<f64>,
+    /// The number of datagrams sent, and dropped because the socket's send buffer was full.
+    sent: AtomicRefCell<(u64, u64)>,
+}
+
+impl Generator {
+    /// Open and bind the model's socket. Returns `None` if the model can't run.
+    fn new(host: &Host, info: TrafficInfo) -> Option<Self> {
+        let Some(peer_ip) = resolve(&info.peer_host) else {
+            log::warn!(
+                "Not starting traffic to '{}' since its address is unknown",
+                info.peer_host
+            );
+            return None;
+        };
+        let peer = SocketAddrV4::new(peer_ip, info.peer_port);
+
+        let socket = UdpSocket::new(
+            FileStatus::empty(),
+            host.params.init_sock_send_buf_size.try_into().unwrap(),
+            host.params.init_sock_recv_buf_size.try_into().unwrap(),
+        );
+
+        let net_ns = host.network_namespace_borrow();
+        let local_addr = if peer_ip.is_loopback() {
+            SocketAddrV4::new(Ipv4Addr::LOCALHOST, 0)
+        } else {
+            SocketAddrV4::new(net_ns.default_ip, 0)
+        };
+        let local_addr = SockaddrStorage::from_inet(&SockaddrIn::from(local_addr));
+        if let Err(e) =
+            UdpSocket::bind(&socket, Some(&local_addr), &net_ns, &mut *host.random_mut())
+        {
+            log::warn!("Not starting traffic to {peer} since its socket couldn't be bound: {e:?}");
+            return None;
+        }
+
+        log::debug!("Starting {:?} traffic to {peer}", info.model);
+
+        let generator = Self {
+            mean_interval_ns: mean_interval_ns(&info),
+            info,
+            peer,
+            socket: Arc::downgrade(&socket),
+            elapsed_ns: AtomicRefCell::new(0.0),
+            sent: AtomicRefCell::new((0, 0)),
+        };
+        host.add_traffic_socket(socket);
+        Some(generator)
+    }
+
+    /// The time at which to send a datagram `elapsed_ns` nanoseconds after the start time, or
+    /// `None` if it's at or after the stop time.
+    fn send_time(&self, elapsed_ns: f64) -> Option<EmulatedTime> {
+        let offset = SimulationTime::from_nanos(elapsed_ns.round() as u64);
+        let offset = self.info.start_time.checked_add(offset)?;
+        if self.info.stop_time.is_some_and(|x| offset >= x) {
+            return None;
+        }
+        Some(EmulatedTime::SIMULATION_START + offset)
+    }
+
+    fn schedule_send(generator: Arc<Self>, host: &Host, time: Option<EmulatedTime>) {
+        let Some(time) = time else {
+            let (sent, dropped) = *generator.sent.borrow();
+            log::debug!(
+                "Stopped traffic to {} after sending {sent} datagrams and dropping {dropped}",
+                generator.peer
+            );
+            return;
+        };
+        let task = TaskRef::new(move |host| Self::send(&generator, host));
+        host.schedule_task_at_emulated_time(task, time);
+    }
+
+    fn send(generator: &Arc<Self>, host: &Host) {
+        // the host has shut down
+        let Some(socket) = generator.socket.upgrade() else {
+            return;
+        };
+
+        let payload = Bytes::from_static(&PAYLOAD[..generator.info.packet_size]);
+        let rv = CallbackQueue::queue_and_run(|cb_queue| {
+            UdpSocket::send_native(
+                &socket,
+                generator.peer,
+                payload,
+                &host.network_namespace_borrow(),
+                cb_queue,
+            )
+        });
+
+        match rv {
+            Ok(()) => generator.sent.borrow_mut().0 += 1,
+            // like a sender that doesn't wait for its socket to become writable
+            Err(Errno::EWOULDBLOCK) => generator.sent.borrow_mut().1 += 1,
+            Err(e) => {
+                log::warn!("Stopping traffic to {} after an error: {e}", generator.peer);
+                return;
+            }
+        }
+
+        let interval = next_interval_ns(
+            generator.info.model,
+            generator.mean_interval_ns,
+            &mut *host.random_mut(),
+        );
+        let time = {
+            let mut elapsed_ns = generator.elapsed_ns.borrow_mut();
+            *elapsed_ns += interval;
+            generator.send_time(*elapsed_ns)
+        };
+        Self::schedule_send(Arc::clone(generator), host, time);
+    }
+}
+
+/// The mean interval between datagrams that sends at the model's rate.
+fn mean_interval_ns(info: &TrafficInfo) -> f64 {
+    (info.packet_size as f64) * 8.0 * 1_000_000_000.0 / (info.rate_bits as f64)
+}
+
+/// The interval before the next datagram, in nanoseconds.
+fn next_interval_ns(model: TrafficModel, mean_ns: f64, rng: &mut impl Rng) -> f64 {
+    match model {
+        TrafficModel::UdpConstant => mean_ns,
+        // the intervals between the arrivals of a poisson process are exponentially distributed
+        TrafficModel::UdpPoisson => -mean_ns * (1.0 - rng.gen::<f64>()).ln(),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use rand::SeedableRng;
+    use rand_xoshiro::Xoshiro256PlusPlus;
+
+    use super::*;
+
+    fn info(model: TrafficModel) -> TrafficInfo {
+        TrafficInfo {
+            model,
+            peer_host: "server".to_string(),
+            peer_port: 80,
+            // 1 Mbit/s
+            rate_bits: 1_000_000,
+            packet_size: 1000,
+            start_time: SimulationTime::ZERO,
+            stop_time: None,
+        }
+    }
+
+    #[test]
+    fn test_constant_interval() {
+        let info = info(TrafficModel::UdpConstant);
+        let mean = mean_interval_ns(&info);
+        assert_eq!(mean, 8_000_000.0);
+
+        let mut rng = Xoshiro256PlusPlus::seed_from_u64(1);
+        assert_eq!(next_interval_ns(info.model, mean, &mut rng), mean);
+    }
+
+    #[test]
+    fn test_poisson_interval() {
+        let info = info(TrafficModel::UdpPoisson);
+        let mean = mean_interval_ns(&info);
+
+        let mut rng = Xoshiro256PlusPlus::seed_from_u64(1);
+        let n = 100_000;
+        let intervals: Vec<f64> = (0..n)
+            .map(|_| next_interval_ns(info.model, mean, &mut rng))
+            .collect();
+        assert!(intervals.iter().all(|x| *x >= 0.0 && x.is_finite()));
+
+        let sample_mean = intervals.iter().sum::<f64>() / n as f64;
+        assert!((sample_mean - mean).abs() < mean * 0.02);
+    }
+}
@@ -1,9 +1,13 @@
+pub mod path_cache;
 mod petgraph_wrapper;
+pub mod routing_cache;
 
 use std::collections::hash_map::Entry;
-use std::collections::HashMap;
+use std::collections::{BTreeMap, HashMap};
 use std::error::Error;
 use std::hash::Hash;
+use std::num::{NonZeroU64, NonZeroUsize};
+use std::sync::atomic::{AtomicU32, AtomicU64, Ordering};
 
 use anyhow::Context;
 use log::*;
@@ -14,6 +18,7 @@ use crate::core::support::configuration::{
     self, Compression, FileSource, GraphOptions, GraphSource,
 };
 use crate::core::support::{units, units::Unit};
+use crate::network::graph::path_cache::{PathCache, PathSource};
 use crate::network::graph::petgraph_wrapper::GraphWrapper;
 use crate::utility::tilde_expansion;
 
@@ -133,9 +138,22 @@ impl NetworkGraph {
         self.graph.node_weight(index).map(|w| w.id)
     }
 
+    /// Whether the graph's edges only connect their source to their target.
+    pub fn is_directed(&self) -> bool {
+        matches!(self.graph, GraphWrapper::Directed(_))
+    }
+
     pub fn parse(graph_text: &str) -> Result<Self, NetGraphError> {
-        let gml_graph = gml_parser::parse(graph_text)?;
+        Self::from_gml(gml_parser::parse(graph_text)?)
+    }
+
+    /// Parse the graph incrementally from a reader, so that the whole graph text doesn't need to
+    /// be kept in memory.
+    pub fn parse_reader(reader: impl std::io::BufRead) -> Result<Self, NetGraphError> {
+        Self::from_gml(gml_parser::parse_reader(reader)?)
+    }
 
+    fn from_gml(gml_graph: gml_parser::gml::Gml) -> Result<Self, NetGraphError> {
         let mut g = match gml_graph.directed {
             true => GraphWrapper::Directed(
                 petgraph::graph::Graph::<_, _, petgraph::Directed, _>::with_capacity(
@@ -229,6 +247,58 @@ impl NetworkGraph {
         Ok(paths)
     }
 
+    /// Compute the shortest paths from `src` to each node in `nodes`, in the same order. The path
+    /// from `src` to itself is the node's self-loop.
+    pub fn shortest_paths_from(
+        &self,
+        src: NodeIndex,
+        nodes: &[NodeIndex],
+    ) -> Result<Vec<Option<PathProperties>>, NetGraphError> {
+        let paths = match &self.graph {
+            GraphWrapper::Directed(graph) => {
+                petgraph::algo::dijkstra(&graph, src, None, |e| e.weight().into())
+            }
+            GraphWrapper::Undirected(graph) => {
+                petgraph::algo::dijkstra(&graph, src, None, |e| e.weight().into())
+            }
+        };
+
+        nodes
+            .iter()
+            .map(|dst| {
+                if *dst == src {
+                    // there must be a single self-loop for each node
+                    return Ok(Some(self.get_edge_weight(&src, &src)?.into()));
+                }
+                Ok(paths.get(dst).copied())
+            })
+            .collect()
+    }
+
+    /// Check that each node has exactly one self-loop, which is required to compute shortest
+    /// paths.
+    pub fn verify_self_loops(&self, nodes: &[NodeIndex]) -> Result<(), NetGraphError> {
+        for node in nodes {
+            self.get_edge_weight(node, node)?;
+        }
+        Ok(())
+    }
+
+    /// The smallest latency of any edge in the graph, which is a lower bound on the latency of any
+    /// path.
+    pub fn smallest_edge_latency_ns(&self) -> Option<u64> {
+        match &self.graph {
+            GraphWrapper::Directed(graph) => graph
+                .edge_weights()
+                .map(|e| PathProperties::from(e).latency_ns)
+                .min(),
+            GraphWrapper::Undirected(graph) => graph
+                .edge_weights()
+                .map(|e| PathProperties::from(e).latency_ns)
+                .min(),
+        }
+    }
+
     pub fn get_direct_paths(
         &self,
         nodes: &[NodeIndex],
@@ -304,6 +374,17 @@ pub struct PathProperties {
     pub packet_loss: f32,
 }
 
+impl PathProperties {
+    /// This path with its latency rounded up to a multiple of `quantum_ns`.
+    pub fn with_latency_quantum(self, quantum_ns: NonZeroU64) -> Self {
+        let quantum_ns = quantum_ns.get();
+        Self {
+            latency_ns: (self.latency_ns + quantum_ns - 1) / quantum_ns * quantum_ns,
+            ..self
+        }
+    }
+}
+
 impl PartialOrd for PathProperties {
     fn partial_cmp(&self, other: &Self) -> Option<std::cmp::Ordering> {
         // order by lowest latency first, then by lowest packet loss
@@ -428,44 +509,259 @@ impl<T: Copy + Eq + Hash + std::fmt::Display> Default for IpAssignment<T> {
 }
 
 /// Routing information for paths between nodes.
+///
+/// Nodes are assigned dense indices (see [`RoutingInfo::node_index`]). The properties of the path
+/// between each pair of nodes are either stored in flat arrays indexed by `src * num_nodes + dst`,
+/// so that looking up a path by node index doesn't require any hashing, or are computed on demand
+/// and cached (see [`RoutingInfo::new_lazy`]).
+///
+/// Stored paths can be changed in place with [`RoutingInfo::set_path_by_index`], which must only
+/// be called while no hosts are running (between scheduling rounds).
 #[derive(Debug)]
 pub struct RoutingInfo<T: Eq + Hash + std::fmt::Display + Clone + Copy> {
-    paths: HashMap<(T, T), PathProperties>,
-    packet_counters: std::sync::RwLock<HashMap<(T, T), u64>>,
+    /// The node for each dense index.
+    nodes: Vec<T>,
+    /// The dense index of each node.
+    node_indices: HashMap<T, usize>,
+    paths: Paths,
+    /// Incremented whenever a path is changed, so that copies of paths can be invalidated.
+    generation: AtomicU64,
+}
+
+#[derive(Debug)]
+enum Paths {
+    Dense {
+        /// The latency of each path in nanoseconds, or `u64::MAX` if there is no path. The paths
+        /// are only changed between scheduling rounds, so relaxed loads are enough.
+        latencies_ns: Vec<AtomicU64>,
+        /// The packet loss of each path, as the bits of an `f32`.
+        packet_losses: Vec<AtomicU32>,
+        /// The number of packets sent along each path. Each path has its own atomic counter
+        /// rather than all threads sharing one locked map.
+        packet_counters: Vec<AtomicU64>,
+    },
+    Lazy {
+        cache: PathCache,
+        /// A lower bound on the latency of any path.
+        smallest_latency_ns: Option<u64>,
+    },
 }
 
 impl<T: Eq + Hash + std::fmt::Display + Clone + Copy> RoutingInfo<T> {
     pub fn new(paths: HashMap<(T, T), PathProperties>) -> Self {
+        let mut nodes = Vec::new();
+        let mut node_indices = HashMap::new();
+        for (src, dst) in paths.keys() {
+            for node in [src, dst] {
+                node_indices.entry(*node).or_insert_with(|| {
+                    nodes.push(*node);
+                    nodes.len() - 1
+                });
+            }
+        }
+
+        let num_paths = nodes.len().pow(2);
+        let mut latencies_ns = vec![u64::MAX; num_paths];
+        let mut packet_losses = vec![1.0; num_paths];
+        for ((src, dst), path) in paths {
+            let index = node_indices[&src] * nodes.len() + node_indices[&dst];
+            assert_ne!(path.latency_ns, u64::MAX);
+            latencies_ns[index] = path.latency_ns;
+            packet_losses[index] = path.packet_loss;
+        }
+
         Self {
-            paths,
-            packet_counters: std::sync::RwLock::new(HashMap::new()),
+            nodes,
+            node_indices,
+            paths: Paths::Dense {
+                latencies_ns: latencies_ns.into_iter().map(AtomicU64::new).collect(),
+                packet_losses: packet_losses
+                    .into_iter()
+                    .map(|x| AtomicU32::new(x.to_bits()))
+                    .collect(),
+                packet_counters: (0..num_paths).map(|_| AtomicU64::new(0)).collect(),
+            },
+            generation: AtomicU64::new(0),
+        }
+    }
+
+    /// Routing information where the paths from a node are computed by `compute` the first time
+    /// that they're needed, and the paths for at most `cache_size` source nodes are kept. The
+    /// dense index of each node is its index in `nodes`, and `compute` must return the paths from
+    /// a source node to each node in this order. `smallest_latency_ns` must not be larger than the
+    /// latency of any path.
+    pub fn new_lazy(
+        nodes: Vec<T>,
+        compute: PathSource,
+        cache_size: NonZeroUsize,
+        smallest_latency_ns: Option<u64>,
+    ) -> Self {
+        let node_indices: HashMap<_, _> = nodes.iter().enumerate().map(|(i, x)| (*x, i)).collect();
+        assert_eq!(node_indices.len(), nodes.len());
+
+        let num_nodes = nodes.len();
+        Self {
+            nodes,
+            node_indices,
+            paths: Paths::Lazy {
+                cache: PathCache::new(num_nodes, cache_size, compute),
+                smallest_latency_ns,
+            },
+            generation: AtomicU64::new(0),
         }
     }
 
+    /// Get the dense index of a node, for use with the `*_by_index` methods.
+    pub fn node_index(&self, node: T) -> Option<usize> {
+        self.node_indices.get(&node).copied()
+    }
+
+    fn path_index(&self, start: usize, end: usize) -> usize {
+        assert!(start < self.nodes.len() && end < self.nodes.len());
+        start * self.nodes.len() + end
+    }
+
     /// Get properties for the path from one node to another.
     pub fn path(&self, start: T, end: T) -> Option<PathProperties> {
-        self.paths.get(&(start, end)).copied()
+        self.path_by_index(self.node_index(start)?, self.node_index(end)?)
     }
 
-    /// Increment the number of packets sent from one node to another.
+    /// Get properties for the path from one node to another, using the nodes' dense indices.
+    pub fn path_by_index(&self, start: usize, end: usize) -> Option<PathProperties> {
+        let index = self.path_index(start, end);
+        match &self.paths {
+            Paths::Dense {
+                latencies_ns,
+                packet_losses,
+                ..
+            } => {
+                let latency_ns = latencies_ns[index].load(Ordering::Relaxed);
+                if latency_ns == u64::MAX {
+                    return None;
+                }
+                Some(PathProperties {
+                    latency_ns,
+                    packet_loss: f32::from_bits(packet_losses[index].load(Ordering::Relaxed)),
+                })
+            }
+            Paths::Lazy { cache, .. } => cache.path(start, end),
+        }
+    }
+
+    /// Whether paths can be changed with [`RoutingInfo::set_path_by_index`]. Paths that are
+    /// computed lazily can't be changed.
+    pub fn is_mutable(&self) -> bool {
+        matches!(self.paths, Paths::Dense { .. })
+    }
+
+    /// Change the properties of an existing path, using the nodes' dense indices. Must only be
+    /// called while no other thread is using the paths, such as between scheduling rounds. Panics
+    /// if there is no path between the nodes, or if the paths aren't mutable.
+    pub fn set_path_by_index(&self, start: usize, end: usize, path: PathProperties) {
+        let index = self.path_index(start, end);
+        let Paths::Dense {
+            latencies_ns,
+            packet_losses,
+            ..
+        } = &self.paths
+        else {
+            panic!("Lazily computed paths can't be changed");
+        };
+
+        assert_ne!(
+            latencies_ns[index].load(Ordering::Relaxed),
+            u64::MAX,
+            "No path"
+        );
+        assert_ne!(path.latency_ns, u64::MAX);
+        latencies_ns[index].store(path.latency_ns, Ordering::Relaxed);
+        packet_losses[index].store(path.packet_loss.to_bits(), Ordering::Relaxed);
+        self.generation.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// A number that changes whenever a path is changed. A copy of a path that was looked up
+    /// during the same generation is still valid.
+    pub fn generation(&self) -> u64 {
+        self.generation.load(Ordering::Relaxed)
+    }
+
+    /// Increment the number of packets sent from one node to another. Panics if there is no path
+    /// between the nodes.
     pub fn increment_packet_count(&self, start: T, end: T) {
-        let key = (start, end);
-        let mut packet_counters = self.packet_counters.write().unwrap();
-        match packet_counters.get_mut(&key) {
-            Some(x) => *x = x.saturating_add(1),
-            None => assert!(packet_counters.insert(key, 1).is_none()),
+        let (Some(start_index), Some(end_index)) = (self.node_index(start), self.node_index(end))
+        else {
+            panic!("No path from {start} to {end}");
+        };
+        self.increment_packet_count_by_index(start_index, end_index)
+    }
+
+    /// Increment the number of packets sent from one node to another, using the nodes' dense
+    /// indices. Panics if there is no path between the nodes.
+    pub fn increment_packet_count_by_index(&self, start: usize, end: usize) {
+        let index = self.path_index(start, end);
+        match &self.paths {
+            Paths::Dense {
+                latencies_ns,
+                packet_counters,
+                ..
+            } => {
+                assert_ne!(
+                    latencies_ns[index].load(Ordering::Relaxed),
+                    u64::MAX,
+                    "No path"
+                );
+                packet_counters[index].fetch_add(1, Ordering::Relaxed);
+            }
+            // the path must have been used recently to send this packet, so we don't look it up
+            // again to check that it exists
+            Paths::Lazy { cache, .. } => cache.increment_packet_count(start, end),
         }
     }
 
+    /// The number of packets sent along each path, as `(start, end, count)` using the nodes'
+    /// dense indices.
+    fn packet_counts(&self) -> Vec<(usize, usize, u64)> {
+        match &self.paths {
+            Paths::Dense {
+                packet_counters, ..
+            } => packet_counters
+                .iter()
+                .enumerate()
+                .map(|(index, count)| {
+                    let count = count.load(Ordering::Relaxed);
+                    (index / self.nodes.len(), index % self.nodes.len(), count)
+                })
+                .collect(),
+            Paths::Lazy { cache, .. } => cache.packet_counts(),
+        }
+    }
+
+    /// The number of packets sent with each path latency (in nanoseconds).
+    pub fn packet_latency_counts(&self) -> BTreeMap<u64, u64> {
+        let mut latencies = BTreeMap::new();
+        for (start, end, count) in self.packet_counts() {
+            if count == 0 {
+                continue;
+            }
+            let latency_ns = self.path_by_index(start, end).unwrap().latency_ns;
+            *latencies.entry(latency_ns).or_insert(0) += count;
+        }
+        latencies
+    }
+
     /// Log the number of packets sent between nodes.
     pub fn log_packet_counts(&self) {
         // only logs paths that have transmitted at least one packet
-        for ((start, end), count) in self.packet_counters.read().unwrap().iter() {
-            let path = self.paths.get(&(*start, *end)).unwrap();
+        for (start, end, count) in self.packet_counts() {
+            if count == 0 {
+                continue;
+            }
+
+            let path = self.path_by_index(start, end).unwrap();
             log::debug!(
                 "Found path {}->{}: latency={}ns, packet_loss={}, packet_count={}",
-                start,
-                end,
+                self.nodes[start],
+                self.nodes[end],
                 path.latency_ns,
                 path.packet_loss,
                 count,
@@ -473,45 +769,162 @@ impl<T: Eq + Hash + std::fmt::Display + Clone + Copy> RoutingInfo<T> {
         }
     }
 
+    /// Log statistics about the path cache, if paths are computed lazily.
+    pub fn log_path_cache_stats(&self) {
+        if let Paths::Lazy { cache, .. } = &self.paths {
+            cache.log_stats();
+        }
+    }
+
+    /// The smallest latency of any path. If paths are computed lazily, this is a lower bound.
     pub fn get_smallest_latency_ns(&self) -> Option<u64> {
-        self.paths.values().map(|x| x.latency_ns).min()
+        match &self.paths {
+            Paths::Dense { latencies_ns, .. } => latencies_ns
+                .iter()
+                .map(|x| x.load(Ordering::Relaxed))
+                .filter(|x| *x != u64::MAX)
+                .min(),
+            Paths::Lazy {
+                smallest_latency_ns,
+                ..
+            } => *smallest_latency_ns,
+        }
+    }
+}
+
+/// The size of the decompressed chunks sent from the decompression thread.
+const XZ_CHUNK_LEN: usize = 1 << 16;
+
+/// The number of decompressed chunks that may be waiting to be read.
+const XZ_CHUNKS_IN_FLIGHT: usize = 4;
+
+/// Writes decompressed data to a channel in chunks.
+struct ChunkWriter {
+    sender: std::sync::mpsc::SyncSender<std::io::Result<Vec<u8>>>,
+    chunk: Vec<u8>,
+}
+
+impl std::io::Write for ChunkWriter {
+    fn write(&mut self, buf: &[u8]) -> std::io::Result<usize> {
+        let len = std::cmp::min(buf.len(), XZ_CHUNK_LEN - self.chunk.len());
+        self.chunk.extend_from_slice(&buf[..len]);
+        if self.chunk.len() == XZ_CHUNK_LEN {
+            self.flush()?;
+        }
+        Ok(len)
+    }
+
+    fn flush(&mut self) -> std::io::Result<()> {
+        if self.chunk.is_empty() {
+            return Ok(());
+        }
+        let chunk = std::mem::replace(&mut self.chunk, Vec::with_capacity(XZ_CHUNK_LEN));
+        // an error means that the reader was dropped, so we should stop decompressing
+        self.sender
+            .send(Ok(chunk))
+            .map_err(|_| std::io::ErrorKind::BrokenPipe.into())
     }
 }
 
-/// Read and decompress a file.
-fn read_xz<P: AsRef<std::path::Path>>(path: P) -> Result<String, NetGraphError> {
+/// Reads chunks of decompressed data from a channel.
+struct ChunkReader {
+    receiver: std::sync::mpsc::Receiver<std::io::Result<Vec<u8>>>,
+    chunk: Vec<u8>,
+    offset: usize,
+}
+
+impl std::io::Read for ChunkReader {
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        if self.offset == self.chunk.len() {
+            match self.receiver.recv() {
+                Ok(chunk) => self.chunk = chunk?,
+                // the sender was dropped after sending everything
+                Err(_) => return Ok(0),
+            }
+            self.offset = 0;
+        }
+
+        let len = std::cmp::min(buf.len(), self.chunk.len() - self.offset);
+        buf[..len].copy_from_slice(&self.chunk[self.offset..][..len]);
+        self.offset += len;
+        Ok(len)
+    }
+}
+
+/// Open an xz-compressed file. The file is decompressed on a separate thread as the returned
+/// reader is read, so only a few chunks of the decompressed data are in memory at a time.
+fn open_xz<P: AsRef<std::path::Path>>(
+    path: P,
+) -> Result<Box<dyn std::io::Read + Send>, NetGraphError> {
     let path = path.as_ref();
 
     let mut f = std::io::BufReader::new(
         std::fs::File::open(path).with_context(|| format!("Failed to open file: {path:?}"))?,
     );
 
-    let mut decomp: Vec<u8> = Vec::new();
-    lzma_rs::xz_decompress(&mut f, &mut decomp).context("Failed to decompress file")?;
-    decomp.shrink_to_fit();
+    let (sender, receiver) = std::sync::mpsc::sync_channel(XZ_CHUNKS_IN_FLIGHT);
+
+    std::thread::Builder::new()
+        .name("xz-decompress".into())
+        .spawn(move || {
+            let mut writer = ChunkWriter {
+                sender: sender.clone(),
+                chunk: Vec::with_capacity(XZ_CHUNK_LEN),
+            };
+            let rv = lzma_rs::xz_decompress(&mut f, &mut writer)
+                .map_err(|e| std::io::Error::new(std::io::ErrorKind::InvalidData, e))
+                .and_then(|()| std::io::Write::flush(&mut writer));
+            if let Err(e) = rv {
+                // ignore the error if the reader was dropped
+                let _ = sender.send(Err(e));
+            }
+        })
+        .context("Failed to start the decompression thread")?;
 
-    Ok(String::from_utf8(decomp)?)
+    Ok(Box::new(ChunkReader {
+        receiver,
+        chunk: Vec::new(),
+        offset: 0,
+    }))
 }
 
-/// Get the network graph as a string.
-pub fn load_network_graph(graph_options: &GraphOptions) -> Result<String, NetGraphError> {
-    Ok(match graph_options {
-        GraphOptions::Gml(GraphSource::File(FileSource {
+/// Open a configured file for reading, decompressing it if needed. The file should be read using a
+/// buffered reader.
+pub fn open_file_source(
+    source: &FileSource,
+) -> Result<Box<dyn std::io::Read + Send>, NetGraphError> {
+    Ok(match source {
+        FileSource {
             compression: None,
             path: f,
-        })) => std::fs::read_to_string(tilde_expansion(f))
-            .with_context(|| format!("Failed to read file: {f}"))?,
-        GraphOptions::Gml(GraphSource::File(FileSource {
+        } => Box::new(
+            std::fs::File::open(tilde_expansion(f))
+                .with_context(|| format!("Failed to open file: {f}"))?,
+        ),
+        FileSource {
             compression: Some(Compression::Xz),
             path: f,
-        })) => read_xz(tilde_expansion(f))?,
-        GraphOptions::Gml(GraphSource::Inline(s)) => s.clone(),
-        GraphOptions::OneGbitSwitch => configuration::ONE_GBIT_SWITCH_GRAPH.to_string(),
+        } => open_xz(tilde_expansion(f))?,
+    })
+}
+
+/// Open the network graph for reading. The graph should be read using a buffered reader.
+pub fn open_network_graph(
+    graph_options: &GraphOptions,
+) -> Result<Box<dyn std::io::Read + Send>, NetGraphError> {
+    Ok(match graph_options {
+        GraphOptions::Gml(GraphSource::File(source)) => open_file_source(source)?,
+        GraphOptions::Gml(GraphSource::Inline(s)) => {
+            Box::new(std::io::Cursor::new(s.clone().into_bytes()))
+        }
+        GraphOptions::OneGbitSwitch => Box::new(configuration::ONE_GBIT_SWITCH_GRAPH.as_bytes()),
     })
 }
 
 #[cfg(test)]
 mod tests {
+    use std::io::Read;
+
     use super::*;
 
     #[test]
@@ -530,6 +943,194 @@ mod tests {
         assert!((p3.packet_loss - 0.9025).abs() < 0.01);
     }
 
+    #[test]
+    fn test_packet_counts() {
+        let path = PathProperties {
+            latency_ns: 1,
+            packet_loss: 0.0,
+        };
+        let routing = RoutingInfo::new(HashMap::from([((1, 2), path), ((2, 1), path)]));
+
+        std::thread::scope(|s| {
+            for _ in 0..4 {
+                s.spawn(|| {
+                    for _ in 0..1000 {
+                        routing.increment_packet_count(1, 2);
+                    }
+                });
+            }
+        });
+
+        let count = |src, dst| {
+            let index = routing.path_index(
+                routing.node_index(src).unwrap(),
+                routing.node_index(dst).unwrap(),
+            );
+            let Paths::Dense {
+                packet_counters, ..
+            } = &routing.paths
+            else {
+                unreachable!();
+            };
+            packet_counters[index].load(Ordering::Relaxed)
+        };
+
+        assert_eq!(count(1, 2), 4000);
+        assert_eq!(count(2, 1), 0);
+    }
+
+    #[test]
+    fn test_packet_latency_counts() {
+        let path = |latency_ns| PathProperties {
+            latency_ns,
+            packet_loss: 0.0,
+        };
+        let routing = RoutingInfo::new(HashMap::from([
+            ((1, 2), path(5)),
+            ((2, 1), path(5)),
+            ((1, 1), path(2)),
+            ((2, 2), path(3)),
+        ]));
+
+        routing.increment_packet_count(1, 2);
+        routing.increment_packet_count(2, 1);
+        routing.increment_packet_count(1, 1);
+
+        assert_eq!(
+            routing.packet_latency_counts(),
+            BTreeMap::from([(2, 1), (5, 2)])
+        );
+    }
+
+    #[test]
+    fn test_latency_quantum() {
+        let path = |latency_ns| PathProperties {
+            latency_ns,
+            packet_loss: 0.5,
+        };
+        let quantum = NonZeroU64::new(10).unwrap();
+
+        assert_eq!(path(1).with_latency_quantum(quantum).latency_ns, 10);
+        assert_eq!(path(10).with_latency_quantum(quantum).latency_ns, 10);
+        assert_eq!(path(11).with_latency_quantum(quantum).latency_ns, 20);
+        assert_eq!(path(11).with_latency_quantum(quantum).packet_loss, 0.5);
+    }
+
+    #[test]
+    fn test_routing_info_paths() {
+        let path = |latency_ns| PathProperties {
+            latency_ns,
+            packet_loss: 0.0,
+        };
+        let routing = RoutingInfo::new(HashMap::from([((1, 2), path(5)), ((2, 2), path(3))]));
+
+        assert_eq!(routing.path(1, 2).unwrap().latency_ns, 5);
+        assert_eq!(routing.path(2, 2).unwrap().latency_ns, 3);
+        assert!(routing.path(2, 1).is_none());
+        assert!(routing.path(1, 3).is_none());
+        assert_eq!(routing.get_smallest_latency_ns(), Some(3));
+    }
+
+    #[test]
+    fn test_set_path() {
+        let path = |latency_ns, packet_loss| PathProperties {
+            latency_ns,
+            packet_loss,
+        };
+        let routing = RoutingInfo::new(HashMap::from([
+            ((1, 2), path(5, 0.0)),
+            ((2, 1), path(5, 0.0)),
+        ]));
+        assert!(routing.is_mutable());
+
+        let generation = routing.generation();
+        let (a, b) = (
+            routing.node_index(1).unwrap(),
+            routing.node_index(2).unwrap(),
+        );
+        routing.set_path_by_index(a, b, path(2, 0.25));
+        assert_ne!(routing.generation(), generation);
+
+        assert_eq!(routing.path(1, 2).unwrap().latency_ns, 2);
+        assert_eq!(routing.path(1, 2).unwrap().packet_loss, 0.25);
+        assert_eq!(routing.path(2, 1).unwrap().latency_ns, 5);
+        assert_eq!(routing.get_smallest_latency_ns(), Some(2));
+    }
+
+    #[test]
+    fn test_lazy_routing_info() {
+        let graph = NetworkGraph::parse(
+            r#"graph [
+              directed 1
+              node [ id 0 ]
+              node [ id 1 ]
+              node [ id 2 ]
+              edge [ source 0 target 0 latency "2 ns" ]
+              edge [ source 1 target 1 latency "2 ns" ]
+              edge [ source 2 target 2 latency "2 ns" ]
+              edge [ source 0 target 1 latency "3 ns" ]
+              edge [ source 1 target 2 latency "4 ns" ]
+            ]"#,
+        )
+        .unwrap();
+
+        let ids = vec![0, 1, 2];
+        let indices: Vec<_> = ids
+            .iter()
+            .map(|x| *graph.node_id_to_index(*x).unwrap())
+            .collect();
+        graph.verify_self_loops(&indices).unwrap();
+        let smallest_latency_ns = graph.smallest_edge_latency_ns();
+        assert_eq!(smallest_latency_ns, Some(2));
+
+        let routing = RoutingInfo::new_lazy(
+            ids,
+            Box::new(move |src| graph.shortest_paths_from(indices[src], &indices).unwrap()),
+            NonZeroUsize::new(1).unwrap(),
+            smallest_latency_ns,
+        );
+
+        assert_eq!(routing.path(0, 2).unwrap().latency_ns, 7);
+        assert_eq!(routing.path(0, 0).unwrap().latency_ns, 2);
+        assert!(routing.path(2, 0).is_none());
+        assert_eq!(routing.path(1, 2).unwrap().latency_ns, 4);
+        assert_eq!(routing.get_smallest_latency_ns(), Some(2));
+
+        routing.increment_packet_count(0, 2);
+        let Paths::Lazy { cache, .. } = &routing.paths else {
+            unreachable!();
+        };
+        assert_eq!(cache.packet_counts(), [(0, 2, 1)]);
+    }
+
+    #[test]
+    fn test_open_xz() {
+        // larger than a few chunks
+        let text: String = (0..100_000).map(|x| format!("{x}\n")).collect();
+        assert!(text.len() > XZ_CHUNK_LEN * (XZ_CHUNKS_IN_FLIGHT + 2));
+
+        let mut compressed = Vec::new();
+        lzma_rs::xz_compress(&mut text.as_bytes(), &mut compressed).unwrap();
+        let mut file = tempfile::NamedTempFile::new().unwrap();
+        std::io::Write::write_all(&mut file, &compressed).unwrap();
+
+        let mut decompressed = String::new();
+        open_xz(file.path())
+            .unwrap()
+            .read_to_string(&mut decompressed)
+            .unwrap();
+        assert_eq!(decompressed, text);
+
+        // not xz data
+        let file = tempfile::NamedTempFile::new().unwrap();
+        std::fs::write(file.path(), &text).unwrap();
+        let mut decompressed = String::new();
+        assert!(open_xz(file.path())
+            .unwrap()
+            .read_to_string(&mut decompressed)
+            .is_err());
+    }
+
     #[test]
     fn test_nonexistent_id() {
         for id in &[2, 3] {
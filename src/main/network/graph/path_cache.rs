@@ -0,0 +1,282 @@
+use std::collections::HashMap;
+use std::num::NonZeroUsize;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, RwLock};
+
+use crossbeam::utils::CachePadded;
+
+use super::PathProperties;
+
+/// The number of cache hit counters in a [`PathCache`]. Each thread only increments the counter at
+/// its own index, so threads don't share a counter unless there are more threads than counters.
+const HIT_COUNTERS: usize = 64;
+
+std::thread_local! {
+    /// This thread's index into the hit counters of a [`PathCache`].
+    static HIT_COUNTER_INDEX: usize = {
+        static NEXT_INDEX: AtomicUsize = AtomicUsize::new(0);
+        NEXT_INDEX.fetch_add(1, Ordering::Relaxed) % HIT_COUNTERS
+    };
+}
+
+/// Computes the paths from a source node to every node, by the nodes' dense indices.
+pub type PathSource = Box<dyn Fn(usize) -> Vec<Option<PathProperties>> + Send + Sync>;
+
+/// A bounded cache of the paths from each source node to every other node. The paths for a source
+/// node are only computed the first time they're needed, and the least recently used source
+/// nodes are evicted when the cache is full.
+pub struct PathCache {
+    compute: PathSource,
+    num_nodes: usize,
+    capacity: NonZeroUsize,
+    rows: RwLock<HashMap<usize, CachedRow>>,
+    /// Incremented on every cache miss. Rows store the clock value from when they were last used,
+    /// so all rows used since the previous miss are treated as equally recent.
+    clock: AtomicU64,
+    /// Cache hits, counted separately by each thread (see `HIT_COUNTER_INDEX`) and summed when
+    /// they're logged.
+    hits: Box<[CachePadded<AtomicU64>]>,
+    misses: AtomicU64,
+    evictions: AtomicU64,
+    /// The number of packets sent along each path whose source node isn't cached, as
+    /// `(src, dst) -> count`. A row's counts are moved here when it's evicted.
+    uncached_packet_counts: Mutex<HashMap<(usize, usize), u64>>,
+}
+
+struct CachedRow {
+    paths: Arc<Vec<Option<PathProperties>>>,
+    last_used: AtomicU64,
+    /// The number of packets sent from this row's source node to each destination node.
+    packet_counters: Box<[AtomicU64]>,
+}
+
+impl PathCache {
+    pub fn new(num_nodes: usize, capacity: NonZeroUsize, compute: PathSource) -> Self {
+        Self {
+            compute,
+            num_nodes,
+            capacity,
+            rows: RwLock::new(HashMap::new()),
+            clock: AtomicU64::new(0),
+            hits: (0..HIT_COUNTERS)
+                .map(|_| CachePadded::new(AtomicU64::new(0)))
+                .collect(),
+            misses: AtomicU64::new(0),
+            evictions: AtomicU64::new(0),
+            uncached_packet_counts: Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// Get the paths from the `src` node to all nodes, computing them if they aren't cached.
+    fn row(&self, src: usize) -> Arc<Vec<Option<PathProperties>>> {
+        let now = self.clock.load(Ordering::Relaxed);
+
+        if let Some(row) = self.rows.read().unwrap().get(&src) {
+            // avoid writing to the shared cache line if we don't need to
+            if row.last_used.load(Ordering::Relaxed) != now {
+                row.last_used.store(now, Ordering::Relaxed);
+            }
+            HIT_COUNTER_INDEX.with(|i| self.hits[*i].fetch_add(1, Ordering::Relaxed));
+            return Arc::clone(&row.paths);
+        }
+
+        // compute the paths without holding the lock; another thread may compute the same paths
+        // at the same time, in which case we keep whichever is inserted first
+        let paths = Arc::new((self.compute)(src));
+        self.misses.fetch_add(1, Ordering::Relaxed);
+        // rows used after this miss will be more recent than this row
+        let now = self.clock.fetch_add(1, Ordering::Relaxed);
+
+        let mut rows = self.rows.write().unwrap();
+
+        if !rows.contains_key(&src) && rows.len() >= self.capacity.get() {
+            // evict the least recently used row (ties are broken by the node index so that the
+            // choice doesn't depend on the hash map's order)
+            let (evict, _) = rows
+                .iter()
+                .map(|(node, row)| (*node, row.last_used.load(Ordering::Relaxed)))
+                .min_by_key(|(node, last_used)| (*last_used, *node))
+                .unwrap();
+            let row = rows.remove(&evict).unwrap();
+            self.evictions.fetch_add(1, Ordering::Relaxed);
+
+            // keep the evicted row's packet counts
+            let mut uncached = self.uncached_packet_counts.lock().unwrap();
+            for (dst, count) in row.packet_counters.iter().enumerate() {
+                let count = count.load(Ordering::Relaxed);
+                if count != 0 {
+                    *uncached.entry((evict, dst)).or_insert(0) += count;
+                }
+            }
+        }
+
+        let row = rows.entry(src).or_insert_with(|| CachedRow {
+            paths,
+            last_used: AtomicU64::new(now),
+            packet_counters: (0..self.num_nodes).map(|_| AtomicU64::new(0)).collect(),
+        });
+        Arc::clone(&row.paths)
+    }
+
+    /// Get properties for the path from one node to another.
+    pub fn path(&self, src: usize, dst: usize) -> Option<PathProperties> {
+        self.row(src)[dst]
+    }
+
+    /// Increment the number of packets sent from one node to another.
+    pub fn increment_packet_count(&self, src: usize, dst: usize) {
+        assert!(dst < self.num_nodes);
+
+        // the path was just used to send the packet, so its row is almost always still cached
+        if let Some(row) = self.rows.read().unwrap().get(&src) {
+            row.packet_counters[dst].fetch_add(1, Ordering::Relaxed);
+            return;
+        }
+
+        *self
+            .uncached_packet_counts
+            .lock()
+            .unwrap()
+            .entry((src, dst))
+            .or_insert(0) += 1;
+    }
+
+    /// The number of packets sent along each path that has sent at least one packet, as
+    /// `(src, dst, count)`.
+    pub fn packet_counts(&self) -> Vec<(usize, usize, u64)> {
+        let mut counts = self.uncached_packet_counts.lock().unwrap().clone();
+        for (src, row) in self.rows.read().unwrap().iter() {
+            for (dst, count) in row.packet_counters.iter().enumerate() {
+                let count = count.load(Ordering::Relaxed);
+                if count != 0 {
+                    *counts.entry((*src, dst)).or_insert(0) += count;
+                }
+            }
+        }
+
+        let mut counts: Vec<_> = counts
+            .into_iter()
+            .map(|((src, dst), count)| (src, dst, count))
+            .collect();
+        counts.sort();
+        counts
+    }
+
+    /// The number of cache hits from all threads.
+    fn hits(&self) -> u64 {
+        self.hits.iter().map(|x| x.load(Ordering::Relaxed)).sum()
+    }
+
+    /// Log the number of cache hits, misses, and evictions. Should be called once the worker
+    /// threads have finished, so that all of their hits are included.
+    pub fn log_stats(&self) {
+        let hits = self.hits();
+        let misses = self.misses.load(Ordering::Relaxed);
+        let lookups = hits + misses;
+        let hit_rate = if lookups == 0 {
+            0.0
+        } else {
+            100.0 * hits as f64 / lookups as f64
+        };
+        log::info!(
+            "Shortest path cache: {hits} hits, {misses} misses ({hit_rate:.2}% hit rate), {} \
+             evictions, capacity of {} source nodes",
+            self.evictions.load(Ordering::Relaxed),
+            self.capacity,
+        );
+    }
+}
+
+impl std::fmt::Debug for PathCache {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("PathCache")
+            .field("capacity", &self.capacity)
+            .field("cached_rows", &self.rows.read().unwrap().len())
+            .field("hits", &self.hits())
+            .field("misses", &self.misses)
+            .finish_non_exhaustive()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn cache(num_nodes: usize, capacity: usize) -> (PathCache, Arc<AtomicU64>) {
+        let computed = Arc::new(AtomicU64::new(0));
+        let computed_clone = Arc::clone(&computed);
+        let cache = PathCache::new(
+            num_nodes,
+            NonZeroUsize::new(capacity).unwrap(),
+            Box::new(move |src| {
+                computed_clone.fetch_add(1, Ordering::Relaxed);
+                (0..num_nodes)
+                    .map(|dst| {
+                        Some(PathProperties {
+                            latency_ns: (src * 100 + dst) as u64,
+                            packet_loss: 0.0,
+                        })
+                    })
+                    .collect()
+            }),
+        );
+        (cache, computed)
+    }
+
+    #[test]
+    fn test_path() {
+        let (cache, computed) = cache(4, 2);
+        assert_eq!(cache.path(1, 3).unwrap().latency_ns, 103);
+        assert_eq!(cache.path(1, 2).unwrap().latency_ns, 102);
+        assert_eq!(cache.path(3, 0).unwrap().latency_ns, 300);
+        assert_eq!(computed.load(Ordering::Relaxed), 2);
+        assert_eq!(cache.hits(), 1);
+        assert_eq!(cache.misses.load(Ordering::Relaxed), 2);
+    }
+
+    #[test]
+    fn test_eviction() {
+        let (cache, computed) = cache(4, 2);
+        cache.path(0, 0);
+        cache.path(1, 0);
+        // use 0 again so that 1 is the least recently used
+        cache.path(0, 0);
+        cache.path(2, 0);
+        assert_eq!(computed.load(Ordering::Relaxed), 3);
+        assert_eq!(cache.evictions.load(Ordering::Relaxed), 1);
+
+        // 0 should still be cached, but 1 was evicted
+        cache.path(0, 1);
+        assert_eq!(computed.load(Ordering::Relaxed), 3);
+        cache.path(1, 1);
+        assert_eq!(computed.load(Ordering::Relaxed), 4);
+        assert!(cache.rows.read().unwrap().len() <= 2);
+    }
+
+    #[test]
+    fn test_packet_counts() {
+        let (cache, _) = cache(3, 1);
+        cache.increment_packet_count(2, 0);
+        cache.increment_packet_count(0, 1);
+        cache.increment_packet_count(2, 0);
+        assert_eq!(cache.packet_counts(), [(0, 1, 1), (2, 0, 2)]);
+    }
+
+    #[test]
+    fn test_packet_counts_evicted() {
+        let (cache, _) = cache(3, 1);
+        cache.path(2, 0);
+        cache.increment_packet_count(2, 0);
+        cache.increment_packet_count(2, 1);
+
+        // evicts row 2, whose counts must be kept
+        cache.path(0, 1);
+        cache.increment_packet_count(0, 1);
+        assert_eq!(cache.evictions.load(Ordering::Relaxed), 1);
+
+        // row 2 is computed again with new counters
+        cache.path(2, 0);
+        cache.increment_packet_count(2, 0);
+        assert_eq!(cache.packet_counts(), [(0, 1, 1), (2, 0, 2), (2, 1, 1)]);
+    }
+}
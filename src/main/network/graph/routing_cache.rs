@@ -0,0 +1,342 @@
+//! A binary file containing precomputed shortest paths between all nodes of a network graph, so
+//! that simulations which reuse the same graph don't need to recompute them.
+//!
+//! The file is memory-mapped when loaded, so only the pages for the paths that the simulation
+//! uses are read. All values are stored in native byte order. The layout is:
+//!
+//! ```text
+//! magic: [u8; 8]
+//! version: u32
+//! reserved: u32
+//! graph hash: u64
+//! number of nodes (N): u64
+//! node ids: [u32; N] (sorted, padded to a multiple of 8 bytes)
+//! latencies in nanoseconds: [u64; N * N] (u64::MAX if there is no path)
+//! packet losses: [f32; N * N]
+//! ```
+
+use std::collections::HashMap;
+use std::io::Write;
+use std::num::NonZeroUsize;
+use std::os::raw::c_void;
+
+use anyhow::Context;
+use nix::sys::mman::{MapFlags, ProtFlags};
+
+use super::{open_network_graph, NetworkGraph, PathProperties};
+use crate::core::support::configuration::{Compression, FileSource, GraphOptions, GraphSource};
+
+const MAGIC: [u8; 8] = *b"SHDWRTC\0";
+
+/// Must be incremented whenever the file layout changes.
+const VERSION: u32 = 1;
+
+const HEADER_LEN: usize = 32;
+
+/// A reader that hashes the data read through it, so that a routing cache can be checked against
+/// the graph text it was generated from. This is FNV-1a, which unlike the std hashers is guaranteed
+/// to be stable across Rust versions.
+pub struct HashingReader<R> {
+    inner: R,
+    hash: u64,
+}
+
+impl<R> HashingReader<R> {
+    pub fn new(inner: R) -> Self {
+        Self {
+            inner,
+            hash: 0xcbf29ce484222325,
+        }
+    }
+
+    /// The hash of all data that has been read so far.
+    pub fn hash(&self) -> u64 {
+        self.hash
+    }
+}
+
+impl<R: std::io::Read> std::io::Read for HashingReader<R> {
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        let len = self.inner.read(buf)?;
+        for byte in &buf[..len] {
+            self.hash ^= u64::from(*byte);
+            self.hash = self.hash.wrapping_mul(0x100000001b3);
+        }
+        Ok(len)
+    }
+}
+
+/// Parse the network graph, and hash the entire graph text.
+pub fn parse_and_hash_graph(graph_options: &GraphOptions) -> anyhow::Result<(NetworkGraph, u64)> {
+    let reader = open_network_graph(graph_options)
+        .map_err(|e| anyhow::anyhow!(e))
+        .context("Failed to load the network graph")?;
+    let mut reader = std::io::BufReader::new(HashingReader::new(reader));
+
+    let graph = NetworkGraph::parse_reader(&mut reader)
+        .map_err(|e| anyhow::anyhow!(e))
+        .context("Failed to parse the network graph")?;
+
+    // the hash covers anything after the end of the graph as well
+    std::io::copy(&mut reader, &mut std::io::sink()).context("Failed to read the network graph")?;
+
+    Ok((graph, reader.get_ref().hash()))
+}
+
+fn node_ids_len(num_nodes: usize) -> usize {
+    // pad so that the following u64 values are aligned
+    (num_nodes * std::mem::size_of::<u32>() + 7) / 8 * 8
+}
+
+fn file_len(num_nodes: usize) -> Option<usize> {
+    let num_paths = num_nodes.checked_mul(num_nodes)?;
+    let path_len = std::mem::size_of::<u64>() + std::mem::size_of::<f32>();
+    num_paths
+        .checked_mul(path_len)?
+        .checked_add(HEADER_LEN + node_ids_len(num_nodes))
+}
+
+/// Write the paths between all pairs of `nodes` to a routing cache file.
+pub fn write(
+    path: impl AsRef<std::path::Path>,
+    graph_hash: u64,
+    nodes: &[u32],
+    paths: &HashMap<(u32, u32), PathProperties>,
+) -> anyhow::Result<()> {
+    let mut nodes = nodes.to_vec();
+    nodes.sort();
+    nodes.dedup();
+
+    let num_paths = nodes.len() * nodes.len();
+    let mut latencies_ns = vec![u64::MAX; num_paths];
+    let mut packet_losses = vec![1.0f32; num_paths];
+    for (i, src) in nodes.iter().enumerate() {
+        for (j, dst) in nodes.iter().enumerate() {
+            if let Some(path) = paths.get(&(*src, *dst)) {
+                latencies_ns[i * nodes.len() + j] = path.latency_ns;
+                packet_losses[i * nodes.len() + j] = path.packet_loss;
+            }
+        }
+    }
+
+    let file = std::fs::File::create(path)?;
+    let mut file = std::io::BufWriter::new(file);
+
+    file.write_all(&MAGIC)?;
+    file.write_all(&VERSION.to_ne_bytes())?;
+    file.write_all(&0u32.to_ne_bytes())?;
+    file.write_all(&graph_hash.to_ne_bytes())?;
+    file.write_all(&u64::try_from(nodes.len()).unwrap().to_ne_bytes())?;
+
+    let node_bytes: &[u8] = bytemuck::cast_slice(&nodes);
+    file.write_all(node_bytes)?;
+    file.write_all(&vec![0u8; node_ids_len(nodes.len()) - node_bytes.len()])?;
+    file.write_all(bytemuck::cast_slice(&latencies_ns))?;
+    file.write_all(bytemuck::cast_slice(&packet_losses))?;
+
+    file.flush()?;
+    Ok(())
+}
+
+/// A memory-mapped routing cache file.
+#[derive(Debug)]
+pub struct RoutingCache {
+    ptr: *mut c_void,
+    len: usize,
+    num_nodes: usize,
+}
+
+// the mapping is read-only and owned by this object
+unsafe impl Send for RoutingCache {}
+unsafe impl Sync for RoutingCache {}
+
+impl RoutingCache {
+    /// Map a routing cache file. Returns an error if the file is not a valid routing cache, or if
+    /// it was generated from a graph with a different hash.
+    pub fn open(path: impl AsRef<std::path::Path>, graph_hash: u64) -> anyhow::Result<Self> {
+        let file = std::fs::File::open(path)?;
+        let len = usize::try_from(file.metadata()?.len()).unwrap();
+        if len < HEADER_LEN {
+            anyhow::bail!("The file is too small to be a routing cache");
+        }
+
+        let ptr = unsafe {
+            nix::sys::mman::mmap(
+                None,
+                NonZeroUsize::new(len).unwrap(),
+                ProtFlags::PROT_READ,
+                MapFlags::MAP_PRIVATE,
+                Some(&file),
+                0,
+            )
+        }
+        .context("Failed to map the routing cache")?;
+
+        // the file can be closed once it has been mapped
+        let mut cache = Self {
+            ptr,
+            len,
+            num_nodes: 0,
+        };
+
+        let bytes = cache.bytes();
+        let header_u32 =
+            |offset: usize| u32::from_ne_bytes(bytes[offset..][..4].try_into().unwrap());
+        let header_u64 =
+            |offset: usize| u64::from_ne_bytes(bytes[offset..][..8].try_into().unwrap());
+
+        if bytes[..8] != MAGIC {
+            anyhow::bail!("The file is not a routing cache");
+        }
+        if header_u32(8) != VERSION {
+            anyhow::bail!(
+                "The routing cache has version {}, but version {VERSION} is required",
+                header_u32(8),
+            );
+        }
+        if header_u64(16) != graph_hash {
+            anyhow::bail!(
+                "The routing cache was generated from a different network graph \
+                 (it will need to be regenerated with '--precompute-routing')"
+            );
+        }
+
+        let num_nodes = usize::try_from(header_u64(24)).unwrap();
+        // a corrupt node count might overflow
+        if num_nodes > len || file_len(num_nodes) != Some(len) {
+            anyhow::bail!("The routing cache has an unexpected size");
+        }
+        cache.num_nodes = num_nodes;
+
+        if !cache.node_ids().windows(2).all(|x| x[0] < x[1]) {
+            anyhow::bail!("The routing cache's nodes are not sorted");
+        }
+
+        Ok(cache)
+    }
+
+    fn bytes(&self) -> &[u8] {
+        unsafe { std::slice::from_raw_parts(self.ptr as *const u8, self.len) }
+    }
+
+    /// The sorted ids of all nodes in the cache.
+    pub fn node_ids(&self) -> &[u32] {
+        let start = HEADER_LEN;
+        bytemuck::cast_slice(&self.bytes()[start..][..self.num_nodes * 4])
+    }
+
+    fn latencies_ns(&self) -> &[u64] {
+        let start = HEADER_LEN + node_ids_len(self.num_nodes);
+        bytemuck::cast_slice(&self.bytes()[start..][..self.num_nodes.pow(2) * 8])
+    }
+
+    fn packet_losses(&self) -> &[f32] {
+        let start = HEADER_LEN + node_ids_len(self.num_nodes) + self.num_nodes.pow(2) * 8;
+        bytemuck::cast_slice(&self.bytes()[start..][..self.num_nodes.pow(2) * 4])
+    }
+
+    /// Get properties for the path from one node to another.
+    pub fn path(&self, src: u32, dst: u32) -> Option<PathProperties> {
+        let src = self.node_ids().binary_search(&src).ok()?;
+        let dst = self.node_ids().binary_search(&dst).ok()?;
+        let index = src * self.num_nodes + dst;
+
+        let latency_ns = self.latencies_ns()[index];
+        if latency_ns == u64::MAX {
+            return None;
+        }
+
+        Some(PathProperties {
+            latency_ns,
+            packet_loss: self.packet_losses()[index],
+        })
+    }
+}
+
+impl Drop for RoutingCache {
+    fn drop(&mut self) {
+        unsafe { nix::sys::mman::munmap(self.ptr, self.len) }
+            .unwrap_or_else(|e| log::warn!("munmap: {}", e));
+    }
+}
+
+/// Compute the shortest paths between all nodes of the GML graph file at `graph_path` and write
+/// them to a routing cache file at `output_path`. The graph file is assumed to be xz-compressed if
+/// its name ends with ".xz".
+pub fn precompute_routing(graph_path: &str, output_path: &str) -> anyhow::Result<()> {
+    let compression = graph_path.ends_with(".xz").then_some(Compression::Xz);
+    let (graph, graph_hash) =
+        parse_and_hash_graph(&GraphOptions::Gml(GraphSource::File(FileSource {
+            compression,
+            path: graph_path.to_string(),
+        })))?;
+
+    let nodes: Vec<_> = graph.node_id_to_index_map.values().copied().collect();
+    let paths: HashMap<_, _> = graph
+        .compute_shortest_paths(&nodes)
+        .map_err(|e| anyhow::anyhow!(e))
+        .context("Failed to compute shortest paths between graph nodes")?
+        .into_iter()
+        .map(|((src, dst), path)| {
+            let src = graph.node_index_to_id(src).unwrap();
+            let dst = graph.node_index_to_id(dst).unwrap();
+            ((src, dst), path)
+        })
+        .collect();
+
+    let node_ids: Vec<_> = graph.node_id_to_index_map.keys().copied().collect();
+    write(output_path, graph_hash, &node_ids, &paths)
+        .with_context(|| format!("Failed to write the routing cache {output_path}"))?;
+
+    log::info!(
+        "Wrote the shortest paths between {} nodes to {output_path}",
+        node_ids.len()
+    );
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_hashing_reader() {
+        let hash = |text: &str| {
+            let mut reader = HashingReader::new(text.as_bytes());
+            std::io::copy(&mut reader, &mut std::io::sink()).unwrap();
+            reader.hash()
+        };
+        assert_eq!(hash(""), 0xcbf29ce484222325);
+        assert_eq!(hash("a"), 0xaf63dc4c8601ec8c);
+        assert_ne!(hash("graph [ ]"), hash("graph [  ]"));
+    }
+
+    #[test]
+    fn test_write_and_open() {
+        let path = |latency_ns, packet_loss| PathProperties {
+            latency_ns,
+            packet_loss,
+        };
+        let paths = HashMap::from([
+            ((7, 7), path(1, 0.0)),
+            ((7, 3), path(20, 0.5)),
+            ((3, 3), path(2, 0.0)),
+        ]);
+
+        let dir = tempfile::tempdir().unwrap();
+        let file = dir.path().join("routes.bin");
+        write(&file, 1234, &[7, 3, 5], &paths).unwrap();
+
+        let cache = RoutingCache::open(&file, 1234).unwrap();
+        assert_eq!(cache.node_ids(), [3, 5, 7]);
+        assert_eq!(cache.path(7, 3).unwrap().latency_ns, 20);
+        assert_eq!(cache.path(7, 3).unwrap().packet_loss, 0.5);
+        assert_eq!(cache.path(3, 3).unwrap().latency_ns, 2);
+        assert!(cache.path(3, 7).is_none());
+        assert!(cache.path(5, 5).is_none());
+        assert!(cache.path(4, 3).is_none());
+
+        assert!(RoutingCache::open(&file, 1235).is_err());
+    }
+}
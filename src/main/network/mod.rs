@@ -3,9 +3,11 @@ use std::net::Ipv4Addr;
 use crate::network::packet::PacketRc;
 
 pub mod graph;
+pub mod multicast;
 pub mod packet;
 pub mod relay;
 pub mod router;
+pub mod schedule;
 
 pub trait PacketDevice {
     fn get_address(&self) -> Ipv4Addr;
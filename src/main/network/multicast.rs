@@ -0,0 +1,183 @@
+//! The hosts that receive multicast and broadcast packets.
+//!
+//! A packet sent to a multicast group is delivered to every other host that has a socket in the
+//! group, and a packet sent to the limited broadcast address (255.255.255.255) is delivered to
+//! every other host on the sender's network graph node, which Shadow treats as the sender's local
+//! network. The sender's worker looks up the destination hosts once and sends each of them a copy
+//! of the packet, and the copies share the packet's payload.
+//!
+//! Hosts join and leave groups while the simulation is running, but a host's changes only become
+//! visible to other hosts at the end of the scheduling round, so that which hosts receive a packet
+//! doesn't depend on the order in which the threads run their hosts. This is similar to the delay
+//! before a router learns of a membership change in a real network. When the rounds are run
+//! without a global barrier, there's no point at which all hosts have stopped, so changes are
+//! visible as soon as they're made and which hosts receive a packet may differ between runs.
+
+use std::collections::HashMap;
+use std::net::Ipv4Addr;
+use std::sync::{Arc, Mutex, RwLock};
+
+use shadow_shim_helper_rs::HostId;
+
+/// Whether packets to the address are delivered to a set of hosts rather than a single host.
+pub fn is_fan_out_address(addr: Ipv4Addr) -> bool {
+    addr.is_multicast() || addr.is_broadcast()
+}
+
+#[derive(Debug)]
+pub struct MulticastGroups {
+    /// The member hosts of each group, sorted by host ID.
+    members: RwLock<HashMap<Ipv4Addr, Arc<[HostId]>>>,
+    /// Membership changes that will be applied at the end of the round.
+    pending: Mutex<Vec<(Ipv4Addr, HostId, bool)>>,
+    /// Apply membership changes as soon as they're made, since there are no rounds.
+    apply_immediately: bool,
+    /// The hosts on each host's network node, indexed by host ID. Hosts on the same node share a
+    /// list.
+    broadcast_domains: Vec<Arc<[HostId]>>,
+}
+
+impl MulticastGroups {
+    /// `host_nodes` has the network node of each host, indexed by host ID.
+    pub fn new(host_nodes: &[usize], apply_immediately: bool) -> Self {
+        let mut by_node: HashMap<usize, Vec<HostId>> = HashMap::new();
+        for (host_id, node) in host_nodes.iter().enumerate() {
+            let host_id = HostId::from(u32::try_from(host_id).unwrap());
+            by_node.entry(*node).or_default().push(host_id);
+        }
+        let by_node: HashMap<usize, Arc<[HostId]>> =
+            by_node.into_iter().map(|(k, v)| (k, v.into())).collect();
+
+        Self {
+            members: RwLock::new(HashMap::new()),
+            pending: Mutex::new(Vec::new()),
+            apply_immediately,
+            broadcast_domains: host_nodes
+                .iter()
+                .map(|node| Arc::clone(&by_node[node]))
+                .collect(),
+        }
+    }
+
+    /// Record that `host` has joined or left `group`. Calls for the same host must be made in the
+    /// order of the changes.
+    pub fn update(&self, group: Ipv4Addr, host: HostId, is_member: bool) {
+        debug_assert!(group.is_multicast());
+        if self.apply_immediately {
+            Self::apply(&mut self.members.write().unwrap(), group, host, is_member);
+        } else {
+            self.pending.lock().unwrap().push((group, host, is_member));
+        }
+    }
+
+    /// Apply the membership changes since the last call. Must not be called while hosts are
+    /// running.
+    pub fn apply_pending(&self) {
+        let mut pending = self.pending.lock().unwrap();
+        if pending.is_empty() {
+            return;
+        }
+
+        // the changes of different hosts may be interleaved in any order, but they commute
+        let mut members = self.members.write().unwrap();
+        for (group, host, is_member) in pending.drain(..) {
+            Self::apply(&mut members, group, host, is_member);
+        }
+    }
+
+    fn apply(
+        members: &mut HashMap<Ipv4Addr, Arc<[HostId]>>,
+        group: Ipv4Addr,
+        host: HostId,
+        is_member: bool,
+    ) {
+        let mut hosts: Vec<HostId> = members.get(&group).map_or(Vec::new(), |x| x.to_vec());
+        match (hosts.binary_search(&host), is_member) {
+            (Err(i), true) => hosts.insert(i, host),
+            (Ok(i), false) => {
+                hosts.remove(i);
+            }
+            _ => return,
+        }
+
+        if hosts.is_empty() {
+            members.remove(&group);
+        } else {
+            members.insert(group, hosts.into());
+        }
+    }
+
+    /// The hosts that should receive a packet sent by `src` to `dst`, which must be a multicast or
+    /// broadcast address. May include `src`.
+    pub fn destinations(&self, src: HostId, dst: Ipv4Addr) -> Option<Arc<[HostId]>> {
+        if dst.is_broadcast() {
+            let index = usize::try_from(u32::from(src)).unwrap();
+            return Some(Arc::clone(&self.broadcast_domains[index]));
+        }
+        self.members.read().unwrap().get(&dst).cloned()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn ids(x: &[u32]) -> Vec<HostId> {
+        x.iter().map(|x| HostId::from(*x)).collect()
+    }
+
+    #[test]
+    fn test_membership() {
+        let groups = MulticastGroups::new(&[0, 0, 0], false);
+        let group = Ipv4Addr::new(239, 1, 2, 3);
+        let id = |x: u32| HostId::from(x);
+
+        groups.update(group, id(2), true);
+        groups.update(group, id(0), true);
+        // not visible until applied
+        assert!(groups.destinations(id(1), group).is_none());
+
+        groups.apply_pending();
+        assert_eq!(*groups.destinations(id(1), group).unwrap(), *ids(&[0, 2]));
+
+        // joining twice and leaving a group that the host isn't in have no effect
+        groups.update(group, id(2), true);
+        groups.update(group, id(1), false);
+        groups.update(group, id(0), false);
+        groups.apply_pending();
+        assert_eq!(*groups.destinations(id(1), group).unwrap(), *ids(&[2]));
+
+        groups.update(group, id(2), false);
+        groups.apply_pending();
+        assert!(groups.destinations(id(1), group).is_none());
+    }
+
+    #[test]
+    fn test_apply_immediately() {
+        let groups = MulticastGroups::new(&[0], true);
+        let group = Ipv4Addr::new(224, 0, 0, 251);
+
+        groups.update(group, HostId::from(0), true);
+        assert_eq!(
+            *groups.destinations(HostId::from(0), group).unwrap(),
+            *ids(&[0])
+        );
+    }
+
+    #[test]
+    fn test_broadcast() {
+        let groups = MulticastGroups::new(&[0, 1, 0, 1, 1], false);
+        assert_eq!(
+            *groups
+                .destinations(HostId::from(3), Ipv4Addr::BROADCAST)
+                .unwrap(),
+            *ids(&[1, 3, 4])
+        );
+        assert_eq!(
+            *groups
+                .destinations(HostId::from(0), Ipv4Addr::BROADCAST)
+                .unwrap(),
+            *ids(&[0, 2])
+        );
+    }
+}
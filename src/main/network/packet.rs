@@ -6,11 +6,14 @@ use crate::cshadow as c;
 use crate::host::memory_manager::MemoryManager;
 use crate::host::network::interface::FifoPacketPriority;
 use crate::host::syscall::io::IoVec;
+use crate::utility::give::Give;
 use crate::utility::pcap_writer::PacketDisplay;
 
+use bytes::{Bytes, BytesMut};
 use linux_api::errno::Errno;
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
 use shadow_shim_helper_rs::util::SyncSendPointer;
+use shadow_shim_helper_rs::HostId;
 
 #[repr(i32)]
 pub enum PacketStatus {
@@ -38,6 +41,16 @@ pub enum PacketStatus {
     RelayForwarded = c::_PacketDeliveryStatusFlags_PDS_RELAY_FORWARDED,
 }
 
+/// A packet payload buffer owned by rust. A C payload holds a pointer to this object rather than
+/// its own copy of the bytes, so the bytes can be shared between the sender and receiver.
+pub struct PayloadBytes(Bytes);
+
+impl From<Bytes> for PayloadBytes {
+    fn from(bytes: Bytes) -> Self {
+        Self(bytes)
+    }
+}
+
 pub struct PacketRc {
     c_ptr: SyncSendPointer<c::Packet>,
 }
@@ -73,6 +86,11 @@ impl PacketRc {
         Self::from_raw(Worker::with_active_host(|host| unsafe { c::packet_new(host) }).unwrap())
     }
 
+    /// Creates a packet with the given id, without drawing one from the current host.
+    pub fn new_with_id(host_id: HostId, packet_id: u64) -> Self {
+        Self::from_raw(unsafe { c::packet_newWithID(u32::from(host_id), packet_id) })
+    }
+
     #[cfg(test)]
     /// Creates an empty packet for unit tests.
     pub fn mock_new() -> PacketRc {
@@ -92,15 +110,12 @@ impl PacketRc {
         // the tcp header allows for a max of 4 begin/end pairs
         assert!(selective_acks.len() <= 4);
 
-        let mut selective_acks_glist = std::ptr::null_mut();
-
-        for sack in selective_acks {
-            for val in [sack.0, sack.1] {
-                // integer to pointer cast
-                let val = val as *mut libc::c_void;
-                selective_acks_glist = unsafe { c::g_list_append(selective_acks_glist, val) };
-            }
+        let mut selective_acks_buf = [0u32; 8];
+        for (i, sack) in selective_acks.iter().enumerate() {
+            selective_acks_buf[i * 2] = sack.0;
+            selective_acks_buf[i * 2 + 1] = sack.1;
         }
+        let selective_acks = &selective_acks_buf[..selective_acks.len() * 2];
 
         // TODO: not sure if linux uses milliseconds, but it probably doesn't matter as long as we
         // convert it back to a u32 the same way when receiving packets
@@ -121,17 +136,19 @@ impl PacketRc {
             c::packet_updateTCP(
                 self.c_ptr.ptr(),
                 header.ack,
-                selective_acks_glist,
                 header.window_size.into(),
                 header.window_scale.unwrap_or(0),
                 header.window_scale.is_some(),
                 timestamp.into(),
                 timestamp_echo.into(),
             );
-        }
 
-        // the C packet should make a copy of the glist, so we can free ours
-        unsafe { c::g_list_free(selective_acks_glist) };
+            c::packet_setTCPSelectiveACKs(
+                self.c_ptr.ptr(),
+                selective_acks.as_ptr(),
+                selective_acks.len().try_into().unwrap(),
+            );
+        }
     }
 
     pub fn get_tcp(&self) -> Option<tcp::TcpHeader> {
@@ -147,31 +164,19 @@ impl PacketRc {
             .unwrap()
             .as_millis();
 
-        // need to get the selective acks from a glist, so we'll panic a lot here to simplify things
-
-        let mut selective_acks = header.selectiveACKs;
-
-        // TODO: this selective ack code is untested until the new tcp code uses sacks, so it has
-        // not been checked for memory safety issues and there are probably bugs
-        let mut sack_iter = std::iter::from_fn(move || {
-            if selective_acks.is_null() {
-                return None;
-            }
-
-            let rv = unsafe { (*selective_acks).data } as u64;
-            selective_acks = unsafe { (*selective_acks).next };
-            Some(u32::try_from(rv).unwrap())
-        });
-
-        let sack_iter = std::iter::from_fn(move || {
-            // we expect the packet sack list to have a length divisible by 2
-            let begin = sack_iter.next()?;
-            let end = sack_iter.next().unwrap();
-
-            Some((begin, end))
-        });
+        let mut num_selective_acks = 0;
+        let selective_acks =
+            unsafe { c::packet_getTCPSelectiveACKs(self.c_ptr.ptr(), &mut num_selective_acks) };
+        let selective_acks = unsafe {
+            std::slice::from_raw_parts(selective_acks, num_selective_acks.try_into().unwrap())
+        };
 
-        let selective_acks: Vec<_> = sack_iter.collect();
+        // we expect the packet sack list to have a length divisible by 2
+        assert_eq!(selective_acks.len() % 2, 0);
+        let selective_acks: Vec<_> = selective_acks
+            .chunks_exact(2)
+            .map(|sack| (sack[0], sack[1]))
+            .collect();
         let selective_acks = tcp::util::SmallArrayBackedSlice::new(&selective_acks).unwrap();
 
         // the C packet doesn't have the distinction between no sack option or a sack option of
@@ -234,6 +239,45 @@ impl PacketRc {
         }
     }
 
+    /// Set the packet payload without copying the bytes. Will panic if the packet already has a
+    /// payload.
+    pub fn set_payload_bytes(&mut self, payload: Bytes, priority: FifoPacketPriority) {
+        if payload.is_empty() {
+            // not worth allocating a `PayloadBytes` object
+            return self.set_payload(&[], priority);
+        }
+
+        let ptr = payload.as_ptr();
+        let len = payload.len();
+        let bytes = Box::into_raw(Box::new(PayloadBytes(payload)));
+
+        unsafe {
+            c::packet_setPayloadFromBytes(
+                self.c_ptr.ptr(),
+                bytes,
+                ptr as *const libc::c_void,
+                len.try_into().unwrap(),
+                priority,
+            )
+        }
+    }
+
+    /// Get the packet payload. If the payload was set using
+    /// [`set_payload_bytes`](Self::set_payload_bytes), this shares the payload's buffer rather
+    /// than copying the bytes.
+    pub fn payload_bytes(&self) -> Bytes {
+        let bytes = unsafe { c::packet_getPayloadBytes(self.c_ptr.ptr()) };
+
+        if let Some(bytes) = unsafe { bytes.as_ref() } {
+            return bytes.0.clone();
+        }
+
+        let mut payload = BytesMut::zeroed(self.payload_size());
+        let num_bytes_copied = self.get_payload(&mut payload);
+        assert_eq!(num_bytes_copied, payload.len());
+        payload.freeze()
+    }
+
     /// Copy the packet payload to a buffer. Will truncate if the buffer is not large enough.
     pub fn get_payload(&self, buffer: &mut [u8]) -> usize {
         unsafe {
@@ -366,13 +410,13 @@ impl Drop for PacketRc {
 }
 
 impl PacketDisplay for PacketRc {
-    fn display_bytes(&self, writer: impl Write) -> std::io::Result<()> {
+    fn display_bytes<W: Write>(&self, writer: &mut Give<W>) -> std::io::Result<()> {
         self.borrow_inner().cast_const().display_bytes(writer)
     }
 }
 
 impl PacketDisplay for *const c::Packet {
-    fn display_bytes(&self, mut writer: impl Write) -> std::io::Result<()> {
+    fn display_bytes<W: Write>(&self, writer: &mut Give<W>) -> std::io::Result<()> {
         assert!(!self.is_null());
 
         let header_len: u16 = unsafe { c::packet_getHeaderSize(*self) }
@@ -424,32 +468,41 @@ impl PacketDisplay for *const c::Packet {
         // write protocol-specific data
 
         match protocol {
-            c::_ProtocolType_PTCP => display_tcp_bytes(*self, &mut writer)?,
-            c::_ProtocolType_PUDP => display_udp_bytes(*self, &mut writer)?,
+            c::_ProtocolType_PTCP => display_tcp_bytes(*self, &mut *writer)?,
+            c::_ProtocolType_PUDP => display_udp_bytes(*self, &mut *writer)?,
             _ => panic!("Unexpected packet protocol"),
         }
 
         // write payload data
 
-        if payload_len > 0 {
-            // shadow's packet payloads are guarded by a mutex, so it's easiest to make a copy of them
-            let mut payload_buf = vec![0u8; payload_len.try_into().unwrap()];
-            let count = unsafe {
-                c::packet_copyPayloadShadow(
-                    *self,
-                    0,
-                    payload_buf.as_mut_ptr() as *mut libc::c_void,
-                    payload_len.into(),
-                )
-            };
-            assert_eq!(
-                count,
-                u32::from(payload_len),
-                "Packet payload somehow changed size"
-            );
+        // only the part of the payload that fits within the writer's limit will be written
+        let payload_len = std::cmp::min(u64::from(payload_len), writer.limit()) as usize;
 
-            // packet payload: `payload_len` bytes
-            writer.write_all(&payload_buf)?;
+        if payload_len > 0 {
+            let bytes = unsafe { c::packet_getPayloadBytes(*self) };
+
+            if let Some(bytes) = unsafe { bytes.as_ref() } {
+                // packet payload: `payload_len` bytes
+                writer.write_all(&bytes.0[..payload_len])?;
+            } else {
+                // the payload is owned by C, so it's easiest to make a copy of it
+                let mut payload_buf = vec![0u8; payload_len];
+                let count = unsafe {
+                    c::packet_copyPayloadShadow(
+                        *self,
+                        0,
+                        payload_buf.as_mut_ptr() as *mut libc::c_void,
+                        payload_len.try_into().unwrap(),
+                    )
+                };
+                assert_eq!(
+                    count as usize, payload_len,
+                    "Packet payload somehow changed size"
+                );
+
+                // packet payload: `payload_len` bytes
+                writer.write_all(&payload_buf)?;
+            }
         }
 
         Ok(())
@@ -635,3 +688,185 @@ pub fn from_legacy_tcp_flags(mut flags: c::ProtocolTCPFlags) -> tcp::TcpFlags {
 
     new_flags
 }
+
+mod export {
+    use shadow_shim_helper_rs::syscall_types::UntypedForeignPtr;
+
+    use super::*;
+    use crate::host::syscall_types::ForeignArrayPtr;
+
+    /// Free a payload buffer that was given to a C payload by
+    /// [`PacketRc::set_payload_bytes`].
+    #[no_mangle]
+    pub extern "C" fn payloadbytes_free(bytes: *mut PayloadBytes) {
+        assert!(!bytes.is_null());
+        drop(unsafe { Box::from_raw(bytes) });
+    }
+
+    /// Get a new payload buffer for the `len` bytes at `offset` in `bytes`, which shares the
+    /// buffer of `bytes` rather than copying it. The returned object must be freed with
+    /// [`payloadbytes_free`], usually by giving it to a C payload.
+    #[no_mangle]
+    pub extern "C" fn payloadbytes_slice(
+        bytes: *const PayloadBytes,
+        offset: libc::size_t,
+        len: libc::size_t,
+    ) -> *mut PayloadBytes {
+        let bytes = unsafe { bytes.as_ref() }.unwrap();
+        Box::into_raw(Box::new(PayloadBytes(bytes.0.slice(offset..offset + len))))
+    }
+
+    /// Get a new payload buffer with a copy of the `len` bytes at `src` in shadow's memory. The
+    /// returned object must be freed with [`payloadbytes_free`].
+    #[no_mangle]
+    pub extern "C" fn payloadbytes_newFromBuffer(
+        src: *const libc::c_void,
+        len: libc::size_t,
+    ) -> *mut PayloadBytes {
+        assert!(!src.is_null() || len == 0);
+        let buf = if len == 0 {
+            &[][..]
+        } else {
+            unsafe { std::slice::from_raw_parts(src as *const u8, len) }
+        };
+        Box::into_raw(Box::new(PayloadBytes(Bytes::copy_from_slice(buf))))
+    }
+
+    /// Get a new payload buffer with a copy of the `len` bytes at `src` in the plugin's memory.
+    /// Returns NULL if the memory couldn't be read. The returned object must be freed with
+    /// [`payloadbytes_free`].
+    #[no_mangle]
+    pub extern "C" fn payloadbytes_newFromMemoryManager(
+        src: UntypedForeignPtr,
+        len: libc::size_t,
+        mem: *const MemoryManager,
+    ) -> *mut PayloadBytes {
+        let mem = unsafe { mem.as_ref() }.unwrap();
+        let mut buf = BytesMut::zeroed(len);
+
+        if let Err(e) = mem.copy_from_ptr(&mut buf[..], ForeignArrayPtr::new(src.cast::<u8>(), len))
+        {
+            log::trace!("Couldn't read payload from {src:?}: {e:?}");
+            return std::ptr::null_mut();
+        }
+
+        Box::into_raw(Box::new(PayloadBytes(buf.freeze())))
+    }
+
+    /// Get the length of a payload buffer.
+    #[no_mangle]
+    pub extern "C" fn payloadbytes_getLength(bytes: *const PayloadBytes) -> libc::size_t {
+        let bytes = unsafe { bytes.as_ref() }.unwrap();
+        bytes.0.len()
+    }
+
+    /// Get a pointer to the start of a payload buffer.
+    #[no_mangle]
+    pub extern "C" fn payloadbytes_getData(bytes: *const PayloadBytes) -> *const libc::c_void {
+        let bytes = unsafe { bytes.as_ref() }.unwrap();
+        bytes.0.as_ptr() as *const libc::c_void
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn new_packet() -> PacketRc {
+        // not a mock packet, since mock packets report a fixed payload size
+        PacketRc::from_raw(unsafe { c::packet_new_inner(1, 1) })
+    }
+
+    #[test]
+    fn test_payload_bytes_shared() {
+        let payload = Bytes::from_static(b"hello world");
+        let mut packet = new_packet();
+        packet.set_payload_bytes(payload.clone(), 0);
+
+        assert_eq!(packet.payload_size(), payload.len());
+        let received = packet.payload_bytes();
+        assert_eq!(received, payload);
+        // the receiver shares the sender's buffer
+        assert_eq!(received.as_ptr(), payload.as_ptr());
+
+        let mut buf = [0u8; 5];
+        assert_eq!(packet.get_payload(&mut buf), 5);
+        assert_eq!(&buf, b"hello");
+    }
+
+    fn selective_acks(packet: &PacketRc) -> Vec<u32> {
+        let mut len = 0;
+        let acks = unsafe { c::packet_getTCPSelectiveACKs(packet.borrow_inner(), &mut len) };
+        unsafe { std::slice::from_raw_parts(acks, len.try_into().unwrap()) }.to_vec()
+    }
+
+    #[test]
+    fn test_copy_selective_acks() {
+        // both inline and shared selective acks
+        for num_acks in [3, c::PACKET_TCP_INLINE_SACKS + 5] {
+            let acks: Vec<u32> = (100..).take(num_acks.try_into().unwrap()).collect();
+
+            let packet = new_packet();
+            unsafe {
+                c::packet_setTCP(
+                    packet.borrow_inner(),
+                    c::ProtocolTCPFlags_PTCP_ACK,
+                    u32::from(Ipv4Addr::new(1, 2, 3, 4)).to_be(),
+                    10u16.to_be(),
+                    u32::from(Ipv4Addr::new(5, 6, 7, 8)).to_be(),
+                    20u16.to_be(),
+                    1,
+                );
+                c::packet_setTCPSelectiveACKs(packet.borrow_inner(), acks.as_ptr(), num_acks);
+            }
+
+            let copy = PacketRc::from_raw(unsafe { c::packet_copy(packet.borrow_inner()) });
+            // the copy must remain valid after the original is freed
+            drop(packet);
+
+            assert_eq!(selective_acks(&copy), acks);
+            assert_eq!(
+                copy.src_address(),
+                SocketAddrV4::new(Ipv4Addr::new(1, 2, 3, 4), 10)
+            );
+            assert_eq!(
+                copy.dst_address(),
+                SocketAddrV4::new(Ipv4Addr::new(5, 6, 7, 8), 20)
+            );
+        }
+    }
+
+    #[test]
+    fn test_freed_packet_reused() {
+        let mut packet = new_packet();
+        packet.set_payload(b"hello world", 0);
+        packet.add_status(PacketStatus::SndCreated);
+        let ptr = packet.borrow_inner();
+        drop(packet);
+
+        // packets are pooled per thread, and the reused packet is reset
+        let packet = new_packet();
+        assert_eq!(packet.borrow_inner(), ptr);
+        assert_eq!(packet.payload_size(), 0);
+        assert_eq!(
+            unsafe { c::packet_getProtocol(packet.borrow_inner()) },
+            c::_ProtocolType_PNONE
+        );
+        assert_eq!(
+            unsafe { c::packet_getDeliveryStatus(packet.borrow_inner()) },
+            c::_PacketDeliveryStatusFlags_PDS_NONE
+        );
+    }
+
+    #[test]
+    fn test_payload_bytes_copied() {
+        let mut packet = new_packet();
+        packet.set_payload(b"hello world", 0);
+        assert_eq!(packet.payload_bytes(), &b"hello world"[..]);
+
+        let mut packet = new_packet();
+        packet.set_payload_bytes(Bytes::new(), 0);
+        assert_eq!(packet.payload_size(), 0);
+        assert!(packet.payload_bytes().is_empty());
+    }
+}
@@ -8,10 +8,10 @@ use shadow_shim_helper_rs::simulation_time::SimulationTime;
 use crate::core::work::task::TaskRef;
 use crate::core::worker::Worker;
 use crate::cshadow as c;
-use crate::host::host::Host;
+use crate::host::host::{Host, PacketDeviceId};
 use crate::network::packet::PacketStatus;
 use crate::network::relay::token_bucket::TokenBucket;
-use crate::network::PacketRc;
+use crate::network::{PacketDevice, PacketRc};
 use crate::utility::ObjectCounter;
 
 mod token_bucket;
@@ -23,11 +23,12 @@ mod token_bucket;
 /// ensure that `PacketRc`s are continually forwarded over time without exceeding
 /// the configured `RateLimit`.
 ///
-/// An `Ipv4Addr` associated with a source `PacketDevice` object is supplied
-/// when creating a `Relay`. This `Ipv4Addr` is only meaningful to the extent
-/// that the `Host` understands how to map this `Ipv4Addr` to the intended
-/// `PacketDevice` when `Host::get_packet_device(Ipv4Addr)` is called. This
-/// source `PacketDevice` supplies the `Relay` with a stream of `PacketRc`s
+/// An `Ipv4Addr` associated with a source `PacketDevice` object, and the
+/// `PacketDeviceId` that the `Host` maps this `Ipv4Addr` to, are supplied when
+/// creating a `Relay`. The `Relay` gets the source device from the `Host` with
+/// `Host::packet_device(PacketDeviceId)`, so that the address doesn't need to
+/// be routed again each time the `Relay` forwards packets. This source
+/// `PacketDevice` supplies the `Relay` with a stream of `PacketRc`s
 /// (through its implementation of `PacketDevice::pop()`) that the `Relay` will
 /// forward to a destination.
 ///
@@ -37,7 +38,8 @@ mod token_bucket;
 ///
 /// For each `PacketRc` that needs to be forwarded, the `Relay` uses the
 /// `PacketRc`'s destination `Ipv4Addr` to obtain the destination `PacketDevice`
-/// from the `Host` by calling its `Host::get_packet_device(Ipv4Addr)` function.
+/// from the `Host` by calling its `Host::get_next_packet_device()` function,
+/// unless the destination is the source device.
 /// The `PacketRc` is forwarded to the destination through the destination
 /// `PacketDevice`'s implementation of `PacketDevice::push()`.
 ///
@@ -57,6 +59,7 @@ struct RelayInternal {
     _counter: ObjectCounter,
     rate_limiter: Option<TokenBucket>,
     src_dev_address: Ipv4Addr,
+    src_dev: PacketDeviceId,
     state: RelayState,
     next_packet: Option<PacketRc>,
 }
@@ -77,33 +80,57 @@ enum RelayState {
 
 /// Specifies a throughput limit the relay should enforce when forwarding packets.
 pub enum RateLimit {
+    /// Tokens are added to the relay's token bucket once per millisecond.
     BytesPerSecond(u64),
+    /// Tokens are added to the relay's token bucket continuously, so the rate is exact even if it
+    /// isn't a whole number of bytes per millisecond.
+    BytesPerSecondContinuous(u64),
     Unlimited,
 }
 
+impl RateLimit {
+    fn token_bucket(self) -> Option<TokenBucket> {
+        match self {
+            RateLimit::BytesPerSecond(bytes) => Some(create_token_bucket(bytes)),
+            RateLimit::BytesPerSecondContinuous(bytes) => {
+                Some(create_continuous_token_bucket(bytes))
+            }
+            RateLimit::Unlimited => None,
+        }
+    }
+}
+
 impl Relay {
     /// Creates a new `Relay` that will forward `PacketRc`s following the given
-    /// `RateLimit` from the `PacketDevice` returned by the `Host` when passing
-    /// the given `src_dev_address` to `Host::get_packet_device()`. The `Relay`
+    /// `RateLimit` from the `PacketDevice` with the given `src_dev_address`,
+    /// which the `Host` maps to `src_dev` (see `Host::packet_device_id()`). The `Relay`
     /// internally schedules tasks as needed to ensure packets continue to be
     /// forwarded over time without exceeding the configured `RateLimit`.
-    pub fn new(rate: RateLimit, src_dev_address: Ipv4Addr) -> Self {
-        let rate_limiter = match rate {
-            RateLimit::BytesPerSecond(bytes) => Some(create_token_bucket(bytes)),
-            RateLimit::Unlimited => None,
-        };
-
+    pub fn new(rate: RateLimit, src_dev_address: Ipv4Addr, src_dev: PacketDeviceId) -> Self {
         Self {
             internal: AtomicRefCell::new(RelayInternal {
                 _counter: ObjectCounter::new("Relay"),
-                rate_limiter,
+                rate_limiter: rate.token_bucket(),
                 src_dev_address,
+                src_dev,
                 state: RelayState::Idle,
                 next_packet: None,
             }),
         }
     }
 
+    /// Change the relay's rate limit. If the relay was already rate limited, its token bucket is
+    /// reconfigured in place and keeps its balance, otherwise it starts with a full bucket. A packet
+    /// that's waiting for tokens is forwarded at the new rate once the relay's already scheduled
+    /// forwarding event runs.
+    pub fn set_rate(&self, rate: RateLimit) {
+        let mut internal = self.internal.borrow_mut();
+        match (&mut internal.rate_limiter, rate.token_bucket()) {
+            (Some(current), Some(new)) => current.reconfigure(new),
+            (current, new) => *current = new,
+        }
+    }
+
     /// Notify the relay that its packet source now has packets available for
     /// relaying to the packet sink. This must be called when the source changes
     /// state from empty to non-empty to signal the relay to resume forwarding.
@@ -134,6 +161,60 @@ impl Relay {
         }
     }
 
+    /// Forward `packet` straight to its destination device instead of having
+    /// the source device supply it to a forwarding task. This is only done if
+    /// the relay is idle (so no earlier packets are waiting to be forwarded)
+    /// and the packet conforms to the rate limit now, in which case a
+    /// forwarding task would have forwarded it at this same simulation time.
+    /// The caller must make sure that the source device has no packets.
+    /// `before_forward` is called just before the packet is pushed to its
+    /// destination. Returns the packet if it wasn't forwarded.
+    pub fn try_forward_now(
+        &self,
+        host: &Host,
+        mut packet: PacketRc,
+        before_forward: impl FnOnce(&mut PacketRc),
+    ) -> Result<(), PacketRc> {
+        let Ok(mut internal) = self.internal.try_borrow_mut() else {
+            return Err(packet);
+        };
+        let internal = &mut *internal;
+
+        if internal.state != RelayState::Idle || internal.next_packet.is_some() {
+            return Err(packet);
+        }
+
+        // local packets go back to the source device, which isn't a shortcut
+        let dst_address = *packet.dst_address().ip();
+        if dst_address == internal.src_dev_address {
+            return Err(packet);
+        }
+
+        if let Some(tb) = internal
+            .rate_limiter
+            .as_mut()
+            .filter(|_| !Worker::is_bootstrapping())
+        {
+            // doesn't remove any tokens if it fails
+            if tb
+                .burst()
+                .conforming_remove(packet.total_size() as u64)
+                .is_err()
+            {
+                return Err(packet);
+            }
+        }
+
+        internal.state = RelayState::Forwarding;
+        before_forward(&mut packet);
+        packet.add_status(PacketStatus::RelayForwarded);
+        host.get_next_packet_device(internal.src_dev, dst_address)
+            .push(packet);
+        internal.state = RelayState::Idle;
+
+        Ok(())
+    }
+
     /// Schedule an event to trigger us to run the forwarding loop later, and
     /// changes our state to `RelayState::Pending`. This allows us to run the
     /// forwarding loop after unwinding the current stack, and allows socket
@@ -205,10 +286,21 @@ impl Relay {
         // for the rest of this function (for the entire time that we remain in
         // the Forwarding state).
         let mut internal = self.internal.borrow_mut();
+        let internal = &mut *internal;
         internal.state = RelayState::Forwarding;
 
         // The source device supplies us with the stream of packets to forward.
-        let src = host.get_packet_device(internal.src_dev_address);
+        let src = host.packet_device(internal.src_dev);
+
+        // Rate limit applies only if we have a token bucket, and rate limits
+        // do not apply during bootstrapping. Simulation time doesn't advance
+        // while we're forwarding, so we refill the bucket once and remove
+        // tokens for the whole burst of packets against that balance.
+        let mut burst = internal
+            .rate_limiter
+            .as_mut()
+            .filter(|_| !is_bootstrapping)
+            .map(|tb| tb.burst());
 
         // Continue forwarding until we run out of either packets or tokens.
         loop {
@@ -222,25 +314,22 @@ impl Relay {
             // The packet is local if the src and dst refer to the same device.
             // This can happen for the loopback device, and for the inet device
             // if both sockets use the public ip to communicate over localhost.
-            let is_local = src.get_address() == *packet.dst_address().ip();
+            let is_local = internal.src_dev_address == *packet.dst_address().ip();
 
             // Check if we have enough tokens for forward the packet. Rate
-            // limits do not apply during bootstrapping, or if the source and
-            // destination are the same device.
-            if !is_bootstrapping && !is_local {
-                // Rate limit applies only if we have a token bucket.
-                if let Some(tb) = internal.rate_limiter.as_mut() {
+            // limits do not apply if the source and destination are the same
+            // device.
+            if !is_local {
+                if let Some(burst) = burst.as_mut() {
                     // Try to remove tokens for this packet.
-                    if let Err(blocking_dur) = tb.comforming_remove(packet.total_size() as u64) {
+                    if let Err(blocking_dur) = burst.conforming_remove(packet.total_size() as u64) {
                         // Too few tokens, need to block.
                         log::trace!(
                             "Relay src={} dst={} exceeded rate limit, need {} more tokens \
                             for packet of size {}, blocking for {:?}",
-                            src.get_address(),
+                            internal.src_dev_address,
                             packet.dst_address().ip(),
-                            packet
-                                .total_size()
-                                .saturating_sub(tb.comforming_remove(0).unwrap() as usize),
+                            packet.total_size().saturating_sub(burst.balance() as usize),
                             packet.total_size(),
                             blocking_dur
                         );
@@ -251,7 +340,9 @@ impl Relay {
                         internal.next_packet = Some(packet);
                         internal.state = RelayState::Idle;
 
-                        // Call Relay::forward_later() after dropping the mutable borrow.
+                        // Call Relay::forward_later() after dropping the mutable borrow. This
+                        // is the only event we schedule for the burst, at the time when the
+                        // bucket will have refilled enough for the cached packet.
                         return Some(blocking_dur);
                     }
                 }
@@ -265,7 +356,7 @@ impl Relay {
                 src.push(packet);
             } else {
                 // The source and destination are different.
-                let dst = host.get_packet_device(*packet.dst_address().ip());
+                let dst = host.get_next_packet_device(internal.src_dev, *packet.dst_address().ip());
                 dst.push(packet);
             }
         }
@@ -286,6 +377,24 @@ fn create_token_bucket(bytes_per_second: u64) -> TokenBucket {
     TokenBucket::new(capacity, refill_size, refill_interval).unwrap()
 }
 
+/// Configures a continuously refilled token bucket according to the given
+/// bytes_per_second rate limit. The bucket has the same capacity as the one
+/// from `create_token_bucket()`, and a relay that runs out of tokens waits until
+/// there are a millisecond's worth of tokens (or enough for its next packet) so
+/// that it still forwards packets in batches of about the same size.
+fn create_continuous_token_bucket(bytes_per_second: u64) -> TokenBucket {
+    let bytes_per_milli = std::cmp::max(1, bytes_per_second / 1000);
+    let capacity = bytes_per_milli + get_burst_allowance();
+
+    TokenBucket::new_continuous(
+        capacity,
+        std::cmp::max(1, bytes_per_second),
+        SimulationTime::from_secs(1),
+        bytes_per_milli,
+    )
+    .unwrap()
+}
+
 /// Returns the "burst allowance" we use in our token buckets.
 ///
 /// What the burst allowance ensures is that we don't lose tokens that are
@@ -9,6 +9,19 @@ pub struct TokenBucket {
     refill_increment: u64,
     refill_interval: SimulationTime,
     last_refill: EmulatedTime,
+    /// Set if tokens are refilled continuously rather than every `refill_interval`.
+    continuous: Option<ContinuousRefill>,
+}
+
+/// The state of a continuously refilled `TokenBucket`. See `TokenBucket::new_continuous()`.
+struct ContinuousRefill {
+    /// The fraction of a token that has been refilled but not yet added to the balance, in units
+    /// of `1 / refill_interval` tokens (where `refill_interval` is in nanoseconds). Always less
+    /// than one token.
+    fraction: u128,
+    /// When too few tokens are available, wait until the bucket holds at least this many tokens
+    /// before conforming, so that a busy bucket doesn't wake up for every packet.
+    min_wakeup_tokens: u64,
 }
 
 impl TokenBucket {
@@ -32,6 +45,28 @@ impl TokenBucket {
         )
     }
 
+    /// Like `new()`, but tokens are added continuously at a rate of
+    /// `refill_increment` tokens per `refill_interval`, keeping fractions of a
+    /// token between refills. The rate is then exact for any interval, so the
+    /// interval can be long (for example a rate in bytes per second) without
+    /// losing precision. When a removal doesn't conform, the returned duration
+    /// is the exact time until the bucket holds enough tokens for it, or
+    /// `min_wakeup_tokens` tokens if that's more (but never more than the
+    /// capacity).
+    pub fn new_continuous(
+        capacity: u64,
+        refill_increment: u64,
+        refill_interval: SimulationTime,
+        min_wakeup_tokens: u64,
+    ) -> Option<TokenBucket> {
+        let mut tb = TokenBucket::new(capacity, refill_increment, refill_interval)?;
+        tb.continuous = Some(ContinuousRefill {
+            fraction: 0,
+            min_wakeup_tokens,
+        });
+        Some(tb)
+    }
+
     /// Implements the functionality of `new()` allowing the caller to set the
     /// last refill time. Useful for testing.
     fn new_inner(
@@ -53,36 +88,76 @@ impl TokenBucket {
                 refill_increment,
                 refill_interval,
                 last_refill,
+                continuous: None,
             })
         } else {
             None
         }
     }
 
-    /// Remove `decrement` tokens from the bucket if and only if the bucket
-    /// contains at least `decrement` tokens. Returns the updated token balance
-    /// on success, or the duration until the next refill event after which we
-    /// would have enough tokens to allow the decrement to conform on error
-    /// (returned durations always align with this `TokenBucket`'s discrete
-    /// refill interval boundaries). Passing a 0 `decrement` always succeeds.
-    pub fn comforming_remove(&mut self, decrement: u64) -> Result<u64, SimulationTime> {
-        let now = Worker::current_time().unwrap();
-        self.conforming_remove_inner(decrement, &now)
-    }
-
-    /// Implements the functionality of `comforming_remove()` without calling into the
-    /// `Worker` module. Useful for testing.
+    /// Remove `decrement` tokens from the bucket at time `now`. A single-packet
+    /// shorthand for `burst_inner()`, used for testing.
+    #[cfg(test)]
     fn conforming_remove_inner(
         &mut self,
         decrement: u64,
         now: &EmulatedTime,
     ) -> Result<u64, SimulationTime> {
+        self.burst_inner(now).conforming_remove(decrement)
+    }
+
+    /// Apply any pending refills once and return a `TokenBurst` that can remove tokens for many
+    /// packets without re-reading the current time or re-checking the refill schedule for each
+    /// one. All of the packets in a burst must be sent at the same simulation time.
+    pub fn burst(&mut self) -> TokenBurst<'_> {
+        let now = Worker::current_time().unwrap();
+        self.burst_inner(&now)
+    }
+
+    /// Implements the functionality of `burst()` without calling into the `Worker` module. Useful
+    /// for testing.
+    fn burst_inner(&mut self, now: &EmulatedTime) -> TokenBurst<'_> {
         let next_refill_span = self.lazy_refill(now);
-        self.balance = self
-            .balance
-            .checked_sub(decrement)
-            .ok_or_else(|| self.compute_conforming_duration(decrement, next_refill_span))?;
-        Ok(self.balance)
+        TokenBurst {
+            bucket: self,
+            next_refill_span,
+        }
+    }
+
+    /// Change the bucket's capacity and refill rate to those of `new`, which must be refilled in
+    /// the same way (continuously or not). The bucket keeps its balance (up to the new capacity) and
+    /// refill schedule, and the tokens for the time before now are refilled at the old rate, so
+    /// changing the rate doesn't give the bucket a free burst of tokens.
+    pub fn reconfigure(&mut self, new: TokenBucket) {
+        let now = Worker::current_time().unwrap();
+        self.reconfigure_inner(new, &now)
+    }
+
+    /// Implements the functionality of `reconfigure()` without calling into the `Worker` module.
+    /// Useful for testing.
+    fn reconfigure_inner(&mut self, new: TokenBucket, now: &EmulatedTime) {
+        assert_eq!(self.continuous.is_some(), new.continuous.is_some());
+        self.lazy_refill(now);
+
+        self.capacity = new.capacity;
+        self.balance = std::cmp::min(self.balance, self.capacity);
+        self.refill_increment = new.refill_increment;
+
+        if new.refill_interval != self.refill_interval {
+            // the refill schedule (and any fraction of a token) is in units of the old interval
+            self.refill_interval = new.refill_interval;
+            self.last_refill = *now;
+            if let Some(continuous) = &mut self.continuous {
+                continuous.fraction = 0;
+            }
+        }
+
+        if let (Some(continuous), Some(new_continuous)) = (&mut self.continuous, new.continuous) {
+            continuous.min_wakeup_tokens = new_continuous.min_wakeup_tokens;
+            if self.balance == self.capacity {
+                continuous.fraction = 0;
+            }
+        }
     }
 
     /// Computes the duration required to refill enough tokens such that our
@@ -96,6 +171,10 @@ impl TokenBucket {
         decrement: u64,
         next_refill_span: SimulationTime,
     ) -> SimulationTime {
+        if let Some(continuous) = &self.continuous {
+            return self.compute_continuous_conforming_duration(continuous, decrement);
+        }
+
         let required_token_increment = decrement.saturating_sub(self.balance);
 
         let num_required_refills = {
@@ -119,12 +198,64 @@ impl TokenBucket {
         }
     }
 
+    /// Computes the exact duration until a continuously refilled bucket holds
+    /// enough tokens for `decrement` (or `min_wakeup_tokens`).
+    fn compute_continuous_conforming_duration(
+        &self,
+        continuous: &ContinuousRefill,
+        decrement: u64,
+    ) -> SimulationTime {
+        let target = std::cmp::max(
+            decrement,
+            std::cmp::min(continuous.min_wakeup_tokens, self.capacity),
+        );
+        if target <= self.balance {
+            return SimulationTime::ZERO;
+        }
+
+        // in units of `1 / refill_interval` tokens; the fraction is less than one token
+        let required_units = u128::from(target - self.balance) * self.refill_interval.as_nanos()
+            - continuous.fraction;
+        let increment = u128::from(self.refill_increment);
+        // same as `required_units.div_ceil(increment)`
+        let nanos = required_units / increment + u128::from(required_units % increment > 0);
+
+        SimulationTime::from_nanos(u64::try_from(nanos).unwrap_or(u64::MAX))
+    }
+
+    /// Adds the tokens that a continuously refilled bucket gained since the
+    /// last refill.
+    fn continuous_refill(&mut self, now: &EmulatedTime) {
+        let continuous = self.continuous.as_mut().unwrap();
+        let interval_nanos = self.refill_interval.as_nanos();
+
+        let units = now.duration_since(&self.last_refill).as_nanos()
+            * u128::from(self.refill_increment)
+            + continuous.fraction;
+        self.last_refill = *now;
+
+        let tokens = u64::try_from(units / interval_nanos).unwrap_or(u64::MAX);
+        continuous.fraction = units % interval_nanos;
+
+        self.balance = self.balance.saturating_add(tokens);
+        if self.balance >= self.capacity {
+            self.balance = self.capacity;
+            continuous.fraction = 0;
+        }
+    }
+
     /// Simulates a fixed refill schedule following the bucket's configured
     /// refill interval. This function will lazily apply refills that may have
     /// occurred in the past but were not applied yet because the token bucket
     /// was not in use. No refills will occur if called multiple times within
     /// the same refill interval. Returns the duration to the next refill event.
     fn lazy_refill(&mut self, now: &EmulatedTime) -> SimulationTime {
+        if self.continuous.is_some() {
+            // there are no refill events
+            self.continuous_refill(now);
+            return SimulationTime::ZERO;
+        }
+
         let mut span = now.duration_since(&self.last_refill);
 
         if span >= self.refill_interval {
@@ -157,6 +288,36 @@ impl TokenBucket {
     }
 }
 
+/// Removes tokens from a `TokenBucket` for a burst of packets sent at the same simulation time.
+/// See `TokenBucket::burst()`.
+pub struct TokenBurst<'a> {
+    bucket: &'a mut TokenBucket,
+    next_refill_span: SimulationTime,
+}
+
+impl TokenBurst<'_> {
+    /// Remove `decrement` tokens from the bucket if and only if the bucket
+    /// contains at least `decrement` tokens. Returns the updated token balance
+    /// on success, or the duration until the next refill event after which we
+    /// would have enough tokens to allow the decrement to conform on error
+    /// (returned durations always align with this `TokenBucket`'s discrete
+    /// refill interval boundaries, unless it's refilled continuously). Passing
+    /// a 0 `decrement` always succeeds.
+    pub fn conforming_remove(&mut self, decrement: u64) -> Result<u64, SimulationTime> {
+        let bucket = &mut *self.bucket;
+        bucket.balance = bucket
+            .balance
+            .checked_sub(decrement)
+            .ok_or_else(|| bucket.compute_conforming_duration(decrement, self.next_refill_span))?;
+        Ok(bucket.balance)
+    }
+
+    /// The number of tokens remaining in the bucket.
+    pub fn balance(&self) -> u64 {
+        self.bucket.balance
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -274,4 +435,126 @@ mod tests {
         let dur_until_conforming = SimulationTime::from_millis(125 * 5 - inc);
         assert_eq!(result.unwrap_err(), dur_until_conforming);
     }
+
+    fn new_continuous_inner(
+        capacity: u64,
+        refill_increment: u64,
+        refill_interval: SimulationTime,
+        min_wakeup_tokens: u64,
+        now: EmulatedTime,
+    ) -> TokenBucket {
+        let mut tb =
+            TokenBucket::new_inner(capacity, refill_increment, refill_interval, now).unwrap();
+        tb.continuous = Some(ContinuousRefill {
+            fraction: 0,
+            min_wakeup_tokens,
+        });
+        tb
+    }
+
+    #[test]
+    fn test_reconfigure() {
+        let now = mock_time_millis(1000);
+        let mut tb = TokenBucket::new_inner(100, 10, SimulationTime::from_millis(10), now).unwrap();
+        assert!(tb.conforming_remove_inner(100, &now).is_ok());
+
+        // 2 intervals pass at the old rate, then the rate is doubled and the capacity halved
+        let later = now + SimulationTime::from_millis(25);
+        let new = TokenBucket::new_inner(50, 20, SimulationTime::from_millis(10), now).unwrap();
+        tb.reconfigure_inner(new, &later);
+        assert_eq!(tb.balance, 20);
+        assert_eq!(tb.capacity, 50);
+
+        // the refill schedule is kept, so the next refill is 5 millis later
+        let result = tb.conforming_remove_inner(0, &(later + SimulationTime::from_millis(5)));
+        assert_eq!(result.unwrap(), 40);
+
+        // a full bucket is limited to the new capacity
+        let much_later = later + SimulationTime::from_secs(1);
+        let new = TokenBucket::new_inner(30, 20, SimulationTime::from_millis(10), now).unwrap();
+        tb.reconfigure_inner(new, &much_later);
+        assert_eq!(tb.balance, 30);
+    }
+
+    #[test]
+    fn test_continuous_refill_keeps_fractions() {
+        let now = mock_time_millis(1000);
+        // 3 tokens every 1000 nanos
+        let mut tb = new_continuous_inner(100, 3, SimulationTime::from_nanos(1000), 0, now);
+        assert!(tb.conforming_remove_inner(100, &now).is_ok());
+
+        // 1 nano at a time never refills a whole token, but the fractions add up
+        for i in 1..=1000 {
+            let later = now + SimulationTime::from_nanos(i);
+            assert!(tb.conforming_remove_inner(0, &later).is_ok());
+        }
+        assert_eq!(tb.balance, 3);
+
+        // far into the future, but not past the capacity
+        let later = now + SimulationTime::from_secs(60);
+        assert_eq!(tb.conforming_remove_inner(0, &later), Ok(100));
+    }
+
+    #[test]
+    fn test_continuous_remove_error() {
+        let now = mock_time_millis(1000);
+        let mut tb = new_continuous_inner(100, 3, SimulationTime::from_nanos(1000), 0, now);
+        assert!(tb.conforming_remove_inner(100, &now).is_ok());
+
+        // a token takes 333.3 nanos
+        let result = tb.conforming_remove_inner(1, &now);
+        assert_eq!(result, Err(SimulationTime::from_nanos(334)));
+
+        // the token has arrived at exactly that time
+        let later = now + SimulationTime::from_nanos(334);
+        assert_eq!(tb.conforming_remove_inner(1, &later), Ok(0));
+
+        // 2 tokens take 666.7 nanos, but 0.002 of a token is left over from the last one
+        let result = tb.conforming_remove_inner(2, &later);
+        assert_eq!(result, Err(SimulationTime::from_nanos(666)));
+    }
+
+    #[test]
+    fn test_continuous_min_wakeup() {
+        let now = mock_time_millis(1000);
+        let mut tb = new_continuous_inner(100, 10, SimulationTime::from_millis(1), 50, now);
+        assert!(tb.conforming_remove_inner(100, &now).is_ok());
+
+        // wait for 50 tokens even though only 1 is needed
+        let result = tb.conforming_remove_inner(1, &now);
+        assert_eq!(result, Err(SimulationTime::from_millis(5)));
+
+        // but not past the capacity
+        let mut tb = new_continuous_inner(20, 10, SimulationTime::from_millis(1), 50, now);
+        assert!(tb.conforming_remove_inner(20, &now).is_ok());
+        let result = tb.conforming_remove_inner(1, &now);
+        assert_eq!(result, Err(SimulationTime::from_millis(2)));
+    }
+
+    #[test]
+    fn test_burst_matches_remove() {
+        let now = mock_time_millis(1000);
+        let mut tb1 =
+            TokenBucket::new_inner(100, 10, SimulationTime::from_millis(125), now).unwrap();
+        let mut tb2 =
+            TokenBucket::new_inner(100, 10, SimulationTime::from_millis(125), now).unwrap();
+
+        // partway through a refill interval, after the bucket has been drained
+        assert!(tb1.conforming_remove_inner(100, &now).is_ok());
+        assert!(tb2.conforming_remove_inner(100, &now).is_ok());
+        let later = mock_time_millis(1000 + 125 * 4 + 10);
+
+        let mut burst = tb1.burst_inner(&later);
+        for decrement in [15, 20, 5, 1] {
+            assert_eq!(
+                burst.conforming_remove(decrement),
+                tb2.conforming_remove_inner(decrement, &later),
+            );
+        }
+        assert_eq!(burst.balance(), tb2.balance);
+        assert_eq!(
+            burst.conforming_remove(50).unwrap_err(),
+            tb2.conforming_remove_inner(50, &later).unwrap_err(),
+        );
+    }
 }
@@ -36,6 +36,8 @@ const LIMIT: usize = usize::MAX;
 struct CoDelPopItem {
     packet: PacketRc,
     ok_to_drop: bool,
+    /// How long the packet was in the queue.
+    standing_delay: SimulationTime,
 }
 
 /// Represents the possible states of the CoDel algorithm.
@@ -47,24 +49,68 @@ enum CoDelMode {
     Drop,
 }
 
-/// An entry in the CoDel queque.
-struct CoDelElement {
-    packet: PacketRc,
-    enqueue_ts: EmulatedTime,
+/// The number of packets we initially reserve space for. Most hosts' queues
+/// never hold more than a few packets, so this is small and the queue doubles
+/// its capacity when a host receives a larger burst.
+const INITIAL_CAPACITY: usize = 16;
+
+/// The number of buckets in the queue depth histogram. Bucket `i` counts
+/// enqueues that found `2^(i-1)..2^i` packets already in the queue (bucket 0
+/// counts enqueues into an empty queue), and the last bucket also counts all
+/// larger depths.
+const DEPTH_HISTOGRAM_BUCKETS: usize = 24;
+
+/// The number of buckets in the CoDel drop histogram. Bucket `i` counts drops
+/// of packets that had been queued for `2^(i-1)..2^i` milliseconds (bucket 0
+/// counts packets queued for less than a millisecond), and the last bucket also
+/// counts all longer delays.
+const DROP_HISTOGRAM_BUCKETS: usize = 16;
+
+/// Statistics about a `CoDelQueue`'s occupancy and drops.
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct CoDelStats {
+    /// Queue depths seen by enqueued packets, in power-of-two buckets.
+    pub depth_histogram: [u64; DEPTH_HISTOGRAM_BUCKETS],
+    /// The largest number of packets ever stored in the queue.
+    pub max_depth: usize,
+    /// Packets dropped by the CoDel control law.
+    pub codel_drops: u64,
+    /// The time that packets dropped by the control law had been queued for,
+    /// in power-of-two millisecond buckets.
+    pub drop_delay_histogram: [u64; DROP_HISTOGRAM_BUCKETS],
+    /// Packets dropped because the queue was full.
+    pub limit_drops: u64,
+}
+
+impl CoDelStats {
+    fn record_depth(&mut self, depth: usize) {
+        let bucket = (usize::BITS - depth.leading_zeros()) as usize;
+        self.depth_histogram[bucket.min(DEPTH_HISTOGRAM_BUCKETS - 1)] += 1;
+        self.max_depth = self.max_depth.max(depth + 1);
+    }
+
+    fn record_codel_drop(&mut self, standing_delay: SimulationTime) {
+        let millis = standing_delay.as_millis();
+        let bucket = (u64::BITS - millis.leading_zeros()) as usize;
+        self.drop_delay_histogram[bucket.min(DROP_HISTOGRAM_BUCKETS - 1)] += 1;
+        self.codel_drops += 1;
+    }
 }
 
 /// A packet queue implementing the CoDel active queue management (AQM)
 /// algorithm, suitable for use in network routers.
 ///
-/// Currently, the memory capacity of the queue for storing elements is
-/// monitonically increasing since we do not shrink the queue's capacity on
-/// `pop()` operations. We think this is OK since we only use one queue per
-/// host. However, if memory overhead becomes problematic, we can consider
-/// occasionally shrinking the queue's capacity or using a backing that is more
-/// memory-efficient (e.g. a LinkedList).
+/// Packets and their insertion times are stored in separate ring buffers, so
+/// that the timestamps are contiguous in memory. Currently, the memory capacity
+/// of the queue for storing elements is monitonically increasing since we do
+/// not shrink the queue's capacity on `pop()` operations. We think this is OK
+/// since we only use one queue per host. However, if memory overhead becomes
+/// problematic, we can consider occasionally shrinking the queue's capacity.
 pub struct CoDelQueue {
-    /// A queue holding packets and insertion times.
-    elements: VecDeque<CoDelElement>,
+    /// A queue holding packets.
+    packets: VecDeque<PacketRc>,
+    /// The insertion time of each packet in `packets`.
+    enqueue_times: VecDeque<EmulatedTime>,
     /// The running sum of the sizes of packets stored in the queue.
     total_bytes_stored: usize,
     /// The state indicating if we are dropping or storing packets.
@@ -78,41 +124,54 @@ pub struct CoDelQueue {
     current_drop_count: usize,
     /// The number of packets dropped the last time we were in drop mode.
     previous_drop_count: usize,
+    stats: CoDelStats,
 }
 
 impl CoDelQueue {
     /// Creates a new empty packet queue.
     pub fn new() -> CoDelQueue {
         CoDelQueue {
-            elements: VecDeque::new(),
+            packets: VecDeque::with_capacity(INITIAL_CAPACITY),
+            enqueue_times: VecDeque::with_capacity(INITIAL_CAPACITY),
             total_bytes_stored: 0,
             mode: CoDelMode::Store,
             interval_end: None,
             drop_next: None,
             current_drop_count: 0,
             previous_drop_count: 0,
+            stats: CoDelStats::default(),
         }
     }
 
+    /// Returns statistics about the queue's occupancy and drops.
+    pub fn stats(&self) -> &CoDelStats {
+        &self.stats
+    }
+
     /// Returns the total number of packets stored in the queue.
-    #[cfg(test)]
     pub fn len(&self) -> usize {
-        self.elements.len()
+        self.packets.len()
     }
 
     /// Returns true if the queue is holding zero packets, false otherwise.
-    #[cfg(test)]
     pub fn is_empty(&self) -> bool {
         self.len() == 0
     }
 
+    /// Release the unused capacity of the queue, including the capacity it was created with. The
+    /// queue will grow again as packets are pushed.
+    pub fn shrink_to_fit(&mut self) {
+        self.packets.shrink_to_fit();
+        self.enqueue_times.shrink_to_fit();
+    }
+
     /// Returns the packet at the front of the queue, or None if the queue is
     /// empty. Note that there is no gurantee that a subsequent `pop()`
     /// operation will return the same packet, since it could be dropped by the
     /// queue between the `peek()` and `pop()` operations.
     #[cfg(test)]
     pub fn peek(&self) -> Option<&PacketRc> {
-        self.elements.front().map(|x| &x.packet)
+        self.packets.front()
     }
 
     /// Returns the next packet in the queue that conforms to the CoDel standing
@@ -126,8 +185,8 @@ impl CoDelQueue {
         let maybe_packet = match self.codel_pop(&now) {
             Some(item) => match item.ok_to_drop {
                 true => match self.mode {
-                    CoDelMode::Store => self.drop_from_store_mode(&now, item.packet),
-                    CoDelMode::Drop => self.drop_from_drop_mode(&now, item.packet),
+                    CoDelMode::Store => self.drop_from_store_mode(&now, item),
+                    CoDelMode::Drop => self.drop_from_drop_mode(&now, item),
                 },
                 false => {
                     // Always set Store mode when standing delay below TARGET.
@@ -148,11 +207,12 @@ impl CoDelQueue {
         })
     }
 
-    fn drop_from_store_mode(&mut self, now: &EmulatedTime, packet: PacketRc) -> Option<PacketRc> {
+    fn drop_from_store_mode(&mut self, now: &EmulatedTime, item: CoDelPopItem) -> Option<PacketRc> {
         debug_assert_eq!(self.mode, CoDelMode::Store);
 
         // Drop one packet and move to drop mode.
-        self.drop_packet(packet);
+        self.stats.record_codel_drop(item.standing_delay);
+        self.drop_packet(item.packet);
         let next_item = self.codel_pop(now);
         self.mode = CoDelMode::Drop;
 
@@ -170,17 +230,16 @@ impl CoDelQueue {
         next_item.map(|x| x.packet)
     }
 
-    fn drop_from_drop_mode(&mut self, now: &EmulatedTime, packet: PacketRc) -> Option<PacketRc> {
+    fn drop_from_drop_mode(&mut self, now: &EmulatedTime, item: CoDelPopItem) -> Option<PacketRc> {
         debug_assert_eq!(self.mode, CoDelMode::Drop);
 
-        let mut item = Some(CoDelPopItem {
-            packet,
-            ok_to_drop: true,
-        });
+        let mut item = Some(item);
 
         // Drop as many packets as the control law dictates.
         while item.is_some() && self.mode == CoDelMode::Drop && self.should_drop(now) {
-            self.drop_packet(item.unwrap().packet);
+            let dropped = item.unwrap();
+            self.stats.record_codel_drop(dropped.standing_delay);
+            self.drop_packet(dropped.packet);
             self.current_drop_count += 1;
 
             item = self.codel_pop(now);
@@ -203,21 +262,22 @@ impl CoDelQueue {
 
     // Corresponds to the `dodequeue` function in the RFC.
     fn codel_pop(&mut self, now: &EmulatedTime) -> Option<CoDelPopItem> {
-        match self.elements.pop_front() {
-            Some(element) => {
+        match self.packets.pop_front() {
+            Some(packet) => {
                 // Found a packet.
-                debug_assert!(element.packet.total_size() <= self.total_bytes_stored);
-                self.total_bytes_stored = self
-                    .total_bytes_stored
-                    .saturating_sub(element.packet.total_size());
+                let enqueue_ts = self.enqueue_times.pop_front().unwrap();
+                debug_assert!(packet.total_size() <= self.total_bytes_stored);
+                self.total_bytes_stored =
+                    self.total_bytes_stored.saturating_sub(packet.total_size());
 
-                debug_assert!(now >= &element.enqueue_ts);
-                let standing_delay = now.saturating_duration_since(&element.enqueue_ts);
+                debug_assert!(now >= &enqueue_ts);
+                let standing_delay = now.saturating_duration_since(&enqueue_ts);
                 let ok_to_drop = self.process_standing_delay(now, standing_delay);
 
                 Some(CoDelPopItem {
-                    packet: element.packet,
+                    packet,
                     ok_to_drop,
+                    standing_delay,
                 })
             }
             None => {
@@ -303,21 +363,36 @@ impl CoDelQueue {
     /// Requires the current time as an argument to avoid calling into the
     /// worker module internally.
     pub fn push(&mut self, mut packet: PacketRc, now: EmulatedTime) {
-        if self.elements.len() < LIMIT {
+        if self.packets.len() < LIMIT {
             packet.add_status(PacketStatus::RouterEnqueued);
+            self.stats.record_depth(self.packets.len());
             self.total_bytes_stored += packet.total_size();
-            self.elements.push_back(CoDelElement {
-                packet,
-                enqueue_ts: now,
-            });
+            self.packets.push_back(packet);
+            self.enqueue_times.push_back(now);
         } else {
             // Section 5.4 in the RFC notes that "packets arriving at a full
             // buffer will be dropped, but these drops are not counted towards
             // CoDel's computations".
+            self.stats.limit_drops += 1;
             self.drop_packet(packet);
         }
     }
 
+    /// Update the queue as if `packet` was pushed into the empty queue and
+    /// popped again at the same time, without storing it. The packet has no
+    /// standing delay, so it's never dropped and it always leaves the queue in
+    /// Store mode.
+    pub fn push_pop_empty(&mut self, packet: &mut PacketRc) {
+        debug_assert!(self.is_empty());
+        packet.add_status(PacketStatus::RouterEnqueued);
+        self.stats.record_depth(0);
+
+        // what `pop()` does for a packet with a standing delay below TARGET
+        self.interval_end = None;
+        self.mode = CoDelMode::Store;
+        packet.add_status(PacketStatus::RouterDequeued);
+    }
+
     fn drop_packet(&self, mut packet: PacketRc) {
         packet.add_status(PacketStatus::RouterDropped);
     }
@@ -364,6 +439,44 @@ mod tests {
         assert!(cdq.pop(now).is_none());
     }
 
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn depth_stats() {
+        let now = mock_time_millis(1000);
+        let mut cdq = CoDelQueue::new();
+
+        for _ in 0..5 {
+            cdq.push(PacketRc::mock_new(), now);
+        }
+        while cdq.pop(now).is_some() {}
+        cdq.push(PacketRc::mock_new(), now);
+
+        let stats = cdq.stats();
+        assert_eq!(stats.max_depth, 5);
+        // depths 0, 1, 2..=3, and 4 when pushing
+        assert_eq!(stats.depth_histogram[..4], [2, 1, 2, 1]);
+        assert_eq!(stats.codel_drops, 0);
+        assert_eq!(stats.limit_drops, 0);
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn push_pop_empty() {
+        let now = mock_time_millis(1000);
+        let mut cdq = CoDelQueue::new();
+
+        cdq.push(PacketRc::mock_new(), now);
+        assert!(cdq.pop(now).is_some());
+        cdq.push_pop_empty(&mut PacketRc::mock_new());
+
+        assert!(cdq.is_empty());
+        assert_eq!(cdq.mode, CoDelMode::Store);
+        assert_eq!(cdq.interval_end, None);
+        // both enqueues found an empty queue
+        assert_eq!(cdq.stats().depth_histogram[..2], [2, 0]);
+        assert_eq!(cdq.stats().max_depth, 1);
+    }
+
     #[test]
     fn control_law() {
         let now = mock_time_millis(1000);
@@ -471,6 +584,12 @@ mod tests {
         assert_eq!(cdq.len(), N - 5);
         assert_eq!(cdq.mode, CoDelMode::Drop);
 
+        // The dropped packet was queued for 110 ms.
+        assert_eq!(cdq.stats().codel_drops, 1);
+        let mut expected = [0; DROP_HISTOGRAM_BUCKETS];
+        expected[7] = 1;
+        assert_eq!(cdq.stats().drop_delay_histogram, expected);
+
         // Now if we wait another interval, we get another drop and then
         // low-delay packets should put us back into store mode.
         for _ in 0..3 {
@@ -59,6 +59,56 @@ impl Router {
     pub fn route_incoming_packet(&self, packet: PacketRc) {
         self.push_inner(packet, Worker::current_time().unwrap())
     }
+
+    /// Returns true if inbound packets are waiting in our CoDel queue.
+    pub fn has_inbound_packets(&self) -> bool {
+        !self.inbound_packets.borrow().is_empty()
+    }
+
+    /// Record that a packet from the virtual internet is being delivered to the
+    /// destination host directly instead of through our CoDel queue, which is
+    /// only allowed while the queue is empty. The queue is updated as if the
+    /// packet was pushed and popped at the same time.
+    pub fn bypass_incoming_packet(&self, packet: &mut PacketRc) {
+        self.magic.debug_check();
+        self.inbound_packets.borrow_mut().push_pop_empty(packet);
+    }
+
+    /// Release the unused capacity of our inbound CoDel queue.
+    pub fn shrink_to_fit(&self) {
+        self.magic.debug_check();
+        self.inbound_packets.borrow_mut().shrink_to_fit();
+    }
+
+    /// Log the occupancy and drop statistics of our inbound CoDel queue.
+    pub fn log_queue_stats(&self, host_name: &str) {
+        let queue = self.inbound_packets.borrow();
+        let stats = queue.stats();
+
+        // only the non-empty power-of-two buckets, as "range:count"
+        let format_histogram = |buckets: &[u64]| -> String {
+            let buckets: Vec<String> = buckets
+                .iter()
+                .enumerate()
+                .filter(|(_, count)| **count > 0)
+                .map(|(bucket, count)| match bucket {
+                    0 => format!("0:{count}"),
+                    _ => format!("{}-{}:{count}", 1u64 << (bucket - 1), (1u64 << bucket) - 1),
+                })
+                .collect();
+            buckets.join(", ")
+        };
+
+        log::debug!(
+            "Router queue for host '{host_name}': max depth {} packets, {} CoDel drops, {} \
+             limit drops, depth histogram [{}], CoDel drop delay histogram in ms [{}]",
+            stats.max_depth,
+            stats.codel_drops,
+            stats.limit_drops,
+            format_histogram(&stats.depth_histogram),
+            format_histogram(&stats.drop_delay_histogram),
+        );
+    }
 }
 
 impl PacketDevice for Router {
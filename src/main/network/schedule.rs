@@ -0,0 +1,175 @@
+//! Changes to host bandwidths and to network paths at given simulation times, configured with
+//! `network.schedule`.
+//!
+//! A host's bandwidth changes run as tasks on the host at their exact times, and reconfigure the
+//! token buckets of the host's internet interface in place (see [`Host::set_bandwidth`]).
+//!
+//! An edge's changes are applied by the manager between scheduling rounds, when no hosts are
+//! running, and a round never runs past the time of the next change. Each change only patches the
+//! stored path between the edge's two nodes, so nothing is recomputed. Hosts cache the paths that
+//! they send packets along, and these caches are invalidated by the change (see
+//! [`RoutingInfo::generation`]). If a change lowers the smallest latency in the simulation, the
+//! runahead is lowered before the next round starts, so that packets along the changed path aren't
+//! held until the end of a round that's longer than their latency.
+
+use std::collections::VecDeque;
+use std::hash::Hash;
+
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+use crate::core::work::task::TaskRef;
+use crate::host::host::Host;
+use crate::network::graph::{PathProperties, RoutingInfo};
+
+/// A change to a host's bandwidth, in bits per second. Omitted directions aren't changed.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct BandwidthChange {
+    pub time: SimulationTime,
+    pub up_bits: Option<u64>,
+    pub down_bits: Option<u64>,
+}
+
+/// Schedule the bandwidth changes of a host to run at their times.
+pub fn schedule_bandwidth_changes(host: &Host, changes: &[BandwidthChange]) {
+    for change in changes {
+        let change = *change;
+        let task = TaskRef::new(move |host| {
+            log::debug!(
+                "Changing the bandwidth of host '{}': {change:?}",
+                host.name()
+            );
+            host.set_bandwidth(change.up_bits, change.down_bits);
+        });
+        host.schedule_task_at_emulated_time(task, EmulatedTime::SIMULATION_START + change.time);
+    }
+}
+
+/// A change to the path from one node to another, using the nodes' dense indices (see
+/// [`RoutingInfo::node_index`]). Omitted properties aren't changed.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct PathChange {
+    pub time: SimulationTime,
+    pub src: usize,
+    pub dst: usize,
+    pub latency_ns: Option<u64>,
+    pub packet_loss: Option<f32>,
+}
+
+/// The path changes that haven't been applied yet.
+#[derive(Debug, Default)]
+pub struct PathSchedule {
+    /// Sorted by time. Changes at the same time are kept in the configured order, so that a later
+    /// change to the same path wins.
+    changes: VecDeque<PathChange>,
+}
+
+impl PathSchedule {
+    pub fn new(mut changes: Vec<PathChange>) -> Self {
+        changes.sort_by_key(|x| x.time);
+        Self {
+            changes: changes.into(),
+        }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.changes.is_empty()
+    }
+
+    /// The time of the next change that hasn't been applied.
+    pub fn next_time(&self) -> Option<EmulatedTime> {
+        self.changes
+            .front()
+            .map(|x| EmulatedTime::SIMULATION_START + x.time)
+    }
+
+    /// Limit the end of a scheduling window so that the window doesn't run past the next change.
+    pub fn clamp_window_end(&self, window_end: EmulatedTime) -> EmulatedTime {
+        std::cmp::min(window_end, self.next_time().unwrap_or(EmulatedTime::MAX))
+    }
+
+    /// Apply the changes at or before `time` to `routing`. Must only be called while no hosts are
+    /// running. Returns the smallest latency of the changed paths, if any were changed.
+    pub fn apply_until<T: Eq + Hash + std::fmt::Display + Clone + Copy>(
+        &mut self,
+        time: EmulatedTime,
+        routing: &RoutingInfo<T>,
+    ) -> Option<u64> {
+        let mut min_latency_ns = None;
+
+        while self.next_time().is_some_and(|x| x <= time) {
+            let change = self.changes.pop_front().unwrap();
+            let old = routing.path_by_index(change.src, change.dst).unwrap();
+            let new = PathProperties {
+                latency_ns: change.latency_ns.unwrap_or(old.latency_ns),
+                packet_loss: change.packet_loss.unwrap_or(old.packet_loss),
+            };
+            log::debug!(
+                "Changing the path {}->{} from {old:?} to {new:?}",
+                change.src,
+                change.dst
+            );
+            routing.set_path_by_index(change.src, change.dst, new);
+
+            min_latency_ns = Some(
+                min_latency_ns.map_or(new.latency_ns, |x: u64| std::cmp::min(x, new.latency_ns)),
+            );
+        }
+
+        min_latency_ns
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::collections::HashMap;
+
+    use super::*;
+
+    fn time(millis: u64) -> EmulatedTime {
+        EmulatedTime::SIMULATION_START + SimulationTime::from_millis(millis)
+    }
+
+    #[test]
+    fn test_apply_until() {
+        let path = PathProperties {
+            latency_ns: 10_000_000,
+            packet_loss: 0.0,
+        };
+        let routing = RoutingInfo::new(HashMap::from([((1, 2), path), ((2, 1), path)]));
+        let (a, b) = (
+            routing.node_index(1).unwrap(),
+            routing.node_index(2).unwrap(),
+        );
+
+        let change = |millis, latency_ns, packet_loss| PathChange {
+            time: SimulationTime::from_millis(millis),
+            src: a,
+            dst: b,
+            latency_ns,
+            packet_loss,
+        };
+        let mut schedule = PathSchedule::new(vec![
+            change(20, None, Some(0.5)),
+            change(10, Some(5_000_000), None),
+            change(10, Some(2_000_000), None),
+        ]);
+
+        assert_eq!(schedule.next_time(), Some(time(10)));
+        assert_eq!(schedule.clamp_window_end(time(15)), time(10));
+        assert_eq!(schedule.apply_until(time(9), &routing), None);
+
+        // the later of the two changes at the same time wins
+        assert_eq!(schedule.apply_until(time(10), &routing), Some(2_000_000));
+        assert_eq!(routing.path(1, 2).unwrap().latency_ns, 2_000_000);
+        assert_eq!(routing.path(2, 1).unwrap().latency_ns, 10_000_000);
+
+        // omitted properties aren't changed
+        assert_eq!(schedule.apply_until(time(30), &routing), Some(2_000_000));
+        assert_eq!(routing.path(1, 2).unwrap().latency_ns, 2_000_000);
+        assert_eq!(routing.path(1, 2).unwrap().packet_loss, 0.5);
+
+        assert!(schedule.is_empty());
+        assert_eq!(schedule.clamp_window_end(time(15)), time(15));
+    }
+}
@@ -25,7 +25,6 @@ struct _DNS {
 
     /* address in network byte order */
     in_addr_t ipAddressCounter;
-    guint macAddressCounter;
 
     /* address mappings */
     GHashTable* addressByIP;
@@ -33,9 +32,19 @@ struct _DNS {
 
     int hosts_file_fd;
 
+    /* Read-only copies of the address mappings, sorted by IP and by name. These are built by
+     * dns_freeze() and are then used for lock-free lookups. They don't hold references; the
+     * addresses are kept alive by the hash tables. */
+    bool frozen;
+    guint numFrozen;
+    Address** frozenByIP;
+    Address** frozenByName;
+
     MAGIC_DECLARE;
 };
 
+static bool _dns_writeNewHostsFile(DNS* dns);
+
 /* Address must be in network byte order. */
 static gboolean _dns_isIPInRange(const in_addr_t netIP, const gchar* cidrStr) {
     utility_debugAssert(cidrStr);
@@ -116,6 +125,10 @@ Address* dns_register(DNS* dns, HostId id, const gchar* name, in_addr_t requeste
     MAGIC_ASSERT(dns);
     utility_debugAssert(name);
 
+    if (dns->frozen) {
+        utility_panic("Can't register host '%s' after the DNS was frozen", name);
+    }
+
     g_mutex_lock(&dns->lock);
 
     gboolean isLocal = FALSE;
@@ -133,7 +146,9 @@ Address* dns_register(DNS* dns, HostId id, const gchar* name, in_addr_t requeste
         return NULL;
     }
 
-    guint mac = ++dns->macAddressCounter;
+    /* Hosts may be registered in any order, so derive the mac from the host's id. Each host
+     * registers its localhost address and then its public address. */
+    guint mac = 2 * (guint)id + (isLocal ? 1 : 2);
     Address* address = address_new(id, mac, (guint32)requestedIP, name, isLocal);
 
     /* store the ip/name mappings */
@@ -159,6 +174,13 @@ Address* dns_register(DNS* dns, HostId id, const gchar* name, in_addr_t requeste
 
 void dns_deregister(DNS* dns, Address* address) {
     MAGIC_ASSERT(dns);
+
+    /* Other threads may still be doing lock-free lookups, so keep the address registered until the
+     * DNS is freed. */
+    if (dns->frozen) {
+        return;
+    }
+
     if(!address_isLocal(address)) {
         g_mutex_lock(&dns->lock);
 
@@ -176,10 +198,65 @@ void dns_deregister(DNS* dns, Address* address) {
     }
 }
 
+static int _dns_compareIP(const void* a, const void* b) {
+    in_addr_t ipA = address_toNetworkIP(*(Address* const*)a);
+    in_addr_t ipB = address_toNetworkIP(*(Address* const*)b);
+    return (ipA > ipB) - (ipA < ipB);
+}
+
+static int _dns_compareName(const void* a, const void* b) {
+    return strcmp(address_toHostName(*(Address* const*)a), address_toHostName(*(Address* const*)b));
+}
+
+static int _dns_compareKeyToIP(const void* key, const void* elem) {
+    in_addr_t ip = *(const in_addr_t*)key;
+    in_addr_t elemIP = address_toNetworkIP(*(Address* const*)elem);
+    return (ip > elemIP) - (ip < elemIP);
+}
+
+static int _dns_compareKeyToName(const void* key, const void* elem) {
+    return strcmp(key, address_toHostName(*(Address* const*)elem));
+}
+
+void dns_freeze(DNS* dns) {
+    MAGIC_ASSERT(dns);
+
+    g_mutex_lock(&dns->lock);
+
+    utility_alwaysAssert(!dns->frozen);
+
+    /* the hosts file won't change after this, so create it now while we hold the lock */
+    if (dns->hosts_file_fd < 0 && !_dns_writeNewHostsFile(dns)) {
+        warning("Unable to create hosts file; expect networking errors.");
+    }
+
+    dns->numFrozen = g_hash_table_size(dns->addressByIP);
+    utility_alwaysAssert(dns->numFrozen == g_hash_table_size(dns->addressByName));
+
+    dns->frozenByIP = (Address**)g_hash_table_get_values_as_array(dns->addressByIP, NULL);
+    dns->frozenByName = (Address**)g_hash_table_get_values_as_array(dns->addressByName, NULL);
+
+    qsort(dns->frozenByIP, dns->numFrozen, sizeof(Address*), _dns_compareIP);
+    qsort(dns->frozenByName, dns->numFrozen, sizeof(Address*), _dns_compareName);
+
+    dns->frozen = true;
+
+    g_mutex_unlock(&dns->lock);
+}
+
 /* Address must be in network byte order. */
 Address* dns_resolveIPToAddress(DNS* dns, in_addr_t ip) {
     MAGIC_ASSERT(dns);
-    Address* result = g_hash_table_lookup(dns->addressByIP, GUINT_TO_POINTER(ip));
+
+    Address* result = NULL;
+    if (dns->frozen) {
+        Address** found = bsearch(
+            &ip, dns->frozenByIP, dns->numFrozen, sizeof(Address*), _dns_compareKeyToIP);
+        result = found ? *found : NULL;
+    } else {
+        result = g_hash_table_lookup(dns->addressByIP, GUINT_TO_POINTER(ip));
+    }
+
     if(!result) {
         gchar* ipStr = address_ipToNewString(ip);
         debug("address for '%s' does not yet exist", ipStr);
@@ -190,7 +267,16 @@ Address* dns_resolveIPToAddress(DNS* dns, in_addr_t ip) {
 
 Address* dns_resolveNameToAddress(DNS* dns, const gchar* name) {
     MAGIC_ASSERT(dns);
-    Address* result = g_hash_table_lookup(dns->addressByName, name);
+
+    Address* result = NULL;
+    if (dns->frozen) {
+        Address** found = bsearch(
+            name, dns->frozenByName, dns->numFrozen, sizeof(Address*), _dns_compareKeyToName);
+        result = found ? *found : NULL;
+    } else {
+        result = g_hash_table_lookup(dns->addressByName, name);
+    }
+
     if(!result) {
         warning("unable to find address from name '%s'", name);
     }
@@ -241,18 +327,23 @@ static bool _dns_writeNewHostsFile(DNS* dns) {
 gchar* dns_getHostsFilePath(DNS* dns) {
     MAGIC_ASSERT(dns);
 
-    g_mutex_lock(&dns->lock);
+    int fd = -1;
 
-    if(dns->hosts_file_fd < 0) {
-        if(!_dns_writeNewHostsFile(dns)) {
+    if (dns->frozen) {
+        /* the file was created by dns_freeze() and won't be replaced */
+        fd = dns->hosts_file_fd;
+    } else {
+        g_mutex_lock(&dns->lock);
+        if (dns->hosts_file_fd < 0 && !_dns_writeNewHostsFile(dns)) {
             warning("Unable to create hosts file; expect networking errors.");
-            return NULL;
         }
+        fd = dns->hosts_file_fd;
+        g_mutex_unlock(&dns->lock);
     }
 
-    int fd = dns->hosts_file_fd;
-
-    g_mutex_unlock(&dns->lock);
+    if (fd < 0) {
+        return NULL;
+    }
 
     char* path = NULL;
     if (asprintf(&path, "/proc/%ld/fd/%i", (long)getpid(), fd) < 0) {
@@ -260,8 +351,8 @@ gchar* dns_getHostsFilePath(DNS* dns) {
         abort();
     }
 
-    // TODO: there's a race condition here where another thread could close and
-    // invalidate this hosts file before the calling code can use this path
+    // TODO: before the DNS is frozen, there's a race condition here where another thread could
+    // close and invalidate this hosts file before the calling code can use this path
     return path;
 }
 
@@ -290,6 +381,9 @@ void dns_free(DNS* dns) {
         dns->hosts_file_fd = -1;
     }
 
+    g_free(dns->frozenByIP);
+    g_free(dns->frozenByName);
+
     g_hash_table_destroy(dns->addressByIP);
     g_hash_table_destroy(dns->addressByName);
 
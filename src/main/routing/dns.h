@@ -22,6 +22,11 @@ void dns_free(DNS* dns);
 Address* dns_register(DNS* dns, HostId id, const gchar* name, in_addr_t requestedIP);
 void dns_deregister(DNS* dns, Address* address);
 
+/* Makes the DNS read-only once all hosts are registered. Lookups after this don't take a lock,
+ * dns_register() panics, and dns_deregister() is a no-op (addresses stay registered until
+ * dns_free()). Must not be called concurrently with lookups. */
+void dns_freeze(DNS* dns);
+
 /* Address must be in network byte order. */
 Address* dns_resolveIPToAddress(DNS* dns, in_addr_t ip);
 Address* dns_resolveNameToAddress(DNS* dns, const gchar* name);
@@ -6,33 +6,30 @@
 
 #include <assert.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "lib/logger/log_level.h"
 #include "lib/logger/logger.h"
 #include "main/bindings/c/bindings.h"
+#include "main/core/support/config_handlers.h"
 #include "main/core/worker.h"
 #include "main/routing/address.h"
 #include "main/routing/packet.h"
 #include "main/routing/payload.h"
 #include "main/utility/utility.h"
-#include "shd-config.h"
 
-/* g_memdup() is deprecated due to a security issue and has been replaced
- * by g_memdup2(), but not all of our supported platforms support this yet.
- * https://gitlab.gnome.org/GNOME/glib/-/issues/2319
- */
+static bool _logPacketStatus = true;
+ADD_CONFIG_HANDLER(config_getLogPacketStatus, _logPacketStatus)
+
+/* the number of most recent delivery statuses that a packet keeps in order for logging */
+#define PACKET_STATUS_RING_LEN 32
 
-#if HAS_MEMDUP2
-#define compat_static_g_memdup g_memdup2
-#else
-#define compat_static_g_memdup(mem, byte_size)                                                     \
-    ({                                                                                             \
-        static_assert(byte_size < UINT_MAX, "g_memdup() overflow");                                \
-        g_memdup(mem, byte_size);                                                                  \
-    })
-#endif
+/* the most freed packets that a thread keeps for reuse. with the thread-per-host scheduler every
+ * host has its own thread, so this is kept small */
+#define PACKET_POOL_MAX_LEN 128
 
 /* thread-safe structure representing a data/network packet */
 
@@ -61,7 +58,9 @@ struct _PacketUDPHeader {
     in_port_t destinationPort;
 };
 
-/* packets are guaranteed not to be shared across hosts */
+/* packets are guaranteed not to be shared across hosts (a packet is copied with `packet_copy` when
+ * it's sent to another host), so unlike the payload's, the reference count doesn't need to be
+ * atomic */
 struct _Packet {
     guint referenceCount;
 
@@ -71,7 +70,13 @@ struct _Packet {
     guint64 packetID;
 
     ProtocolType protocol;
-    gpointer header;
+    /* the header for `protocol`, stored inline so that copying the packet doesn't need to allocate
+     * it separately */
+    union {
+        PacketLocalHeader local;
+        PacketUDPHeader udp;
+        PacketTCPHeader tcp;
+    } header;
     Payload* payload;
 
     /* tracks application priority so we flush packets from the interface to
@@ -82,11 +87,80 @@ struct _Packet {
     uint64_t priority;
 
     PacketDeliveryStatusFlags allStatus;
-    GQueue* orderedStatus;
+    /* the most recent statuses in the order that they were added in, as the bit index of each
+     * status flag, which are only tracked when packet statuses are being logged */
+    guint8 orderedStatus[PACKET_STATUS_RING_LEN];
+    /* the number of statuses that were added to `orderedStatus`, including any that have since
+     * been overwritten */
+    guint numOrderedStatus;
+
+    /* the next packet in this thread's pool while the packet is in the pool */
+    Packet* nextFree;
 
     MAGIC_DECLARE;
 };
 
+/* packets that were freed by this thread, which are reused before allocating new ones. a packet may
+ * be freed by a different thread than the one that allocated it, which is fine since they're all
+ * allocated with `g_malloc` */
+static __thread Packet* _packetPool = NULL;
+static __thread guint _packetPoolLen = 0;
+/* whether this thread's pool will be freed when the thread exits */
+static __thread bool _packetPoolHasDestructor = false;
+
+static pthread_key_t _packetPoolKey;
+static pthread_once_t _packetPoolKeyOnce = PTHREAD_ONCE_INIT;
+
+void packet_freeThreadPool() {
+    while (_packetPool) {
+        Packet* packet = _packetPool;
+        _packetPool = packet->nextFree;
+        g_free(packet);
+    }
+    _packetPoolLen = 0;
+}
+
+static void _packet_poolDestructor(void* unused) { packet_freeThreadPool(); }
+
+static void _packet_createPoolKey() {
+    int rv = pthread_key_create(&_packetPoolKey, _packet_poolDestructor);
+    utility_alwaysAssert(rv == 0);
+}
+
+/* returns a zeroed packet with a reference count of 1 */
+static Packet* _packet_alloc() {
+    Packet* packet = _packetPool;
+    if (packet) {
+        _packetPool = packet->nextFree;
+        _packetPoolLen--;
+        memset(packet, 0, sizeof(*packet));
+    } else {
+        packet = g_new0(Packet, 1);
+    }
+
+    MAGIC_INIT(packet);
+    packet->referenceCount = 1;
+    return packet;
+}
+
+static void _packet_dealloc(Packet* packet) {
+    MAGIC_CLEAR(packet);
+
+    if (_packetPoolLen < PACKET_POOL_MAX_LEN) {
+        if (!_packetPoolHasDestructor) {
+            /* the destructor only runs if the key's value is non-NULL */
+            pthread_once(&_packetPoolKeyOnce, _packet_createPoolKey);
+            pthread_setspecific(_packetPoolKey, (void*)1);
+            _packetPoolHasDestructor = true;
+        }
+        packet->nextFree = _packetPool;
+        _packetPool = packet;
+        _packetPoolLen++;
+    } else {
+        g_free(packet);
+    }
+}
+
 const gchar* protocol_toString(ProtocolType type) {
     switch (type) {
         case PLOCAL: return "LOCAL";
@@ -99,16 +173,11 @@ const gchar* protocol_toString(ProtocolType type) {
 
 // Exposed for unit testing only. Use `packet_new` outside of tests.
 Packet* packet_new_inner(guint hostID, guint64 packetID) {
-    Packet* packet = g_new0(Packet, 1);
-    MAGIC_INIT(packet);
-
-    packet->referenceCount = 1;
+    Packet* packet = _packet_alloc();
 
     packet->hostID = hostID;
     packet->packetID = packetID;
 
-    packet->orderedStatus = g_queue_new();
-
     return packet;
 }
 
@@ -120,6 +189,12 @@ Packet* packet_new(const Host* host) {
     return packet;
 }
 
+Packet* packet_newWithID(guint hostID, guint64 packetID) {
+    Packet* packet = packet_new_inner(hostID, packetID);
+    worker_count_allocation(Packet);
+    return packet;
+}
+
 /* If modifying this function, you should also modify `packet_setPayloadWithMemoryManager` below.
  */
 void packet_setPayload(Packet* packet, const Thread* thread, UntypedForeignPtr payload,
@@ -166,16 +241,28 @@ void packet_setPayloadFromShadow(Packet* packet, const void* payload, gsize payl
     packet->priority = packetPriority;
 }
 
+void packet_setPayloadFromBytes(Packet* packet, PayloadBytes* bytes, const void* payload,
+                                gsize payloadLength, uint64_t packetPriority) {
+    MAGIC_ASSERT(packet);
+    utility_debugAssert(bytes);
+    utility_debugAssert(!packet->payload);
+
+    /* the payload starts with 1 ref, which we hold */
+    packet->payload = payload_newFromBytes(bytes, payload, payloadLength);
+    utility_alwaysAssert(packet->payload != NULL);
+    /* application data needs a priority ordering for FIFO onto the wire */
+    packet->priority = packetPriority;
+}
+
 /* copy everything except the payload.
  * the payload will point to the same payload as the original packet.
- * the payload is protected so it is safe to send the copied packet to a different host. */
+ * the payload's reference count is atomic and its data is immutable, so it is safe to send the
+ * copied packet to a different host. the same is true of any selective acks that didn't fit
+ * inline in the tcp header. */
 Packet* packet_copy(Packet* packet) {
     MAGIC_ASSERT(packet);
 
-    Packet* copy = g_new0(Packet, 1);
-    MAGIC_INIT(copy);
-
-    copy->referenceCount = 1;
+    Packet* copy = _packet_alloc();
 
     copy->hostID = packet->hostID;
     copy->packetID = packet->packetID;
@@ -187,45 +274,14 @@ Packet* packet_copy(Packet* packet) {
     }
 
     copy->allStatus = packet->allStatus;
-
-    if(packet->orderedStatus) {
-        /* this is ok because we store ints in the pointers, not objects */
-        copy->orderedStatus = g_queue_copy(packet->orderedStatus);
-    }
+    memcpy(copy->orderedStatus, packet->orderedStatus, sizeof(copy->orderedStatus));
+    copy->numOrderedStatus = packet->numOrderedStatus;
 
     copy->protocol = packet->protocol;
-    if(packet->header) {
-        switch (packet->protocol) {
-            case PLOCAL: {
-                copy->header = compat_static_g_memdup(packet->header, sizeof(PacketLocalHeader));
-                break;
-            }
-
-            case PUDP: {
-                copy->header = compat_static_g_memdup(packet->header, sizeof(PacketUDPHeader));
-                break;
-            }
-
-            case PTCP: {
-                copy->header = compat_static_g_memdup(packet->header, sizeof(PacketTCPHeader));
-
-                PacketTCPHeader* packetHeader = (PacketTCPHeader*)packet->header;
-                PacketTCPHeader* copyHeader = (PacketTCPHeader*)copy->header;
-
-                copyHeader->selectiveACKs = NULL;
-
-                if(packetHeader->selectiveACKs) {
-                    /* g_list_copy is shallow, but we store integers in the data pointers, so its OK here */
-                    copyHeader->selectiveACKs = g_list_copy(packetHeader->selectiveACKs);
-                }
-                break;
-            }
+    copy->header = packet->header;
 
-            default: {
-                utility_panic("unrecognized protocol");
-                break;
-            }
-        }
+    if (packet->protocol == PTCP && packet->header.tcp.sharedSelectiveACKs) {
+        g_atomic_rc_box_acquire(packet->header.tcp.sharedSelectiveACKs);
     }
 
     worker_count_allocation(Packet);
@@ -235,25 +291,15 @@ Packet* packet_copy(Packet* packet) {
 static void _packet_free(Packet* packet) {
     MAGIC_ASSERT(packet);
 
-    if(packet->protocol == PTCP) {
-        PacketTCPHeader* header = (PacketTCPHeader*)packet->header;
-        if(header->selectiveACKs) {
-            g_list_free(header->selectiveACKs);
-        }
+    if (packet->protocol == PTCP && packet->header.tcp.sharedSelectiveACKs) {
+        g_atomic_rc_box_release(packet->header.tcp.sharedSelectiveACKs);
     }
 
-    if(packet->header) {
-        g_free(packet->header);
-    }
     if(packet->payload) {
         payload_unref(packet->payload);
     }
-    if(packet->orderedStatus) {
-        g_queue_free(packet->orderedStatus);
-    }
 
-    MAGIC_CLEAR(packet);
-    g_free(packet);
+    _packet_dealloc(packet);
 
     worker_count_deallocation(Packet);
 }
@@ -285,10 +331,10 @@ gint packet_compareTCPSequence(Packet* packet1, Packet* packet2, gpointer user_d
     guint sequence1 = 0, sequence2 = 0;
 
     utility_debugAssert(packet1->protocol == PTCP);
-    sequence1 = ((PacketTCPHeader*)(packet1->header))->sequence;
+    sequence1 = packet1->header.tcp.sequence;
 
     utility_debugAssert(packet2->protocol == PTCP);
-    sequence2 = ((PacketTCPHeader*)(packet2->header))->sequence;
+    sequence2 = packet2->header.tcp.sequence;
 
     return sequence1 < sequence2 ? -1 : sequence1 > sequence2 ? 1 : 0;
 }
@@ -303,17 +349,16 @@ void packet_setMock(Packet* packet) {
 void packet_setLocal(Packet* packet, enum ProtocolLocalFlags flags,
         gint sourceDescriptorHandle, gint destinationDescriptorHandle, in_port_t port) {
     MAGIC_ASSERT(packet);
-    utility_debugAssert(!(packet->header) && packet->protocol == PNONE);
+    utility_debugAssert(packet->protocol == PNONE);
     utility_debugAssert(port > 0);
 
-    PacketLocalHeader* header = g_new0(PacketLocalHeader, 1);
+    PacketLocalHeader* header = &packet->header.local;
 
     header->flags = flags;
     header->sourceDescriptorHandle = sourceDescriptorHandle;
     header->destinationDescriptorHandle = destinationDescriptorHandle;
     header->port = port;
 
-    packet->header = header;
     packet->protocol = PLOCAL;
 }
 
@@ -322,10 +367,10 @@ void packet_setUDP(Packet* packet, enum ProtocolUDPFlags flags,
         in_addr_t sourceIP, in_port_t sourcePort,
         in_addr_t destinationIP, in_port_t destinationPort) {
     MAGIC_ASSERT(packet);
-    utility_debugAssert(!(packet->header) && packet->protocol == PNONE);
+    utility_debugAssert(packet->protocol == PNONE);
     utility_debugAssert(sourceIP && sourcePort && destinationIP && destinationPort);
 
-    PacketUDPHeader* header = g_new0(PacketUDPHeader, 1);
+    PacketUDPHeader* header = &packet->header.udp;
 
     header->flags = flags;
     header->sourceIP = sourceIP;
@@ -333,7 +378,6 @@ void packet_setUDP(Packet* packet, enum ProtocolUDPFlags flags,
     header->destinationIP = destinationIP;
     header->destinationPort = destinationPort;
 
-    packet->header = header;
     packet->protocol = PUDP;
 }
 
@@ -342,10 +386,10 @@ void packet_setTCP(Packet* packet, enum ProtocolTCPFlags flags,
         in_addr_t sourceIP, in_port_t sourcePort,
         in_addr_t destinationIP, in_port_t destinationPort, guint sequence) {
     MAGIC_ASSERT(packet);
-    utility_debugAssert(!(packet->header) && packet->protocol == PNONE);
+    utility_debugAssert(packet->protocol == PNONE);
     utility_debugAssert(sourceIP && sourcePort && destinationIP && destinationPort);
 
-    PacketTCPHeader* header = g_new0(PacketTCPHeader, 1);
+    PacketTCPHeader* header = &packet->header.tcp;
 
     header->flags = flags;
     header->sourceIP = sourceIP;
@@ -354,29 +398,33 @@ void packet_setTCP(Packet* packet, enum ProtocolTCPFlags flags,
     header->destinationPort = destinationPort;
     header->sequence = sequence;
 
-    packet->header = header;
     packet->protocol = PTCP;
 }
 
-void packet_updateTCP(Packet* packet, guint acknowledgement, GList* selectiveACKs, guint window,
+/* Returns a buffer for `numSelectiveACKs` selective acks, replacing the header's existing acks. */
+static guint* _packet_resetTCPSelectiveACKs(PacketTCPHeader* header, guint numSelectiveACKs) {
+    if (header->sharedSelectiveACKs) {
+        g_atomic_rc_box_release(header->sharedSelectiveACKs);
+        header->sharedSelectiveACKs = NULL;
+    }
+
+    header->numSelectiveACKs = numSelectiveACKs;
+
+    if (numSelectiveACKs <= PACKET_TCP_INLINE_SACKS) {
+        return header->inlineSelectiveACKs;
+    }
+
+    header->sharedSelectiveACKs = g_atomic_rc_box_alloc(numSelectiveACKs * sizeof(guint));
+    return header->sharedSelectiveACKs;
+}
+
+void packet_updateTCP(Packet* packet, guint acknowledgement, guint window,
                       unsigned char windowScale, bool windowScaleSet,
                       CSimulationTime timestampValue, CSimulationTime timestampEcho) {
     MAGIC_ASSERT(packet);
-    utility_debugAssert(packet->header && (packet->protocol == PTCP));
-
-    PacketTCPHeader* header = (PacketTCPHeader*) packet->header;
+    utility_debugAssert(packet->protocol == PTCP);
 
-    if(selectiveACKs && g_list_length(selectiveACKs) > 0) {
-        /* free the old ack list if it exists */
-        if(header->selectiveACKs != NULL) {
-            g_list_free(header->selectiveACKs);
-            header->selectiveACKs = NULL;
-        }
-
-        /* set the new sacks */
-        header->flags |= PTCP_SACK;
-        header->selectiveACKs = g_list_copy(selectiveACKs);
-    }
+    PacketTCPHeader* header = &packet->header.tcp;
 
     header->acknowledgment = acknowledgement;
     header->window = window;
@@ -386,6 +434,19 @@ void packet_updateTCP(Packet* packet, guint acknowledgement, GList* selectiveACK
     header->timestampEcho = timestampEcho;
 }
 
+void packet_setTCPSelectiveACKs(Packet* packet, const guint* selectiveACKs,
+                                guint numSelectiveACKs) {
+    MAGIC_ASSERT(packet);
+    utility_debugAssert(packet->protocol == PTCP);
+
+    if (numSelectiveACKs > 0) {
+        PacketTCPHeader* header = &packet->header.tcp;
+        header->flags |= PTCP_SACK;
+        guint* acks = _packet_resetTCPSelectiveACKs(header, numSelectiveACKs);
+        memcpy(acks, selectiveACKs, numSelectiveACKs * sizeof(guint));
+    }
+}
+
 gsize packet_getTotalSize(const Packet* packet) {
     MAGIC_ASSERT(packet);
     return packet_getPayloadSize(packet) + packet_getHeaderSize(packet);
@@ -446,13 +507,13 @@ in_addr_t packet_getDestinationIP(const Packet* packet) {
         }
 
         case PUDP: {
-            PacketUDPHeader* header = packet->header;
+            const PacketUDPHeader* header = &packet->header.udp;
             ip = header->destinationIP;
             break;
         }
 
         case PTCP: {
-            PacketTCPHeader* header = packet->header;
+            const PacketTCPHeader* header = &packet->header.tcp;
             ip = header->destinationIP;
             break;
         }
@@ -474,19 +535,19 @@ in_port_t packet_getDestinationPort(const Packet* packet) {
 
     switch (packet->protocol) {
         case PLOCAL: {
-            PacketLocalHeader* header = packet->header;
+            const PacketLocalHeader* header = &packet->header.local;
             port = header->port;
             break;
         }
 
         case PUDP: {
-            PacketUDPHeader* header = packet->header;
+            const PacketUDPHeader* header = &packet->header.udp;
             port = header->destinationPort;
             break;
         }
 
         case PTCP: {
-            PacketTCPHeader* header = packet->header;
+            const PacketTCPHeader* header = &packet->header.tcp;
             port = header->destinationPort;
             break;
         }
@@ -513,13 +574,13 @@ in_addr_t packet_getSourceIP(const Packet* packet) {
         }
 
         case PUDP: {
-            PacketUDPHeader* header = packet->header;
+            const PacketUDPHeader* header = &packet->header.udp;
             ip = header->sourceIP;
             break;
         }
 
         case PTCP: {
-            PacketTCPHeader* header = packet->header;
+            const PacketTCPHeader* header = &packet->header.tcp;
             ip = header->sourceIP;
             break;
         }
@@ -541,19 +602,19 @@ in_port_t packet_getSourcePort(const Packet* packet) {
 
     switch (packet->protocol) {
         case PLOCAL: {
-            PacketLocalHeader* header = packet->header;
+            const PacketLocalHeader* header = &packet->header.local;
             port = header->port;
             break;
         }
 
         case PUDP: {
-            PacketUDPHeader* header = packet->header;
+            const PacketUDPHeader* header = &packet->header.udp;
             port = header->sourcePort;
             break;
         }
 
         case PTCP: {
-            PacketTCPHeader* header = packet->header;
+            const PacketTCPHeader* header = &packet->header.tcp;
             port = header->sourcePort;
             break;
         }
@@ -612,26 +673,34 @@ guint packet_copyPayloadShadow(const Packet* packet, gsize payloadOffset, void*
     }
 }
 
-GList* packet_copyTCPSelectiveACKs(Packet* packet) {
+const PayloadBytes* packet_getPayloadBytes(const Packet* packet) {
     MAGIC_ASSERT(packet);
-    utility_debugAssert(packet->protocol == PTCP);
-
-    PacketTCPHeader* packetHeader = (PacketTCPHeader*)packet->header;
 
-    /* make sure to do a deep copy of all pointers to avoid concurrency issues */
-    GList* selectiveACKsCopy = NULL;
-    if(packetHeader->selectiveACKs) {
-        /* g_list_copy is shallow, but we store integers in the data pointers, so its OK here */
-        selectiveACKsCopy = g_list_copy(packetHeader->selectiveACKs);
+    if (packet->payload) {
+        return payload_getBytes(packet->payload);
+    } else {
+        return NULL;
     }
+}
+
+const guint* packet_getTCPSelectiveACKs(const Packet* packet, guint* numSelectiveACKs) {
+    MAGIC_ASSERT(packet);
+    utility_alwaysAssert(packet->protocol == PTCP);
+
+    const PacketTCPHeader* header = &packet->header.tcp;
+    *numSelectiveACKs = header->numSelectiveACKs;
 
-    return selectiveACKsCopy;
+    if (header->sharedSelectiveACKs) {
+        return header->sharedSelectiveACKs;
+    } else {
+        return header->inlineSelectiveACKs;
+    }
 }
 
 PacketTCPHeader* packet_getTCPHeader(const Packet* packet) {
     MAGIC_ASSERT(packet);
     utility_alwaysAssert(packet->protocol == PTCP);
-    return (PacketTCPHeader*)packet->header;
+    return (PacketTCPHeader*)&packet->header.tcp;
 }
 
 static const gchar* _packet_deliveryStatusToAscii(PacketDeliveryStatusFlags status) {
@@ -674,7 +743,7 @@ gchar* packet_toString(Packet* packet) {
 
     switch (packet->protocol) {
         case PLOCAL: {
-            PacketLocalHeader* header = packet->header;
+            const PacketLocalHeader* header = &packet->header.local;
             g_string_append_printf(packetString, "%i -> %i bytes=%u",
                     header->sourceDescriptorHandle, header->destinationDescriptorHandle,
                     payloadLength);
@@ -682,7 +751,7 @@ gchar* packet_toString(Packet* packet) {
         }
 
         case PUDP: {
-            PacketUDPHeader* header = packet->header;
+            const PacketUDPHeader* header = &packet->header.udp;
             gchar* sourceIPString = address_ipToNewString(header->sourceIP);
             gchar* destinationIPString = address_ipToNewString(header->destinationIP);
 
@@ -698,7 +767,7 @@ gchar* packet_toString(Packet* packet) {
         }
 
         case PTCP: {
-            PacketTCPHeader* header = packet->header;
+            const PacketTCPHeader* header = &packet->header.tcp;
             gchar* sourceIPString = address_ipToNewString(header->sourceIP);
             gchar* destinationIPString = address_ipToNewString(header->destinationIP);
 
@@ -708,28 +777,19 @@ gchar* packet_toString(Packet* packet) {
                     destinationIPString, ntohs(header->destinationPort),
                     header->sequence, header->acknowledgment);
 
-            // Instead of printing out entire list of SACK, print out ranges to save space
-            gint firstSack = -1;
-            gint lastSack = -1;
-            for(GList *iter = header->selectiveACKs; iter; iter = g_list_next(iter)) {
-                gint seq = GPOINTER_TO_INT(iter->data);
-                if(firstSack == -1) {
-                    firstSack = seq;
-                } else if(lastSack == -1 || seq == lastSack + 1) {
-                    lastSack = seq;
-                } else {
-                    g_string_append_printf(packetString, "%d-%d ", firstSack, lastSack);
-                    firstSack = seq;
-                    lastSack = -1;
+            // The selective acks are already stored as [begin, end) ranges
+            guint numSelectiveACKs = 0;
+            const guint* selectiveACKs = packet_getTCPSelectiveACKs(packet, &numSelectiveACKs);
+            for (guint i = 0; i + 1 < numSelectiveACKs; i += 2) {
+                guint first = selectiveACKs[i];
+                guint last = selectiveACKs[i + 1] - 1;
+                g_string_append_printf(packetString, "%s%u", i > 0 ? " " : "", first);
+                if (last != first) {
+                    g_string_append_printf(packetString, "-%u", last);
                 }
             }
 
-            if(firstSack != -1) {
-                g_string_append_printf(packetString, "%d", firstSack);
-                if(lastSack != -1) {
-                    g_string_append_printf(packetString,"-%d", lastSack);
-                }
-            } else {
+            if (numSelectiveACKs == 0) {
                 g_string_append_printf(packetString, "NA");
             }
 
@@ -775,21 +835,24 @@ gchar* packet_toString(Packet* packet) {
         }
     }
 
-    guint statusLength = g_queue_get_length(packet->orderedStatus);
+    guint statusLength = MIN(packet->numOrderedStatus, PACKET_STATUS_RING_LEN);
+    guint firstStatus = packet->numOrderedStatus - statusLength;
     if(statusLength > 0) {
         g_string_append_printf(packetString, " status=");
     }
-    for(int i = 0; i < statusLength; i++) {
-        gpointer statusPtr = g_queue_pop_head(packet->orderedStatus);
-        PacketDeliveryStatusFlags status = (PacketDeliveryStatusFlags) GPOINTER_TO_UINT(statusPtr);
+    if (firstStatus > 0) {
+        /* the oldest statuses were overwritten */
+        g_string_append_printf(packetString, "...,");
+    }
+    for(guint i = 0; i < statusLength; i++) {
+        guint8 bit = packet->orderedStatus[(firstStatus + i) % PACKET_STATUS_RING_LEN];
+        PacketDeliveryStatusFlags status = (PacketDeliveryStatusFlags)(1u << bit);
 
         if(i < statusLength - 1) {
             g_string_append_printf(packetString, "%s,", _packet_deliveryStatusToAscii(status));
         } else {
             g_string_append_printf(packetString, "%s", _packet_deliveryStatusToAscii(status));
         }
-
-        g_queue_push_tail(packet->orderedStatus, statusPtr);
     }
 
     return g_string_free(packetString, FALSE);
@@ -801,11 +864,17 @@ gchar* _packet_getString(Packet* packet) {
 
 void packet_addDeliveryStatus(Packet* packet, PacketDeliveryStatusFlags status) {
     MAGIC_ASSERT(packet);
+    /* the ordered ring records one status at a time */
+    utility_debugAssert(status != PDS_NONE && (status & (status - 1)) == 0);
 
     packet->allStatus |= status;
 
-    if (logger_isEnabled(logger_getDefault(), LOGLEVEL_TRACE)) {
-        g_queue_push_tail(packet->orderedStatus, GUINT_TO_POINTER(status));
+    /* checking the log level is relatively expensive, and this is called several times for every
+     * packet */
+    if (_logPacketStatus && logger_isEnabled(logger_getDefault(), LOGLEVEL_TRACE)) {
+        packet->orderedStatus[packet->numOrderedStatus % PACKET_STATUS_RING_LEN] =
+            (guint8)g_bit_nth_lsf(status, -1);
+        packet->numOrderedStatus++;
         gchar* packetStr = packet_toString(packet);
         trace("[%s] %s", _packet_deliveryStatusToAscii(status), packetStr);
         g_free(packetStr);
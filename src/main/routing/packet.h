@@ -17,6 +17,9 @@
 #include "main/host/protocol.h"
 #include "main/host/syscall_types.h"
 
+/* the number of selective acks that fit in a tcp header without a separate allocation */
+#define PACKET_TCP_INLINE_SACKS 8
+
 typedef struct _PacketTCPHeader PacketTCPHeader;
 struct _PacketTCPHeader {
     enum ProtocolTCPFlags flags;
@@ -33,7 +36,13 @@ struct _PacketTCPHeader {
 
     guint sequence;
     guint acknowledgment;
-    GList* selectiveACKs;
+    // use `packet_getTCPSelectiveACKs` to read these
+    guint numSelectiveACKs;
+    // the selective acks if there are at most `PACKET_TCP_INLINE_SACKS` of them
+    guint inlineSelectiveACKs[PACKET_TCP_INLINE_SACKS];
+    // otherwise an immutable, reference-counted array of the selective acks that may be shared
+    // with copies of the packet
+    guint* sharedSelectiveACKs;
     guint window;
     unsigned char windowScale;
     bool windowScaleSet;
@@ -44,6 +53,9 @@ struct _PacketTCPHeader {
 const gchar* protocol_toString(ProtocolType type);
 
 Packet* packet_new(const Host* host);
+// A packet with the given id rather than one drawn from the current host, such as a packet that
+// was created by another host in a recorded simulation.
+Packet* packet_newWithID(guint hostID, guint64 packetID);
 void packet_setPayload(Packet* packet, const Thread* thread, UntypedForeignPtr payload,
                        gsize payloadLength, uint64_t packetPriority);
 void packet_setPayloadWithMemoryManager(Packet* packet, UntypedForeignPtr payload,
@@ -51,6 +63,9 @@ void packet_setPayloadWithMemoryManager(Packet* packet, UntypedForeignPtr payloa
                                         uint64_t packetPriority);
 void packet_setPayloadFromShadow(Packet* packet, const void* payload, gsize payloadLength,
                                  uint64_t packetPriority);
+// Takes ownership of `bytes`. The packet's payload will share its buffer without copying it.
+void packet_setPayloadFromBytes(Packet* packet, PayloadBytes* bytes, const void* payload,
+                                gsize payloadLength, uint64_t packetPriority);
 Packet* packet_copy(Packet* packet);
 
 // Exposed for unit testing only. Use `packet_new` outside of tests.
@@ -60,6 +75,9 @@ void packet_setMock(Packet* packet);
 
 void packet_ref(Packet* packet);
 void packet_unref(Packet* packet);
+// Free the packets in the calling thread's pool of freed packets. Worker threads' pools are also
+// freed when the threads exit.
+void packet_freeThreadPool();
 static inline void packet_unrefTaskFreeFunc(gpointer packet) { packet_unref(packet); }
 
 void packet_setPriority(Packet *packet, uint64_t value);
@@ -79,7 +97,7 @@ void packet_setTCP(Packet* packet, enum ProtocolTCPFlags flags,
         in_addr_t sourceIP, in_port_t sourcePort,
         in_addr_t destinationIP, in_port_t destinationPort, guint sequence);
 
-void packet_updateTCP(Packet* packet, guint acknowledgement, GList* selectiveACKs, guint window,
+void packet_updateTCP(Packet* packet, guint acknowledgement, guint window,
                       unsigned char windowScale, bool windowScaleSet,
                       CSimulationTime timestampValue, CSimulationTime timestampEcho);
 
@@ -106,7 +124,16 @@ gssize packet_copyPayloadWithMemoryManager(const Packet* packet, gsize payloadOf
                                            MemoryManager* mem);
 guint packet_copyPayloadShadow(const Packet* packet, gsize payloadOffset, void* buffer,
                                gsize bufferLength);
-GList* packet_copyTCPSelectiveACKs(Packet* packet);
+// Returns NULL if the packet has no payload, or if its payload isn't owned by rust.
+const PayloadBytes* packet_getPayloadBytes(const Packet* packet);
+// Returns the selective acks, and sets `numSelectiveACKs` to the number of acks. The acks are
+// flattened pairs of sequence numbers, where each pair is a half-open [begin, end) range. The returned
+// pointer is valid until the packet's selective acks are changed or the packet is freed.
+const guint* packet_getTCPSelectiveACKs(const Packet* packet, guint* numSelectiveACKs);
+// Replaces the packet's selective acks (if `numSelectiveACKs` is non-zero) with a copy of the
+// given acks.
+void packet_setTCPSelectiveACKs(Packet* packet, const guint* selectiveACKs,
+                                guint numSelectiveACKs);
 PacketTCPHeader* packet_getTCPHeader(const Packet* packet);
 gint packet_compareTCPSequence(Packet* packet1, Packet* packet2, gpointer user_data);
 
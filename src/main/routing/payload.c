@@ -9,16 +9,19 @@
 #include <string.h>
 
 #include "lib/logger/logger.h"
+#include "main/bindings/c/bindings.h"
 #include "main/core/support/definitions.h"
 #include "main/core/worker.h"
 #include "main/utility/utility.h"
 
-/* packet payloads may be shared across hosts, so we must lock access to them */
+/* packet payloads may be shared across hosts, so the reference count is atomic. the data is never
+ * modified after the payload is created, so reading it doesn't require a lock. */
 struct _Payload {
-    GMutex lock;
-    guint referenceCount;
+    gint referenceCount;
     gpointer data;
     gsize length;
+    /* if non-NULL, `data` points into this rust-owned buffer rather than our own allocation */
+    PayloadBytes* bytes;
     MAGIC_DECLARE;
 };
 
@@ -38,7 +41,6 @@ Payload* payload_new(const Thread* thread, UntypedForeignPtr data, gsize dataLen
         payload->length = dataLength;
     }
 
-    g_mutex_init(&(payload->lock));
     payload->referenceCount = 1;
 
     worker_count_allocation(Payload);
@@ -65,7 +67,6 @@ Payload* payload_newWithMemoryManager(UntypedForeignPtr data, gsize dataLength,
         payload->length = dataLength;
     }
 
-    g_mutex_init(&(payload->lock));
     payload->referenceCount = 1;
 
     worker_count_allocation(Payload);
@@ -84,7 +85,24 @@ Payload* payload_newFromShadow(const void* data, gsize dataLength) {
         payload->length = dataLength;
     }
 
-    g_mutex_init(&(payload->lock));
+    payload->referenceCount = 1;
+
+    worker_count_allocation(Payload);
+
+    return payload;
+}
+
+Payload* payload_newFromBytes(PayloadBytes* bytes, const void* data, gsize dataLength) {
+    utility_debugAssert(bytes);
+
+    Payload* payload = g_new0(Payload, 1);
+    MAGIC_INIT(payload);
+
+    /* the buffer is immutable, so we never write through this pointer */
+    payload->data = (gpointer)data;
+    payload->length = dataLength;
+    payload->bytes = bytes;
+
     payload->referenceCount = 1;
 
     worker_count_allocation(Payload);
@@ -95,9 +113,9 @@ Payload* payload_newFromShadow(const void* data, gsize dataLength) {
 static void _payload_free(Payload* payload) {
     MAGIC_ASSERT(payload);
 
-    g_mutex_clear(&(payload->lock));
-
-    if(payload->data) {
+    if (payload->bytes) {
+        payloadbytes_free(payload->bytes);
+    } else if (payload->data) {
         g_free(payload->data);
     }
 
@@ -107,40 +125,26 @@ static void _payload_free(Payload* payload) {
     worker_count_deallocation(Payload);
 }
 
-static void _payload_lock(Payload* payload) {
-    MAGIC_ASSERT(payload);
-    g_mutex_lock(&(payload->lock));
-}
-
-static void _payload_unlock(Payload* payload) {
-    MAGIC_ASSERT(payload);
-    g_mutex_unlock(&(payload->lock));
-}
-
 void payload_ref(Payload* payload) {
     MAGIC_ASSERT(payload);
-    _payload_lock(payload);
-    (payload->referenceCount)++;
-    _payload_unlock(payload);
+    g_atomic_int_inc(&(payload->referenceCount));
 }
 
 void payload_unref(Payload* payload) {
     MAGIC_ASSERT(payload);
-    _payload_lock(payload);
-    (payload->referenceCount)--;
-    gboolean needsFree = (payload->referenceCount == 0) ? TRUE : FALSE;
-    _payload_unlock(payload);
-    if(needsFree) {
+    if (g_atomic_int_dec_and_test(&(payload->referenceCount))) {
         _payload_free(payload);
     }
 }
 
 gsize payload_getLength(Payload* payload) {
     MAGIC_ASSERT(payload);
-    _payload_lock(payload);
-    gsize length = payload->length;
-    _payload_unlock(payload);
-    return length;
+    return payload->length;
+}
+
+const PayloadBytes* payload_getBytes(Payload* payload) {
+    MAGIC_ASSERT(payload);
+    return payload->bytes;
 }
 
 /* If modifying this function, you should also modify `payload_getDataWithMemoryManager` below. */
@@ -148,8 +152,6 @@ gssize payload_getData(Payload* payload, const Thread* thread, gsize offset,
                        UntypedForeignPtr destBuffer, gsize destBufferLength) {
     MAGIC_ASSERT(payload);
 
-    _payload_lock(payload);
-
     utility_debugAssert(offset <= payload->length);
 
     gssize targetLength = payload->length - offset;
@@ -159,13 +161,10 @@ gssize payload_getData(Payload* payload, const Thread* thread, gsize offset,
         int err = process_writePtr(
             thread_getProcess(thread), destBuffer, payload->data + offset, copyLength);
         if (err) {
-            _payload_unlock(payload);
             return err;
         }
     }
 
-    _payload_unlock(payload);
-
     return copyLength;
 }
 
@@ -177,8 +176,6 @@ gssize payload_getDataWithMemoryManager(Payload* payload, gsize offset,
                                         MemoryManager* mem) {
     MAGIC_ASSERT(payload);
 
-    _payload_lock(payload);
-
     utility_debugAssert(offset <= payload->length);
 
     gssize targetLength = payload->length - offset;
@@ -188,13 +185,10 @@ gssize payload_getDataWithMemoryManager(Payload* payload, gsize offset,
         int err =
             memorymanager_writePtr(mem, destBuffer, payload->data + offset, copyLength);
         if (err) {
-            _payload_unlock(payload);
             return err;
         }
     }
 
-    _payload_unlock(payload);
-
     return copyLength;
 }
 
@@ -202,8 +196,6 @@ gsize payload_getDataShadow(Payload* payload, gsize offset, void* destBuffer,
                             gsize destBufferLength) {
     MAGIC_ASSERT(payload);
 
-    _payload_lock(payload);
-
     utility_debugAssert(offset <= payload->length);
 
     gsize targetLength = payload->length - offset;
@@ -213,7 +205,5 @@ gsize payload_getDataShadow(Payload* payload, gsize offset, void* destBuffer,
         memcpy(destBuffer, payload->data + offset, copyLength);
     }
 
-    _payload_unlock(payload);
-
     return copyLength;
 }
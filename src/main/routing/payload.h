@@ -18,11 +18,16 @@ Payload* payload_new(const Thread* thread, UntypedForeignPtr data, gsize dataLen
 Payload* payload_newWithMemoryManager(UntypedForeignPtr data, gsize dataLength,
                                       const MemoryManager* mem);
 Payload* payload_newFromShadow(const void* data, gsize dataLength);
+/* Takes ownership of `bytes`, whose buffer of `dataLength` bytes starts at `data`. The buffer is
+ * shared rather than copied, and `bytes` is freed when the payload is freed. */
+Payload* payload_newFromBytes(PayloadBytes* bytes, const void* data, gsize dataLength);
 
 void payload_ref(Payload* payload);
 void payload_unref(Payload* payload);
 
 gsize payload_getLength(Payload* payload);
+/* Returns NULL if the payload's buffer isn't owned by rust. */
+const PayloadBytes* payload_getBytes(Payload* payload);
 gssize payload_getData(Payload* payload, const Thread* thread, gsize offset,
                        UntypedForeignPtr destBuffer, gsize destBufferLength);
 gssize payload_getDataWithMemoryManager(Payload* payload, gsize offset,
@@ -3,11 +3,26 @@
  * See LICENSE for licensing information
  */
 
+use std::cell::RefCell;
 use std::collections::LinkedList;
 use std::io::{ErrorKind, Read, Write};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
 
 use bytes::{Bytes, BytesMut};
 
+/// The largest number of buffers that will be kept in each thread's [`BUFFER_POOL`].
+const MAX_POOLED_BUFFERS: usize = 64;
+
+std::thread_local! {
+    /// Buffers released by queues on this thread when they became empty, which can be reused by
+    /// any queue on the thread. This lets idle queues (for example the buffers of idle sockets)
+    /// hold no memory, without the queues that are in use needing to allocate more often. Each
+    /// buffer is kept with the [`Allocation`] that tracks it, which is reused along with it.
+    static BUFFER_POOL: RefCell<Vec<(BytesMut, Arc<Allocation>)>> =
+        const { RefCell::new(Vec::new()) };
+}
+
 /// A queue of bytes that supports reading and writing stream and/or packet data.
 ///
 /// Both stream and packet data can be pushed onto the buffer and their order will be preserved.
@@ -18,11 +33,16 @@ use bytes::{Bytes, BytesMut};
 /// To avoid memory copies when moving bytes from one `ByteQueue` to another, you can use
 /// `pop_chunk()` to remove a chunk from the queue, and use `push_chunk()` to add it to another
 /// queue.
+///
+/// No memory is allocated until data is pushed, and any buffers kept for reuse are returned to a
+/// per-thread pool when the queue becomes empty.
 pub struct ByteQueue {
     /// The queued bytes.
     bytes: LinkedList<ByteChunk>,
     /// A pre-allocated buffer that can be used for new bytes.
-    unused_buffer: Option<BytesMut>,
+    unused_buffer: Option<(BytesMut, Arc<Allocation>)>,
+    /// Buffers of stream chunks that were fully read, which can be reused for new bytes.
+    free_buffers: Vec<(BytesMut, Arc<Allocation>)>,
     /// The number of bytes in the queue.
     length: usize,
     /// The size of newly allocated chunks when storing stream data.
@@ -33,10 +53,16 @@ pub struct ByteQueue {
 }
 
 impl ByteQueue {
+    /// The largest chunk that will be allocated for stream data based on a size hint.
+    const MAX_CHUNK_CAPACITY: usize = 256 * 1024;
+    /// The largest number of read buffers that will be kept for reuse.
+    const MAX_FREE_BUFFERS: usize = 4;
+
     pub fn new(default_chunk_capacity: usize) -> Self {
         Self {
             bytes: LinkedList::new(),
             unused_buffer: None,
+            free_buffers: Vec::new(),
             length: 0,
             default_chunk_capacity,
             #[cfg(test)]
@@ -67,30 +93,173 @@ impl ByteQueue {
             self.total_allocations += 1;
         }
 
-        BytesMut::from_iter(std::iter::repeat(0).take(size))
+        BytesMut::zeroed(size)
+    }
+
+    /// Allocate a new buffer along with the [`Allocation`] that tracks its use.
+    #[must_use]
+    fn alloc_tracked_buffer(&mut self, size: usize) -> (BytesMut, Arc<Allocation>) {
+        let buf = self.alloc_zeroed_buffer(size);
+        let alloc = Allocation::new(&buf);
+        (buf, alloc)
+    }
+
+    /// Keep the buffer of a chunk that has been fully read so that it can be reused for new bytes
+    /// instead of allocating a new buffer.
+    fn recycle_buffer(&mut self, buf: BytesMut, alloc: Option<Arc<Allocation>>) {
+        if self.free_buffers.len() >= Self::MAX_FREE_BUFFERS {
+            return;
+        }
+
+        if let Some(x) = self.reclaim_buffer(buf, alloc) {
+            self.free_buffers.push(x);
+        }
+    }
+
+    /// Prepare an empty buffer for reuse along with its [`Allocation`], or return `None` if it
+    /// shouldn't be reused.
+    ///
+    /// Only buffers whose memory isn't shared with any other buffer are reused. Reclaiming a shared
+    /// buffer would require allocating a new one, which is no better than allocating it later.
+    fn reclaim_buffer(
+        &self,
+        mut buf: BytesMut,
+        alloc: Option<Arc<Allocation>>,
+    ) -> Option<(BytesMut, Arc<Allocation>)> {
+        debug_assert!(buf.is_empty());
+
+        // buffers that we didn't allocate aren't tracked, so we can't know if they're shared
+        let alloc = alloc?;
+
+        // some other chunk in this queue (or the `unused_buffer`) still uses the memory, or part of
+        // it was handed out by `pop_chunk()`
+        if Arc::strong_count(&alloc) != 1 || alloc.escaped.load(Ordering::Relaxed) {
+            return None;
+        }
+
+        // don't hold on to small buffers that were allocated for small packets, or large buffers
+        // that were allocated for large writes
+        if alloc.capacity != self.default_chunk_capacity {
+            return None;
+        }
+
+        // no other buffers use this buffer's memory, so this will reclaim the entire allocation
+        // without allocating or copying
+        buf.reserve(alloc.capacity);
+        debug_assert_eq!(buf.capacity(), alloc.capacity);
+
+        // the reclaimed memory was initialized when the buffer was first allocated
+        buf.resize(buf.capacity(), 0);
+
+        // nothing else references the allocation and none of its memory escaped, so it can keep
+        // tracking the buffer when it's reused
+        Some((buf, alloc))
+    }
+
+    /// Get a buffer of at least `capacity` bytes, from our free buffers or the thread's pool if
+    /// possible.
+    fn take_buffer(&mut self, capacity: usize) -> (BytesMut, Arc<Allocation>) {
+        // reuse the buffer of a previously read chunk if possible
+        let buf = match self.free_buffers.pop() {
+            Some(x) if x.0.len() >= capacity => Some(x),
+            Some(x) => {
+                self.free_buffers.push(x);
+                None
+            }
+            None => None,
+        };
+
+        let pooled = buf.or_else(|| {
+            BUFFER_POOL.with(|pool| {
+                let mut pool = pool.borrow_mut();
+                match pool.last() {
+                    Some(x) if x.0.len() >= capacity => pool.pop(),
+                    _ => None,
+                }
+            })
+        });
+
+        // a new `Allocation` is only needed for a new buffer
+        pooled.unwrap_or_else(|| self.alloc_tracked_buffer(capacity))
+    }
+
+    /// Return our free buffers (and the unused part of the last chunk's buffer) to the thread's
+    /// pool. Should be called when the queue becomes empty.
+    fn release_buffers(&mut self) {
+        debug_assert!(self.bytes.is_empty());
+
+        if let Some((mut buf, alloc)) = self.unused_buffer.take() {
+            buf.clear();
+            if let Some(x) = self.reclaim_buffer(buf, Some(alloc)) {
+                self.free_buffers.push(x);
+            }
+        }
+
+        if self.free_buffers.is_empty() {
+            return;
+        }
+
+        BUFFER_POOL.with(|pool| {
+            let mut pool = pool.borrow_mut();
+            for x in self.free_buffers.drain(..) {
+                if pool.len() >= MAX_POOLED_BUFFERS {
+                    break;
+                }
+                pool.push(x);
+            }
+        });
+
+        // any buffers that didn't fit in the pool are freed
+        self.free_buffers = Vec::new();
     }
 
     /// Push stream data onto the queue. The data may be merged into the previous stream chunk.
-    pub fn push_stream<R: Read>(&mut self, mut src: R) -> std::io::Result<usize> {
+    pub fn push_stream<R: Read>(&mut self, src: R) -> std::io::Result<usize> {
+        self.push_stream_with_size_hint(src, 0)
+    }
+
+    /// Push stream data onto the queue, where `size_hint` is the number of bytes that `src` is
+    /// expected to provide. If the hint is non-zero, no more than `size_hint` bytes will be read
+    /// from `src`. If the hint is larger than the default chunk capacity, a single larger chunk is
+    /// allocated so that large writes are read from `src` all at once instead of in many small
+    /// reads (which may each require accessing the plugin's memory). The data may be merged into
+    /// the previous stream chunk.
+    pub fn push_stream_with_size_hint<R: Read>(
+        &mut self,
+        mut src: R,
+        size_hint: usize,
+    ) -> std::io::Result<usize> {
         let mut total_copied = 0;
 
         loop {
-            let mut unused = match self.unused_buffer.take() {
+            let (mut unused, alloc) = match self.unused_buffer.take() {
                 // we already have an allocated buffer
                 Some(x) => x,
                 // we need to allocate a new buffer
-                None => self.alloc_zeroed_buffer(self.default_chunk_capacity),
+                None => {
+                    let remaining_hint = size_hint.saturating_sub(total_copied);
+                    let remaining_hint = std::cmp::min(remaining_hint, Self::MAX_CHUNK_CAPACITY);
+                    let capacity = std::cmp::max(self.default_chunk_capacity, remaining_hint);
+
+                    self.take_buffer(capacity)
+                }
             };
             assert_eq!(unused.len(), unused.capacity());
 
-            let copied = src.read(&mut unused)?;
+            // don't read past the hint
+            let read_len = match size_hint {
+                0 => unused.len(),
+                _ => std::cmp::min(unused.len(), size_hint - total_copied),
+            };
+
+            let copied = src.read(&mut unused[..read_len])?;
             let bytes = unused.split_to(copied);
 
             total_copied += bytes.len();
 
             if !unused.is_empty() {
                 // restore the remaining unused buffer
-                self.unused_buffer = Some(unused);
+                self.unused_buffer = Some((unused, Arc::clone(&alloc)));
             }
 
             if bytes.is_empty() {
@@ -120,7 +289,12 @@ impl ByteQueue {
 
             // if we didn't merge it into the previous chunk
             if let Some(bytes) = bytes {
-                self.push_chunk(bytes, ChunkType::Stream);
+                self.push_tracked_chunk(bytes.into(), ChunkType::Stream, Some(alloc));
+            }
+
+            // we've read all of the expected bytes
+            if size_hint != 0 && total_copied >= size_hint {
+                break;
             }
         }
 
@@ -133,13 +307,13 @@ impl ByteQueue {
         // we may need somewhere to store a new buffer
         let mut new_buf;
 
-        let unused = match &mut self.unused_buffer {
+        let (unused, alloc) = match &mut self.unused_buffer {
             // if the existing 'unused_buffer' has enough space
-            Some(buf) if buf.len() >= size => buf,
+            Some((buf, alloc)) if buf.len() >= size => (buf, Arc::clone(alloc)),
             // otherwise allocate a new buffer
             _ => {
-                new_buf = self.alloc_zeroed_buffer(size);
-                &mut new_buf
+                new_buf = self.alloc_tracked_buffer(size);
+                (&mut new_buf.0, Arc::clone(&new_buf.1))
             }
         };
         assert_eq!(unused.len(), unused.capacity());
@@ -148,23 +322,34 @@ impl ByteQueue {
         let bytes = unused.split_to(size);
 
         // we may have used up all of the space in 'unused_buffer'
-        if let Some(ref unused_buffer) = self.unused_buffer {
+        if let Some((ref unused_buffer, _)) = self.unused_buffer {
             if unused_buffer.is_empty() {
                 self.unused_buffer = None;
             }
         }
 
-        self.push_chunk(bytes, ChunkType::Packet);
+        self.push_tracked_chunk(bytes.into(), ChunkType::Packet, Some(alloc));
 
         Ok(())
     }
 
     /// Push a chunk of stream or packet data onto the queue.
     pub fn push_chunk(&mut self, data: impl Into<BytesWrapper>, chunk_type: ChunkType) -> usize {
-        let data = data.into();
+        self.push_tracked_chunk(data.into(), chunk_type, None)
+    }
+
+    /// Push a chunk onto the queue, where `alloc` tracks the chunk's memory if the queue allocated
+    /// it.
+    fn push_tracked_chunk(
+        &mut self,
+        data: BytesWrapper,
+        chunk_type: ChunkType,
+        alloc: Option<Arc<Allocation>>,
+    ) -> usize {
         let len = data.len();
         self.length += len;
-        self.bytes.push_back(ByteChunk::new(data, chunk_type));
+        self.bytes
+            .push_back(ByteChunk::new(data, chunk_type, alloc));
         len
     }
 
@@ -175,6 +360,17 @@ impl ByteQueue {
     /// the number of bytes copied, the number of bytes removed from the queue (including dropped
     /// bytes), and the chunk type.
     pub fn pop<W: Write>(&mut self, dst: W) -> std::io::Result<Option<(usize, usize, ChunkType)>> {
+        let rv = self.pop_inner(dst);
+        if self.bytes.is_empty() {
+            self.release_buffers();
+        }
+        rv
+    }
+
+    fn pop_inner<W: Write>(
+        &mut self,
+        dst: W,
+    ) -> std::io::Result<Option<(usize, usize, ChunkType)>> {
         // peek the front to see what kind of data is next
         match self.bytes.front() {
             Some(x) => match x.chunk_type {
@@ -233,7 +429,10 @@ impl ByteQueue {
             total_copied += copied;
 
             if bytes.is_empty() {
-                self.bytes.pop_front();
+                let chunk = self.bytes.pop_front().unwrap();
+                if let BytesWrapper::Mutable(buf) = chunk.data {
+                    self.recycle_buffer(buf, chunk.alloc);
+                }
             }
         }
 
@@ -289,6 +488,11 @@ impl ByteQueue {
         let chunk = self.bytes.front_mut()?;
         let chunk_type = chunk.chunk_type;
 
+        // the returned bytes will share the chunk's memory, so it must never be reused
+        if let Some(alloc) = &chunk.alloc {
+            alloc.escaped.store(true, Ordering::Relaxed);
+        }
+
         let bytes = match chunk_type {
             ChunkType::Stream => {
                 let temp = chunk
@@ -304,6 +508,10 @@ impl ByteQueue {
 
         self.length -= bytes.len();
 
+        if self.bytes.is_empty() {
+            self.release_buffers();
+        }
+
         Some((bytes.into(), chunk_type))
     }
 
@@ -489,11 +697,37 @@ impl BytesWrapper {
 struct ByteChunk {
     data: BytesWrapper,
     chunk_type: ChunkType,
+    /// The allocation that `data` is part of, if it was allocated by the queue.
+    alloc: Option<Arc<Allocation>>,
 }
 
 impl ByteChunk {
-    pub fn new(data: BytesWrapper, chunk_type: ChunkType) -> Self {
-        Self { data, chunk_type }
+    pub fn new(data: BytesWrapper, chunk_type: ChunkType, alloc: Option<Arc<Allocation>>) -> Self {
+        Self {
+            data,
+            chunk_type,
+            alloc,
+        }
+    }
+}
+
+/// Tracks which buffers share the memory of a buffer allocated by a [`ByteQueue`]. Every buffer
+/// held by the queue that uses the memory holds a reference, so the memory is not shared with any
+/// other buffer when the strong count is 1 (unless some of it `escaped` the queue). The `bytes`
+/// crate doesn't expose whether a buffer is uniquely owned, so we need to track this ourselves.
+struct Allocation {
+    /// The capacity of the buffer when it was allocated.
+    capacity: usize,
+    /// Whether some of the memory was returned from the queue and may still be in use.
+    escaped: AtomicBool,
+}
+
+impl Allocation {
+    fn new(buf: &BytesMut) -> Arc<Self> {
+        Arc::new(Self {
+            capacity: buf.capacity(),
+            escaped: AtomicBool::new(false),
+        })
     }
 }
 
@@ -551,6 +785,130 @@ mod tests {
         assert_eq!(bq.num_bytes(), 0);
     }
 
+    #[test]
+    fn test_bytequeue_stream_size_hint() {
+        let chunk_size = 5;
+        let mut bq = ByteQueue::new(chunk_size);
+
+        let src = [1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13];
+        let mut dst = [0; 13];
+
+        // a large enough hint should use a single chunk
+        assert_eq!(
+            bq.push_stream_with_size_hint(&src[..], src.len()).unwrap(),
+            src.len()
+        );
+        assert_eq!(bq.bytes.len(), 1);
+        assert_eq!(bq.total_allocations, 1);
+
+        // a small hint should use the default chunk capacity
+        assert_eq!(bq.push_stream_with_size_hint(&src[..2], 2).unwrap(), 2);
+        assert_eq!(bq.bytes.len(), 2);
+        assert_eq!(bq.total_allocations, 2);
+
+        assert_eq!(13, bq.pop(&mut dst[..]).unwrap().unwrap().0);
+        assert_eq!(dst, src);
+        assert_eq!(bq.num_bytes(), 2);
+    }
+
+    #[test]
+    fn test_bytequeue_stream_reuse_buffer() {
+        let chunk_size = 5;
+        let mut bq = ByteQueue::new(chunk_size);
+
+        let src = [1, 2, 3, 4, 5];
+        let mut dst = [0; 5];
+
+        // fill an entire chunk so that no other references to its buffer remain
+        assert_eq!(bq.push_stream_with_size_hint(&src[..], 5).unwrap(), 5);
+        assert_eq!(bq.total_allocations, 1);
+
+        assert_eq!(5, bq.pop(&mut dst[..]).unwrap().unwrap().0);
+        assert_eq!(dst, src);
+        // the queue is empty, so the buffer was returned to the thread's pool
+        assert!(bq.free_buffers.is_empty());
+        assert_eq!(BUFFER_POOL.with(|x| x.borrow().len()), 1);
+        let alloc = BUFFER_POOL.with(|x| Arc::as_ptr(&x.borrow()[0].1));
+
+        // the buffer of the read chunk should be reused, along with its allocation tracker
+        assert_eq!(bq.push_stream_with_size_hint(&src[..3], 3).unwrap(), 3);
+        assert_eq!(bq.total_allocations, 1);
+        assert_eq!(BUFFER_POOL.with(|x| x.borrow().len()), 0);
+        assert_eq!(
+            Arc::as_ptr(bq.bytes.front().unwrap().alloc.as_ref().unwrap()),
+            alloc
+        );
+
+        dst.fill(0);
+        assert_eq!(3, bq.pop(&mut dst[..]).unwrap().unwrap().0);
+        assert_eq!(dst, [1, 2, 3, 0, 0]);
+    }
+
+    #[test]
+    fn test_bytequeue_release_when_empty() {
+        let mut bq = ByteQueue::new(10);
+        let mut dst = [0; 10];
+
+        // a partly used chunk leaves an unused buffer
+        bq.push_stream(&[1, 2, 3][..]).unwrap();
+        assert!(bq.unused_buffer.is_some());
+
+        assert_eq!(3, bq.pop(&mut dst[..]).unwrap().unwrap().0);
+        assert!(bq.unused_buffer.is_none());
+        assert!(bq.free_buffers.is_empty());
+        assert!(BUFFER_POOL.with(|x| !x.borrow().is_empty()));
+
+        // a new queue can use the pooled buffers
+        let mut bq2 = ByteQueue::new(10);
+        bq2.push_stream(&[4, 5, 6][..]).unwrap();
+        assert_eq!(bq2.total_allocations, 0);
+        assert_eq!(3, bq2.pop(&mut dst[..]).unwrap().unwrap().0);
+        assert_eq!(dst[..3], [4, 5, 6]);
+    }
+
+    #[test]
+    fn test_bytequeue_reclaim_shared_buffer() {
+        let mut bq = ByteQueue::new(10);
+        let mut dst = [0; 10];
+
+        // the chunk shares its buffer's memory with the unused buffer
+        bq.push_stream(&[1, 2, 3][..]).unwrap();
+        let ptr = bq.bytes.front().unwrap().data.as_ref().as_ptr();
+
+        // the read chunk's buffer is still shared so it isn't kept, but once the unused buffer is
+        // released the entire allocation is reclaimed without allocating a new buffer
+        assert_eq!(3, bq.pop(&mut dst[..]).unwrap().unwrap().0);
+        BUFFER_POOL.with(|pool| {
+            let pool = pool.borrow();
+            assert_eq!(pool.len(), 1);
+            assert_eq!(pool[0].0.as_ptr(), ptr);
+            assert_eq!(pool[0].0.len(), 10);
+        });
+        assert_eq!(bq.total_allocations, 1);
+    }
+
+    #[test]
+    fn test_bytequeue_escaped_buffer_not_reused() {
+        let mut bq = ByteQueue::new(5);
+        let src = [1, 2, 3, 4, 5];
+
+        // fill an entire chunk and hand its memory out of the queue
+        assert_eq!(bq.push_stream_with_size_hint(&src[..], 5).unwrap(), 5);
+        let (popped, _) = bq.pop_chunk(5).unwrap();
+        assert_eq!(popped, src[..]);
+        assert!(bq.free_buffers.is_empty());
+        assert!(BUFFER_POOL.with(|x| x.borrow().is_empty()));
+
+        // new bytes must not overwrite the popped bytes
+        assert_eq!(
+            bq.push_stream_with_size_hint(&[6, 7, 8, 9, 10][..], 5)
+                .unwrap(),
+            5
+        );
+        assert_eq!(bq.total_allocations, 2);
+        assert_eq!(popped, src[..]);
+    }
+
     #[test]
     fn test_bytequeue_packet() {
         let mut bq = ByteQueue::new(5);
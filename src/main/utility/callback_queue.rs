@@ -3,20 +3,33 @@
 //! mutate the same state simultaneously, an event queue is used to defer new events until the
 //! current event has finished running.
 
+use std::cell::Cell;
+use std::collections::VecDeque;
+use std::marker::PhantomData;
+use std::mem::{ManuallyDrop, MaybeUninit};
 use std::sync::{Arc, Weak};
 
 use atomic_refcell::AtomicRefCell;
 use log::*;
 
+/// The largest capacity of an empty queue that will be kept for reuse by
+/// [`CallbackQueue::queue_and_run`].
+const MAX_SPARE_CAPACITY: usize = 1024;
+
+std::thread_local! {
+    /// An empty queue whose allocation can be reused by the next [`CallbackQueue::queue_and_run`]
+    /// on this thread.
+    static SPARE_QUEUE: Cell<Option<VecDeque<Callback>>> = const { Cell::new(None) };
+}
+
 /// A queue of events (functions/closures) which when run can add their own events to the queue.
 /// This allows events to be deferred and run later.
-#[allow(clippy::type_complexity)]
-pub struct CallbackQueue(std::collections::VecDeque<Box<dyn FnOnce(&mut Self)>>);
+pub struct CallbackQueue(VecDeque<Callback>);
 
 impl CallbackQueue {
     /// Create an empty event queue.
     pub fn new() -> Self {
-        Self(std::collections::VecDeque::new())
+        Self(VecDeque::new())
     }
 
     pub fn len(&self) -> usize {
@@ -27,9 +40,9 @@ impl CallbackQueue {
         self.len() == 0
     }
 
-    /// Add an event to the queue.
+    /// Add an event to the queue. Small closures are stored in the queue without allocating.
     pub fn add(&mut self, f: impl FnOnce(&mut Self) + 'static) {
-        self.0.push_back(Box::new(f));
+        self.0.push_back(Callback::new(f));
     }
 
     /// Process all of the events in the queue (and any new events that are generated).
@@ -38,7 +51,7 @@ impl CallbackQueue {
         let mut count = 0;
         while let Some(f) = self.0.pop_front() {
             // run the event and allow it to add new events
-            (f)(self);
+            f.run(self);
 
             count += 1;
             if count == 200 {
@@ -50,14 +63,22 @@ impl CallbackQueue {
     }
 
     /// A convenience function to create an EventQueue, allow the caller to add events,
-    /// and process them all before returning.
+    /// and process them all before returning. The queue's allocation is reused between calls on
+    /// the same thread.
     pub fn queue_and_run<F, U>(f: F) -> U
     where
         F: FnOnce(&mut Self) -> U,
     {
-        let mut cb_queue = Self::new();
+        // if this is a nested call, the spare queue will already have been taken
+        let mut cb_queue = Self(SPARE_QUEUE.with(|x| x.take()).unwrap_or_default());
         let rv = (f)(&mut cb_queue);
         cb_queue.run();
+
+        let spare = std::mem::take(&mut cb_queue.0);
+        if spare.capacity() <= MAX_SPARE_CAPACITY {
+            SPARE_QUEUE.with(|x| x.set(Some(spare)));
+        }
+
         rv
     }
 }
@@ -82,6 +103,76 @@ impl std::ops::Drop for CallbackQueue {
     }
 }
 
+/// The storage for a callback's closure. Closures that are larger than this (or that need a larger
+/// alignment) are boxed. This is large enough for a listener notification (an `Arc<dyn Fn>` and a
+/// small message).
+type CallbackData = MaybeUninit<[usize; 4]>;
+
+/// A `Box<dyn FnOnce(&mut CallbackQueue)>` that stores small closures inline.
+struct Callback {
+    data: CallbackData,
+    /// Runs the closure stored in `data`, moving it out of `data`.
+    call: unsafe fn(*mut CallbackData, &mut CallbackQueue),
+    /// Drops the closure stored in `data` without running it.
+    drop: unsafe fn(*mut CallbackData),
+    /// The closure may not be `Send` or `Sync`.
+    _phantom: PhantomData<Box<dyn FnOnce(&mut CallbackQueue)>>,
+}
+
+impl Callback {
+    fn new<F: FnOnce(&mut CallbackQueue) + 'static>(f: F) -> Self {
+        if Self::fits::<F>() {
+            Self::new_inline(f)
+        } else {
+            Self::new_inline(Box::new(f))
+        }
+    }
+
+    const fn fits<F>() -> bool {
+        std::mem::size_of::<F>() <= std::mem::size_of::<CallbackData>()
+            && std::mem::align_of::<F>() <= std::mem::align_of::<CallbackData>()
+    }
+
+    fn new_inline<F: FnOnce(&mut CallbackQueue) + 'static>(f: F) -> Self {
+        assert!(Self::fits::<F>());
+
+        unsafe fn call<F: FnOnce(&mut CallbackQueue)>(
+            data: *mut CallbackData,
+            cb_queue: &mut CallbackQueue,
+        ) {
+            let f = unsafe { data.cast::<F>().read() };
+            (f)(cb_queue)
+        }
+
+        unsafe fn drop<F>(data: *mut CallbackData) {
+            unsafe { data.cast::<F>().drop_in_place() }
+        }
+
+        let mut data = CallbackData::uninit();
+        unsafe { data.as_mut_ptr().cast::<F>().write(f) };
+
+        Self {
+            data,
+            call: call::<F>,
+            drop: drop::<F>,
+            _phantom: PhantomData,
+        }
+    }
+
+    fn run(self, cb_queue: &mut CallbackQueue) {
+        // the closure is moved out of `data` when called, so it must not be dropped again (even if
+        // the closure panics)
+        let mut this = ManuallyDrop::new(self);
+        unsafe { (this.call)(&mut this.data, cb_queue) }
+    }
+}
+
+impl std::ops::Drop for Callback {
+    fn drop(&mut self) {
+        unsafe { (self.drop)(&mut self.data) }
+    }
+}
+
 #[derive(Clone, Copy, PartialEq, PartialOrd)]
 struct HandleId(u32);
 
@@ -131,7 +222,12 @@ impl<T: Clone + Copy + 'static> EventSource<T> {
         self.inner.borrow_mut().add_listener(inner_ref, notify_fn)
     }
 
-    /// Notify all listeners.
+    /// The number of listeners that are currently subscribed.
+    pub fn num_listeners(&self) -> usize {
+        self.inner.borrow().listeners.len()
+    }
+
+    /// Notify all listeners. This doesn't allocate for messages that are a few bytes or smaller.
     pub fn notify_listeners(&mut self, message: T, cb_queue: &mut CallbackQueue) {
         for (_, l) in &self.inner.borrow().listeners {
             let l_clone = l.clone();
@@ -210,11 +306,59 @@ mod tests {
         CallbackQueue::queue_and_run(|queue| source.notify_listeners(1, queue));
         CallbackQueue::queue_and_run(|queue| source.notify_listeners(3, queue));
 
+        assert_eq!(source.num_listeners(), 1);
         handle.stop_listening();
+        assert_eq!(source.num_listeners(), 0);
 
         CallbackQueue::queue_and_run(|queue| source.notify_listeners(5, queue));
         CallbackQueue::queue_and_run(|queue| source.notify_listeners(7, queue));
 
         assert_eq!(*counter.borrow(), 4);
     }
+
+    #[test]
+    fn test_callback_sizes() {
+        let counter = Arc::new(AtomicRefCell::new(0u64));
+
+        // a small closure which is stored inline, and a large closure which is boxed
+        let small = Arc::clone(&counter);
+        let large = (Arc::clone(&counter), [1u64; 16]);
+        assert!(Callback::fits::<Arc<AtomicRefCell<u64>>>());
+        assert!(!Callback::fits::<(Arc<AtomicRefCell<u64>>, [u64; 16])>());
+
+        CallbackQueue::queue_and_run(|queue| {
+            queue.add(move |_| *small.borrow_mut() += 1);
+            queue.add(move |queue| {
+                *large.0.borrow_mut() += large.1.iter().sum::<u64>();
+                // a nested queue, which can't use the spare queue
+                CallbackQueue::queue_and_run(|queue| {
+                    let large = Arc::clone(&large.0);
+                    queue.add(move |_| *large.borrow_mut() += 100)
+                });
+                let large = Arc::clone(&large.0);
+                queue.add(move |_| *large.borrow_mut() += 1000);
+            });
+        });
+
+        assert_eq!(*counter.borrow(), 1117);
+        // the closures and the queue's callbacks have all been dropped
+        assert_eq!(Arc::strong_count(&counter), 1);
+    }
+
+    #[test]
+    fn test_callback_drop() {
+        let counter = Arc::new(());
+
+        let small = Arc::clone(&counter);
+        let large = (Arc::clone(&counter), [0u64; 16]);
+        let callbacks = [
+            Callback::new(move |_| drop(small)),
+            Callback::new(move |_| drop(large)),
+        ];
+        assert_eq!(Arc::strong_count(&counter), 3);
+
+        // dropped without running
+        std::mem::drop(callbacks);
+        assert_eq!(Arc::strong_count(&counter), 1);
+    }
 }
@@ -1,14 +1,24 @@
 use std::collections::HashMap;
 use std::fs::File;
 use std::os::unix::prelude::{AsRawFd, FromRawFd};
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
 use std::sync::Arc;
 use std::sync::Mutex;
 use std::thread;
 
+use crossbeam::queue::SegQueue;
 use nix::errno::Errno;
 use nix::sys::epoll::{Epoll, EpollCreateFlags, EpollEvent, EpollFlags};
 use nix::unistd::Pid;
 
+/// The number of independently locked shards that the monitored pids are split between, so that
+/// threads registering and unregistering different pids rarely contend with each other or with the
+/// watcher thread.
+const NUM_SHARDS: usize = 16;
+
+/// The maximum number of epoll events handled per wakeup of the watcher thread.
+const EVENT_BATCH_SIZE: usize = 256;
+
 // TODO: consider using std::os::linux::process::PidFd once it's stabilized.
 fn pidfd_open(pid: Pid) -> nix::Result<File> {
     let raw_fd =
@@ -21,8 +31,8 @@ fn pidfd_open(pid: Pid) -> nix::Result<File> {
 /// when the object is dropped.
 #[derive(Debug)]
 pub struct ChildPidWatcher {
-    inner: Arc<Mutex<Inner>>,
-    epoll: Arc<Epoll>,
+    inner: Arc<Inner>,
+    thread_handle: Option<thread::JoinHandle<()>>,
 }
 
 pub type WatchHandle = u64;
@@ -46,24 +56,46 @@ struct PidData {
 
 #[derive(Debug)]
 struct Inner {
+    // The pidfds of the monitored pids, and the command_notifier.
+    epoll: Epoll,
     // Next unique handle ID.
-    next_handle: WatchHandle,
+    next_handle: AtomicU64,
     // Pending commands for watcher thread.
-    commands: Vec<Command>,
-    // Data for each monitored pid.
-    pids: HashMap<Pid, PidData>,
+    commands: SegQueue<Command>,
+    // Whether the command_notifier has been written to since the watcher
+    // thread last drained `commands`, so that we only write to it once per
+    // batch of commands.
+    command_pending: AtomicBool,
     // event_fd used to notify watcher thread via epoll. Calling thread writes a
     // single byte, which the watcher thread reads to reset.
     command_notifier: File,
-    thread_handle: Option<thread::JoinHandle<()>>,
+    // Data for each monitored pid, split by pid.
+    shards: Vec<Mutex<Shard>>,
 }
 
 impl Inner {
-    fn send_command(&mut self, cmd: Command) {
+    fn send_command(&self, cmd: Command) {
         self.commands.push(cmd);
-        nix::unistd::write(self.command_notifier.as_raw_fd(), &1u64.to_ne_bytes()).unwrap();
+        if !self.command_pending.swap(true, Ordering::SeqCst) {
+            nix::unistd::write(self.command_notifier.as_raw_fd(), &1u64.to_ne_bytes()).unwrap();
+        }
     }
 
+    fn shard_idx(pid: Pid) -> usize {
+        pid.as_raw() as usize % NUM_SHARDS
+    }
+
+    fn shard(&self, pid: Pid) -> std::sync::MutexGuard<Shard> {
+        self.shards[Self::shard_idx(pid)].lock().unwrap()
+    }
+}
+
+#[derive(Debug, Default)]
+struct Shard {
+    pids: HashMap<Pid, PidData>,
+}
+
+impl Shard {
     fn unwatch_pid(&mut self, epoll: &Epoll, pid: Pid) {
         let Some(piddata) = self.pids.get_mut(&pid) else {
             // Already unregistered the pid
@@ -108,7 +140,7 @@ impl ChildPidWatcher {
     /// Create a ChildPidWatcher. Spawns a background thread, which is joined
     /// when the object is dropped.
     pub fn new() -> Self {
-        let epoll = Arc::new(Epoll::new(EpollCreateFlags::empty()).unwrap());
+        let epoll = Epoll::new(EpollCreateFlags::empty()).unwrap();
         let command_notifier = {
             let raw =
                 nix::sys::eventfd::eventfd(0, nix::sys::eventfd::EfdFlags::EFD_NONBLOCK).unwrap();
@@ -116,34 +148,32 @@ impl ChildPidWatcher {
         };
         let event = EpollEvent::new(EpollFlags::EPOLLIN, 0);
         epoll.add(&command_notifier, event).unwrap();
-        let watcher = ChildPidWatcher {
-            inner: Arc::new(Mutex::new(Inner {
-                next_handle: 1,
-                pids: HashMap::new(),
-                commands: Vec::new(),
-                command_notifier,
-                thread_handle: None,
-            })),
+        let inner = Arc::new(Inner {
             epoll,
-        };
+            next_handle: AtomicU64::new(1),
+            commands: SegQueue::new(),
+            command_pending: AtomicBool::new(false),
+            command_notifier,
+            shards: (0..NUM_SHARDS).map(|_| Mutex::default()).collect(),
+        });
         let thread_handle = {
-            let inner = Arc::clone(&watcher.inner);
-            let epoll = watcher.epoll.clone();
+            let inner = Arc::clone(&inner);
             thread::Builder::new()
                 .name("child-pid-watcher".into())
-                .spawn(move || ChildPidWatcher::thread_loop(&inner, &epoll))
+                .spawn(move || ChildPidWatcher::thread_loop(&inner))
                 .unwrap()
         };
-        watcher.inner.lock().unwrap().thread_handle = Some(thread_handle);
-        watcher
+        ChildPidWatcher {
+            inner,
+            thread_handle: Some(thread_handle),
+        }
     }
 
-    fn thread_loop(inner: &Mutex<Inner>, epoll: &Epoll) {
-        let mut events = [EpollEvent::empty(); 10];
-        let mut commands = Vec::new();
-        let mut done = false;
-        while !done {
-            let nevents = match epoll.wait(&mut events, -1) {
+    fn thread_loop(inner: &Inner) {
+        let mut events = vec![EpollEvent::empty(); EVENT_BATCH_SIZE];
+        let mut exited = Vec::with_capacity(EVENT_BATCH_SIZE);
+        loop {
+            let nevents = match inner.epoll.wait(&mut events, -1) {
                 Ok(n) => n,
                 Err(Errno::EINTR) => {
                     // Just try again.
@@ -152,23 +182,43 @@ impl ChildPidWatcher {
                 Err(e) => panic!("epoll_wait: {:?}", e),
             };
 
-            // We hold the lock the whole time we're processing events. While it'd
-            // be nice to avoid holding it while executing callbacks (and therefore
-            // not require that callbacks don't call ChildPidWatcher APIs), that'd
-            // make it difficult to guarantee a callback *won't* be run if the
-            // caller unregisters it.
-            let mut inner = inner.lock().unwrap();
-
+            let mut notified = false;
+            exited.clear();
             for event in &events[0..nevents] {
                 let pid = Pid::from_raw(i32::try_from(event.data()).unwrap());
                 // We get an event for pid=0 when there's a write to the command_notifier;
-                // Ignore that here and handle below.
-                if pid.as_raw() != 0 {
-                    inner.unwatch_pid(epoll, pid);
-                    inner.run_callbacks_for_pid(pid);
-                    inner.maybe_remove_pid(epoll, pid);
+                // handle that below.
+                if pid.as_raw() == 0 {
+                    notified = true;
+                } else {
+                    exited.push(pid);
+                }
+            }
+
+            // Group the exited pids by shard so that each shard's lock is taken
+            // once per batch.
+            //
+            // We hold a shard's lock the whole time we're processing its pids.
+            // While it'd be nice to avoid holding it while executing callbacks
+            // (and therefore not require that callbacks don't call
+            // ChildPidWatcher APIs), that'd make it difficult to guarantee a
+            // callback *won't* be run if the caller unregisters it.
+            exited.sort_unstable_by_key(|pid| (Inner::shard_idx(*pid), pid.as_raw()));
+            let mut exited_iter = exited.iter().peekable();
+            while let Some(first) = exited_iter.peek() {
+                let shard_idx = Inner::shard_idx(**first);
+                let mut shard = inner.shards[shard_idx].lock().unwrap();
+                while let Some(pid) = exited_iter.next_if(|x| Inner::shard_idx(**x) == shard_idx) {
+                    shard.unwatch_pid(&inner.epoll, *pid);
+                    shard.run_callbacks_for_pid(*pid);
+                    shard.maybe_remove_pid(&inner.epoll, *pid);
                 }
             }
+
+            if !notified {
+                continue;
+            }
+
             // Reading an eventfd always returns an 8 byte integer. Do so to ensure it's
             // no longer marked 'readable'.
             let mut buf = [0; 8];
@@ -179,29 +229,35 @@ impl ChildPidWatcher {
                 Err(Errno::EAGAIN) => true,
                 Err(e) => panic!("Unexpected error {:?}", e),
             });
+
+            // Clear the flag after resetting the notifier but before draining the
+            // commands. A command sent after this point writes to the notifier
+            // again, and that write can't be swallowed by the read above.
+            inner.command_pending.store(false, Ordering::SeqCst);
+
             // Run commands
-            std::mem::swap(&mut commands, &mut inner.commands);
-            for cmd in commands.drain(..) {
+            while let Some(cmd) = inner.commands.pop() {
                 match cmd {
                     Command::RunCallbacks(pid) => {
-                        debug_assert!(inner.pid_has_exited(pid));
-                        inner.run_callbacks_for_pid(pid);
-                        inner.maybe_remove_pid(epoll, pid);
+                        let mut shard = inner.shard(pid);
+                        debug_assert!(shard.pid_has_exited(pid));
+                        shard.run_callbacks_for_pid(pid);
+                        shard.maybe_remove_pid(&inner.epoll, pid);
                     }
                     Command::UnregisterPid(pid) => {
-                        if let Some(pid_data) = inner.pids.get_mut(&pid) {
+                        let mut shard = inner.shard(pid);
+                        if let Some(pid_data) = shard.pids.get_mut(&pid) {
                             pid_data.unregistered = true;
-                            inner.maybe_remove_pid(epoll, pid);
+                            shard.maybe_remove_pid(&inner.epoll, pid);
                         }
                     }
                     Command::Finish => {
-                        done = true;
                         // There could be more commands queued and/or more epoll
                         // events ready, but it doesn't matter. We don't
                         // guarantee to callers whether callbacks have run or
                         // not after having sent `Finish`; only that no more
                         // callbacks will run after the thread is joined.
-                        break;
+                        return;
                     }
                 }
             }
@@ -248,13 +304,13 @@ impl ChildPidWatcher {
     /// function both to avoid such panics, and to avoid accidentally watching
     /// an unrelated process with a recycled `pid`.
     pub fn register_pid(&self, pid: Pid) {
-        let mut inner = self.inner.lock().unwrap();
+        let mut shard = self.inner.shard(pid);
         let pidfd = pidfd_open(pid).unwrap();
 
         let event = EpollEvent::new(EpollFlags::EPOLLIN, pid.as_raw().try_into().unwrap());
-        self.epoll.add(&pidfd, event).unwrap();
+        self.inner.epoll.add(&pidfd, event).unwrap();
 
-        let prev = inner.pids.insert(
+        let prev = shard.pids.insert(
             pid,
             PidData {
                 callbacks: HashMap::new(),
@@ -279,8 +335,7 @@ impl ChildPidWatcher {
         // Let the worker handle the actual unregistration. This avoids a race
         // where we unregister a pid at the same time as the worker thread
         // receives an epoll event for it.
-        let mut inner = self.inner.lock().unwrap();
-        inner.send_command(Command::UnregisterPid(pid));
+        self.inner.send_command(Command::UnregisterPid(pid));
     }
 
     /// Call `callback` from another thread after the child `pid`
@@ -295,15 +350,14 @@ impl ChildPidWatcher {
         pid: Pid,
         callback: impl Send + FnOnce(Pid) + 'static,
     ) -> WatchHandle {
-        let mut inner = self.inner.lock().unwrap();
-        let handle = inner.next_handle;
-        inner.next_handle += 1;
-        let pid_data = inner.pids.get_mut(&pid).unwrap();
+        let mut shard = self.inner.shard(pid);
+        let handle = self.inner.next_handle.fetch_add(1, Ordering::Relaxed);
+        let pid_data = shard.pids.get_mut(&pid).unwrap();
         assert!(!pid_data.unregistered);
         pid_data.callbacks.insert(handle, Box::new(callback));
         if pid_data.pidfd.is_none() {
             // pid is already dead. Run the callback we just registered.
-            inner.send_command(Command::RunCallbacks(pid));
+            self.inner.send_command(Command::RunCallbacks(pid));
         }
         handle
     }
@@ -314,10 +368,10 @@ impl ChildPidWatcher {
     ///
     /// No-op if `pid` isn't registered.
     pub fn unregister_callback(&self, pid: Pid, handle: WatchHandle) {
-        let mut inner = self.inner.lock().unwrap();
-        if let Some(pid_data) = inner.pids.get_mut(&pid) {
+        let mut shard = self.inner.shard(pid);
+        if let Some(pid_data) = shard.pids.get_mut(&pid) {
             pid_data.callbacks.remove(&handle);
-            inner.maybe_remove_pid(&self.epoll, pid);
+            shard.maybe_remove_pid(&self.inner.epoll, pid);
         }
     }
 }
@@ -330,12 +384,8 @@ impl Default for ChildPidWatcher {
 
 impl Drop for ChildPidWatcher {
     fn drop(&mut self) {
-        let handle = {
-            let mut inner = self.inner.lock().unwrap();
-            inner.send_command(Command::Finish);
-            inner.thread_handle.take().unwrap()
-        };
-        handle.join().unwrap();
+        self.inner.send_command(Command::Finish);
+        self.thread_handle.take().unwrap().join().unwrap();
     }
 }
 
@@ -201,6 +201,70 @@ impl Sub for Counter {
     }
 }
 
+/// The number of indices that an [`IndexedCounter`] stores in an array. Syscall numbers for
+/// Linux syscalls are all below this.
+const INDEXED_COUNTER_DENSE_LEN: usize = 512;
+
+/// A counter for keys that are identified by a small integer (such as a syscall number) in addition
+/// to a name. Counting a key is an array access rather than a hash map lookup, so this is cheap
+/// enough to use on hot paths. Counts can be converted to a [`Counter`] keyed by name.
+#[derive(Debug, Clone)]
+pub struct IndexedCounter {
+    // The count and name of each index below `INDEXED_COUNTER_DENSE_LEN`. The name is only set
+    // once the index has been counted.
+    dense: Vec<(i64, Option<&'static str>)>,
+    // Counts for indices that are too large for `dense`.
+    sparse: Counter,
+}
+
+impl IndexedCounter {
+    pub fn new() -> Self {
+        Self {
+            dense: Vec::new(),
+            sparse: Counter::new(),
+        }
+    }
+
+    /// Increment the counter value by one for the key with the given index. `name` is only called
+    /// the first time that the index is counted, and should return the same name for every call
+    /// with this index.
+    pub fn add_one(&mut self, index: usize, name: impl FnOnce() -> &'static str) {
+        if index >= INDEXED_COUNTER_DENSE_LEN {
+            self.sparse.add_one(name());
+            return;
+        }
+
+        if index >= self.dense.len() {
+            self.dense.resize(index + 1, (0, None));
+        }
+
+        let (count, item_name) = &mut self.dense[index];
+        if item_name.is_none() {
+            *item_name = Some(name());
+        }
+        *count += 1;
+    }
+
+    /// Returns the counts keyed by name.
+    pub fn to_counter(&self) -> Counter {
+        let mut counter = self.sparse.clone();
+        for (count, name) in &self.dense {
+            if let Some(name) = name {
+                if *count != 0 {
+                    counter.add_value(name, *count);
+                }
+            }
+        }
+        counter
+    }
+}
+
+impl Default for IndexedCounter {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
 mod export {
     use std::ffi::CStr;
     use std::ffi::CString;
@@ -308,6 +372,53 @@ mod export {
         // Free the previously alloc'd string
         drop(unsafe { CString::from_raw(ptr) });
     }
+
+    #[no_mangle]
+    pub extern "C" fn indexedcounter_new() -> *mut IndexedCounter {
+        Box::into_raw(Box::new(IndexedCounter::new()))
+    }
+
+    #[no_mangle]
+    pub extern "C" fn indexedcounter_free(counter_ptr: *mut IndexedCounter) {
+        if counter_ptr.is_null() {
+            return;
+        }
+        drop(unsafe { Box::from_raw(counter_ptr) });
+    }
+
+    /// Increment the count of the key with the given index and name.
+    ///
+    /// # Safety
+    ///
+    /// `name` must be a nul-terminated string that is valid for the rest of the program, such as
+    /// a string literal.
+    #[no_mangle]
+    pub unsafe extern "C" fn indexedcounter_add_one(
+        counter: *mut IndexedCounter,
+        index: u64,
+        name: *const c_char,
+    ) {
+        assert!(!counter.is_null());
+        assert!(!name.is_null());
+
+        let counter = unsafe { &mut *counter };
+        // a large index will end up in the counter's sparse counts
+        let index = usize::try_from(index).unwrap_or(usize::MAX);
+
+        counter.add_one(index, || {
+            let name: &'static CStr = unsafe { CStr::from_ptr(name) };
+            name.to_str().unwrap()
+        });
+    }
+
+    /// Returns a new counter with the counts keyed by name. The returned counter must be freed
+    /// with `counter_free`.
+    #[no_mangle]
+    pub extern "C" fn indexedcounter_to_counter(counter: *const IndexedCounter) -> *mut Counter {
+        assert!(!counter.is_null());
+        let counter = unsafe { &*counter };
+        Box::into_raw(Box::new(counter.to_counter()))
+    }
 }
 
 #[cfg(test)]
@@ -561,4 +672,18 @@ mod tests {
             String::from("{close:1, read:1, write:1}")
         );
     }
+
+    #[test]
+    fn test_indexed_counter() {
+        let mut counter = IndexedCounter::new();
+        counter.add_one(0, || "read");
+        counter.add_one(1, || "write");
+        counter.add_one(0, || unreachable!());
+        counter.add_one(100_000, || "large");
+
+        assert_eq!(
+            counter.to_counter().to_string(),
+            String::from("{read:2, large:1, write:1}")
+        );
+    }
 }
@@ -0,0 +1,294 @@
+//! A Shadow-wide cache of the contents of read-only files. When many hosts read the same input
+//! files (binaries, libraries, or files copied from the template directory), Shadow reads each
+//! file from the OS once and serves the hosts' reads from a single copy in memory.
+//!
+//! A file is identified by its device, inode, size, and modification time when it's opened, so a
+//! file that's replaced or modified before it's opened again gets a new entry. The cached contents
+//! of a file that's modified while it's open aren't updated.
+
+use std::collections::HashMap;
+use std::fs::File;
+use std::mem::ManuallyDrop;
+use std::os::fd::{AsRawFd, BorrowedFd, FromRawFd};
+use std::os::unix::fs::FileExt;
+use std::sync::{Arc, Mutex};
+
+#[derive(Copy, Clone, Debug, PartialEq, Eq, Hash)]
+struct FileKey {
+    dev: u64,
+    ino: u64,
+    size: u64,
+    mtime_sec: i64,
+    mtime_nsec: i64,
+}
+
+impl FileKey {
+    /// The key of `fd`, or `None` if it isn't a regular file.
+    fn new(fd: BorrowedFd) -> Option<Self> {
+        let mut stat = std::mem::MaybeUninit::<libc::stat>::uninit();
+        if unsafe { libc::fstat(fd.as_raw_fd(), stat.as_mut_ptr()) } != 0 {
+            return None;
+        }
+        let stat = unsafe { stat.assume_init() };
+
+        if stat.st_mode & libc::S_IFMT != libc::S_IFREG {
+            return None;
+        }
+
+        // Pseudo-files (such as in procfs and sysfs) report a size of 0 or a fixed size that has
+        // nothing to do with their contents, which are generated when they're read. An empty file
+        // has nothing worth caching either.
+        if stat.st_size == 0 || is_pseudo_fs(fd) {
+            return None;
+        }
+
+        Some(Self {
+            dev: stat.st_dev,
+            ino: stat.st_ino,
+            size: stat.st_size.try_into().ok()?,
+            mtime_sec: stat.st_mtime,
+            mtime_nsec: stat.st_mtime_nsec,
+        })
+    }
+}
+
+/// Whether `fd` is on a filesystem whose files' contents are generated when they're read. Assumes
+/// so if the filesystem can't be determined.
+fn is_pseudo_fs(fd: BorrowedFd) -> bool {
+    let mut statfs = std::mem::MaybeUninit::<libc::statfs>::uninit();
+    if unsafe { libc::fstatfs(fd.as_raw_fd(), statfs.as_mut_ptr()) } != 0 {
+        return true;
+    }
+    let statfs = unsafe { statfs.assume_init() };
+
+    // the type of `f_type` differs between architectures
+    #[allow(clippy::unnecessary_cast)]
+    let fs_type = statfs.f_type as i64;
+    [
+        libc::PROC_SUPER_MAGIC,
+        libc::SYSFS_MAGIC,
+        libc::DEBUGFS_MAGIC,
+        libc::SECURITYFS_MAGIC,
+        libc::CGROUP_SUPER_MAGIC,
+        libc::CGROUP2_SUPER_MAGIC,
+    ]
+    .into_iter()
+    .any(|x| x as i64 == fs_type)
+}
+
+struct Inner {
+    files: HashMap<FileKey, Arc<[u8]>>,
+    num_bytes: u64,
+}
+
+pub struct FileCache {
+    max_bytes: u64,
+    inner: Mutex<Inner>,
+}
+
+impl FileCache {
+    /// A cache that holds up to `max_bytes` of file contents. Files are never evicted, so once the
+    /// cache is full, files that aren't already cached are read from the OS as usual. A
+    /// `max_bytes` of 0 disables the cache.
+    pub fn new(max_bytes: u64) -> Self {
+        Self {
+            max_bytes,
+            inner: Mutex::new(Inner {
+                files: HashMap::new(),
+                num_bytes: 0,
+            }),
+        }
+    }
+
+    fn has_room_for(&self, inner: &Inner, len: u64) -> bool {
+        inner
+            .num_bytes
+            .checked_add(len)
+            .is_some_and(|x| x <= self.max_bytes)
+    }
+
+    /// Get the contents of the regular file `fd`, reading the file if it isn't already cached.
+    /// Returns `None` if `fd` isn't a regular file, the file doesn't fit in the cache, or the file
+    /// couldn't be read. The file's offset isn't changed.
+    pub fn get(&self, fd: BorrowedFd) -> Option<Arc<[u8]>> {
+        if self.max_bytes == 0 {
+            return None;
+        }
+
+        let key = FileKey::new(fd)?;
+
+        {
+            let inner = self.inner.lock().unwrap();
+            if let Some(contents) = inner.files.get(&key) {
+                return Some(Arc::clone(contents));
+            }
+            if !self.has_room_for(&inner, key.size) {
+                return None;
+            }
+        }
+
+        // read the file without holding the lock, since it may be large
+        let len = usize::try_from(key.size).ok()?;
+        let mut contents = vec![0u8; len];
+        // the fd is owned by the caller, so we must not close it
+        let file = ManuallyDrop::new(unsafe { File::from_raw_fd(fd.as_raw_fd()) });
+        file.read_exact_at(&mut contents, 0).ok()?;
+
+        // the file may have been modified while we were reading it
+        if FileKey::new(fd)? != key {
+            return None;
+        }
+
+        let mut inner = self.inner.lock().unwrap();
+        // another thread may have read the same file while we weren't holding the lock
+        if let Some(contents) = inner.files.get(&key) {
+            return Some(Arc::clone(contents));
+        }
+        if !self.has_room_for(&inner, key.size) {
+            return None;
+        }
+
+        let contents: Arc<[u8]> = contents.into();
+        inner.files.insert(key, Arc::clone(&contents));
+        inner.num_bytes += key.size;
+        Some(contents)
+    }
+}
+
+/// The cached contents of a file.
+pub struct CachedFile(Arc<[u8]>);
+
+impl CachedFile {
+    /// Copy the bytes starting at `offset` to `buf`, and return the number of bytes copied.
+    pub fn read_at(&self, buf: &mut [u8], offset: u64) -> usize {
+        let Ok(offset) = usize::try_from(offset) else {
+            return 0;
+        };
+        let Some(remaining) = self.0.get(offset..) else {
+            return 0;
+        };
+        let len = std::cmp::min(remaining.len(), buf.len());
+        buf[..len].copy_from_slice(&remaining[..len]);
+        len
+    }
+
+    pub fn len(&self) -> usize {
+        self.0.len()
+    }
+}
+
+mod export {
+    use super::*;
+    use crate::core::worker::Worker;
+
+    /// Get the cached contents of the read-only regular file `fd`, reading the file into the cache
+    /// if needed. Returns NULL if the file isn't cached. The file must be freed with
+    /// `cachedfile_free`.
+    #[no_mangle]
+    pub extern "C" fn filecache_get(fd: libc::c_int) -> *mut CachedFile {
+        let fd = unsafe { BorrowedFd::borrow_raw(fd) };
+        match Worker::with_file_cache(|cache| cache.get(fd)) {
+            Some(contents) => Box::into_raw(Box::new(CachedFile(contents))),
+            None => std::ptr::null_mut(),
+        }
+    }
+
+    #[no_mangle]
+    pub extern "C" fn cachedfile_free(file: *mut CachedFile) {
+        assert!(!file.is_null());
+        drop(unsafe { Box::from_raw(file) });
+    }
+
+    #[no_mangle]
+    pub extern "C" fn cachedfile_len(file: *const CachedFile) -> libc::size_t {
+        let file = unsafe { file.as_ref().unwrap() };
+        file.len()
+    }
+
+    /// Copy up to `len` bytes starting at `offset` to `buf`. Returns the number of bytes copied,
+    /// which is 0 at or past the end of the file, or `-EINVAL` if `offset` is negative.
+    #[no_mangle]
+    pub extern "C" fn cachedfile_read(
+        file: *const CachedFile,
+        buf: *mut libc::c_void,
+        len: libc::size_t,
+        offset: libc::off_t,
+    ) -> isize {
+        let file = unsafe { file.as_ref().unwrap() };
+        let Ok(offset) = u64::try_from(offset) else {
+            return -(libc::EINVAL as isize);
+        };
+        if len == 0 {
+            return 0;
+        }
+        let buf = unsafe { std::slice::from_raw_parts_mut(buf.cast::<u8>(), len) };
+        file.read_at(buf, offset).try_into().unwrap()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::Write;
+    use std::os::fd::AsFd;
+
+    use super::*;
+
+    #[test]
+    fn test_shared_contents() {
+        let mut file = tempfile::NamedTempFile::new().unwrap();
+        file.write_all(b"hello world").unwrap();
+        let other = File::open(file.path()).unwrap();
+
+        let cache = FileCache::new(1024);
+        let a = cache.get(file.as_file().as_fd()).unwrap();
+        let b = cache.get(other.as_fd()).unwrap();
+        assert_eq!(&*a, b"hello world");
+        assert!(Arc::ptr_eq(&a, &b));
+
+        let cached = CachedFile(a);
+        let mut buf = [0u8; 16];
+        assert_eq!(cached.read_at(&mut buf, 6), 5);
+        assert_eq!(&buf[..5], b"world");
+        assert_eq!(cached.read_at(&mut buf, 11), 0);
+        assert_eq!(cached.read_at(&mut buf, 100), 0);
+    }
+
+    #[test]
+    fn test_modified_file() {
+        let mut file = tempfile::NamedTempFile::new().unwrap();
+        file.write_all(b"hello").unwrap();
+
+        let cache = FileCache::new(1024);
+        let a = cache.get(file.as_file().as_fd()).unwrap();
+
+        file.write_all(b" world").unwrap();
+        let b = cache.get(file.as_file().as_fd()).unwrap();
+        assert_eq!(&*a, b"hello");
+        assert_eq!(&*b, b"hello world");
+    }
+
+    #[test]
+    fn test_limits() {
+        let mut file = tempfile::NamedTempFile::new().unwrap();
+        file.write_all(b"hello world").unwrap();
+
+        assert!(FileCache::new(0).get(file.as_file().as_fd()).is_none());
+        assert!(FileCache::new(10).get(file.as_file().as_fd()).is_none());
+
+        let dir = tempfile::tempdir().unwrap();
+        let dir = File::open(dir.path()).unwrap();
+        assert!(FileCache::new(1024).get(dir.as_fd()).is_none());
+    }
+
+    #[test]
+    fn test_pseudo_files() {
+        let cache = FileCache::new(1 << 20);
+
+        // procfs files report a size of 0, but aren't empty
+        let status = File::open("/proc/self/status").unwrap();
+        assert!(cache.get(status.as_fd()).is_none());
+
+        let empty = tempfile::NamedTempFile::new().unwrap();
+        assert!(cache.get(empty.as_file().as_fd()).is_none());
+    }
+}
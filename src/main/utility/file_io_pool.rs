@@ -0,0 +1,236 @@
+//! A small pool of threads that read and write OS-backed files for managed processes, so that a
+//! slow file operation doesn't stop a worker thread from running its other hosts.
+//!
+//! Each operation works on a duplicate of the file's descriptor, so the managed process closing
+//! the file doesn't affect operations that are still in progress.
+
+use std::os::fd::{AsFd, AsRawFd, BorrowedFd, OwnedFd};
+use std::sync::OnceLock;
+
+use crossbeam::channel::{Receiver, Sender};
+
+/// The number of threads in the pool. File operations are mostly waiting on the disk, so a few
+/// threads are enough to keep several operations in flight.
+const NUM_THREADS: usize = 4;
+
+enum Request {
+    Pread { len: usize, offset: i64 },
+    Pwrite { buf: Vec<u8>, offset: i64 },
+}
+
+/// The result of an operation: the bytes read (empty for writes), and the number of bytes read or
+/// written or a negative errno.
+type Completion = (Vec<u8>, isize);
+
+struct Job {
+    fd: OwnedFd,
+    request: Request,
+    done: Sender<Completion>,
+}
+
+/// A file operation that was submitted to the pool or run immediately.
+pub enum FileIoOp {
+    Done(Completion),
+    Pending(Receiver<Completion>),
+}
+
+impl FileIoOp {
+    /// Read up to `len` bytes at `offset`.
+    pub fn pread(
+        fd: BorrowedFd,
+        len: usize,
+        offset: i64,
+        run_async: bool,
+    ) -> std::io::Result<Self> {
+        Self::new(fd, Request::Pread { len, offset }, run_async)
+    }
+
+    /// Write `buf` at `offset`.
+    pub fn pwrite(
+        fd: BorrowedFd,
+        buf: &[u8],
+        offset: i64,
+        run_async: bool,
+    ) -> std::io::Result<Self> {
+        let buf = buf.to_vec();
+        Self::new(fd, Request::Pwrite { buf, offset }, run_async)
+    }
+
+    fn new(fd: BorrowedFd, request: Request, run_async: bool) -> std::io::Result<Self> {
+        if !run_async {
+            return Ok(Self::Done(run(fd, request)));
+        }
+
+        let (done, receiver) = crossbeam::channel::bounded(1);
+        let job = Job {
+            fd: fd.try_clone_to_owned()?,
+            request,
+            done,
+        };
+        pool_sender().send(job).unwrap();
+        Ok(Self::Pending(receiver))
+    }
+
+    /// Wait for the operation to finish.
+    pub fn wait(self) -> Completion {
+        match self {
+            Self::Done(x) => x,
+            Self::Pending(receiver) => receiver.recv().unwrap(),
+        }
+    }
+}
+
+fn run(fd: BorrowedFd, request: Request) -> Completion {
+    let fd = fd.as_raw_fd();
+    match request {
+        Request::Pread { len, offset } => {
+            let mut buf = vec![0u8; len];
+            let rv = unsafe { libc::pread(fd, buf.as_mut_ptr().cast(), len, offset) };
+            if rv < 0 {
+                return (Vec::new(), neg_errno());
+            }
+            buf.truncate(rv as usize);
+            (buf, rv)
+        }
+        Request::Pwrite { buf, offset } => {
+            let rv = unsafe { libc::pwrite(fd, buf.as_ptr().cast(), buf.len(), offset) };
+            if rv < 0 {
+                return (Vec::new(), neg_errno());
+            }
+            (Vec::new(), rv)
+        }
+    }
+}
+
+fn neg_errno() -> isize {
+    -(std::io::Error::last_os_error().raw_os_error().unwrap() as isize)
+}
+
+/// The pool's threads, started when they're first needed. They exit when the simulation does.
+static POOL: OnceLock<Sender<Job>> = OnceLock::new();
+
+fn pool_sender() -> &'static Sender<Job> {
+    POOL.get_or_init(|| {
+        let (sender, receiver) = crossbeam::channel::unbounded::<Job>();
+        for i in 0..NUM_THREADS {
+            let receiver = receiver.clone();
+            std::thread::Builder::new()
+                .name(format!("file-io-{i}"))
+                .spawn(move || {
+                    for job in receiver {
+                        let completion = run(job.fd.as_fd(), job.request);
+                        // the operation may have been discarded
+                        let _ = job.done.send(completion);
+                    }
+                })
+                .unwrap();
+        }
+        sender
+    })
+}
+
+mod export {
+    use super::*;
+
+    fn to_c(op: std::io::Result<FileIoOp>, op_out: *mut *mut FileIoOp) -> libc::c_int {
+        match op {
+            Ok(op) => {
+                unsafe { op_out.write(Box::into_raw(Box::new(op))) };
+                0
+            }
+            Err(e) => -e.raw_os_error().unwrap(),
+        }
+    }
+
+    /// Start reading up to `len` bytes at `offset` of `fd`. If `run_async` is false, the read
+    /// happens before this returns. Returns 0 and writes the operation to `op_out`, which must be
+    /// finished with `fileio_wait`, or returns a negative errno if the operation couldn't be
+    /// started.
+    #[no_mangle]
+    pub unsafe extern "C" fn fileio_pread(
+        fd: libc::c_int,
+        len: libc::size_t,
+        offset: libc::off_t,
+        run_async: bool,
+        op_out: *mut *mut FileIoOp,
+    ) -> libc::c_int {
+        let fd = unsafe { BorrowedFd::borrow_raw(fd) };
+        to_c(FileIoOp::pread(fd, len, offset, run_async), op_out)
+    }
+
+    /// Start writing `len` bytes of `buf` at `offset` of `fd`. The bytes are copied, so `buf`
+    /// doesn't need to outlive this call. Otherwise the same as `fileio_pread`.
+    #[no_mangle]
+    pub unsafe extern "C" fn fileio_pwrite(
+        fd: libc::c_int,
+        buf: *const libc::c_void,
+        len: libc::size_t,
+        offset: libc::off_t,
+        run_async: bool,
+        op_out: *mut *mut FileIoOp,
+    ) -> libc::c_int {
+        let fd = unsafe { BorrowedFd::borrow_raw(fd) };
+        let buf = if len == 0 {
+            &[]
+        } else {
+            unsafe { std::slice::from_raw_parts(buf.cast::<u8>(), len) }
+        };
+        to_c(FileIoOp::pwrite(fd, buf, offset, run_async), op_out)
+    }
+
+    /// Wait for the operation to finish, and free it. Returns the number of bytes read or written,
+    /// or a negative errno. Up to `buf_len` bytes that were read are copied to `buf`, which may be
+    /// NULL to discard them.
+    #[no_mangle]
+    pub unsafe extern "C" fn fileio_wait(
+        op: *mut FileIoOp,
+        buf: *mut libc::c_void,
+        buf_len: libc::size_t,
+    ) -> isize {
+        assert!(!op.is_null());
+        let op = unsafe { Box::from_raw(op) };
+        let (bytes, rv) = op.wait();
+        if !buf.is_null() {
+            let len = std::cmp::min(bytes.len(), buf_len);
+            unsafe { std::ptr::copy_nonoverlapping(bytes.as_ptr(), buf.cast::<u8>(), len) };
+        }
+        rv
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::{Read, Seek, SeekFrom, Write};
+
+    use super::*;
+
+    #[test]
+    fn test_read_and_write() {
+        let mut file = tempfile::tempfile().unwrap();
+        file.write_all(b"hello world").unwrap();
+
+        for run_async in [false, true] {
+            let op = FileIoOp::pread(file.as_fd(), 5, 6, run_async).unwrap();
+            assert_eq!(op.wait(), (b"world".to_vec(), 5));
+
+            // reading past the end
+            let op = FileIoOp::pread(file.as_fd(), 5, 100, run_async).unwrap();
+            assert_eq!(op.wait(), (Vec::new(), 0));
+
+            let op = FileIoOp::pwrite(file.as_fd(), b"HELLO", 0, run_async).unwrap();
+            assert_eq!(op.wait(), (Vec::new(), 5));
+        }
+
+        let mut contents = String::new();
+        file.seek(SeekFrom::Start(0)).unwrap();
+        file.read_to_string(&mut contents).unwrap();
+        assert_eq!(contents, "HELLO world");
+    }
+
+    #[test]
+    fn test_error() {
+        let file = tempfile::tempfile().unwrap();
+        let op = FileIoOp::pread(file.as_fd(), 5, -1, true).unwrap();
+        assert_eq!(op.wait(), (Vec::new(), -(libc::EINVAL as isize)));
+    }
+}
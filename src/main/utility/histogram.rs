@@ -0,0 +1,140 @@
+use std::time::Duration;
+
+use serde::ser::SerializeMap;
+
+/// The number of buckets in a [`LatencyHistogram`]: one for zero, and one for each bit length of a
+/// `u64`.
+const NUM_BUCKETS: usize = u64::BITS as usize + 1;
+
+/// A histogram of durations, with a bucket for each power of two nanoseconds. Recording a duration
+/// only needs a few instructions, so this can be used on hot paths.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct LatencyHistogram {
+    count: u64,
+    total_ns: u64,
+    // Bucket 0 counts durations of 0 ns, and bucket `i > 0` counts durations in `[2^(i-1), 2^i)`
+    // ns.
+    buckets: [u64; NUM_BUCKETS],
+}
+
+impl LatencyHistogram {
+    pub fn new() -> Self {
+        Self {
+            count: 0,
+            total_ns: 0,
+            buckets: [0; NUM_BUCKETS],
+        }
+    }
+
+    /// Add a duration to the histogram.
+    pub fn record(&mut self, duration: Duration) {
+        let ns = u64::try_from(duration.as_nanos()).unwrap_or(u64::MAX);
+        let bucket = (u64::BITS - ns.leading_zeros()) as usize;
+
+        self.count += 1;
+        self.total_ns = self.total_ns.saturating_add(ns);
+        self.buckets[bucket] += 1;
+    }
+
+    /// Add all durations in `other` to this histogram.
+    pub fn add(&mut self, other: &Self) {
+        self.count += other.count;
+        self.total_ns = self.total_ns.saturating_add(other.total_ns);
+        for (bucket, other_bucket) in self.buckets.iter_mut().zip(other.buckets.iter()) {
+            *bucket += other_bucket;
+        }
+    }
+
+    /// The number of durations that were recorded.
+    pub fn count(&self) -> u64 {
+        self.count
+    }
+}
+
+impl Default for LatencyHistogram {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Serialized as the count and total, and a map from each non-empty bucket's exclusive upper bound
+/// in nanoseconds to its count.
+impl serde::Serialize for LatencyHistogram {
+    fn serialize<S>(&self, serializer: S) -> Result<S::Ok, S::Error>
+    where
+        S: serde::Serializer,
+    {
+        struct Buckets<'a>(&'a [u64; NUM_BUCKETS]);
+
+        impl serde::Serialize for Buckets<'_> {
+            fn serialize<S>(&self, serializer: S) -> Result<S::Ok, S::Error>
+            where
+                S: serde::Serializer,
+            {
+                let non_empty = self.0.iter().enumerate().filter(|(_, x)| **x != 0);
+                let mut map = serializer.serialize_map(Some(non_empty.clone().count()))?;
+                for (i, count) in non_empty {
+                    let upper_bound_ns = 1u128 << i;
+                    map.serialize_entry(&upper_bound_ns.to_string(), count)?;
+                }
+                map.end()
+            }
+        }
+
+        let mut map = serializer.serialize_map(Some(3))?;
+        map.serialize_entry("count", &self.count)?;
+        map.serialize_entry("total_ns", &self.total_ns)?;
+        map.serialize_entry("buckets_lt_ns", &Buckets(&self.buckets))?;
+        map.end()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_buckets() {
+        let mut hist = LatencyHistogram::new();
+        hist.record(Duration::ZERO);
+        hist.record(Duration::from_nanos(1));
+        hist.record(Duration::from_nanos(1000));
+        hist.record(Duration::from_nanos(1023));
+        hist.record(Duration::from_nanos(1024));
+        hist.record(Duration::MAX);
+
+        assert_eq!(hist.count(), 6);
+        assert_eq!(hist.buckets[0], 1);
+        assert_eq!(hist.buckets[1], 1);
+        assert_eq!(hist.buckets[10], 2);
+        assert_eq!(hist.buckets[11], 1);
+        assert_eq!(hist.buckets[64], 1);
+    }
+
+    #[test]
+    fn test_add() {
+        let mut a = LatencyHistogram::new();
+        a.record(Duration::from_nanos(5));
+        let mut b = LatencyHistogram::new();
+        b.record(Duration::from_nanos(6));
+        b.record(Duration::from_nanos(100));
+
+        a.add(&b);
+        assert_eq!(a.count(), 3);
+        assert_eq!(a.total_ns, 111);
+        assert_eq!(a.buckets[3], 2);
+        assert_eq!(a.buckets[7], 1);
+    }
+
+    #[test]
+    fn test_serialize() {
+        let mut hist = LatencyHistogram::new();
+        hist.record(Duration::from_nanos(3));
+        hist.record(Duration::from_nanos(2));
+
+        assert_eq!(
+            serde_json::to_string(&hist).unwrap(),
+            r#"{"count":2,"total_ns":5,"buckets_lt_ns":{"4":2}}"#
+        );
+    }
+}
@@ -0,0 +1,88 @@
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd};
+
+use nix::errno::Errno;
+
+// From linux/perf_event.h. Neither `libc` nor `linux_api` provide these yet.
+const PERF_TYPE_HARDWARE: u32 = 0;
+const PERF_COUNT_HW_INSTRUCTIONS: u64 = 1;
+const PERF_FLAG_FD_CLOEXEC: libc::c_ulong = 1 << 3;
+const PERF_ATTR_FLAG_EXCLUDE_KERNEL: u64 = 1 << 5;
+const PERF_ATTR_FLAG_EXCLUDE_HV: u64 = 1 << 6;
+
+/// The first (`PERF_ATTR_SIZE_VER0`) version of `struct perf_event_attr`. The
+/// kernel zero-extends older versions of the struct, so we don't need any of
+/// the newer fields.
+#[repr(C)]
+#[derive(Default)]
+struct PerfEventAttrVer0 {
+    type_: u32,
+    size: u32,
+    config: u64,
+    sample_period: u64,
+    sample_type: u64,
+    read_format: u64,
+    flags: u64,
+    wakeup_events: u32,
+    bp_type: u32,
+    config1: u64,
+}
+
+static_assertions::assert_eq_size!(PerfEventAttrVer0, [u8; 64]);
+
+/// Counts the user-space instructions retired by a native thread, using a
+/// hardware performance counter.
+pub struct InstructionCounter {
+    fd: OwnedFd,
+    last_count: u64,
+}
+
+impl InstructionCounter {
+    /// Start counting the instructions of the native thread `tid`, which may
+    /// be a thread of another process.
+    pub fn new(tid: nix::unistd::Pid) -> Result<Self, Errno> {
+        let attr = PerfEventAttrVer0 {
+            type_: PERF_TYPE_HARDWARE,
+            size: std::mem::size_of::<PerfEventAttrVer0>() as u32,
+            config: PERF_COUNT_HW_INSTRUCTIONS,
+            flags: PERF_ATTR_FLAG_EXCLUDE_KERNEL | PERF_ATTR_FLAG_EXCLUDE_HV,
+            ..Default::default()
+        };
+
+        // count on any cpu that `tid` runs on
+        let cpu: libc::c_int = -1;
+        let group_fd: libc::c_int = -1;
+
+        let fd = Errno::result(unsafe {
+            libc::syscall(
+                libc::SYS_perf_event_open,
+                &attr as *const PerfEventAttrVer0,
+                tid.as_raw(),
+                cpu,
+                group_fd,
+                PERF_FLAG_FD_CLOEXEC,
+            )
+        })?;
+        let fd = unsafe { OwnedFd::from_raw_fd(fd.try_into().unwrap()) };
+
+        Ok(Self { fd, last_count: 0 })
+    }
+
+    /// The number of instructions retired since the previous call (or since
+    /// the counter was created).
+    pub fn take(&mut self) -> u64 {
+        let mut count: u64 = 0;
+        let rv = unsafe {
+            libc::read(
+                self.fd.as_raw_fd(),
+                &mut count as *mut u64 as *mut libc::c_void,
+                std::mem::size_of::<u64>(),
+            )
+        };
+        // a counter for a thread that has exited can still be read
+        assert_eq!(rv, std::mem::size_of::<u64>() as isize);
+
+        let delta = count.saturating_sub(self.last_count);
+        self.last_count = count;
+        delta
+    }
+}
@@ -1,3 +1,4 @@
+use std::collections::{btree_map, BTreeMap};
 use std::ops::Range;
 
 pub type Interval = Range<usize>;
@@ -43,81 +44,80 @@ pub enum Mutation<V> {
 }
 
 pub struct ItemIter<'a, V> {
-    map: &'a IntervalMap<V>,
-    i: usize,
+    inner: btree_map::Range<'a, usize, (usize, V)>,
 }
 
 impl<'a, V> Iterator for ItemIter<'a, V> {
     type Item = (Interval, &'a V);
 
     fn next(&mut self) -> Option<Self::Item> {
-        let i = self.i;
-        let m = self.map;
-        if i >= m.starts.len() {
-            return None;
-        }
-        let rv = Some(((m.starts[i]..m.ends[i]), &m.vals[i]));
-        self.i += 1;
-        rv
+        self.inner
+            .next()
+            .map(|(start, (end, val))| (*start..*end, val))
     }
 }
 
 pub struct KeyIter<'a, V> {
-    map: &'a IntervalMap<V>,
-    i: usize,
+    inner: btree_map::Range<'a, usize, (usize, V)>,
 }
 
 impl<'a, V> Iterator for KeyIter<'a, V> {
     type Item = Interval;
 
     fn next(&mut self) -> Option<Self::Item> {
-        let i = self.i;
-        let m = self.map;
-        if i >= m.starts.len() {
-            return None;
-        }
-        let rv = Some(m.starts[i]..m.ends[i]);
-        self.i += 1;
-        rv
+        self.inner.next().map(|(start, (end, _))| *start..*end)
     }
 }
 
+/// Maps from non-overlapping `Interval`s to `V`. The intervals are stored in a B-tree keyed by
+/// their start, so lookups take O(log n) time and splicing an interval that overlaps k existing
+/// intervals takes O(log n + k) time.
 #[derive(Clone, Debug)]
 pub struct IntervalMap<V> {
-    starts: Vec<usize>,
-    ends: Vec<usize>,
-    vals: Vec<V>,
+    /// Maps the start of each interval to its end and value.
+    map: BTreeMap<usize, (usize, V)>,
 }
 
-/// Maps from non-overlapping `Interval`s to `V`.
 impl<V: Clone> IntervalMap<V> {
     pub fn new() -> IntervalMap<V> {
         IntervalMap {
-            starts: Vec::new(),
-            ends: Vec::new(),
-            vals: Vec::new(),
+            map: BTreeMap::new(),
         }
     }
 
+    /// The number of intervals in the map.
+    pub fn len(&self) -> usize {
+        self.map.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.map.is_empty()
+    }
+
     /// Returns iterator over all intervals keys, in sorted order.
     pub fn keys(&self) -> KeyIter<V> {
-        KeyIter { map: self, i: 0 }
+        KeyIter {
+            inner: self.map.range(..),
+        }
     }
 
     /// Returns iterator over all intervals keys and their values, in order by interval key.
     pub fn iter(&self) -> ItemIter<V> {
-        ItemIter { map: self, i: 0 }
+        ItemIter {
+            inner: self.map.range(..),
+        }
     }
 
     /// Returns iterator over all interval keys and their values, starting with the first interval
     /// containing or after `begin`.
     pub fn iter_from(&self, begin: usize) -> ItemIter<V> {
-        let idx = match self.starts.binary_search(&begin) {
-            Ok(i) => i,
-            Err(i) if (i > 0 && begin < self.ends[i - 1]) => i - 1,
-            Err(i) => i,
+        let start = match self.get(begin) {
+            Some((interval, _)) => interval.start,
+            None => begin,
         };
-        ItemIter { map: self, i: idx }
+        ItemIter {
+            inner: self.map.range(start..),
+        }
     }
 
     /// Mutates the map so that the given range maps to nothing, modifying and removing intervals
@@ -147,39 +147,26 @@ impl<V: Clone> IntervalMap<V> {
         // List of mutations we had to perform to do the splice, which we'll ultimately return.
         let mut mutations = Vec::new();
 
-        // Vectors that we'll ultimately splice insto self.{starts,ends,vals}.
-        let mut starts_insertions = Vec::new();
-        let mut ends_insertions = Vec::new();
-        let mut vals_insertions = Vec::new();
-
-        // We'll splice in the provided value, if any.
-        if let Some(v) = val {
-            starts_insertions.push(start);
-            ends_insertions.push(end);
-            vals_insertions.push(v);
-        };
-
-        // We're eventually going to call Vec::splice on our vectors, and
-        // this will be the starting index.
-        let splice_start = match self.starts.binary_search(&start) {
-            Ok(i) | Err(i) => i,
-        };
-
-        // Check whether there's an interval before the splice point,
-        // and if so whether it overlaps.
-        if splice_start > 0 && self.ends[splice_start - 1] > start {
-            let overlapping_idx = splice_start - 1;
-            let overlapping_int = self.starts[overlapping_idx]..self.ends[overlapping_idx];
+        // Check whether there's an interval before the splice point, and if so whether it
+        // overlaps.
+        let overlapping_before = self
+            .map
+            .range(..start)
+            .next_back()
+            .map(|(b, (e, _))| *b..*e)
+            .filter(|x| x.end > start);
+
+        if let Some(overlapping_int) = overlapping_before {
+            let (overlapping_end, overlapping_val) =
+                self.map.get_mut(&overlapping_int.start).unwrap();
+            // Truncate the existing interval.
+            *overlapping_end = start;
 
             if overlapping_int.end <= end {
                 // overlapping_int :   -----
                 // - (start, end)  :      -----
                 //           --->  :   ---
-                self.ends[overlapping_idx] = start;
-                mutations.push(Mutation::ModifiedEnd(
-                    overlapping_int,
-                    self.ends[overlapping_idx],
-                ));
+                mutations.push(Mutation::ModifiedEnd(overlapping_int, start));
             } else {
                 // If it ends after the end of our interval, we need to split it.
                 // overlapping_int : ----------
@@ -188,97 +175,58 @@ impl<V: Clone> IntervalMap<V> {
                 let new1 = overlapping_int.start..start;
                 let new2 = end..overlapping_int.end;
 
-                // Truncate the existing interval.
-                self.ends[overlapping_idx] = new1.end;
-
-                // Create a new interval, starting after the insertion interval.
-                starts_insertions.push(new2.start);
-                ends_insertions.push(new2.end);
-                vals_insertions.push(self.vals[overlapping_idx].clone());
+                // Create a new interval, starting after the splice interval.
+                let val = overlapping_val.clone();
+                self.map.insert(new2.start, (new2.end, val));
                 mutations.push(Mutation::Split(overlapping_int, new1, new2));
             }
         }
 
-        // Find the end of the splice interval, which is the index of the first interval that ends
-        // after the splice end (after having clipped the end of any existing interval contained in
-        // the range, above).
-        let splice_end = match self.ends.binary_search(&end) {
-            Ok(i) => i + 1,
-            Err(i) => i,
-        };
-
-        // Check whether we need to clip the startning of splice_end's interval.
-        let mut modified_start: Option<Mutation<V>> = None;
-        if splice_end < self.starts.len()
-            && self.starts[splice_end] < end
-            && self.ends[splice_end] > end
-        {
-            let overlapping_idx = splice_end;
-            let overlapping_int = self.starts[overlapping_idx]..self.ends[overlapping_idx];
-            // overlapping_int :   ------
-            // - (start, end)  : -----
-            //           --->  :      ---
-            self.starts[overlapping_idx] = end;
-            // We don't push this onto `mutations` yet because we want to keep it sorted, and this
-            // will always be the last mutation.
-            modified_start = Some(Mutation::ModifiedBegin(
-                overlapping_int,
-                self.starts[overlapping_idx],
-            ));
-        }
-
-        // Do the splice into each parallel vector, tracking intervals that are dropped completely.
+        // Remove the intervals that start within the splice interval. Only the last of them can
+        // end after the splice end, in which case its start is clipped instead.
         // dropped         :   --- --- --- --- --- ----
         // - (start, end)  : ----------------------------
         //           --->  :
-        let dropped_starts = self
-            .starts
-            .splice(splice_start..splice_end, starts_insertions);
-        let dropped_ends = self.ends.splice(splice_start..splice_end, ends_insertions);
-        let mut dropped_vals = self.vals.splice(splice_start..splice_end, vals_insertions);
-        for (dropped_start, dropped_end) in dropped_starts.zip(dropped_ends) {
-            mutations.push(Mutation::Removed(
-                dropped_start..dropped_end,
-                dropped_vals.next().unwrap(),
-            ));
+        let contained: Vec<usize> = self.map.range(start..end).map(|(b, _)| *b).collect();
+        for overlapping_start in contained {
+            let (overlapping_end, overlapping_val) = self.map.remove(&overlapping_start).unwrap();
+            let overlapping_int = overlapping_start..overlapping_end;
+
+            if overlapping_end <= end {
+                mutations.push(Mutation::Removed(overlapping_int, overlapping_val));
+            } else {
+                // overlapping_int :   ------
+                // - (start, end)  : -----
+                //           --->  :      ---
+                self.map.insert(end, (overlapping_end, overlapping_val));
+                mutations.push(Mutation::ModifiedBegin(overlapping_int, end));
+            }
         }
 
-        // Do the modified startning, if any, last, so that mutations are ordered.
-        if let Some(m) = modified_start {
-            mutations.push(m)
+        // We'll splice in the provided value, if any.
+        if let Some(v) = val {
+            self.map.insert(start, (end, v));
         }
 
         mutations
     }
 
-    // Returns the index of the interval containing `x`.
-    fn get_index(&self, x: usize) -> Option<usize> {
-        match self.starts.binary_search(&x) {
-            Ok(i) => Some(i),
-            Err(i) => {
-                if i == 0 {
-                    None
-                } else if x < self.ends[i - 1] {
-                    Some(i - 1)
-                } else {
-                    None
-                }
-            }
-        }
-    }
-
     // Returns the entry of the interval containing `x`.
     pub fn get(&self, x: usize) -> Option<(Interval, &V)> {
-        self.get_index(x)
-            .map(|i| (self.starts[i]..self.ends[i], &self.vals[i]))
+        self.map
+            .range(..=x)
+            .next_back()
+            .filter(|(_, (end, _))| x < *end)
+            .map(|(start, (end, val))| (*start..*end, val))
     }
 
     // Returns the entry of the interval containing `x`.
     pub fn get_mut(&mut self, x: usize) -> Option<(Interval, &mut V)> {
-        match self.get_index(x) {
-            None => None,
-            Some(i) => Some((self.starts[i]..self.ends[i], &mut self.vals[i])),
-        }
+        self.map
+            .range_mut(..=x)
+            .next_back()
+            .filter(|(_, (end, _))| x < *end)
+            .map(|(start, (end, val))| (*start..*end, val))
     }
 }
 
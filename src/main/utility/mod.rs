@@ -8,9 +8,14 @@ pub mod byte_queue;
 pub mod callback_queue;
 pub mod childpid_watcher;
 pub mod counter;
+pub mod file_cache;
+pub mod file_io_pool;
 pub mod give;
+pub mod histogram;
+pub mod instruction_counter;
 pub mod interval_map;
 pub mod legacy_callback_queue;
+pub mod numa;
 pub mod pcap_writer;
 pub mod perf_timer;
 pub mod proc_maps;
@@ -20,10 +25,10 @@ pub mod status_bar;
 pub mod stream_len;
 pub mod synchronization;
 pub mod syscall;
+pub mod template_copy;
 
 use std::ffi::CString;
 use std::marker::PhantomData;
-use std::os::unix::fs::{DirBuilderExt, MetadataExt};
 use std::os::unix::prelude::OsStrExt;
 use std::path::{Path, PathBuf};
 
@@ -236,57 +241,6 @@ pub fn tilde_expansion(path: &str) -> std::path::PathBuf {
     std::path::PathBuf::from(path)
 }
 
-/// Copy the contents of the `src` directory to a new directory named `dst`. Permissions will be
-/// preserved.
-pub fn copy_dir_all(src: impl AsRef<Path>, dst: impl AsRef<Path>) -> std::io::Result<()> {
-    // a directory to copy
-    struct DirCopyTask {
-        src: PathBuf,
-        dst: PathBuf,
-        mode: u32,
-    }
-
-    // a stack of directories to copy
-    let mut stack: Vec<DirCopyTask> = vec![];
-
-    stack.push(DirCopyTask {
-        src: src.as_ref().to_path_buf(),
-        dst: dst.as_ref().to_path_buf(),
-        mode: src.as_ref().metadata()?.mode(),
-    });
-
-    while let Some(DirCopyTask { src, dst, mode }) = stack.pop() {
-        // create the directory with the same permissions
-        create_dir_with_mode(&dst, mode)?;
-
-        // copy directory contents
-        for entry in std::fs::read_dir(src)? {
-            let entry = entry?;
-            let meta = entry.metadata()?;
-            let new_dst_path = dst.join(entry.file_name());
-
-            if meta.is_dir() {
-                stack.push(DirCopyTask {
-                    src: entry.path(),
-                    dst: new_dst_path,
-                    mode: meta.mode(),
-                });
-            } else {
-                // copy() will also copy the permissions
-                std::fs::copy(entry.path(), &new_dst_path)?;
-            }
-        }
-    }
-
-    Ok(())
-}
-
-fn create_dir_with_mode(path: impl AsRef<Path>, mode: u32) -> std::io::Result<()> {
-    let mut dir_builder = std::fs::DirBuilder::new();
-    dir_builder.mode(mode);
-    dir_builder.create(&path)
-}
-
 /// Helper for converting a PathBuf to a CString
 pub fn pathbuf_to_nul_term_cstring(buf: PathBuf) -> CString {
     let mut bytes = buf.as_os_str().to_os_string().as_bytes().to_vec();
@@ -0,0 +1,156 @@
+//! Helpers for placing memory on NUMA nodes.
+
+use std::collections::BTreeSet;
+
+/// `MPOL_MF_MOVE` from "linux/mempolicy.h": move pages that are only mapped by this process.
+const MPOL_MF_MOVE: libc::c_int = 1 << 1;
+
+/// The NUMA node of the CPU that the calling thread is running on.
+pub fn current_node() -> Option<u32> {
+    let mut cpu: libc::c_uint = 0;
+    let mut node: libc::c_uint = 0;
+    let rv = unsafe {
+        libc::syscall(
+            libc::SYS_getcpu,
+            &mut cpu as *mut libc::c_uint,
+            &mut node as *mut libc::c_uint,
+            std::ptr::null_mut::<libc::c_void>(),
+        )
+    };
+    (rv == 0).then_some(node)
+}
+
+/// The results of moving pages to a NUMA node.
+#[derive(Copy, Clone, Debug, Default, PartialEq, Eq)]
+pub struct PageMoveStats {
+    /// Pages that were moved to the node.
+    pub moved: u64,
+    /// Pages that were already on the node.
+    pub local: u64,
+    /// Pages that couldn't be moved, for example because they're shared with another process or
+    /// haven't been touched yet.
+    pub failed: u64,
+}
+
+/// Move the pages containing the memory ranges `(start, len)` to `node`. Pages that are already on
+/// the node aren't moved. The memory must be mapped for the duration of the call.
+pub fn move_to_node(ranges: &[(*const u8, usize)], node: u32) -> PageMoveStats {
+    let page_size = nix::unistd::sysconf(nix::unistd::SysconfVar::PAGE_SIZE)
+        .unwrap()
+        .unwrap() as usize;
+
+    let pages: BTreeSet<usize> = ranges
+        .iter()
+        .filter(|(_, len)| *len > 0)
+        .flat_map(|(start, len)| {
+            let first = *start as usize / page_size;
+            let last = (*start as usize + len - 1) / page_size;
+            (first..=last).map(|x| x * page_size)
+        })
+        .collect();
+    let pages: Vec<*mut libc::c_void> = pages.into_iter().map(|x| x as *mut _).collect();
+
+    let mut stats = PageMoveStats::default();
+    if pages.is_empty() {
+        return stats;
+    }
+
+    // find the node of each page
+    let mut status = vec![0 as libc::c_int; pages.len()];
+    if move_pages(&pages, None, &mut status).is_err() {
+        stats.failed = pages.len() as u64;
+        return stats;
+    }
+
+    let mut to_move = Vec::new();
+    for (page, page_node) in pages.iter().zip(&status) {
+        match u32::try_from(*page_node) {
+            Ok(x) if x == node => stats.local += 1,
+            Ok(_) => to_move.push(*page),
+            // a negative errno, for example if the page isn't present
+            Err(_) => stats.failed += 1,
+        }
+    }
+
+    if to_move.is_empty() {
+        return stats;
+    }
+
+    let nodes = vec![node as libc::c_int; to_move.len()];
+    let mut status = vec![0 as libc::c_int; to_move.len()];
+    if move_pages(&to_move, Some(&nodes), &mut status).is_err() {
+        stats.failed += to_move.len() as u64;
+        return stats;
+    }
+
+    for page_node in status {
+        if u32::try_from(page_node) == Ok(node) {
+            stats.moved += 1;
+        } else {
+            stats.failed += 1;
+        }
+    }
+
+    stats
+}
+
+/// A wrapper for `move_pages(2)` on the calling process. If `nodes` is `None`, the node of each
+/// page is written to `status` without moving the pages.
+fn move_pages(
+    pages: &[*mut libc::c_void],
+    nodes: Option<&[libc::c_int]>,
+    status: &mut [libc::c_int],
+) -> std::io::Result<()> {
+    assert_eq!(pages.len(), status.len());
+    if let Some(nodes) = nodes {
+        assert_eq!(pages.len(), nodes.len());
+    }
+
+    let rv = unsafe {
+        libc::syscall(
+            libc::SYS_move_pages,
+            0 as libc::pid_t,
+            pages.len() as libc::c_ulong,
+            pages.as_ptr(),
+            nodes.map_or(std::ptr::null(), |x| x.as_ptr()),
+            status.as_mut_ptr(),
+            MPOL_MF_MOVE,
+        )
+    };
+
+    // a positive return value is the number of pages that couldn't be moved, which are also
+    // reported in `status`
+    if rv < 0 {
+        return Err(std::io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_move_to_current_node() {
+        let Some(node) = current_node() else {
+            // getcpu() may not be available in some sandboxes
+            return;
+        };
+
+        // touch each page so that it's present
+        let buf = vec![1u8; 3 * 4096];
+        let stats = move_to_node(&[(buf.as_ptr(), buf.len())], node);
+
+        // the buffer spans at most 4 pages, depending on the page size and its alignment
+        let total = stats.moved + stats.local + stats.failed;
+        assert!((1..=4).contains(&total), "{stats:?}");
+    }
+
+    #[test]
+    fn test_empty() {
+        assert_eq!(
+            move_to_node(&[(std::ptr::null(), 0)], 0),
+            PageMoveStats::default()
+        );
+    }
+}
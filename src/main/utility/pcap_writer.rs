@@ -1,11 +1,50 @@
-use std::io::{Seek, SeekFrom, Write};
+use std::collections::HashSet;
+use std::fs::File;
+use std::io::{Cursor, Seek, SeekFrom, Write};
+use std::num::NonZeroU32;
+use std::sync::{Arc, Mutex};
 
 use crate::cshadow as c;
 use crate::utility::give::Give;
 
+/// Which packets a pcap file should capture.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct PcapFilter {
+    /// Capture only one of every `sample_interval` packets that match the other filters.
+    pub sample_interval: NonZeroU32,
+    /// Capture only TCP packets with the SYN, FIN, or RST flag.
+    pub control_only: bool,
+    /// Capture only packets to or from these ports, or all packets if empty.
+    pub ports: HashSet<u16>,
+}
+
+impl PcapFilter {
+    /// Returns true if a packet with these properties passes the filter, ignoring sampling.
+    fn matches(&self, src_port: u16, dst_port: u16, is_control: bool) -> bool {
+        if self.control_only && !is_control {
+            return false;
+        }
+
+        self.ports.is_empty() || self.ports.contains(&src_port) || self.ports.contains(&dst_port)
+    }
+}
+
+impl Default for PcapFilter {
+    fn default() -> Self {
+        Self {
+            sample_interval: NonZeroU32::new(1).unwrap(),
+            control_only: false,
+            ports: HashSet::new(),
+        }
+    }
+}
+
 pub struct PcapWriter<W: Write> {
     writer: W,
     capture_len: u32,
+    filter: PcapFilter,
+    /// The number of packets that have matched the filter, used for sampling.
+    num_matched: u64,
 }
 
 impl<W: Write> PcapWriter<W> {
@@ -15,6 +54,8 @@ impl<W: Write> PcapWriter<W> {
         let mut rv = PcapWriter {
             writer,
             capture_len,
+            filter: PcapFilter::default(),
+            num_matched: 0,
         };
 
         rv.write_header()?;
@@ -22,6 +63,25 @@ impl<W: Write> PcapWriter<W> {
         Ok(rv)
     }
 
+    /// Only capture packets that pass `filter`. Packets are captured by default.
+    pub fn with_filter(mut self, filter: PcapFilter) -> Self {
+        self.filter = filter;
+        self
+    }
+
+    /// Returns true if a packet with these properties should be written. This must be called
+    /// exactly once for each packet, since it updates the sampling state.
+    pub fn should_capture(&mut self, src_port: u16, dst_port: u16, is_control: bool) -> bool {
+        if !self.filter.matches(src_port, dst_port, is_control) {
+            return false;
+        }
+
+        // capture the first matching packet, then every `sample_interval`th after it
+        let sample = self.num_matched % u64::from(self.filter.sample_interval.get()) == 0;
+        self.num_matched += 1;
+        sample
+    }
+
     fn write_header(&mut self) -> std::io::Result<()> {
         // magic number to show endianness
         const MAGIC_NUMBER: u32 = 0xA1B2C3D4;
@@ -142,26 +202,154 @@ impl<W: Write + Seek> PcapWriter<W> {
     }
 }
 
+/// Buffered data is handed to the background thread once at least this many bytes are buffered.
+const BACKGROUND_WRITE_SIZE: usize = 64 * 1024;
+
+/// A file writer that buffers data in memory and hands full buffers to a background thread to be
+/// written, so that the caller never blocks on disk I/O. Seeking is only supported within data
+/// that hasn't been handed to the background thread yet, so a pcap record must be completed before
+/// calling `end_record()`.
+pub struct BackgroundFileWriter {
+    file: Arc<File>,
+    buf: Cursor<Vec<u8>>,
+    /// The number of bytes that have been handed to the background thread.
+    sent_len: u64,
+}
+
+impl BackgroundFileWriter {
+    pub fn new(file: File) -> Self {
+        Self {
+            file: Arc::new(file),
+            buf: Cursor::new(Vec::with_capacity(BACKGROUND_WRITE_SIZE)),
+            sent_len: 0,
+        }
+    }
+
+    /// Mark the end of a record. If enough data has been buffered, it's handed to the background
+    /// thread.
+    pub fn end_record(&mut self) {
+        if self.buf.get_ref().len() >= BACKGROUND_WRITE_SIZE {
+            self.send();
+        }
+    }
+
+    fn send(&mut self) {
+        debug_assert_eq!(self.buf.position(), self.buf.get_ref().len() as u64);
+
+        let buf = std::mem::replace(
+            &mut self.buf,
+            Cursor::new(Vec::with_capacity(BACKGROUND_WRITE_SIZE)),
+        )
+        .into_inner();
+
+        if buf.is_empty() {
+            return;
+        }
+
+        self.sent_len += buf.len() as u64;
+        background_sender()
+            .send((Arc::clone(&self.file), buf))
+            .unwrap();
+    }
+}
+
+impl Write for BackgroundFileWriter {
+    fn write(&mut self, buf: &[u8]) -> std::io::Result<usize> {
+        self.buf.write(buf)
+    }
+
+    fn flush(&mut self) -> std::io::Result<()> {
+        self.send();
+        Ok(())
+    }
+}
+
+impl Seek for BackgroundFileWriter {
+    fn seek(&mut self, pos: SeekFrom) -> std::io::Result<u64> {
+        let pos = match pos {
+            SeekFrom::Start(pos) => SeekFrom::Start(
+                pos.checked_sub(self.sent_len)
+                    .ok_or(std::io::ErrorKind::Unsupported)?,
+            ),
+            pos => pos,
+        };
+        Ok(self.sent_len + self.buf.seek(pos)?)
+    }
+}
+
+impl Drop for BackgroundFileWriter {
+    fn drop(&mut self) {
+        // move the position to the end in case a record was only partially written
+        self.buf.seek(SeekFrom::End(0)).unwrap();
+        self.send();
+    }
+}
+
+type BackgroundWrite = (Arc<File>, Vec<u8>);
+
+struct BackgroundThread {
+    sender: crossbeam::channel::Sender<BackgroundWrite>,
+    handle: std::thread::JoinHandle<()>,
+}
+
+/// The thread that writes all `BackgroundFileWriter` data, started when it's first needed.
+static BACKGROUND_THREAD: Mutex<Option<BackgroundThread>> = Mutex::new(None);
+
+fn background_sender() -> crossbeam::channel::Sender<BackgroundWrite> {
+    let mut thread = BACKGROUND_THREAD.lock().unwrap();
+    let thread = thread.get_or_insert_with(|| {
+        let (sender, receiver) = crossbeam::channel::unbounded::<BackgroundWrite>();
+        let handle = std::thread::Builder::new()
+            .name("pcap-writer".into())
+            .spawn(move || {
+                // writes to each file are received in order, and the file is closed when the last
+                // reference to it is dropped
+                for (file, buf) in receiver {
+                    if let Err(e) = (&*file).write_all(&buf) {
+                        log::warn!("Unable to write packets to pcap output: {e}");
+                    }
+                }
+            })
+            .unwrap();
+        BackgroundThread { sender, handle }
+    });
+    thread.sender.clone()
+}
+
+/// Wait for the background thread to finish writing all data from `BackgroundFileWriter`s. Any
+/// writers that still exist will keep the thread running, so this should be called after all
+/// writers have been dropped.
+pub fn wait_for_background_writes() {
+    let Some(thread) = BACKGROUND_THREAD.lock().unwrap().take() else {
+        return;
+    };
+
+    // the thread will exit once all senders have been dropped
+    drop(thread.sender);
+    thread.handle.join().unwrap();
+}
+
 pub trait PacketDisplay {
-    /// Write the packet bytes.
-    fn display_bytes(&self, writer: impl Write) -> std::io::Result<()>;
+    /// Write the packet bytes. Implementations should avoid preparing bytes beyond the writer's
+    /// limit, since they'd be discarded.
+    fn display_bytes<W: Write>(&self, writer: &mut Give<W>) -> std::io::Result<()>;
 }
 
 mod export {
     use std::ffi::{CStr, OsStr};
-    use std::fs::File;
-    use std::io::BufWriter;
     use std::os::unix::ffi::OsStrExt;
 
     use super::*;
 
     /// A new packet capture writer. Each packet (header and payload) captured will be truncated to
-    /// a length `capture_len`.
+    /// a length `capture_len`. Only packets that pass `filter` will be captured, or all packets if
+    /// `filter` is NULL.
     #[no_mangle]
     pub extern "C" fn pcapwriter_new(
         path: *const libc::c_char,
         capture_len: u32,
-    ) -> *mut PcapWriter<BufWriter<File>> {
+        filter: *const PcapFilter,
+    ) -> *mut PcapWriter<BackgroundFileWriter> {
         assert!(!path.is_null());
         let path = OsStr::from_bytes(unsafe { CStr::from_ptr(path) }.to_bytes());
 
@@ -172,12 +360,17 @@ mod export {
                 return std::ptr::null_mut();
             }
         };
-        let file = BufWriter::new(file);
-        Box::into_raw(Box::new(PcapWriter::new(file, capture_len).unwrap()))
+        let file = BackgroundFileWriter::new(file);
+        let filter = unsafe { filter.as_ref() }.cloned().unwrap_or_default();
+        Box::into_raw(Box::new(
+            PcapWriter::new(file, capture_len)
+                .unwrap()
+                .with_filter(filter),
+        ))
     }
 
     #[no_mangle]
-    pub extern "C" fn pcapwriter_free(pcap: *mut PcapWriter<BufWriter<File>>) {
+    pub extern "C" fn pcapwriter_free(pcap: *mut PcapWriter<BackgroundFileWriter>) {
         if pcap.is_null() {
             return;
         }
@@ -185,10 +378,10 @@ mod export {
     }
 
     /// If there's an error, returns 1. Otherwise returns 0. If there's an error, the pcap file is
-    /// likely to be corrupt.
+    /// likely to be corrupt. The packet is written to the file later by a background thread.
     #[no_mangle]
     pub extern "C" fn pcapwriter_writePacket(
-        pcap: *mut PcapWriter<BufWriter<File>>,
+        pcap: *mut PcapWriter<BackgroundFileWriter>,
         ts_sec: u32,
         ts_usec: u32,
         packet: *const c::Packet,
@@ -198,6 +391,21 @@ mod export {
 
         let pcap = unsafe { pcap.as_mut() }.unwrap();
 
+        let src_port = u16::from_be(unsafe { c::packet_getSourcePort(packet) });
+        let dst_port = u16::from_be(unsafe { c::packet_getDestinationPort(packet) });
+        let is_control = unsafe { c::packet_getProtocol(packet) } == c::_ProtocolType_PTCP && {
+            let flags = unsafe { (*c::packet_getTCPHeader(packet)).flags };
+            flags
+                & (c::ProtocolTCPFlags_PTCP_SYN
+                    | c::ProtocolTCPFlags_PTCP_FIN
+                    | c::ProtocolTCPFlags_PTCP_RST)
+                != 0
+        };
+
+        if !pcap.should_capture(src_port, dst_port, is_control) {
+            return 0;
+        }
+
         let packet_len: u32 = u32::try_from(unsafe { c::packet_getTotalSize(packet) }).unwrap();
 
         if let Err(e) = pcap.write_packet_fmt(ts_sec, ts_usec, packet_len, |writer| {
@@ -207,6 +415,8 @@ mod export {
             return 1;
         }
 
+        pcap.writer.end_record();
+
         0
     }
 }
@@ -290,4 +500,60 @@ mod tests {
             .concat()
         );
     }
+
+    #[test]
+    fn test_background_file_writer() {
+        let file = tempfile::NamedTempFile::new().unwrap();
+
+        let mut expected = Cursor::new(vec![]);
+        let mut expected_pcap = PcapWriter::new(&mut expected, 100).unwrap();
+
+        let mut pcap =
+            PcapWriter::new(BackgroundFileWriter::new(file.reopen().unwrap()), 100).unwrap();
+
+        // enough packets that some are handed to the background thread before the writer is
+        // dropped
+        let packet = [0xAB; 200];
+        for i in 0..(2 * BACKGROUND_WRITE_SIZE / 100) {
+            let i = i as u32;
+            expected_pcap
+                .write_packet_fmt(i, i, 200, |writer| writer.write_all(&packet))
+                .unwrap();
+            pcap.write_packet_fmt(i, i, 200, |writer| writer.write_all(&packet))
+                .unwrap();
+            pcap.writer.end_record();
+        }
+
+        drop(pcap);
+        wait_for_background_writes();
+
+        assert_eq!(std::fs::read(file.path()).unwrap(), expected.into_inner());
+    }
+
+    #[test]
+    fn test_filter() {
+        let mut pcap = PcapWriter::new(vec![], 65535).unwrap();
+        assert!((0..5).all(|_| pcap.should_capture(1, 2, false)));
+
+        let mut pcap = PcapWriter::new(vec![], 65535)
+            .unwrap()
+            .with_filter(PcapFilter {
+                sample_interval: NonZeroU32::new(3).unwrap(),
+                ..Default::default()
+            });
+        let captured: Vec<_> = (0..7).map(|_| pcap.should_capture(1, 2, false)).collect();
+        assert_eq!(captured, [true, false, false, true, false, false, true]);
+
+        let mut pcap = PcapWriter::new(vec![], 65535)
+            .unwrap()
+            .with_filter(PcapFilter {
+                control_only: true,
+                ports: [80].into(),
+                ..Default::default()
+            });
+        assert!(pcap.should_capture(80, 1000, true));
+        assert!(pcap.should_capture(1000, 80, true));
+        assert!(!pcap.should_capture(1000, 80, false));
+        assert!(!pcap.should_capture(1000, 1001, true));
+    }
 }
@@ -3,9 +3,6 @@ use std::fmt::Display;
 use std::path::PathBuf;
 use std::str::FromStr;
 
-use once_cell::sync::Lazy;
-use regex::Regex;
-
 /// Whether a region of memory is shared.
 #[derive(PartialEq, Eq, Debug, Copy, Clone)]
 pub enum Sharing {
@@ -40,19 +37,23 @@ pub enum MappingPath {
 impl FromStr for MappingPath {
     type Err = Box<dyn Error>;
     fn from_str(s: &str) -> Result<Self, Self::Err> {
-        static SPECIAL_RE: Lazy<Regex> = Lazy::new(|| Regex::new(r"^\[(\S+)\]$").unwrap());
-        static THREAD_STACK_RE: Lazy<Regex> = Lazy::new(|| Regex::new(r"^stack:(\d+)$").unwrap());
-
         if s.starts_with('/') {
             return Ok(MappingPath::Path(PathBuf::from(s)));
         }
-        if let Some(caps) = SPECIAL_RE.captures(s) {
-            let s = caps.get(1).unwrap().as_str();
-            if let Some(caps) = THREAD_STACK_RE.captures(s) {
+
+        // a non-empty label in square brackets, like "[heap]"
+        let label = s
+            .strip_prefix('[')
+            .and_then(|s| s.strip_suffix(']'))
+            .filter(|s| !s.is_empty() && !s.contains(char::is_whitespace));
+
+        if let Some(s) = label {
+            let thread_id = s
+                .strip_prefix("stack:")
+                .filter(|s| !s.is_empty() && s.bytes().all(|x| x.is_ascii_digit()));
+            if let Some(thread_id) = thread_id {
                 return Ok(MappingPath::ThreadStack(
-                    caps.get(1)
-                        .unwrap()
-                        .as_str()
+                    thread_id
                         .parse::<i32>()
                         .map_err(|e| format!("Parsing thread id: {}", e))?,
                 ));
@@ -100,79 +101,79 @@ where
     }
 }
 
+/// Parses a permission bit, which is either `set` or '-'.
+fn parse_perm_bit(c: char, set: char, name: &str) -> Result<bool, String> {
+    match c {
+        x if x == set => Ok(true),
+        '-' => Ok(false),
+        _ => Err(format!("Couldn't parse {} bit {}", name, c)),
+    }
+}
+
 impl FromStr for Mapping {
     type Err = Box<dyn Error>;
     fn from_str(line: &str) -> Result<Self, Self::Err> {
-        static RE: Lazy<Regex> = Lazy::new(|| {
-            Regex::new(
-                r"^(\S+)-(\S+)\s+(\S)(\S)(\S)(\S)\s+(\S+)\s+(\S+):(\S+)\s+(\S+)\s*(\S*)\s*(\S*)$",
-            )
-            .unwrap()
-        });
-
-        let caps = RE
-            .captures(line)
-            .ok_or_else(|| format!("Didn't match regex: {}", line))?;
+        // This is parsed by splitting on whitespace rather than with a regex, since a process's
+        // maps file may have many thousands of lines. The fields are:
+        // begin-end perms offset major:minor inode [path] [(deleted)]
+        let mut fields = line.split_ascii_whitespace();
+        let mut next_field = |name: &str| {
+            fields
+                .next()
+                .ok_or_else(|| format!("Missing {}: {}", name, line))
+        };
+
+        let (begin, end) = next_field("address range")?
+            .split_once('-')
+            .ok_or_else(|| format!("Couldn't parse address range: {}", line))?;
+
+        let perms = next_field("permissions")?;
+        let perms: Vec<char> = perms.chars().collect();
+        let [read, write, execute, sharing] = perms[..] else {
+            return Err(format!("Couldn't parse permissions: {}", line).into());
+        };
+
+        let offset = next_field("offset")?;
+
+        let (device_major, device_minor) = next_field("device")?
+            .split_once(':')
+            .ok_or_else(|| format!("Couldn't parse device: {}", line))?;
+
+        let inode = next_field("inode")?;
+
+        let path = fields.next();
+        let trailer = fields.next();
+        if let Some(x) = fields.next() {
+            return Err(format!("Unexpected trailing field '{}'", x).into());
+        }
 
         Ok(Mapping {
-            begin: parse_field(caps.get(1).unwrap().as_str(), "begin", |s| {
-                usize::from_str_radix(s, 16)
-            })?,
-            end: parse_field(caps.get(2).unwrap().as_str(), "end", |s| {
-                usize::from_str_radix(s, 16)
-            })?,
-            read: {
-                let s = caps.get(3).unwrap().as_str();
-                match s {
-                    "r" => true,
-                    "-" => false,
-                    _ => return Err(format!("Couldn't parse read bit {}", s).into()),
-                }
-            },
-            write: {
-                let s = caps.get(4).unwrap().as_str();
-                match s {
-                    "w" => true,
-                    "-" => false,
-                    _ => return Err(format!("Couldn't parse write bit {}", s).into()),
-                }
-            },
-            execute: {
-                let s = caps.get(5).unwrap().as_str();
-                match s {
-                    "x" => true,
-                    "-" => false,
-                    _ => return Err(format!("Couldn't parse execute bit {}", s).into()),
-                }
-            },
-            sharing: caps.get(6).unwrap().as_str().parse::<Sharing>()?,
-            offset: parse_field(caps.get(7).unwrap().as_str(), "offset", |s| {
-                usize::from_str_radix(s, 16)
-            })?,
-            device_major: parse_field(caps.get(8).unwrap().as_str(), "device_major", |s| {
+            begin: parse_field(begin, "begin", |s| usize::from_str_radix(s, 16))?,
+            end: parse_field(end, "end", |s| usize::from_str_radix(s, 16))?,
+            read: parse_perm_bit(read, 'r', "read")?,
+            write: parse_perm_bit(write, 'w', "write")?,
+            execute: parse_perm_bit(execute, 'x', "execute")?,
+            sharing: sharing.encode_utf8(&mut [0; 4]).parse::<Sharing>()?,
+            offset: parse_field(offset, "offset", |s| usize::from_str_radix(s, 16))?,
+            device_major: parse_field(device_major, "device_major", |s| {
                 i32::from_str_radix(s, 16)
             })?,
-            device_minor: parse_field(caps.get(9).unwrap().as_str(), "device_minor", |s| {
+            device_minor: parse_field(device_minor, "device_minor", |s| {
                 i32::from_str_radix(s, 16)
             })?,
             // Undocumented whether this is actually base 10; change to 16 if we find
             // counter-examples.
-            inode: parse_field(caps.get(10).unwrap().as_str(), "inode", |s| s.parse())?,
-            path: parse_field::<_, _, Box<dyn Error>>(
-                caps.get(11).unwrap().as_str(),
-                "path",
-                |s| match s {
-                    "" => Ok(None),
-                    s => Ok(Some(s.parse::<MappingPath>()?)),
-                },
-            )?,
-            deleted: {
-                let s = caps.get(12).unwrap().as_str();
-                match s {
-                    "" => false,
-                    "(deleted)" => true,
-                    _ => return Err(format!("Couldn't parse trailing field '{}'", s).into()),
-                }
+            inode: parse_field(inode, "inode", |s| s.parse())?,
+            path: match path {
+                None => None,
+                Some(s) => Some(parse_field::<_, _, Box<dyn Error>>(s, "path", |s| {
+                    s.parse::<MappingPath>()
+                })?),
+            },
+            deleted: match trailer {
+                None => false,
+                Some("(deleted)") => true,
+                Some(s) => return Err(format!("Couldn't parse trailing field '{}'", s).into()),
             },
         })
     }
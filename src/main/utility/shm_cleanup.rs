@@ -5,6 +5,9 @@ use std::path::PathBuf;
 use std::str::FromStr;
 
 use anyhow::{self, Context};
+use shadow_shmem::util::SHM_DIR_PREFIX;
+
+use crate::core::live_metrics::LIVE_METRICS_FILE_PREFIX;
 
 pub const SHM_DIR_PATH: &str = "/dev/shm/";
 const PROC_DIR_PATH: &str = "/proc/";
@@ -22,15 +25,20 @@ fn get_dir_contents(dir: &Path) -> anyhow::Result<Vec<PathBuf>> {
         .collect()
 }
 
-// Parse files in dir_path and return the paths to the shm files created by Shadow.
+// Parse files in dir_path and return the paths to the shm files and per-process shm directories
+// created by Shadow. Current versions of Shadow only create directories (and a live metrics file),
+// but older versions created their shm files directly in dir_path.
 fn get_shadow_shm_file_paths(dir_path: &Path) -> anyhow::Result<Vec<PathBuf>> {
     let vec = get_dir_contents(dir_path)?
         .into_iter()
         .filter_map(|path| match path.file_name() {
-            Some(name) => name
-                .to_string_lossy()
-                .starts_with(SHADOW_SHM_FILE_PREFIX)
-                .then_some(Some(path)),
+            Some(name) => {
+                let name = name.to_string_lossy();
+                (name.starts_with(SHADOW_SHM_FILE_PREFIX)
+                    || name.starts_with(SHM_DIR_PREFIX)
+                    || name.starts_with(LIVE_METRICS_FILE_PREFIX))
+                .then_some(Some(path))
+            }
             None => None, // ignore paths ending in '..'
         })
         .flatten()
@@ -51,9 +59,10 @@ fn get_running_pid_set(dir_path: &Path) -> anyhow::Result<HashSet<i32>> {
     Ok(set)
 }
 
-// Parse the PID that is encoded in the Shadow shmem file name. The PID is the
-// part after the '-', e.g., 2738869 in the example file name:
-// `shadow_shmemfile_6379761.950298775-2738869`
+// Parse the PID that is encoded in the Shadow shmem file or directory name. The
+// PID is the part after the last '-', e.g., 2738869 in the example names:
+// `shadow_shmemfile_6379761.950298775-2738869`, `shadow_shmemdir-2738869`, and
+// `shadow-live-metrics-2738869`
 fn pid_from_shadow_shm_file_name(file_name: &str) -> anyhow::Result<i32> {
     let pid_str = file_name.split('-').last().context(format!(
         "Parsing PID separator '-' from shm file name {:?}",
@@ -67,8 +76,10 @@ fn pid_from_shadow_shm_file_name(file_name: &str) -> anyhow::Result<i32> {
 }
 
 // Cleans up orphaned shared memory files that are no longer mapped by a shadow
-// process. This function should never fail or crash, but is not guaranteed to
-// reclaim all possible orphans. Returns the number of orphans removed.
+// process. A process's shm directory is removed with all of its files at once.
+// This function should never fail or crash, but is not guaranteed to reclaim
+// all possible orphans. Returns the number of orphaned files and directories
+// removed.
 pub fn shm_cleanup(shm_dir: impl AsRef<Path>) -> anyhow::Result<u32> {
     // Get the shm file paths before the PIDs to avoid a race condition (#1343).
     let shm_paths = get_shadow_shm_file_paths(shm_dir.as_ref())?;
@@ -108,17 +119,39 @@ pub fn shm_cleanup(shm_dir: impl AsRef<Path>) -> anyhow::Result<u32> {
             // Do not remove the file if it's owner process is still running.
             if !running_pids.contains(&creator_pid) {
                 log::trace!("Removing orphaned shared memory file {:?}", path);
-                if fs::remove_file(path).is_ok() {
+                let removed = if path.is_dir() {
+                    fs::remove_dir_all(path)
+                } else {
+                    fs::remove_file(path)
+                };
+                if removed.is_ok() {
                     num_removed += 1;
                 }
             }
         }
     }
 
-    log::debug!("Removed {} total shared memory files.", num_removed);
+    log::debug!(
+        "Removed {} total shared memory files and directories.",
+        num_removed
+    );
     Ok(num_removed)
 }
 
+// Runs `shm_cleanup` on a new thread, so that the simulation can start while a
+// large number of orphans are removed.
+pub fn shm_cleanup_in_background(
+    shm_dir: impl AsRef<Path> + Send + 'static,
+) -> std::io::Result<std::thread::JoinHandle<()>> {
+    std::thread::Builder::new()
+        .name("shm-cleanup".into())
+        .spawn(move || {
+            if let Err(e) = shm_cleanup(shm_dir) {
+                log::warn!("Unable to clean up shared memory files: {:?}", e);
+            }
+        })
+}
+
 #[cfg(test)]
 mod tests {
     use std::fs::OpenOptions;
@@ -158,6 +191,54 @@ mod tests {
         assert!(valid.exists(), "Doesn't exist: {}", valid.display());
     }
 
+    #[test]
+    fn test_expired_shm_dir_is_removed() {
+        let dir = tempfile::tempdir().unwrap();
+        let expired: PathBuf = [dir.as_ref(), "shadow_shmemdir-999999999".as_ref()]
+            .iter()
+            .collect();
+
+        fs::create_dir(&expired).unwrap();
+        touch(expired.join("shadow_shmemfile_6379761.950298775-999999999")).unwrap();
+        assert_eq!(shm_cleanup(&dir).unwrap(), 1);
+        assert!(!expired.exists(), "Exists: {}", expired.display());
+    }
+
+    #[test]
+    fn test_valid_shm_dir_is_not_removed() {
+        let my_pid = process::id();
+        let dir = tempfile::tempdir().unwrap();
+        let s = format!("shadow_shmemdir-{my_pid}");
+        let valid: PathBuf = [dir.as_ref(), s.as_ref()].iter().collect();
+
+        fs::create_dir(&valid).unwrap();
+        assert_eq!(shm_cleanup(&dir).unwrap(), 0);
+        assert!(valid.exists(), "Doesn't exist: {}", valid.display());
+    }
+
+    #[test]
+    fn test_expired_live_metrics_file_is_removed() {
+        let dir = tempfile::tempdir().unwrap();
+        let s = format!("{LIVE_METRICS_FILE_PREFIX}999999999");
+        let expired: PathBuf = [dir.as_ref(), s.as_ref()].iter().collect();
+
+        touch(&expired).unwrap();
+        assert_eq!(shm_cleanup(&dir).unwrap(), 1);
+        assert!(!expired.exists(), "Exists: {}", expired.display());
+    }
+
+    #[test]
+    fn test_valid_live_metrics_file_is_not_removed() {
+        let my_pid = process::id();
+        let dir = tempfile::tempdir().unwrap();
+        let s = format!("{LIVE_METRICS_FILE_PREFIX}{my_pid}");
+        let valid: PathBuf = [dir.as_ref(), s.as_ref()].iter().collect();
+
+        touch(&valid).unwrap();
+        assert_eq!(shm_cleanup(&dir).unwrap(), 0);
+        assert!(valid.exists(), "Doesn't exist: {}", valid.display());
+    }
+
     #[test]
     fn test_nonshadow_shm_file_is_not_removed() {
         let dir = tempfile::tempdir().unwrap();
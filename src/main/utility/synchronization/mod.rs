@@ -1,3 +1,5 @@
 pub mod count_down_latch;
 pub mod simple_latch;
+pub mod spin_wait;
 pub mod thread_parking;
+pub mod tree_latch;
@@ -3,6 +3,8 @@ use std::sync::Arc;
 
 use nix::errno::Errno;
 
+use crate::utility::synchronization::spin_wait::SpinWait;
+
 /// A simple reusable latch. Multiple waiters can wait for the latch to open. After opening the
 /// latch with [`open()`](Self::open), you must not open the latch again until all waiters have
 /// waited with [`wait()`](LatchWaiter::wait) on the latch. In other words, you must not call
@@ -21,6 +23,8 @@ use nix::errno::Errno;
 pub struct Latch {
     /// The generation of the latch.
     latch_gen: Arc<AtomicU32>,
+    /// The number of waiters that are (or are about to be) futex-waiting.
+    sleepers: Arc<AtomicU32>,
 }
 
 /// A waiter that waits for the latch to open. A waiter for a latch can be created with
@@ -32,8 +36,12 @@ pub struct LatchWaiter {
     gen: u32,
     /// The read-only generation of the latch.
     latch_gen: Arc<AtomicU32>,
+    /// The number of waiters that are (or are about to be) futex-waiting.
+    sleepers: Arc<AtomicU32>,
     /// Should we sched_yield in a spinloop indefinitely rather than futex-wait?
     spin_yield: bool,
+    /// How long to spin before futex-waiting.
+    spin: SpinWait,
 }
 
 impl Latch {
@@ -41,6 +49,7 @@ impl Latch {
     pub fn new() -> Self {
         Self {
             latch_gen: Arc::new(AtomicU32::new(0)),
+            sleepers: Arc::new(AtomicU32::new(0)),
         }
     }
 
@@ -49,22 +58,32 @@ impl Latch {
     /// latch [`open()`](Self::open).
     ///
     /// If `spin_yield` is `true`, the waiter will `sched_yield` in a spinloop indefinitely. If
-    /// `spin_yield` is `false`, the waiter will futex-wait. Setting to `true` may improve
-    /// performance in some workloads.
+    /// `spin_yield` is `false`, the waiter will spin for a short, adaptive amount of time (see
+    /// [`SpinWait`]) and then futex-wait. Setting to `true` may improve performance in some
+    /// workloads.
     pub fn waiter(&mut self, spin_yield: bool) -> LatchWaiter {
         LatchWaiter {
             // we're the only one who can mutate the atomic,
             // so there's no race condition here
             gen: self.latch_gen.load(Ordering::Relaxed),
             latch_gen: Arc::clone(&self.latch_gen),
+            sleepers: Arc::clone(&self.sleepers),
             spin_yield,
+            spin: SpinWait::new(),
         }
     }
 
     /// Open the latch.
     pub fn open(&mut self) {
         // the addition is wrapping
-        let _prev = self.latch_gen.fetch_add(1, Ordering::Release);
+        let _prev = self.latch_gen.fetch_add(1, Ordering::SeqCst);
+
+        // waiters increment `sleepers` before futex-waiting, so if there are none then we don't
+        // need to make a syscall (the orderings must be `SeqCst` so that a waiter that increments
+        // `sleepers` after we load it is guaranteed to see the new generation)
+        if self.sleepers.load(Ordering::SeqCst) == 0 {
+            return;
+        }
 
         // This is safe since `AtomicU32` "has the same in-memory representation as the underlying
         // integer type, u32": https://doc.rust-lang.org/std/sync/atomic/struct.AtomicU32.html.
@@ -101,6 +120,12 @@ impl Default for Latch {
 impl LatchWaiter {
     /// Wait for the latch to open.
     pub fn wait(&mut self) {
+        if !self.spin_yield {
+            let gen = self.gen;
+            let latch_gen = &self.latch_gen;
+            self.spin.spin(|| latch_gen.load(Ordering::Acquire) != gen);
+        }
+
         loop {
             let latch_gen = self.latch_gen.load(Ordering::Acquire);
 
@@ -116,6 +141,7 @@ impl LatchWaiter {
             if !self.spin_yield {
                 let futex_word: &AtomicU32 = self.latch_gen.as_ref();
 
+                self.sleepers.fetch_add(1, Ordering::SeqCst);
                 let rv = Errno::result(unsafe {
                     libc::syscall(
                         libc::SYS_futex,
@@ -127,6 +153,7 @@ impl LatchWaiter {
                         0u32,
                     )
                 });
+                self.sleepers.fetch_sub(1, Ordering::SeqCst);
                 assert!(
                     rv.is_ok() || rv == Err(Errno::EAGAIN) || rv == Err(Errno::EINTR),
                     "FUTEX_WAIT failed with {rv:?}"
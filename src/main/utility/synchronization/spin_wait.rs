@@ -0,0 +1,61 @@
+/// Bounded, adaptive spinning before blocking. The number of spins allowed before giving up is
+/// doubled each time the condition becomes true while spinning, and halved each time it doesn't, so
+/// that threads spin when the wait is usually short and block quickly when it usually isn't.
+#[derive(Debug, Clone)]
+pub struct SpinWait {
+    limit: u32,
+}
+
+impl SpinWait {
+    /// The smallest spin limit.
+    const MIN_SPINS: u32 = 1 << 4;
+    /// The largest spin limit (roughly tens of microseconds on a modern CPU).
+    const MAX_SPINS: u32 = 1 << 12;
+
+    pub fn new() -> Self {
+        Self {
+            limit: Self::MIN_SPINS,
+        }
+    }
+
+    /// Spin until `done` returns true or the spin limit is reached. Returns the last value returned
+    /// by `done`.
+    pub fn spin(&mut self, done: impl Fn() -> bool) -> bool {
+        for _ in 0..self.limit {
+            if done() {
+                self.limit = std::cmp::min(self.limit.saturating_mul(2), Self::MAX_SPINS);
+                return true;
+            }
+            std::hint::spin_loop();
+        }
+
+        self.limit = std::cmp::max(self.limit / 2, Self::MIN_SPINS);
+        done()
+    }
+}
+
+impl Default for SpinWait {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_limits() {
+        let mut spin = SpinWait::new();
+
+        for _ in 0..20 {
+            assert!(spin.spin(|| true));
+        }
+        assert_eq!(spin.limit, SpinWait::MAX_SPINS);
+
+        for _ in 0..20 {
+            assert!(!spin.spin(|| false));
+        }
+        assert_eq!(spin.limit, SpinWait::MIN_SPINS);
+    }
+}
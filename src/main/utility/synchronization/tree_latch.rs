@@ -0,0 +1,357 @@
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::Arc;
+
+use crossbeam::utils::CachePadded;
+use nix::errno::Errno;
+
+use crate::utility::synchronization::spin_wait::SpinWait;
+
+/// The number of children of each node in the tree.
+const FAN_IN: usize = 4;
+
+#[derive(Debug)]
+struct TreeLatchInner {
+    /// The tree nodes, with the leaves first and the root last.
+    nodes: Vec<CachePadded<Node>>,
+    /// Incremented each time that the root reaches zero. Also used as the futex word.
+    generation: CachePadded<AtomicU32>,
+    /// Non-zero if the waiter is (or is about to be) futex-waiting.
+    waiter_sleeping: CachePadded<AtomicU32>,
+}
+
+#[derive(Debug)]
+struct Node {
+    /// The number of children (or counters, for a leaf) that haven't counted down yet.
+    remaining: AtomicU32,
+    /// The number of children (or counters, for a leaf).
+    total: u32,
+    /// The index of the parent node, or `None` for the root.
+    parent: Option<usize>,
+}
+
+/// A counter for a [`build_tree_latch`] latch.
+#[derive(Debug)]
+pub struct TreeLatchCounter {
+    inner: Arc<TreeLatchInner>,
+    /// The leaf node for this counter.
+    leaf: usize,
+    /// The generation that this counter will count down in next.
+    generation: u32,
+}
+
+/// The waiter for a [`build_tree_latch`] latch.
+#[derive(Debug)]
+pub struct TreeLatchWaiter {
+    inner: Arc<TreeLatchInner>,
+    /// The generation that this waiter will wait for next.
+    generation: u32,
+    /// Should we sched_yield in a spinloop indefinitely rather than futex-wait?
+    spin_yield: bool,
+    spin: SpinWait,
+}
+
+/// A reusable count-down latch for a fixed number of counters and a single waiter, built as a tree
+/// of atomic counters. Each counter counts down at a leaf of the tree, and the last counter to
+/// reach a node continues to its parent, so that only a few counters contend on any cache line.
+/// Nodes are padded to their own cache lines.
+///
+/// The waiter spins for a bounded, adaptive amount of time (see [`SpinWait`]) before futex-waiting,
+/// and the last counter only makes a futex syscall if the waiter is blocked.
+///
+/// Like [`count_down_latch`](super::count_down_latch), each counter must count down at most once
+/// per generation, and must not count down again until the waiter has returned from
+/// [`wait()`](TreeLatchWaiter::wait). Changes made by a counter before it counts down are visible
+/// to the waiter after `wait()` returns.
+///
+/// Unlike `count_down_latch`, the number of counters is fixed: dropping a counter doesn't remove it
+/// from the tree, so after a counter is dropped the waiter won't return again. The exception is a
+/// counter that's dropped while its thread is panicking, which counts down if it hadn't yet, so that
+/// the waiter returns from the current generation and can notice the panic.
+///
+/// This builds a latch with `num_counters` counters, which must be greater than 0. If `spin_yield`
+/// is `true`, the waiter will `sched_yield` in a spinloop indefinitely instead of futex-waiting.
+pub fn build_tree_latch(
+    num_counters: usize,
+    spin_yield: bool,
+) -> (Vec<TreeLatchCounter>, TreeLatchWaiter) {
+    assert!(num_counters > 0);
+
+    // build the tree one level at a time, starting with the leaves
+    let mut nodes: Vec<Node> = vec![];
+    let mut level_start = 0;
+    let mut level_children = num_counters;
+    loop {
+        let level_len = (level_children + FAN_IN - 1) / FAN_IN;
+        for i in 0..level_len {
+            let total = std::cmp::min(FAN_IN, level_children - i * FAN_IN);
+            nodes.push(Node {
+                remaining: AtomicU32::new(total.try_into().unwrap()),
+                total: total.try_into().unwrap(),
+                parent: None,
+            });
+        }
+
+        if level_len == 1 {
+            break;
+        }
+
+        // the next level's nodes will start after this level's nodes
+        let next_level_start = nodes.len();
+        for i in 0..level_len {
+            nodes[level_start + i].parent = Some(next_level_start + i / FAN_IN);
+        }
+
+        level_start = next_level_start;
+        level_children = level_len;
+    }
+
+    let inner = Arc::new(TreeLatchInner {
+        nodes: nodes.into_iter().map(CachePadded::new).collect(),
+        generation: CachePadded::new(AtomicU32::new(0)),
+        waiter_sleeping: CachePadded::new(AtomicU32::new(0)),
+    });
+
+    let counters = (0..num_counters)
+        .map(|i| TreeLatchCounter {
+            inner: Arc::clone(&inner),
+            leaf: i / FAN_IN,
+            generation: 0,
+        })
+        .collect();
+
+    let waiter = TreeLatchWaiter {
+        inner,
+        generation: 0,
+        spin_yield,
+        spin: SpinWait::new(),
+    };
+
+    (counters, waiter)
+}
+
+impl TreeLatchCounter {
+    /// Count down, and wake the waiter if this is the last counter of the current generation.
+    pub fn count_down(&mut self) {
+        let inner = &*self.inner;
+
+        let latch_gen = inner.generation.load(Ordering::Relaxed);
+        assert_eq!(
+            self.generation, latch_gen,
+            "Counter generation does not match latch generation"
+        );
+        self.generation = self.generation.wrapping_add(1);
+
+        let mut node_idx = self.leaf;
+        loop {
+            let node = &inner.nodes[node_idx];
+
+            // the acquire-release makes the changes of the other counters that reached this node
+            // visible to whichever counter continues to the parent
+            if node.remaining.fetch_sub(1, Ordering::AcqRel) != 1 {
+                // other children haven't counted down yet
+                return;
+            }
+
+            // reset the node for the next generation before continuing, so that every node has
+            // been reset by the time the waiter returns
+            node.remaining.store(node.total, Ordering::Relaxed);
+
+            match node.parent {
+                Some(parent) => node_idx = parent,
+                None => break,
+            }
+        }
+
+        // we were the last counter, so open the latch
+        inner.generation.fetch_add(1, Ordering::SeqCst);
+
+        // the waiter sets this before futex-waiting, so if it's not set we can skip the syscall
+        if inner.waiter_sleeping.load(Ordering::SeqCst) != 0 {
+            futex_wake(&inner.generation);
+        }
+    }
+}
+
+impl std::ops::Drop for TreeLatchCounter {
+    fn drop(&mut self) {
+        // if the thread panicked before counting down during the current generation, count down so
+        // that the waiter isn't blocked forever. We don't count down otherwise, since the node
+        // totals still include this counter and the next generation would be shortchanged.
+        if std::thread::panicking()
+            && self.generation == self.inner.generation.load(Ordering::Relaxed)
+        {
+            self.count_down();
+        }
+    }
+}
+
+impl TreeLatchWaiter {
+    /// Wait for all counters to count down.
+    pub fn wait(&mut self) {
+        let inner = &*self.inner;
+        let expected = self.generation.wrapping_add(1);
+        let is_open = || inner.generation.load(Ordering::Acquire) == expected;
+
+        if !self.spin_yield && !self.spin.spin(is_open) {
+            while !is_open() {
+                inner.waiter_sleeping.store(1, Ordering::SeqCst);
+                // the futex won't block if the generation has already changed
+                futex_wait(&inner.generation, self.generation);
+                inner.waiter_sleeping.store(0, Ordering::SeqCst);
+            }
+        }
+
+        while !is_open() {
+            std::hint::spin_loop();
+            std::thread::yield_now();
+        }
+
+        self.generation = expected;
+    }
+}
+
+fn futex_wait(word: &AtomicU32, expected: u32) {
+    let rv = Errno::result(unsafe {
+        libc::syscall(
+            libc::SYS_futex,
+            word.as_ptr(),
+            libc::FUTEX_WAIT | libc::FUTEX_PRIVATE_FLAG,
+            expected,
+            std::ptr::null::<libc::timespec>(),
+            std::ptr::null_mut::<u32>(),
+            0u32,
+        )
+    });
+    assert!(
+        rv.is_ok() || rv == Err(Errno::EAGAIN) || rv == Err(Errno::EINTR),
+        "FUTEX_WAIT failed with {rv:?}"
+    );
+}
+
+fn futex_wake(word: &AtomicU32) {
+    let rv = unsafe {
+        libc::syscall(
+            libc::SYS_futex,
+            word.as_ptr(),
+            libc::FUTEX_WAKE | libc::FUTEX_PRIVATE_FLAG,
+            1,
+            std::ptr::null::<libc::timespec>(),
+            std::ptr::null_mut::<u32>(),
+            0u32,
+        )
+    };
+    assert!(rv >= 0);
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::atomic::AtomicUsize;
+
+    use super::*;
+
+    #[test]
+    fn test_tree_shape() {
+        let (_counters, waiter) = build_tree_latch(10, false);
+        let nodes = &waiter.inner.nodes;
+
+        // 3 leaves, and a root with 3 children
+        assert_eq!(nodes.len(), 4);
+        assert_eq!(
+            nodes.iter().map(|x| x.total).collect::<Vec<_>>(),
+            [4, 4, 2, 3]
+        );
+        assert_eq!(
+            nodes.iter().map(|x| x.parent).collect::<Vec<_>>(),
+            [Some(3), Some(3), Some(3), None]
+        );
+    }
+
+    #[test]
+    fn test_single_thread() {
+        let (mut counters, mut waiter) = build_tree_latch(1, false);
+        for _ in 0..3 {
+            counters[0].count_down();
+            waiter.wait();
+        }
+    }
+
+    #[test]
+    fn test_threads() {
+        for spin_yield in [false, true] {
+            let num_threads = 37;
+            let num_rounds = 100;
+            let (counters, mut waiter) = build_tree_latch(num_threads, spin_yield);
+            let count = Arc::new(AtomicUsize::new(0));
+            // each thread waits for the main thread to allow it to start the next round
+            let round = Arc::new(AtomicUsize::new(0));
+
+            let threads: Vec<_> = counters
+                .into_iter()
+                .map(|mut counter| {
+                    let count = Arc::clone(&count);
+                    let round = Arc::clone(&round);
+                    std::thread::spawn(move || {
+                        for i in 0..num_rounds {
+                            while round.load(Ordering::Acquire) != i {
+                                std::thread::yield_now();
+                            }
+                            count.fetch_add(1, Ordering::Relaxed);
+                            counter.count_down();
+                        }
+                    })
+                })
+                .collect();
+
+            for i in 0..num_rounds {
+                waiter.wait();
+                assert_eq!(count.load(Ordering::Relaxed), (i + 1) * num_threads);
+                round.store(i + 1, Ordering::Release);
+            }
+
+            for t in threads {
+                t.join().unwrap();
+            }
+        }
+    }
+
+    #[test]
+    fn test_panic_counts_down() {
+        let (mut counters, mut waiter) = build_tree_latch(3, false);
+        counters[0].count_down();
+
+        // the other counters' threads panic before counting down
+        let threads: Vec<_> = counters
+            .drain(1..)
+            .map(|counter| {
+                std::thread::spawn(move || {
+                    let _counter = counter;
+                    panic!("expected panic");
+                })
+            })
+            .collect();
+
+        waiter.wait();
+        for t in threads {
+            assert!(t.join().is_err());
+        }
+    }
+
+    #[test]
+    fn test_drop_does_not_count_down() {
+        let (mut counters, waiter) = build_tree_latch(2, false);
+        counters[0].count_down();
+        counters.truncate(1);
+
+        // the dropped counter didn't open the latch
+        assert_eq!(waiter.inner.generation.load(Ordering::Relaxed), 0);
+        assert_eq!(waiter.inner.nodes[0].remaining.load(Ordering::Relaxed), 1);
+    }
+
+    #[test]
+    #[should_panic]
+    fn test_multiple_count_down() {
+        let (mut counters, _waiter) = build_tree_latch(2, false);
+        counters[0].count_down();
+        counters[0].count_down();
+    }
+}
@@ -0,0 +1,272 @@
+//! Copying the template directory to the data directory at startup.
+//!
+//! Files are copied in parallel, and are cloned (reflinked) when the filesystem supports it, so
+//! that identical files share their data on disk until one of the copies is modified. If cloning
+//! isn't supported, files can optionally be hard linked instead. A hard linked file is copied the
+//! first time that a managed process opens it for writing (see [`break_hard_link`]), so that
+//! writes don't modify the template or other hosts' files.
+
+use std::fs::{File, OpenOptions};
+use std::os::fd::AsRawFd;
+use std::os::unix::fs::{DirBuilderExt, MetadataExt, OpenOptionsExt, PermissionsExt};
+use std::path::{Path, PathBuf};
+use std::sync::OnceLock;
+
+use rayon::prelude::*;
+
+/// `FICLONE` from "linux/fs.h", which isn't in all versions of the libc crate.
+const FICLONE: libc::c_ulong = 0x4004_9409;
+
+/// The data directory, if any files in it are hard links to the template directory.
+static HARD_LINKED_DIR: OnceLock<PathBuf> = OnceLock::new();
+
+/// How a file was copied.
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+enum CopyKind {
+    Cloned,
+    HardLinked,
+    Copied,
+}
+
+/// Copy the contents of the `src` directory to a new directory named `dst`. Permissions will be
+/// preserved. If `allow_hard_links` is true, regular files that can't be cloned are hard linked.
+pub fn copy_dir_all(
+    src: impl AsRef<Path>,
+    dst: impl AsRef<Path>,
+    allow_hard_links: bool,
+) -> std::io::Result<()> {
+    // a directory to copy
+    struct DirCopyTask {
+        src: PathBuf,
+        dst: PathBuf,
+        mode: u32,
+    }
+
+    // a stack of directories to copy
+    let mut stack: Vec<DirCopyTask> = vec![];
+
+    // the files to copy after the directories have been created
+    let mut files: Vec<(PathBuf, PathBuf, bool)> = vec![];
+
+    stack.push(DirCopyTask {
+        src: src.as_ref().to_path_buf(),
+        dst: dst.as_ref().to_path_buf(),
+        mode: src.as_ref().metadata()?.mode(),
+    });
+
+    while let Some(DirCopyTask { src, dst, mode }) = stack.pop() {
+        // create the directory with the same permissions
+        create_dir_with_mode(&dst, mode)?;
+
+        // copy directory contents
+        for entry in std::fs::read_dir(src)? {
+            let entry = entry?;
+            let meta = entry.metadata()?;
+            let new_dst_path = dst.join(entry.file_name());
+
+            if meta.is_dir() {
+                stack.push(DirCopyTask {
+                    src: entry.path(),
+                    dst: new_dst_path,
+                    mode: meta.mode(),
+                });
+            } else {
+                // don't hard link symlinks, since we copy the files that they point to
+                let can_hard_link = allow_hard_links && meta.is_file();
+                files.push((entry.path(), new_dst_path, can_hard_link));
+            }
+        }
+    }
+
+    let kinds = files
+        .par_iter()
+        .map(|(src, dst, can_hard_link)| copy_file(src, dst, *can_hard_link))
+        .collect::<std::io::Result<Vec<CopyKind>>>()?;
+
+    let num_cloned = kinds.iter().filter(|x| **x == CopyKind::Cloned).count();
+    let num_hard_linked = kinds.iter().filter(|x| **x == CopyKind::HardLinked).count();
+    log::debug!(
+        "Copied {} template files ({num_cloned} cloned, {num_hard_linked} hard linked)",
+        kinds.len()
+    );
+
+    if num_hard_linked > 0 {
+        // paths opened by managed processes are compared against this
+        let dst = dst.as_ref().canonicalize()?;
+        if HARD_LINKED_DIR.set(dst).is_err() {
+            log::warn!("Template files were hard linked into more than one directory");
+        }
+    }
+
+    Ok(())
+}
+
+fn create_dir_with_mode(path: impl AsRef<Path>, mode: u32) -> std::io::Result<()> {
+    let mut dir_builder = std::fs::DirBuilder::new();
+    dir_builder.mode(mode);
+    dir_builder.create(&path)
+}
+
+/// Create a new file `dst` with the same permissions as `src`.
+fn create_file_like(src: &File, dst: &Path) -> std::io::Result<File> {
+    let permissions = src.metadata()?.permissions();
+    let file = OpenOptions::new()
+        .write(true)
+        .create_new(true)
+        .mode(permissions.mode())
+        .open(dst)?;
+    // the mode given to open() is affected by the umask
+    file.set_permissions(permissions)?;
+    Ok(file)
+}
+
+/// Copy the file `src` to a new file `dst`, preserving its permissions. The file is cloned if the
+/// filesystem supports it, otherwise it's hard linked if `can_hard_link` is true, otherwise its
+/// contents are copied.
+fn copy_file(src: &Path, dst: &Path, can_hard_link: bool) -> std::io::Result<CopyKind> {
+    let mut src_file = File::open(src)?;
+    let mut dst_file = create_file_like(&src_file, dst)?;
+
+    if unsafe { libc::ioctl(dst_file.as_raw_fd(), FICLONE as _, src_file.as_raw_fd()) } == 0 {
+        return Ok(CopyKind::Cloned);
+    }
+
+    if can_hard_link {
+        drop(dst_file);
+        std::fs::remove_file(dst)?;
+        if std::fs::hard_link(src, dst).is_ok() {
+            return Ok(CopyKind::HardLinked);
+        }
+        // for example if the directories are on different filesystems
+        dst_file = create_file_like(&src_file, dst)?;
+    }
+
+    // uses copy_file_range() when possible
+    std::io::copy(&mut src_file, &mut dst_file)?;
+    Ok(CopyKind::Copied)
+}
+
+/// If `path` is a file in the data directory that's hard linked to the template directory, replace
+/// it with a copy so that it can be modified without changing the template. Returns true if the
+/// file was copied.
+pub fn break_hard_link(path: &Path) -> std::io::Result<bool> {
+    let Some(dir) = HARD_LINKED_DIR.get() else {
+        return Ok(false);
+    };
+
+    // the managed process' path may contain symlinks or ".." components
+    let (Some(parent), Some(name)) = (path.parent(), path.file_name()) else {
+        return Ok(false);
+    };
+    let Ok(parent) = parent.canonicalize() else {
+        return Ok(false);
+    };
+    if !parent.starts_with(dir) {
+        return Ok(false);
+    }
+    let path = parent.join(name);
+
+    let meta = match std::fs::symlink_metadata(&path) {
+        Ok(x) => x,
+        Err(e) if e.kind() == std::io::ErrorKind::NotFound => return Ok(false),
+        Err(e) => return Err(e),
+    };
+
+    if !meta.is_file() || meta.nlink() < 2 {
+        return Ok(false);
+    }
+
+    // copy to a temporary file in the same directory, then replace the link with it
+    let mut tmp_name = name.to_os_string();
+    tmp_name.push(".shadow-copy");
+    let tmp_path = path.with_file_name(tmp_name);
+
+    let result = copy_file(&path, &tmp_path, false).and_then(|_| std::fs::rename(&tmp_path, &path));
+    if result.is_err() {
+        let _ = std::fs::remove_file(&tmp_path);
+    }
+    result.map(|()| true)
+}
+
+mod export {
+    use std::ffi::CStr;
+    use std::os::unix::ffi::OsStrExt;
+
+    use super::*;
+
+    /// If the file at the absolute path `path` is hard linked to the template directory, replace
+    /// it with a copy. Returns 0 on success (including if the file isn't hard linked), or a
+    /// negative errno.
+    #[no_mangle]
+    pub unsafe extern "C" fn utility_breakTemplateHardLink(
+        path: *const libc::c_char,
+    ) -> libc::c_int {
+        assert!(!path.is_null());
+        let path = unsafe { CStr::from_ptr(path) };
+        let path = Path::new(std::ffi::OsStr::from_bytes(path.to_bytes()));
+
+        match break_hard_link(path) {
+            Ok(copied) => {
+                if copied {
+                    log::trace!("Copied hard linked template file {}", path.display());
+                }
+                0
+            }
+            Err(e) => {
+                log::warn!(
+                    "Unable to copy hard linked template file {}: {e}",
+                    path.display()
+                );
+                -e.raw_os_error().unwrap_or(libc::EIO)
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_copy_dir_all() {
+        let src = tempfile::tempdir().unwrap();
+        std::fs::create_dir(src.path().join("dir")).unwrap();
+        std::fs::write(src.path().join("a"), "hello").unwrap();
+        std::fs::write(src.path().join("dir/b"), "world").unwrap();
+        std::fs::set_permissions(
+            src.path().join("dir/b"),
+            std::fs::Permissions::from_mode(0o600),
+        )
+        .unwrap();
+
+        let parent = tempfile::tempdir().unwrap();
+        let dst = parent.path().join("copy");
+        copy_dir_all(src.path(), &dst, false).unwrap();
+
+        assert_eq!(std::fs::read_to_string(dst.join("a")).unwrap(), "hello");
+        assert_eq!(std::fs::read_to_string(dst.join("dir/b")).unwrap(), "world");
+        let mode = std::fs::metadata(dst.join("dir/b")).unwrap().mode();
+        assert_eq!(mode & 0o777, 0o600);
+
+        // not hard linked, so modifying the copy doesn't modify the source
+        std::fs::write(dst.join("a"), "changed").unwrap();
+        assert_eq!(
+            std::fs::read_to_string(src.path().join("a")).unwrap(),
+            "hello"
+        );
+    }
+
+    #[test]
+    fn test_copy_file_hard_link() {
+        let dir = tempfile::tempdir().unwrap();
+        let src = dir.path().join("src");
+        let dst = dir.path().join("dst");
+        std::fs::write(&src, "hello").unwrap();
+
+        let kind = copy_file(&src, &dst, true).unwrap();
+        assert_eq!(std::fs::read_to_string(&dst).unwrap(), "hello");
+        if kind == CopyKind::HardLinked {
+            assert_eq!(std::fs::metadata(&dst).unwrap().nlink(), 2);
+        }
+    }
+}
@@ -0,0 +1,257 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+// Network workloads for the scenarios that `./setup bench` runs. Servers run until the simulation
+// ends, and clients exit once they're done (except for idle clients, which hold their connections
+// open until the simulation ends).
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "test/test_glib_helpers.h"
+
+#define BUF_SIZE 65536
+#define UDP_MSG_SIZE 64
+#define MAX_EVENTS 1024
+
+static const char* USAGE =
+    "usage:\n"
+    "  bench-net tcp-server PORT\n"
+    "  bench-net tcp-client PORT NBYTES HOST...\n"
+    "  bench-net udp-server PORT\n"
+    "  bench-net udp-client PORT NREQUESTS HOST\n"
+    "  bench-net idle-client PORT NCONNS HOST\n";
+
+static char buf[BUF_SIZE];
+
+static uint16_t parse_port(const char* s) {
+    long port = strtol(s, NULL, 10);
+    if (port <= 0 || port > UINT16_MAX) {
+        g_error("Invalid port '%s'", s);
+    }
+    return (uint16_t)port;
+}
+
+static void resolve(const char* host, uint16_t port, struct sockaddr_in* addr) {
+    struct addrinfo hints = {.ai_family = AF_INET};
+    struct addrinfo* res = NULL;
+    int rv = getaddrinfo(host, NULL, &hints, &res);
+    if (rv != 0) {
+        g_error("getaddrinfo(%s): %s", host, gai_strerror(rv));
+    }
+    *addr = *(struct sockaddr_in*)res->ai_addr;
+    addr->sin_port = htons(port);
+    freeaddrinfo(res);
+}
+
+// Allow as many open files as we can, since the idle scenario holds many connections open.
+static void raise_nofile_limit() {
+    struct rlimit limit;
+    assert_nonneg_errno(getrlimit(RLIMIT_NOFILE, &limit));
+    limit.rlim_cur = limit.rlim_max;
+    assert_nonneg_errno(setrlimit(RLIMIT_NOFILE, &limit));
+}
+
+static int epoll_add(int epfd, int fd, uint32_t events) {
+    struct epoll_event ev = {.events = events, .data.fd = fd};
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// Accept connections and discard everything that's sent to them.
+static int tcp_server(uint16_t port) {
+    raise_nofile_limit();
+
+    int listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    assert_nonneg_errno(listenfd);
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY), .sin_port = htons(port)};
+    assert_nonneg_errno(bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)));
+    assert_nonneg_errno(listen(listenfd, SOMAXCONN));
+
+    int epfd = epoll_create1(0);
+    assert_nonneg_errno(epfd);
+    assert_nonneg_errno(epoll_add(epfd, listenfd, EPOLLIN));
+
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        assert_nonneg_errno(n);
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == listenfd) {
+                int connfd;
+                while ((connfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+                    assert_nonneg_errno(epoll_add(epfd, connfd, EPOLLIN));
+                }
+                assert_true_errno(errno == EAGAIN || errno == EWOULDBLOCK);
+                continue;
+            }
+
+            ssize_t rv;
+            while ((rv = read(fd, buf, sizeof(buf))) > 0) {
+            }
+            if (rv == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                close(fd);
+            }
+        }
+    }
+}
+
+// Connect to each host and send it `nbytes`.
+static int tcp_client(uint16_t port, size_t nbytes, int num_hosts, char** hosts) {
+    int epfd = epoll_create1(0);
+    assert_nonneg_errno(epfd);
+
+    // indexed by fd
+    size_t* remaining = g_new0(size_t, num_hosts + 1024);
+    int num_open = 0;
+
+    for (int i = 0; i < num_hosts; i++) {
+        struct sockaddr_in addr;
+        resolve(hosts[i], port, &addr);
+
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        assert_nonneg_errno(fd);
+        g_assert_cmpint(fd, <, num_hosts + 1024);
+
+        int rv = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+        assert_true_errno(rv == 0 || errno == EINPROGRESS);
+
+        assert_nonneg_errno(epoll_add(epfd, fd, EPOLLOUT));
+        remaining[fd] = nbytes;
+        num_open++;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (num_open > 0) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        assert_nonneg_errno(n);
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                g_error("Connection on fd %d failed", fd);
+            }
+
+            while (remaining[fd] > 0) {
+                ssize_t rv = write(fd, buf, MIN(remaining[fd], sizeof(buf)));
+                if (rv < 0) {
+                    assert_true_errno(errno == EAGAIN || errno == EWOULDBLOCK);
+                    break;
+                }
+                remaining[fd] -= rv;
+            }
+
+            if (remaining[fd] == 0) {
+                close(fd);
+                num_open--;
+            }
+        }
+    }
+
+    g_free(remaining);
+    return EXIT_SUCCESS;
+}
+
+// Echo each datagram back to its sender.
+static int udp_server(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert_nonneg_errno(fd);
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY), .sin_port = htons(port)};
+    assert_nonneg_errno(bind(fd, (struct sockaddr*)&addr, sizeof(addr)));
+
+    while (1) {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        ssize_t rv = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*)&peer, &peer_len);
+        assert_nonneg_errno(rv);
+        assert_nonneg_errno(sendto(fd, buf, rv, 0, (struct sockaddr*)&peer, peer_len));
+    }
+}
+
+// Send `nrequests` requests and wait for each response, resending requests that time out.
+static int udp_client(uint16_t port, long nrequests, const char* host) {
+    struct sockaddr_in addr;
+    resolve(host, port, &addr);
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert_nonneg_errno(fd);
+    assert_nonneg_errno(connect(fd, (struct sockaddr*)&addr, sizeof(addr)));
+
+    struct timeval timeout = {.tv_sec = 1};
+    assert_nonneg_errno(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)));
+
+    long num_resent = 0;
+    for (long i = 0; i < nrequests; i++) {
+        assert_nonneg_errno(send(fd, buf, UDP_MSG_SIZE, 0));
+        while (recv(fd, buf, sizeof(buf), 0) < 0) {
+            assert_true_errno(errno == EAGAIN || errno == EWOULDBLOCK);
+            assert_nonneg_errno(send(fd, buf, UDP_MSG_SIZE, 0));
+            num_resent++;
+        }
+    }
+
+    printf("%ld requests, %ld resent\n", nrequests, num_resent);
+    return EXIT_SUCCESS;
+}
+
+// Open `nconns` connections to the host and keep them open without sending anything.
+static int idle_client(uint16_t port, long nconns, const char* host) {
+    raise_nofile_limit();
+
+    struct sockaddr_in addr;
+    resolve(host, port, &addr);
+
+    for (long i = 0; i < nconns; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        assert_nonneg_errno(fd);
+        int rv = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+        assert_true_errno(rv == 0 || errno == EINPROGRESS);
+    }
+
+    printf("opened %ld connections\n", nconns);
+    fflush(stdout);
+
+    while (1) {
+        pause();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 3 && !strcmp(argv[1], "tcp-server")) {
+        return tcp_server(parse_port(argv[2]));
+    } else if (argc >= 5 && !strcmp(argv[1], "tcp-client")) {
+        return tcp_client(
+            parse_port(argv[2]), strtoull(argv[3], NULL, 10), argc - 4, &argv[4]);
+    } else if (argc >= 3 && !strcmp(argv[1], "udp-server")) {
+        return udp_server(parse_port(argv[2]));
+    } else if (argc == 5 && !strcmp(argv[1], "udp-client")) {
+        return udp_client(parse_port(argv[2]), strtol(argv[3], NULL, 10), argv[4]);
+    } else if (argc == 5 && !strcmp(argv[1], "idle-client")) {
+        return idle_client(parse_port(argv[2]), strtol(argv[3], NULL, 10), argv[4]);
+    }
+
+    fprintf(stderr, "%s", USAGE);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,70 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+/* Counts the UDP datagrams that arrive at a port until none have arrived for a while, for checking
+ * the datagrams sent by a host's traffic model. */
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#define IDLE_TIMEOUT_MS 2000
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s PORT\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(atoi(argv[1])),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return EXIT_FAILURE;
+    }
+
+    long count = 0;
+    ssize_t size = -1;
+    while (1) {
+        // wait indefinitely for the first datagram
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        int rv = poll(&pfd, 1, count == 0 ? -1 : IDLE_TIMEOUT_MS);
+        if (rv < 0) {
+            perror("poll");
+            return EXIT_FAILURE;
+        }
+        if (rv == 0) {
+            break;
+        }
+
+        char buf[65536];
+        ssize_t len = recv(fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            perror("recv");
+            return EXIT_FAILURE;
+        }
+        if (size >= 0 && len != size) {
+            printf("received datagrams of %zd and %zd bytes\n", size, len);
+            return EXIT_FAILURE;
+        }
+        size = len;
+        count++;
+    }
+
+    printf("received %ld datagrams of %zd bytes\n", count, size);
+    return EXIT_SUCCESS;
+}
@@ -329,6 +329,97 @@ fn test_ctl_invalid_op() -> anyhow::Result<()> {
     })
 }
 
+fn test_ctl_exclusive() -> anyhow::Result<()> {
+    let (read_fd, write_fd) = unistd::pipe()?;
+    let epoll_fd = epoll::epoll_create()?;
+    let other_epoll_fd = epoll::epoll_create()?;
+
+    let fds = [epoll_fd, other_epoll_fd, read_fd, write_fd];
+    test_utils::run_and_close_fds(&fds, || {
+        let ctl = |op, fd, events: libc::c_int| {
+            let mut event = libc::epoll_event {
+                events: events as u32,
+                u64: 0,
+            };
+            Errno::result(unsafe { libc::epoll_ctl(epoll_fd, op, fd, &mut event) })
+        };
+
+        // only some flags are allowed with EPOLLEXCLUSIVE
+        assert_eq!(
+            ctl(
+                libc::EPOLL_CTL_ADD,
+                read_fd,
+                libc::EPOLLEXCLUSIVE | libc::EPOLLIN | libc::EPOLLPRI
+            ),
+            Err(Errno::EINVAL)
+        );
+        assert_eq!(
+            ctl(
+                libc::EPOLL_CTL_ADD,
+                read_fd,
+                libc::EPOLLEXCLUSIVE | libc::EPOLLIN | libc::EPOLLONESHOT
+            ),
+            Err(Errno::EINVAL)
+        );
+
+        // EPOLLERR and EPOLLHUP are always reported, so they're allowed
+        let events = libc::EPOLLEXCLUSIVE
+            | libc::EPOLLIN
+            | libc::EPOLLOUT
+            | libc::EPOLLERR
+            | libc::EPOLLHUP
+            | libc::EPOLLET;
+        assert_eq!(ctl(libc::EPOLL_CTL_ADD, read_fd, events), Ok(0));
+
+        // an exclusive watch can't be modified, with or without the flag
+        assert_eq!(
+            ctl(libc::EPOLL_CTL_MOD, read_fd, libc::EPOLLIN),
+            Err(Errno::EINVAL)
+        );
+        assert_eq!(
+            ctl(
+                libc::EPOLL_CTL_MOD,
+                read_fd,
+                libc::EPOLLEXCLUSIVE | libc::EPOLLIN
+            ),
+            Err(Errno::EINVAL)
+        );
+        // but it's still registered, and can be removed
+        assert_eq!(
+            ctl(libc::EPOLL_CTL_ADD, read_fd, libc::EPOLLIN),
+            Err(Errno::EEXIST)
+        );
+        assert_eq!(ctl(libc::EPOLL_CTL_DEL, read_fd, 0), Ok(0));
+
+        // a non-exclusive watch can't be made exclusive
+        assert_eq!(ctl(libc::EPOLL_CTL_ADD, write_fd, libc::EPOLLOUT), Ok(0));
+        assert_eq!(
+            ctl(
+                libc::EPOLL_CTL_MOD,
+                write_fd,
+                libc::EPOLLEXCLUSIVE | libc::EPOLLOUT
+            ),
+            Err(Errno::EINVAL)
+        );
+
+        // the target can't be an epoll instance, although it can be watched without the flag
+        assert_eq!(
+            ctl(
+                libc::EPOLL_CTL_ADD,
+                other_epoll_fd,
+                libc::EPOLLEXCLUSIVE | libc::EPOLLIN
+            ),
+            Err(Errno::EINVAL)
+        );
+        assert_eq!(
+            ctl(libc::EPOLL_CTL_ADD, other_epoll_fd, libc::EPOLLIN),
+            Ok(0)
+        );
+
+        Ok(())
+    })
+}
+
 fn main() -> anyhow::Result<()> {
     // should we restrict the tests we run?
     let filter_shadow_passing = std::env::args().any(|x| x == "--shadow-passing");
@@ -356,7 +447,8 @@ fn main() -> anyhow::Result<()> {
             test_wait_negative_timeout,
             all_envs.clone(),
         ),
-        ShadowTest::new("test_ctl_invalid_op", test_ctl_invalid_op, all_envs),
+        ShadowTest::new("test_ctl_invalid_op", test_ctl_invalid_op, all_envs.clone()),
+        ShadowTest::new("test_ctl_exclusive", test_ctl_exclusive, all_envs),
     ];
 
     if filter_shadow_passing {
@@ -53,6 +53,12 @@ fn main() -> Result<(), String> {
             test_eventfd_read_write_semaphore_nonblock,
             set![TestEnv::Libc, TestEnv::Shadow],
         ),
+        // Linux consumes the counter before it faults on the reader's buffer
+        test_utils::ShadowTest::new(
+            "test_eventfd_read_write_bad_buffer",
+            test_eventfd_read_write_bad_buffer,
+            set![TestEnv::Shadow],
+        ),
     ];
 
     if filter_shadow_passing {
@@ -408,3 +414,24 @@ fn test_eventfd_read_write_semaphore_nonblock() -> Result<(), String> {
         Ok(())
     })
 }
+
+fn test_eventfd_read_write_bad_buffer() -> Result<(), String> {
+    let efd: RawFd = call_eventfd(2, EfdFlags::EFD_NONBLOCK)?;
+
+    // an address in the first page, which is never mapped
+    let bad_buf = 16 as *mut libc::c_void;
+
+    test_utils::run_and_close_fds(&[efd], || {
+        // a failed read shouldn't change the counter
+        let rv = Errno::result(unsafe { libc::read(efd, bad_buf, 8) });
+        test_utils::result_assert_eq(rv, Err(Errno::EFAULT), "Expected EFAULT from read")?;
+        check_read_success(efd, 2)?;
+
+        // a failed write shouldn't change the counter
+        let rv = Errno::result(unsafe { libc::write(efd, bad_buf, 8) });
+        test_utils::result_assert_eq(rv, Err(Errno::EFAULT), "Expected EFAULT from write")?;
+        check_read_eagain(efd)?;
+
+        Ok(())
+    })
+}
@@ -12,9 +12,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "lib/logger/logger.h"
@@ -98,12 +100,82 @@ static void _futex_wait_test() {
     _wait_for_condition(&arg.child_finished);
 }
 
+typedef struct {
+    atomic_int futex;
+    atomic_bool child_started;
+} FutexWaitSharedTestArg;
+
+// Like `_futex_wait_test`, but the waiter is another process that shares the futex through a
+// `MAP_SHARED` mapping, so the futex operations can't use `FUTEX_PRIVATE_FLAG`.
+static void _futex_wait_shared_process_test() {
+    FutexWaitSharedTestArg* arg =
+        mmap(NULL, sizeof(*arg), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    g_assert_true(arg != MAP_FAILED);
+    atomic_store(&arg->futex, UNAVAILABLE);
+    atomic_store(&arg->child_started, false);
+
+    pid_t pid = fork();
+    if (pid < 0 && errno == ENOTSUP && running_in_shadow()) {
+        // Shadow doesn't support fork with its memory manager.
+        g_test_skip("fork isn't supported");
+        g_assert_cmpint(munmap(arg, sizeof(*arg)), ==, 0);
+        return;
+    }
+    assert_nonneg_errno(pid);
+
+    if (pid == 0) {
+        atomic_store(&arg->child_started, true);
+        do {
+            long rv = syscall(SYS_futex, &arg->futex, FUTEX_WAIT, UNAVAILABLE, NULL, NULL, 0);
+            if (rv != 0 && errno != EAGAIN) {
+                _exit(EXIT_FAILURE);
+            }
+        } while (atomic_load(&arg->futex) != AVAILABLE);
+        _exit(EXIT_SUCCESS);
+    }
+
+    _wait_for_condition(&arg->child_started);
+
+    // Wake the child. There's no way to guarantee that the child is already asleep
+    // on the futex, so we need to loop.
+    long woken = 0;
+    while (1) {
+        woken = syscall(SYS_futex, &arg->futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+        assert_nonneg_errno(woken);
+        if (woken == 1) {
+            break;
+        }
+        g_assert_cmpint(woken, ==, 0);
+        usleep(1);
+    }
+
+    // Flip the flag to let the child exit, and wake it in case it went back to sleep.
+    g_assert_cmpint(atomic_exchange(&arg->futex, AVAILABLE), ==, UNAVAILABLE);
+    woken = syscall(SYS_futex, &arg->futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+    assert_nonneg_errno(woken);
+    g_assert_cmpint(woken, <=, 1);
+
+    int status = 0;
+    g_assert_cmpint(waitpid(pid, &status, 0), ==, pid);
+    g_assert_true(WIFEXITED(status));
+    g_assert_cmpint(WEXITSTATUS(status), ==, EXIT_SUCCESS);
+
+    g_assert_cmpint(munmap(arg, sizeof(*arg)), ==, 0);
+}
+
 static void _futex_wait_stale_test() {
     int futex = AVAILABLE;
     g_assert_cmpint(syscall(SYS_futex, &futex, FUTEX_WAIT, UNAVAILABLE, NULL, NULL, 0), ==, -1);
     assert_errno_is(EAGAIN);
 }
 
+static void _futex_wait_bad_addr_test() {
+    // an address in the first page, which is never mapped
+    int* futex = (int*)16;
+    g_assert_cmpint(syscall(SYS_futex, futex, FUTEX_WAIT, UNAVAILABLE, NULL, NULL, 0), ==, -1);
+    assert_errno_is(EFAULT);
+}
+
 static void _futex_wake_nobody_test() {
     int futex = AVAILABLE;
     g_assert_cmpint(syscall(SYS_futex, &futex, FUTEX_WAKE, INT_MAX), ==, 0);
@@ -402,7 +474,9 @@ int main(int argc, char** argv) {
 
     g_test_add_func("/futex/wait", _futex_wait_test);
     g_test_add_func("/futex/wait_intr", _futex_wait_intr_test);
+    g_test_add_func("/futex/wait_shared_process", _futex_wait_shared_process_test);
     g_test_add_func("/futex/wait_stale", _futex_wait_stale_test);
+    g_test_add_func("/futex/wait_bad_addr", _futex_wait_bad_addr_test);
     g_test_add_func("/futex/wake_nobody", _futex_wake_nobody_test);
     g_test_add_func("/futex/wake_stress", _futex_stress_test);
     g_test_add_func("/futex/wait_timeout", _futex_wait_timeout_test);
@@ -149,6 +149,11 @@ fn get_tests() -> Vec<test_utils::ShadowTest<(), String>> {
             test_close_during_blocking_write,
             set![TestEnv::Libc, TestEnv::Shadow],
         ),
+        test_utils::ShadowTest::new(
+            "test_sendfile",
+            test_sendfile,
+            set![TestEnv::Libc, TestEnv::Shadow],
+        ),
     ];
 
     tests
@@ -1224,3 +1229,83 @@ fn test_close_during_blocking_write() -> Result<(), String> {
 
     Ok(())
 }
+
+fn test_sendfile() -> Result<(), String> {
+    let path = "test_pipe_sendfile.txt";
+    std::fs::write(path, b"hello world").map_err(|e| e.to_string())?;
+    let path_c = std::ffi::CString::new(path).unwrap();
+
+    let file_fd = test_utils::check_system_call!(
+        || { unsafe { libc::open(path_c.as_ptr(), libc::O_RDONLY) } },
+        &[]
+    )?;
+
+    let mut fds = [0 as libc::c_int; 2];
+    test_utils::check_system_call!(|| { unsafe { libc::pipe(fds.as_mut_ptr()) } }, &[])?;
+    let (read_fd, write_fd) = (fds[0], fds[1]);
+
+    let rv = test_utils::run_and_close_fds(&[write_fd, read_fd, file_fd], || {
+        let mut read_buf = [0u8; 16];
+
+        // with an offset, the file position shouldn't change
+        let mut offset: libc::off_t = 6;
+        let rv = test_utils::check_system_call!(
+            || { unsafe { libc::sendfile(write_fd, file_fd, &mut offset, 100) } },
+            &[]
+        )?;
+        test_utils::result_assert_eq(rv, 5, "Expected to send 5 bytes")?;
+        test_utils::result_assert_eq(offset, 11, "Unexpected offset")?;
+
+        let pos = unsafe { libc::lseek(file_fd, 0, libc::SEEK_CUR) };
+        test_utils::result_assert_eq(pos, 0, "Unexpected file position")?;
+
+        let rv = test_utils::check_system_call!(
+            || {
+                unsafe {
+                    libc::read(
+                        read_fd,
+                        read_buf.as_mut_ptr() as *mut libc::c_void,
+                        read_buf.len(),
+                    )
+                }
+            },
+            &[]
+        )?;
+        test_utils::result_assert_eq(&read_buf[..rv as usize], &b"world"[..], "Buffers differ")?;
+
+        // without an offset, the file position should be used and updated
+        let rv = test_utils::check_system_call!(
+            || { unsafe { libc::sendfile(write_fd, file_fd, std::ptr::null_mut(), 5) } },
+            &[]
+        )?;
+        test_utils::result_assert_eq(rv, 5, "Expected to send 5 bytes")?;
+
+        let pos = unsafe { libc::lseek(file_fd, 0, libc::SEEK_CUR) };
+        test_utils::result_assert_eq(pos, 5, "Unexpected file position")?;
+
+        let rv = test_utils::check_system_call!(
+            || {
+                unsafe {
+                    libc::read(
+                        read_fd,
+                        read_buf.as_mut_ptr() as *mut libc::c_void,
+                        read_buf.len(),
+                    )
+                }
+            },
+            &[]
+        )?;
+        test_utils::result_assert_eq(&read_buf[..rv as usize], &b"hello"[..], "Buffers differ")?;
+
+        // the input must be a regular file
+        test_utils::check_system_call!(
+            || { unsafe { libc::sendfile(write_fd, read_fd, std::ptr::null_mut(), 5) } },
+            &[libc::EINVAL]
+        )?;
+
+        Ok(())
+    });
+
+    std::fs::remove_file(path).map_err(|e| e.to_string())?;
+    rv
+}
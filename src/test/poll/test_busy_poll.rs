@@ -0,0 +1,129 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+// Tight loops of non-blocking syscalls that wait for a file to become ready. Under Shadow with
+// `experimental.busy_poll_threshold` set, the thread is blocked after enough unready syscalls in a
+// row, which lets simulated time advance. These check that the loops still finish, that simulated
+// time has moved forward by the time they do, and that every syscall returned the correct
+// readiness even though some of them were elided.
+
+use std::time::{Duration, Instant};
+
+const WRITE_DELAY: Duration = Duration::from_millis(10);
+
+fn pipe() -> (libc::c_int, libc::c_int) {
+    let mut fds = [0; 2];
+    assert_eq!(
+        unsafe { libc::pipe2(fds.as_mut_ptr(), libc::O_NONBLOCK) },
+        0
+    );
+    (fds[0], fds[1])
+}
+
+fn close(fd: libc::c_int) {
+    assert_eq!(unsafe { libc::close(fd) }, 0);
+}
+
+/// Write a byte to `fd` from another thread after `WRITE_DELAY`.
+fn write_later(fd: libc::c_int) -> std::thread::JoinHandle<()> {
+    std::thread::spawn(move || {
+        std::thread::sleep(WRITE_DELAY);
+        assert_eq!(unsafe { libc::write(fd, b"x".as_ptr().cast(), 1) }, 1);
+    })
+}
+
+/// Poll with a zero timeout until the pipe is readable.
+fn test_poll_until_readable() {
+    let (read_fd, write_fd) = pipe();
+    let start = Instant::now();
+    let writer = write_later(write_fd);
+
+    let mut num_polls = 0u64;
+    loop {
+        let mut pfd = libc::pollfd {
+            fd: read_fd,
+            events: libc::POLLIN,
+            revents: 0,
+        };
+        let rv = unsafe { libc::poll(&mut pfd, 1, 0) };
+        num_polls += 1;
+        if rv == 0 {
+            assert_eq!(pfd.revents, 0);
+            continue;
+        }
+        assert_eq!(rv, 1);
+        assert_eq!(pfd.revents, libc::POLLIN);
+        break;
+    }
+
+    // it can't have become readable before it was written
+    assert!(start.elapsed() >= WRITE_DELAY);
+    assert!(num_polls > 1);
+
+    let mut buf = [0u8; 2];
+    assert_eq!(
+        unsafe { libc::read(read_fd, buf.as_mut_ptr().cast(), buf.len()) },
+        1
+    );
+    assert_eq!(buf[0], b'x');
+
+    writer.join().unwrap();
+    close(read_fd);
+    close(write_fd);
+}
+
+/// Read until the pipe has data, retrying on `EAGAIN`.
+fn test_read_until_readable() {
+    let (read_fd, write_fd) = pipe();
+    let start = Instant::now();
+    let writer = write_later(write_fd);
+
+    let mut buf = [0u8; 2];
+    loop {
+        let rv = unsafe { libc::read(read_fd, buf.as_mut_ptr().cast(), buf.len()) };
+        if rv < 0 {
+            assert_eq!(
+                std::io::Error::last_os_error().raw_os_error(),
+                Some(libc::EAGAIN)
+            );
+            continue;
+        }
+        assert_eq!(rv, 1);
+        assert_eq!(buf[0], b'x');
+        break;
+    }
+
+    assert!(start.elapsed() >= WRITE_DELAY);
+
+    writer.join().unwrap();
+    close(read_fd);
+    close(write_fd);
+}
+
+/// Poll a pipe that never becomes readable until a deadline passes. Nothing else in the process
+/// runs, so only the blocked polls move simulated time forward.
+fn test_poll_until_deadline() {
+    let (read_fd, write_fd) = pipe();
+    let deadline = Instant::now() + Duration::from_millis(50);
+
+    while Instant::now() < deadline {
+        let mut pfd = libc::pollfd {
+            fd: read_fd,
+            events: libc::POLLIN,
+            revents: 0,
+        };
+        assert_eq!(unsafe { libc::poll(&mut pfd, 1, 0) }, 0);
+        assert_eq!(pfd.revents, 0);
+    }
+
+    close(read_fd);
+    close(write_fd);
+}
+
+fn main() {
+    test_poll_until_readable();
+    test_read_until_readable();
+    test_poll_until_deadline();
+}
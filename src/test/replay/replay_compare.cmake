@@ -0,0 +1,28 @@
+macro(EXEC_DIFF_CHECK FILE1 FILE2)
+    execute_process(
+        COMMAND ${CMAKE_COMMAND} -E compare_files ${FILE1} ${FILE2}
+        RESULT_VARIABLE RESULT
+        OUTPUT_VARIABLE STDOUTPUT
+        ERROR_VARIABLE STDERROR)
+    message(STATUS "Diff returned ${RESULT} for 'diff ${FILE1} ${FILE2}'")
+    if(RESULT)
+        message(STATUS "Diff stdout is: ${STDOUTPUT}")
+        message(STATUS "Diff stderr is: ${STDERROR}")
+        message(FATAL_ERROR "Differences found; test failed")
+    endif()
+endmacro()
+
+## the replayed client must behave exactly as it did when it was recorded
+exec_diff_check(
+    ${CMAKE_BINARY_DIR}/replay-record-shadow.data/hosts/client/test-replay.1000.stdout
+    ${CMAKE_BINARY_DIR}/replay-replay-shadow.data/hosts/client/test-replay.1000.stdout
+)
+exec_diff_check(
+    ${CMAKE_BINARY_DIR}/replay-record-shadow.data/hosts/client/test-replay.1000.strace
+    ${CMAKE_BINARY_DIR}/replay-replay-shadow.data/hosts/client/test-replay.1000.strace
+)
+
+## and the replayed run must not have built the server
+if(EXISTS ${CMAKE_BINARY_DIR}/replay-replay-shadow.data/hosts/server)
+    message(FATAL_ERROR "The server was built in the replayed run")
+endif()
@@ -0,0 +1,110 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+/* A UDP client and echo server. The client looks up the server by name, so a replay of the client
+ * only matches its recording if the server's name still resolves. */
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define PORT 8765
+#define NUM_MESSAGES 10
+
+static int _run_server(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        char buf[64];
+        struct sockaddr_in peer = {0};
+        socklen_t peer_len = sizeof(peer);
+        ssize_t len = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*)&peer, &peer_len);
+        if (len < 0) {
+            perror("recvfrom");
+            return EXIT_FAILURE;
+        }
+        if (sendto(fd, buf, len, 0, (struct sockaddr*)&peer, peer_len) != len) {
+            perror("sendto");
+            return EXIT_FAILURE;
+        }
+    }
+
+    close(fd);
+    return EXIT_SUCCESS;
+}
+
+static int _run_client(const char* server) {
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+    struct addrinfo* info = NULL;
+    int rv = getaddrinfo(server, NULL, &hints, &info);
+    if (rv != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_in addr = *(struct sockaddr_in*)info->ai_addr;
+    addr.sin_port = htons(PORT);
+    freeaddrinfo(info);
+
+    printf("resolved %s to %s\n", server, inet_ntoa(addr.sin_addr));
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        char buf[64];
+        int len = snprintf(buf, sizeof(buf), "message %d", i);
+        if (sendto(fd, buf, len, 0, (struct sockaddr*)&addr, sizeof(addr)) != len) {
+            perror("sendto");
+            return EXIT_FAILURE;
+        }
+
+        ssize_t recv_len = recv(fd, buf, sizeof(buf) - 1, 0);
+        if (recv_len < 0) {
+            perror("recv");
+            return EXIT_FAILURE;
+        }
+        buf[recv_len] = '\0';
+        printf("received '%s'\n", buf);
+    }
+
+    close(fd);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 2 && strcmp(argv[1], "server") == 0) {
+        return _run_server();
+    }
+    if (argc == 3 && strcmp(argv[1], "client") == 0) {
+        return _run_client(argv[2]);
+    }
+
+    fprintf(stderr, "Usage: %s server | client <server-name>\n", argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,51 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+/* Sleeps in short steps until it receives SIGTERM or a timeout expires, and prints how long it ran
+ * for. The round hook test sends the signal from its peer program at a set time. */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define STEP_MS 10
+#define TIMEOUT_MS 8000
+
+static volatile sig_atomic_t _signaled = 0;
+
+static void _handle_sigterm(int sig) { _signaled = 1; }
+
+static int64_t _now_ms(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+        perror("clock_gettime");
+        exit(EXIT_FAILURE);
+    }
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int main(int argc, char* argv[]) {
+    struct sigaction action = {.sa_handler = _handle_sigterm};
+    if (sigaction(SIGTERM, &action, NULL) < 0) {
+        perror("sigaction");
+        return EXIT_FAILURE;
+    }
+
+    int64_t start = _now_ms();
+    while (!_signaled && _now_ms() - start < TIMEOUT_MS) {
+        struct timespec step = {.tv_sec = 0, .tv_nsec = STEP_MS * 1000000};
+        // interrupted by the signal
+        nanosleep(&step, NULL);
+    }
+
+    if (_signaled) {
+        printf("signaled after %lld ms\n", (long long)(_now_ms() - start));
+    } else {
+        printf("timed out\n");
+    }
+    return EXIT_SUCCESS;
+}
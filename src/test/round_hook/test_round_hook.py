@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+
+import glob, json, os, re, socket, subprocess, sys, tempfile
+
+DESCRIPTION = """
+Runs Shadow with experimental.round_hook_socket set to a socket that this script
+listens on, replies to Shadow's reports as the round hook, and checks the
+reports and the simulation's results:
+
+$ test_round_hook.py SHADOW CONFIG MODE
+
+MODE is one of:
+  signal        let Shadow run one second at a time, and signal the host at 5 s
+  run-to-end    let Shadow run to the end after the first report
+  unknown-host  send an event for a host that doesn't exist
+"""
+
+SEC_NS = 1_000_000_000
+# see round_hook.yaml
+END_NS = 10 * SEC_NS
+START_NS = 1 * SEC_NS
+SIGNAL_NS = 5 * SEC_NS
+
+def reply_signal(report):
+    sim_time = report['sim_time_ns']
+    events = []
+    if sim_time == 2 * SEC_NS:
+        # not checked other than that it's accepted
+        events.append({'time_ns': sim_time, 'host': 'waiter',
+                       'action': {'set_bandwidth': {'up_bits': 10_000_000}}})
+    if sim_time == SIGNAL_NS:
+        # at exactly the reported time, which Shadow must not have run past
+        events.append({'time_ns': sim_time, 'host': 'waiter',
+                       'action': {'signal': {'signal': 'SIGTERM'}}})
+    return {'run_until_ns': sim_time + SEC_NS, 'events': events}
+
+def reply_run_to_end(report):
+    return {'run_until_ns': None}
+
+def reply_unknown_host(report):
+    return {'run_until_ns': None, 'events': [
+        {'time_ns': START_NS, 'host': 'nosuchhost',
+         'action': {'signal': {'signal': 'SIGTERM'}}}]}
+
+REPLIES = {
+    'signal': reply_signal,
+    'run-to-end': reply_run_to_end,
+    'unknown-host': reply_unknown_host,
+}
+
+def run(shadow, config, mode, data_dir):
+    '''
+    Run Shadow with this script as its round hook. Returns the reports that Shadow sent, its exit
+    code, and its stderr.
+    '''
+    reply = REPLIES[mode]
+    reports = []
+
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, 'hook.sock')
+        listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        listener.bind(path)
+        listener.listen(1)
+        listener.settimeout(60)
+
+        proc = subprocess.Popen(
+            [shadow, f'--data-directory={data_dir}', '--log-level=info', '--parallelism=1',
+             '--use-cpu-pinning=false', f'--round-hook-socket={path}', config],
+            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+
+        conn, _ = listener.accept()
+        with conn, conn.makefile('rw') as stream:
+            for line in stream:
+                report = json.loads(line)
+                reports.append(report)
+                if report['finished']:
+                    break
+                stream.write(json.dumps(reply(report)) + '\n')
+                stream.flush()
+
+        _, stderr = proc.communicate(timeout=60)
+
+    return reports, proc.returncode, stderr
+
+def read_stdout(data_dir):
+    paths = glob.glob(os.path.join(data_dir, 'hosts', 'waiter', '*.stdout'))
+    assert len(paths) == 1, paths
+    with open(paths[0]) as f:
+        return f.read()
+
+def check_reports(reports, expected_times):
+    '''
+    Check that Shadow synced at each of `expected_times` and then sent a finished report.
+    '''
+    times = [x['sim_time_ns'] for x in reports]
+    assert times == expected_times + [END_NS], times
+    assert [x['finished'] for x in reports] == [False] * len(expected_times) + [True]
+    assert all(x['end_time_ns'] == END_NS for x in reports)
+
+    rounds = [x['rounds_executed'] for x in reports]
+    assert rounds == sorted(rounds), rounds
+    assert rounds[-1] > 0
+
+def main():
+    if len(sys.argv) != 4 or sys.argv[3] not in REPLIES:
+        print(DESCRIPTION, file=sys.stderr)
+        sys.exit(1)
+    shadow, config, mode = sys.argv[1:]
+    data_dir = f'round-hook-{mode}-shadow.data'
+    subprocess.run(['rm', '-rf', data_dir], check=True)
+
+    reports, returncode, stderr = run(shadow, config, mode, data_dir)
+
+    if mode == 'signal':
+        assert returncode == 0, stderr
+        # a sync at each second before the end
+        check_reports(reports, [x * SEC_NS for x in range(END_NS // SEC_NS)])
+        output = read_stdout(data_dir)
+        m = re.fullmatch(r'signaled after (\d+) ms\n', output)
+        assert m, output
+        # the process ran from its start until the hook's signal, give or take the syscall
+        # latencies
+        expected_ms = (SIGNAL_NS - START_NS) // 1_000_000
+        assert abs(int(m.group(1)) - expected_ms) <= 10, output
+    elif mode == 'run-to-end':
+        assert returncode == 0, stderr
+        # no syncs after the first, since the reply let Shadow run to the end
+        check_reports(reports, [0])
+        assert read_stdout(data_dir) == 'timed out\n'
+    elif mode == 'unknown-host':
+        assert returncode != 0
+        assert 'The round hook sent events for unknown hosts: ["nosuchhost"]' in stderr, stderr
+        # the simulation failed at the first sync, so it didn't finish
+        assert len(reports) == 1 and not reports[0]['finished'], reports
+
+    print(f'{len(reports)} reports')
+
+if __name__ == '__main__':
+    main()
@@ -69,6 +69,11 @@ fn get_tests() -> Vec<test_utils::ShadowTest<(), String>> {
                 move || test_invalid_sock_type(accept_fn),
                 set![TestEnv::Libc, TestEnv::Shadow],
             ),
+            test_utils::ShadowTest::new(
+                &append_args("test_interrupted"),
+                move || test_interrupted(accept_fn),
+                set![TestEnv::Libc, TestEnv::Shadow],
+            ),
         ]);
 
         let accept_flags = [
@@ -306,6 +311,63 @@ fn test_invalid_sock_type(accept_fn: AcceptFn) -> Result<(), String> {
     })
 }
 
+extern "C" fn nop_signal_handler(_sig: libc::c_int) {}
+
+/// Test that an accept that's interrupted by a signal returns EINTR, and doesn't keep the
+/// listening socket open after it's closed.
+fn test_interrupted(accept_fn: AcceptFn) -> Result<(), String> {
+    // no SA_RESTART, so the accept isn't restarted
+    let mut action: libc::sigaction = unsafe { std::mem::zeroed() };
+    action.sa_sigaction = nop_signal_handler as libc::sighandler_t;
+    let rv = unsafe { libc::sigaction(libc::SIGUSR1, &action, std::ptr::null_mut()) };
+    assert_eq!(rv, 0);
+
+    let fd = unsafe { libc::socket(libc::AF_INET, libc::SOCK_STREAM, 0) };
+    assert!(fd >= 0);
+    let (addr, addr_len) = socket_utils::autobind_helper(fd, libc::AF_INET);
+    let rv = unsafe { libc::listen(fd, 10) };
+    assert_eq!(rv, 0);
+
+    let (tid_sender, tid_receiver) = std::sync::mpsc::channel();
+    let handle = std::thread::spawn(move || {
+        tid_sender
+            .send(unsafe { libc::syscall(libc::SYS_gettid) } as libc::pid_t)
+            .unwrap();
+        let mut args = AcceptArguments {
+            fd,
+            addr: None,
+            addr_len: None,
+            flags: 0,
+        };
+        check_accept_call(&mut args, accept_fn, Some(libc::EINTR)).map(|_| ())
+    });
+    let tid = tid_receiver.recv().unwrap();
+
+    // wait until the thread is blocked in accept (hopefully)
+    std::thread::sleep(std::time::Duration::from_millis(10));
+    let rv = unsafe { libc::syscall(libc::SYS_tgkill, libc::getpid(), tid, libc::SIGUSR1) };
+    assert_eq!(rv, 0);
+    let result = handle.join().unwrap();
+
+    let rv = unsafe { libc::close(fd) };
+    assert_eq!(rv, 0);
+
+    // the closed socket no longer has the port, so another socket can bind to it
+    let fd = unsafe { libc::socket(libc::AF_INET, libc::SOCK_STREAM, 0) };
+    assert!(fd >= 0);
+    let bind_result = test_utils::run_and_close_fds(&[fd], || {
+        let rv = unsafe { libc::bind(fd, addr.as_ptr(), addr_len) };
+        test_utils::result_assert_eq(rv, 0, "Could not bind to the closed socket's address")
+    });
+
+    action.sa_sigaction = libc::SIG_DFL;
+    let rv = unsafe { libc::sigaction(libc::SIGUSR1, &action, std::ptr::null_mut()) };
+    assert_eq!(rv, 0);
+
+    result?;
+    bind_result
+}
+
 /// Test accept using a non-listening socket.
 fn test_non_listening_fd(
     accept_fn: AcceptFn,
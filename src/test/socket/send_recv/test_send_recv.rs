@@ -72,7 +72,6 @@ enum SendRecvMethod {
     #[allow(dead_code)]
     Msg,
     /// For `sendmmsg()`/`recvmmsg()`.
-    #[allow(dead_code)]
     Mmsg,
 }
 
@@ -103,8 +102,7 @@ fn get_tests() -> Vec<test_utils::ShadowTest<(), String>> {
     let sys_methods = [
         SendRecvMethod::ToFrom,
         SendRecvMethod::Msg,
-        // TODO: support sendmmsg/recvmmsg
-        //SendRecvMethod::Mmsg,
+        SendRecvMethod::Mmsg,
     ];
 
     for &sys_method in sys_methods.iter() {
@@ -469,11 +467,35 @@ fn get_tests() -> Vec<test_utils::ShadowTest<(), String>> {
         }
     }
 
-    tests.extend(vec![test_utils::ShadowTest::new(
-        "test_unix_dgram_multiple_senders",
-        test_unix_dgram_multiple_senders,
-        set![TestEnv::Libc, TestEnv::Shadow],
-    )]);
+    tests.extend(vec![
+        test_utils::ShadowTest::new(
+            "test_unix_dgram_multiple_senders",
+            test_unix_dgram_multiple_senders,
+            set![TestEnv::Libc, TestEnv::Shadow],
+        ),
+        test_utils::ShadowTest::new(
+            "test_recvfrom_interrupted",
+            test_recvfrom_interrupted,
+            set![TestEnv::Libc, TestEnv::Shadow],
+        ),
+    ]);
+
+    for &init_method in &init_methods {
+        let append_args = |s| format!("{s} <init_method={init_method:?}>");
+
+        tests.extend(vec![
+            test_utils::ShadowTest::new(
+                &append_args("test_mmsg_batch_dgram"),
+                move || test_mmsg_batch_dgram(init_method),
+                set![TestEnv::Libc, TestEnv::Shadow],
+            ),
+            test_utils::ShadowTest::new(
+                &append_args("test_sendmmsg_partial_efault"),
+                move || test_sendmmsg_partial_efault(init_method),
+                set![TestEnv::Libc, TestEnv::Shadow],
+            ),
+        ]);
+    }
 
     tests
 }
@@ -1118,6 +1140,62 @@ fn test_blocking(
     })
 }
 
+extern "C" fn nop_signal_handler(_sig: libc::c_int) {}
+
+/// Test that a recvfrom() that's interrupted by a signal returns EINTR, and doesn't keep the
+/// socket open after it's closed.
+fn test_recvfrom_interrupted() -> Result<(), String> {
+    // no SA_RESTART, so the recvfrom() isn't restarted
+    let mut action: libc::sigaction = unsafe { std::mem::zeroed() };
+    action.sa_sigaction = nop_signal_handler as libc::sighandler_t;
+    let rv = unsafe { libc::sigaction(libc::SIGUSR1, &action, std::ptr::null_mut()) };
+    assert_eq!(rv, 0);
+
+    let fd = unsafe { libc::socket(libc::AF_INET, libc::SOCK_DGRAM, 0) };
+    assert!(fd >= 0);
+    let (addr, addr_len) = autobind_helper(fd, libc::AF_INET);
+
+    let (tid_sender, tid_receiver) = std::sync::mpsc::channel();
+    let handle = std::thread::spawn(move || {
+        tid_sender
+            .send(unsafe { libc::syscall(libc::SYS_gettid) } as libc::pid_t)
+            .unwrap();
+        let mut buf = [0u8; 10];
+        let mut args = RecvfromArguments {
+            fd,
+            len: buf.len(),
+            buf: Some(&mut buf),
+            ..Default::default()
+        };
+        check_recv_call(&mut args, SendRecvMethod::ToFrom, &[libc::EINTR], false).map(|_| ())
+    });
+    let tid = tid_receiver.recv().unwrap();
+
+    // wait until the thread is blocked in recvfrom() (hopefully)
+    std::thread::sleep(std::time::Duration::from_millis(10));
+    let rv = unsafe { libc::syscall(libc::SYS_tgkill, libc::getpid(), tid, libc::SIGUSR1) };
+    assert_eq!(rv, 0);
+    let result = handle.join().unwrap();
+
+    let rv = unsafe { libc::close(fd) };
+    assert_eq!(rv, 0);
+
+    // the closed socket no longer has the port, so another socket can bind to it
+    let fd = unsafe { libc::socket(libc::AF_INET, libc::SOCK_DGRAM, 0) };
+    assert!(fd >= 0);
+    let bind_result = test_utils::run_and_close_fds(&[fd], || {
+        let rv = unsafe { libc::bind(fd, addr.as_ptr(), addr_len) };
+        test_utils::result_assert_eq(rv, 0, "Could not bind to the closed socket's address")
+    });
+
+    action.sa_sigaction = libc::SIG_DFL;
+    let rv = unsafe { libc::sigaction(libc::SIGUSR1, &action, std::ptr::null_mut()) };
+    assert_eq!(rv, 0);
+
+    result?;
+    bind_result
+}
+
 /// Test sendto() and recvfrom() using a non-blocking stream socket.
 fn test_nonblocking_stream(
     sys_method: SendRecvMethod,
@@ -2439,6 +2517,219 @@ fn test_unix_dgram_multiple_senders() -> Result<(), String> {
     Ok(())
 }
 
+/// Test sendmmsg() and recvmmsg() with multiple datagrams in a single call.
+fn test_mmsg_batch_dgram(init_method: SocketInitMethod) -> Result<(), String> {
+    let (fd_client, fd_server) = socket_init_helper(
+        init_method,
+        libc::SOCK_DGRAM,
+        0,
+        /* bind_client = */ false,
+    );
+
+    test_utils::run_and_close_fds(&[fd_client, fd_server], || {
+        let mut send_bufs = [vec![1u8; 1], vec![2u8; 3], vec![3u8; 5]];
+        let mut send_iovs: Vec<libc::iovec> = send_bufs
+            .iter_mut()
+            .map(|buf| libc::iovec {
+                iov_base: buf.as_mut_ptr() as *mut core::ffi::c_void,
+                iov_len: buf.len(),
+            })
+            .collect();
+        let mut send_msgs: Vec<libc::mmsghdr> = send_iovs
+            .iter_mut()
+            .map(|iov| libc::mmsghdr {
+                msg_hdr: libc::msghdr {
+                    msg_name: std::ptr::null_mut(),
+                    msg_namelen: 0,
+                    msg_iov: iov,
+                    msg_iovlen: 1,
+                    msg_control: std::ptr::null_mut(),
+                    msg_controllen: 0,
+                    msg_flags: 0,
+                },
+                msg_len: 0,
+            })
+            .collect();
+
+        // send all 3 messages in a single call
+        let rv = test_utils::check_system_call!(
+            || unsafe {
+                libc::sendmmsg(fd_client, send_msgs.as_mut_ptr(), send_msgs.len() as u32, 0)
+            },
+            &[],
+        )?;
+        test_utils::result_assert_eq(rv, 3, "Unexpected number of messages sent")?;
+        for (msg, buf) in send_msgs.iter().zip(&send_bufs) {
+            test_utils::result_assert_eq(
+                msg.msg_len as usize,
+                buf.len(),
+                "Unexpected number of bytes sent",
+            )?;
+        }
+
+        // shadow needs to run events
+        assert_eq!(unsafe { libc::usleep(10000) }, 0);
+
+        let mut recv_bufs = [[0u8; 10]; 4];
+        let mut recv_iovs: Vec<libc::iovec> = recv_bufs
+            .iter_mut()
+            .map(|buf| libc::iovec {
+                iov_base: buf.as_mut_ptr() as *mut core::ffi::c_void,
+                iov_len: buf.len(),
+            })
+            .collect();
+        let mut recv_msgs: Vec<libc::mmsghdr> = recv_iovs
+            .iter_mut()
+            .map(|iov| libc::mmsghdr {
+                msg_hdr: libc::msghdr {
+                    msg_name: std::ptr::null_mut(),
+                    msg_namelen: 0,
+                    msg_iov: iov,
+                    msg_iovlen: 1,
+                    msg_control: std::ptr::null_mut(),
+                    msg_controllen: 0,
+                    msg_flags: 0,
+                },
+                msg_len: 0,
+            })
+            .collect();
+
+        // ask for 4 messages without blocking; should receive the 3 that were sent
+        let rv = test_utils::check_system_call!(
+            || unsafe {
+                libc::recvmmsg(
+                    fd_server,
+                    recv_msgs.as_mut_ptr(),
+                    recv_msgs.len() as u32,
+                    libc::MSG_DONTWAIT,
+                    std::ptr::null_mut(),
+                )
+            },
+            &[],
+        )?;
+        test_utils::result_assert_eq(rv, 3, "Unexpected number of messages received")?;
+        for ((msg, recv_buf), send_buf) in recv_msgs.iter().zip(&recv_bufs).zip(&send_bufs) {
+            test_utils::result_assert_eq(
+                &recv_buf[..msg.msg_len as usize],
+                &send_buf[..],
+                "Unexpected message received",
+            )?;
+        }
+
+        // no more messages are buffered
+        test_utils::check_system_call!(
+            || unsafe {
+                libc::recvmmsg(
+                    fd_server,
+                    recv_msgs.as_mut_ptr(),
+                    recv_msgs.len() as u32,
+                    libc::MSG_DONTWAIT,
+                    std::ptr::null_mut(),
+                )
+            },
+            &[libc::EAGAIN],
+        )?;
+
+        Ok(())
+    })
+}
+
+/// Test that sendmmsg() returns the messages sent so far when a later message has a bad address.
+fn test_sendmmsg_partial_efault(init_method: SocketInitMethod) -> Result<(), String> {
+    let (fd_client, fd_server) = socket_init_helper(
+        init_method,
+        libc::SOCK_DGRAM,
+        0,
+        /* bind_client = */ false,
+    );
+
+    test_utils::run_and_close_fds(&[fd_client, fd_server], || {
+        let mut send_bufs = [vec![1u8; 1], vec![2u8; 3]];
+        let mut send_iovs: Vec<libc::iovec> = send_bufs
+            .iter_mut()
+            .map(|buf| libc::iovec {
+                iov_base: buf.as_mut_ptr() as *mut core::ffi::c_void,
+                iov_len: buf.len(),
+            })
+            .collect();
+        let mut send_msgs: Vec<libc::mmsghdr> = send_iovs
+            .iter_mut()
+            .map(|iov| libc::mmsghdr {
+                msg_hdr: libc::msghdr {
+                    msg_name: std::ptr::null_mut(),
+                    msg_namelen: 0,
+                    msg_iov: iov,
+                    msg_iovlen: 1,
+                    msg_control: std::ptr::null_mut(),
+                    msg_controllen: 0,
+                    msg_flags: 0,
+                },
+                msg_len: 0,
+            })
+            .collect();
+
+        // the second message's address can't be read
+        send_msgs[1].msg_hdr.msg_name = 1 as *mut core::ffi::c_void;
+        send_msgs[1].msg_hdr.msg_namelen =
+            std::mem::size_of::<libc::sockaddr_in>() as libc::socklen_t;
+
+        // the first message was sent, so the call succeeds
+        let rv = test_utils::check_system_call!(
+            || unsafe {
+                libc::sendmmsg(fd_client, send_msgs.as_mut_ptr(), send_msgs.len() as u32, 0)
+            },
+            &[],
+        )?;
+        test_utils::result_assert_eq(rv, 1, "Unexpected number of messages sent")?;
+        test_utils::result_assert_eq(
+            send_msgs[0].msg_len as usize,
+            send_bufs[0].len(),
+            "Unexpected number of bytes sent",
+        )?;
+
+        // if no message was sent, the error is returned
+        test_utils::check_system_call!(
+            || unsafe { libc::sendmmsg(fd_client, send_msgs[1..].as_mut_ptr(), 1, 0) },
+            &[libc::EFAULT],
+        )?;
+
+        // shadow needs to run events
+        assert_eq!(unsafe { libc::usleep(10000) }, 0);
+
+        // only the first message was received
+        let mut recv_buf = [0u8; 10];
+        let rv = test_utils::check_system_call!(
+            || unsafe {
+                libc::recv(
+                    fd_server,
+                    recv_buf.as_mut_ptr() as *mut core::ffi::c_void,
+                    recv_buf.len(),
+                    libc::MSG_DONTWAIT,
+                )
+            },
+            &[],
+        )?;
+        test_utils::result_assert_eq(
+            &recv_buf[..rv as usize],
+            &send_bufs[0][..],
+            "Unexpected message received",
+        )?;
+        test_utils::check_system_call!(
+            || unsafe {
+                libc::recv(
+                    fd_server,
+                    recv_buf.as_mut_ptr() as *mut core::ffi::c_void,
+                    recv_buf.len(),
+                    libc::MSG_DONTWAIT,
+                )
+            },
+            &[libc::EAGAIN],
+        )?;
+
+        Ok(())
+    })
+}
+
 /// A helper function to call sendto() and recvfrom() with valid values
 /// and a user-provided fd.
 fn fd_test_helper(
@@ -2614,7 +2905,33 @@ fn check_send_call(
             )?
         }
         SendRecvMethod::Mmsg => {
-            todo!();
+            let mut iov = libc::iovec {
+                // casting a const pointer to a mut pointer, but syscall should not mutate data
+                iov_base: buf_ptr as *mut core::ffi::c_void,
+                iov_len: args.len,
+            };
+            let mut msgs = [libc::mmsghdr {
+                msg_hdr: libc::msghdr {
+                    // casting a const pointer to a mut pointer, but syscall should not mutate data
+                    msg_name: addr_ptr as *mut _,
+                    msg_namelen: args.addr_len,
+                    msg_iov: &mut iov,
+                    msg_iovlen: 1,
+                    msg_control: std::ptr::null_mut(),
+                    msg_controllen: 0,
+                    msg_flags: 0,
+                },
+                msg_len: 0,
+            }];
+            let rv = test_utils::check_system_call!(
+                || unsafe { libc::sendmmsg(args.fd, msgs.as_mut_ptr(), 1, args.flags) },
+                expected_errnos,
+            )?;
+            // return the number of bytes sent rather than the number of messages
+            match rv {
+                1 => msgs[0].msg_len as libc::ssize_t,
+                rv => rv as libc::ssize_t,
+            }
         }
     };
 
@@ -2699,7 +3016,43 @@ fn check_recv_call(
             (rv, Some(msg.msg_flags))
         }
         SendRecvMethod::Mmsg => {
-            todo!();
+            let mut iov = libc::iovec {
+                iov_base: buf_ptr as *mut core::ffi::c_void,
+                iov_len: args.len,
+            };
+            let mut msgs = [libc::mmsghdr {
+                msg_hdr: libc::msghdr {
+                    msg_name: addr_ptr as *mut libc::c_void,
+                    msg_namelen: args.addr_len.unwrap_or(0),
+                    msg_iov: &mut iov,
+                    msg_iovlen: 1,
+                    msg_control: std::ptr::null_mut(),
+                    msg_controllen: 0,
+                    msg_flags: 0,
+                },
+                msg_len: 0,
+            }];
+            let rv = test_utils::check_system_call!(
+                || unsafe {
+                    libc::recvmmsg(
+                        args.fd,
+                        msgs.as_mut_ptr(),
+                        1,
+                        args.flags,
+                        std::ptr::null_mut(),
+                    )
+                },
+                expected_errnos,
+            )?;
+            if let Some(ref mut addr_len) = args.addr_len {
+                *addr_len = msgs[0].msg_hdr.msg_namelen;
+            }
+            // return the number of bytes received rather than the number of messages
+            let rv = match rv {
+                1 => msgs[0].msg_len as libc::ssize_t,
+                rv => rv as libc::ssize_t,
+            };
+            (rv, Some(msgs[0].msg_hdr.msg_flags))
         }
     };
 
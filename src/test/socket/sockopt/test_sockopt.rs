@@ -195,6 +195,11 @@ fn get_tests() -> Vec<test_utils::ShadowTest<(), String>> {
                     move || test_tcp_nodelay(domain, sock_type),
                     set![TestEnv::Libc, TestEnv::Shadow],
                 ),
+                test_utils::ShadowTest::new(
+                    &append_args("test_tcp_cork"),
+                    move || test_tcp_cork(domain, sock_type),
+                    set![TestEnv::Libc, TestEnv::Shadow],
+                ),
                 test_utils::ShadowTest::new(
                     &append_args("test_tcp_congestion"),
                     move || test_tcp_congestion(domain, sock_type),
@@ -807,40 +812,50 @@ fn test_tcp_info(domain: libc::c_int, sock_type: libc::c_int) -> Result<(), Stri
 
 /// Test getsockopt() and setsockopt() using the TCP_NODELAY option.
 fn test_tcp_nodelay(domain: libc::c_int, sock_type: libc::c_int) -> Result<(), String> {
+    test_tcp_bool_option(domain, sock_type, libc::TCP_NODELAY)
+}
+
+/// Test getsockopt() and setsockopt() using the TCP_CORK option.
+fn test_tcp_cork(domain: libc::c_int, sock_type: libc::c_int) -> Result<(), String> {
+    test_tcp_bool_option(domain, sock_type, libc::TCP_CORK)
+}
+
+/// Test getsockopt() and setsockopt() using a boolean TCP option that is off by default.
+fn test_tcp_bool_option(
+    domain: libc::c_int,
+    sock_type: libc::c_int,
+    optname: libc::c_int,
+) -> Result<(), String> {
     let fd = unsafe { libc::socket(domain, sock_type, 0) };
     assert!(fd >= 0);
 
     let level = libc::SOL_TCP;
-    let optname = libc::TCP_NODELAY;
 
-    // shadow doesn't support setting a value of 0
-    let optval = 1i32.to_ne_bytes();
+    let one = 1i32.to_ne_bytes();
     let zero = 0i32.to_ne_bytes();
 
-    let mut get_args_1 = GetsockoptArguments::new(fd, level, optname, Some(zero.into()));
-    let mut get_args_2 = GetsockoptArguments::new(fd, level, optname, Some(zero.into()));
-    let mut set_args = SetsockoptArguments::new(fd, level, optname, Some(optval.into()));
-
     test_utils::run_and_close_fds(&[fd], || {
         let expected_errnos = if sock_type == libc::SOCK_STREAM {
             vec![]
         } else {
             vec![libc::ENOPROTOOPT, libc::EOPNOTSUPP]
         };
-        check_getsockopt_call(&mut get_args_1, &expected_errnos)?;
 
-        if sock_type == libc::SOCK_STREAM {
-            // in shadow will return 1, but in linux will return 0
-            let value = u32::from_ne_bytes(get_args_1.optval.unwrap().try_into().unwrap());
-            test_utils::result_assert([0, 1].contains(&value), "Unexpected value for TCP_NODELAY")?;
-        }
+        // the option is off by default, and can be turned on and off again
+        for (set_value, expected) in [(None, 0), (Some(one), 1), (Some(zero), 0)] {
+            if let Some(set_value) = set_value {
+                let mut set_args =
+                    SetsockoptArguments::new(fd, level, optname, Some(set_value.into()));
+                check_setsockopt_call(&mut set_args, &expected_errnos)?;
+            }
 
-        check_setsockopt_call(&mut set_args, &expected_errnos)?;
-        check_getsockopt_call(&mut get_args_2, &expected_errnos)?;
+            let mut get_args = GetsockoptArguments::new(fd, level, optname, Some(one.into()));
+            check_getsockopt_call(&mut get_args, &expected_errnos)?;
 
-        if sock_type == libc::SOCK_STREAM {
-            let value = u32::from_ne_bytes(get_args_2.optval.unwrap().try_into().unwrap());
-            test_utils::result_assert_eq(value, 1, "Unexpected value for TCP_NODELAY")?;
+            if sock_type == libc::SOCK_STREAM {
+                let value = u32::from_ne_bytes(get_args.optval.unwrap().try_into().unwrap());
+                test_utils::result_assert_eq(value, expected, "Unexpected option value")?;
+            }
         }
 
         Ok(())
@@ -859,6 +874,7 @@ fn test_tcp_congestion(domain: libc::c_int, sock_type: libc::c_int) -> Result<()
     let get_args_2 = GetsockoptArguments::new(fd, level, optname, Some(vec![0u8; 3]));
     let mut set_args_1 = SetsockoptArguments::new(fd, level, optname, Some("reno".into()));
     let mut set_args_2 = SetsockoptArguments::new(fd, level, optname, Some("ren".into()));
+    let mut set_args_3 = SetsockoptArguments::new(fd, level, optname, Some("cubic".into()));
 
     test_utils::run_and_close_fds(&[fd], || {
         for mut get_args in [get_args_1, get_args_2] {
@@ -913,6 +929,21 @@ fn test_tcp_congestion(domain: libc::c_int, sock_type: libc::c_int) -> Result<()
         };
         check_setsockopt_call(&mut set_args_1, &expected_errnos)?;
 
+        // try switching to a different valid name
+        check_setsockopt_call(&mut set_args_3, &expected_errnos)?;
+
+        if sock_type == libc::SOCK_STREAM {
+            let mut get_args = GetsockoptArguments::new(fd, level, optname, Some(vec![0u8; 16]));
+            check_getsockopt_call(&mut get_args, &[])?;
+
+            let returned_str = get_args.optval.as_ref().unwrap();
+            test_utils::result_assert_eq(
+                &returned_str[..6],
+                &b"cubic\0"[..],
+                "TCP_CONGESTION was not changed",
+            )?;
+        }
+
         // try setting an invalid name
         let expected_errnos = if sock_type == libc::SOCK_STREAM {
             vec![libc::ENOENT]
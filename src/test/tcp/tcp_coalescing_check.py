@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+
+import struct, sys
+
+'''
+Checks the data segments that each client of tcp-coalescing.yaml sent, from the client's pcap
+file. Run from the simulation's data directory.
+'''
+
+SERVER_PORT = 1234
+
+# for each client host, the payload sizes of its data segments, and the time of each segment in ms
+# after the client's last handshake packet (or None if the time isn't checked)
+EXPECTED = {
+    # Nagle's algorithm: the first write is sent, and the other writes are coalesced into one
+    # segment once it's acknowledged
+    'nagle': [(100, 0), (900, None)],
+    # TCP_NODELAY: each write is sent immediately
+    'nodelay': [(100, 0)] * 10,
+    # MSG_MORE: the writes are held until the last one
+    'msg-more': [(1000, 0)],
+    # TCP_CORK: the first writes are sent when the cork times out, and the second writes when the
+    # socket is uncorked after a 1 second sleep
+    'cork': [(1000, 200), (1000, 1000)],
+}
+
+# allow for the latency of the syscalls between the handshake and the writes
+TIME_TOLERANCE_MS = 2
+
+def read_pcap(path):
+    '''
+    Returns the timestamp in microseconds and the data of each packet in a pcap file of raw IP
+    packets.
+    '''
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    magic, = struct.unpack_from('<I', data, 0)
+    endian = '<' if magic == 0xA1B2C3D4 else '>'
+    link_type, = struct.unpack_from(endian + 'I', data, 20)
+    # LINKTYPE_RAW
+    assert link_type == 101, link_type
+
+    packets = []
+    offset = 24
+    while offset < len(data):
+        ts_sec, ts_usec, captured_len, _ = struct.unpack_from(endian + 'IIII', data, offset)
+        offset += 16
+        packets.append((ts_sec * 1_000_000 + ts_usec, data[offset:offset + captured_len]))
+        offset += captured_len
+    return packets
+
+def tcp_segments(packets):
+    '''
+    Returns the timestamp, flags, and payload length of each TCP packet sent to the server.
+    '''
+    segments = []
+    for time, packet in packets:
+        ihl = (packet[0] & 0xF) * 4
+        total_len, = struct.unpack_from('!H', packet, 2)
+        protocol = packet[9]
+        if protocol != 6:
+            continue
+        _, dst_port = struct.unpack_from('!HH', packet, ihl)
+        if dst_port != SERVER_PORT:
+            continue
+        data_offset = (packet[ihl + 12] >> 4) * 4
+        flags = packet[ihl + 13]
+        segments.append((time, flags, total_len - ihl - data_offset))
+    return segments
+
+def check_host(host, expected):
+    segments = tcp_segments(read_pcap(f'hosts/{host}/eth0.pcap'))
+
+    SYN = 0x02
+    FIN = 0x01
+    handshake = [x for x in segments if x[2] == 0 and not x[1] & FIN]
+    # the SYN and the ACK of the SYN-ACK
+    assert len(handshake) >= 2 and handshake[0][1] & SYN, (host, segments)
+    handshake_end = handshake[1][0]
+
+    data = [(x[2], (x[0] - handshake_end) / 1000) for x in segments if x[2] > 0]
+    sizes = [x[0] for x in data]
+    assert sizes == [x[0] for x in expected], (host, data)
+
+    for (_, time_ms), (_, expected_ms) in zip(data, expected):
+        if expected_ms is not None:
+            assert abs(time_ms - expected_ms) <= TIME_TOLERANCE_MS, (host, data)
+
+def main():
+    for host, expected in EXPECTED.items():
+        check_host(host, expected)
+    print(f'Checked the segments of {len(EXPECTED)} hosts')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,159 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+/* Makes small writes to a TCP socket in one of several ways that affect how they're coalesced
+ * into segments (Nagle's algorithm, TCP_NODELAY, MSG_MORE, and TCP_CORK). The segments are
+ * checked from the client's pcap file by tcp_coalescing_check.py. */
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define USAGE                                                                                      \
+    "USAGE: '%s server port num_clients' or '%s client (nagle|nodelay|msg-more|cork) server port'"
+#define WRITE_SIZE 100
+#define NUM_WRITES 10
+
+static int _set_option(int fd, int option, int value) {
+    if (setsockopt(fd, IPPROTO_TCP, option, &value, sizeof(value)) < 0) {
+        perror("setsockopt");
+        return -1;
+    }
+    return 0;
+}
+
+/* Make NUM_WRITES writes of WRITE_SIZE bytes, with `flags` on all but the last. */
+static int _write_all(int fd, int flags) {
+    char buf[WRITE_SIZE];
+    memset(buf, 'a', sizeof(buf));
+    for (int i = 0; i < NUM_WRITES; i++) {
+        int write_flags = i < NUM_WRITES - 1 ? flags : 0;
+        if (send(fd, buf, sizeof(buf), write_flags) != sizeof(buf)) {
+            perror("send");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int _run_client(const char* mode, const char* server, const char* port) {
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+    struct addrinfo* info = NULL;
+    if (getaddrinfo(server, port, &hints, &info) != 0) {
+        fprintf(stderr, "getaddrinfo failed\n");
+        return EXIT_FAILURE;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    if (connect(fd, info->ai_addr, info->ai_addrlen) < 0) {
+        perror("connect");
+        return EXIT_FAILURE;
+    }
+    freeaddrinfo(info);
+
+    if (!strcmp(mode, "nagle")) {
+        /* the first write is sent, and the rest are held until it's acknowledged */
+        if (_write_all(fd, 0) < 0) {
+            return EXIT_FAILURE;
+        }
+    } else if (!strcmp(mode, "nodelay")) {
+        /* each write is sent immediately */
+        if (_set_option(fd, TCP_NODELAY, 1) < 0 || _write_all(fd, 0) < 0) {
+            return EXIT_FAILURE;
+        }
+    } else if (!strcmp(mode, "msg-more")) {
+        /* the writes are held until the last one, which doesn't have MSG_MORE */
+        if (_set_option(fd, TCP_NODELAY, 1) < 0 || _write_all(fd, MSG_MORE) < 0) {
+            return EXIT_FAILURE;
+        }
+    } else if (!strcmp(mode, "cork")) {
+        /* the first writes are sent when the cork times out after 200 ms, and the second writes
+         * when the socket is uncorked */
+        if (_set_option(fd, TCP_CORK, 1) < 0 || _write_all(fd, 0) < 0) {
+            return EXIT_FAILURE;
+        }
+        struct timespec delay = {.tv_sec = 1, .tv_nsec = 0};
+        if (nanosleep(&delay, NULL) < 0) {
+            perror("nanosleep");
+            return EXIT_FAILURE;
+        }
+        if (_write_all(fd, 0) < 0 || _set_option(fd, TCP_CORK, 0) < 0) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        fprintf(stderr, "Unknown mode '%s'\n", mode);
+        return EXIT_FAILURE;
+    }
+
+    close(fd);
+    return EXIT_SUCCESS;
+}
+
+static int _run_server(const char* port, int num_clients) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(atoi(port)),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return EXIT_FAILURE;
+    }
+    if (listen(fd, num_clients) < 0) {
+        perror("listen");
+        return EXIT_FAILURE;
+    }
+
+    /* the clients' data is small enough to wait in the socket buffers, so it's fine to read the
+     * connections one at a time */
+    for (int i = 0; i < num_clients; i++) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            perror("accept");
+            return EXIT_FAILURE;
+        }
+
+        char buf[4096];
+        ssize_t len;
+        while ((len = recv(conn, buf, sizeof(buf), 0)) > 0) {
+        }
+        if (len < 0) {
+            perror("recv");
+            return EXIT_FAILURE;
+        }
+        close(conn);
+    }
+
+    close(fd);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 4 && !strcmp(argv[1], "server")) {
+        return _run_server(argv[2], atoi(argv[3]));
+    } else if (argc == 5 && !strcmp(argv[1], "client")) {
+        return _run_client(argv[2], argv[3], argv[4]);
+    }
+
+    fprintf(stderr, USAGE "\n", argv[0], argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,84 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+//! Tests multicast delivery between hosts. A `receiver` joins a group with its socket bound to the
+//! group's address, a `nonmember` binds the same port to the wildcard address without joining,
+//! and a `sender` sends one unicast datagram to the receiver's port followed by one datagram to
+//! the group. Only the receiver should receive a datagram, and only the group's.
+
+use std::net::{Ipv4Addr, SocketAddrV4, UdpSocket};
+use std::os::fd::AsRawFd;
+
+use nix::poll::{poll, PollFd, PollFlags};
+
+const GROUP: Ipv4Addr = Ipv4Addr::new(239, 1, 2, 3);
+const PORT: u16 = 7000;
+
+const UNICAST_MESSAGE: &[u8] = b"unicast";
+const MULTICAST_MESSAGE: &[u8] = b"multicast";
+
+/// Receive a datagram, or return `None` if none arrive within a few seconds.
+fn recv(socket: &UdpSocket) -> anyhow::Result<Option<Vec<u8>>> {
+    let mut fds = [PollFd::new(socket.as_raw_fd(), PollFlags::POLLIN)];
+    if poll(&mut fds, 3000)? == 0 {
+        return Ok(None);
+    }
+
+    let mut buf = [0; 100];
+    let len = socket.recv(&mut buf)?;
+    Ok(Some(buf[..len].to_vec()))
+}
+
+fn receiver() -> anyhow::Result<()> {
+    let socket = UdpSocket::bind(SocketAddrV4::new(GROUP, PORT))?;
+    socket.join_multicast_v4(&GROUP, &Ipv4Addr::UNSPECIFIED)?;
+
+    // a socket bound to a group's address only receives the group's datagrams, so the unicast
+    // datagram that was sent first must have been dropped
+    assert_eq!(recv(&socket)?.as_deref(), Some(MULTICAST_MESSAGE));
+    assert_eq!(recv(&socket)?, None);
+
+    socket.leave_multicast_v4(&GROUP, &Ipv4Addr::UNSPECIFIED)?;
+    Ok(())
+}
+
+fn nonmember() -> anyhow::Result<()> {
+    let socket = UdpSocket::bind(SocketAddrV4::new(Ipv4Addr::UNSPECIFIED, PORT))?;
+
+    // the host never joined the group
+    assert_eq!(recv(&socket)?, None);
+    Ok(())
+}
+
+fn sender(receiver_host: &str) -> anyhow::Result<()> {
+    let socket = UdpSocket::bind(SocketAddrV4::new(Ipv4Addr::UNSPECIFIED, 0))?;
+
+    assert_eq!(
+        socket.send_to(UNICAST_MESSAGE, (receiver_host, PORT))?,
+        UNICAST_MESSAGE.len()
+    );
+    assert_eq!(
+        socket.send_to(MULTICAST_MESSAGE, SocketAddrV4::new(GROUP, PORT))?,
+        MULTICAST_MESSAGE.len()
+    );
+    Ok(())
+}
+
+fn main() -> anyhow::Result<()> {
+    let args: Vec<String> = std::env::args().collect();
+
+    match args.get(1).map(String::as_str) {
+        Some("receiver") => receiver()?,
+        Some("nonmember") => nonmember()?,
+        Some("sender") => sender(&args[2])?,
+        _ => anyhow::bail!(
+            "Usage: {} (receiver | nonmember | sender RECEIVER)",
+            args[0]
+        ),
+    }
+
+    println!("Success.");
+    Ok(())
+}
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+
+import sys, os, argparse, errno, re, struct
+
+DESCRIPTION="""
+Converts the binary strace files written by Shadow's "binary"
+experimental.strace_logging_mode to text, with one line per syscall:
+
+$ python decode-strace.py shadow.data/hosts/client/curl.1000.strace
+
+Syscall arguments and successful return values are shown as raw integers,
+since plugin memory isn't read when writing binary strace files. Syscalls
+that were run natively are shown with the return value '<native>'.
+"""
+
+# see write_syscall_binary() in src/main/host/syscall/formatter.rs
+MAGIC = b"SHDWSTR\x01"
+RECORD = struct.Struct('<QIq6QBq')
+UNISTD_PATHS = ['/usr/include/x86_64-linux-gnu/asm/unistd_64.h', '/usr/include/asm/unistd_64.h']
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=DESCRIPTION,
+        formatter_class=argparse.RawTextHelpFormatter)
+
+    parser.add_argument(
+        help="The PATH to a binary strace file, which may be '-' for STDIN",
+        metavar="PATH",
+        action="store", dest="path")
+
+    parser.add_argument('--no-sort',
+        help="""Write the syscalls in the order they're stored in the file. By
+default they're sorted by time, since processes that were forked
+from one another share a file and write to it in batches""",
+        action="store_true", dest="no_sort",
+        default=False)
+
+    args = parser.parse_args()
+
+    names = syscall_names()
+
+    source = sys.stdin.buffer if args.path == '-' else open(args.path, 'rb')
+    if source.read(len(MAGIC)) != MAGIC:
+        print("{0} is not a binary strace file".format(args.path), file=sys.stderr)
+        return 1
+
+    records = read_records(source)
+    if not args.no_sort: records = sorted(records, key=lambda r: r[0])
+
+    for record in records: sys.stdout.write(format_record(record, names))
+
+    if source is not sys.stdin.buffer: source.close()
+    return 0
+
+def syscall_names():
+    names = {}
+    for path in UNISTD_PATHS:
+        if not os.path.exists(path): continue
+        with open(path, 'r') as f:
+            for line in f:
+                m = re.match(r'#define __NR_(\w+)\s+(\d+)', line)
+                if m is not None: names[int(m.group(2))] = m.group(1)
+        break
+    return names
+
+def read_records(source):
+    records = []
+    while True:
+        buf = source.read(RECORD.size)
+        if len(buf) == 0: break
+        if len(buf) != RECORD.size:
+            print("ignoring truncated record at the end of the file", file=sys.stderr)
+            break
+        records.append(RECORD.unpack(buf))
+    return records
+
+def format_record(record, names):
+    sim_nanos, tid, number = record[0], record[1], record[2]
+    args, native, rv = record[3:9], record[9], record[10]
+
+    secs, nanos = divmod(sim_nanos, 10**9)
+    mins, secs = divmod(secs, 60)
+    hours, mins = divmod(mins, 60)
+
+    name = names.get(number, "syscall_{0}".format(number))
+    args = ", ".join(str(x) if x < 2**32 else hex(x) for x in args)
+
+    if native: rv = "<native>"
+    elif -4096 < rv < 0 and -rv in errno.errorcode: rv = "{0} ({1})".format(rv, errno.errorcode[-rv])
+    else: rv = str(rv)
+
+    return "{0:02}:{1:02}:{2:02}.{3:09} [tid {4}] {5}({6}) = {7}\n".format(
+        hours, mins, secs, nanos, tid, name, args, rv)
+
+if __name__ == '__main__': sys.exit(main())
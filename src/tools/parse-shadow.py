@@ -1,7 +1,7 @@
 #!/usr/bin/env python3
 
 from __future__ import print_function
-import sys, os, argparse, re, json, itertools
+import sys, os, argparse, re, json, itertools, struct
 from multiprocessing import Pool, cpu_count
 from subprocess import Popen, PIPE
 from signal import signal, SIGINT, SIG_IGN
@@ -28,7 +28,11 @@ $ xzcat shadow.log.xz | python parse-shadow.py -
 
 The default mode is to filter and parse the log file using a single
 process; this will be done with multiple worker processes when passing
-the '-m' option.\n
+the '-m' option.
+
+Logs written with Shadow's binary log format (experimental.log_format) are
+detected and decoded automatically. To convert a binary log to text:
+$ python parse-shadow.py --decode shadow.log > shadow.log.txt\n
 """
 
 SHADOWJSON="stats.shadow.json"
@@ -38,6 +42,9 @@ LABELS = ['packets_total', 'bytes_total',
     'packets_data', 'bytes_data_header', 'bytes_data_payload',
     'packets_data_retrans', 'bytes_data_header_retrans', 'bytes_data_payload_retrans']
 NUMLINES=10000
+# see src/main/core/logger/binary_log.rs
+BINLOG_MAGIC = b"SHDWLOG\x01"
+BINLOG_LEVELS = {1:'ERROR', 2:'WARN', 3:'INFO', 4:'DEBUG', 5:'TRACE'}
 
 def main():
     parser = argparse.ArgumentParser(
@@ -70,6 +77,12 @@ files generated by this script will be written""",
         action="store_true", dest="tee",
         default=False)
 
+    parser.add_argument('--decode',
+        help="""Write the log input to stdout as text and exit, which
+converts a binary log to the text format""",
+        action="store_true", dest="decode",
+        default=False)
+
     parser.add_argument('--packet-data',
         help="Include packets/sec data in addition to bytes/sec data in the "
         "shadow stats output at the cost of greatly increased processing time, "
@@ -85,12 +98,17 @@ def run(args):
     print("processing input from {0}...".format(args.logpath), file=sys.stderr)
     source, xzproc = source_prepare(args.logpath)
 
+    if args.decode:
+        for line in log_lines(source): sys.stdout.write(line)
+        source_cleanup(args.logpath, source, xzproc)
+        return
+
     d = {'ticks':{}, 'nodes':{}}
     m = {'mem':0, 'hours':0}
     p = Pool(args.nprocesses)
     try:
         lines = []
-        for line in source:
+        for line in log_lines(source):
             if args.tee: sys.stdout.write(line)
             lines.append(line)
             if len(lines) > args.nprocesses*NUMLINES:
@@ -251,18 +269,83 @@ def type_nonnegative_integer(value):
 def source_prepare(filename):
     source, xzproc = None, None
     if filename == '-':
-        source = sys.stdin
+        source = sys.stdin.buffer
     elif filename.endswith(".xz"):
         xzproc = Popen(["xz", "--decompress", "--stdout", filename], stdout=PIPE)
         source = xzproc.stdout
     else:
-        source = open(filename, 'r')
+        source = open(filename, 'rb')
     return source, xzproc
 
 def source_cleanup(filename, source, xzproc):
     if xzproc is not None: xzproc.wait()
     elif filename != '-': source.close()
 
+def log_lines(source):
+    # yields the text lines of a binary or text log read from a binary stream
+    head = source.read(len(BINLOG_MAGIC))
+    if head == BINLOG_MAGIC:
+        for line in binary_log_lines(source): yield line
+        return
+    for line in (head + source.readline()).splitlines(True): yield line.decode('utf-8', 'replace')
+    for line in source: yield line.decode('utf-8', 'replace')
+
+def binary_log_lines(source):
+    # yields the binary log entries as lines in the same format as shadow's text logs
+    def read(fmt):
+        size = struct.calcsize(fmt)
+        buf = source.read(size)
+        if len(buf) != size: raise EOFError("truncated binary log")
+        return struct.unpack(fmt, buf)[0]
+    def read_str():
+        n = read('<I')
+        if n == 0xffffffff: return None
+        buf = source.read(n)
+        if len(buf) != n: raise EOFError("truncated binary log")
+        return buf.decode('utf-8', 'replace')
+    def fmt_time(total, frac_per_sec, frac_digits):
+        secs, frac = divmod(total, frac_per_sec)
+        mins, secs = divmod(secs, 60)
+        hours, mins = divmod(mins, 60)
+        return "{0:02}:{1:02}:{2:02}.{3:0{4}}".format(hours, mins, secs, frac, frac_digits)
+
+    callsites, hosts, threads = {}, {}, {}
+    while True:
+        kind = source.read(1)
+        if len(kind) == 0: return
+        kind = kind[0]
+        if kind == 1:
+            level = read('<B')
+            callsite_id = read('<I')
+            path = read_str()
+            lineno = read('<I')
+            module = read_str()
+            filename = path[path.rfind('/')+1:] if path is not None else 'n/a'
+            lineno = str(lineno) if lineno != 0xffffffff else 'n/a'
+            callsites[callsite_id] = (BINLOG_LEVELS[level], filename, lineno, module or 'n/a')
+        elif kind == 2:
+            host_id = read('<I')
+            name = read_str()
+            ip = read_str()
+            hosts[host_id] = "{0}:{1}".format(name, ip)
+        elif kind == 3:
+            tid = read('<I')
+            threads[tid] = read_str()
+        elif kind == 4:
+            level, filename, lineno, module = callsites[read('<I')]
+            wall_micros = read('<Q')
+            sim_nanos = read('<Q')
+            tid = read('<I')
+            host_id = read('<I')
+            msg = read_str()
+            sim = fmt_time(sim_nanos, 10**9, 9) if sim_nanos != 0xffffffffffffffff else 'n/a'
+            host = hosts[host_id] if host_id != 0xffffffff else 'n/a'
+            yield "{0} [{1}:{2}] {3} [{4}] [{5}] [{6}:{7}] [{8}] {9}\n".format(
+                fmt_time(wall_micros, 10**6, 6), tid, threads[tid], sim, level, host,
+                filename, lineno, module, msg)
+        else:
+            raise ValueError("unknown binary log entry kind {0}".format(kind))
+
 def timestamp_to_seconds(stamp):
     parts = stamp.split(":")
     h, m, s = int(parts[0]), int(parts[1]), float(parts[2])
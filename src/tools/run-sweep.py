@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+
+import sys, os, argparse, glob, subprocess, time
+
+DESCRIPTION="""
+Runs many small Shadow simulations at the same time, each pinned to its own
+set of physical cores, so that a sweep of simulations that are each too small
+to use the whole machine can keep every core busy:
+
+$ python run-sweep.py --parallelism 4 sweep/*.yaml
+
+The cores that this script may use (see taskset(1)) are divided into slots of
+PARALLELISM cores, using one CPU per physical core and keeping each slot on a
+single NUMA node when possible. Each simulation runs in the directory of its
+config file with Shadow's CPU pinning enabled, writes its data to
+'<config name>.data', and writes its stdout and stderr to '<config name>.log'.
+When a simulation finishes, the next one is started in its slot.
+
+Arguments after '--' are passed to each Shadow process.
+"""
+
+def main():
+    argv = sys.argv[1:]
+    shadow_args = []
+    if '--' in argv:
+        i = argv.index('--')
+        argv, shadow_args = argv[:i], argv[i + 1:]
+
+    parser = argparse.ArgumentParser(
+        description=DESCRIPTION,
+        formatter_class=argparse.RawTextHelpFormatter)
+
+    parser.add_argument(
+        help="The PATHs to the simulations' config files",
+        metavar="PATH", nargs='+',
+        action="store", dest="configs")
+
+    parser.add_argument('-p', '--parallelism',
+        help="Run each simulation with this many worker threads, each on its own physical core",
+        metavar="CORES", type=int,
+        action="store", dest="parallelism",
+        default=1)
+
+    parser.add_argument('--shadow',
+        help="The PATH to the Shadow executable",
+        metavar="PATH",
+        action="store", dest="shadow",
+        default="shadow")
+
+    args = parser.parse_args(argv)
+
+    slots = cpu_slots(args.parallelism)
+    if len(slots) == 0:
+        print("There are fewer than {} physical cores available".format(args.parallelism), file=sys.stderr)
+        return 1
+    print("Running {} simulations, {} at a time".format(len(args.configs), len(slots)))
+
+    pending = list(args.configs)
+    running = {}
+    failed = []
+    while len(pending) > 0 or len(running) > 0:
+        # start a simulation in each free slot
+        for slot in slots:
+            if len(pending) == 0:
+                break
+            if tuple(slot) not in running:
+                config = pending.pop(0)
+                running[tuple(slot)] = (config, start(args.shadow, config, slot, args.parallelism, shadow_args), time.monotonic())
+
+        time.sleep(0.5)
+
+        for slot, (config, proc, start_time) in list(running.items()):
+            rc = proc.poll()
+            if rc is None:
+                continue
+            del running[slot]
+            print("{} {} after {:.0f}s (exit code {})".format(
+                config, "finished" if rc == 0 else "FAILED", time.monotonic() - start_time, rc))
+            if rc != 0:
+                failed.append(config)
+
+    if len(failed) > 0:
+        print("{} of {} simulations failed: {}".format(len(failed), len(args.configs), ' '.join(failed)), file=sys.stderr)
+        return 1
+    return 0
+
+def start(shadow, config, cpus, parallelism, shadow_args):
+    config = os.path.abspath(config)
+    directory = os.path.dirname(config)
+    name = os.path.splitext(os.path.basename(config))[0]
+
+    cmd = [shadow, '--parallelism', str(parallelism), '--data-directory', name + '.data'] + shadow_args + [config]
+    log = open(os.path.join(directory, name + '.log'), 'w')
+    # shadow only pins its threads to CPUs within its initial affinity
+    return subprocess.Popen(cmd, cwd=directory, stdout=log, stderr=subprocess.STDOUT,
+        preexec_fn=lambda: os.sched_setaffinity(0, cpus))
+
+def read_int(path):
+    with open(path) as f:
+        return int(f.read().strip())
+
+def cpu_slots(parallelism):
+    # one CPU per physical core, grouped by NUMA node
+    cores = {}
+    for cpu in sorted(os.sched_getaffinity(0)):
+        topology = '/sys/devices/system/cpu/cpu{}/topology/'.format(cpu)
+        core = (read_int(topology + 'physical_package_id'), read_int(topology + 'core_id'))
+        nodes = glob.glob('/sys/devices/system/cpu/cpu{}/node*'.format(cpu))
+        node = int(os.path.basename(nodes[0])[len('node'):]) if len(nodes) > 0 else 0
+        cores.setdefault(core, (node, cpu))
+
+    by_node = {}
+    for node, cpu in sorted(cores.values()):
+        by_node.setdefault(node, []).append(cpu)
+
+    slots = []
+    leftover = []
+    for node in sorted(by_node):
+        cpus = by_node[node]
+        while len(cpus) >= parallelism:
+            slots.append(cpus[:parallelism])
+            cpus = cpus[parallelism:]
+        leftover += cpus
+
+    # slots made of the remaining cores of several nodes
+    while len(leftover) >= parallelism:
+        slots.append(leftover[:parallelism])
+        leftover = leftover[parallelism:]
+
+    return slots
+
+if __name__ == '__main__': sys.exit(main())
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+
+import sys, os, argparse, glob, mmap, struct, time
+
+DESCRIPTION="""
+Shows the progress of a running simulation from the live metrics that Shadow
+publishes when experimental.live_metrics is enabled:
+
+$ python shadow-top.py /dev/shm/shadow-live-metrics-1234
+
+The path can be omitted if only one simulation is running. The display is
+refreshed every interval until the simulation ends.
+"""
+
+# see src/main/core/live_metrics.rs
+MAGIC = struct.unpack('<I', b"SHTP")[0]
+VERSION = 1
+HEADER = struct.Struct('<IIII')
+SEQ = struct.Struct('<Q')
+SEQ_OFFSET = 16
+FIELDS = struct.Struct('<7Q')
+FIELDS_OFFSET = 24
+THREAD = struct.Struct('<QQ')
+THREADS_OFFSET = 128
+THREAD_SIZE = 64
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=DESCRIPTION,
+        formatter_class=argparse.RawTextHelpFormatter)
+
+    parser.add_argument(
+        help="The PATH to a live metrics file",
+        metavar="PATH", nargs='?',
+        action="store", dest="path")
+
+    parser.add_argument('-i', '--interval',
+        help="Refresh the display every this many SECONDS",
+        metavar="SECONDS", type=float,
+        action="store", dest="interval",
+        default=1.0)
+
+    args = parser.parse_args()
+
+    path = args.path
+    if path is None:
+        paths = glob.glob('/dev/shm/shadow-live-metrics-*')
+        if len(paths) != 1:
+            print("Found {} live metrics files, please choose one: {}".format(len(paths), ' '.join(paths)), file=sys.stderr)
+            return 1
+        path = paths[0]
+
+    with open(path, 'rb') as f:
+        m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+    magic, version, num_threads, _ = HEADER.unpack_from(m, 0)
+    if magic != MAGIC:
+        print("'{}' isn't a live metrics file".format(path), file=sys.stderr)
+        return 1
+    if version != VERSION:
+        print("'{}' has version {}, but this tool reads version {}".format(path, version, VERSION), file=sys.stderr)
+        return 1
+
+    prev = None
+    try:
+        while os.path.exists(path):
+            cur = read_metrics(m, num_threads)
+            if prev is not None:
+                show(path, prev, cur)
+            prev = cur
+            time.sleep(args.interval)
+    except KeyboardInterrupt:
+        pass
+
+    return 0
+
+def read_metrics(m, num_threads):
+    # the manager updates the fields inside a seqlock, so retry until we copy them between updates
+    while True:
+        seq = SEQ.unpack_from(m, SEQ_OFFSET)[0]
+        if seq % 2 == 1:
+            time.sleep(0.001)
+            continue
+        data = m[:THREADS_OFFSET + num_threads * THREAD_SIZE]
+        if SEQ.unpack_from(m, SEQ_OFFSET)[0] == seq:
+            break
+
+    metrics = dict(zip(['sim_ns', 'end_ns', 'real_ns', 'rounds', 'hosts_active', 'hosts', 'rss'],
+                       FIELDS.unpack_from(data, FIELDS_OFFSET)))
+    metrics['wall'] = time.monotonic()
+    metrics['threads'] = [THREAD.unpack_from(data, THREADS_OFFSET + i * THREAD_SIZE) for i in range(num_threads)]
+    return metrics
+
+def show(path, prev, cur):
+    wall = cur['wall'] - prev['wall']
+    real = (cur['real_ns'] - prev['real_ns']) / 1e9
+    sim = (cur['sim_ns'] - prev['sim_ns']) / 1e9
+
+    lines = []
+    lines.append("{}".format(path))
+    lines.append("sim time:   {:.3f}s of {:.3f}s ({:.1f}%)".format(
+        cur['sim_ns'] / 1e9, cur['end_ns'] / 1e9,
+        100 * cur['sim_ns'] / cur['end_ns'] if cur['end_ns'] > 0 else 0))
+    lines.append("real time:  {:.1f}s".format(cur['real_ns'] / 1e9))
+    lines.append("sim/real:   {:.3f}".format(sim / real if real > 0 else 0))
+    lines.append("rounds/s:   {:.1f}".format((cur['rounds'] - prev['rounds']) / wall))
+    lines.append("hosts:      {} active of {}".format(cur['hosts_active'], cur['hosts']))
+    lines.append("syscalls/s: {:.0f}".format(
+        sum(c[1] - p[1] for c, p in zip(cur['threads'], prev['threads'])) / wall))
+    lines.append("rss:        {:.1f} MiB".format(cur['rss'] / 2**20))
+    lines.append("")
+    lines.append("thread  busy  syscalls/s")
+    for i, (c, p) in enumerate(zip(cur['threads'], prev['threads'])):
+        busy = (c[0] - p[0]) / 1e9 / real if real > 0 else 0
+        lines.append("{:>6}  {:>3.0f}%  {:>10.0f}".format(i, 100 * busy, (c[1] - p[1]) / wall))
+
+    # clear the terminal and redraw
+    sys.stdout.write("\033[H\033[J" + "\n".join(lines) + "\n")
+    sys.stdout.flush()
+
+if __name__ == '__main__': sys.exit(main())